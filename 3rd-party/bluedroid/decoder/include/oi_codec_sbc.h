@@ -122,6 +122,25 @@ Declarations of codec functions, data types, and macros.
 
 typedef OI_INT16 SBC_BUFFER_T;
 
+/* BK4BTSTACK_CHANGE START */
+/* Set OI_SBC_SIMD_OPT to TRUE to enable the AVX2/NEON kernels for the 8 subband synthesis window.
+   Off by default as test/sbc/sbc_simd_benchmark shows no measurable gain over the scalar code */
+#ifndef OI_SBC_SIMD_OPT
+#define OI_SBC_SIMD_OPT FALSE
+#endif
+
+/* kernel set used by the synthesis filter, the decoder reset selects the best one supported by the CPU */
+#define OI_SBC_SIMD_NONE 0
+#define OI_SBC_SIMD_AVX2 2
+#define OI_SBC_SIMD_NEON 3
+
+#if (OI_SBC_SIMD_OPT == TRUE) && ((defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || defined(__ARM_NEON))
+#define OI_SBC_SIMD_AVAILABLE TRUE
+#else
+#define OI_SBC_SIMD_AVAILABLE FALSE
+#endif
+/* BK4BTSTACK_CHANGE END */
+
 
 /** Used internally. */
 typedef struct {
@@ -175,6 +194,9 @@ typedef struct {
     OI_BYTE formatByte;
     OI_UINT8 pcmStride;
     OI_UINT8 maxChannels;
+/* BK4BTSTACK_CHANGE START */
+    OI_UINT8 simdLevel;     /**< OI_SBC_SIMD_xxx, can be lowered after decoder reset */
+/* BK4BTSTACK_CHANGE END */
 } OI_CODEC_SBC_COMMON_CONTEXT;
 
 
@@ -72,6 +72,9 @@ INLINE OI_STATUS internal_DecoderReset(OI_CODEC_SBC_DECODER_CONTEXT *context,
     context->common.maxBitneed = 0;
     context->limitFrameFormat = FALSE;
     OI_SBC_ExpandFrameFields(&context->common.frameInfo);
+    /* BK4BTSTACK_CHANGE START */
+    context->common.simdLevel = OI_SBC_SynthSimdLevel();
+    /* BK4BTSTACK_CHANGE END */
 
     /*PLATFORM_DECODER_RESET(context);*/
 
@@ -256,6 +256,192 @@ typedef void (*SYNTH_FRAME)(OI_CODEC_SBC_DECODER_CONTEXT *context, OI_INT16 *pcm
 #define SYNTH112 SynthWindow112_generated
 #endif
 
+/* BK4BTSTACK_CHANGE START */
+/*
+ * Vectorized SynthWindow80_generated: the eight output samples are computed in parallel.
+ *
+ * Output n sums products of buffer[A[n] + 16*m] ("even" terms) and buffer[B[n] + 16*m]
+ * ("odd" terms) for m = 0..4, with A = { 12, 5, 6, 7, 8, 7, 6, 5 } and
+ * B = { 20, 11, 10, 9, -, 9, 10, 11 }. Apart from lane 0 of the odd terms, all samples
+ * of row m lie within buffer[16*m + 5 .. 16*m + 12] and are gathered with a byte shuffle.
+ * Each product is shifted by a per-lane amount (left if positive, arithmetic right if
+ * negative) and accumulated with 32 bit wrap-around, which matches the scalar code exactly.
+ * Outputs without a term in a row use a zero coefficient.
+ */
+typedef void (*SYNTH_WINDOW)(OI_INT16 *pcm, SBC_BUFFER_T const * RESTRICT buffer, OI_UINT strideShift);
+
+#if (OI_SBC_SIMD_AVAILABLE == TRUE)
+
+/* the x86 kernels are AVX2 only, they use the GCC/Clang target attribute and a runtime CPU check */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define OI_SBC_SIMD_X86
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#define OI_SBC_SIMD_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+static const OI_INT32 synth80EvenCoef[5][8] = {
+    {   8235,  -3263, -10385, -16457,  10445,  16913,  11167,   9293 },
+    {  26479,  -5229,   -309, -23641,  -5297,   3687,   1917,   1247 },
+    {   9399, -27021, -23063, -12889,  22299,  15447,   8317,  23671 },
+    {  26479,  17319,   2309,  24211,  10603, -18233,  22117,  11537 },
+    {   8235,   4555,   6239,  21223,   9539,   1499,   7543,    685 }
+};
+static const OI_INT32 synth80EvenShift[5][8] = {
+    {     -3,     -5,     -6,     -6,     -4,     -5,     -4,     -3 },
+    {     -2,      0,      4,     -2,      1,      1,      2,      3 },
+    {      3,      1,      1,      2,      2,      2,      3,      2 },
+    {     -2,      1,      3,     -1,      0,     -3,     -4,     -1 },
+    {     -3,     -1,     -3,     -8,     -4,     -1,     -3,      1 }
+};
+static const OI_INT32 synth80OddCoef[5][8] = {
+    { -23167,  29293,  24995,  19083,      0,  -8443, -10337,  -6087 },
+    { -17397,  30835,   9161, -29015,      0,   -301, -30605,  -2893 },
+    {  17397,  31633,  27561,   6145,      0,  10255,   9553,  18055 },
+    {  23167,  26663,  12705,  23469,      0,   9405,  16383,   1747 },
+    {      0,  12419,   9251,  26913,      0,  26189,   8603,   8721 }
+};
+static const OI_INT32 synth80OddShift[5][8] = {
+    {     -3,     -5,     -5,     -5,      0,     -7,     -4,     -2 },
+    {      1,     -3,     -3,     -4,      0,      5,     -1,      3 },
+    {      1,      1,      1,      3,      0,      2,      2,      1 },
+    {     -3,     -2,     -1,     -2,      0,     -1,     -2,      1 },
+    {      0,     -4,     -4,     -6,      0,     -7,     -6,     -7 }
+};
+
+/* the final pcm = acc / 32768 rounds towards zero as in C and saturates to 16 bit */
+#ifdef OI_SBC_SIMD_X86
+__attribute__((target("avx2")))
+static inline __m256i SynthTerm_AVX2(__m256i x, const OI_INT32 *coef, const OI_INT32 *shift)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i s = _mm256_loadu_si256((const __m256i *)shift);
+    __m256i p = _mm256_mullo_epi32(x, _mm256_loadu_si256((const __m256i *)coef));
+    p = _mm256_sllv_epi32(p, _mm256_max_epi32(s, zero));
+    return _mm256_srav_epi32(p, _mm256_max_epi32(_mm256_sub_epi32(zero, s), zero));
+}
+
+__attribute__((target("avx2")))
+static void SynthWindow80_AVX2(OI_INT16 *pcm, SBC_BUFFER_T const * RESTRICT buffer, OI_UINT strideShift)
+{
+    const __m128i evenIdx = _mm_setr_epi8(14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 4, 5, 2, 3, 0, 1);
+    const __m128i oddIdx  = _mm_setr_epi8(-1, -1, 12, 13, 10, 11, 8, 9, -1, -1, 8, 9, 10, 11, 12, 13);
+    __m256i acc = _mm256_setzero_si256();
+    __m128i out;
+    OI_INT16 tmp[8];
+    OI_UINT m;
+    OI_UINT i;
+
+    for (m = 0; m < 5; m++) {
+        __m128i l = _mm_loadu_si128((const __m128i *)(buffer + 16 * m + 5));
+        __m128i e = _mm_shuffle_epi8(l, evenIdx);
+        __m128i o = _mm_shuffle_epi8(l, oddIdx);
+        if (m < 4) {
+            o = _mm_insert_epi16(o, buffer[16 * m + 20], 0);
+        }
+        acc = _mm256_add_epi32(acc, SynthTerm_AVX2(_mm256_cvtepi16_epi32(e), synth80EvenCoef[m], synth80EvenShift[m]));
+        acc = _mm256_add_epi32(acc, SynthTerm_AVX2(_mm256_cvtepi16_epi32(o), synth80OddCoef[m], synth80OddShift[m]));
+    }
+    acc = _mm256_add_epi32(acc, _mm256_srli_epi32(_mm256_srai_epi32(acc, 31), 17));
+    acc = _mm256_srai_epi32(acc, 15);
+    out = _mm_packs_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    if (strideShift == 0) {
+        _mm_storeu_si128((__m128i *)pcm, out);
+        return;
+    }
+    _mm_storeu_si128((__m128i *)tmp, out);
+    for (i = 0; i < 8; i++) {
+        pcm[i << strideShift] = tmp[i];
+    }
+}
+#endif /* OI_SBC_SIMD_X86 */
+
+#ifdef OI_SBC_SIMD_NEON_KERNELS
+static inline int32x4_t SynthTerm_NEON(int16x4_t x, const OI_INT32 *coef, const OI_INT32 *shift)
+{
+    return vshlq_s32(vmulq_s32(vmovl_s16(x), vld1q_s32(coef)), vld1q_s32(shift));
+}
+
+static void SynthWindow80_NEON(OI_INT16 *pcm, SBC_BUFFER_T const * RESTRICT buffer, OI_UINT strideShift)
+{
+    static const OI_UINT8 evenIdx[16] = { 14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 4, 5, 2, 3, 0, 1 };
+    static const OI_UINT8 oddIdx[16]  = { 255, 255, 12, 13, 10, 11, 8, 9, 255, 255, 8, 9, 10, 11, 12, 13 };
+    const uint8x8_t evenLo = vld1_u8(evenIdx);
+    const uint8x8_t evenHi = vld1_u8(evenIdx + 8);
+    const uint8x8_t oddLo = vld1_u8(oddIdx);
+    const uint8x8_t oddHi = vld1_u8(oddIdx + 8);
+    int32x4_t accLo = vdupq_n_s32(0);
+    int32x4_t accHi = vdupq_n_s32(0);
+    int16x8_t out;
+    OI_INT16 tmp[8];
+    OI_UINT m;
+    OI_UINT i;
+
+    for (m = 0; m < 5; m++) {
+        int16x8_t l = vld1q_s16(buffer + 16 * m + 5);
+        uint8x8x2_t t;
+        int16x4_t o;
+        t.val[0] = vreinterpret_u8_s16(vget_low_s16(l));
+        t.val[1] = vreinterpret_u8_s16(vget_high_s16(l));
+        o = vreinterpret_s16_u8(vtbl2_u8(t, oddLo));
+        if (m < 4) {
+            o = vset_lane_s16(buffer[16 * m + 20], o, 0);
+        }
+        accLo = vaddq_s32(accLo, SynthTerm_NEON(vreinterpret_s16_u8(vtbl2_u8(t, evenLo)), &synth80EvenCoef[m][0], &synth80EvenShift[m][0]));
+        accHi = vaddq_s32(accHi, SynthTerm_NEON(vreinterpret_s16_u8(vtbl2_u8(t, evenHi)), &synth80EvenCoef[m][4], &synth80EvenShift[m][4]));
+        accLo = vaddq_s32(accLo, SynthTerm_NEON(o, &synth80OddCoef[m][0], &synth80OddShift[m][0]));
+        accHi = vaddq_s32(accHi, SynthTerm_NEON(vreinterpret_s16_u8(vtbl2_u8(t, oddHi)), &synth80OddCoef[m][4], &synth80OddShift[m][4]));
+    }
+    accLo = vaddq_s32(accLo, vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(vshrq_n_s32(accLo, 31)), 17)));
+    accHi = vaddq_s32(accHi, vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(vshrq_n_s32(accHi, 31)), 17)));
+    out = vcombine_s16(vqmovn_s32(vshrq_n_s32(accLo, 15)), vqmovn_s32(vshrq_n_s32(accHi, 15)));
+    if (strideShift == 0) {
+        vst1q_s16(pcm, out);
+        return;
+    }
+    vst1q_s16(tmp, out);
+    for (i = 0; i < 8; i++) {
+        pcm[i << strideShift] = tmp[i];
+    }
+}
+#endif /* OI_SBC_SIMD_NEON_KERNELS */
+
+#endif /* OI_SBC_SIMD_AVAILABLE */
+
+PRIVATE OI_UINT8 OI_SBC_SynthSimdLevel(void)
+{
+#if (OI_SBC_SIMD_AVAILABLE == TRUE)
+#ifdef OI_SBC_SIMD_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return OI_SBC_SIMD_AVX2;
+    }
+#endif
+#ifdef OI_SBC_SIMD_NEON_KERNELS
+    return OI_SBC_SIMD_NEON;
+#endif
+#endif
+    return OI_SBC_SIMD_NONE;
+}
+
+static SYNTH_WINDOW SynthWindow80Kernel(OI_UINT8 simdLevel)
+{
+    switch (simdLevel) {
+#ifdef OI_SBC_SIMD_X86
+        case OI_SBC_SIMD_AVX2:
+            return SynthWindow80_AVX2;
+#endif
+#ifdef OI_SBC_SIMD_NEON_KERNELS
+        case OI_SBC_SIMD_NEON:
+            return SynthWindow80_NEON;
+#endif
+        default:
+            return SYNTH80;
+    }
+}
+/* BK4BTSTACK_CHANGE END */
+
 PRIVATE void OI_SBC_SynthFrame_80(OI_CODEC_SBC_DECODER_CONTEXT *context, OI_INT16 *pcm, OI_UINT blkstart, OI_UINT blkcount);
 PRIVATE void OI_SBC_SynthFrame_80(OI_CODEC_SBC_DECODER_CONTEXT *context, OI_INT16 *pcm, OI_UINT blkstart, OI_UINT blkcount)
 {
@@ -266,6 +452,9 @@ PRIVATE void OI_SBC_SynthFrame_80(OI_CODEC_SBC_DECODER_CONTEXT *context, OI_INT1
     OI_UINT offset = context->common.filterBufferOffset;
     OI_INT32 *s = context->common.subdata + 8 * nrof_channels * blkstart;
     OI_UINT blkstop = blkstart + blkcount;
+    /* BK4BTSTACK_CHANGE START */
+    SYNTH_WINDOW synth80 = SynthWindow80Kernel(context->common.simdLevel);
+    /* BK4BTSTACK_CHANGE END */
 
     for (blk = blkstart; blk < blkstop; blk++) {
         if (offset == 0) {
@@ -280,7 +469,7 @@ PRIVATE void OI_SBC_SynthFrame_80(OI_CODEC_SBC_DECODER_CONTEXT *context, OI_INT1
 
         for (ch = 0; ch < nrof_channels; ch++) {
             DCT2_8(context->common.filterBuffer[ch] + offset, s);
-            SYNTH80(pcm + ch, context->common.filterBuffer[ch] + offset, pcmStrideShift);
+            synth80(pcm + ch, context->common.filterBuffer[ch] + offset, pcmStrideShift);
             s += 8;
         }
         pcm += (8 << pcmStrideShift);
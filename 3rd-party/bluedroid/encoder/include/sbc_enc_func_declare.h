@@ -40,7 +40,13 @@ extern const SINT32 gas32CoeffFor8SBs[];
 extern void sbc_enc_bit_alloc_mono(SBC_ENC_PARAMS *CodecParams);
 extern void sbc_enc_bit_alloc_ste(SBC_ENC_PARAMS *CodecParams);
 
-extern void SbcAnalysisInit (void);
+/* BK4BTSTACK_CHANGE START */
+extern void SbcAnalysisInit (SBC_ENC_PARAMS *strEncParams);
+extern SINT16 SbcAnalysisSimdLevel (void);
+#if (SBC_SIMD_AVAILABLE == TRUE)
+extern void SbcFastIDCT8Simd (SINT16 s16SimdLevel, SINT32 *pInVect, SINT32 *pOutVect, SINT32 s32NumOfDCTs);
+#endif
+/* BK4BTSTACK_CHANGE END */
 
 extern void SbcAnalysisFilter4(SBC_ENC_PARAMS *strEncParams);
 extern void SbcAnalysisFilter8(SBC_ENC_PARAMS *strEncParams);
@@ -147,6 +147,28 @@
 /*#define ENC_VX_BUFFER_SIZE MINIMUM_ENC_VX_BUFFER_SIZE + 1024*/
 #endif
 
+/* BK4BTSTACK_CHANGE START */
+/* Set SBC_SIMD_OPT to FALSE to disable the SSE2/AVX2/NEON kernels for windowing and DCT in the analysis filter */
+#ifndef SBC_SIMD_OPT
+#define SBC_SIMD_OPT TRUE
+#endif
+
+/* kernel set used by the analysis filter, SBC_Encoder_Init selects the best one supported by the CPU */
+#define SBC_SIMD_NONE 0
+#define SBC_SIMD_SSE2 1
+#define SBC_SIMD_AVX2 2
+#define SBC_SIMD_NEON 3
+
+/* the kernels are bit-exact with the default 32 bit fixed-point configuration only */
+#if (SBC_SIMD_OPT == TRUE) && (SBC_IPAQ_OPT == TRUE) && (SBC_ARM_ASM_OPT == FALSE) && (SBC_FAST_DCT == TRUE) && \
+    (SBC_IS_64_MULT_IN_WINDOW_ACCU == FALSE) && (SBC_IS_64_MULT_IN_IDCT == FALSE) && \
+    ((defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))) || defined(__ARM_NEON))
+#define SBC_SIMD_AVAILABLE TRUE
+#else
+#define SBC_SIMD_AVAILABLE FALSE
+#endif
+/* BK4BTSTACK_CHANGE END */
+
 #ifndef SBC_FOR_EMBEDDED_LINUX
 #define SBC_FOR_EMBEDDED_LINUX FALSE
 #endif
@@ -196,6 +218,21 @@ typedef struct SBC_ENC_PARAMS_TAG
     UINT16 u16PacketLength;
     /* BK4BTSTACK_CHANGE START */
     UINT8  mSBCEnabled;
+
+    /* analysis filter and joint stereo state, kept per encoder instance */
+    SINT32 as32X[ENC_VX_BUFFER_SIZE/2];             /* used as SINT16 array, must be 32 bits aligned cf SHIFTUP_X8_2 */
+#if (SBC_SIMD_AVAILABLE == TRUE)
+    SINT32 as32DCTY[16*SBC_MAX_NUM_OF_BLOCKS*SBC_MAX_NUM_OF_CHANNELS];    /* windowed samples of all blocks for batched DCT */
+#else
+    SINT32 as32DCTY[16];
+#endif
+    SINT16 s16ShiftCounter;
+    SINT16 s16EncMaxShiftCounter;
+    SINT16 s16SimdLevel;                            /* SBC_SIMD_xxx, can be lowered after SBC_Encoder_Init */
+#if (SBC_JOINT_STE_INCLUDED == TRUE)
+    SINT32 as32LRDiff[SBC_MAX_NUM_OF_BLOCKS];
+    SINT32 as32LRSum[SBC_MAX_NUM_OF_BLOCKS];
+#endif
     /* BK4BTSTACK_CHANGE END */
 }SBC_ENC_PARAMS;
 
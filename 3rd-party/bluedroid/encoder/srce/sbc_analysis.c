@@ -153,15 +153,13 @@
 #define WIND_8_SUBBANDS_8_2 (SINT16)0x12CF  /* 40 = 0x12CF6C75 */
 #endif
 
-#if (SBC_USE_ARM_PRAGMA==TRUE)
-#pragma arm section zidata = "sbc_s32_analysis_section"
-#endif
-static SINT32   s32DCTY[16]  = {0};
-static SINT32   s32X[ENC_VX_BUFFER_SIZE/2];
-static SINT16   *s16X=(SINT16*) s32X;      /* s16X must be 32 bits aligned cf  SHIFTUP_X8_2*/
-#if (SBC_USE_ARM_PRAGMA==TRUE)
-#pragma arm section zidata
-#endif
+/* BK4BTSTACK_CHANGE START */
+/* analysis filter state is stored in SBC_ENC_PARAMS to allow for multiple encoder instances */
+#define s32DCTY             (pstrEncParams->as32DCTY)
+#define s16X                ((SINT16*) pstrEncParams->as32X)      /* s16X must be 32 bits aligned cf  SHIFTUP_X8_2*/
+#define ShiftCounter        (pstrEncParams->s16ShiftCounter)
+#define EncMaxShiftCounter  (pstrEncParams->s16EncMaxShiftCounter)
+/* BK4BTSTACK_CHANGE END */
 
 /* This macro is for 4 subbands */
 #define SHIFTUP_X4                                                               \
@@ -897,8 +895,294 @@ static SINT16   *s16X=(SINT16*) s32X;      /* s16X must be 32 bits aligned cf  S
 #endif
 #endif
 
-static SINT16 ShiftCounter=0;
-extern SINT16 EncMaxShiftCounter;
+/* BK4BTSTACK_CHANGE START */
+#if (SBC_SIMD_AVAILABLE == TRUE)
+/*
+ * SIMD windowing
+ *
+ * With 16 bit coefficients, each windowed sample of the 8 subband filter is a sum of five products
+ * accumulated in 32 bit: Y[k] = sum(j=0..4) C[j][k] * s16X[ChOffset+16*j+k], k = 0..15
+ * WINDOW_ACCU_8_0 and WINDOW_ACCU_8_8 add or subtract two samples before the multiplication. As the
+ * accumulation wraps around modulo 2^32, multiplying each sample separately gives the same result.
+ * The 4 subband filter works the same with s16X[ChOffset+8*j+k], k = 0..7.
+ *
+ * The tables hold the coefficient pairs (C[0][k], C[1][k]), (C[2][k], C[3][k]) and (C[4][k], 0) as
+ * used by _mm_madd_epi16.
+ */
+#if defined(__SSE2__)
+#define SBC_SIMD_X86
+#include <immintrin.h>
+/* AVX2 kernels use the GCC/Clang target attribute and a runtime CPU check */
+#if defined(__GNUC__)
+#define SBC_SIMD_AVX2_KERNELS
+#endif
+#endif
+#if defined(__ARM_NEON)
+#define SBC_SIMD_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+static const SINT16 as16Window8Pairs[3][32] =
+{
+    {
+        0, WIND_8_SUBBANDS_0_1,
+        WIND_8_SUBBANDS_1_0, WIND_8_SUBBANDS_1_1,
+        WIND_8_SUBBANDS_2_0, WIND_8_SUBBANDS_2_1,
+        WIND_8_SUBBANDS_3_0, WIND_8_SUBBANDS_3_1,
+        WIND_8_SUBBANDS_4_0, WIND_8_SUBBANDS_4_1,
+        WIND_8_SUBBANDS_5_0, WIND_8_SUBBANDS_5_1,
+        WIND_8_SUBBANDS_6_0, WIND_8_SUBBANDS_6_1,
+        WIND_8_SUBBANDS_7_0, WIND_8_SUBBANDS_7_1,
+        WIND_8_SUBBANDS_8_0, WIND_8_SUBBANDS_8_1,
+        WIND_8_SUBBANDS_7_4, WIND_8_SUBBANDS_7_3,
+        WIND_8_SUBBANDS_6_4, WIND_8_SUBBANDS_6_3,
+        WIND_8_SUBBANDS_5_4, WIND_8_SUBBANDS_5_3,
+        WIND_8_SUBBANDS_4_4, WIND_8_SUBBANDS_4_3,
+        WIND_8_SUBBANDS_3_4, WIND_8_SUBBANDS_3_3,
+        WIND_8_SUBBANDS_2_4, WIND_8_SUBBANDS_2_3,
+        WIND_8_SUBBANDS_1_4, WIND_8_SUBBANDS_1_3,
+    },
+    {
+        WIND_8_SUBBANDS_0_2, -WIND_8_SUBBANDS_0_2,
+        WIND_8_SUBBANDS_1_2, WIND_8_SUBBANDS_1_3,
+        WIND_8_SUBBANDS_2_2, WIND_8_SUBBANDS_2_3,
+        WIND_8_SUBBANDS_3_2, WIND_8_SUBBANDS_3_3,
+        WIND_8_SUBBANDS_4_2, WIND_8_SUBBANDS_4_3,
+        WIND_8_SUBBANDS_5_2, WIND_8_SUBBANDS_5_3,
+        WIND_8_SUBBANDS_6_2, WIND_8_SUBBANDS_6_3,
+        WIND_8_SUBBANDS_7_2, WIND_8_SUBBANDS_7_3,
+        WIND_8_SUBBANDS_8_2, WIND_8_SUBBANDS_8_1,
+        WIND_8_SUBBANDS_7_2, WIND_8_SUBBANDS_7_1,
+        WIND_8_SUBBANDS_6_2, WIND_8_SUBBANDS_6_1,
+        WIND_8_SUBBANDS_5_2, WIND_8_SUBBANDS_5_1,
+        WIND_8_SUBBANDS_4_2, WIND_8_SUBBANDS_4_1,
+        WIND_8_SUBBANDS_3_2, WIND_8_SUBBANDS_3_1,
+        WIND_8_SUBBANDS_2_2, WIND_8_SUBBANDS_2_1,
+        WIND_8_SUBBANDS_1_2, WIND_8_SUBBANDS_1_1,
+    },
+    {
+        -WIND_8_SUBBANDS_0_1, 0,
+        WIND_8_SUBBANDS_1_4, 0,
+        WIND_8_SUBBANDS_2_4, 0,
+        WIND_8_SUBBANDS_3_4, 0,
+        WIND_8_SUBBANDS_4_4, 0,
+        WIND_8_SUBBANDS_5_4, 0,
+        WIND_8_SUBBANDS_6_4, 0,
+        WIND_8_SUBBANDS_7_4, 0,
+        WIND_8_SUBBANDS_8_0, 0,
+        WIND_8_SUBBANDS_7_0, 0,
+        WIND_8_SUBBANDS_6_0, 0,
+        WIND_8_SUBBANDS_5_0, 0,
+        WIND_8_SUBBANDS_4_0, 0,
+        WIND_8_SUBBANDS_3_0, 0,
+        WIND_8_SUBBANDS_2_0, 0,
+        WIND_8_SUBBANDS_1_0, 0,
+    },
+};
+
+static const SINT16 as16Window4Pairs[3][16] =
+{
+    {
+        0, WIND_4_SUBBANDS_0_1,
+        WIND_4_SUBBANDS_1_0, WIND_4_SUBBANDS_1_1,
+        WIND_4_SUBBANDS_2_0, WIND_4_SUBBANDS_2_1,
+        WIND_4_SUBBANDS_3_0, WIND_4_SUBBANDS_3_1,
+        WIND_4_SUBBANDS_4_0, WIND_4_SUBBANDS_4_1,
+        WIND_4_SUBBANDS_3_4, WIND_4_SUBBANDS_3_3,
+        WIND_4_SUBBANDS_2_4, WIND_4_SUBBANDS_2_3,
+        WIND_4_SUBBANDS_1_4, WIND_4_SUBBANDS_1_3,
+    },
+    {
+        WIND_4_SUBBANDS_0_2, -WIND_4_SUBBANDS_0_2,
+        WIND_4_SUBBANDS_1_2, WIND_4_SUBBANDS_1_3,
+        WIND_4_SUBBANDS_2_2, WIND_4_SUBBANDS_2_3,
+        WIND_4_SUBBANDS_3_2, WIND_4_SUBBANDS_3_3,
+        WIND_4_SUBBANDS_4_2, WIND_4_SUBBANDS_4_1,
+        WIND_4_SUBBANDS_3_2, WIND_4_SUBBANDS_3_1,
+        WIND_4_SUBBANDS_2_2, WIND_4_SUBBANDS_2_1,
+        WIND_4_SUBBANDS_1_2, WIND_4_SUBBANDS_1_1,
+    },
+    {
+        -WIND_4_SUBBANDS_0_1, 0,
+        WIND_4_SUBBANDS_1_4, 0,
+        WIND_4_SUBBANDS_2_4, 0,
+        WIND_4_SUBBANDS_3_4, 0,
+        WIND_4_SUBBANDS_4_0, 0,
+        WIND_4_SUBBANDS_3_0, 0,
+        WIND_4_SUBBANDS_2_0, 0,
+        WIND_4_SUBBANDS_1_0, 0,
+    },
+};
+
+#ifdef SBC_SIMD_X86
+static void SbcWindow8_SSE2(const SINT16 *x, SINT32 *y)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int h;
+    for (h = 0; h < 2; h++)
+    {
+        __m128i x0 = _mm_loadu_si128((const __m128i *)(x +  0 + 8*h));
+        __m128i x1 = _mm_loadu_si128((const __m128i *)(x + 16 + 8*h));
+        __m128i x2 = _mm_loadu_si128((const __m128i *)(x + 32 + 8*h));
+        __m128i x3 = _mm_loadu_si128((const __m128i *)(x + 48 + 8*h));
+        __m128i x4 = _mm_loadu_si128((const __m128i *)(x + 64 + 8*h));
+        __m128i lo, hi;
+        lo =               _mm_madd_epi16(_mm_unpacklo_epi16(x0, x1),   _mm_loadu_si128((const __m128i *)&as16Window8Pairs[0][16*h]));
+        lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x2, x3),   _mm_loadu_si128((const __m128i *)&as16Window8Pairs[1][16*h])), lo);
+        lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x4, zero), _mm_loadu_si128((const __m128i *)&as16Window8Pairs[2][16*h])), lo);
+        hi =               _mm_madd_epi16(_mm_unpackhi_epi16(x0, x1),   _mm_loadu_si128((const __m128i *)&as16Window8Pairs[0][16*h+8]));
+        hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x2, x3),   _mm_loadu_si128((const __m128i *)&as16Window8Pairs[1][16*h+8])), hi);
+        hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x4, zero), _mm_loadu_si128((const __m128i *)&as16Window8Pairs[2][16*h+8])), hi);
+        _mm_storeu_si128((__m128i *)(y + 8*h),     lo);
+        _mm_storeu_si128((__m128i *)(y + 8*h + 4), hi);
+    }
+}
+
+static void SbcWindow4_SSE2(const SINT16 *x, SINT32 *y)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i x0 = _mm_loadu_si128((const __m128i *)(x +  0));
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(x +  8));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(x + 16));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(x + 24));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(x + 32));
+    __m128i lo, hi;
+    lo =               _mm_madd_epi16(_mm_unpacklo_epi16(x0, x1),   _mm_loadu_si128((const __m128i *)&as16Window4Pairs[0][0]));
+    lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x2, x3),   _mm_loadu_si128((const __m128i *)&as16Window4Pairs[1][0])), lo);
+    lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x4, zero), _mm_loadu_si128((const __m128i *)&as16Window4Pairs[2][0])), lo);
+    hi =               _mm_madd_epi16(_mm_unpackhi_epi16(x0, x1),   _mm_loadu_si128((const __m128i *)&as16Window4Pairs[0][8]));
+    hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x2, x3),   _mm_loadu_si128((const __m128i *)&as16Window4Pairs[1][8])), hi);
+    hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x4, zero), _mm_loadu_si128((const __m128i *)&as16Window4Pairs[2][8])), hi);
+    _mm_storeu_si128((__m128i *)(y + 0), lo);
+    _mm_storeu_si128((__m128i *)(y + 4), hi);
+}
+
+#ifdef SBC_SIMD_AVX2_KERNELS
+/* samples are reordered so that unpacklo/unpackhi provide the pairs for k = 0..7 and k = 8..15 */
+__attribute__((target("avx2")))
+static void SbcWindow8_AVX2(const SINT16 *x, SINT32 *y)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i x0 = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i *)(x +  0)), 0xd8);
+    __m256i x1 = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i *)(x + 16)), 0xd8);
+    __m256i x2 = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i *)(x + 32)), 0xd8);
+    __m256i x3 = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i *)(x + 48)), 0xd8);
+    __m256i x4 = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i *)(x + 64)), 0xd8);
+    __m256i lo, hi;
+    lo =                  _mm256_madd_epi16(_mm256_unpacklo_epi16(x0, x1),   _mm256_loadu_si256((const __m256i *)&as16Window8Pairs[0][0]));
+    lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(x2, x3),   _mm256_loadu_si256((const __m256i *)&as16Window8Pairs[1][0])), lo);
+    lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(x4, zero), _mm256_loadu_si256((const __m256i *)&as16Window8Pairs[2][0])), lo);
+    hi =                  _mm256_madd_epi16(_mm256_unpackhi_epi16(x0, x1),   _mm256_loadu_si256((const __m256i *)&as16Window8Pairs[0][16]));
+    hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(x2, x3),   _mm256_loadu_si256((const __m256i *)&as16Window8Pairs[1][16])), hi);
+    hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(x4, zero), _mm256_loadu_si256((const __m256i *)&as16Window8Pairs[2][16])), hi);
+    _mm256_storeu_si256((__m256i *)(y + 0), lo);
+    _mm256_storeu_si256((__m256i *)(y + 8), hi);
+}
+#endif /* SBC_SIMD_AVX2_KERNELS */
+#endif /* SBC_SIMD_X86 */
+
+#ifdef SBC_SIMD_NEON_KERNELS
+/* coefficients are de-interleaved from the pair tables by vld2 */
+static void SbcWindow8_NEON(const SINT16 *x, SINT32 *y)
+{
+    int g;
+    for (g = 0; g < 4; g++)
+    {
+        int16x4x2_t c01 = vld2_s16(&as16Window8Pairs[0][8*g]);
+        int16x4x2_t c23 = vld2_s16(&as16Window8Pairs[1][8*g]);
+        int16x4x2_t c4  = vld2_s16(&as16Window8Pairs[2][8*g]);
+        int32x4_t acc = vmull_s16(vld1_s16(x + 4*g), c01.val[0]);
+        acc = vmlal_s16(acc, vld1_s16(x + 16 + 4*g), c01.val[1]);
+        acc = vmlal_s16(acc, vld1_s16(x + 32 + 4*g), c23.val[0]);
+        acc = vmlal_s16(acc, vld1_s16(x + 48 + 4*g), c23.val[1]);
+        acc = vmlal_s16(acc, vld1_s16(x + 64 + 4*g), c4.val[0]);
+        vst1q_s32(y + 4*g, acc);
+    }
+}
+
+static void SbcWindow4_NEON(const SINT16 *x, SINT32 *y)
+{
+    int g;
+    for (g = 0; g < 2; g++)
+    {
+        int16x4x2_t c01 = vld2_s16(&as16Window4Pairs[0][8*g]);
+        int16x4x2_t c23 = vld2_s16(&as16Window4Pairs[1][8*g]);
+        int16x4x2_t c4  = vld2_s16(&as16Window4Pairs[2][8*g]);
+        int32x4_t acc = vmull_s16(vld1_s16(x + 4*g), c01.val[0]);
+        acc = vmlal_s16(acc, vld1_s16(x +  8 + 4*g), c01.val[1]);
+        acc = vmlal_s16(acc, vld1_s16(x + 16 + 4*g), c23.val[0]);
+        acc = vmlal_s16(acc, vld1_s16(x + 24 + 4*g), c23.val[1]);
+        acc = vmlal_s16(acc, vld1_s16(x + 32 + 4*g), c4.val[0]);
+        vst1q_s32(y + 4*g, acc);
+    }
+}
+#endif /* SBC_SIMD_NEON_KERNELS */
+
+static void SbcWindow8Simd(SINT16 s16SimdLevel, const SINT16 *x, SINT32 *y)
+{
+    switch (s16SimdLevel)
+    {
+#ifdef SBC_SIMD_AVX2_KERNELS
+    case SBC_SIMD_AVX2:
+        SbcWindow8_AVX2(x, y);
+        break;
+#endif
+#ifdef SBC_SIMD_X86
+    case SBC_SIMD_SSE2:
+        SbcWindow8_SSE2(x, y);
+        break;
+#endif
+#ifdef SBC_SIMD_NEON_KERNELS
+    case SBC_SIMD_NEON:
+        SbcWindow8_NEON(x, y);
+        break;
+#endif
+    default:
+        break;
+    }
+}
+
+static void SbcWindow4Simd(SINT16 s16SimdLevel, const SINT16 *x, SINT32 *y)
+{
+    switch (s16SimdLevel)
+    {
+#ifdef SBC_SIMD_X86
+    case SBC_SIMD_AVX2:
+    case SBC_SIMD_SSE2:
+        SbcWindow4_SSE2(x, y);
+        break;
+#endif
+#ifdef SBC_SIMD_NEON_KERNELS
+    case SBC_SIMD_NEON:
+        SbcWindow4_NEON(x, y);
+        break;
+#endif
+    default:
+        break;
+    }
+}
+#endif /* SBC_SIMD_AVAILABLE */
+
+SINT16 SbcAnalysisSimdLevel(void)
+{
+#if (SBC_SIMD_AVAILABLE == TRUE)
+#ifdef SBC_SIMD_AVX2_KERNELS
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return SBC_SIMD_AVX2;
+    }
+#endif
+#ifdef SBC_SIMD_X86
+    return SBC_SIMD_SSE2;
+#endif
+#ifdef SBC_SIMD_NEON_KERNELS
+    return SBC_SIMD_NEON;
+#endif
+#endif
+    return SBC_SIMD_NONE;
+}
+/* BK4BTSTACK_CHANGE END */
+
 /****************************************************************************
 * SbcAnalysisFilter - performs Analysis of the input audio stream
 *
@@ -965,6 +1249,15 @@ void SbcAnalysisFilter4(SBC_ENC_PARAMS *pstrEncParams)
         {
             ChOffset=s32Ch*Offset2+Offset;
             
+            /* BK4BTSTACK_CHANGE START */
+#if (SBC_SIMD_AVAILABLE == TRUE)
+            if (pstrEncParams->s16SimdLevel != SBC_SIMD_NONE)
+            {
+                SbcWindow4Simd(pstrEncParams->s16SimdLevel, &s16X[ChOffset], s32DCTY);
+            }
+            else
+#endif
+            /* BK4BTSTACK_CHANGE END */
             WINDOW_PARTIAL_4
 
             SBC_FastIDCT4(s32DCTY, ps32SbBuf);
@@ -1068,6 +1361,17 @@ void SbcAnalysisFilter8 (SBC_ENC_PARAMS *pstrEncParams)
         {
             ChOffset=s32Ch*Offset2+Offset;
 
+            /* BK4BTSTACK_CHANGE START */
+#if (SBC_SIMD_AVAILABLE == TRUE)
+            if (pstrEncParams->s16SimdLevel != SBC_SIMD_NONE)
+            {
+                /* window only, the DCT of all blocks follows below */
+                SbcWindow8Simd(pstrEncParams->s16SimdLevel, &s16X[ChOffset], &s32DCTY[16*(s32Blk*s32NumOfChannels+s32Ch)]);
+                continue;
+            }
+#endif
+            /* BK4BTSTACK_CHANGE END */
+
             WINDOW_PARTIAL_8
 
             SBC_FastIDCT8 (s32DCTY, ps32SbBuf);
@@ -1099,9 +1403,19 @@ void SbcAnalysisFilter8 (SBC_ENC_PARAMS *pstrEncParams)
             }
         }
     }
+    /* BK4BTSTACK_CHANGE START */
+#if (SBC_SIMD_AVAILABLE == TRUE)
+    if (pstrEncParams->s16SimdLevel != SBC_SIMD_NONE)
+    {
+        SbcFastIDCT8Simd(pstrEncParams->s16SimdLevel, s32DCTY, pstrEncParams->s32SbBuffer, s32NumOfBlocks*s32NumOfChannels);
+    }
+#endif
+    /* BK4BTSTACK_CHANGE END */
 }
 
-void SbcAnalysisInit (void)
+/* BK4BTSTACK_CHANGE START */
+void SbcAnalysisInit (SBC_ENC_PARAMS *pstrEncParams)
+/* BK4BTSTACK_CHANGE END */
 {
     memset(s16X,0,ENC_VX_BUFFER_SIZE*sizeof(SINT16));
     ShiftCounter=0;
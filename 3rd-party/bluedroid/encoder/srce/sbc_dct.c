@@ -243,3 +243,303 @@ void SBC_FastIDCT4(SINT32 *pInVect, SINT32 *pOutVect)
     }
 #endif
 }
+
+/* BK4BTSTACK_CHANGE START */
+#if (SBC_SIMD_AVAILABLE == TRUE)
+/*
+ * SBC_FastIDCT8 for 4 (SSE2, NEON) or 8 (AVX2) blocks in parallel, one block per lane.
+ * The blocks are transposed so that each vector holds the same input of all blocks.
+ */
+#if defined(__SSE2__)
+#define SBC_SIMD_X86
+#include <immintrin.h>
+/* AVX2 kernels use the GCC/Clang target attribute and a runtime CPU check */
+#if defined(__GNUC__)
+#define SBC_SIMD_AVX2_KERNELS
+#endif
+#endif
+#if defined(__ARM_NEON)
+#define SBC_SIMD_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+/* SBC_FastIDCT8 on vectors, SBC_SIMD_MULT(v, c) computes (SINT32)(((SINT64)c * v) >> 15) for 0 <= c < 0x8000 */
+#define SBC_SIMD_FAST_IDCT8(in, out)                                                        \
+{                                                                                           \
+    SBC_SIMD_T x0, x1, x2, x3, x4, x5, x6, x7, temp;                                        \
+    SBC_SIMD_T res_even0, res_even1, res_even2, res_even3;                                  \
+    SBC_SIMD_T res_odd0, res_odd1, res_odd2, res_odd3;                                      \
+    x0 = SBC_SIMD_MULT(in[4], SBC_COS_PI_SUR_4);                                            \
+    x1 = SBC_SIMD_SRA1(SBC_SIMD_ADD(in[3], in[5]));                                         \
+    x2 = SBC_SIMD_SRA1(SBC_SIMD_ADD(in[2], in[6]));                                         \
+    x3 = SBC_SIMD_SRA1(SBC_SIMD_ADD(in[1], in[7]));                                         \
+    x4 = SBC_SIMD_SRA1(SBC_SIMD_ADD(in[0], in[8]));                                         \
+    x5 = SBC_SIMD_SRA1(SBC_SIMD_SUB(in[9], in[15]));                                        \
+    x6 = SBC_SIMD_SRA1(SBC_SIMD_SUB(in[10], in[14]));                                       \
+    x7 = SBC_SIMD_SRA1(SBC_SIMD_SUB(in[11], in[13]));                                       \
+    temp = x0;                                                                              \
+    x0 = SBC_SIMD_MULT(SBC_SIMD_ADD(x0, x4), SBC_COS_PI_SUR_4);                             \
+    x4 = SBC_SIMD_MULT(SBC_SIMD_SUB(temp, x4), SBC_COS_PI_SUR_4);                           \
+    x2 = SBC_SIMD_SUB(x2, x6);                                                              \
+    x6 = SBC_SIMD_MULT(SBC_SIMD_SHL1(x6), SBC_COS_PI_SUR_4);                                \
+    temp = x2;                                                                              \
+    x2 = SBC_SIMD_MULT(SBC_SIMD_ADD(x2, x6), SBC_COS_PI_SUR_8);                             \
+    x6 = SBC_SIMD_MULT(SBC_SIMD_SUB(temp, x6), SBC_COS_3PI_SUR_8);                          \
+    res_even0 = SBC_SIMD_ADD(x0, x2);                                                       \
+    res_even1 = SBC_SIMD_ADD(x4, x6);                                                       \
+    res_even2 = SBC_SIMD_SUB(x4, x6);                                                       \
+    res_even3 = SBC_SIMD_SUB(x0, x2);                                                       \
+    x7 = SBC_SIMD_SHL1(x7);                                                                 \
+    x5 = SBC_SIMD_SUB(SBC_SIMD_SHL1(x5), x7);                                               \
+    x3 = SBC_SIMD_SUB(SBC_SIMD_SHL1(x3), x5);                                               \
+    x1 = SBC_SIMD_SUB(x1, SBC_SIMD_SRA1(x3));                                               \
+    x5 = SBC_SIMD_MULT(x5, SBC_COS_PI_SUR_4);                                               \
+    temp = x1;                                                                              \
+    x1 = SBC_SIMD_ADD(x1, x5);                                                              \
+    x5 = SBC_SIMD_SUB(temp, x5);                                                            \
+    x3 = SBC_SIMD_SUB(x3, x7);                                                              \
+    x7 = SBC_SIMD_MULT(SBC_SIMD_SHL1(x7), SBC_COS_PI_SUR_4);                                \
+    temp = x3;                                                                              \
+    x3 = SBC_SIMD_MULT(SBC_SIMD_ADD(x3, x7), SBC_COS_PI_SUR_8);                             \
+    x7 = SBC_SIMD_MULT(SBC_SIMD_SUB(temp, x7), SBC_COS_3PI_SUR_8);                          \
+    res_odd0 = SBC_SIMD_MULT(SBC_SIMD_ADD(x1, x3), SBC_COS_PI_SUR_16);                      \
+    res_odd1 = SBC_SIMD_MULT(SBC_SIMD_ADD(x5, x7), SBC_COS_3PI_SUR_16);                     \
+    res_odd2 = SBC_SIMD_MULT(SBC_SIMD_SUB(x5, x7), SBC_COS_5PI_SUR_16);                     \
+    res_odd3 = SBC_SIMD_MULT(SBC_SIMD_SUB(x1, x3), SBC_COS_7PI_SUR_16);                     \
+    out[0] = SBC_SIMD_ADD(res_even0, res_odd0);                                             \
+    out[1] = SBC_SIMD_ADD(res_even1, res_odd1);                                             \
+    out[2] = SBC_SIMD_ADD(res_even2, res_odd2);                                             \
+    out[3] = SBC_SIMD_ADD(res_even3, res_odd3);                                             \
+    out[7] = SBC_SIMD_SUB(res_even0, res_odd0);                                             \
+    out[6] = SBC_SIMD_SUB(res_even1, res_odd1);                                             \
+    out[5] = SBC_SIMD_SUB(res_even2, res_odd2);                                             \
+    out[4] = SBC_SIMD_SUB(res_even3, res_odd3);                                             \
+}
+
+#ifdef SBC_SIMD_X86
+#define SBC_SSE2_TRANSPOSE4(r0, r1, r2, r3)                                                 \
+{                                                                                           \
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);                                                \
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);                                                \
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);                                                \
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);                                                \
+    r0 = _mm_unpacklo_epi64(t0, t1);                                                        \
+    r1 = _mm_unpackhi_epi64(t0, t1);                                                        \
+    r2 = _mm_unpacklo_epi64(t2, t3);                                                        \
+    r3 = _mm_unpackhi_epi64(t2, t3);                                                        \
+}
+
+/* c * v >> 15 = ((c * (v >> 16)) << 1) + ((c * (v & 0xffff)) >> 15) */
+static inline __m128i SbcMult_SSE2(__m128i v, SINT32 c)
+{
+    __m128i hi = _mm_madd_epi16(v, _mm_set1_epi32(c << 16));
+    __m128i lo_l = _mm_mullo_epi16(v, _mm_set1_epi32(c));
+    __m128i lo_h = _mm_mulhi_epu16(v, _mm_set1_epi32(c));
+    __m128i lo = _mm_or_si128(_mm_slli_epi32(lo_h, 16), lo_l);
+    return _mm_add_epi32(_mm_slli_epi32(hi, 1), _mm_srli_epi32(lo, 15));
+}
+
+/* 4 blocks: pInVect with 16 entries, pOutVect with 8 entries per block */
+static void SbcFastIDCT8x4_SSE2(const SINT32 *pInVect, SINT32 *pOutVect)
+{
+    __m128i in[16];
+    __m128i out[8];
+    int i;
+    for (i = 0; i < 16; i += 4)
+    {
+        in[i+0] = _mm_loadu_si128((const __m128i *)(pInVect +  0 + i));
+        in[i+1] = _mm_loadu_si128((const __m128i *)(pInVect + 16 + i));
+        in[i+2] = _mm_loadu_si128((const __m128i *)(pInVect + 32 + i));
+        in[i+3] = _mm_loadu_si128((const __m128i *)(pInVect + 48 + i));
+        SBC_SSE2_TRANSPOSE4(in[i+0], in[i+1], in[i+2], in[i+3]);
+    }
+#define SBC_SIMD_T          __m128i
+#define SBC_SIMD_ADD(a, b)  _mm_add_epi32(a, b)
+#define SBC_SIMD_SUB(a, b)  _mm_sub_epi32(a, b)
+#define SBC_SIMD_SRA1(a)    _mm_srai_epi32(a, 1)
+#define SBC_SIMD_SHL1(a)    _mm_slli_epi32(a, 1)
+#define SBC_SIMD_MULT(a, c) SbcMult_SSE2(a, c)
+    SBC_SIMD_FAST_IDCT8(in, out);
+#undef SBC_SIMD_T
+#undef SBC_SIMD_ADD
+#undef SBC_SIMD_SUB
+#undef SBC_SIMD_SRA1
+#undef SBC_SIMD_SHL1
+#undef SBC_SIMD_MULT
+    for (i = 0; i < 8; i += 4)
+    {
+        SBC_SSE2_TRANSPOSE4(out[i+0], out[i+1], out[i+2], out[i+3]);
+        _mm_storeu_si128((__m128i *)(pOutVect +  0 + i), out[i+0]);
+        _mm_storeu_si128((__m128i *)(pOutVect +  8 + i), out[i+1]);
+        _mm_storeu_si128((__m128i *)(pOutVect + 16 + i), out[i+2]);
+        _mm_storeu_si128((__m128i *)(pOutVect + 24 + i), out[i+3]);
+    }
+}
+
+#ifdef SBC_SIMD_AVX2_KERNELS
+__attribute__((target("avx2")))
+static inline __m256i SbcMult_AVX2(__m256i v, SINT32 c)
+{
+    __m256i hi = _mm256_madd_epi16(v, _mm256_set1_epi32(c << 16));
+    __m256i lo_l = _mm256_mullo_epi16(v, _mm256_set1_epi32(c));
+    __m256i lo_h = _mm256_mulhi_epu16(v, _mm256_set1_epi32(c));
+    __m256i lo = _mm256_or_si256(_mm256_slli_epi32(lo_h, 16), lo_l);
+    return _mm256_add_epi32(_mm256_slli_epi32(hi, 1), _mm256_srli_epi32(lo, 15));
+}
+
+/* 8 blocks, transposed as two groups of 4 blocks */
+__attribute__((target("avx2")))
+static void SbcFastIDCT8x8_AVX2(const SINT32 *pInVect, SINT32 *pOutVect)
+{
+    __m256i in[16];
+    __m256i out[8];
+    int i;
+    for (i = 0; i < 16; i += 4)
+    {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(pInVect +   0 + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(pInVect +  16 + i));
+        __m128i a2 = _mm_loadu_si128((const __m128i *)(pInVect +  32 + i));
+        __m128i a3 = _mm_loadu_si128((const __m128i *)(pInVect +  48 + i));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(pInVect +  64 + i));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(pInVect +  80 + i));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(pInVect +  96 + i));
+        __m128i b3 = _mm_loadu_si128((const __m128i *)(pInVect + 112 + i));
+        SBC_SSE2_TRANSPOSE4(a0, a1, a2, a3);
+        SBC_SSE2_TRANSPOSE4(b0, b1, b2, b3);
+        in[i+0] = _mm256_inserti128_si256(_mm256_castsi128_si256(a0), b0, 1);
+        in[i+1] = _mm256_inserti128_si256(_mm256_castsi128_si256(a1), b1, 1);
+        in[i+2] = _mm256_inserti128_si256(_mm256_castsi128_si256(a2), b2, 1);
+        in[i+3] = _mm256_inserti128_si256(_mm256_castsi128_si256(a3), b3, 1);
+    }
+#define SBC_SIMD_T          __m256i
+#define SBC_SIMD_ADD(a, b)  _mm256_add_epi32(a, b)
+#define SBC_SIMD_SUB(a, b)  _mm256_sub_epi32(a, b)
+#define SBC_SIMD_SRA1(a)    _mm256_srai_epi32(a, 1)
+#define SBC_SIMD_SHL1(a)    _mm256_slli_epi32(a, 1)
+#define SBC_SIMD_MULT(a, c) SbcMult_AVX2(a, c)
+    SBC_SIMD_FAST_IDCT8(in, out);
+#undef SBC_SIMD_T
+#undef SBC_SIMD_ADD
+#undef SBC_SIMD_SUB
+#undef SBC_SIMD_SRA1
+#undef SBC_SIMD_SHL1
+#undef SBC_SIMD_MULT
+    for (i = 0; i < 8; i += 4)
+    {
+        __m128i a0 = _mm256_castsi256_si128(out[i+0]);
+        __m128i a1 = _mm256_castsi256_si128(out[i+1]);
+        __m128i a2 = _mm256_castsi256_si128(out[i+2]);
+        __m128i a3 = _mm256_castsi256_si128(out[i+3]);
+        __m128i b0 = _mm256_extracti128_si256(out[i+0], 1);
+        __m128i b1 = _mm256_extracti128_si256(out[i+1], 1);
+        __m128i b2 = _mm256_extracti128_si256(out[i+2], 1);
+        __m128i b3 = _mm256_extracti128_si256(out[i+3], 1);
+        SBC_SSE2_TRANSPOSE4(a0, a1, a2, a3);
+        SBC_SSE2_TRANSPOSE4(b0, b1, b2, b3);
+        _mm_storeu_si128((__m128i *)(pOutVect +  0 + i), a0);
+        _mm_storeu_si128((__m128i *)(pOutVect +  8 + i), a1);
+        _mm_storeu_si128((__m128i *)(pOutVect + 16 + i), a2);
+        _mm_storeu_si128((__m128i *)(pOutVect + 24 + i), a3);
+        _mm_storeu_si128((__m128i *)(pOutVect + 32 + i), b0);
+        _mm_storeu_si128((__m128i *)(pOutVect + 40 + i), b1);
+        _mm_storeu_si128((__m128i *)(pOutVect + 48 + i), b2);
+        _mm_storeu_si128((__m128i *)(pOutVect + 56 + i), b3);
+    }
+}
+#endif /* SBC_SIMD_AVX2_KERNELS */
+#endif /* SBC_SIMD_X86 */
+
+#ifdef SBC_SIMD_NEON_KERNELS
+#define SBC_NEON_TRANSPOSE4(r0, r1, r2, r3)                                                 \
+{                                                                                           \
+    int32x4x2_t t01 = vtrnq_s32(r0, r1);                                                    \
+    int32x4x2_t t23 = vtrnq_s32(r2, r3);                                                    \
+    r0 = vcombine_s32(vget_low_s32(t01.val[0]),  vget_low_s32(t23.val[0]));                 \
+    r1 = vcombine_s32(vget_low_s32(t01.val[1]),  vget_low_s32(t23.val[1]));                 \
+    r2 = vcombine_s32(vget_high_s32(t01.val[0]), vget_high_s32(t23.val[0]));                \
+    r3 = vcombine_s32(vget_high_s32(t01.val[1]), vget_high_s32(t23.val[1]));                \
+}
+
+static inline int32x4_t SbcMult_NEON(int32x4_t v, SINT32 c)
+{
+    int32x2_t vc = vdup_n_s32(c);
+    int64x2_t lo = vmull_s32(vget_low_s32(v), vc);
+    int64x2_t hi = vmull_s32(vget_high_s32(v), vc);
+    return vcombine_s32(vshrn_n_s64(lo, 15), vshrn_n_s64(hi, 15));
+}
+
+static void SbcFastIDCT8x4_NEON(const SINT32 *pInVect, SINT32 *pOutVect)
+{
+    int32x4_t in[16];
+    int32x4_t out[8];
+    int i;
+    for (i = 0; i < 16; i += 4)
+    {
+        in[i+0] = vld1q_s32(pInVect +  0 + i);
+        in[i+1] = vld1q_s32(pInVect + 16 + i);
+        in[i+2] = vld1q_s32(pInVect + 32 + i);
+        in[i+3] = vld1q_s32(pInVect + 48 + i);
+        SBC_NEON_TRANSPOSE4(in[i+0], in[i+1], in[i+2], in[i+3]);
+    }
+#define SBC_SIMD_T          int32x4_t
+#define SBC_SIMD_ADD(a, b)  vaddq_s32(a, b)
+#define SBC_SIMD_SUB(a, b)  vsubq_s32(a, b)
+#define SBC_SIMD_SRA1(a)    vshrq_n_s32(a, 1)
+#define SBC_SIMD_SHL1(a)    vshlq_n_s32(a, 1)
+#define SBC_SIMD_MULT(a, c) SbcMult_NEON(a, c)
+    SBC_SIMD_FAST_IDCT8(in, out);
+#undef SBC_SIMD_T
+#undef SBC_SIMD_ADD
+#undef SBC_SIMD_SUB
+#undef SBC_SIMD_SRA1
+#undef SBC_SIMD_SHL1
+#undef SBC_SIMD_MULT
+    for (i = 0; i < 8; i += 4)
+    {
+        SBC_NEON_TRANSPOSE4(out[i+0], out[i+1], out[i+2], out[i+3]);
+        vst1q_s32(pOutVect +  0 + i, out[i+0]);
+        vst1q_s32(pOutVect +  8 + i, out[i+1]);
+        vst1q_s32(pOutVect + 16 + i, out[i+2]);
+        vst1q_s32(pOutVect + 24 + i, out[i+3]);
+    }
+}
+#endif /* SBC_SIMD_NEON_KERNELS */
+
+/* DCT for s32NumOfDCTs blocks, remaining blocks are transformed by SBC_FastIDCT8 */
+void SbcFastIDCT8Simd(SINT16 s16SimdLevel, SINT32 *pInVect, SINT32 *pOutVect, SINT32 s32NumOfDCTs)
+{
+    SINT32 n = 0;
+#ifdef SBC_SIMD_AVX2_KERNELS
+    if (s16SimdLevel == SBC_SIMD_AVX2)
+    {
+        for (; n + 8 <= s32NumOfDCTs; n += 8)
+        {
+            SbcFastIDCT8x8_AVX2(pInVect + 16*n, pOutVect + 8*n);
+        }
+    }
+#endif
+#ifdef SBC_SIMD_X86
+    if (s16SimdLevel == SBC_SIMD_AVX2 || s16SimdLevel == SBC_SIMD_SSE2)
+    {
+        for (; n + 4 <= s32NumOfDCTs; n += 4)
+        {
+            SbcFastIDCT8x4_SSE2(pInVect + 16*n, pOutVect + 8*n);
+        }
+    }
+#endif
+#ifdef SBC_SIMD_NEON_KERNELS
+    if (s16SimdLevel == SBC_SIMD_NEON)
+    {
+        for (; n + 4 <= s32NumOfDCTs; n += 4)
+        {
+            SbcFastIDCT8x4_NEON(pInVect + 16*n, pOutVect + 8*n);
+        }
+    }
+#endif
+    for (; n < s32NumOfDCTs; n++)
+    {
+        SBC_FastIDCT8(pInVect + 16*n, pOutVect + 8*n);
+    }
+}
+#endif /* SBC_SIMD_AVAILABLE */
+/* BK4BTSTACK_CHANGE END */
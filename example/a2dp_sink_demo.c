@@ -422,6 +422,8 @@ static void hal_audio_dma_process(btstack_data_source_t * ds, btstack_data_sourc
 static int media_processing_init(avdtp_media_codec_configuration_sbc_t configuration){
     if (media_initialized) return 0;
 #ifdef DECODE_SBC
+    // release decoder of previous stream
+    btstack_sbc_decoder_deinit(&state);
     btstack_sbc_decoder_init(&state, mode, handle_pcm_data, NULL);
 #endif
 
@@ -131,6 +131,7 @@ static int negotiated_codec = -1;
 
 #ifdef ENABLE_HFP_WIDE_BAND_SPEECH
 btstack_sbc_decoder_state_t decoder_state;
+static hfp_msbc_state_t msbc_encoder_state;
 #endif
 
 btstack_cvsd_plc_state_t cvsd_plc_state;
@@ -187,11 +188,11 @@ static void sco_demo_sine_wave_int16_at_16000_hz_host_endian(unsigned int num_sa
 }
 
 static void sco_demo_msbc_fill_sine_audio_frame(void){
-    if (!hfp_msbc_can_encode_audio_frame_now()) return;
-    int num_samples = hfp_msbc_num_audio_samples_per_frame();
+    if (!hfp_msbc_can_encode_audio_frame_now(&msbc_encoder_state)) return;
+    int num_samples = hfp_msbc_num_audio_samples_per_frame(&msbc_encoder_state);
     int16_t sample_buffer[num_samples];
     sco_demo_sine_wave_int16_at_16000_hz_host_endian(num_samples, sample_buffer);
-    hfp_msbc_encode_audio_frame(sample_buffer);
+    hfp_msbc_encode_audio_frame(&msbc_encoder_state, sample_buffer);
     num_audio_frames++;
 }
 #endif
@@ -394,8 +395,12 @@ static void handle_pcm_data(int16_t * data, int num_samples, int num_channels, i
 static void sco_demo_init_mSBC(void){
     printf("SCO Demo: Init mSBC\n");
 
+    // release decoder and encoder of previous connection
+    btstack_sbc_decoder_deinit(&decoder_state);
+    hfp_msbc_deinit(&msbc_encoder_state);
+
     btstack_sbc_decoder_init(&decoder_state, SBC_MODE_mSBC, &handle_pcm_data, NULL);    
-    hfp_msbc_init();
+    hfp_msbc_init(&msbc_encoder_state);
 
 #ifdef SCO_WAV_FILENAME
     num_samples_to_write = MSBC_SAMPLE_RATE * SCO_WAV_DURATION_IN_SECONDS;
@@ -585,10 +590,10 @@ void sco_demo_send(hci_con_handle_t sco_handle){
         sco_payload_length = 24;
         sco_packet_length = sco_payload_length + 3;
 
-        if (hfp_msbc_num_bytes_in_stream() < sco_payload_length){
+        if (hfp_msbc_num_bytes_in_stream(&msbc_encoder_state) < sco_payload_length){
             log_error("mSBC stream is empty.");
         }
-        hfp_msbc_read_from_stream(sco_packet + 3, sco_payload_length);
+        hfp_msbc_read_from_stream(&msbc_encoder_state, sco_packet + 3, sco_payload_length);
         if (msbc_file_out){
             // log outgoing mSBC data for testing
             fwrite(sco_packet + 3, sco_payload_length, 1, msbc_file_out);
@@ -621,22 +626,22 @@ void sco_demo_send(hci_con_handle_t sco_handle){
         }
 
         if (!pa_input_paused){
-            int num_samples = hfp_msbc_num_audio_samples_per_frame();
-            if (hfp_msbc_can_encode_audio_frame_now() && btstack_ring_buffer_bytes_available(&pa_input_ring_buffer) >= (num_samples * MSBC_BYTES_PER_FRAME)){
+            int num_samples = hfp_msbc_num_audio_samples_per_frame(&msbc_encoder_state);
+            if (hfp_msbc_can_encode_audio_frame_now(&msbc_encoder_state) && btstack_ring_buffer_bytes_available(&pa_input_ring_buffer) >= (num_samples * MSBC_BYTES_PER_FRAME)){
                 int16_t sample_buffer[num_samples];
                 uint32_t bytes_read;
                 btstack_ring_buffer_read(&pa_input_ring_buffer, (uint8_t*) sample_buffer, num_samples * MSBC_BYTES_PER_FRAME, &bytes_read);
-                hfp_msbc_encode_audio_frame(sample_buffer);
+                hfp_msbc_encode_audio_frame(&msbc_encoder_state, sample_buffer);
                 num_audio_frames++;
             }
         }
 
-        if (hfp_msbc_num_bytes_in_stream() < sco_payload_length){
+        if (hfp_msbc_num_bytes_in_stream(&msbc_encoder_state) < sco_payload_length){
             log_error("mSBC stream should not be empty.");
             memset(sco_packet + 3, 0, sco_payload_length);
             pa_input_paused = 1;
         } else {
-            hfp_msbc_read_from_stream(sco_packet + 3, sco_payload_length);
+            hfp_msbc_read_from_stream(&msbc_encoder_state, sco_packet + 3, sco_payload_length);
             if (msbc_file_out){
                 // log outgoing mSBC data for testing
                 fwrite(sco_packet + 3, sco_payload_length, 1, msbc_file_out);
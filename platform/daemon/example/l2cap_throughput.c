@@ -54,6 +54,7 @@
 
 #define PSM_TEST 0xdead
 #define PACKET_SIZE 1000
+#define REPORT_INTERVAL_MS 3000
 
 int serverMode = 1;
 bd_addr_t addr = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00}; 
@@ -62,6 +63,26 @@ uint32_t counter = 0;
 
 btstack_timer_source_t timer;
 
+// data rate over the daemon socket, received in server mode and sent in client mode
+uint32_t throughput_start_ms;
+uint32_t throughput_bytes;
+uint32_t throughput_packets;
+
+void throughput_track(uint16_t size){
+	uint32_t now = btstack_run_loop_get_time_ms();
+	if (throughput_packets == 0){
+		throughput_start_ms = now;
+	}
+	throughput_bytes += size;
+	throughput_packets++;
+	uint32_t delta_ms = now - throughput_start_ms;
+	if (delta_ms < REPORT_INTERVAL_MS) return;
+	printf("%s %u packets, %u bytes in %u ms -> %u bytes/s\n", serverMode ? "Received" : "Sent",
+		throughput_packets, throughput_bytes, delta_ms, (uint32_t) ((uint64_t) throughput_bytes * 1000 / delta_ms));
+	throughput_bytes = 0;
+	throughput_packets = 0;
+}
+
 void update_packet(void){
     big_endian_store_32( packet, 0, counter++);
 }
@@ -92,6 +113,7 @@ void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint
 			
 		case L2CAP_DATA_PACKET:
 			// measure data rate
+			throughput_track(size);
 			break;
 			
 		case HCI_EVENT_PACKET:
@@ -184,6 +206,7 @@ void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint
 						update_packet();
 						local_cid = little_endian_read_16(packet, 2);
 						bt_send_l2cap( local_cid, packet, PACKET_SIZE); 
+						throughput_track(PACKET_SIZE);
 					}
 				    break;
 				    	
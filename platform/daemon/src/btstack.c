@@ -51,6 +51,8 @@
 #include "socket_connection.h"
 #include "btstack_run_loop.h"
 #include "btstack_client.h"
+#include "btstack_debug.h"
+#include "daemon_shm.h"
  
 #include <string.h>
 #include <unistd.h>
@@ -71,6 +73,15 @@ static void (*client_packet_handler)(uint8_t packet_type, uint16_t channel, uint
 static const char * daemon_tcp_address = NULL;
 static uint16_t     daemon_tcp_port    = BTSTACK_PORT;
 
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+// max time to wait for daemon to free space in shared memory
+#define BTSTACK_SHM_SEND_TIMEOUT_MS 1000
+
+static daemon_shm_t shm;
+static int          shm_active;
+static int          shm_rx_paused;  // daemon sends data over socket until DAEMON_EVENT_SHARED_MEMORY_RESUMED
+#endif
+
 // optional: if called before bt_open, TCP socket is used instead of local unix socket
 //           note: address is not copied and must be valid during bt_open
 void bt_use_tcp(const char * address, uint16_t port){
@@ -78,8 +89,73 @@ void bt_use_tcp(const char * address, uint16_t port){
     daemon_tcp_port    = port;
 }
 
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+static void shm_handler(daemon_shm_t * shm_context){
+    uint16_t packet_type;
+    uint16_t channel;
+    uint16_t size;
+    uint8_t * data;
+    if (shm_rx_paused) return;
+    while (shm_active && (data = daemon_shm_peek_packet(shm_context, &packet_type, &channel, &size)) != NULL){
+        (*client_packet_handler)(packet_type, channel, data, size);
+        if (!shm_active) break;
+        daemon_shm_consume_packet(shm_context);
+    }
+}
+
+static void shm_attach(connection_t *connection, uint8_t *event){
+    int fds[DAEMON_SHM_NUM_FDS];
+    int num_fds = socket_connection_take_received_fds(connection, fds, DAEMON_SHM_NUM_FDS);
+    if (num_fds == DAEMON_SHM_NUM_FDS && !shm_active){
+        if (daemon_shm_attach(&shm, fds, &shm_handler) == 0){
+            shm_active = 1;
+            shm_rx_paused = 0;
+            return;
+        }
+        // closed by daemon_shm_attach
+        num_fds = 0;
+    }
+    log_error("shm_attach: cannot use shared memory");
+    int i;
+    for (i = 0; i < num_fds; i++){
+        close(fds[i]);
+    }
+    event[2] = BTSTACK_MEMORY_ALLOC_FAILED;
+}
+
+// @returns 1 if packet was handled internally
+static int shm_socket_packet_handler(connection_t *connection, uint16_t packet_type, uint8_t *data){
+    if (packet_type == HCI_EVENT_PACKET){
+        switch (hci_event_packet_get_type(data)){
+            case DAEMON_EVENT_SHARED_MEMORY_OPENED:
+                if (data[2] == 0){
+                    shm_attach(connection, data);
+                }
+                return 0;
+            case DAEMON_EVENT_SHARED_MEMORY_RESUMED:
+                shm_rx_paused = 0;
+                shm_handler(&shm);
+                return 1;
+            default:
+                break;
+        }
+    }
+    if (!shm_active || shm_rx_paused) return 0;
+    // packets in shared memory were sent before this one
+    shm_handler(&shm);
+    // daemon found ring full and continues on socket
+    if (packet_type == L2CAP_DATA_PACKET || packet_type == RFCOMM_DATA_PACKET){
+        shm_rx_paused = 1;
+    }
+    return 0;
+}
+#endif
+
 static int socket_packet_handler(connection_t *connection, uint16_t packet_type, uint16_t channel, uint8_t *data, uint16_t size){
     // log_info("BTstack client handler: packet type %u, data[0] %x", packet_type, data[0]);
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+    if (shm_socket_packet_handler(connection, packet_type, data)) return 0;
+#endif
     (*client_packet_handler)(packet_type, channel, data, size);
     return 0;
 }
@@ -104,6 +180,12 @@ int bt_open(void){
 
 // stop using BTstack library
 int bt_close(void){
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+    if (shm_active){
+        shm_active = 0;
+        daemon_shm_close(&shm);
+    }
+#endif
     return socket_connection_close_tcp(btstack_connection);
 }
 
@@ -124,14 +206,26 @@ btstack_packet_handler_t bt_register_packet_handler(btstack_packet_handler_t han
     return old_handler;
 }
 
+static void bt_send_data(uint16_t packet_type, uint16_t channel, uint8_t *data, uint16_t len){
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+    if (shm_active){
+        if (daemon_shm_send_packet_blocking(&shm, packet_type, channel, data, len, BTSTACK_SHM_SEND_TIMEOUT_MS)){
+            log_error("bt_send_data: shared memory full, packet for channel 0x%04x dropped", channel);
+        }
+        return;
+    }
+#endif
+    socket_connection_send_packet(btstack_connection, packet_type, channel, data, len);
+}
+
 void bt_send_l2cap(uint16_t source_cid, uint8_t *data, uint16_t len){
     // send
-    socket_connection_send_packet(btstack_connection, L2CAP_DATA_PACKET, source_cid, data, len);
+    bt_send_data(L2CAP_DATA_PACKET, source_cid, data, len);
 }
 
 void bt_send_rfcomm(uint16_t rfcomm_cid, uint8_t *data, uint16_t len){
     // send
-    socket_connection_send_packet(btstack_connection, RFCOMM_DATA_PACKET, rfcomm_cid, data, len);
+    bt_send_data(RFCOMM_DATA_PACKET, rfcomm_cid, data, len);
 }
 
 void bt_send_acl(uint8_t * data, uint16_t len){
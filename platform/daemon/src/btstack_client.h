@@ -92,6 +92,8 @@ btstack_packet_handler_t bt_register_packet_handler(btstack_packet_handler_t han
 
 void bt_send_acl(uint8_t * data, uint16_t len);
 
+// L2CAP and RFCOMM data goes through shared memory after DAEMON_EVENT_SHARED_MEMORY_OPENED with status 0,
+// requested by sending btstack_open_shared_memory. Waits for the daemon if shared memory is full
 void bt_send_l2cap(uint16_t local_cid, uint8_t *data, uint16_t len);
 void bt_send_rfcomm(uint16_t rfcom_cid, uint8_t *data, uint16_t len);
 
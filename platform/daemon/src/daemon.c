@@ -66,6 +66,7 @@
 #include "btstack_run_loop.h"
 #include "btstack_run_loop_posix.h"
 #include "btstack_version.h"
+#include "daemon_shm.h"
 #include "classic/btstack_link_key_db.h"
 #include "classic/rfcomm.h"
 #include "classic/sdp_server.h"
@@ -145,6 +146,12 @@ typedef struct {
     
     // discoverable
     uint8_t        discoverable;
+
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+    // optional shared memory for L2CAP and RFCOMM data
+    daemon_shm_t * shm;
+    uint8_t        shm_tx_suspended;    // ring was full, data goes over socket until client caught up
+#endif
     
 } client_state_t;
 
@@ -684,10 +691,115 @@ static void daemon_disconnect_client(connection_t * connection){
     daemon_gatt_client_close_connection(connection);
 #endif
 
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+    if (client->shm){
+        daemon_shm_close(client->shm);
+        free(client->shm);
+    }
+#endif
+
     btstack_linked_list_remove(&clients, (btstack_linked_item_t *) client);
     free(client); 
 }
 
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+// send L2CAP and RFCOMM data from shared memory, stop at first packet that cannot be sent now
+// @returns 0 if all packets have been sent
+static int daemon_shm_process_client(client_state_t * client){
+    if (!client->shm) return 0;
+    uint16_t packet_type;
+    uint16_t channel;
+    uint16_t length;
+    uint8_t * data;
+    while ((data = daemon_shm_peek_packet(client->shm, &packet_type, &channel, &length)) != NULL){
+        int err = 0;
+        switch (packet_type){
+            case L2CAP_DATA_PACKET:
+                err = l2cap_send(channel, data, length);
+                break;
+            case RFCOMM_DATA_PACKET:
+                err = rfcomm_send(channel, data, length);
+                break;
+            default:
+                log_error("daemon_shm_process_client: packet type %u not supported", packet_type);
+                break;
+        }
+        if (err == BTSTACK_ACL_BUFFERS_FULL || err == RFCOMM_NO_OUTGOING_CREDITS) return err;
+        if (err){
+            log_error("daemon_shm_process_client: dropped packet for channel 0x%04x, err %d", channel, err);
+        }
+        daemon_shm_consume_packet(client->shm);
+    }
+    return 0;
+}
+
+static void daemon_shm_handler(daemon_shm_t * shm){
+    client_state_t * client = (client_state_t *) shm->context;
+    // client freed space after ring was full. data sent over socket in between is followed by marker,
+    // so client knows when to continue with the ring
+    if (client->shm_tx_suspended){
+        log_info("daemon_shm_handler: resume shared memory for client %p", client->connection);
+        client->shm_tx_suspended = 0;
+        uint8_t event[2];
+        event[0] = DAEMON_EVENT_SHARED_MEMORY_RESUMED;
+        event[1] = 0;
+        socket_connection_send_packet(client->connection, HCI_EVENT_PACKET, 0, event, sizeof(event));
+    }
+    daemon_shm_process_client(client);
+}
+
+// @returns 1 if packet was put into shared memory
+static int daemon_shm_emit_packet(connection_t * connection, uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    client_state_t * client = client_for_connection(connection);
+    if (!client || !client->shm || client->shm_tx_suspended) return 0;
+    if (daemon_shm_send_packet(client->shm, packet_type, channel, packet, size) == 0) return 1;
+    log_info("daemon_shm_emit_packet: ring full, use socket for client %p", connection);
+    client->shm_tx_suspended = 1;
+    return 0;
+}
+#endif
+
+static void daemon_open_shared_memory(connection_t * connection, uint32_t ring_size){
+    uint8_t event[7];
+    event[0] = DAEMON_EVENT_SHARED_MEMORY_OPENED;
+    event[1] = sizeof(event) - 2;
+    event[2] = ERROR_CODE_UNSUPPORTED_FEATURE_OR_PARAMETER_VALUE;
+    little_endian_store_32(event, 3, 0);
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+    client_state_t * client = client_for_connection(connection);
+    if (!client) return;
+    if (client->shm){
+        event[2] = ERROR_CODE_COMMAND_DISALLOWED;
+    } else {
+        daemon_shm_t * shm = malloc(sizeof(daemon_shm_t));
+        if (!shm || daemon_shm_create(shm, ring_size, &daemon_shm_handler)){
+            free(shm);
+            event[2] = BTSTACK_MEMORY_ALLOC_FAILED;
+        } else {
+            shm->context = client;
+            event[2] = 0;
+            little_endian_store_32(event, 3, daemon_shm_get_ring_size(shm));
+            // memory and doorbells are passed along with the event, only possible for unix domain sockets
+            int fds[DAEMON_SHM_NUM_FDS];
+            daemon_shm_get_fds(shm, fds);
+            if (socket_connection_send_packet_with_fds(connection, HCI_EVENT_PACKET, 0, event, sizeof(event), fds, DAEMON_SHM_NUM_FDS) == 0){
+                log_info("daemon_open_shared_memory: client %p uses %u bytes per ring", connection, daemon_shm_get_ring_size(shm));
+                client->shm = shm;
+                client->shm_tx_suspended = 0;
+                return;
+            }
+            daemon_shm_close(shm);
+            free(shm);
+            event[2] = ERROR_CODE_COMMAND_DISALLOWED;
+            little_endian_store_32(event, 3, 0);
+        }
+    }
+#else
+    UNUSED(ring_size);
+#endif
+    socket_connection_send_packet(connection, HCI_EVENT_PACKET, 0, event, sizeof(event));
+}
+
 static void hci_emit_btstack_version(void){
     log_info("DAEMON_EVENT_VERSION %u.%u", BTSTACK_MAJOR, BTSTACK_MINOR);
     uint8_t event[6];
@@ -962,6 +1074,10 @@ static int btstack_command_handler(connection_t *connection, uint8_t *packet, ui
             // merge state
             gap_discoverable_control(clients_require_discoverable());
             break;
+        case BTSTACK_OPEN_SHARED_MEMORY:
+            log_info("BTSTACK_OPEN_SHARED_MEMORY: %u", little_endian_read_32(packet, 3));
+            daemon_open_shared_memory(connection, little_endian_read_32(packet, 3));
+            break;
         case BTSTACK_SET_BLUETOOTH_ENABLED:
             log_info("BTSTACK_SET_BLUETOOTH_ENABLED: %u\n", packet[3]);
             if (packet[3]) {
@@ -1309,6 +1425,17 @@ static int daemon_client_handler(connection_t *connection, uint16_t packet_type,
     
     int err = 0;
     client_state_t * client;
+
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+    // packets in shared memory were sent before this one
+    if (packet_type != DAEMON_EVENT_PACKET){
+        client = client_for_connection(connection);
+        if (client){
+            err = daemon_shm_process_client(client);
+            if (err) return err;
+        }
+    }
+#endif
     
     switch (packet_type){
         case HCI_COMMAND_DATA_PACKET:
@@ -1436,6 +1563,12 @@ static void daemon_retry_parked(void){
     retry_mutex = 1;
     
     // ... try sending again  
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+    btstack_linked_item_t *it;
+    for (it = (btstack_linked_item_t *) clients; it ; it = it->next){
+        daemon_shm_process_client((client_state_t *) it);
+    }
+#endif
     socket_connection_retry_parked();
 
     // unlock mutex
@@ -1494,6 +1627,10 @@ static void app_run(void){
 
 static void daemon_emit_packet(void * connection, uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
     if (connection) {
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+        if ((packet_type == L2CAP_DATA_PACKET || packet_type == RFCOMM_DATA_PACKET) &&
+            daemon_shm_emit_packet((connection_t *) connection, packet_type, channel, packet, size)) return;
+#endif
         socket_connection_send_packet(connection, packet_type, channel, packet, size);
     } else {
         socket_connection_send_packet_all(packet_type, channel, packet, size);
@@ -1616,7 +1753,7 @@ static void daemon_packet_handler(void * connection, uint8_t packet_type, uint16
             if (!connection) return;
             break;
         case RFCOMM_DATA_PACKET:        
-            connection = connection_for_l2cap_cid(channel);
+            connection = connection_for_rfcomm_cid(channel);
             if (!connection) return;
             break;
         default:
@@ -97,6 +97,13 @@ const hci_cmd_t btstack_set_bluetooth_enabled = {
 OPCODE(OGF_BTSTACK, BTSTACK_SET_BLUETOOTH_ENABLED), "1"
 };
 
+/**
+ * @param ring_size (32), 0 for default
+ */
+const hci_cmd_t btstack_open_shared_memory = {
+OPCODE(OGF_BTSTACK, BTSTACK_OPEN_SHARED_MEMORY), "4"
+};
+
 /**
  * @param bd_addr (48)
  * @param psm (16)
@@ -59,6 +59,7 @@ extern const hci_cmd_t btstack_get_system_bluetooth_enabled;
 extern const hci_cmd_t btstack_set_system_bluetooth_enabled;
 extern const hci_cmd_t btstack_set_discoverable;
 extern const hci_cmd_t btstack_set_bluetooth_enabled;    // only used by btstack config
+extern const hci_cmd_t btstack_open_shared_memory;
 
 extern const hci_cmd_t l2cap_accept_connection_cmd;
 extern const hci_cmd_t l2cap_create_channel_cmd;
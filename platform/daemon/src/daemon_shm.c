@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define __BTSTACK_FILE__ "daemon_shm.c"
+
+/*
+ *  daemon_shm.c
+ *
+ *  Shared memory data path between BTstack daemon and a client
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "btstack_config.h"
+
+#include "daemon_shm.h"
+
+#include "btstack_debug.h"
+#include "btstack_util.h"
+
+#ifdef ENABLE_DAEMON_SHARED_MEMORY
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// record: type (16), channel (16), size (16), reserved (16), data - padded to 8 bytes
+#define DAEMON_SHM_RECORD_HEADER_SIZE 8
+#define DAEMON_SHM_RECORD_WRAP        0xffff
+
+static uint32_t daemon_shm_record_size(uint16_t size){
+    return (DAEMON_SHM_RECORD_HEADER_SIZE + size + 7) & ~7u;
+}
+
+static void daemon_shm_doorbell_signal(int fd){
+    uint64_t value = 1;
+    if (write(fd, &value, sizeof(value)) < 0 && errno != EAGAIN){
+        log_error("daemon_shm: doorbell signal failed, %s", strerror(errno));
+    }
+}
+
+static int daemon_shm_doorbell_clear(int fd){
+    uint64_t value;
+    return read(fd, &value, sizeof(value)) == sizeof(value);
+}
+
+static void daemon_shm_process(btstack_data_source_t *ds, btstack_data_source_callback_type_t callback_type){
+    UNUSED(callback_type);
+    daemon_shm_t * shm = (daemon_shm_t *) ds;
+    daemon_shm_doorbell_clear(ds->fd);
+    (*shm->handler)(shm);
+}
+
+static void daemon_shm_ring_init(daemon_shm_ring_t * ring, uint8_t * memory, uint32_t size){
+    ring->header = (daemon_shm_ring_header_t *) memory;
+    ring->data   = memory + sizeof(daemon_shm_ring_header_t);
+    ring->size   = size;
+}
+
+static int daemon_shm_map(daemon_shm_t * shm, uint32_t ring_size, int tx_index){
+    shm->memory_size = 2 * (sizeof(daemon_shm_ring_header_t) + ring_size);
+    void * memory = mmap(NULL, shm->memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->memory_fd, 0);
+    if (memory == MAP_FAILED){
+        log_error("daemon_shm: mmap failed, %s", strerror(errno));
+        return -1;
+    }
+    shm->memory = (uint8_t *) memory;
+    uint8_t * rings[2];
+    rings[0] = shm->memory;
+    rings[1] = shm->memory + sizeof(daemon_shm_ring_header_t) + ring_size;
+    daemon_shm_ring_init(&shm->tx, rings[tx_index],     ring_size);
+    daemon_shm_ring_init(&shm->rx, rings[1 - tx_index], ring_size);
+    return 0;
+}
+
+static void daemon_shm_start(daemon_shm_t * shm, void (*handler)(daemon_shm_t * shm)){
+    shm->handler = handler;
+    btstack_run_loop_set_data_source_handler(&shm->ds, &daemon_shm_process);
+    btstack_run_loop_enable_data_source_callbacks(&shm->ds, DATA_SOURCE_CALLBACK_READ);
+    btstack_run_loop_add_data_source(&shm->ds);
+}
+
+static void daemon_shm_reset(daemon_shm_t * shm){
+    memset(shm, 0, sizeof(daemon_shm_t));
+    shm->memory_fd = -1;
+    shm->peer_doorbell_fd = -1;
+    shm->ds.fd = -1;
+}
+
+int daemon_shm_create(daemon_shm_t * shm, uint32_t ring_size, void (*handler)(daemon_shm_t * shm)){
+    daemon_shm_reset(shm);
+
+    if (ring_size == 0){
+        ring_size = DAEMON_SHM_RING_SIZE;
+    }
+    ring_size = btstack_max(DAEMON_SHM_RING_SIZE_MIN, btstack_min(DAEMON_SHM_RING_SIZE_MAX, ring_size));
+    uint32_t size = DAEMON_SHM_RING_SIZE_MIN;
+    while (size < ring_size){
+        size <<= 1;
+    }
+
+    // daemon -> client ring first, then client -> daemon ring
+    shm->memory_fd = memfd_create("BTstack", MFD_CLOEXEC);
+    if (shm->memory_fd < 0){
+        log_error("daemon_shm: memfd_create failed, %s", strerror(errno));
+        daemon_shm_close(shm);
+        return -1;
+    }
+    if (ftruncate(shm->memory_fd, 2 * (sizeof(daemon_shm_ring_header_t) + size)) < 0){
+        log_error("daemon_shm: ftruncate failed, %s", strerror(errno));
+        daemon_shm_close(shm);
+        return -1;
+    }
+    shm->ds.fd            = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shm->peer_doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shm->ds.fd < 0 || shm->peer_doorbell_fd < 0 || daemon_shm_map(shm, size, 0)){
+        daemon_shm_close(shm);
+        return -1;
+    }
+
+    daemon_shm_start(shm, handler);
+    log_info("daemon_shm: created %u bytes per ring", size);
+    return 0;
+}
+
+int daemon_shm_attach(daemon_shm_t * shm, const int * fds, void (*handler)(daemon_shm_t * shm)){
+    daemon_shm_reset(shm);
+    shm->memory_fd        = fds[0];
+    shm->ds.fd            = fds[1];
+    shm->peer_doorbell_fd = fds[2];
+
+    struct stat st;
+    if (fstat(shm->memory_fd, &st) < 0){
+        daemon_shm_close(shm);
+        return -1;
+    }
+    uint32_t size = (uint32_t) (st.st_size / 2 - sizeof(daemon_shm_ring_header_t));
+    if (size < DAEMON_SHM_RING_SIZE_MIN || size > DAEMON_SHM_RING_SIZE_MAX || (size & (size - 1))){
+        log_error("daemon_shm: invalid size of shared memory %u", (int) st.st_size);
+        daemon_shm_close(shm);
+        return -1;
+    }
+    if (daemon_shm_map(shm, size, 1)){
+        daemon_shm_close(shm);
+        return -1;
+    }
+
+    daemon_shm_start(shm, handler);
+    return 0;
+}
+
+void daemon_shm_get_fds(daemon_shm_t * shm, int * fds){
+    fds[0] = shm->memory_fd;
+    fds[1] = shm->peer_doorbell_fd;
+    fds[2] = shm->ds.fd;
+}
+
+uint32_t daemon_shm_get_ring_size(daemon_shm_t * shm){
+    return shm->tx.size;
+}
+
+void daemon_shm_close(daemon_shm_t * shm){
+    if (shm->handler){
+        btstack_run_loop_remove_data_source(&shm->ds);
+    }
+    if (shm->memory){
+        munmap(shm->memory, shm->memory_size);
+    }
+    if (shm->memory_fd >= 0){
+        close(shm->memory_fd);
+    }
+    if (shm->ds.fd >= 0){
+        close(shm->ds.fd);
+    }
+    if (shm->peer_doorbell_fd >= 0){
+        close(shm->peer_doorbell_fd);
+    }
+    daemon_shm_reset(shm);
+}
+
+int daemon_shm_send_packet(daemon_shm_t * shm, uint16_t type, uint16_t channel, const uint8_t * data, uint16_t size){
+    daemon_shm_ring_t * ring = &shm->tx;
+    daemon_shm_ring_header_t * header = ring->header;
+
+    uint32_t head = shm->tx_head;
+    uint32_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+    uint32_t pos  = head & (ring->size - 1);
+    uint32_t record_size = daemon_shm_record_size(size);
+    uint32_t contiguous  = ring->size - pos;
+    uint32_t needed = record_size <= contiguous ? record_size : contiguous + record_size;
+
+    if (ring->size - (head - tail) < needed){
+        // ask consumer to signal doorbell after it freed space, check again in case it just did
+        __atomic_store_n(&header->producer_waiting, 1, __ATOMIC_SEQ_CST);
+        tail = __atomic_load_n(&header->tail, __ATOMIC_SEQ_CST);
+        if (ring->size - (head - tail) < needed) return -1;
+        __atomic_store_n(&header->producer_waiting, 0, __ATOMIC_RELAXED);
+    }
+
+    uint32_t write_head = head;
+    if (record_size > contiguous){
+        // skip rest of ring
+        little_endian_store_16(&ring->data[pos], 0, DAEMON_SHM_RECORD_WRAP);
+        write_head += contiguous;
+        pos = 0;
+    }
+    uint8_t * record = &ring->data[pos];
+    little_endian_store_16(record, 0, type);
+    little_endian_store_16(record, 2, channel);
+    little_endian_store_16(record, 4, size);
+    little_endian_store_16(record, 6, 0);
+    memcpy(&record[DAEMON_SHM_RECORD_HEADER_SIZE], data, size);
+    shm->tx_head = write_head + record_size;
+    __atomic_store_n(&header->head, shm->tx_head, __ATOMIC_RELEASE);
+
+    // consumer might sleep if it has consumed everything before this packet
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->tail, __ATOMIC_RELAXED) == head){
+        daemon_shm_doorbell_signal(shm->peer_doorbell_fd);
+    }
+    return 0;
+}
+
+int daemon_shm_send_packet_blocking(daemon_shm_t * shm, uint16_t type, uint16_t channel, const uint8_t * data, uint16_t size, int timeout_ms){
+    int doorbell_cleared = 0;
+    int err;
+    while (1){
+        err = daemon_shm_send_packet(shm, type, channel, data, size);
+        if (!err) break;
+        struct pollfd pfd;
+        pfd.fd = shm->ds.fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout_ms) <= 0) break;
+        doorbell_cleared |= daemon_shm_doorbell_clear(shm->ds.fd);
+    }
+    // the doorbell might also have been signaled for new packets in the rx ring
+    if (doorbell_cleared){
+        daemon_shm_doorbell_signal(shm->ds.fd);
+    }
+    return err;
+}
+
+uint8_t * daemon_shm_peek_packet(daemon_shm_t * shm, uint16_t * type, uint16_t * channel, uint16_t * size){
+    daemon_shm_ring_t * ring = &shm->rx;
+    daemon_shm_ring_header_t * header = ring->header;
+
+    // ring is written by peer, validate everything
+    uint32_t tail = shm->rx_tail;
+    while (1){
+        uint32_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        uint32_t available = head - tail;
+        if (available == 0) return NULL;
+        if (available > ring->size || (available & 7)){
+            log_error("daemon_shm: invalid ring head %u, tail %u", head, tail);
+            return NULL;
+        }
+        uint32_t pos = tail & (ring->size - 1);
+        uint32_t contiguous = ring->size - pos;
+        uint8_t * record = &ring->data[pos];
+        uint16_t record_type = little_endian_read_16(record, 0);
+        if (record_type == DAEMON_SHM_RECORD_WRAP){
+            if (contiguous > available){
+                log_error("daemon_shm: invalid wrap record");
+                return NULL;
+            }
+            tail += contiguous;
+            shm->rx_tail = tail;
+            __atomic_store_n(&header->tail, tail, __ATOMIC_RELEASE);
+            continue;
+        }
+        uint16_t record_length = little_endian_read_16(record, 4);
+        uint32_t record_size = daemon_shm_record_size(record_length);
+        if (record_size > available || record_size > contiguous){
+            log_error("daemon_shm: invalid record size %u", record_length);
+            return NULL;
+        }
+        shm->rx_record_size = record_size;
+        *type    = record_type;
+        *channel = little_endian_read_16(record, 2);
+        *size    = record_length;
+        return &record[DAEMON_SHM_RECORD_HEADER_SIZE];
+    }
+}
+
+void daemon_shm_consume_packet(daemon_shm_t * shm){
+    daemon_shm_ring_header_t * header = shm->rx.header;
+    shm->rx_tail += shm->rx_record_size;
+    shm->rx_record_size = 0;
+    __atomic_store_n(&header->tail, shm->rx_tail, __ATOMIC_RELEASE);
+
+    // producer might wait for space
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->producer_waiting, __ATOMIC_RELAXED)){
+        __atomic_store_n(&header->producer_waiting, 0, __ATOMIC_RELAXED);
+        daemon_shm_doorbell_signal(shm->peer_doorbell_fd);
+    }
+}
+
+#endif
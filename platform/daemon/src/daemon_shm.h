@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  daemon_shm.h
+ *
+ *  Optional shared memory data path between BTstack daemon and a client
+ *
+ *  L2CAP and RFCOMM data is exchanged through two single-producer/single-consumer rings in a
+ *  shared memory region, one per direction. Each side has an eventfd as doorbell that the peer
+ *  signals when it put packets into an empty ring or freed space in a ring it found full.
+ *  The region and the eventfds are created by the daemon and passed to the client over the
+ *  unix domain socket, all other packets stay on the socket.
+ */
+
+#ifndef __DAEMON_SHM_H
+#define __DAEMON_SHM_H
+
+#include "btstack_run_loop.h"
+
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+// default size of each ring, power of two
+#ifndef DAEMON_SHM_RING_SIZE
+#define DAEMON_SHM_RING_SIZE     (256 * 1024)
+#endif
+
+// packets up to 64 kB have to fit twice, as a packet that does not fit at the end skips the rest of the ring
+#define DAEMON_SHM_RING_SIZE_MIN (256 * 1024)
+#define DAEMON_SHM_RING_SIZE_MAX (4 * 1024 * 1024)
+
+// file descriptors passed from daemon to client: memory, client doorbell, daemon doorbell
+#define DAEMON_SHM_NUM_FDS 3
+
+/** ring header in shared memory, producer and consumer index on separate cache lines */
+typedef struct {
+    uint32_t head;                  // written by producer
+    uint8_t  producer_padding[60];
+    uint32_t tail;                  // written by consumer
+    uint8_t  producer_waiting;      // set by producer if ring was full, consumer signals doorbell after consume
+    uint8_t  consumer_padding[59];
+} daemon_shm_ring_header_t;
+
+typedef struct {
+    daemon_shm_ring_header_t * header;
+    uint8_t * data;
+    uint32_t  size;
+} daemon_shm_ring_t;
+
+typedef struct daemon_shm {
+    // doorbell of this side - assert: first field
+    btstack_data_source_t ds;
+
+    void (*handler)(struct daemon_shm * shm);
+    void * context;
+
+    int       memory_fd;
+    int       peer_doorbell_fd;
+    uint8_t * memory;
+    uint32_t  memory_size;
+
+    // own copies of indices, the peer could modify the ones in shared memory
+    daemon_shm_ring_t tx;
+    uint32_t          tx_head;
+    daemon_shm_ring_t rx;
+    uint32_t          rx_tail;
+    uint32_t          rx_record_size;
+} daemon_shm_t;
+
+/**
+ * @brief Create shared memory region and doorbells (daemon)
+ * @param shm
+ * @param ring_size of each direction, 0 for DAEMON_SHM_RING_SIZE, rounded up to power of two
+ * @param handler called from run loop when doorbell was signaled
+ * @returns 0 if ok
+ */
+int daemon_shm_create(daemon_shm_t * shm, uint32_t ring_size, void (*handler)(daemon_shm_t * shm));
+
+/**
+ * @brief Map shared memory region received from daemon (client). Takes ownership of fds
+ * @param shm
+ * @param fds as provided by daemon_shm_get_fds
+ * @param handler called from run loop when doorbell was signaled
+ * @returns 0 if ok
+ */
+int daemon_shm_attach(daemon_shm_t * shm, const int * fds, void (*handler)(daemon_shm_t * shm));
+
+/**
+ * @brief Get fds to pass to client
+ * @param shm created by daemon_shm_create
+ * @param fds array of DAEMON_SHM_NUM_FDS
+ */
+void daemon_shm_get_fds(daemon_shm_t * shm, int * fds);
+
+/**
+ * @brief Get size of each ring
+ */
+uint32_t daemon_shm_get_ring_size(daemon_shm_t * shm);
+
+/**
+ * @brief Unmap memory, close fds and remove doorbell from run loop
+ */
+void daemon_shm_close(daemon_shm_t * shm);
+
+/**
+ * @brief Put packet into tx ring and signal peer if it might be waiting
+ * @returns 0 if ok, -1 if ring is full. The peer signals the doorbell when space becomes available
+ */
+int daemon_shm_send_packet(daemon_shm_t * shm, uint16_t type, uint16_t channel, const uint8_t * data, uint16_t size);
+
+/**
+ * @brief Get next packet from rx ring without consuming it
+ * @note the packet stays valid until daemon_shm_consume_packet is called
+ * @returns pointer to packet data or NULL if ring is empty or corrupted
+ */
+uint8_t * daemon_shm_peek_packet(daemon_shm_t * shm, uint16_t * type, uint16_t * channel, uint16_t * size);
+
+/**
+ * @brief Release packet returned by daemon_shm_peek_packet and signal peer if it is waiting for space
+ */
+void daemon_shm_consume_packet(daemon_shm_t * shm);
+
+/**
+ * @brief Put packet into tx ring, wait for peer to free space if it is full
+ * @note the handler is not called while waiting, but gets called from the run loop afterwards
+ * @returns 0 if ok, -1 if ring is still full after timeout
+ */
+int daemon_shm_send_packet_blocking(daemon_shm_t * shm, uint16_t type, uint16_t channel, const uint8_t * data, uint16_t size, int timeout_ms);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __DAEMON_SHM_H
@@ -70,6 +70,7 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #endif
  
@@ -86,14 +87,40 @@ struct sockaddr_un {
 //
 #define S_IRWXG 0
 #define S_IRWXO 0
+//
+struct iovec {
+    void * iov_base;
+    size_t iov_len;
+};
 #endif
 
 #ifdef USE_LAUNCHD
 #include "../port/ios/3rdparty/launch.h"
 #endif
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
 #define MAX_PENDING_CONNECTIONS 10
 
+// packets that cannot be sent right away are queued in the output buffer of the connection
+#ifndef SOCKET_CONNECTION_OUTPUT_BUFFER_SIZE
+#define SOCKET_CONNECTION_OUTPUT_BUFFER_SIZE 65536
+#endif
+
+// stop reading from a client while its output buffer is above the high watermark,
+// continue when it dropped below the low watermark
+#define SOCKET_CONNECTION_OUTPUT_HIGH_WATERMARK (SOCKET_CONNECTION_OUTPUT_BUFFER_SIZE / 2)
+#define SOCKET_CONNECTION_OUTPUT_LOW_WATERMARK  (SOCKET_CONNECTION_OUTPUT_BUFFER_SIZE / 4)
+
+// file descriptors passed along with a packet over unix domain sockets
+#define SOCKET_CONNECTION_MAX_FDS 4
+
 /** prototypes */
 static void socket_connection_hci_process(btstack_data_source_t *ds, btstack_data_source_callback_type_t callback_type);
 static int socket_connection_dummy_handler(connection_t *connection, uint16_t packet_type, uint16_t channel, uint8_t *data, uint16_t length);
@@ -121,10 +148,21 @@ typedef struct linked_connection {
 struct connection {
     btstack_data_source_t ds;                // used for run loop
     linked_connection_t linked_connection;   // used for connection list
+    linked_connection_t parked_connection;   // used for parked list
     SOCKET_STATE state;
     uint16_t bytes_read;
     uint16_t bytes_to_read;
     uint8_t  buffer[6+HCI_ACL_BUFFER_SIZE]; // packet_header(6) + max packet: 3-DH5 = header(6) + payload (1021)
+    int      received_fds[SOCKET_CONNECTION_MAX_FDS];
+    int      num_received_fds;
+
+    // output
+    uint8_t  park_on_backpressure;          // only for accepted connections, clients keep reading
+    uint8_t  output_parked;
+    uint8_t  broken;
+    uint32_t output_pos;
+    uint32_t output_len;
+    uint8_t  output_buffer[SOCKET_CONNECTION_OUTPUT_BUFFER_SIZE];
 };
 
 /** list of socket connections */
@@ -145,12 +183,45 @@ static int socket_connection_dummy_handler(connection_t *connection, uint16_t pa
     return 0;
 }
 
+static int socket_connection_is_parked(connection_t *conn){
+    btstack_linked_item_t *it;
+    for (it = (btstack_linked_item_t *) parked; it ; it = it->next){
+        if (it == &conn->parked_connection.item) return 1;
+    }
+    return 0;
+}
+
+// read while connection is neither parked nor broken, write while output is queued
+static void socket_connection_update_callbacks(connection_t *conn){
+    if (conn->broken || (!conn->output_parked && !socket_connection_is_parked(conn))){
+        btstack_run_loop_enable_data_source_callbacks(&conn->ds, DATA_SOURCE_CALLBACK_READ);
+    } else {
+        btstack_run_loop_disable_data_source_callbacks(&conn->ds, DATA_SOURCE_CALLBACK_READ);
+    }
+    if (!conn->broken && conn->output_len){
+        btstack_run_loop_enable_data_source_callbacks(&conn->ds, DATA_SOURCE_CALLBACK_WRITE);
+    } else {
+        btstack_run_loop_disable_data_source_callbacks(&conn->ds, DATA_SOURCE_CALLBACK_WRITE);
+    }
+}
+
+static void socket_connection_close_received_fds(connection_t *conn){
+    int i;
+    for (i = 0; i < conn->num_received_fds; i++){
+        close(conn->received_fds[i]);
+    }
+    conn->num_received_fds = 0;
+}
+
 static void socket_connection_free_connection(connection_t *conn){
+    socket_connection_close_received_fds(conn);
+
     // remove from run_loop 
     btstack_run_loop_remove_data_source(&conn->ds);
     
-    // and from connection list
+    // and from connection and parked lists
     btstack_linked_list_remove(&connections, &conn->linked_connection.item);
+    btstack_linked_list_remove(&parked, &conn->parked_connection.item);
     
     // destroy
     free(conn);
@@ -168,8 +239,20 @@ static connection_t * socket_connection_register_new_connection(int fd){
     connection_t * conn = malloc( sizeof(connection_t));
     if (conn == NULL) return 0;
 
-    // store reference from linked item to base object
+    // store reference from linked items to base object
     conn->linked_connection.connection = conn;
+    conn->parked_connection.connection = conn;
+
+    // output is queued instead of blocking the run loop
+#ifndef _WIN32
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    conn->park_on_backpressure = 0;
+    conn->output_parked = 0;
+    conn->broken = 0;
+    conn->output_pos = 0;
+    conn->output_len = 0;
+    conn->num_received_fds = 0;
 
     btstack_run_loop_set_data_source_handler(&conn->ds, &socket_connection_hci_process);
     btstack_run_loop_set_data_source_fd(&conn->ds, fd);
@@ -199,12 +282,136 @@ void static socket_connection_emit_connection_closed(connection_t *connection){
     (*socket_connection_packet_callback)(connection, DAEMON_EVENT_PACKET, 0, (uint8_t *) &event, 1);
 }
 
+static int socket_connection_writev(int fd, struct iovec * iov, int iovcnt){
+#ifdef _WIN32
+    // no writev, write blocks one by one until one is not written completely
+    int bytes_written = 0;
+    int i;
+    for (i = 0; i < iovcnt; i++){
+        int res = write(fd, iov[i].iov_base, iov[i].iov_len);
+        if (res < 0) return bytes_written ? bytes_written : res;
+        bytes_written += res;
+        if ((size_t) res < iov[i].iov_len) break;
+    }
+    return bytes_written;
+#else
+    return writev(fd, iov, iovcnt);
+#endif
+}
+
+// connection cannot be used anymore: stop writing and let the read handler close it
+static void socket_connection_mark_broken(connection_t *conn){
+    if (conn->broken) return;
+    conn->broken = 1;
+    conn->output_len = 0;
+#ifdef _WIN32
+    shutdown(conn->ds.fd, SD_BOTH);
+#else
+    shutdown(conn->ds.fd, SHUT_RDWR);
+#endif
+    socket_connection_update_callbacks(conn);
+}
+
+// write as much of the output buffer as possible in a single writev
+static void socket_connection_flush(connection_t *conn){
+    if (conn->output_len == 0) return;
+    struct iovec iov[2];
+    int iovcnt = 1;
+    uint32_t first_len = btstack_min(conn->output_len, SOCKET_CONNECTION_OUTPUT_BUFFER_SIZE - conn->output_pos);
+    iov[0].iov_base = &conn->output_buffer[conn->output_pos];
+    iov[0].iov_len  = first_len;
+    if (first_len < conn->output_len){
+        iov[1].iov_base = conn->output_buffer;
+        iov[1].iov_len  = conn->output_len - first_len;
+        iovcnt = 2;
+    }
+    int bytes_written = socket_connection_writev(conn->ds.fd, iov, iovcnt);
+    if (bytes_written < 0){
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+        log_error("socket_connection_flush: write failed, %s", strerror(errno));
+        socket_connection_mark_broken(conn);
+        return;
+    }
+    conn->output_pos = (conn->output_pos + bytes_written) % SOCKET_CONNECTION_OUTPUT_BUFFER_SIZE;
+    conn->output_len -= bytes_written;
+    if (conn->output_len == 0){
+        conn->output_pos = 0;
+    }
+    if (conn->output_parked && conn->output_len < SOCKET_CONNECTION_OUTPUT_LOW_WATERMARK){
+        log_info("socket_connection_flush: output drained -> un-park connection %p", conn);
+        conn->output_parked = 0;
+    }
+    socket_connection_update_callbacks(conn);
+}
+
+static void socket_connection_queue_output(connection_t *conn, const uint8_t * data, uint32_t len){
+    uint32_t write_pos = (conn->output_pos + conn->output_len) % SOCKET_CONNECTION_OUTPUT_BUFFER_SIZE;
+    uint32_t first_len = btstack_min(len, SOCKET_CONNECTION_OUTPUT_BUFFER_SIZE - write_pos);
+    memcpy(&conn->output_buffer[write_pos], data, first_len);
+    memcpy(conn->output_buffer, &data[first_len], len - first_len);
+    conn->output_len += len;
+}
+
+// send queued output before the connection gets closed
+static void socket_connection_flush_blocking(connection_t *conn){
+    if (conn->output_len == 0) return;
+#ifndef _WIN32
+    fcntl(conn->ds.fd, F_SETFL, fcntl(conn->ds.fd, F_GETFL, 0) & ~O_NONBLOCK);
+#endif
+    while (conn->output_len && !conn->broken){
+        socket_connection_flush(conn);
+    }
+}
+
+// read and keep file descriptors that were passed along, until the packet has been dispatched
+static int socket_connection_read(connection_t *conn, int fd){
+#ifdef _WIN32
+    return read(fd, &conn->buffer[conn->bytes_read], conn->bytes_to_read);
+#else
+    union {
+        struct cmsghdr header;
+        uint8_t        buffer[CMSG_SPACE(SOCKET_CONNECTION_MAX_FDS * sizeof(int))];
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    iov.iov_base = &conn->buffer[conn->bytes_read];
+    iov.iov_len  = conn->bytes_to_read;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    int bytes_read = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (bytes_read <= 0) return bytes_read;
+    struct cmsghdr * cmsg;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        int num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int i;
+        for (i = 0; i < num_fds; i++){
+            int received_fd;
+            memcpy(&received_fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (conn->num_received_fds < SOCKET_CONNECTION_MAX_FDS){
+                conn->received_fds[conn->num_received_fds++] = received_fd;
+            } else {
+                close(received_fd);
+            }
+        }
+    }
+    return bytes_read;
+#endif
+}
+
 void socket_connection_hci_process(btstack_data_source_t *ds, btstack_data_source_callback_type_t callback_type) {
-    UNUSED(callback_type);
     connection_t *conn = (connection_t *) ds;
+    if (callback_type == DATA_SOURCE_CALLBACK_WRITE){
+        socket_connection_flush(conn);
+        return;
+    }
     int fd = btstack_run_loop_get_data_source_fd(ds);
-    int bytes_read = read(fd, &conn->buffer[conn->bytes_read], conn->bytes_to_read);
-    if (bytes_read <= 0){
+    int bytes_read = socket_connection_read(conn, fd);
+    if (bytes_read < 0 && !conn->broken && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (bytes_read <= 0 || conn->broken){
         // connection broken (no particular channel, no date yet)
         socket_connection_emit_connection_closed(conn);
         
@@ -238,14 +445,17 @@ void socket_connection_hci_process(btstack_data_source_t *ds, btstack_data_sourc
         int dispatch_err = (*socket_connection_packet_callback)(conn, little_endian_read_16( conn->buffer, 0), little_endian_read_16( conn->buffer, 2),
                                                             &conn->buffer[sizeof(packet_header_t)], little_endian_read_16( conn->buffer, 4));
         
+        // file descriptors not taken by packet handler
+        socket_connection_close_received_fds(conn);
+
         // reset state machine
         socket_connection_init_statemachine(conn);
         
         // "park" if dispatch failed
         if (dispatch_err) {
             log_info("socket_connection_hci_process dispatch failed -> park connection");
-            btstack_run_loop_remove_data_source(ds);
-            btstack_linked_list_add_tail(&parked, (btstack_linked_item_t *) ds);
+            btstack_linked_list_add_tail(&parked, &conn->parked_connection.item);
+            socket_connection_update_callbacks(conn);
         }
     }
 }
@@ -259,7 +469,7 @@ void socket_connection_retry_parked(void){
     // log_info("socket_connection_hci_process retry parked");
     btstack_linked_item_t *it = (btstack_linked_item_t *) &parked;
     while (it->next) {
-        connection_t * conn = (connection_t *) it->next;
+        connection_t * conn = ((linked_connection_t *) it->next)->connection;
         
         // dispatch packet !!! connection, type, channel, data, size
         uint16_t packet_type = little_endian_read_16( conn->buffer, 0);
@@ -271,7 +481,7 @@ void socket_connection_retry_parked(void){
         if (!dispatch_err) {
             log_info("socket_connection_hci_process dispatch succeeded -> un-park connection %p", conn);
             it->next = it->next->next;
-            btstack_run_loop_add_data_source( (btstack_data_source_t *) conn);
+            socket_connection_update_callbacks(conn);
         } else {
             it = it->next;
         }
@@ -298,6 +508,11 @@ static void socket_connection_accept(btstack_data_source_t *socket_ds, btstack_d
     log_info("socket_connection_accept new connection %u", fd);
     
     connection_t * connection = socket_connection_register_new_connection(fd);
+    if (!connection){
+        close(fd);
+        return;
+    }
+    connection->park_on_backpressure = 1;
     socket_connection_emit_connection_opened(connection);
 }
 
@@ -509,14 +724,131 @@ void socket_connection_register_packet_callback( int (*packet_callback)(connecti
 
 /**
  * send HCI packet to single connection
+ * writes header and packet with a single writev if nothing is queued, queues the rest otherwise
  */
 void socket_connection_send_packet(connection_t *conn, uint16_t type, uint16_t channel, uint8_t *packet, uint16_t size){
+    if (conn->broken) return;
+
+    uint8_t header[sizeof(packet_header_t)];
+    little_endian_store_16(header, 0, type);
+    little_endian_store_16(header, 2, channel);
+    little_endian_store_16(header, 4, size);
+
+    uint32_t bytes_written = 0;
+    if (conn->output_len == 0){
+        struct iovec iov[2];
+        iov[0].iov_base = header;
+        iov[0].iov_len  = sizeof(header);
+        iov[1].iov_base = packet;
+        iov[1].iov_len  = size;
+        int res = socket_connection_writev(conn->ds.fd, iov, 2);
+        if (res < 0){
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                log_error("socket_connection_send_packet: write failed, %s", strerror(errno));
+                socket_connection_mark_broken(conn);
+                return;
+            }
+            res = 0;
+        }
+        bytes_written = res;
+        if (bytes_written == sizeof(header) + size) return;
+    }
+
+    // queue remainder, drop client that does not read
+    if (conn->output_len + sizeof(header) + size - bytes_written > SOCKET_CONNECTION_OUTPUT_BUFFER_SIZE){
+        log_error("socket_connection_send_packet: output buffer of connection %p full -> close", conn);
+        socket_connection_mark_broken(conn);
+        return;
+    }
+    if (bytes_written < sizeof(header)){
+        socket_connection_queue_output(conn, &header[bytes_written], sizeof(header) - bytes_written);
+        socket_connection_queue_output(conn, packet, size);
+    } else {
+        bytes_written -= sizeof(header);
+        socket_connection_queue_output(conn, &packet[bytes_written], size - bytes_written);
+    }
+    if (conn->park_on_backpressure && !conn->output_parked && conn->output_len > SOCKET_CONNECTION_OUTPUT_HIGH_WATERMARK){
+        log_info("socket_connection_send_packet: output backed up -> park connection %p", conn);
+        conn->output_parked = 1;
+    }
+    socket_connection_update_callbacks(conn);
+}
+
+/**
+ * send HCI packet together with file descriptors to single unix domain connection
+ * fails instead of queuing, as file descriptors cannot be sent after the packet data
+ */
+int socket_connection_send_packet_with_fds(connection_t *conn, uint16_t type, uint16_t channel, uint8_t *packet, uint16_t size, const int * fds, int num_fds){
+#ifdef _WIN32
+    UNUSED(conn);
+    UNUSED(type);
+    UNUSED(channel);
+    UNUSED(packet);
+    UNUSED(size);
+    UNUSED(fds);
+    UNUSED(num_fds);
+    return -1;
+#else
+    if (conn->broken || conn->output_len || num_fds > SOCKET_CONNECTION_MAX_FDS) return -1;
+
     uint8_t header[sizeof(packet_header_t)];
     little_endian_store_16(header, 0, type);
     little_endian_store_16(header, 2, channel);
     little_endian_store_16(header, 4, size);
-    write(conn->ds.fd, header, 6);
-    write(conn->ds.fd, packet, size);
+
+    union {
+        struct cmsghdr header;
+        uint8_t        buffer[CMSG_SPACE(SOCKET_CONNECTION_MAX_FDS * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len  = sizeof(header);
+    iov[1].iov_base = packet;
+    iov[1].iov_len  = size;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(num_fds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+
+    int res = sendmsg(conn->ds.fd, &msg, MSG_NOSIGNAL);
+    if (res <= 0){
+        log_error("socket_connection_send_packet_with_fds: sendmsg failed, %s", strerror(errno));
+        return -1;
+    }
+
+    // file descriptors went with the first byte, queue remainder
+    uint32_t bytes_written = res;
+    if (bytes_written < sizeof(header)){
+        socket_connection_queue_output(conn, &header[bytes_written], sizeof(header) - bytes_written);
+        socket_connection_queue_output(conn, packet, size);
+    } else {
+        bytes_written -= sizeof(header);
+        socket_connection_queue_output(conn, &packet[bytes_written], size - bytes_written);
+    }
+    socket_connection_update_callbacks(conn);
+    return 0;
+#endif
+}
+
+/**
+ * take file descriptors received with the packet that is currently dispatched
+ */
+int socket_connection_take_received_fds(connection_t *conn, int * fds, int max_fds){
+    int num_fds = btstack_min(conn->num_received_fds, max_fds);
+    memcpy(fds, conn->received_fds, num_fds * sizeof(int));
+    // close the ones that do not fit
+    conn->num_received_fds -= num_fds;
+    memmove(conn->received_fds, &conn->received_fds[num_fds], conn->num_received_fds * sizeof(int));
+    socket_connection_close_received_fds(conn);
+    return num_fds;
 }
 
 /**
@@ -567,6 +899,7 @@ connection_t * socket_connection_open_tcp(const char *address, uint16_t port){
  */
 int socket_connection_close_tcp(connection_t * connection){
     if (!connection) return -1;
+    socket_connection_flush_blocking(connection);
 #ifdef _WIN32
     shutdown(connection->ds.fd, SD_BOTH);
 #else    
@@ -604,6 +937,7 @@ connection_t * socket_connection_open_unix(void){
  */
 int socket_connection_close_unix(connection_t * connection){
     if (!connection) return -1;
+    socket_connection_flush_blocking(connection);
 #ifdef _WIN32
     shutdown(connection->ds.fd, SD_BOTH);
 #else    
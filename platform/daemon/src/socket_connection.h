@@ -109,9 +109,24 @@ void socket_connection_register_packet_callback( int (*packet_callback)(connecti
 
 /**
  * send HCI packet to single connection
+ * does not block, packets that cannot be sent right away are queued and sent when the socket becomes writable.
+ * accepted connections stop reading new packets while their queue is long and get closed when it is full
  */
 void socket_connection_send_packet(connection_t *connection, uint16_t packet_type, uint16_t channel, uint8_t *data, uint16_t size);
 
+/**
+ * send HCI packet together with file descriptors, only supported for unix domain sockets
+ * @return 0 if packet was sent, -1 if not possible (e.g. TCP connection or output queued)
+ */
+int socket_connection_send_packet_with_fds(connection_t *connection, uint16_t packet_type, uint16_t channel, uint8_t *data, uint16_t size, const int * fds, int num_fds);
+
+/**
+ * take file descriptors received with the packet that is currently dispatched, e.g. from packet handler
+ * ownership is transferred to the caller, file descriptors that are not taken are closed after dispatch
+ * @return number of file descriptors stored in fds
+ */
+int socket_connection_take_received_fds(connection_t *connection, int * fds, int max_fds);
+
 /**
  * send event data to all clients
  */
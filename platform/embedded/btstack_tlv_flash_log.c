@@ -0,0 +1,546 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY MATTHIAS RINGWALD AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+#define __BTSTACK_FILE__ "btstack_tlv_flash_log.c"
+
+#include "btstack_tlv.h"
+#include "btstack_tlv_flash_log.h"
+#include "btstack_debug.h"
+#include "btstack_util.h"
+
+#include <string.h>
+
+// Header:
+// - Magic: 'BTLG'
+// - Sequence Number: 32 bit, incremented for every bank that is opened
+
+// Entries
+// - Tag: 32 bit, overwritten with 0 if deleted or updated
+// - Len: 32 bit
+// - Value: Len in bytes
+// The value is written before tag and len
+
+#define BTSTACK_TLV_HEADER_LEN 8
+#define BTSTACK_TLV_ENTRY_HEADER_LEN 8
+
+#define BTSTACK_TLV_ERASED_SEQ 0xffffffff
+#define BTSTACK_TLV_ERASED_TAG 0xffffffff
+#define BTSTACK_TLV_DELETED_TAG 0
+
+#ifndef BTSTACK_FLASH_ALIGNMENT_MAX
+#define BTSTACK_FLASH_ALIGNMENT_MAX 8
+#endif
+
+static const char * btstack_tlv_header_magic = "BTLG";
+
+static uint32_t btstack_tlv_flash_log_align_size(btstack_tlv_flash_log_t * self, uint32_t size){
+	uint32_t aligment = self->hal_flash_bank_impl->get_alignment(self->hal_flash_bank_context);
+	return (size + aligment - 1) & ~(aligment - 1);
+}
+
+static uint32_t btstack_tlv_flash_log_entry_size(btstack_tlv_flash_log_t * self, uint32_t len){
+	return BTSTACK_TLV_ENTRY_HEADER_LEN + btstack_tlv_flash_log_align_size(self, len);
+}
+
+static uint32_t btstack_tlv_flash_log_bank_size(btstack_tlv_flash_log_t * self){
+	return self->hal_flash_bank_impl->get_size(self->hal_flash_bank_context);
+}
+
+// support unaligned flash read/writes
+// strategy: increase size to meet alignment, perform unaligned read/write of last chunk with helper buffer
+
+static void btstack_tlv_flash_log_read(btstack_tlv_flash_log_t * self, int bank, uint32_t offset, uint8_t * buffer, uint32_t size){
+
+	// read main data
+	uint32_t aligment = self->hal_flash_bank_impl->get_alignment(self->hal_flash_bank_context);
+	uint32_t lower_bits = size & (aligment - 1);
+	uint32_t size_aligned = size - lower_bits;
+	if (size_aligned){
+		self->hal_flash_bank_impl->read(self->hal_flash_bank_context, bank, offset, buffer, size_aligned);
+		buffer += size_aligned;
+		offset += size_aligned;
+		size   -= size_aligned;
+	}
+
+	// read last part
+	if (size == 0) return;
+	uint8_t aligment_block[BTSTACK_FLASH_ALIGNMENT_MAX];
+	self->hal_flash_bank_impl->read(self->hal_flash_bank_context, bank, offset, aligment_block, aligment);
+	uint32_t bytes_to_copy = btstack_min(aligment - lower_bits, size);
+	memcpy(buffer, aligment_block, bytes_to_copy);
+}
+
+static void btstack_tlv_flash_log_write(btstack_tlv_flash_log_t * self, int bank, uint32_t offset, const uint8_t * buffer, uint32_t size){
+
+	// write main data
+	uint32_t aligment = self->hal_flash_bank_impl->get_alignment(self->hal_flash_bank_context);
+	uint32_t lower_bits = size & (aligment - 1);
+	uint32_t size_aligned = size - lower_bits;
+	if (size_aligned){
+		self->hal_flash_bank_impl->write(self->hal_flash_bank_context, bank, offset, buffer, size_aligned);
+		buffer += size_aligned;
+		offset += size_aligned;
+		size   -= size_aligned;
+	}
+
+	// write last part
+	if (size == 0) return;
+	uint8_t aligment_block[BTSTACK_FLASH_ALIGNMENT_MAX];
+	memset(aligment_block, 0xff, aligment);
+	memcpy(aligment_block, buffer, lower_bits);
+	self->hal_flash_bank_impl->write(self->hal_flash_bank_context, bank, offset, aligment_block, aligment);
+}
+
+static void btstack_tlv_flash_log_read_entry_header(btstack_tlv_flash_log_t * self, int bank, uint32_t offset, uint32_t * tag, uint32_t * len){
+	uint8_t entry[BTSTACK_TLV_ENTRY_HEADER_LEN];
+	btstack_tlv_flash_log_read(self, bank, offset, entry, sizeof(entry));
+	*tag = big_endian_read_32(entry, 0);
+	*len = big_endian_read_32(entry, 4);
+}
+
+// overwrite tag with invalid tag
+static void btstack_tlv_flash_log_invalidate_entry(btstack_tlv_flash_log_t * self, int bank, uint32_t offset){
+	uint32_t zero_tag = 0;
+	btstack_tlv_flash_log_write(self, bank, offset, (uint8_t*) &zero_tag, sizeof(zero_tag));
+}
+
+/**
+ * @brief Check if erased from offset
+ */
+static int btstack_tlv_flash_log_test_erased(btstack_tlv_flash_log_t * self, int bank, uint32_t offset){
+	uint32_t size = btstack_tlv_flash_log_bank_size(self);
+	uint8_t buffer[16];
+	uint8_t empty16[16];
+	memset(empty16, 0xff, sizeof(empty16));
+	while (offset < size){
+		uint32_t copy_size = (offset + sizeof(empty16) < size) ? sizeof(empty16) : (size - offset); 
+		btstack_tlv_flash_log_read(self, bank, offset, buffer, copy_size);
+		if (memcmp(buffer, empty16, copy_size)) return 0;
+		offset += copy_size;
+	}
+	return 1;
+}
+
+static void btstack_tlv_flash_log_erase_bank(btstack_tlv_flash_log_t * self, int bank){
+	log_info("erase bank %u", bank);
+	self->hal_flash_bank_impl->erase(self->hal_flash_bank_context, bank);
+	self->bank_seq[bank] = BTSTACK_TLV_ERASED_SEQ;
+	self->num_erased_banks++;
+	self->num_erases++;
+}
+
+// index
+
+static uint32_t btstack_tlv_flash_log_hash(uint32_t tag){
+	tag ^= tag >> 16;
+	tag *= 0x45d9f3b;
+	tag ^= tag >> 16;
+	return tag;
+}
+
+// @returns slot for tag, or empty slot where it can be added
+static uint16_t btstack_tlv_flash_log_index_find(btstack_tlv_flash_log_t * self, uint32_t tag){
+	uint16_t slot = btstack_tlv_flash_log_hash(tag) % self->index_size;
+	while (self->index[slot].tag != tag && self->index[slot].tag != BTSTACK_TLV_DELETED_TAG){
+		slot = (slot + 1) % self->index_size;
+	}
+	return slot;
+}
+
+static btstack_tlv_flash_log_index_entry_t * btstack_tlv_flash_log_index_lookup(btstack_tlv_flash_log_t * self, uint32_t tag){
+	btstack_tlv_flash_log_index_entry_t * entry = &self->index[btstack_tlv_flash_log_index_find(self, tag)];
+	if (entry->tag != tag) return NULL;
+	return entry;
+}
+
+// remove slot and move following entries of the same cluster back
+static void btstack_tlv_flash_log_index_remove(btstack_tlv_flash_log_t * self, uint16_t slot){
+	uint16_t next = slot;
+	while (1){
+		next = (next + 1) % self->index_size;
+		if (self->index[next].tag == BTSTACK_TLV_DELETED_TAG) break;
+		uint16_t home = btstack_tlv_flash_log_hash(self->index[next].tag) % self->index_size;
+		// keep entry if its home slot is cyclically in (slot, next]
+		if (slot <= next ? (slot < home && home <= next) : (slot < home || home <= next)) continue;
+		self->index[slot] = self->index[next];
+		slot = next;
+	}
+	self->index[slot].tag = BTSTACK_TLV_DELETED_TAG;
+	self->num_tags--;
+}
+
+// log
+
+static uint32_t btstack_tlv_flash_log_max_live_size(btstack_tlv_flash_log_t * self){
+	if (self->num_banks < 3) return 0;
+	return (self->num_banks - 2) * (btstack_tlv_flash_log_bank_size(self) - BTSTACK_TLV_HEADER_LEN);
+}
+
+static int btstack_tlv_flash_log_oldest_bank(btstack_tlv_flash_log_t * self){
+	int bank;
+	int oldest_bank = -1;
+	for (bank = 0; bank < self->num_banks; bank++){
+		if (self->bank_seq[bank] == BTSTACK_TLV_ERASED_SEQ) continue;
+		if (oldest_bank < 0 || self->bank_seq[bank] < self->bank_seq[oldest_bank]){
+			oldest_bank = bank;
+		}
+	}
+	return oldest_bank;
+}
+
+static void btstack_tlv_flash_log_open_bank(btstack_tlv_flash_log_t * self, int bank, uint32_t seq){
+	log_info("open bank %u, seq %u", bank, seq);
+	uint8_t header[BTSTACK_TLV_HEADER_LEN];
+	memcpy(&header[0], btstack_tlv_header_magic, 4);
+	big_endian_store_32(header, 4, seq);
+	btstack_tlv_flash_log_write(self, bank, 0, header, BTSTACK_TLV_HEADER_LEN);
+	self->bank_seq[bank] = seq;
+	self->num_erased_banks--;
+	self->head_bank = bank;
+	self->write_offset = BTSTACK_TLV_HEADER_LEN;
+}
+
+// make room for entry in head bank. store_tag keeps one erased bank for garbage collection
+// @returns 0 on success
+static int btstack_tlv_flash_log_reserve(btstack_tlv_flash_log_t * self, uint32_t entry_size, int for_gc){
+	if (self->write_offset + entry_size <= btstack_tlv_flash_log_bank_size(self)) return 0;
+	if (self->num_erased_banks < (for_gc ? 1 : 2)) return 1;
+	int i;
+	for (i = 1; i < self->num_banks; i++){
+		int bank = (self->head_bank + i) % self->num_banks;
+		if (self->bank_seq[bank] != BTSTACK_TLV_ERASED_SEQ) continue;
+		btstack_tlv_flash_log_open_bank(self, bank, self->bank_seq[self->head_bank] + 1);
+		return 0;
+	}
+	return 1;
+}
+
+// append entry at write offset, value is either provided or copied from flash
+static void btstack_tlv_flash_log_append(btstack_tlv_flash_log_t * self, uint32_t tag, uint32_t len, const uint8_t * data, int src_bank, uint32_t src_offset){
+	uint32_t offset = self->write_offset + BTSTACK_TLV_ENTRY_HEADER_LEN;
+
+	// write value first
+	if (data){
+		btstack_tlv_flash_log_write(self, self->head_bank, offset, data, len);
+	} else {
+		uint8_t copy_buffer[32];
+		uint32_t bytes_to_copy = len;
+		while (bytes_to_copy){
+			uint32_t bytes_this_iteration = btstack_min(bytes_to_copy, sizeof(copy_buffer));
+			btstack_tlv_flash_log_read(self, src_bank, src_offset, copy_buffer, bytes_this_iteration);
+			btstack_tlv_flash_log_write(self, self->head_bank, offset, copy_buffer, bytes_this_iteration);
+			src_offset    += bytes_this_iteration;
+			offset        += bytes_this_iteration;
+			bytes_to_copy -= bytes_this_iteration;
+		}
+	}
+
+	// then entry
+	uint8_t entry[BTSTACK_TLV_ENTRY_HEADER_LEN];
+	big_endian_store_32(entry, 0, tag);
+	big_endian_store_32(entry, 4, len);
+	btstack_tlv_flash_log_write(self, self->head_bank, self->write_offset, entry, sizeof(entry));
+
+	self->write_offset += btstack_tlv_flash_log_entry_size(self, len);
+}
+
+static int btstack_tlv_flash_log_gc_needed(btstack_tlv_flash_log_t * self){
+	if (self->tail_bank == self->head_bank) return 0;
+	return self->num_erased_banks < BTSTACK_TLV_FLASH_LOG_GC_ERASED_BANKS;
+}
+
+int btstack_tlv_flash_log_gc_step(btstack_tlv_flash_log_t * self){
+	if (!btstack_tlv_flash_log_gc_needed(self)) return 0;
+
+	self->num_gc_steps++;
+
+	// relocate live entries of oldest bank
+	uint32_t bank_size = btstack_tlv_flash_log_bank_size(self);
+	uint32_t bytes_copied = 0;
+	while (self->gc_offset + BTSTACK_TLV_ENTRY_HEADER_LEN <= bank_size){
+		uint32_t tag;
+		uint32_t len;
+		btstack_tlv_flash_log_read_entry_header(self, self->tail_bank, self->gc_offset, &tag, &len);
+		if (tag == BTSTACK_TLV_ERASED_TAG) break;
+		uint32_t entry_size = btstack_tlv_flash_log_entry_size(self, len);
+		if (tag != BTSTACK_TLV_DELETED_TAG){
+			btstack_tlv_flash_log_index_entry_t * entry = btstack_tlv_flash_log_index_lookup(self, tag);
+			if (entry && entry->bank == self->tail_bank && entry->offset == self->gc_offset){
+				// step done
+				if (bytes_copied + entry_size > BTSTACK_TLV_FLASH_LOG_GC_STEP_SIZE && bytes_copied) return 1;
+				if (btstack_tlv_flash_log_reserve(self, entry_size, 1)){
+					log_error("gc: no space to relocate tag '%x'", tag);
+					return 0;
+				}
+				log_info("gc: relocate tag '%x' from bank %u, offset %u", tag, self->tail_bank, self->gc_offset);
+				entry->bank   = self->head_bank;
+				entry->offset = self->write_offset;
+				btstack_tlv_flash_log_append(self, tag, len, NULL, self->tail_bank, self->gc_offset + BTSTACK_TLV_ENTRY_HEADER_LEN);
+				// don't resurrect tag if new entry gets deleted before bank is erased
+				btstack_tlv_flash_log_invalidate_entry(self, self->tail_bank, self->gc_offset);
+				bytes_copied += entry_size;
+			}
+		}
+		self->gc_offset += entry_size;
+	}
+
+	// erase in separate step
+	if (bytes_copied) return 1;
+
+	btstack_tlv_flash_log_erase_bank(self, self->tail_bank);
+	self->tail_bank = btstack_tlv_flash_log_oldest_bank(self);
+	self->gc_offset = BTSTACK_TLV_HEADER_LEN;
+	return btstack_tlv_flash_log_gc_needed(self);
+}
+
+/**
+ * Get Value for Tag
+ * @param tag
+ * @param buffer
+ * @param buffer_size
+ * @returns size of value
+ */
+static int btstack_tlv_flash_log_get_tag(void * context, uint32_t tag, uint8_t * buffer, uint32_t buffer_size){
+
+	btstack_tlv_flash_log_t * self = (btstack_tlv_flash_log_t *) context;
+
+	btstack_tlv_flash_log_index_entry_t * entry = btstack_tlv_flash_log_index_lookup(self, tag);
+	if (!entry) return 0;
+	if (!buffer) return entry->len;
+	uint32_t copy_size = btstack_min(buffer_size, entry->len);
+	btstack_tlv_flash_log_read(self, entry->bank, entry->offset + BTSTACK_TLV_ENTRY_HEADER_LEN, buffer, copy_size);
+	return copy_size;
+}
+
+/**
+ * Store Tag 
+ * @param tag
+ * @param data
+ * @param data_size
+ */
+static int btstack_tlv_flash_log_store_tag(void * context, uint32_t tag, const uint8_t * data, uint32_t data_size){
+
+	btstack_tlv_flash_log_t * self = (btstack_tlv_flash_log_t *) context;
+
+	if (tag == BTSTACK_TLV_DELETED_TAG || tag == BTSTACK_TLV_ERASED_TAG){
+		log_error("invalid tag '%x'", tag);
+		return 1;
+	}
+
+	uint32_t entry_size = btstack_tlv_flash_log_entry_size(self, data_size);
+	if (data_size > 0xffff || BTSTACK_TLV_HEADER_LEN + entry_size > btstack_tlv_flash_log_bank_size(self)){
+		log_error("entry for tag '%x' too large", tag);
+		return 2;
+	}
+
+	// check space
+	btstack_tlv_flash_log_index_entry_t * entry = &self->index[btstack_tlv_flash_log_index_find(self, tag)];
+	int new_tag = entry->tag != tag;
+	if (new_tag && (self->num_tags + 1) >= self->index_size){
+		log_error("couldn't write entry, index full");
+		return 2;
+	}
+	uint32_t live_size = self->live_size + entry_size;
+	if (!new_tag){
+		live_size -= btstack_tlv_flash_log_entry_size(self, entry->len);
+	}
+	if (live_size > btstack_tlv_flash_log_max_live_size(self)){
+		log_error("couldn't write entry, not enough space left");
+		return 2;
+	}
+
+	// spread garbage collection over writes
+	btstack_tlv_flash_log_gc_step(self);
+
+	// run garbage collection until entry fits
+	uint32_t max_gc_steps = self->num_banks * (btstack_tlv_flash_log_bank_size(self) / BTSTACK_TLV_FLASH_LOG_GC_STEP_SIZE + 2);
+	while (btstack_tlv_flash_log_reserve(self, entry_size, 0)){
+		if (!btstack_tlv_flash_log_gc_needed(self) || max_gc_steps-- == 0){
+			log_error("couldn't write entry, not enough space left");
+			return 2;
+		}
+		btstack_tlv_flash_log_gc_step(self);
+	}
+
+	log_info("write '%x', len %u at bank %u, offset %u", tag, data_size, self->head_bank, self->write_offset);
+
+	int bank = self->head_bank;
+	uint32_t offset = self->write_offset;
+	btstack_tlv_flash_log_append(self, tag, data_size, data, 0, 0);
+
+	// overwrite old entry (if exists)
+	if (new_tag){
+		self->num_tags++;
+	} else {
+		btstack_tlv_flash_log_invalidate_entry(self, entry->bank, entry->offset);
+	}
+	entry->tag    = tag;
+	entry->bank   = bank;
+	entry->offset = offset;
+	entry->len    = data_size;
+	self->live_size = live_size;
+
+	return 0;
+}
+
+/**
+ * Delete Tag
+ * @param tag
+ */
+static void btstack_tlv_flash_log_delete_tag(void * context, uint32_t tag){
+	btstack_tlv_flash_log_t * self = (btstack_tlv_flash_log_t *) context;
+	uint16_t slot = btstack_tlv_flash_log_index_find(self, tag);
+	btstack_tlv_flash_log_index_entry_t * entry = &self->index[slot];
+	if (entry->tag != tag) return;
+	log_info("Erase tag '%x' at bank %u, offset %u", tag, entry->bank, entry->offset);
+	btstack_tlv_flash_log_invalidate_entry(self, entry->bank, entry->offset);
+	self->live_size -= btstack_tlv_flash_log_entry_size(self, entry->len);
+	btstack_tlv_flash_log_index_remove(self, slot);
+}
+
+static const btstack_tlv_t btstack_tlv_flash_log = {
+	/* int  (*get_tag)(..);     */ &btstack_tlv_flash_log_get_tag,
+	/* int (*store_tag)(..);    */ &btstack_tlv_flash_log_store_tag,
+	/* void (*delete_tag)(v..); */ &btstack_tlv_flash_log_delete_tag,
+};
+
+// add entries of bank to index, later entries replace earlier ones
+// @returns offset after last entry
+static uint32_t btstack_tlv_flash_log_scan_bank(btstack_tlv_flash_log_t * self, int bank){
+	uint32_t bank_size = btstack_tlv_flash_log_bank_size(self);
+	uint32_t offset = BTSTACK_TLV_HEADER_LEN;
+	while (offset + BTSTACK_TLV_ENTRY_HEADER_LEN <= bank_size){
+		uint32_t tag;
+		uint32_t len;
+		btstack_tlv_flash_log_read_entry_header(self, bank, offset, &tag, &len);
+		if (tag == BTSTACK_TLV_ERASED_TAG) break;
+		uint32_t entry_size = btstack_tlv_flash_log_entry_size(self, len);
+		if (len > 0xffff || offset + entry_size > bank_size){
+			log_error("invalid entry in bank %u, offset %u", bank, offset);
+			return bank_size;
+		}
+		if (tag != BTSTACK_TLV_DELETED_TAG){
+			btstack_tlv_flash_log_index_entry_t * entry = &self->index[btstack_tlv_flash_log_index_find(self, tag)];
+			if (entry->tag == tag){
+				// reset after new entry was written but before old one was invalidated
+				btstack_tlv_flash_log_invalidate_entry(self, entry->bank, entry->offset);
+				self->live_size -= btstack_tlv_flash_log_entry_size(self, entry->len);
+			} else if ((self->num_tags + 1) >= self->index_size){
+				log_error("index full, drop tag '%x'", tag);
+				entry = NULL;
+			} else {
+				self->num_tags++;
+			}
+			if (entry){
+				entry->tag    = tag;
+				entry->bank   = bank;
+				entry->offset = offset;
+				entry->len    = len;
+				self->live_size += entry_size;
+			}
+		}
+		offset += entry_size;
+	}
+	return offset;
+}
+
+/**
+ * Init Tag Length Value Store
+ */
+const btstack_tlv_t * btstack_tlv_flash_log_init_instance(btstack_tlv_flash_log_t * self, const hal_flash_bank_t * hal_flash_bank_impl, void * hal_flash_bank_context,
+	int num_banks, btstack_tlv_flash_log_index_entry_t * index_storage, uint16_t index_size){
+
+	memset(self, 0, sizeof(btstack_tlv_flash_log_t));
+	if (num_banks < 3){
+		log_error("btstack_tlv_flash_log requires at least 3 banks");
+		return NULL;
+	}
+	if (index_size == 0){
+		log_error("btstack_tlv_flash_log requires index storage");
+		return NULL;
+	}
+	self->hal_flash_bank_impl    = hal_flash_bank_impl;
+	self->hal_flash_bank_context = hal_flash_bank_context;
+	self->num_banks  = btstack_min(num_banks, BTSTACK_TLV_FLASH_LOG_MAX_BANKS);
+	self->index      = index_storage;
+	self->index_size = index_size;
+	memset(index_storage, 0, index_size * sizeof(btstack_tlv_flash_log_index_entry_t));
+
+	// read bank headers, erase invalid banks
+	int bank;
+	for (bank = 0; bank < self->num_banks; bank++){
+		uint8_t header[BTSTACK_TLV_HEADER_LEN];
+		btstack_tlv_flash_log_read(self, bank, 0, header, BTSTACK_TLV_HEADER_LEN);
+		self->bank_seq[bank] = BTSTACK_TLV_ERASED_SEQ;
+		if (memcmp(header, btstack_tlv_header_magic, 4) == 0){
+			self->bank_seq[bank] = big_endian_read_32(header, 4);
+		}
+		if (self->bank_seq[bank] != BTSTACK_TLV_ERASED_SEQ) continue;
+		if (btstack_tlv_flash_log_test_erased(self, bank, 0)){
+			self->num_erased_banks++;
+		} else {
+			btstack_tlv_flash_log_erase_bank(self, bank);
+		}
+	}
+
+	// replay banks from oldest to newest
+	self->head_bank = -1;
+	uint32_t seq = 0;
+	while (1){
+		int next_bank = -1;
+		for (bank = 0; bank < self->num_banks; bank++){
+			if (self->bank_seq[bank] == BTSTACK_TLV_ERASED_SEQ) continue;
+			if (self->head_bank >= 0 && self->bank_seq[bank] <= seq) continue;
+			if (next_bank < 0 || self->bank_seq[bank] < self->bank_seq[next_bank]){
+				next_bank = bank;
+			}
+		}
+		if (next_bank < 0) break;
+		log_info("scan bank %u, seq %u", next_bank, self->bank_seq[next_bank]);
+		self->head_bank = next_bank;
+		seq = self->bank_seq[next_bank];
+		self->write_offset = btstack_tlv_flash_log_scan_bank(self, next_bank);
+	}
+
+	if (self->head_bank < 0){
+		btstack_tlv_flash_log_open_bank(self, 0, 0);
+	} else if (!btstack_tlv_flash_log_test_erased(self, self->head_bank, self->write_offset)){
+		// reset after value was written but before its tag: continue in next bank
+		log_info("Flash not empty after last found tag -> close bank %u", self->head_bank);
+		self->write_offset = btstack_tlv_flash_log_bank_size(self);
+	}
+	self->tail_bank = btstack_tlv_flash_log_oldest_bank(self);
+	self->gc_offset = BTSTACK_TLV_HEADER_LEN;
+
+	log_info("%u tags, head bank %u, write offset %u, tail bank %u", self->num_tags, self->head_bank, self->write_offset, self->tail_bank);
+	return &btstack_tlv_flash_log;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY MATTHIAS RINGWALD AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ *  btstack_tlv_flash_log.h
+ *
+ *  Implementation for BTstack's Tag Value Length Persistent Storage implementations
+ *  using a log of three or more hal_flash_bank banks with a RAM index and incremental
+ *  garbage collection
+ */
+
+#ifndef __BTSTACK_TLV_FLASH_LOG_H
+#define __BTSTACK_TLV_FLASH_LOG_H
+
+#include <stdint.h>
+#include "btstack_tlv.h"
+#include "hal_flash_bank.h"
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#ifndef BTSTACK_TLV_FLASH_LOG_MAX_BANKS
+#define BTSTACK_TLV_FLASH_LOG_MAX_BANKS 8
+#endif
+
+// garbage collection runs while less banks are erased
+#ifndef BTSTACK_TLV_FLASH_LOG_GC_ERASED_BANKS
+#define BTSTACK_TLV_FLASH_LOG_GC_ERASED_BANKS 2
+#endif
+
+// bytes relocated by a single garbage collection step
+#ifndef BTSTACK_TLV_FLASH_LOG_GC_STEP_SIZE
+#define BTSTACK_TLV_FLASH_LOG_GC_STEP_SIZE 128
+#endif
+
+// index entry for a single tag
+typedef struct {
+	uint32_t tag;
+	uint16_t bank;
+	uint16_t len;
+	uint32_t offset;
+} btstack_tlv_flash_log_index_entry_t;
+
+typedef struct {
+	const hal_flash_bank_t * hal_flash_bank_impl;
+	void * hal_flash_bank_context;
+	int num_banks;
+	// sequence number from bank header, 0xffffffff if bank is erased
+	uint32_t bank_seq[BTSTACK_TLV_FLASH_LOG_MAX_BANKS];
+	int num_erased_banks;
+	// bank for new entries
+	int head_bank;
+	uint32_t write_offset;
+	// oldest bank, garbage collection copies live entries from gc_offset on
+	int tail_bank;
+	uint32_t gc_offset;
+	// tag -> location, open addressing with linear probing
+	btstack_tlv_flash_log_index_entry_t * index;
+	uint16_t index_size;
+	uint16_t num_tags;
+	uint32_t live_size;
+	// statistics
+	uint32_t num_gc_steps;
+	uint32_t num_erases;
+} btstack_tlv_flash_log_t;
+
+/**
+ * Init Tag Length Value Store
+ * @param context btstack_tlv_flash_log_t
+ * @param hal_flash_bank_impl    of hal_flash_bank interface
+ * @Param hal_flash_bank_context of hal_flash_bank_interface
+ * @param num_banks provided by hal_flash_bank, at least 3 and up to BTSTACK_TLV_FLASH_LOG_MAX_BANKS
+ * @param index_storage for RAM index, should provide twice as many entries as tags stored
+ * @param index_size number of entries in index_storage, at least 1
+ * @note the live entries can use up to num_banks - 2 banks, the others are needed for garbage collection
+ * @returns btstack_tlv implementation, or NULL if num_banks or index_size are invalid
+ */
+const btstack_tlv_t * btstack_tlv_flash_log_init_instance(btstack_tlv_flash_log_t * context, const hal_flash_bank_t * hal_flash_bank_impl, void * hal_flash_bank_context,
+	int num_banks, btstack_tlv_flash_log_index_entry_t * index_storage, uint16_t index_size);
+
+/**
+ * Perform single garbage collection step if needed. A step either relocates up to BTSTACK_TLV_FLASH_LOG_GC_STEP_SIZE
+ * bytes from the oldest bank or erases it. Store Tag performs one step, too. Call e.g. from a timer to
+ * keep garbage collection out of Store Tag.
+ * @param context btstack_tlv_flash_log_t
+ * @returns 1 if garbage collection needs more steps
+ */
+int btstack_tlv_flash_log_gc_step(btstack_tlv_flash_log_t * context);
+
+#if defined __cplusplus
+}
+#endif
+#endif // __BTSTACK_TLV_FLASH_LOG_H
@@ -30,7 +30,7 @@
  */
 
 /*
- *  hal_flash_bank_memory.c -- volatile test environment that provides just two memory banks
+ *  hal_flash_bank_memory.c -- volatile test environment that provides two or more memory banks
  *
  */
 
@@ -60,7 +60,7 @@ static uint32_t hal_flash_bank_memory_get_alignment(void * context){
 
 static void hal_flash_bank_memory_erase(void * context, int bank){
 	hal_flash_bank_memory_t * self = (hal_flash_bank_memory_t *) context;
-	if (bank > 1) return;
+	if (bank < 0 || bank >= self->num_banks) return;
 	memset(self->banks[bank], 0xff, self->bank_size);
 }
 
@@ -69,7 +69,7 @@ static void hal_flash_bank_memory_read(void * context, int bank, uint32_t offset
 
 	// log_info("read offset %u, len %u", offset, size);
 
-	if (bank > 1) return;
+	if (bank < 0 || bank >= self->num_banks) return;
 	if (offset > self->bank_size) return;
 	if ((offset + size) > self->bank_size) return;
 
@@ -82,7 +82,7 @@ static void hal_flash_bank_memory_write(void * context, int bank, uint32_t offse
 	log_info("write offset %u, len %u", offset, size);
 	log_info_hexdump(data, size);
 
-	if (bank > 1) return;
+	if (bank < 0 || bank >= self->num_banks) return;
 	if (offset > self->bank_size) return;
 	if ((offset + size) > self->bank_size) return;
 
@@ -112,9 +112,20 @@ static const hal_flash_bank_t hal_flash_bank_memory_instance = {
  * Initialize instance
  */
 const hal_flash_bank_t * hal_flash_bank_memory_init_instance(hal_flash_bank_memory_t * self, uint8_t * storage, uint32_t storage_size){
-	self->bank_size = storage_size / 2;
-	self->banks[0] = storage;
-	self->banks[1] = &storage[self->bank_size];
+	return hal_flash_bank_memory_init_instance_with_banks(self, storage, storage_size, 2);
+}
+
+const hal_flash_bank_t * hal_flash_bank_memory_init_instance_with_banks(hal_flash_bank_memory_t * self, uint8_t * storage, uint32_t storage_size, int num_banks){
+	int i;
+	if (num_banks > HAL_FLASH_BANK_MEMORY_MAX_BANKS){
+		log_error("num banks %u > HAL_FLASH_BANK_MEMORY_MAX_BANKS", num_banks);
+		num_banks = HAL_FLASH_BANK_MEMORY_MAX_BANKS;
+	}
+	self->num_banks = num_banks;
+	self->bank_size = storage_size / num_banks;
+	for (i=0;i<num_banks;i++){
+		self->banks[i] = &storage[i * self->bank_size];
+	}
 	memset(storage, 0xff, storage_size);
 	return &hal_flash_bank_memory_instance;
 }
@@ -46,10 +46,15 @@
 extern "C" {
 #endif
 
+#ifndef HAL_FLASH_BANK_MEMORY_MAX_BANKS
+#define HAL_FLASH_BANK_MEMORY_MAX_BANKS 8
+#endif
+
 // private
 typedef struct {
 	uint32_t   bank_size;
-	uint8_t  * banks[2];
+	int        num_banks;
+	uint8_t  * banks[HAL_FLASH_BANK_MEMORY_MAX_BANKS];
 } hal_flash_bank_memory_t;
 
 // public
@@ -62,6 +67,15 @@ typedef struct {
  */
 const hal_flash_bank_t * hal_flash_bank_memory_init_instance(hal_flash_bank_memory_t * context, uint8_t * storage, uint32_t storage_size);
 
+/** 
+ * Init instance with more than two banks
+ * @param context hal_flash_bank_memory_t
+ * @param storage to use
+ * @param size of storage
+ * @param num_banks to split storage into, up to HAL_FLASH_BANK_MEMORY_MAX_BANKS
+ */
+const hal_flash_bank_t * hal_flash_bank_memory_init_instance_with_banks(hal_flash_bank_memory_t * context, uint8_t * storage, uint32_t storage_size, int num_banks);
+
 #if defined __cplusplus
 }
 #endif
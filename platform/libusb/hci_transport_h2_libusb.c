@@ -118,6 +118,12 @@ static const uint16_t iso_packet_size_for_alt_setting[] = {
 #define SCO_OUT_BUFFER_COUNT  (8)
 #define SCO_OUT_BUFFER_SIZE (SCO_OUT_BUFFER_COUNT * SCO_PACKET_SIZE)
 
+// Outgoing ACL packets, one per outgoing HCI packet buffer
+#define ACL_OUT_BUFFER_COUNT HCI_OUTGOING_PACKET_BUFFER_COUNT
+
+// Outgoing packets in send order, HCI_EVENT_TRANSPORT_PACKET_SENT is emitted in this order
+#define TX_QUEUE_SIZE (HCI_OUTGOING_PACKET_BUFFER_COUNT + 2)
+
 // seems to be the max depth for USB 3
 #define USB_MAX_PATH_LEN 7
 
@@ -154,7 +160,8 @@ static libusb_device        * dev;
 static libusb_device_handle * handle;
 
 static struct libusb_transfer *command_out_transfer;
-static struct libusb_transfer *acl_out_transfer;
+static struct libusb_transfer *acl_out_transfers[ACL_OUT_BUFFER_COUNT];
+static int acl_out_transfers_write;
 static struct libusb_transfer *event_in_transfer[EVENT_IN_BUFFER_COUNT];
 static struct libusb_transfer *acl_in_transfer[ACL_IN_BUFFER_COUNT];
 
@@ -196,6 +203,9 @@ static uint8_t hci_cmd_buffer[3 + 256 + LIBUSB_CONTROL_SETUP_SIZE];
 static uint8_t hci_event_in_buffer[EVENT_IN_BUFFER_COUNT][HCI_ACL_BUFFER_SIZE]; // bigger than largest packet
 static uint8_t hci_acl_in_buffer[ACL_IN_BUFFER_COUNT][HCI_INCOMING_PRE_BUFFER_SIZE + HCI_ACL_BUFFER_SIZE]; 
 
+// buffer used by each ACL IN transfer: incoming buffer from HCI, or hci_acl_in_buffer if none is available
+static uint8_t * acl_in_buffer[ACL_IN_BUFFER_COUNT];
+
 // For (ab)use as a linked list of received packets
 static struct libusb_transfer *handle_packet;
 
@@ -208,6 +218,12 @@ static int usb_timer_active;
 static int usb_acl_out_active = 0;
 static int usb_command_active = 0;
 
+// outgoing packet types in send order and number of completed packets per type
+static uint8_t tx_queue_packet_type[TX_QUEUE_SIZE];
+static int     tx_queue_head;
+static int     tx_queue_count;
+static int     tx_completed[HCI_SCO_DATA_PACKET + 1];
+
 // endpoint addresses
 static int event_in_addr;
 static int acl_in_addr;
@@ -303,6 +319,8 @@ LIBUSB_CALL static void async_callback(struct libusb_transfer *transfer){
             if (transfer == acl_in_transfer[c]){
                 libusb_free_transfer(transfer);
                 acl_in_transfer[c] = 0;
+                hci_incoming_buffer_release(acl_in_buffer[c]);
+                acl_in_buffer[c] = NULL;
                 return;
             }
         }
@@ -345,6 +363,39 @@ LIBUSB_CALL static void async_callback(struct libusb_transfer *transfer){
 }
 
 
+static void tx_queue_init(void){
+    tx_queue_head  = 0;
+    tx_queue_count = 0;
+    memset(tx_completed, 0, sizeof(tx_completed));
+}
+
+static void tx_queue_add(uint8_t packet_type){
+    int pos = tx_queue_head + tx_queue_count;
+    if (pos >= TX_QUEUE_SIZE){
+        pos -= TX_QUEUE_SIZE;
+    }
+    tx_queue_packet_type[pos] = packet_type;
+    tx_queue_count++;
+}
+
+// endpoints complete in order, but not in order with each other
+static void tx_queue_packet_completed(uint8_t packet_type){
+    tx_completed[packet_type]++;
+    while (tx_queue_count){
+        uint8_t head_packet_type = tx_queue_packet_type[tx_queue_head];
+        if (tx_completed[head_packet_type] == 0) break;
+        tx_completed[head_packet_type]--;
+        tx_queue_head++;
+        if (tx_queue_head == TX_QUEUE_SIZE){
+            tx_queue_head = 0;
+        }
+        tx_queue_count--;
+        // notify upper stack that provided buffer can be used again
+        uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
+        packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+    }
+}
+
 #ifdef ENABLE_SCO_OVER_HCI
 static int usb_send_sco_packet(uint8_t *packet, int size){
     int r;
@@ -379,9 +430,9 @@ static int usb_send_sco_packet(uint8_t *packet, int size){
 
     // log_info("H2: queued packet at index %u, num active %u", tranfer_index, sco_out_transfers_active);
 
-    // notify upper stack that provided buffer can be used again
-    uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
-    packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+    // packet was copied, notify upper stack that provided buffer can be used again
+    tx_queue_add(HCI_SCO_DATA_PACKET);
+    tx_queue_packet_completed(HCI_SCO_DATA_PACKET);
 
     // and if we have more space for SCO packets
     if (sco_ring_have_space()) {
@@ -431,7 +482,6 @@ static void handle_isochronous_data(uint8_t * buffer, uint16_t size){
 static void handle_completed_transfer(struct libusb_transfer *transfer){
 
     int resubmit = 0;
-    int signal_done = 0;
 
     if (transfer->endpoint == event_in_addr) {
         packet_handler(HCI_EVENT_PACKET, transfer-> buffer, transfer->actual_length);
@@ -439,15 +489,26 @@ static void handle_completed_transfer(struct libusb_transfer *transfer){
     } else if (transfer->endpoint == acl_in_addr) {
         // log_info("-> acl");
         packet_handler(HCI_ACL_DATA_PACKET, transfer-> buffer, transfer->actual_length);
+        // continue with another buffer if packet was retained
+        int c;
+        for (c = 0 ; c < ACL_IN_BUFFER_COUNT ; c++){
+            if (transfer != acl_in_transfer[c]) continue;
+            acl_in_buffer[c] = hci_incoming_buffer_recycle(acl_in_buffer[c]);
+            if (!acl_in_buffer[c]){
+                acl_in_buffer[c] = hci_acl_in_buffer[c];
+            }
+            transfer->buffer = acl_in_buffer[c] + HCI_INCOMING_PRE_BUFFER_SIZE;
+            break;
+        }
         resubmit = 1;
     } else if (transfer->endpoint == 0){
         // log_info("command done, size %u", transfer->actual_length);
         usb_command_active = 0;
-        signal_done = 1;
+        tx_queue_packet_completed(HCI_COMMAND_DATA_PACKET);
     } else if (transfer->endpoint == acl_out_addr){
         // log_info("acl out done, size %u", transfer->actual_length);
-        usb_acl_out_active = 0;
-        signal_done = 1;
+        usb_acl_out_active--;
+        tx_queue_packet_completed(HCI_ACL_DATA_PACKET);
 #ifdef ENABLE_SCO_OVER_HCI
     } else if (transfer->endpoint == sco_in_addr) {
         // log_info("handle_completed_transfer for SCO IN! num packets %u", transfer->NUM_ISO_PACKETS);
@@ -491,12 +552,6 @@ static void handle_completed_transfer(struct libusb_transfer *transfer){
         log_info("usb_process_ds endpoint unknown %x", transfer->endpoint);
     }
 
-    if (signal_done){
-        // notify upper stack that provided buffer can be used again
-        uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
-        packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
-    }
-
     if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return;
 
     if (resubmit){
@@ -1037,7 +1092,13 @@ static int usb_open(void){
     }
 
     command_out_transfer = libusb_alloc_transfer(0);
-    acl_out_transfer     = libusb_alloc_transfer(0);
+    for (c = 0 ; c < ACL_OUT_BUFFER_COUNT ; c++) {
+        acl_out_transfers[c] = libusb_alloc_transfer(0);
+    }
+    acl_out_transfers_write = 0;
+    usb_acl_out_active = 0;
+    usb_command_active = 0;
+    tx_queue_init();
 
     // TODO check for error
 
@@ -1056,9 +1117,14 @@ static int usb_open(void){
     }
 
     for (c = 0 ; c < ACL_IN_BUFFER_COUNT ; c++) {
+        // receive into incoming buffer from HCI if available
+        acl_in_buffer[c] = hci_incoming_buffer_get();
+        if (!acl_in_buffer[c]){
+            acl_in_buffer[c] = hci_acl_in_buffer[c];
+        }
         // configure acl_in handlers
         libusb_fill_bulk_transfer(acl_in_transfer[c], handle, acl_in_addr, 
-                hci_acl_in_buffer[c] + HCI_INCOMING_PRE_BUFFER_SIZE, HCI_ACL_BUFFER_SIZE, async_callback, NULL, 0) ;
+                acl_in_buffer[c] + HCI_INCOMING_PRE_BUFFER_SIZE, HCI_ACL_BUFFER_SIZE, async_callback, NULL, 0) ;
         r = libusb_submit_transfer(acl_in_transfer[c]);
         if (r) {
             log_error("Error submitting bulk in transfer %d", r);
@@ -1272,6 +1338,7 @@ static int usb_send_cmd_packet(uint8_t *packet, int size){
         return -1;
     }
 
+    tx_queue_add(HCI_COMMAND_DATA_PACKET);
     return 0;
 }
 
@@ -1282,31 +1349,37 @@ static int usb_send_acl_packet(uint8_t *packet, int size){
 
     // log_info("usb_send_acl_packet enter, size %u", size);
     
-    // prepare transfer
-    int completed = 0;
+    // prepare transfer, bulk transfers on the same endpoint complete in order
+    struct libusb_transfer * acl_out_transfer = acl_out_transfers[acl_out_transfers_write];
     libusb_fill_bulk_transfer(acl_out_transfer, handle, acl_out_addr, packet, size,
-        async_callback, &completed, 0);
+        async_callback, NULL, 0);
     acl_out_transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
 
     // update stata before submitting transfer
-    usb_acl_out_active = 1;
+    usb_acl_out_active++;
 
     r = libusb_submit_transfer(acl_out_transfer);
     if (r < 0) {
-        usb_acl_out_active = 0;
+        usb_acl_out_active--;
         log_error("Error submitting acl transfer, %d", r);
         return -1;
     }
 
+    acl_out_transfers_write++;
+    if (acl_out_transfers_write == ACL_OUT_BUFFER_COUNT){
+        acl_out_transfers_write = 0;
+    }
+    tx_queue_add(HCI_ACL_DATA_PACKET);
     return 0;
 }
 
 static int usb_can_send_packet_now(uint8_t packet_type){
+    if (tx_queue_count >= TX_QUEUE_SIZE) return 0;
     switch (packet_type){
         case HCI_COMMAND_DATA_PACKET:
             return !usb_command_active;
         case HCI_ACL_DATA_PACKET:
-            return !usb_acl_out_active;
+            return usb_acl_out_active < ACL_OUT_BUFFER_COUNT;
 #ifdef ENABLE_SCO_OVER_HCI
         case HCI_SCO_DATA_PACKET:
             return sco_ring_have_space();
@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2018 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define __BTSTACK_FILE__ "btstack_run_loop_epoll.c"
+
+/*
+ *  btstack_run_loop_epoll.c
+ *
+ *  Linux run loop based on epoll. In contrast to btstack_run_loop_posix.c, file descriptors
+ *  are registered with the kernel once and only updated when the enabled callback types change.
+ *  The cost of an iteration depends on the number of ready data sources, not on the number
+ *  of registered ones.
+ */
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_epoll.h"
+#include "btstack_linked_list.h"
+#include "btstack_debug.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+// max number of ready data sources reported by a single epoll_wait call
+#ifndef BTSTACK_RUN_LOOP_EPOLL_MAX_EVENTS
+#define BTSTACK_RUN_LOOP_EPOLL_MAX_EVENTS 32
+#endif
+
+// private flags stored in btstack_data_source_t.flags next to the public callback types
+#define DATA_SOURCE_EPOLL_ADDED      (1 << 14)
+#define DATA_SOURCE_EPOLL_REGISTERED (1 << 15)
+
+static void btstack_run_loop_epoll_dump_timer(void);
+
+// the run loop
+static int epoll_fd = -1;
+static btstack_linked_list_t data_sources;
+static btstack_timer_wheel_t timer_wheel;
+// start time
+static struct timespec init_ts;
+
+// ready events of current iteration, entries are cleared if data source gets removed during dispatch
+static struct epoll_event ready_events[BTSTACK_RUN_LOOP_EPOLL_MAX_EVENTS];
+static int ready_events_num;
+static int ready_events_pos;
+
+static uint32_t btstack_run_loop_epoll_events_for_flags(uint16_t flags){
+    uint32_t events = 0;
+    if (flags & DATA_SOURCE_CALLBACK_READ){
+        events |= EPOLLIN;
+    }
+    if (flags & DATA_SOURCE_CALLBACK_WRITE){
+        events |= EPOLLOUT;
+    }
+    return events;
+}
+
+// sync kernel registration with enabled callbacks. fds without enabled callbacks are not registered
+// as epoll always reports EPOLLHUP/EPOLLERR, which select() would have ignored
+static void btstack_run_loop_epoll_update(btstack_data_source_t * ds, uint16_t old_flags){
+    if ((ds->flags & DATA_SOURCE_EPOLL_ADDED) == 0) return;
+    if (ds->fd < 0) return;
+
+    uint32_t events = btstack_run_loop_epoll_events_for_flags(ds->flags);
+    int registered  = (ds->flags & DATA_SOURCE_EPOLL_REGISTERED) != 0;
+    if (registered && events == btstack_run_loop_epoll_events_for_flags(old_flags)) return;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events   = events;
+    event.data.ptr = ds;
+
+    int op;
+    if (events == 0){
+        if (!registered) return;
+        op = EPOLL_CTL_DEL;
+        ds->flags &= ~DATA_SOURCE_EPOLL_REGISTERED;
+    } else if (registered){
+        op = EPOLL_CTL_MOD;
+    } else {
+        op = EPOLL_CTL_ADD;
+        ds->flags |= DATA_SOURCE_EPOLL_REGISTERED;
+    }
+    if (epoll_ctl(epoll_fd, op, ds->fd, &event) < 0){
+        log_error("btstack_run_loop_epoll: epoll_ctl(%u) for fd %u failed, errno %u", op, ds->fd, errno);
+    }
+}
+
+/**
+ * Add data_source to run_loop
+ */
+static void btstack_run_loop_epoll_add_data_source(btstack_data_source_t *ds){
+    btstack_linked_list_add(&data_sources, (btstack_linked_item_t *) ds);
+    uint16_t old_flags = ds->flags;
+    ds->flags |= DATA_SOURCE_EPOLL_ADDED;
+    ds->flags &= ~DATA_SOURCE_EPOLL_REGISTERED;
+    btstack_run_loop_epoll_update(ds, old_flags);
+}
+
+/**
+ * Remove data_source from run loop
+ */
+static int btstack_run_loop_epoll_remove_data_source(btstack_data_source_t *ds){
+    int i;
+    // drop pending events for this data source
+    for (i = ready_events_pos; i < ready_events_num; i++){
+        if (ready_events[i].data.ptr == ds){
+            ready_events[i].data.ptr = NULL;
+        }
+    }
+    if (ds->flags & DATA_SOURCE_EPOLL_REGISTERED){
+        // fd might have been closed already, which removes it from the epoll set automatically
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ds->fd, &event);
+    }
+    ds->flags &= ~(DATA_SOURCE_EPOLL_ADDED | DATA_SOURCE_EPOLL_REGISTERED);
+    return btstack_linked_list_remove(&data_sources, (btstack_linked_item_t *) ds);
+}
+
+/**
+ * Add timer to run_loop
+ */
+static void btstack_run_loop_epoll_add_timer(btstack_timer_source_t *ts){
+    btstack_timer_wheel_add(&timer_wheel, ts);
+    log_debug("Added timer %p at %u\n", ts, ts->timeout);
+}
+
+/**
+ * Remove timer from run loop
+ */
+static int btstack_run_loop_epoll_remove_timer(btstack_timer_source_t *ts){
+    return btstack_timer_wheel_remove(&timer_wheel, ts);
+}
+
+static void btstack_run_loop_epoll_dump_timer(void){
+    btstack_timer_wheel_dump(&timer_wheel);
+}
+
+static void btstack_run_loop_epoll_enable_data_source_callbacks(btstack_data_source_t * ds, uint16_t callback_types){
+    uint16_t old_flags = ds->flags;
+    ds->flags |= callback_types;
+    btstack_run_loop_epoll_update(ds, old_flags);
+}
+
+static void btstack_run_loop_epoll_disable_data_source_callbacks(btstack_data_source_t * ds, uint16_t callback_types){
+    uint16_t old_flags = ds->flags;
+    ds->flags &= ~callback_types;
+    btstack_run_loop_epoll_update(ds, old_flags);
+}
+
+/**
+ * @brief Queries the current time in ms since start
+ */
+static uint32_t btstack_run_loop_epoll_get_time_ms(void){
+    struct timespec now_ts;
+    clock_gettime(CLOCK_MONOTONIC, &now_ts);
+    uint32_t time_ms = (uint32_t)((now_ts.tv_sec - init_ts.tv_sec) * 1000) + (now_ts.tv_nsec / 1000000);
+    return time_ms;
+}
+
+static void btstack_run_loop_epoll_dispatch(btstack_data_source_t * ds, uint32_t events){
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && (ds->flags & DATA_SOURCE_CALLBACK_READ)){
+        log_debug("btstack_run_loop_epoll_execute: process read ds %p with fd %u\n", ds, ds->fd);
+        ds->process(ds, DATA_SOURCE_CALLBACK_READ);
+        // data source removed by callback
+        if (ready_events[ready_events_pos].data.ptr == NULL) return;
+    }
+    if ((events & (EPOLLOUT | EPOLLERR)) && (ds->flags & DATA_SOURCE_CALLBACK_WRITE)){
+        log_debug("btstack_run_loop_epoll_execute: process write ds %p with fd %u\n", ds, ds->fd);
+        ds->process(ds, DATA_SOURCE_CALLBACK_WRITE);
+    }
+}
+
+/**
+ * Execute run_loop
+ */
+static void btstack_run_loop_epoll_execute(void) {
+    uint32_t now_ms;
+    uint32_t next_timeout;
+
+    while (1) {
+        // get next timeout
+        int timeout_ms = -1;
+        if (btstack_timer_wheel_get_next_timeout(&timer_wheel, &next_timeout)) {
+            now_ms = btstack_run_loop_epoll_get_time_ms();
+            int delta = next_timeout - now_ms;
+            if (delta < 0){
+                delta = 0;
+            }
+            timeout_ms = delta;
+            log_debug("btstack_run_loop_epoll_execute next timeout in %u ms", delta);
+        }
+
+        // wait for ready FDs
+        int num_events = epoll_wait(epoll_fd, ready_events, BTSTACK_RUN_LOOP_EPOLL_MAX_EVENTS, timeout_ms);
+        if (num_events < 0){
+            if (errno != EINTR){
+                log_error("btstack_run_loop_epoll_execute: epoll_wait failed, errno %u", errno);
+            }
+            num_events = 0;
+        }
+
+        // process ready data sources
+        ready_events_num = num_events;
+        for (ready_events_pos = 0; ready_events_pos < ready_events_num; ready_events_pos++){
+            btstack_data_source_t * ds = (btstack_data_source_t *) ready_events[ready_events_pos].data.ptr;
+            if (ds == NULL) continue;
+            btstack_run_loop_epoll_dispatch(ds, ready_events[ready_events_pos].events);
+        }
+        ready_events_num = 0;
+        ready_events_pos = 0;
+
+        // process timers
+        now_ms = btstack_run_loop_epoll_get_time_ms();
+        btstack_timer_wheel_process_expired(&timer_wheel, now_ms);
+    }
+}
+
+// set timer
+static void btstack_run_loop_epoll_set_timer(btstack_timer_source_t *a, uint32_t timeout_in_ms){
+    uint32_t time_ms = btstack_run_loop_epoll_get_time_ms();
+    a->timeout = time_ms + timeout_in_ms;
+    log_debug("btstack_run_loop_epoll_set_timer to %u ms (now %u, timeout %u)", a->timeout, time_ms, timeout_in_ms);
+}
+
+static void btstack_run_loop_epoll_init(void){
+    data_sources = NULL;
+    ready_events_num = 0;
+    ready_events_pos = 0;
+    if (epoll_fd >= 0){
+        close(epoll_fd);
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0){
+        log_error("btstack_run_loop_epoll_init: epoll_create1 failed, errno %u", errno);
+    }
+    // start at full second
+    clock_gettime(CLOCK_MONOTONIC, &init_ts);
+    init_ts.tv_nsec = 0;
+    btstack_timer_wheel_init(&timer_wheel, btstack_run_loop_epoll_get_time_ms());
+    log_debug("btstack_run_loop_epoll_init at %u/%u", (int) init_ts.tv_sec, 0);
+}
+
+static const btstack_run_loop_t btstack_run_loop_epoll = {
+    &btstack_run_loop_epoll_init,
+    &btstack_run_loop_epoll_add_data_source,
+    &btstack_run_loop_epoll_remove_data_source,
+    &btstack_run_loop_epoll_enable_data_source_callbacks,
+    &btstack_run_loop_epoll_disable_data_source_callbacks,
+    &btstack_run_loop_epoll_set_timer,
+    &btstack_run_loop_epoll_add_timer,
+    &btstack_run_loop_epoll_remove_timer,
+    &btstack_run_loop_epoll_execute,
+    &btstack_run_loop_epoll_dump_timer,
+    &btstack_run_loop_epoll_get_time_ms,
+};
+
+/**
+ * Provide btstack_run_loop_epoll instance
+ */
+const btstack_run_loop_t * btstack_run_loop_epoll_get_instance(void){
+    return &btstack_run_loop_epoll;
+}
@@ -35,11 +35,12 @@
 #include "btstack_tlv_posix.h"
 #include "btstack_debug.h"
 #include "btstack_util.h"
-#include "btstack_debug.h"
-#include "string.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 
 // Header:
@@ -52,43 +53,284 @@
 // - Tag: 32 bit
 // - Len: 32 bit
 // - Value: Len in bytes
+// Entries with Len = 0 mark deleted tags
 
 #define BTSTACK_TLV_HEADER_LEN 8
+#define BTSTACK_TLV_ENTRY_HEADER_LEN 8
 static const char * btstack_tlv_header_magic = "BTstack";
 
+#define BTSTACK_TLV_MIN_BUCKETS 16
+
+// value storage is rounded up to allow updates of similar size in place
+#define BTSTACK_TLV_VALUE_GRANULARITY 16
+
 #define DUMMY_SIZE 4
 typedef struct tlv_entry {
-	void   * next;
+	struct tlv_entry * next;	// next entry in bucket
 	uint32_t tag;
 	uint32_t len;
+	uint32_t capacity;
 	uint8_t  value[DUMMY_SIZE];	// dummy size
 } tlv_entry_t;
 
-static int btstack_tlv_posix_append_tag(btstack_tlv_posix_t * self, uint32_t tag, const uint8_t * data, uint32_t data_size){
+static uint32_t btstack_tlv_posix_hash(uint32_t tag){
+	tag ^= tag >> 16;
+	tag *= 0x45d9f3b;
+	tag ^= tag >> 16;
+	return tag;
+}
 
-	if (!self->file) return 1;
+static tlv_entry_t ** btstack_tlv_posix_bucket(btstack_tlv_posix_t * self, uint32_t tag){
+	return (tlv_entry_t **) &self->buckets[btstack_tlv_posix_hash(tag) & (self->num_buckets - 1)];
+}
 
-	log_info("append tag %04x, len %u", tag, data_size);
+static tlv_entry_t * btstack_tlv_posix_find_entry(btstack_tlv_posix_t * self, uint32_t tag){
+	if (!self->buckets) return NULL;
+	tlv_entry_t * entry;
+	for (entry = *btstack_tlv_posix_bucket(self, tag); entry ; entry = entry->next){
+		if (entry->tag == tag) return entry;
+	}
+	return NULL;
+}
 
-	uint8_t header[8];
+static int btstack_tlv_posix_resize(btstack_tlv_posix_t * self, uint32_t num_buckets){
+	void ** buckets = (void **) calloc(num_buckets, sizeof(void *));
+	if (!buckets) return 1;
+	void ** old_buckets = self->buckets;
+	uint32_t old_num_buckets = self->num_buckets;
+	self->buckets = buckets;
+	self->num_buckets = num_buckets;
+	uint32_t i;
+	for (i = 0; i < old_num_buckets; i++){
+		tlv_entry_t * entry = (tlv_entry_t *) old_buckets[i];
+		while (entry){
+			tlv_entry_t * next = entry->next;
+			tlv_entry_t ** bucket = btstack_tlv_posix_bucket(self, entry->tag);
+			entry->next = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+	free(old_buckets);
+	return 0;
+}
+
+// store value in table, reuses entry if value fits. returns 0 on success
+static int btstack_tlv_posix_put_entry(btstack_tlv_posix_t * self, uint32_t tag, const uint8_t * data, uint32_t data_size){
+	if (self->num_entries >= 2 * self->num_buckets){
+		btstack_tlv_posix_resize(self, btstack_max(BTSTACK_TLV_MIN_BUCKETS, 2 * self->num_buckets));
+		if (!self->buckets) return 1;
+	}
+	tlv_entry_t ** link = btstack_tlv_posix_bucket(self, tag);
+	tlv_entry_t * entry;
+	for (entry = *link; entry ; link = &entry->next, entry = entry->next){
+		if (entry->tag == tag) break;
+	}
+	if (entry){
+		self->live_size -= BTSTACK_TLV_ENTRY_HEADER_LEN + entry->len;
+		if (entry->capacity < data_size){
+			// replace entry
+			*link = entry->next;
+			free(entry);
+			self->num_entries--;
+			entry = NULL;
+		}
+	}
+	if (!entry){
+		uint32_t capacity = (data_size + BTSTACK_TLV_VALUE_GRANULARITY - 1) & ~(BTSTACK_TLV_VALUE_GRANULARITY - 1);
+		entry = (tlv_entry_t *) malloc(sizeof(tlv_entry_t) - DUMMY_SIZE + capacity);
+		if (!entry) return 1;
+		entry->tag = tag;
+		entry->capacity = capacity;
+		link = btstack_tlv_posix_bucket(self, tag);
+		entry->next = *link;
+		*link = entry;
+		self->num_entries++;
+	}
+	entry->len = data_size;
+	memcpy(&entry->value[0], data, data_size);
+	self->live_size += BTSTACK_TLV_ENTRY_HEADER_LEN + data_size;
+	return 0;
+}
+
+// returns 1 if entry existed
+static int btstack_tlv_posix_remove_entry(btstack_tlv_posix_t * self, uint32_t tag){
+	if (!self->buckets) return 0;
+	tlv_entry_t ** link = btstack_tlv_posix_bucket(self, tag);
+	tlv_entry_t * entry;
+	for (entry = *link; entry ; link = &entry->next, entry = entry->next){
+		if (entry->tag != tag) continue;
+		*link = entry->next;
+		self->live_size -= BTSTACK_TLV_ENTRY_HEADER_LEN + entry->len;
+		self->num_entries--;
+		free(entry);
+		return 1;
+	}
+	return 0;
+}
+
+static void btstack_tlv_posix_free_entries(btstack_tlv_posix_t * self){
+	uint32_t i;
+	for (i = 0; i < self->num_buckets; i++){
+		tlv_entry_t * entry = (tlv_entry_t *) self->buckets[i];
+		while (entry){
+			tlv_entry_t * next = entry->next;
+			free(entry);
+			entry = next;
+		}
+	}
+	free(self->buckets);
+	self->buckets = NULL;
+	self->num_buckets = 0;
+	self->num_entries = 0;
+	self->live_size = 0;
+}
+
+static int btstack_tlv_posix_write_tag(FILE * file, uint32_t tag, const uint8_t * data, uint32_t data_size){
+	uint8_t header[BTSTACK_TLV_ENTRY_HEADER_LEN];
 	big_endian_store_32(header, 0, tag);
 	big_endian_store_32(header, 4, data_size);
-	size_t written_header = fwrite(header, 1, sizeof(header), self->file);
+	size_t written_header = fwrite(header, 1, sizeof(header), file);
 	if (written_header != sizeof(header)) return 1;
-	size_t written_value = fwrite(data, 1, data_size, self->file);
+	if (data_size == 0) return 0;
+	size_t written_value = fwrite(data, 1, data_size, file);
 	if (written_value != data_size) return 1;
-	return 1;
+	return 0;
 }
 
-static tlv_entry_t * btstack_tlv_posix_find_entry(btstack_tlv_posix_t * self, uint32_t tag){
-	btstack_linked_list_iterator_t it;
-	btstack_linked_list_iterator_init(&it, &self->entry_list);
-	while (btstack_linked_list_iterator_has_next(&it)){
-		tlv_entry_t * entry = (tlv_entry_t*) btstack_linked_list_iterator_next(&it);
-		if (entry->tag != tag) continue;
-		return entry;
+static int btstack_tlv_posix_write_file(btstack_tlv_posix_t * self, FILE * file){
+	uint8_t header[BTSTACK_TLV_HEADER_LEN];
+	memset(header, 0, sizeof(header));
+	strcpy((char *)header, btstack_tlv_header_magic);
+	if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) return 1;
+	uint32_t i;
+	for (i = 0; i < self->num_buckets; i++){
+		tlv_entry_t * entry;
+		for (entry = (tlv_entry_t *) self->buckets[i]; entry ; entry = entry->next){
+			if (btstack_tlv_posix_write_tag(file, entry->tag, &entry->value[0], entry->len)) return 1;
+		}
 	}
-	return NULL;
+	return 0;
+}
+
+static void btstack_tlv_posix_sync_file(FILE * file){
+	fflush(file);
+	fsync(fileno(file));
+}
+
+static void btstack_tlv_posix_sync_timer_handler(btstack_timer_source_t * ts){
+	btstack_tlv_posix_t * self = (btstack_tlv_posix_t *) btstack_run_loop_get_timer_context(ts);
+	self->sync_timer_active = 0;
+	btstack_tlv_posix_sync(self);
+}
+
+static void btstack_tlv_posix_stop_sync_timer(btstack_tlv_posix_t * self){
+	if (!self->sync_timer_active) return;
+	btstack_run_loop_remove_timer(&self->sync_timer);
+	self->sync_timer_active = 0;
+}
+
+void btstack_tlv_posix_sync(btstack_tlv_posix_t * self){
+	btstack_tlv_posix_stop_sync_timer(self);
+	self->unsynced_writes = 0;
+	if (!self->file) return;
+	btstack_tlv_posix_sync_file(self->file);
+}
+
+int btstack_tlv_posix_compact(btstack_tlv_posix_t * self){
+	if (!self->file) return 1;
+
+	// write current entries to new file
+	char * tmp_path = (char *) malloc(strlen(self->db_path) + 5);
+	if (!tmp_path) return 1;
+	strcpy(tmp_path, self->db_path);
+	strcat(tmp_path, ".tmp");
+	FILE * file = fopen(tmp_path, "w+");
+	if (!file){
+		free(tmp_path);
+		return 1;
+	}
+	int err = btstack_tlv_posix_write_file(self, file);
+	if (!err){
+		btstack_tlv_posix_sync_file(file);
+		err = ferror(file) || rename(tmp_path, self->db_path);
+	}
+	if (err){
+		log_error("compact %s failed", self->db_path);
+		fclose(file);
+		unlink(tmp_path);
+		free(tmp_path);
+		return 1;
+	}
+	free(tmp_path);
+
+	// make rename persistent
+	const char * dir_end = strrchr(self->db_path, '/');
+	int dir_fd;
+	if (dir_end){
+		char * dir_path = strndup(self->db_path, dir_end == self->db_path ? 1 : dir_end - self->db_path);
+		dir_fd = dir_path ? open(dir_path, O_RDONLY) : -1;
+		free(dir_path);
+	} else {
+		dir_fd = open(".", O_RDONLY);
+	}
+	if (dir_fd >= 0){
+		fsync(dir_fd);
+		close(dir_fd);
+	}
+
+	// continue with new file
+	fclose(self->file);
+	self->file = file;
+	self->file_size = BTSTACK_TLV_HEADER_LEN + self->live_size;
+	self->num_compactions++;
+	btstack_tlv_posix_stop_sync_timer(self);
+	self->unsynced_writes = 0;
+	log_info("compacted %s to %u bytes", self->db_path, self->file_size);
+	return 0;
+}
+
+static int btstack_tlv_posix_compaction_needed(btstack_tlv_posix_t * self){
+	uint32_t garbage = self->file_size - BTSTACK_TLV_HEADER_LEN - self->live_size;
+	if (garbage < BTSTACK_TLV_POSIX_COMPACTION_MIN_GARBAGE) return 0;
+	return (uint64_t) garbage * 100 >= (uint64_t) self->file_size * BTSTACK_TLV_POSIX_COMPACTION_GARBAGE_PERCENT;
+}
+
+static int btstack_tlv_posix_append_tag(btstack_tlv_posix_t * self, uint32_t tag, const uint8_t * data, uint32_t data_size){
+
+	if (!self->file) return 1;
+
+	log_info("append tag %04x, len %u", tag, data_size);
+
+	int err = btstack_tlv_posix_write_tag(self->file, tag, data, data_size);
+	if (err) return err;
+	self->file_size += BTSTACK_TLV_ENTRY_HEADER_LEN + data_size;
+
+	// compaction writes and syncs everything
+	if (btstack_tlv_posix_compaction_needed(self) && btstack_tlv_posix_compact(self) == 0) return 0;
+
+	switch (self->sync_policy){
+		case BTSTACK_TLV_POSIX_SYNC_ALWAYS:
+			btstack_tlv_posix_sync(self);
+			break;
+		case BTSTACK_TLV_POSIX_SYNC_BATCHED:
+			self->unsynced_writes++;
+			if (self->unsynced_writes >= self->sync_batch_size){
+				btstack_tlv_posix_sync(self);
+				break;
+			}
+			if (self->sync_batch_timeout_ms && !self->sync_timer_active){
+				btstack_run_loop_set_timer_handler(&self->sync_timer, &btstack_tlv_posix_sync_timer_handler);
+				btstack_run_loop_set_timer_context(&self->sync_timer, self);
+				btstack_run_loop_set_timer(&self->sync_timer, self->sync_batch_timeout_ms);
+				btstack_run_loop_add_timer(&self->sync_timer);
+				self->sync_timer_active = 1;
+			}
+			break;
+		default:
+			break;
+	}
+	return 0;
 }
 
 /**
@@ -97,15 +339,8 @@ static tlv_entry_t * btstack_tlv_posix_find_entry(btstack_tlv_posix_t * self, ui
  */
 static void btstack_tlv_posix_delete_tag(void * context, uint32_t tag){
 	btstack_tlv_posix_t * self = (btstack_tlv_posix_t *) context;
-	btstack_linked_list_iterator_t it;
-	btstack_linked_list_iterator_init(&it, &self->entry_list);
-	while (btstack_linked_list_iterator_has_next(&it)){
-		tlv_entry_t * entry = (tlv_entry_t*) btstack_linked_list_iterator_next(&it);
-		if (entry->tag != tag) continue;
-		btstack_linked_list_iterator_remove(&it);
-		btstack_tlv_posix_append_tag(self, tag, NULL, 0);
-		return;
-	}
+	if (!btstack_tlv_posix_remove_entry(self, tag)) return;
+	btstack_tlv_posix_append_tag(self, tag, NULL, 0);
 }
 
 /**
@@ -137,22 +372,14 @@ static int btstack_tlv_posix_get_tag(void * context, uint32_t tag, uint8_t * buf
 static int btstack_tlv_posix_store_tag(void * context, uint32_t tag, const uint8_t * data, uint32_t data_size){
 	btstack_tlv_posix_t * self = (btstack_tlv_posix_t *) context;
 
-	// remove old entry
-	tlv_entry_t * old_entry = btstack_tlv_posix_find_entry(self, tag);
-	if (old_entry){
-		btstack_linked_list_remove(&self->entry_list, (btstack_linked_item_t *) old_entry);
-		free(old_entry);
+	// empty value is stored as delete marker
+	if (data_size == 0){
+		btstack_tlv_posix_delete_tag(context, tag);
+		return 0;
 	}
 
-	// create new entry
-	tlv_entry_t * new_entry = (tlv_entry_t *) malloc(sizeof(tlv_entry_t) - DUMMY_SIZE + data_size);
-	if (!new_entry) return 0;
-	new_entry->tag = tag;
-	new_entry->len = data_size;
-	memcpy(&new_entry->value[0], data, data_size);
-
-	// append new entry
-	btstack_linked_list_add(&self->entry_list, (btstack_linked_item_t *) new_entry);
+	// update entry
+	if (btstack_tlv_posix_put_entry(self, tag, data, data_size)) return 0;
 
 	// write new tag
 	btstack_tlv_posix_append_tag(self, tag, data, data_size);
@@ -160,70 +387,66 @@ static int btstack_tlv_posix_store_tag(void * context, uint32_t tag, const uint8
 	return 0;
 }
 
+// replay log. returns 0 if all records are valid
+static int btstack_tlv_posix_replay(btstack_tlv_posix_t * self, const uint8_t * data, uint32_t size){
+	if (size < BTSTACK_TLV_HEADER_LEN) return 1;
+	if (memcmp(data, btstack_tlv_header_magic, strlen(btstack_tlv_header_magic)) != 0) return 1;
+	log_info("BTstack Magic Header found");
+	uint32_t pos = BTSTACK_TLV_HEADER_LEN;
+	while (pos < size){
+		if (size - pos < BTSTACK_TLV_ENTRY_HEADER_LEN) return 1;
+		uint32_t tag = big_endian_read_32(data, pos);
+		uint32_t len = big_endian_read_32(data, pos + 4);
+		pos += BTSTACK_TLV_ENTRY_HEADER_LEN;
+		// arbitrary safetly check: values < 1000 bytes each
+		if (len > 1000) return 1;
+		if (size - pos < len) return 1;
+		if (len == 0){
+			btstack_tlv_posix_remove_entry(self, tag);
+		} else if (btstack_tlv_posix_put_entry(self, tag, &data[pos], len)){
+			return 1;
+		}
+		pos += len;
+	}
+	return 0;
+}
+
 // returns 0 on success
 static int btstack_tlv_posix_read_db(btstack_tlv_posix_t * self){
 	// open file
 	log_info("open db %s", self->db_path);
     self->file = fopen(self->db_path,"r+");
-    uint8_t header[BTSTACK_TLV_HEADER_LEN];
     if (self->file){
-    	// checker header
-	    size_t objects_read = fread(header, 1, BTSTACK_TLV_HEADER_LEN, self->file );
-	    int file_valid = 0;
-	    if (objects_read == BTSTACK_TLV_HEADER_LEN){
-	    	if (memcmp(header, btstack_tlv_header_magic, strlen(btstack_tlv_header_magic)) == 0){
-		    	log_info("BTstack Magic Header found");
-		    	// read entries
-		    	while (1){
-					uint8_t entry[8];
-					size_t 	entries_read = fread(entry, 1, sizeof(entry), self->file);
-					if (entries_read == 0){
-						// EOF, we're good
-						file_valid = 1;
-						break;
-					}
-					if (entries_read == sizeof(entry)){
-						uint32_t tag = big_endian_read_32(entry, 0);
-						uint32_t len = big_endian_read_32(entry, 4);
-						// arbitrary safetly check: values < 1000 bytes each
-						if (len > 1000) break;
-						tlv_entry_t * new_entry = (tlv_entry_t *) malloc(sizeof(tlv_entry_t) - DUMMY_SIZE + len);
-						if (!new_entry) return 0;
-						new_entry->tag = tag;
-						new_entry->len = len;
-						// read 
-						size_t 	value_read = fread(&new_entry->value[0], 1, len, self->file);
-						if (value_read == len){
-							// append new entry
-							btstack_linked_list_add(&self->entry_list, (btstack_linked_item_t *) new_entry);
-						} else {
-							// fail
-							free(new_entry);
-							break;
-						}
-					}	    		
-		    	}
-	    	}
-	    }
+    	// read complete file and replay records
+    	int file_valid = 0;
+    	struct stat st;
+    	if (fstat(fileno(self->file), &st) == 0){
+    		uint32_t size = (uint32_t) st.st_size;
+    		uint8_t * data = (uint8_t *) malloc(size ? size : 1);
+    		if (data && fread(data, 1, size, self->file) == size){
+    			file_valid = btstack_tlv_posix_replay(self, data, size) == 0;
+    			self->file_size = size;
+    		}
+    		free(data);
+    	}
 	    if (!file_valid) {
 	    	log_info("file invalid, re-create");
     		fclose(self->file);
     		self->file = NULL;
 	    }
     }
-    if (!self->file){
-    	// create truncate file
+    if (self->file){
+    	// append to log
+    	fseek(self->file, 0, SEEK_END);
+    	if (btstack_tlv_posix_compaction_needed(self)){
+    		btstack_tlv_posix_compact(self);
+    	}
+    } else {
+    	// create truncate file and write out all valid entries (if any)
 	    self->file = fopen(self->db_path,"w+");
-	    memset(header, 0, sizeof(header));
-	    strcpy((char *)header, btstack_tlv_header_magic);
-	    fwrite(header, 1, sizeof(header), self->file);
-	    // write out all valid entries (if any)
-		btstack_linked_list_iterator_t it;
-		btstack_linked_list_iterator_init(&it, &self->entry_list);
-		while (btstack_linked_list_iterator_has_next(&it)){
-			tlv_entry_t * entry = (tlv_entry_t*) btstack_linked_list_iterator_next(&it);
-			btstack_tlv_posix_append_tag(self, entry->tag, &entry->value[0], entry->len);
-		}
+	    if (!self->file) return 1;
+	    btstack_tlv_posix_write_file(self, self->file);
+	    self->file_size = BTSTACK_TLV_HEADER_LEN + self->live_size;
     }
 	return 0;
 }
@@ -240,9 +463,25 @@ static const btstack_tlv_t btstack_tlv_posix = {
 const btstack_tlv_t * btstack_tlv_posix_init_instance(btstack_tlv_posix_t * self, const char * db_path){
 	memset(self, 0, sizeof(btstack_tlv_posix_t));
 	self->db_path = db_path;
+	btstack_tlv_posix_resize(self, BTSTACK_TLV_MIN_BUCKETS);
 
 	// read DB
 	btstack_tlv_posix_read_db(self);
 	return &btstack_tlv_posix;
 }
 
+void btstack_tlv_posix_set_sync_policy(btstack_tlv_posix_t * self, btstack_tlv_posix_sync_policy_t sync_policy, uint16_t batch_size, uint32_t batch_timeout_ms){
+	btstack_tlv_posix_sync(self);
+	self->sync_policy = sync_policy;
+	self->sync_batch_size = btstack_max(1, batch_size);
+	self->sync_batch_timeout_ms = batch_timeout_ms;
+}
+
+void btstack_tlv_posix_deinit(btstack_tlv_posix_t * self){
+	btstack_tlv_posix_sync(self);
+	if (self->file){
+		fclose(self->file);
+		self->file = NULL;
+	}
+	btstack_tlv_posix_free_entries(self);
+}
@@ -29,11 +29,15 @@
  *
  */
 
+
 /*
  *  btstack_tlv_posix.h
  *
  *  Implementation for BTstack's Tag Value Length Persistent Storage implementations
  *  using in-memory storage (RAM & malloc) and append-only log files on disc
+ *
+ *  Entries are kept in a hash table. The log file is compacted by writing all entries to a new
+ *  file that replaces the old one, when outdated records make up a large part of the file.
  */
 
 #ifndef __BTSTACK_TLV_POSIX_H
@@ -42,16 +46,52 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "btstack_tlv.h"
-#include "btstack_linked_list.h"
+#include "btstack_run_loop.h"
 
 #if defined __cplusplus
 extern "C" {
 #endif
 
+// compact log file if outdated records use more than BTSTACK_TLV_POSIX_COMPACTION_MIN_GARBAGE bytes
+// and more than BTSTACK_TLV_POSIX_COMPACTION_GARBAGE_PERCENT of the file
+#ifndef BTSTACK_TLV_POSIX_COMPACTION_MIN_GARBAGE
+#define BTSTACK_TLV_POSIX_COMPACTION_MIN_GARBAGE 4096
+#endif
+
+#ifndef BTSTACK_TLV_POSIX_COMPACTION_GARBAGE_PERCENT
+#define BTSTACK_TLV_POSIX_COMPACTION_GARBAGE_PERCENT 50
+#endif
+
+typedef enum {
+	// leave writing to stdio buffer and OS
+	BTSTACK_TLV_POSIX_SYNC_NONE = 0,
+	// flush and fsync after every store and delete
+	BTSTACK_TLV_POSIX_SYNC_ALWAYS,
+	// flush and fsync after a number of writes or a timeout after the first unsynced write
+	BTSTACK_TLV_POSIX_SYNC_BATCHED,
+} btstack_tlv_posix_sync_policy_t;
+
 typedef struct {
-	btstack_linked_list_t entry_list;
+	// hash table of entries
+	void ** buckets;
+	uint32_t num_buckets;
+	uint32_t num_entries;
+
 	const char * db_path;
 	FILE * file;
+
+	// size of log file and of records for current entries, the rest is garbage
+	uint32_t file_size;
+	uint32_t live_size;
+	uint32_t num_compactions;
+
+	// sync
+	btstack_tlv_posix_sync_policy_t sync_policy;
+	uint16_t sync_batch_size;
+	uint32_t sync_batch_timeout_ms;
+	uint16_t unsynced_writes;
+	btstack_timer_source_t sync_timer;
+	uint8_t  sync_timer_active;
 } btstack_tlv_posix_t;
 
 /**
@@ -61,6 +101,34 @@ typedef struct {
  */
 const btstack_tlv_t * btstack_tlv_posix_init_instance(btstack_tlv_posix_t * context, const char * db_path);
 
+/**
+ * Set when written records are flushed to disc
+ * @param context btstack_tlv_posix_t
+ * @param sync_policy
+ * @param batch_size for BTSTACK_TLV_POSIX_SYNC_BATCHED: max writes before sync
+ * @param batch_timeout_ms for BTSTACK_TLV_POSIX_SYNC_BATCHED: max time before sync, uses run loop timer. 0 = no timeout
+ */
+void btstack_tlv_posix_set_sync_policy(btstack_tlv_posix_t * context, btstack_tlv_posix_sync_policy_t sync_policy, uint16_t batch_size, uint32_t batch_timeout_ms);
+
+/**
+ * Flush and fsync pending writes
+ * @param context btstack_tlv_posix_t
+ */
+void btstack_tlv_posix_sync(btstack_tlv_posix_t * context);
+
+/**
+ * Rewrite log file with current entries only
+ * @param context btstack_tlv_posix_t
+ * @returns 0 on success
+ */
+int btstack_tlv_posix_compact(btstack_tlv_posix_t * context);
+
+/**
+ * Sync and close file, free entries
+ * @param context btstack_tlv_posix_t
+ */
+void btstack_tlv_posix_deinit(btstack_tlv_posix_t * context);
+
 #if defined __cplusplus
 }
 #endif
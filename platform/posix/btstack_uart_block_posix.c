@@ -53,6 +53,7 @@
 #include <unistd.h>   /* UNIX standard function definitions */
 #include <string.h>
 #include <errno.h>
+#include <sys/uio.h>
 #ifdef __APPLE__
 #include <sys/ioctl.h>
 #include <IOKit/serial/ioss.h>
@@ -64,14 +65,27 @@ static const btstack_uart_config_t * uart_config;
 // data source for integration with BTstack Runloop
 static btstack_data_source_t transport_data_source;
 
-// block write
-static int             write_bytes_len;
-static const uint8_t * write_bytes_data;
+// size of read-ahead buffer. receive_block requests are served from it, so that several
+// small blocks, e.g. H4 packet type, header and payload, only need a single read()
+#ifndef BTSTACK_UART_POSIX_READ_BUFFER_SIZE
+#define BTSTACK_UART_POSIX_READ_BUFFER_SIZE 1024
+#endif
+
+// block write, sent with writev()
+static struct iovec write_iov[BTSTACK_UART_MAX_BLOCKS];
+static int          write_iov_pos;
+static int          write_iov_count;
 
 // block read
 static uint16_t  read_bytes_len;
 static uint8_t * read_bytes_data;
 
+// read-ahead buffer
+static uint8_t   read_buffer[BTSTACK_UART_POSIX_READ_BUFFER_SIZE];
+static uint16_t  read_buffer_pos;
+static uint16_t  read_buffer_len;
+static int       read_buffer_active;
+
 // callbacks
 static void (*block_sent)(void);
 static void (*block_received)(void);
@@ -84,12 +98,12 @@ static int btstack_uart_posix_init(const btstack_uart_config_t * config){
 
 static void btstack_uart_posix_process_write(btstack_data_source_t *ds) {
     
-    if (write_bytes_len == 0) return;
+    if (write_iov_pos == write_iov_count) return;
 
     uint32_t start = btstack_run_loop_get_time_ms();
 
-    // write up to write_bytes_len to fd
-    int bytes_written = (int) write(ds->fd, write_bytes_data, write_bytes_len);
+    // write remaining blocks to fd
+    int bytes_written = (int) writev(ds->fd, &write_iov[write_iov_pos], write_iov_count - write_iov_pos);
     uint32_t end = btstack_run_loop_get_time_ms();
     if (end - start > 10){
         log_info("write took %u ms", end - start);
@@ -104,10 +118,14 @@ static void btstack_uart_posix_process_write(btstack_data_source_t *ds) {
         return;
     }
 
-    write_bytes_data += bytes_written;
-    write_bytes_len  -= bytes_written;
-
-    if (write_bytes_len){
+    // skip written blocks and advance partially written one
+    while (write_iov_pos < write_iov_count && bytes_written >= (int) write_iov[write_iov_pos].iov_len){
+        bytes_written -= write_iov[write_iov_pos].iov_len;
+        write_iov_pos++;
+    }
+    if (write_iov_pos < write_iov_count){
+        write_iov[write_iov_pos].iov_base = ((uint8_t *) write_iov[write_iov_pos].iov_base) + bytes_written;
+        write_iov[write_iov_pos].iov_len -= bytes_written;
         btstack_run_loop_enable_data_source_callbacks(ds, DATA_SOURCE_CALLBACK_WRITE);
         return;
     }
@@ -120,17 +138,43 @@ static void btstack_uart_posix_process_write(btstack_data_source_t *ds) {
     }
 }
 
+// serve pending block read from read-ahead buffer. receive_block calls from the block received callback
+// are handled by the loop to avoid recursion
+static void btstack_uart_posix_process_read_buffer(void){
+    if (read_buffer_active) return;
+    read_buffer_active = 1;
+    while (read_bytes_len && read_buffer_len){
+        uint16_t bytes_to_copy = read_bytes_len < read_buffer_len ? read_bytes_len : read_buffer_len;
+        memcpy(read_bytes_data, &read_buffer[read_buffer_pos], bytes_to_copy);
+        read_buffer_pos += bytes_to_copy;
+        read_buffer_len -= bytes_to_copy;
+        read_bytes_data += bytes_to_copy;
+        read_bytes_len  -= bytes_to_copy;
+        if (read_bytes_len) break;
+        if (block_received){
+            block_received();
+        }
+    }
+    read_buffer_active = 0;
+    if (read_bytes_len){
+        btstack_run_loop_enable_data_source_callbacks(&transport_data_source, DATA_SOURCE_CALLBACK_READ);
+    } else {
+        btstack_run_loop_disable_data_source_callbacks(&transport_data_source, DATA_SOURCE_CALLBACK_READ);
+    }
+}
+
 static void btstack_uart_posix_process_read(btstack_data_source_t *ds) {
 
     if (read_bytes_len == 0) {
         log_info("called but no read pending");
         btstack_run_loop_disable_data_source_callbacks(ds, DATA_SOURCE_CALLBACK_READ);
+        return;
     }
 
     uint32_t start = btstack_run_loop_get_time_ms();
     
-    // read up to bytes_to_read data in
-    ssize_t bytes_read = read(ds->fd, read_bytes_data, read_bytes_len);
+    // read everything that is available into read-ahead buffer
+    ssize_t bytes_read = read(ds->fd, read_buffer, sizeof(read_buffer));
     // log_info("btstack_uart_posix_process_read need %u bytes, got %d", read_bytes_len, (int) bytes_read);
     uint32_t end = btstack_run_loop_get_time_ms();
     if (end - start > 10){
@@ -145,15 +189,9 @@ static void btstack_uart_posix_process_read(btstack_data_source_t *ds) {
         return;
     }
 
-    read_bytes_len   -= bytes_read;
-    read_bytes_data  += bytes_read;
-    if (read_bytes_len > 0) return;
-    
-    btstack_run_loop_disable_data_source_callbacks(ds, DATA_SOURCE_CALLBACK_READ);
-
-    if (block_received){
-        block_received();
-    }
+    read_buffer_pos = 0;
+    read_buffer_len = (uint16_t) bytes_read;
+    btstack_uart_posix_process_read_buffer();
 }
 
 static void hci_uart_posix_process(btstack_data_source_t *ds, btstack_data_source_callback_type_t callback_type) {
@@ -344,6 +382,10 @@ static int btstack_uart_posix_open(void){
 
     // store fd in data source
     transport_data_source.fd = fd;
+
+    // drop data read ahead from previous session
+    read_buffer_len = 0;
+    read_bytes_len  = 0;
     
     // also set baudrate
     if (btstack_uart_posix_set_baudrate(baudrate) < 0){
@@ -380,19 +422,35 @@ static void btstack_uart_posix_set_block_sent( void (*block_handler)(void)){
     block_sent = block_handler;
 }
 
-static void btstack_uart_posix_send_block(const uint8_t *data, uint16_t size){
+static void btstack_uart_posix_send_blocks(const uint8_t * const * buffers, const uint16_t * lengths, uint8_t num_blocks){
     // setup async write
-    write_bytes_data = data;
-    write_bytes_len  = size;
+    int i;
+    for (i = 0; i < num_blocks; i++){
+        write_iov[i].iov_base = (void *) buffers[i];
+        write_iov[i].iov_len  = lengths[i];
+    }
+    write_iov_pos   = 0;
+    write_iov_count = num_blocks;
 
     // go
     // btstack_uart_posix_process_write(&transport_data_source);
     btstack_run_loop_enable_data_source_callbacks(&transport_data_source, DATA_SOURCE_CALLBACK_WRITE);
 }
 
+static void btstack_uart_posix_send_block(const uint8_t *data, uint16_t size){
+    btstack_uart_posix_send_blocks(&data, &size, 1);
+}
+
 static void btstack_uart_posix_receive_block(uint8_t *buffer, uint16_t len){
     read_bytes_data = buffer;
     read_bytes_len = len;
+
+    // serve from read-ahead buffer first
+    if (read_buffer_len){
+        btstack_uart_posix_process_read_buffer();
+        return;
+    }
+
     btstack_run_loop_enable_data_source_callbacks(&transport_data_source, DATA_SOURCE_CALLBACK_READ);
 
     // go
@@ -418,6 +476,7 @@ static const btstack_uart_block_t btstack_uart_posix = {
     /* int (*get_supported_sleep_modes); */                           NULL,
     /* void (*set_sleep)(btstack_uart_sleep_mode_t sleep_mode); */    NULL,
     /* void (*set_wakeup_handler)(void (*handler)(void)); */          NULL,
+    /* void (*send_blocks)(...); */                                   &btstack_uart_posix_send_blocks,
 };
 
 const btstack_uart_block_t * btstack_uart_block_posix_instance(void){
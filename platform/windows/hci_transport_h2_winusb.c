@@ -70,6 +70,12 @@
 #include <SetupAPI.h>
 #include <Winusb.h>
 
+// HCI Commands and ACL packets are sent on separate endpoints and may complete in any order,
+// but hci.c releases outgoing packet buffers in send order
+#if HCI_OUTGOING_PACKET_BUFFER_COUNT > 1
+#error "WinUSB transport does not support HCI_OUTGOING_PACKET_BUFFER_COUNT > 1"
+#endif
+
 #ifdef ENABLE_SCO_OVER_HCI
 
 // Isochronous Add-On
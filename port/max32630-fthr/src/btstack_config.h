@@ -39,6 +39,8 @@
 #define MAX_NR_AVDTP_STREAM_ENDPOINTS 1
 #define MAX_NR_AVDTP_CONNECTIONS 1
 #define MAX_NR_AVRCP_CONNECTIONS 1
+#define MAX_NR_GOEP_CLIENTS 1
+#define MAX_NR_PBAP_CLIENTS 1
 
 // Link Key DB and LE Device DB using TLV on top of Flash Sector interface
 #define NVM_NUM_LINK_KEYS 16
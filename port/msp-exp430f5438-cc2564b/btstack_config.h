@@ -23,10 +23,12 @@
 #define MAX_NR_BNEP_SERVICES 1
 #define MAX_NR_BTSTACK_LINK_KEY_DB_MEMORY_ENTRIES  2
 #define MAX_NR_GATT_CLIENTS 1
+#define MAX_NR_GOEP_CLIENTS 1
 #define MAX_NR_HCI_CONNECTIONS MAX_SPP_CONNECTIONS
 #define MAX_NR_HFP_CONNECTIONS 0
 #define MAX_NR_L2CAP_CHANNELS  (1+MAX_SPP_CONNECTIONS)
 #define MAX_NR_L2CAP_SERVICES  2
+#define MAX_NR_PBAP_CLIENTS 1
 #define MAX_NR_RFCOMM_CHANNELS MAX_SPP_CONNECTIONS
 #define MAX_NR_RFCOMM_MULTIPLEXERS MAX_SPP_CONNECTIONS
 #define MAX_NR_RFCOMM_SERVICES 1
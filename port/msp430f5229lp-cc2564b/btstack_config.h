@@ -31,6 +31,8 @@
 #define MAX_NR_BNEP_SERVICES 1
 #define MAX_NR_BNEP_CHANNELS MAX_SPP_CONNECTIONS
 #define MAX_NR_BTSTACK_LINK_KEY_DB_MEMORY_ENTRIES  2
+#define MAX_NR_GOEP_CLIENTS 1
+#define MAX_NR_PBAP_CLIENTS 1
 #define MAX_NR_WHITELIST_ENTRIES 1
 #define MAX_NR_SM_LOOKUP_ENTRIES 3
 #define MAX_NR_SERVICE_RECORD_ITEMS 1
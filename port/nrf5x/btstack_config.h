@@ -30,6 +30,8 @@
 #define MAX_NR_BNEP_SERVICES 0
 #define MAX_NR_BNEP_CHANNELS 0
 #define MAX_NR_HFP_CONNECTIONS 0
+#define MAX_NR_GOEP_CLIENTS 1
+#define MAX_NR_PBAP_CLIENTS 1
 #define MAX_NR_WHITELIST_ENTRIES 1
 #define MAX_NR_SM_LOOKUP_ENTRIES 3
 #define MAX_NR_SERVICE_RECORD_ITEMS 1
@@ -39,5 +39,7 @@
 #define MAX_NR_AVDTP_STREAM_ENDPOINTS 1
 #define MAX_NR_AVDTP_CONNECTIONS 1
 #define MAX_NR_AVRCP_CONNECTIONS 1
+#define MAX_NR_GOEP_CLIENTS 1
+#define MAX_NR_PBAP_CLIENTS 1
 
 #endif
@@ -111,6 +111,17 @@ static uint16_t ancs_attribute_len;
 static btstack_packet_handler_t client_handler;
 static btstack_packet_callback_registration_t hci_event_callback_registration;
 
+static const uint8_t ancs_client_hci_events[] = {
+    HCI_EVENT_LE_META,
+    HCI_EVENT_ENCRYPTION_CHANGE,
+    HCI_EVENT_DISCONNECTION_COMPLETE,
+    0
+};
+static const uint8_t ancs_client_hci_le_subevents[] = {
+    HCI_SUBEVENT_LE_CONNECTION_COMPLETE,
+    0
+};
+
 void ancs_client_register_callback(btstack_packet_handler_t handler){
     client_handler = handler; 
 }
@@ -354,5 +365,5 @@ static void handle_hci_event(uint8_t packet_type, uint16_t channel, uint8_t *pac
 
 void ancs_client_init(void){
     hci_event_callback_registration.callback = &handle_hci_event;
-    hci_add_event_handler(&hci_event_callback_registration);
+    hci_add_event_handler_for_events(&hci_event_callback_registration, ancs_client_hci_events, ancs_client_hci_le_subevents);
 }
@@ -69,6 +69,7 @@ static uint16_t uuid16_from_uuid(uint16_t uuid_len, uint8_t * uuid){
 static void att_persistent_ccc_cache(uint16_t handle, uint16_t flags);
 
 static uint8_t const * att_db = NULL;
+static uint16_t const * att_db_index = NULL;
 static att_read_callback_t  att_read_callback  = NULL;
 static att_write_callback_t att_write_callback = NULL;
 static uint8_t  att_prepare_write_error_code   = 0;
@@ -78,6 +79,11 @@ static uint16_t att_prepare_write_error_handle = 0x0000;
 static uint16_t att_persistent_ccc_handle;
 static uint16_t att_persistent_ccc_flags;
 
+// index created by att_set_db
+#ifdef MAX_ATT_DB_INDEX_SIZE
+static uint16_t att_db_index_storage[MAX_ATT_DB_INDEX_SIZE];
+#endif
+
 // new java-style iterator
 typedef struct att_iterator {
     // private
@@ -150,8 +156,133 @@ static int att_iterator_match_uuid(att_iterator_t *it, uint8_t *uuid, uint16_t u
 }
 
 
+// ATT DB index layout:
+// [0]               number of handles N
+// [1..N]            offset of attribute with handle 1..N in ATT DB, ATT_DB_INDEX_NO_ATTRIBUTE for unused handles
+// [N+1]             offset of END tag
+// [N+2]             number of services S
+// [N+3..N+2+2*S]    start handle and end handle for each service
+
+#define ATT_DB_INDEX_NO_ATTRIBUTE 0xffff
+
+static int att_iterator_match_service(att_iterator_t *it){
+    return att_iterator_match_uuid16(it, GATT_PRIMARY_SERVICE_UUID) || att_iterator_match_uuid16(it, GATT_SECONDARY_SERVICE_UUID);
+}
+
+// start iteration at first attribute with handle >= given handle
+static void att_iterator_init_for_handle(att_iterator_t *it, uint32_t handle){
+    att_iterator_init(it);
+    if (!att_db_index) return;
+    uint16_t num_handles = att_db_index[0];
+    uint16_t offset = att_db_index[num_handles + 1];
+    if (handle == 0) handle = 1;
+    for ( ; handle <= num_handles ; handle++){
+        if (att_db_index[handle] == ATT_DB_INDEX_NO_ATTRIBUTE) continue;
+        offset = att_db_index[handle];
+        break;
+    }
+    it->att_ptr = att_db + offset;
+}
+
+// with index, continue with first attribute after the service that contains the current attribute,
+// if the service ends before end_handle. last_handle is set to the last handle of the service
+static void att_iterator_skip_service(att_iterator_t *it, uint16_t end_handle, uint16_t * last_handle){
+    if (!att_db_index) return;
+    if (it->handle == 0) return;
+    uint16_t num_handles = att_db_index[0];
+    const uint16_t * services = &att_db_index[num_handles + 3];
+    // binary search for last service starting at or before current attribute
+    int low  = 0;
+    int high = att_db_index[num_handles + 2] - 1;
+    while (low <= high){
+        int mid = (low + high) >> 1;
+        if (services[mid * 2] > it->handle){
+            high = mid - 1;
+            continue;
+        }
+        if (services[mid * 2 + 1] < it->handle){
+            low = mid + 1;
+            continue;
+        }
+        uint16_t service_end_handle = services[mid * 2 + 1];
+        if (service_end_handle >= end_handle) return;
+        *last_handle = service_end_handle;
+        att_iterator_init_for_handle(it, ((uint32_t) service_end_handle) + 1);
+        return;
+    }
+}
+
+uint16_t att_db_index_create(uint8_t const * db, uint16_t * index, uint16_t index_size){
+    uint16_t num_handles  = 0;
+    uint16_t num_services = 0;
+    uint16_t prev_handle  = 0;
+
+    // get number of handles and services, handles have to be in ascending order
+    uint8_t const * att_db_backup = att_db;
+    att_db = db;
+    att_iterator_t it;
+    att_iterator_init(&it);
+    while (att_iterator_has_next(&it)){
+        att_iterator_fetch_next(&it);
+        if (it.handle == 0) break;
+        if (it.handle <= prev_handle) {
+            log_error("att_db_index_create: handle 0x%04x not in ascending order", it.handle);
+            att_db = att_db_backup;
+            return 0;
+        }
+        prev_handle = it.handle;
+        if (att_iterator_match_service(&it)){
+            num_services++;
+        }
+    }
+    num_handles = prev_handle;
+    uint32_t index_len = 3 + (uint32_t) num_handles + 2 * (uint32_t) num_services;
+    if (index_len > index_size){
+        log_info("att_db_index_create: index needs %u entries, only %u available", (unsigned int) index_len, index_size);
+        att_db = att_db_backup;
+        return 0;
+    }
+
+    // store offsets and service handle ranges
+    index[0] = num_handles;
+    uint16_t handle;
+    for (handle = 1; handle <= num_handles; handle++){
+        index[handle] = ATT_DB_INDEX_NO_ATTRIBUTE;
+    }
+    index[num_handles + 2] = num_services;
+    uint16_t * services = &index[num_handles + 3];
+    int service = -1;
+    att_iterator_init(&it);
+    while (att_iterator_has_next(&it)){
+        uint16_t offset = it.att_ptr - db;
+        att_iterator_fetch_next(&it);
+        if (it.handle == 0) {
+            index[num_handles + 1] = offset;
+            break;
+        }
+        index[it.handle] = offset;
+        if (att_iterator_match_service(&it)){
+            service++;
+            services[service * 2] = it.handle;
+        }
+        if (service >= 0){
+            services[service * 2 + 1] = it.handle;
+        }
+    }
+    att_db = att_db_backup;
+    return (uint16_t) index_len;
+}
+
 static int att_find_handle(att_iterator_t *it, uint16_t handle){
     if (handle == 0) return 0;
+    if (att_db_index){
+        if (handle > att_db_index[0]) return 0;
+        uint16_t offset = att_db_index[handle];
+        if (offset == ATT_DB_INDEX_NO_ATTRIBUTE) return 0;
+        it->att_ptr = att_db + offset;
+        att_iterator_fetch_next(it);
+        return 1;
+    }
     att_iterator_init(it);
     while (att_iterator_has_next(it)){
         att_iterator_fetch_next(it);
@@ -196,6 +327,24 @@ static int att_copy_value(att_iterator_t *it, uint16_t offset, uint8_t * buffer,
 
 void att_set_db(uint8_t const * db){
     att_db = db;
+    att_db_index = NULL;
+#ifdef MAX_ATT_DB_INDEX_SIZE
+    if (db && att_db_index_create(db, att_db_index_storage, MAX_ATT_DB_INDEX_SIZE)){
+        att_db_index = att_db_index_storage;
+    }
+#endif
+}
+
+void att_set_db_index(uint16_t const * index){
+    att_db_index = NULL;
+    if (!index || !att_db) return;
+    // verify that index matches ATT DB by checking END tag
+    uint16_t end_offset = index[index[0] + 1];
+    if (little_endian_read_16(att_db, end_offset) != 0){
+        log_error("att_set_db_index: index doesn't match ATT DB");
+        return;
+    }
+    att_db_index = index;
 }
 
 void att_set_read_callback(att_read_callback_t callback){
@@ -340,7 +489,7 @@ static uint16_t handle_find_information_request2(att_connection_t * att_connecti
     uint16_t uuid_len = 0;
     
     att_iterator_t it;
-    att_iterator_init(&it);
+    att_iterator_init_for_handle(&it, start_handle);
     while (att_iterator_has_next(&it)){
         att_iterator_fetch_next(&it);
         if (!it.handle) break;
@@ -420,9 +569,10 @@ static uint16_t handle_find_by_type_value_request2(att_connection_t * att_connec
     uint16_t offset      = 1;
     uint16_t in_group    = 0;
     uint16_t prev_handle = 0;
+    int service_type = (attribute_type == GATT_PRIMARY_SERVICE_UUID) || (attribute_type == GATT_SECONDARY_SERVICE_UUID);
     
     att_iterator_t it;
-    att_iterator_init(&it);
+    att_iterator_init_for_handle(&it, start_handle);
     while (att_iterator_has_next(&it)){
         att_iterator_fetch_next(&it);
         
@@ -454,6 +604,11 @@ static uint16_t handle_find_by_type_value_request2(att_connection_t * att_connec
             offset += 2;
             in_group = 1;
         }
+
+        // only service declarations can match, continue with next one
+        if (service_type){
+            att_iterator_skip_service(&it, end_handle, &prev_handle);
+        }
     }
     
     if (offset == 1){
@@ -490,7 +645,7 @@ static uint16_t handle_read_by_type_request2(att_connection_t * att_connection,
     uint16_t pair_len = 0;
 
     att_iterator_t it;
-    att_iterator_init(&it);
+    att_iterator_init_for_handle(&it, start_handle);
     uint8_t error_code = 0;
     uint16_t first_matching_but_unreadable_handle = 0;
 
@@ -792,7 +947,7 @@ static uint16_t handle_read_by_group_type_request2(att_connection_t * att_connec
     uint16_t prev_handle = 0;
 
     att_iterator_t it;
-    att_iterator_init(&it);
+    att_iterator_init_for_handle(&it, start_handle);
     while (att_iterator_has_next(&it)){
         att_iterator_fetch_next(&it);
         
@@ -848,6 +1003,9 @@ static uint16_t handle_read_by_group_type_request2(att_connection_t * att_connec
             group_start_value  = it.value;
             in_group = 1;
         }
+
+        // only service declarations can match, continue with next one
+        att_iterator_skip_service(&it, end_handle, &prev_handle);
     }        
     
     if (offset == 1){
@@ -1146,7 +1304,7 @@ int gatt_server_get_get_handle_range_for_service_with_uuid16(uint16_t uuid16, ui
 // returns 0 if not found
 uint16_t gatt_server_get_value_handle_for_characteristic_with_uuid16(uint16_t start_handle, uint16_t end_handle, uint16_t uuid16){
     att_iterator_t it;
-    att_iterator_init(&it);
+    att_iterator_init_for_handle(&it, start_handle);
     while (att_iterator_has_next(&it)){
         att_iterator_fetch_next(&it);
         if (it.handle && it.handle < start_handle) continue;
@@ -1160,7 +1318,7 @@ uint16_t gatt_server_get_value_handle_for_characteristic_with_uuid16(uint16_t st
 // returns 0 if not found
 uint16_t gatt_server_get_client_configuration_handle_for_characteristic_with_uuid16(uint16_t start_handle, uint16_t end_handle, uint16_t uuid16){
     att_iterator_t it;
-    att_iterator_init(&it);
+    att_iterator_init_for_handle(&it, start_handle);
     int characteristic_found = 0;
     while (att_iterator_has_next(&it)){
         att_iterator_fetch_next(&it);
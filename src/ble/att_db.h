@@ -108,6 +108,22 @@ typedef struct att_service_handler {
  */
 void att_set_db(uint8_t const * db);
 
+/*
+ * @brief create index for handle and service lookup in ATT database
+ * @param db
+ * @param index buffer
+ * @param index_size in uint16_t entries
+ * @returns number of used entries, 0 if buffer too small or handles not in ascending order
+ */
+uint16_t att_db_index_create(uint8_t const * db, uint16_t * index, uint16_t index_size);
+
+/*
+ * @brief use index for lookups in current ATT database, e.g. profile_data_index generated by compile_gatt.py
+ * @note att_set_db resets index, if MAX_ATT_DB_INDEX_SIZE is defined, index is created by att_set_db
+ * @param index or NULL
+ */
+void att_set_db_index(uint16_t const * index);
+
 /*
  * @brief set callback for read of dynamic attributes
  * @param callback
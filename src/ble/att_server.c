@@ -70,7 +70,22 @@
 #define NVN_NUM_GATT_SERVER_CCC 20
 #endif
 
+// number of attribute values queued by att_server_notify_connections/att_server_indicate_connections
+#ifndef MAX_ATT_SERVER_FANOUT_VALUES
+#define MAX_ATT_SERVER_FANOUT_VALUES 4
+#endif
+
+#if MAX_ATT_SERVER_FANOUT_VALUES > 32
+#error "MAX_ATT_SERVER_FANOUT_VALUES must not be larger than 32"
+#endif
+
+#ifndef MAX_ATT_SERVER_FANOUT_VALUE_SIZE
+#define MAX_ATT_SERVER_FANOUT_VALUE_SIZE (ATT_DEFAULT_MTU - 3)
+#endif
+
 static void att_run_for_context(att_server_t * att_server);
+static void att_server_fanout_drop(att_server_t * att_server);
+static int  att_server_fanout_run(void);
 static att_write_callback_t att_server_write_callback_for_handle(uint16_t handle);
 static void att_server_persistent_ccc_restore(att_server_t * att_server);
 static void att_server_persistent_ccc_clear(att_server_t * att_server);
@@ -83,14 +98,39 @@ typedef struct {
     uint8_t  device_index;
 } persistent_ccc_entry_t;
 
+// value queued for several connections
+typedef struct {
+    uint16_t attribute_handle;
+    uint8_t  indicate;
+    uint16_t num_pending;
+    uint16_t value_len;
+    uint8_t  value[MAX_ATT_SERVER_FANOUT_VALUE_SIZE];
+} att_server_fanout_value_t;
+
 // global
 static btstack_packet_callback_registration_t hci_event_callback_registration;
+
+static const uint8_t att_server_hci_events[] = {
+    HCI_EVENT_LE_META,
+    HCI_EVENT_ENCRYPTION_CHANGE,
+    HCI_EVENT_ENCRYPTION_KEY_REFRESH_COMPLETE,
+    HCI_EVENT_DISCONNECTION_COMPLETE,
+    0
+};
+static const uint8_t att_server_hci_le_subevents[] = {
+    HCI_SUBEVENT_LE_CONNECTION_COMPLETE,
+    0
+};
 static btstack_packet_callback_registration_t sm_event_callback_registration;
 static btstack_packet_handler_t               att_client_packet_handler = NULL;
 static btstack_linked_list_t                  can_send_now_clients;
 static btstack_linked_list_t                  service_handlers;
 static uint8_t                                att_client_waiting_for_can_send;
 
+static att_server_fanout_value_t              att_server_fanout_values[MAX_ATT_SERVER_FANOUT_VALUES];
+static hci_con_handle_t                       att_server_fanout_last_con_handle = HCI_CON_HANDLE_INVALID;
+static att_server_fanout_statistics_t         att_server_fanout_statistics;
+
 static att_read_callback_t                    att_server_client_read_callback;
 static att_write_callback_t                   att_server_client_write_callback;
 
@@ -232,6 +272,7 @@ static void att_event_packet_handler (uint8_t packet_type, uint16_t channel, uin
                     att_server = att_server_for_handle(con_handle);
                     if (!att_server) break;
                     att_clear_transaction_queue(&att_server->connection);
+                    att_server_fanout_drop(att_server);
                     att_server->connection.con_handle = 0;
                     att_server->value_indication_handle = 0; // reset error state
                     att_server->pairing_active = 0;
@@ -433,6 +474,199 @@ static void att_run_for_context(att_server_t * att_server){
     }   
 }
 
+// ---------------------
+// fan-out of queued values to several connections
+
+static void att_server_fanout_send_prepared(att_server_t * att_server, att_server_fanout_value_t * fanout_value){
+    hci_con_handle_t con_handle = att_server->connection.con_handle;
+    l2cap_reserve_packet_buffer();
+    uint8_t * packet_buffer = l2cap_get_outgoing_buffer();
+    uint16_t size;
+    if (fanout_value->indicate){
+        att_server->value_indication_handle = fanout_value->attribute_handle;
+        btstack_run_loop_set_timer_handler(&att_server->value_indication_timer, att_handle_value_indication_timeout);
+        btstack_run_loop_set_timer_context(&att_server->value_indication_timer, (void *)(uintptr_t) con_handle);
+        btstack_run_loop_set_timer(&att_server->value_indication_timer, ATT_TRANSACTION_TIMEOUT_MS);
+        btstack_run_loop_add_timer(&att_server->value_indication_timer);
+        size = att_prepare_handle_value_indication(&att_server->connection, fanout_value->attribute_handle, fanout_value->value, fanout_value->value_len, packet_buffer);
+    } else {
+        size = att_prepare_handle_value_notification(&att_server->connection, fanout_value->attribute_handle, fanout_value->value, fanout_value->value_len, packet_buffer);
+    }
+    if (l2cap_send_prepared_connectionless(con_handle, L2CAP_CID_ATTRIBUTE_PROTOCOL, size)){
+        att_server_fanout_statistics.dropped++;
+    } else {
+        att_server_fanout_statistics.sent++;
+    }
+}
+
+// find queued value that can be sent, indications have to wait for confirmation of the previous one
+static int att_server_fanout_next_slot(att_server_t * att_server){
+    int i;
+    for (i=0;i<MAX_ATT_SERVER_FANOUT_VALUES;i++){
+        int slot = (att_server->fanout_next_slot + i) % MAX_ATT_SERVER_FANOUT_VALUES;
+        if ((att_server->fanout_pending & (1u << slot)) == 0) continue;
+        if (att_server_fanout_values[slot].indicate && att_server->value_indication_handle) continue;
+        return slot;
+    }
+    return -1;
+}
+
+// send queued values round-robin, one value per connection, starting after the last connection served
+// returns 1 if values are still queued but cannot be sent now
+static int att_server_fanout_run(void){
+    while (1){
+        btstack_linked_list_iterator_t it;
+        att_server_t * first = NULL;
+        att_server_t * next  = NULL;
+        int waiting = 0;
+        int passed_last = 0;
+        hci_connections_get_iterator(&it);
+        while(btstack_linked_list_iterator_has_next(&it)){
+            hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
+            att_server_t * att_server = &connection->att_server;
+            int ready = 0;
+            if (att_server->fanout_pending && att_server_fanout_next_slot(att_server) >= 0){
+                if (att_dispatch_server_can_send_now(connection->con_handle)){
+                    ready = 1;
+                } else {
+                    waiting = 1;
+                }
+            }
+            if (ready && !first){
+                first = att_server;
+            }
+            if (ready && passed_last && !next){
+                next = att_server;
+            }
+            if (connection->con_handle == att_server_fanout_last_con_handle){
+                passed_last = 1;
+            }
+        }
+        if (!next){
+            next = first;
+        }
+        if (!next) return waiting;
+
+        int slot = att_server_fanout_next_slot(next);
+        att_server_fanout_last_con_handle = next->connection.con_handle;
+        next->fanout_pending &= ~(1u << slot);
+        next->fanout_next_slot = (slot + 1) % MAX_ATT_SERVER_FANOUT_VALUES;
+        att_server_fanout_values[slot].num_pending--;
+        att_server_fanout_send_prepared(next, &att_server_fanout_values[slot]);
+    }
+}
+
+static void att_server_fanout_drop(att_server_t * att_server){
+    int slot;
+    for (slot=0;slot<MAX_ATT_SERVER_FANOUT_VALUES;slot++){
+        if ((att_server->fanout_pending & (1u << slot)) == 0) continue;
+        att_server_fanout_values[slot].num_pending--;
+        att_server_fanout_statistics.dropped++;
+    }
+    att_server->fanout_pending = 0;
+}
+
+static int att_server_fanout_targets_connection(hci_con_handle_t con_handle, const hci_con_handle_t * con_handles, uint16_t num_con_handles){
+    if (!con_handles) return 1;
+    int i;
+    for (i=0;i<num_con_handles;i++){
+        if (con_handles[i] == con_handle) return 1;
+    }
+    return 0;
+}
+
+// value can only be replaced if all connections it is still pending for get the new one
+static int att_server_fanout_covers_pending(int slot, const hci_con_handle_t * con_handles, uint16_t num_con_handles){
+    btstack_linked_list_iterator_t it;
+    hci_connections_get_iterator(&it);
+    while(btstack_linked_list_iterator_has_next(&it)){
+        hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
+        if ((connection->att_server.fanout_pending & (1u << slot)) == 0) continue;
+        if (!att_server_fanout_targets_connection(connection->con_handle, con_handles, num_con_handles)) return 0;
+    }
+    return 1;
+}
+
+static att_server_fanout_value_t * att_server_fanout_value_for_handle(uint16_t attribute_handle, uint8_t indicate, const hci_con_handle_t * con_handles, uint16_t num_con_handles){
+    att_server_fanout_value_t * free_value = NULL;
+    int slot;
+    for (slot=0;slot<MAX_ATT_SERVER_FANOUT_VALUES;slot++){
+        att_server_fanout_value_t * fanout_value = &att_server_fanout_values[slot];
+        if (fanout_value->num_pending == 0){
+            if (!free_value) {
+                free_value = fanout_value;
+            }
+            continue;
+        }
+        if (fanout_value->attribute_handle != attribute_handle) continue;
+        if (fanout_value->indicate != indicate) continue;
+        if (att_server_fanout_covers_pending(slot, con_handles, num_con_handles)) return fanout_value;
+    }
+    return free_value;
+}
+
+static void att_server_fanout_queue_for_connection(att_server_t * att_server, int slot){
+    att_server_fanout_value_t * fanout_value = &att_server_fanout_values[slot];
+    uint32_t mask = 1u << slot;
+    if (att_server->fanout_pending & mask){
+        // replace value that was not sent yet
+        att_server_fanout_statistics.superseded++;
+    } else {
+        att_server->fanout_pending |= mask;
+        fanout_value->num_pending++;
+    }
+    // older value for same attribute and PDU type still queued in another slot gets replaced, too
+    int other;
+    for (other=0;other<MAX_ATT_SERVER_FANOUT_VALUES;other++){
+        if (other == slot) continue;
+        if ((att_server->fanout_pending & (1u << other)) == 0) continue;
+        if (att_server_fanout_values[other].attribute_handle != fanout_value->attribute_handle) continue;
+        if (att_server_fanout_values[other].indicate != fanout_value->indicate) continue;
+        att_server->fanout_pending &= ~(1u << other);
+        att_server_fanout_values[other].num_pending--;
+        att_server_fanout_statistics.superseded++;
+    }
+    att_server_fanout_statistics.queued++;
+}
+
+static int att_server_fanout_queue(uint16_t attribute_handle, uint8_t indicate, const uint8_t * value, uint16_t value_len, const hci_con_handle_t * con_handles, uint16_t num_con_handles){
+    if (value_len > MAX_ATT_SERVER_FANOUT_VALUE_SIZE) return ERROR_CODE_UNSUPPORTED_FEATURE_OR_PARAMETER_VALUE;
+
+    att_server_fanout_value_t * fanout_value = att_server_fanout_value_for_handle(attribute_handle, indicate, con_handles, num_con_handles);
+    if (!fanout_value) return BTSTACK_MEMORY_ALLOC_FAILED;
+    int slot = fanout_value - att_server_fanout_values;
+
+    fanout_value->attribute_handle = attribute_handle;
+    fanout_value->indicate = indicate;
+    fanout_value->value_len = value_len;
+    memcpy(fanout_value->value, value, value_len);
+
+    if (con_handles){
+        int i;
+        for (i=0;i<num_con_handles;i++){
+            att_server_t * att_server = att_server_for_handle(con_handles[i]);
+            if (!att_server) continue;
+            if (att_server->connection.con_handle != con_handles[i]) continue;
+            att_server_fanout_queue_for_connection(att_server, slot);
+        }
+    } else {
+        btstack_linked_list_iterator_t it;
+        hci_connections_get_iterator(&it);
+        while(btstack_linked_list_iterator_has_next(&it)){
+            hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
+            att_server_t * att_server = &connection->att_server;
+            if (att_server->connection.con_handle != connection->con_handle) continue;
+            att_server_fanout_queue_for_connection(att_server, slot);
+        }
+    }
+
+    if (att_server_fanout_run()){
+        // L2CAP emits a single can send now event for the ATT fixed channel
+        att_dispatch_server_request_can_send_now_event(HCI_CON_HANDLE_INVALID);
+    }
+    return 0;
+}
+
 static void att_server_handle_can_send_now(void){
 
     // NOTE: we get l2cap fixed channel instead of con_handle 
@@ -467,7 +701,18 @@ static void att_server_handle_can_send_now(void){
         }
     }
 
+    // queued values
+    if (att_server_fanout_run()){
+        att_dispatch_server_request_can_send_now_event(HCI_CON_HANDLE_INVALID);
+        return;
+    }
+
     if (att_client_waiting_for_can_send){
+        // queued values might have used all buffers
+        if (!hci_can_send_acl_le_packet_now()){
+            att_dispatch_server_request_can_send_now_event(HCI_CON_HANDLE_INVALID);
+            return;
+        }
         att_client_waiting_for_can_send = 0;
         att_emit_can_send_now_event();
     }
@@ -495,6 +740,10 @@ static void att_packet_handler(uint8_t packet_type, uint16_t handle, uint8_t *pa
                 uint16_t att_handle = att_server->value_indication_handle;
                 att_server->value_indication_handle = 0;    
                 att_handle_value_indication_notify_client(0, att_server->connection.con_handle, att_handle);
+                // continue with queued values
+                if (att_server->fanout_pending){
+                    att_dispatch_server_request_can_send_now_event(att_server->connection.con_handle);
+                }
                 return;
             }
 
@@ -775,9 +1024,13 @@ void att_server_init(uint8_t const * db, att_read_callback_t read_callback, att_
     att_server_client_read_callback  = read_callback;
     att_server_client_write_callback = write_callback;
 
+    // no values queued
+    memset(att_server_fanout_values, 0, sizeof(att_server_fanout_values));
+    att_server_fanout_last_con_handle = HCI_CON_HANDLE_INVALID;
+
     // register for HCI Events
     hci_event_callback_registration.callback = &att_event_packet_handler;
-    hci_add_event_handler(&hci_event_callback_registration);
+    hci_add_event_handler_for_events(&hci_event_callback_registration, att_server_hci_events, att_server_hci_le_subevents);
 
     // register for SM events
     sm_event_callback_registration.callback = &att_event_packet_handler;
@@ -840,6 +1093,7 @@ int att_server_indicate(hci_con_handle_t con_handle, uint16_t attribute_handle,
     // track indication
     att_server->value_indication_handle = attribute_handle;
     btstack_run_loop_set_timer_handler(&att_server->value_indication_timer, att_handle_value_indication_timeout);
+    btstack_run_loop_set_timer_context(&att_server->value_indication_timer, (void *)(uintptr_t) con_handle);
     btstack_run_loop_set_timer(&att_server->value_indication_timer, ATT_TRANSACTION_TIMEOUT_MS);
     btstack_run_loop_add_timer(&att_server->value_indication_timer);
 
@@ -849,3 +1103,19 @@ int att_server_indicate(hci_con_handle_t con_handle, uint16_t attribute_handle,
 	l2cap_send_prepared_connectionless(att_server->connection.con_handle, L2CAP_CID_ATTRIBUTE_PROTOCOL, size);
     return 0;
 }
+
+int att_server_notify_connections(uint16_t attribute_handle, const uint8_t * value, uint16_t value_len, const hci_con_handle_t * con_handles, uint16_t num_con_handles){
+    return att_server_fanout_queue(attribute_handle, 0, value, value_len, con_handles, num_con_handles);
+}
+
+int att_server_indicate_connections(uint16_t attribute_handle, const uint8_t * value, uint16_t value_len, const hci_con_handle_t * con_handles, uint16_t num_con_handles){
+    return att_server_fanout_queue(attribute_handle, 1, value, value_len, con_handles, num_con_handles);
+}
+
+void att_server_get_fanout_statistics(att_server_fanout_statistics_t * statistics){
+    *statistics = att_server_fanout_statistics;
+}
+
+void att_server_reset_fanout_statistics(void){
+    memset(&att_server_fanout_statistics, 0, sizeof(att_server_fanout_statistics));
+}
@@ -46,6 +46,19 @@ extern "C" {
 #endif
 
 /* API_START */
+
+// delivery statistics for att_server_notify_connections and att_server_indicate_connections
+typedef struct {
+    // values queued for a connection
+    uint32_t queued;
+    // values sent to a connection
+    uint32_t sent;
+    // queued values replaced by a newer value for the same attribute handle before they were sent
+    uint32_t superseded;
+    // queued values not sent as the connection was closed or sending failed
+    uint32_t dropped;
+} att_server_fanout_statistics_t;
+
 /*
  * @brief setup ATT server
  * @param db attribute database created by compile-gatt.ph
@@ -112,6 +125,44 @@ int att_server_notify(hci_con_handle_t con_handle, uint16_t attribute_handle, ui
  */
 int att_server_indicate(hci_con_handle_t con_handle, uint16_t attribute_handle, uint8_t *value, uint16_t value_len);
 
+/*
+ * @brief queue notification of attribute value for several connections
+ * @note the value is copied and sent to the connections in turn as soon as they can send, one value per connection
+ *       at a time. If a notification for the same attribute handle is still queued for a connection, only the new value is sent.
+ *       Up to MAX_ATT_SERVER_FANOUT_VALUES values with up to MAX_ATT_SERVER_FANOUT_VALUE_SIZE bytes can be queued
+ * @param attribute_handle
+ * @param value
+ * @param value_len
+ * @param con_handles list of connections, or NULL for all connections
+ * @param num_con_handles
+ * @return 0 if ok, BTSTACK_MEMORY_ALLOC_FAILED if no value slot free, error otherwise
+ */
+int att_server_notify_connections(uint16_t attribute_handle, const uint8_t * value, uint16_t value_len, const hci_con_handle_t * con_handles, uint16_t num_con_handles);
+
+/*
+ * @brief queue indication of attribute value for several connections
+ * @note as att_server_notify_connections. A connection waits for the confirmation of the previous indication,
+ *       ATT_EVENT_HANDLE_VALUE_INDICATION_COMPLETE is emitted for each connection
+ * @param attribute_handle
+ * @param value
+ * @param value_len
+ * @param con_handles list of connections, or NULL for all connections
+ * @param num_con_handles
+ * @return 0 if ok, BTSTACK_MEMORY_ALLOC_FAILED if no value slot free, error otherwise
+ */
+int att_server_indicate_connections(uint16_t attribute_handle, const uint8_t * value, uint16_t value_len, const hci_con_handle_t * con_handles, uint16_t num_con_handles);
+
+/*
+ * @brief get delivery statistics of queued notifications and indications
+ * @param statistics
+ */
+void att_server_get_fanout_statistics(att_server_fanout_statistics_t * statistics);
+
+/*
+ * @brief reset delivery statistics of queued notifications and indications
+ */
+void att_server_reset_fanout_statistics(void);
+
 /* API_END */
 
 #if defined __cplusplus
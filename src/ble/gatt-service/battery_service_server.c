@@ -42,24 +42,87 @@
  * To use with your application, add '#import <battery_service.gatt' to your .gatt file
  */
 
+#include "btstack_config.h"
 #include "btstack_defines.h"
 #include "ble/att_db.h"
 #include "ble/att_server.h"
+#include "ble/sm.h"
+#include "btstack_event.h"
 #include "btstack_util.h"
 #include "bluetooth_gatt.h"
+#include "hci.h"
 
 #include "ble/gatt-service/battery_service_server.h"
 
-static btstack_context_callback_registration_t  battery_callback;
+// number of connections with individual Client Characteristic Configuration
+#ifndef BATTERY_SERVICE_MAX_CONNECTIONS
+#ifdef MAX_NR_HCI_CONNECTIONS
+#define BATTERY_SERVICE_MAX_CONNECTIONS MAX_NR_HCI_CONNECTIONS
+#else
+#define BATTERY_SERVICE_MAX_CONNECTIONS 4
+#endif
+#endif
+
+// entries of disconnected bonded devices keep their client configuration until the device reconnects
+typedef struct {
+	hci_con_handle_t con_handle;
+	int              le_device_index;
+	uint16_t         client_configuration;
+	uint8_t          notification_pending;
+	// one registration per connection, att_server serves them in order
+	btstack_context_callback_registration_t can_send_now_callback;
+} battery_service_connection_t;
+
+static btstack_packet_callback_registration_t hci_event_callback_registration;
+static btstack_packet_callback_registration_t sm_event_callback_registration;
+static const uint8_t battery_service_hci_events[] = { HCI_EVENT_DISCONNECTION_COMPLETE, 0 };
 static att_service_handler_t       battery_service;
 
 static uint8_t 	battery_value;
-static uint16_t battery_value_client_configuration;
-static hci_con_handle_t battery_value_client_configuration_connection;
+static battery_service_connection_t battery_connections[BATTERY_SERVICE_MAX_CONNECTIONS];
 
 static uint16_t battery_value_handle_value;
 static uint16_t battery_value_handle_client_configuration;
 
+static battery_service_connection_t * battery_service_connection_for_con_handle(hci_con_handle_t con_handle){
+	int i;
+	for (i=0;i<BATTERY_SERVICE_MAX_CONNECTIONS;i++){
+		if (battery_connections[i].con_handle == con_handle) return &battery_connections[i];
+	}
+	return NULL;
+}
+
+static battery_service_connection_t * battery_service_connection_for_le_device_index(int le_device_index){
+	int i;
+	for (i=0;i<BATTERY_SERVICE_MAX_CONNECTIONS;i++){
+		if (battery_connections[i].con_handle != HCI_CON_HANDLE_INVALID) continue;
+		if (battery_connections[i].le_device_index == le_device_index) return &battery_connections[i];
+	}
+	return NULL;
+}
+
+static void battery_service_connection_reset(battery_service_connection_t * connection, hci_con_handle_t con_handle){
+	connection->con_handle = con_handle;
+	connection->le_device_index = -1;
+	connection->client_configuration = 0;
+	connection->notification_pending = 0;
+}
+
+static battery_service_connection_t * battery_service_connection_allocate(hci_con_handle_t con_handle){
+	// use free entry, or drop stored client configuration of a disconnected bonded device
+	battery_service_connection_t * connection = battery_service_connection_for_le_device_index(-1);
+	if (!connection){
+		int i;
+		for (i=0;i<BATTERY_SERVICE_MAX_CONNECTIONS;i++){
+			if (battery_connections[i].con_handle != HCI_CON_HANDLE_INVALID) continue;
+			connection = &battery_connections[i];
+			break;
+		}
+	}
+	if (!connection) return NULL;
+	battery_service_connection_reset(connection, con_handle);
+	return connection;
+}
 
 static uint16_t battery_service_read_callback(hci_con_handle_t con_handle, uint16_t attribute_handle, uint16_t offset, uint8_t * buffer, uint16_t buffer_size){
 	UNUSED(offset);
@@ -73,8 +136,8 @@ static uint16_t battery_service_read_callback(hci_con_handle_t con_handle, uint1
 	}
 	if (attribute_handle == battery_value_handle_client_configuration){
 		if (buffer){
-			little_endian_store_16(buffer, 0, battery_value_client_configuration);
-			battery_value_client_configuration_connection = con_handle;
+			battery_service_connection_t * connection = battery_service_connection_for_con_handle(con_handle);
+			little_endian_store_16(buffer, 0, connection ? connection->client_configuration : 0);
 		}
 		return 2;
 	}
@@ -82,26 +145,91 @@ static uint16_t battery_service_read_callback(hci_con_handle_t con_handle, uint1
 }
 
 static int battery_service_write_callback(hci_con_handle_t con_handle, uint16_t attribute_handle, uint16_t transaction_mode, uint16_t offset, uint8_t *buffer, uint16_t buffer_size){
-	UNUSED(con_handle);
 	UNUSED(transaction_mode);
 	UNUSED(offset);
 	UNUSED(buffer_size);
 
 	if (attribute_handle == battery_value_handle_client_configuration){
-		battery_value_client_configuration = little_endian_read_16(buffer, 0);
+		uint16_t client_configuration = little_endian_read_16(buffer, 0);
+		battery_service_connection_t * connection = battery_service_connection_for_con_handle(con_handle);
+		if (!connection){
+			if (!client_configuration) return 0;
+			connection = battery_service_connection_allocate(con_handle);
+			if (!connection) return ATT_ERROR_INSUFFICIENT_RESOURCES;
+		}
+		connection->client_configuration = client_configuration;
 	}
 	return 0;
 }
 
 static void battery_service_can_send_now(void * context){
 	hci_con_handle_t con_handle = (hci_con_handle_t) (uintptr_t) context;
-	att_server_notify(con_handle, battery_value_handle_value, &battery_value, 1);
+	battery_service_connection_t * connection = battery_service_connection_for_con_handle(con_handle);
+	if (!connection) return;
+	if (!connection->notification_pending) return;
+	if (att_server_notify(con_handle, battery_value_handle_value, &battery_value, 1) == BTSTACK_ACL_BUFFERS_FULL){
+		// try again, other subscribed connections queued before are served first
+		att_server_register_can_send_now_callback(&connection->can_send_now_callback, con_handle);
+		return;
+	}
+	connection->notification_pending = 0;
+}
+
+static void battery_service_hci_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+	UNUSED(channel);
+	UNUSED(size);
+	if (packet_type != HCI_EVENT_PACKET) return;
+	if (hci_event_packet_get_type(packet) != HCI_EVENT_DISCONNECTION_COMPLETE) return;
+	hci_con_handle_t con_handle = hci_event_disconnection_complete_get_connection_handle(packet);
+	battery_service_connection_t * connection = battery_service_connection_for_con_handle(con_handle);
+	if (!connection) return;
+	// keep client configuration of bonded devices, hci connection is still valid here
+	int le_device_index = sm_le_device_index(con_handle);
+	if (le_device_index < 0 || connection->client_configuration == 0){
+		battery_service_connection_reset(connection, HCI_CON_HANDLE_INVALID);
+		return;
+	}
+	connection->con_handle = HCI_CON_HANDLE_INVALID;
+	connection->le_device_index = le_device_index;
+	connection->notification_pending = 0;
+}
+
+static void battery_service_sm_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+	UNUSED(channel);
+	UNUSED(size);
+	if (packet_type != HCI_EVENT_PACKET) return;
+	battery_service_connection_t * connection;
+	hci_con_handle_t con_handle;
+	switch (hci_event_packet_get_type(packet)){
+		case SM_EVENT_IDENTITY_RESOLVING_SUCCEEDED:
+			// bonded device reconnected, restore its client configuration
+			connection = battery_service_connection_for_le_device_index(sm_event_identity_resolving_succeeded_get_index(packet));
+			if (!connection) break;
+			con_handle = sm_event_identity_resolving_succeeded_get_handle(packet);
+			if (battery_service_connection_for_con_handle(con_handle)) break;
+			connection->con_handle = con_handle;
+			break;
+		case SM_EVENT_IDENTITY_CREATED:
+			// new bonding, stored client configuration for this index is outdated
+			connection = battery_service_connection_for_le_device_index(sm_event_identity_created_get_index(packet));
+			if (!connection) break;
+			battery_service_connection_reset(connection, HCI_CON_HANDLE_INVALID);
+			break;
+		default:
+			break;
+	}
 }
 
 void battery_service_server_init(uint8_t value){
 
 	battery_value = value;
 
+	int i;
+	for (i=0;i<BATTERY_SERVICE_MAX_CONNECTIONS;i++){
+		battery_service_connection_reset(&battery_connections[i], HCI_CON_HANDLE_INVALID);
+		battery_connections[i].can_send_now_callback.callback = &battery_service_can_send_now;
+	}
+
 	// get service handle range
 	uint16_t start_handle = 0;
 	uint16_t end_handle   = 0xfff;
@@ -118,13 +246,28 @@ void battery_service_server_init(uint8_t value){
 	battery_service.read_callback  = &battery_service_read_callback;
 	battery_service.write_callback = &battery_service_write_callback;
 	att_server_register_service_handler(&battery_service);
+
+	// forget client configuration on disconnect, unless device is bonded
+	hci_event_callback_registration.callback = &battery_service_hci_event_handler;
+	hci_add_event_handler_for_events(&hci_event_callback_registration, battery_service_hci_events, NULL);
+
+	// restore client configuration when bonded device reconnects
+	sm_event_callback_registration.callback = &battery_service_sm_event_handler;
+	sm_add_event_handler(&sm_event_callback_registration);
 }
 
 void battery_service_server_set_battery_value(uint8_t value){
 	battery_value = value;
-	if (battery_value_client_configuration){
-		battery_callback.callback = &battery_service_can_send_now;
-		battery_callback.context  = (void*) (uintptr_t) battery_value_client_configuration_connection;
-		att_server_register_can_send_now_callback(&battery_callback, battery_value_client_configuration_connection);
+	// queue notification for all subscribed connections. if an earlier value is still pending
+	// for a connection, it gets the current value instead
+	int i;
+	for (i=0;i<BATTERY_SERVICE_MAX_CONNECTIONS;i++){
+		battery_service_connection_t * connection = &battery_connections[i];
+		if (connection->con_handle == HCI_CON_HANDLE_INVALID) continue;
+		if ((connection->client_configuration & GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION) == 0) continue;
+		if (connection->notification_pending) continue;
+		connection->notification_pending = 1;
+		connection->can_send_now_callback.context = (void*) (uintptr_t) connection->con_handle;
+		att_server_register_can_send_now_callback(&connection->can_send_now_callback, connection->con_handle);
 	}
 }
@@ -58,7 +58,11 @@ void battery_service_server_init(uint8_t battery_value);
 
 /**
  * @brief Update battery value
- * @note triggers notifications if subscribed
+ * @note queues a notification for each connection that enabled notifications. Connections are served
+ *       in turn when they can send, a value not yet sent to a connection is replaced by the new one.
+ *       The Client Characteristic Configuration is stored for up to BATTERY_SERVICE_MAX_CONNECTIONS
+ *       connections, default MAX_NR_HCI_CONNECTIONS. It is kept for bonded devices after disconnect
+ *       while the entry is not needed for another connection
  * @param battery_value in range 0-100
  */
 void battery_service_server_set_battery_value(uint8_t battery_value);
@@ -42,39 +42,109 @@
  * To use with your application, add '#import <hids.gatt>' to your .gatt file
  */
 
+#include "btstack_config.h"
 #include "hids_device.h"
 
 #include "ble/att_db.h"
 #include "ble/att_server.h"
+#include "ble/sm.h"
 #include "bluetooth_gatt.h"
+#include "btstack_event.h"
 #include "btstack_util.h"
 #include "btstack_debug.h"
+#include "hci.h"
+
+// number of connections with individual protocol mode and Client Characteristic Configurations
+#ifndef HIDS_DEVICE_MAX_CONNECTIONS
+#ifdef MAX_NR_HCI_CONNECTIONS
+#define HIDS_DEVICE_MAX_CONNECTIONS MAX_NR_HCI_CONNECTIONS
+#else
+#define HIDS_DEVICE_MAX_CONNECTIONS 4
+#endif
+#endif
+
+// entries of disconnected bonded devices keep their client configurations until the device reconnects
+typedef struct {
+    hci_con_handle_t con_handle;
+    int              le_device_index;
+    uint8_t          protocol_mode;
+    uint16_t         boot_mouse_input_client_configuration_value;
+    uint16_t         boot_keyboard_input_client_configuration_value;
+    uint16_t         report_input_client_configuration_value;
+    btstack_context_callback_registration_t can_send_now_callback;
+} hids_device_connection_t;
 
 static btstack_packet_handler_t packet_handler;
-static btstack_context_callback_registration_t  battery_callback;
+static btstack_packet_callback_registration_t hci_event_callback_registration;
+static btstack_packet_callback_registration_t sm_event_callback_registration;
+static const uint8_t hids_device_hci_events[] = { HCI_EVENT_DISCONNECTION_COMPLETE, 0 };
 
 static uint8_t         hid_country_code;
 static const uint8_t * hid_descriptor;
 static uint16_t        hid_descriptor_size;
 
+static hids_device_connection_t hid_connections[HIDS_DEVICE_MAX_CONNECTIONS];
+
 static uint16_t        hid_report_map_handle;
-static uint16_t        hid_protocol_mode;
 static uint16_t        hid_protocol_mode_value_handle;
 
 static uint16_t        hid_boot_mouse_input_value_handle;
 static uint16_t        hid_boot_mouse_input_client_configuration_handle;
-static uint16_t        hid_boot_mouse_input_client_configuration_value;
 
 static uint16_t        hid_boot_keyboard_input_value_handle;
 static uint16_t        hid_boot_keyboard_input_client_configuration_handle;
-static uint16_t        hid_boot_keyboard_input_client_configuration_value;
 
 static uint16_t        hid_report_input_value_handle;
 static uint16_t        hid_report_input_client_configuration_handle;
-static uint16_t        hid_report_input_client_configuration_value;
 
 static att_service_handler_t hid_service;
 
+static hids_device_connection_t * hids_device_connection_for_con_handle(hci_con_handle_t con_handle){
+    int i;
+    for (i=0;i<HIDS_DEVICE_MAX_CONNECTIONS;i++){
+        if (hid_connections[i].con_handle == con_handle) return &hid_connections[i];
+    }
+    return NULL;
+}
+
+static hids_device_connection_t * hids_device_connection_for_le_device_index(int le_device_index){
+    int i;
+    for (i=0;i<HIDS_DEVICE_MAX_CONNECTIONS;i++){
+        if (hid_connections[i].con_handle != HCI_CON_HANDLE_INVALID) continue;
+        if (hid_connections[i].le_device_index == le_device_index) return &hid_connections[i];
+    }
+    return NULL;
+}
+
+static void hids_device_connection_reset(hids_device_connection_t * connection, hci_con_handle_t con_handle){
+    connection->con_handle    = con_handle;
+    connection->le_device_index = -1;
+    // default: Report Protocol Mode
+    connection->protocol_mode = 1;
+    connection->boot_mouse_input_client_configuration_value    = 0;
+    connection->boot_keyboard_input_client_configuration_value = 0;
+    connection->report_input_client_configuration_value        = 0;
+}
+
+static hids_device_connection_t * hids_device_connection_get(hci_con_handle_t con_handle){
+    hids_device_connection_t * connection = hids_device_connection_for_con_handle(con_handle);
+    if (connection) return connection;
+    // use free entry, or drop stored client configurations of a disconnected bonded device
+    connection = hids_device_connection_for_le_device_index(-1);
+    if (!connection){
+        connection = hids_device_connection_for_con_handle(HCI_CON_HANDLE_INVALID);
+    }
+    if (!connection) return NULL;
+    hids_device_connection_reset(connection, con_handle);
+    return connection;
+}
+
+static int hids_device_connection_subscribed(hids_device_connection_t * connection){
+    return connection->boot_mouse_input_client_configuration_value
+        || connection->boot_keyboard_input_client_configuration_value
+        || connection->report_input_client_configuration_value;
+}
+
 static void hids_device_emit_event_with_uint8(uint8_t event, hci_con_handle_t con_handle, uint8_t value){
     if (!packet_handler) return;
     uint8_t buffer[6];
@@ -102,11 +172,11 @@ static void hids_device_can_send_now(void * context){
 // - if buffer == NULL, don't copy data, just return size of value
 // - if buffer != NULL, copy data and return number bytes copied
 static uint16_t att_read_callback(hci_con_handle_t connection_handle, uint16_t att_handle, uint16_t offset, uint8_t * buffer, uint16_t buffer_size){
-    UNUSED(connection_handle);
+    hids_device_connection_t * connection = hids_device_connection_for_con_handle(connection_handle);
 
     if (att_handle == hid_protocol_mode_value_handle){
         log_info("Read protocol mode");
-        return att_read_callback_handle_byte(hid_protocol_mode, offset, buffer, buffer_size);
+        return att_read_callback_handle_byte(connection ? connection->protocol_mode : 1, offset, buffer, buffer_size);
     }
     if (att_handle == hid_report_map_handle){
         log_info("Read report map");
@@ -115,17 +185,17 @@ static uint16_t att_read_callback(hci_con_handle_t connection_handle, uint16_t a
     // if (att_handle == hid_boot_mouse_input_value_handle){
     // }
     if (att_handle == hid_boot_mouse_input_client_configuration_handle){
-        return att_read_callback_handle_little_endian_16(hid_boot_keyboard_input_client_configuration_value, offset, buffer, buffer_size);
+        return att_read_callback_handle_little_endian_16(connection ? connection->boot_mouse_input_client_configuration_value : 0, offset, buffer, buffer_size);
     }
     // if (att_handle == hid_boot_keyboard_input_value_handle){
     // }
     if (att_handle == hid_boot_keyboard_input_client_configuration_handle){
-        return att_read_callback_handle_little_endian_16(hid_boot_keyboard_input_client_configuration_value, offset, buffer, buffer_size);
+        return att_read_callback_handle_little_endian_16(connection ? connection->boot_keyboard_input_client_configuration_value : 0, offset, buffer, buffer_size);
     }
     // if (att_handle == hid_report_input_value_handle){
     // }
     if (att_handle == hid_report_input_client_configuration_handle){
-        return att_read_callback_handle_little_endian_16(hid_report_input_client_configuration_value, offset, buffer, buffer_size);
+        return att_read_callback_handle_little_endian_16(connection ? connection->report_input_client_configuration_value : 0, offset, buffer, buffer_size);
     }
     return 0;
 }
@@ -135,33 +205,93 @@ static int att_write_callback(hci_con_handle_t con_handle, uint16_t att_handle,
     UNUSED(buffer_size);
     UNUSED(offset);
 
+    if ((att_handle != hid_boot_mouse_input_client_configuration_handle)
+    &&  (att_handle != hid_boot_keyboard_input_client_configuration_handle)
+    &&  (att_handle != hid_report_input_client_configuration_handle)
+    &&  (att_handle != hid_protocol_mode_value_handle)) return 0;
+
+    hids_device_connection_t * connection = hids_device_connection_get(con_handle);
+    if (!connection) return ATT_ERROR_INSUFFICIENT_RESOURCES;
+
     if (att_handle == hid_boot_mouse_input_client_configuration_handle){
         uint16_t new_value = little_endian_read_16(buffer, 0);
-        // if (new_value == hid_boot_mouse_input_client_configuration_value) return 0;
-        hid_boot_mouse_input_client_configuration_value = new_value;
-        hids_device_emit_event_with_uint8(HIDS_SUBEVENT_BOOT_MOUSE_INPUT_REPORT_ENABLE, con_handle, hid_protocol_mode);
+        connection->boot_mouse_input_client_configuration_value = new_value;
+        hids_device_emit_event_with_uint8(HIDS_SUBEVENT_BOOT_MOUSE_INPUT_REPORT_ENABLE, con_handle, connection->protocol_mode);
     }
     if (att_handle == hid_boot_keyboard_input_client_configuration_handle){
         uint16_t new_value = little_endian_read_16(buffer, 0);
-        // if (new_value == hid_boot_keyboard_input_client_configuration_value) return 0;
-        hid_boot_keyboard_input_client_configuration_value = new_value;
-        hids_device_emit_event_with_uint8(HIDS_SUBEVENT_BOOT_KEYBOARD_INPUT_REPORT_ENABLE, con_handle, hid_protocol_mode);
+        connection->boot_keyboard_input_client_configuration_value = new_value;
+        hids_device_emit_event_with_uint8(HIDS_SUBEVENT_BOOT_KEYBOARD_INPUT_REPORT_ENABLE, con_handle, connection->protocol_mode);
     }
     if (att_handle == hid_report_input_client_configuration_handle){
         uint16_t new_value = little_endian_read_16(buffer, 0);
-        // if (new_value == hid_report_input_client_configuration_value) return 0;
-        hid_report_input_client_configuration_value = new_value;
+        connection->report_input_client_configuration_value = new_value;
         log_info("Enable Report Input notifications: %x", new_value);
-        hids_device_emit_event_with_uint8(HIDS_SUBEVENT_INPUT_REPORT_ENABLE, con_handle, hid_protocol_mode);
+        hids_device_emit_event_with_uint8(HIDS_SUBEVENT_INPUT_REPORT_ENABLE, con_handle, connection->protocol_mode);
     }
     if (att_handle == hid_protocol_mode_value_handle){
-        hid_protocol_mode = buffer[0];
-        log_info("Set protocol mode: %u", hid_protocol_mode);
-        hids_device_emit_event_with_uint8(HIDS_SUBEVENT_PROTOCOL_MODE, con_handle, hid_protocol_mode);
+        connection->protocol_mode = buffer[0];
+        log_info("Set protocol mode: %u", connection->protocol_mode);
+        hids_device_emit_event_with_uint8(HIDS_SUBEVENT_PROTOCOL_MODE, con_handle, connection->protocol_mode);
     }
     return 0;
 }
 
+static void hids_device_hci_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    UNUSED(channel);
+    UNUSED(size);
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (hci_event_packet_get_type(packet) != HCI_EVENT_DISCONNECTION_COMPLETE) return;
+    hci_con_handle_t con_handle = hci_event_disconnection_complete_get_connection_handle(packet);
+    hids_device_connection_t * connection = hids_device_connection_for_con_handle(con_handle);
+    if (!connection) return;
+    // keep client configurations of bonded devices, hci connection is still valid here
+    int le_device_index = sm_le_device_index(con_handle);
+    if (le_device_index < 0 || !hids_device_connection_subscribed(connection)){
+        hids_device_connection_reset(connection, HCI_CON_HANDLE_INVALID);
+        return;
+    }
+    connection->con_handle      = HCI_CON_HANDLE_INVALID;
+    connection->le_device_index = le_device_index;
+    // Protocol Mode is reset to Report Protocol Mode on reconnect
+    connection->protocol_mode   = 1;
+}
+
+static void hids_device_sm_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    UNUSED(channel);
+    UNUSED(size);
+    if (packet_type != HCI_EVENT_PACKET) return;
+    hids_device_connection_t * connection;
+    hci_con_handle_t con_handle;
+    switch (hci_event_packet_get_type(packet)){
+        case SM_EVENT_IDENTITY_RESOLVING_SUCCEEDED:
+            // bonded device reconnected, restore its client configurations and notify application
+            connection = hids_device_connection_for_le_device_index(sm_event_identity_resolving_succeeded_get_index(packet));
+            if (!connection) break;
+            con_handle = sm_event_identity_resolving_succeeded_get_handle(packet);
+            if (hids_device_connection_for_con_handle(con_handle)) break;
+            connection->con_handle = con_handle;
+            if (connection->boot_mouse_input_client_configuration_value){
+                hids_device_emit_event_with_uint8(HIDS_SUBEVENT_BOOT_MOUSE_INPUT_REPORT_ENABLE, con_handle, connection->protocol_mode);
+            }
+            if (connection->boot_keyboard_input_client_configuration_value){
+                hids_device_emit_event_with_uint8(HIDS_SUBEVENT_BOOT_KEYBOARD_INPUT_REPORT_ENABLE, con_handle, connection->protocol_mode);
+            }
+            if (connection->report_input_client_configuration_value){
+                hids_device_emit_event_with_uint8(HIDS_SUBEVENT_INPUT_REPORT_ENABLE, con_handle, connection->protocol_mode);
+            }
+            break;
+        case SM_EVENT_IDENTITY_CREATED:
+            // new bonding, stored client configurations for this index are outdated
+            connection = hids_device_connection_for_le_device_index(sm_event_identity_created_get_index(packet));
+            if (!connection) break;
+            hids_device_connection_reset(connection, HCI_CON_HANDLE_INVALID);
+            break;
+        default:
+            break;
+    }
+}
+
 /**
  * @brief Set up HIDS Device
  */
@@ -171,8 +301,11 @@ void hids_device_init(uint8_t country_code, const uint8_t * descriptor, uint16_t
     hid_descriptor      = descriptor;
     hid_descriptor_size = descriptor_size;
 
-    // default
-    hid_protocol_mode   = 1;
+    int i;
+    for (i=0;i<HIDS_DEVICE_MAX_CONNECTIONS;i++){
+        hids_device_connection_reset(&hid_connections[i], HCI_CON_HANDLE_INVALID);
+        hid_connections[i].can_send_now_callback.callback = &hids_device_can_send_now;
+    }
 
     // get service handle range
     uint16_t start_handle = 0;
@@ -202,6 +335,14 @@ void hids_device_init(uint8_t country_code, const uint8_t * descriptor, uint16_t
     hid_service.read_callback  = &att_read_callback;
     hid_service.write_callback = &att_write_callback;
     att_server_register_service_handler(&hid_service);
+
+    // forget protocol mode and client configurations on disconnect, unless device is bonded
+    hci_event_callback_registration.callback = &hids_device_hci_event_handler;
+    hci_add_event_handler_for_events(&hci_event_callback_registration, hids_device_hci_events, NULL);
+
+    // restore client configurations when bonded device reconnects
+    sm_event_callback_registration.callback = &hids_device_sm_event_handler;
+    sm_add_event_handler(&sm_event_callback_registration);
 }
 
 /**
@@ -218,9 +359,13 @@ void hids_device_register_packet_handler(btstack_packet_handler_t callback){
  * @param hid_cid
  */
 void hids_device_request_can_send_now_event(hci_con_handle_t con_handle){
-    battery_callback.callback = &hids_device_can_send_now;
-    battery_callback.context  = (void*) (uintptr_t) con_handle;
-    att_server_register_can_send_now_callback(&battery_callback, con_handle);
+    hids_device_connection_t * connection = hids_device_connection_get(con_handle);
+    if (!connection){
+        log_error("hids_device_request_can_send_now_event: no connection context for 0x%04x", con_handle);
+        return;
+    }
+    connection->can_send_now_callback.context = (void*) (uintptr_t) con_handle;
+    att_server_register_can_send_now_callback(&connection->can_send_now_callback, con_handle);
 }
 
 /**
@@ -46,6 +46,10 @@
 
 /**
  * @brief Set up HIDS Device
+ * @note Protocol Mode and Client Characteristic Configurations are stored for up to HIDS_DEVICE_MAX_CONNECTIONS
+ *       connections, default MAX_NR_HCI_CONNECTIONS
+ *       Client Characteristic Configurations of bonded devices are restored on reconnect while the
+ *       entry is not needed for another connection, the enable events are emitted again
  */
 void hids_device_init(uint8_t hid_country_code, const uint8_t * hid_descriptor, uint16_t hid_descriptor_size);
 
@@ -57,7 +61,7 @@ void hids_device_register_packet_handler(btstack_packet_handler_t callback);
 
 /**
  * @brief Request can send now event to send HID Report
- * Generates an HIDS_SUBEVENT_CAN_SEND_NOW subevent
+ * Generates an HIDS_SUBEVENT_CAN_SEND_NOW subevent. Requests for different connections are served in turn
  * @param hid_cid
  */
 void hids_device_request_can_send_now_event(hci_con_handle_t con_handle);
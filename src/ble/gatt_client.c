@@ -65,11 +65,19 @@
 static btstack_linked_list_t gatt_client_connections;
 static btstack_linked_list_t gatt_client_value_listeners;
 static btstack_packet_callback_registration_t hci_event_callback_registration;
+
+// HCI Command Complete also triggers gatt_client_run, e.g. for signed writes waiting for the CMAC engine of the SM
+static const uint8_t gatt_client_hci_events[] = {
+    HCI_EVENT_DISCONNECTION_COMPLETE,
+    HCI_EVENT_COMMAND_COMPLETE,
+    0
+};
 static uint8_t  pts_suppress_mtu_exchange;
 
 static void gatt_client_att_packet_handler(uint8_t packet_type, uint16_t handle, uint8_t *packet, uint16_t size);
 static void gatt_client_hci_event_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
 static void gatt_client_report_error_if_pending(gatt_client_t *peripheral, uint8_t error_code);
+static void gatt_client_run(void);
 
 #ifdef ENABLE_LE_SIGNED_WRITE
 static void att_signed_write_handle_cmac_result(uint8_t hash[8]);
@@ -89,7 +97,7 @@ void gatt_client_init(void){
 
     // regsister for HCI Events
     hci_event_callback_registration.callback = &gatt_client_hci_event_packet_handler;
-    hci_add_event_handler(&hci_event_callback_registration);
+    hci_add_event_handler_for_events(&hci_event_callback_registration, gatt_client_hci_events, NULL);
 
     // and ATT Client PDUs
     att_dispatch_register_client(gatt_client_att_packet_handler);
@@ -723,6 +731,182 @@ static void report_gatt_all_characteristic_descriptors(gatt_client_t * periphera
     
 }
 
+// queued requests
+
+// request has been put back into the queue after a failed Read Multiple Request
+#define GATT_CLIENT_REQUEST_FLAG_NO_BATCH 1
+
+static void emit_gatt_request_complete_event(gatt_client_request_t * request, uint8_t status){
+    // @format H1
+    uint8_t packet[5];
+    packet[0] = GATT_EVENT_QUERY_COMPLETE;
+    packet[1] = 3;
+    little_endian_store_16(packet, 2, request->con_handle);
+    packet[4] = status;
+    emit_event_new(request->callback, packet, sizeof(packet));
+}
+
+static int gatt_client_request_is_queued(gatt_client_request_t * request){
+    btstack_linked_item_t *it;
+    for (it = (btstack_linked_item_t *) gatt_client_connections; it ; it = it->next){
+        gatt_client_t * peripheral = (gatt_client_t *) it;
+        btstack_linked_item_t *request_it;
+        for (request_it = peripheral->request_queue; request_it ; request_it = request_it->next){
+            if (request_it == (btstack_linked_item_t *) request) return 1;
+        }
+        for (request_it = peripheral->request_batch; request_it ; request_it = request_it->next){
+            if (request_it == (btstack_linked_item_t *) request) return 1;
+        }
+    }
+    return 0;
+}
+
+// keep queue sorted by priority, insert behind (or ahead of) requests with same priority
+static void gatt_client_request_insert(gatt_client_t * peripheral, gatt_client_request_t * request, int ahead_of_same_priority){
+    btstack_linked_item_t *it;
+    for (it = (btstack_linked_item_t *) &peripheral->request_queue; it->next ; it = it->next){
+        gatt_client_request_t * queued = (gatt_client_request_t *) it->next;
+        if (queued->priority < request->priority) break;
+        if (ahead_of_same_priority && queued->priority == request->priority) break;
+    }
+    request->item.next = it->next;
+    it->next = (btstack_linked_item_t *) request;
+}
+
+static int gatt_client_request_can_be_batched(gatt_client_request_t * request){
+    if (request->type != GATT_CLIENT_REQUEST_READ_VALUE) return 0;
+    if (request->value_length == 0) return 0;
+    return (request->flags & GATT_CLIENT_REQUEST_FLAG_NO_BATCH) == 0;
+}
+
+// set up gatt client for next queued request, reads of known size are combined into a Read Multiple Request
+static void gatt_client_request_start_next(gatt_client_t * peripheral){
+    gatt_client_request_t * request = (gatt_client_request_t *) btstack_linked_list_pop(&peripheral->request_queue);
+    gatt_client_timeout_start(peripheral);
+    peripheral->callback = request->callback;
+    peripheral->attribute_handle = request->value_handle;
+
+    if (request->type == GATT_CLIENT_REQUEST_WRITE_VALUE){
+        peripheral->attribute_length = request->value_length;
+        peripheral->attribute_value = request->value;
+        peripheral->gatt_client_state = P_W2_SEND_WRITE_CHARACTERISTIC_VALUE;
+        return;
+    }
+
+    peripheral->attribute_offset = 0;
+    peripheral->gatt_client_state = P_W2_SEND_READ_CHARACTERISTIC_VALUE_QUERY;
+    if (!gatt_client_request_can_be_batched(request)) return;
+
+    // values are concatenated in Read Multiple Response and need to fit into a single PDU
+    uint16_t mtu = peripheral_mtu(peripheral);
+    uint16_t max_handles = btstack_min(MAX_GATT_CLIENT_READ_MULTIPLE_HANDLES, (mtu - 1) / 2);
+    uint16_t response_len = 1 + request->value_length;
+    uint16_t num_handles = 1;
+    peripheral->request_batch_handles[0] = request->value_handle;
+    btstack_linked_list_add_tail(&peripheral->request_batch, (btstack_linked_item_t *) request);
+    while (num_handles < max_handles){
+        gatt_client_request_t * next = (gatt_client_request_t *) peripheral->request_queue;
+        if (!next) break;
+        if (!gatt_client_request_can_be_batched(next)) break;
+        if (response_len + next->value_length > mtu) break;
+        btstack_linked_list_pop(&peripheral->request_queue);
+        btstack_linked_list_add_tail(&peripheral->request_batch, (btstack_linked_item_t *) next);
+        peripheral->request_batch_handles[num_handles++] = next->value_handle;
+        response_len += next->value_length;
+    }
+
+    // single read, request not needed anymore
+    if (num_handles == 1){
+        peripheral->request_batch = NULL;
+        return;
+    }
+
+    peripheral->read_multiple_handle_count = num_handles;
+    peripheral->read_multiple_handles = peripheral->request_batch_handles;
+    peripheral->gatt_client_state = P_W2_SEND_READ_MULTIPLE_REQUEST;
+}
+
+// put batched requests back into queue to get read one by one
+static void gatt_client_request_batch_requeue(gatt_client_t * peripheral){
+    while (peripheral->request_batch){
+        gatt_client_request_t * request = (gatt_client_request_t *) btstack_linked_list_get_last_item(&peripheral->request_batch);
+        btstack_linked_list_remove(&peripheral->request_batch, (btstack_linked_item_t *) request);
+        request->flags |= GATT_CLIENT_REQUEST_FLAG_NO_BATCH;
+        gatt_client_request_insert(peripheral, request, 1);
+    }
+}
+
+// @note assume that values are part of an l2cap buffer - overwrite parts of the HCI/L2CAP/ATT packet and of already reported values
+static void gatt_client_request_batch_complete(gatt_client_t * peripheral, uint8_t * values, uint16_t values_len){
+    gatt_client_handle_transaction_complete(peripheral);
+
+    // values are not delimited, so all values need to have the expected size
+    uint16_t expected_len = 0;
+    btstack_linked_item_t *it;
+    for (it = peripheral->request_batch; it ; it = it->next){
+        expected_len += ((gatt_client_request_t *) it)->value_length;
+    }
+    if (expected_len != values_len){
+        log_info("GATT Client: Read Multiple Response len %u != %u, read values one by one", values_len, expected_len);
+        gatt_client_request_batch_requeue(peripheral);
+        return;
+    }
+
+    // requests can be queued again from callback
+    btstack_linked_list_t batch = peripheral->request_batch;
+    peripheral->request_batch = NULL;
+    uint16_t offset = 0;
+    while (batch){
+        gatt_client_request_t * request = (gatt_client_request_t *) btstack_linked_list_pop(&batch);
+        uint8_t * packet = setup_characteristic_value_packet(GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT, peripheral->con_handle, request->value_handle, &values[offset], request->value_length);
+        offset += request->value_length;
+        emit_event_new(request->callback, packet, characteristic_value_event_header_size + request->value_length);
+        emit_gatt_request_complete_event(request, 0);
+    }
+}
+
+static void gatt_client_request_batch_failed(gatt_client_t * peripheral, uint8_t error_code){
+    switch (error_code){
+        case ATT_ERROR_TIMEOUT:
+        case ATT_ERROR_HCI_DISCONNECT_RECEIVED:
+            break;
+        default:
+            // error refers to one of the handles, get individual result for each request
+            gatt_client_request_batch_requeue(peripheral);
+            return;
+    }
+    btstack_linked_list_t batch = peripheral->request_batch;
+    peripheral->request_batch = NULL;
+    while (batch){
+        emit_gatt_request_complete_event((gatt_client_request_t *) btstack_linked_list_pop(&batch), error_code);
+    }
+}
+
+static void gatt_client_request_queue_flush(gatt_client_t * peripheral, uint8_t error_code){
+    while (peripheral->request_queue){
+        emit_gatt_request_complete_event((gatt_client_request_t *) btstack_linked_list_pop(&peripheral->request_queue), error_code);
+    }
+}
+
+static uint8_t gatt_client_queue_request(gatt_client_request_t * request, btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint8_t type, uint16_t value_handle, uint16_t value_length, uint8_t * value, uint8_t priority){
+    gatt_client_t * peripheral = provide_context_for_conn_handle(con_handle);
+
+    if (!peripheral) return BTSTACK_MEMORY_ALLOC_FAILED;
+    if (gatt_client_request_is_queued(request)) return GATT_CLIENT_IN_WRONG_STATE;
+
+    request->callback = callback;
+    request->con_handle = con_handle;
+    request->type = type;
+    request->priority = priority;
+    request->flags = 0;
+    request->value_handle = value_handle;
+    request->value_length = value_length;
+    request->value = value;
+    gatt_client_request_insert(peripheral, request, 0);
+    gatt_client_run();
+    return 0;
+}
+
 static int is_query_done(gatt_client_t * peripheral, uint16_t last_result_handle){
     return last_result_handle >= peripheral->end_group_handle;
 }
@@ -833,6 +1017,11 @@ static void gatt_client_run(void){
             return;
         }
         
+        // start next queued request
+        if (is_ready(peripheral) && peripheral->request_queue){
+            gatt_client_request_start_next(peripheral);
+        }
+
         // check MTU for writes
         switch (peripheral->gatt_client_state){
             case P_W2_SEND_WRITE_CHARACTERISTIC_VALUE:
@@ -1008,6 +1197,10 @@ static void gatt_client_run(void){
 static void gatt_client_report_error_if_pending(gatt_client_t *peripheral, uint8_t error_code) {
     if (is_ready(peripheral)) return;
     gatt_client_handle_transaction_complete(peripheral);
+    if (peripheral->request_batch){
+        gatt_client_request_batch_failed(peripheral, error_code);
+        return;
+    }
     emit_gatt_complete_event(peripheral, error_code);
 }
 
@@ -1025,6 +1218,7 @@ static void gatt_client_hci_event_packet_handler(uint8_t packet_type, uint16_t c
             gatt_client_t * peripheral = get_gatt_client_context_for_handle(con_handle);
             if (!peripheral) break;
             gatt_client_report_error_if_pending(peripheral, ATT_ERROR_HCI_DISCONNECT_RECEIVED);
+            gatt_client_request_queue_flush(peripheral, ATT_ERROR_HCI_DISCONNECT_RECEIVED);
             
             btstack_linked_list_remove(&gatt_client_connections, (btstack_linked_item_t *) peripheral);
             btstack_memory_gatt_client_free(peripheral);
@@ -1307,6 +1501,10 @@ static void gatt_client_att_packet_handler(uint8_t packet_type, uint16_t handle,
         case ATT_READ_MULTIPLE_RESPONSE:
             switch(peripheral->gatt_client_state){
                 case P_W4_READ_MULTIPLE_RESPONSE:
+                    if (peripheral->request_batch){
+                        gatt_client_request_batch_complete(peripheral, &packet[1], size-1);
+                        break;
+                    }
                     report_gatt_characteristic_value(peripheral, 0, &packet[1], size-1);
                     gatt_client_handle_transaction_complete(peripheral);
                     emit_gatt_complete_event(peripheral, 0);
@@ -1630,6 +1828,21 @@ uint8_t gatt_client_read_multiple_characteristic_values(btstack_packet_handler_t
     return 0;
 }
 
+uint8_t gatt_client_queue_read_value_of_characteristic_using_value_handle(gatt_client_request_t * request, btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t value_handle, uint16_t value_length, uint8_t priority){
+    return gatt_client_queue_request(request, callback, con_handle, GATT_CLIENT_REQUEST_READ_VALUE, value_handle, value_length, NULL, priority);
+}
+
+uint8_t gatt_client_queue_write_value_of_characteristic(gatt_client_request_t * request, btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t value_handle, uint16_t value_length, uint8_t * value, uint8_t priority){
+    return gatt_client_queue_request(request, callback, con_handle, GATT_CLIENT_REQUEST_WRITE_VALUE, value_handle, value_length, value, priority);
+}
+
+uint8_t gatt_client_cancel_request(gatt_client_request_t * request){
+    gatt_client_t * peripheral = get_gatt_client_context_for_handle(request->con_handle);
+    if (!peripheral) return GATT_CLIENT_IN_WRONG_STATE;
+    if (btstack_linked_list_remove(&peripheral->request_queue, (btstack_linked_item_t *) request) != 0) return GATT_CLIENT_IN_WRONG_STATE;
+    return 0;
+}
+
 uint8_t gatt_client_write_value_of_characteristic_without_response(hci_con_handle_t con_handle, uint16_t value_handle, uint16_t value_length, uint8_t * value){
     gatt_client_t * peripheral = provide_context_for_conn_handle(con_handle);
     
@@ -45,6 +45,11 @@
 extern "C" {
 #endif
 
+// max number of queued reads combined into a single ATT Read Multiple Request
+#ifndef MAX_GATT_CLIENT_READ_MULTIPLE_HANDLES
+#define MAX_GATT_CLIENT_READ_MULTIPLE_HANDLES 8
+#endif
+
 typedef enum {
     P_READY,
     P_W2_SEND_SERVICE_QUERY,
@@ -165,6 +170,11 @@ typedef struct gatt_client{
     uint16_t    read_multiple_handle_count;
     uint16_t  * read_multiple_handles;
 
+    // queued requests sorted by priority, and queued reads combined into current Read Multiple Request
+    btstack_linked_list_t request_queue;
+    btstack_linked_list_t request_batch;
+    uint16_t request_batch_handles[MAX_GATT_CLIENT_READ_MULTIPLE_HANDLES];
+
     uint16_t client_characteristic_configuration_handle;
     uint8_t  client_characteristic_configuration_value[2];
     
@@ -184,6 +194,23 @@ typedef struct gatt_client_notification {
     uint16_t attribute_handle;
 } gatt_client_notification_t;
 
+typedef enum {
+    GATT_CLIENT_REQUEST_READ_VALUE,
+    GATT_CLIENT_REQUEST_WRITE_VALUE,
+} gatt_client_request_type_t;
+
+typedef struct gatt_client_request {
+    btstack_linked_item_t    item;
+    btstack_packet_handler_t callback;
+    hci_con_handle_t con_handle;
+    uint8_t  type;
+    uint8_t  priority;
+    uint8_t  flags;
+    uint16_t value_handle;
+    uint16_t value_length;
+    uint8_t * value;
+} gatt_client_request_t;
+
 /* API_START */
 
 typedef struct {
@@ -362,6 +389,41 @@ uint8_t gatt_client_execute_write(btstack_packet_handler_t callback, hci_con_han
  */
 uint8_t gatt_client_cancel_write(btstack_packet_handler_t callback, hci_con_handle_t con_handle);
 
+/**
+ * @brief Queues a read of a characteristic value using its value handle. Queued requests are started as soon as the
+ *        GATT Client for con_handle is ready, higher priority first, in order of arrival for same priority. Consecutive
+ *        queued reads with known value length are combined into a single ATT Read Multiple Request. Each request gets
+ *        its own GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT and GATT_EVENT_QUERY_COMPLETE.
+ * @param request struct used to store request, must stay valid until GATT_EVENT_QUERY_COMPLETE
+ * @param callback
+ * @param con_handle
+ * @param value_handle
+ * @param value_length of fixed size value or 0 if unknown. Reads with unknown length are not combined
+ * @param priority
+ * @return status 0 if ok, BTSTACK_MEMORY_ALLOC_FAILED if no GATT Client available, GATT_CLIENT_IN_WRONG_STATE if request already queued
+ */
+uint8_t gatt_client_queue_read_value_of_characteristic_using_value_handle(gatt_client_request_t * request, btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t value_handle, uint16_t value_length, uint8_t priority);
+
+/**
+ * @brief Queues a write of a characteristic value using its value handle. See gatt_client_queue_read_value_of_characteristic_using_value_handle
+ * @param request struct used to store request, must stay valid until GATT_EVENT_QUERY_COMPLETE
+ * @param callback
+ * @param con_handle
+ * @param value_handle
+ * @param value_length
+ * @param value must stay valid until GATT_EVENT_QUERY_COMPLETE
+ * @param priority
+ * @return status 0 if ok, BTSTACK_MEMORY_ALLOC_FAILED if no GATT Client available, GATT_CLIENT_IN_WRONG_STATE if request already queued
+ */
+uint8_t gatt_client_queue_write_value_of_characteristic(gatt_client_request_t * request, btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t value_handle, uint16_t value_length, uint8_t * value, uint8_t priority);
+
+/**
+ * @brief Removes a queued request that has not been started yet. No events are emitted for it.
+ * @param request
+ * @return status 0 if ok, GATT_CLIENT_IN_WRONG_STATE if request is not queued or already in progress
+ */
+uint8_t gatt_client_cancel_request(gatt_client_request_t * request);
+
 /* API_END */
 
 // used by generated btstack_event.c
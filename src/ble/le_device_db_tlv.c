@@ -45,10 +45,32 @@
 #include <stdio.h>
 #include <string.h>
 #include "btstack_debug.h"
+#ifdef ENABLE_LE_SIGNED_WRITE
+#include "btstack_event.h"
+#include "btstack_run_loop.h"
+#include "hci.h"
+#endif
 
 // LE Device DB Implementation storing entries in btstack_tlv
 
-// Local cache is used to keep track of deleted entries in TLV
+// All entries are cached in RAM. Pairing information is written through to TLV, while signing
+// counter and CSRK updates only mark the entry dirty. Dirty entries are written on disconnect,
+// after LE_DEVICE_DB_TLV_FLUSH_INTERVAL_MS, or with le_device_db_tlv_flush().
+//
+// The local signing counter must never be reused. TLV stores an upper bound for it that is
+// raised by LE_DEVICE_DB_TLV_COUNTER_RESERVE whenever the counter reaches it. After a reset,
+// the counter continues at the stored bound, skipping the unused part of the range.
+//
+// The remote signing counter can't be reserved ahead, as that would reject valid writes from
+// the peer. After a crash, it falls back to the last flushed value.
+
+#ifndef LE_DEVICE_DB_TLV_FLUSH_INTERVAL_MS
+#define LE_DEVICE_DB_TLV_FLUSH_INTERVAL_MS 10000
+#endif
+
+#ifndef LE_DEVICE_DB_TLV_COUNTER_RESERVE
+#define LE_DEVICE_DB_TLV_COUNTER_RESERVE 64
+#endif
 
 #define INVALID_ENTRY_ADDR_TYPE 0xff
 
@@ -96,6 +118,23 @@ typedef struct le_device_db_entry_t {
 static uint8_t  entry_map[NVM_NUM_DEVICE_DB_ENTRIES];
 static uint32_t num_valid_entries;
 
+// cached entries
+static le_device_db_entry_t entries[NVM_NUM_DEVICE_DB_ENTRIES];
+
+#ifdef ENABLE_LE_SIGNED_WRITE
+// entries with updates not written to TLV yet
+static uint8_t  entry_dirty[NVM_NUM_DEVICE_DB_ENTRIES];
+static uint32_t num_dirty_entries;
+
+// local counter value stored in TLV
+static uint32_t local_counter_reserved[NVM_NUM_DEVICE_DB_ENTRIES];
+
+static btstack_timer_source_t le_device_db_tlv_flush_timer;
+static int le_device_db_tlv_flush_timer_active;
+static btstack_packet_callback_registration_t le_device_db_tlv_hci_event_callback_registration;
+static const uint8_t le_device_db_tlv_hci_events[] = { HCI_EVENT_DISCONNECTION_COMPLETE, 0 };
+#endif
+
 static const btstack_tlv_t * le_device_db_tlv_btstack_tlv_impl;
 static       void *          le_device_db_tlv_btstack_tlv_context;
 
@@ -121,11 +160,22 @@ static int le_device_db_tlv_fetch(int index, le_device_db_entry_t * entry){
 
 // @returns success
 // @param index = entry_pos
-static int le_device_db_tlv_store(int index, le_device_db_entry_t * entry){
+static int le_device_db_tlv_store(int index){
     if (index < 0 || index >= NVM_NUM_DEVICE_DB_ENTRIES){
 	    log_error("le_device_db_tlv_store called with invalid index %d", index);
 	    return 0;
 	}
+    le_device_db_entry_t * entry = &entries[index];
+#ifdef ENABLE_LE_SIGNED_WRITE
+    // store reserved local counter
+    le_device_db_entry_t stored_entry = *entry;
+    stored_entry.local_counter = local_counter_reserved[index];
+    entry = &stored_entry;
+    if (entry_dirty[index]){
+        entry_dirty[index] = 0;
+        num_dirty_entries--;
+    }
+#endif
     uint32_t tag = le_device_db_tlv_tag_for_index(index);
     le_device_db_tlv_btstack_tlv_impl->store_tag(le_device_db_tlv_btstack_tlv_context, tag, (uint8_t*) entry, sizeof(le_device_db_entry_t));
 	return 1;
@@ -137,20 +187,69 @@ static int le_device_db_tlv_delete(int index){
 	    log_error("le_device_db_tlv_delete called with invalid index %d", index);
 	    return 0;
 	}
+#ifdef ENABLE_LE_SIGNED_WRITE
+    if (entry_dirty[index]){
+        entry_dirty[index] = 0;
+        num_dirty_entries--;
+    }
+#endif
     uint32_t tag = le_device_db_tlv_tag_for_index(index);
     le_device_db_tlv_btstack_tlv_impl->delete_tag(le_device_db_tlv_btstack_tlv_context, tag);
 	return 1;
 }
 
+// @returns cached entry or NULL if not valid
+static le_device_db_entry_t * le_device_db_tlv_entry(int index){
+    if (index < 0 || index >= NVM_NUM_DEVICE_DB_ENTRIES) return NULL;
+    if (!entry_map[index]) return NULL;
+    return &entries[index];
+}
+
+#ifdef ENABLE_LE_SIGNED_WRITE
+
+static void le_device_db_tlv_flush_timer_handler(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    le_device_db_tlv_flush_timer_active = 0;
+    le_device_db_tlv_flush();
+}
+
+static void le_device_db_tlv_mark_dirty(int index){
+    if (entry_dirty[index]) return;
+    entry_dirty[index] = 1;
+    num_dirty_entries++;
+    if (le_device_db_tlv_flush_timer_active) return;
+    btstack_run_loop_set_timer_handler(&le_device_db_tlv_flush_timer, &le_device_db_tlv_flush_timer_handler);
+    btstack_run_loop_set_timer(&le_device_db_tlv_flush_timer, LE_DEVICE_DB_TLV_FLUSH_INTERVAL_MS);
+    btstack_run_loop_add_timer(&le_device_db_tlv_flush_timer);
+    le_device_db_tlv_flush_timer_active = 1;
+}
+
+static void le_device_db_tlv_hci_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    UNUSED(channel);
+    UNUSED(size);
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (hci_event_packet_get_type(packet) != HCI_EVENT_DISCONNECTION_COMPLETE) return;
+    le_device_db_tlv_flush();
+}
+
+#endif
+
 static void le_device_db_tlv_scan(void){
     int i;
     num_valid_entries = 0;
     memset(entry_map, 0, sizeof(entry_map));
+#ifdef ENABLE_LE_SIGNED_WRITE
+    memset(entry_dirty, 0, sizeof(entry_dirty));
+    num_dirty_entries = 0;
+#endif
     for (i=0;i<NVM_NUM_DEVICE_DB_ENTRIES;i++){
         // lookup entry
-        le_device_db_entry_t entry;
-        if (!le_device_db_tlv_fetch(i, &entry)) continue;
+        if (!le_device_db_tlv_fetch(i, &entries[i])) continue;
 
+#ifdef ENABLE_LE_SIGNED_WRITE
+        // continue after reserved range
+        local_counter_reserved[i] = entries[i].local_counter;
+#endif
         entry_map[i] = 1;
         num_valid_entries++;
     }
@@ -193,20 +292,19 @@ int le_device_db_add(int addr_type, bd_addr_t addr, sm_key_t irk){
     int i;
     for (i=0;i<NVM_NUM_DEVICE_DB_ENTRIES;i++){
          if (entry_map[i]) {
-            le_device_db_entry_t entry;
-            le_device_db_tlv_fetch(i, &entry);
+            le_device_db_entry_t * entry = &entries[i];
             // found addr?
-            if ((memcmp(addr, entry.addr, 6) == 0) && addr_type == entry.addr_type){
+            if ((memcmp(addr, entry->addr, 6) == 0) && addr_type == entry->addr_type){
                 index_for_addr = i;
             }
             // update highest seq nr
-            if (entry.seq_nr > highest_seq_nr){
-                highest_seq_nr = entry.seq_nr;
+            if (entry->seq_nr > highest_seq_nr){
+                highest_seq_nr = entry->seq_nr;
             }
             // find entry with lowest seq nr
-            if ((index_for_lowest_seq_nr == 0) || (entry.seq_nr < lowest_seq_nr)){
+            if ((index_for_lowest_seq_nr == 0) || (entry->seq_nr < lowest_seq_nr)){
                 index_for_lowest_seq_nr = i;
-                lowest_seq_nr = entry.seq_nr;
+                lowest_seq_nr = entry->seq_nr;
             }
         } else {
             index_for_empty = i;
@@ -230,21 +328,22 @@ int le_device_db_add(int addr_type, bd_addr_t addr, sm_key_t irk){
     log_info("new entry for index %u", index_to_use);
 
     // store entry at index
-	le_device_db_entry_t entry;
+	le_device_db_entry_t * entry = &entries[index_to_use];
     log_info("LE Device DB adding type %u - %s", addr_type, bd_addr_to_str(addr));
     log_info_key("irk", irk);
 
-    memset(&entry, 0, sizeof(le_device_db_entry_t));
+    memset(entry, 0, sizeof(le_device_db_entry_t));
 
-    entry.addr_type = addr_type;
-    memcpy(entry.addr, addr, 6);
-    memcpy(entry.irk, irk, 16);
+    entry->addr_type = addr_type;
+    memcpy(entry->addr, addr, 6);
+    memcpy(entry->irk, irk, 16);
 #ifdef ENABLE_LE_SIGNED_WRITE
-    entry.remote_counter = 0; 
+    entry->remote_counter = 0; 
+    local_counter_reserved[index_to_use] = 0;
 #endif
 
     // store
-    le_device_db_tlv_store(index_to_use, &entry);
+    le_device_db_tlv_store(index_to_use);
     
     // set in entry_mape
     entry_map[index_to_use] = 1;
@@ -261,53 +360,50 @@ int le_device_db_add(int addr_type, bd_addr_t addr, sm_key_t irk){
 // get device information: addr type and address
 void le_device_db_info(int index, int * addr_type, bd_addr_t addr, sm_key_t irk){
 
-	// fetch entry
-	le_device_db_entry_t entry;
-	int ok = le_device_db_tlv_fetch(index, &entry);
-	if (!ok) return;
+	// get entry
+	le_device_db_entry_t * entry = le_device_db_tlv_entry(index);
+	if (!entry) return;
 
-    if (addr_type) *addr_type = entry.addr_type;
-    if (addr) memcpy(addr, entry.addr, 6);
-    if (irk) memcpy(irk, entry.irk, 16);
+    if (addr_type) *addr_type = entry->addr_type;
+    if (addr) memcpy(addr, entry->addr, 6);
+    if (irk) memcpy(irk, entry->irk, 16);
 }
 
 void le_device_db_encryption_set(int index, uint16_t ediv, uint8_t rand[8], sm_key_t ltk, int key_size, int authenticated, int authorized){
 
-	// fetch entry
-	le_device_db_entry_t entry;
-	int ok = le_device_db_tlv_fetch(index, &entry);
-	if (!ok) return;
+	// get entry
+	le_device_db_entry_t * entry = le_device_db_tlv_entry(index);
+	if (!entry) return;
 
 	// update
     log_info("LE Device DB set encryption for %u, ediv x%04x, key size %u, authenticated %u, authorized %u",
         index, ediv, key_size, authenticated, authorized);
-    entry.ediv = ediv;
-    if (rand) memcpy(entry.rand, rand, 8);
-    if (ltk) memcpy(entry.ltk, ltk, 16);
-    entry.key_size = key_size;
-    entry.authenticated = authenticated;
-    entry.authorized = authorized;
-
-    // store
-    le_device_db_tlv_store(index, &entry);
+    entry->ediv = ediv;
+    if (rand) memcpy(entry->rand, rand, 8);
+    if (ltk) memcpy(entry->ltk, ltk, 16);
+    entry->key_size = key_size;
+    entry->authenticated = authenticated;
+    entry->authorized = authorized;
+
+    // store, includes pending updates
+    le_device_db_tlv_store(index);
 }
 
 void le_device_db_encryption_get(int index, uint16_t * ediv, uint8_t rand[8], sm_key_t ltk, int * key_size, int * authenticated, int * authorized){
 
-	// fetch entry
-	le_device_db_entry_t entry;
-	int ok = le_device_db_tlv_fetch(index, &entry);
-	if (!ok) return;
+	// get entry
+	le_device_db_entry_t * entry = le_device_db_tlv_entry(index);
+	if (!entry) return;
 
 	// update user fields
     log_info("LE Device DB encryption for %u, ediv x%04x, keysize %u, authenticated %u, authorized %u",
-        index, entry.ediv, entry.key_size, entry.authenticated, entry.authorized);
-    if (ediv) *ediv = entry.ediv;
-    if (rand) memcpy(rand, entry.rand, 8);
-    if (ltk)  memcpy(ltk, entry.ltk, 16);    
-    if (key_size) *key_size = entry.key_size;
-    if (authenticated) *authenticated = entry.authenticated;
-    if (authorized) *authorized = entry.authorized;
+        index, entry->ediv, entry->key_size, entry->authenticated, entry->authorized);
+    if (ediv) *ediv = entry->ediv;
+    if (rand) memcpy(rand, entry->rand, 8);
+    if (ltk)  memcpy(ltk, entry->ltk, 16);    
+    if (key_size) *key_size = entry->key_size;
+    if (authenticated) *authenticated = entry->authenticated;
+    if (authorized) *authorized = entry->authorized;
 }
 
 #ifdef ENABLE_LE_SIGNED_WRITE
@@ -315,132 +411,159 @@ void le_device_db_encryption_get(int index, uint16_t * ediv, uint8_t rand[8], sm
 // get signature key
 void le_device_db_remote_csrk_get(int index, sm_key_t csrk){
 
-	// fetch entry
-	le_device_db_entry_t entry;
-	int ok = le_device_db_tlv_fetch(index, &entry);
-	if (!ok) return;
+	// get entry
+	le_device_db_entry_t * entry = le_device_db_tlv_entry(index);
+	if (!entry) return;
 
-    if (csrk) memcpy(csrk, entry.remote_csrk, 16);
+    if (csrk) memcpy(csrk, entry->remote_csrk, 16);
 }
 
 void le_device_db_remote_csrk_set(int index, sm_key_t csrk){
 
-	// fetch entry
-	le_device_db_entry_t entry;
-	int ok = le_device_db_tlv_fetch(index, &entry);
-	if (!ok) return;
+	// get entry
+	le_device_db_entry_t * entry = le_device_db_tlv_entry(index);
+	if (!entry) return;
 
     if (!csrk) return;
+    if (memcmp(entry->remote_csrk, csrk, 16) == 0) return;
 
     // update
-    memcpy(entry.remote_csrk, csrk, 16);
+    memcpy(entry->remote_csrk, csrk, 16);
 
-    // store
-    le_device_db_tlv_store(index, &entry);
+    le_device_db_tlv_mark_dirty(index);
 }
 
 void le_device_db_local_csrk_get(int index, sm_key_t csrk){
 
-	// fetch entry
-	le_device_db_entry_t entry;
-	int ok = le_device_db_tlv_fetch(index, &entry);
-	if (!ok) return;
+	// get entry
+	le_device_db_entry_t * entry = le_device_db_tlv_entry(index);
+	if (!entry) return;
 
     if (!csrk) return;
 
     // fill
-    memcpy(csrk, entry.local_csrk, 16);
+    memcpy(csrk, entry->local_csrk, 16);
 }
 
 void le_device_db_local_csrk_set(int index, sm_key_t csrk){
 
-	// fetch entry
-	le_device_db_entry_t entry;
-	int ok = le_device_db_tlv_fetch(index, &entry);
-	if (!ok) return;
+	// get entry
+	le_device_db_entry_t * entry = le_device_db_tlv_entry(index);
+	if (!entry) return;
 
     if (!csrk) return;
+    if (memcmp(entry->local_csrk, csrk, 16) == 0) return;
 
     // update
-    memcpy(entry.local_csrk, csrk, 16);
+    memcpy(entry->local_csrk, csrk, 16);
 
-    // store
-    le_device_db_tlv_store(index, &entry);
+    le_device_db_tlv_mark_dirty(index);
 }
 
 // query last used/seen signing counter
 uint32_t le_device_db_remote_counter_get(int index){
 
-	// fetch entry
-	le_device_db_entry_t entry;
-	int ok = le_device_db_tlv_fetch(index, &entry);
-	if (!ok) return 0;
+	// get entry
+	le_device_db_entry_t * entry = le_device_db_tlv_entry(index);
+	if (!entry) return 0;
 
-    return entry.remote_counter;
+    return entry->remote_counter;
 }
 
 // update signing counter
 void le_device_db_remote_counter_set(int index, uint32_t counter){
 
-	// fetch entry
-	le_device_db_entry_t entry;
-	int ok = le_device_db_tlv_fetch(index, &entry);
-	if (!ok) return;
+	// get entry
+	le_device_db_entry_t * entry = le_device_db_tlv_entry(index);
+	if (!entry) return;
 
-    entry.remote_counter = counter;
+    if (entry->remote_counter == counter) return;
 
-    // store
-    le_device_db_tlv_store(index, &entry);
+    entry->remote_counter = counter;
+
+    le_device_db_tlv_mark_dirty(index);
 }
 
 // query last used/seen signing counter
 uint32_t le_device_db_local_counter_get(int index){
 
-	// fetch entry
-	le_device_db_entry_t entry;
-	int ok = le_device_db_tlv_fetch(index, &entry);
-	if (!ok) return 0;
+	// get entry
+	le_device_db_entry_t * entry = le_device_db_tlv_entry(index);
+	if (!entry) return 0;
 
-    return entry.local_counter;
+    return entry->local_counter;
 }
 
 // update signing counter
 void le_device_db_local_counter_set(int index, uint32_t counter){
 
-	// fetch entry
-	le_device_db_entry_t entry;
-	int ok = le_device_db_tlv_fetch(index, &entry);
-	if (!ok) return;
+	// get entry
+	le_device_db_entry_t * entry = le_device_db_tlv_entry(index);
+	if (!entry) return;
+
+    // reset, e.g. after new pairing, or reserved range used up
+    int store = (counter < entry->local_counter) || (counter > local_counter_reserved[index]);
 
 	// update
-    entry.local_counter = counter;
+    entry->local_counter = counter;
 
-    // store
-    le_device_db_tlv_store(index, &entry);
+    if (!store) return;
+
+    // reserve next range
+    local_counter_reserved[index] = counter + LE_DEVICE_DB_TLV_COUNTER_RESERVE;
+    le_device_db_tlv_store(index);
 }
 
 #endif
 
+void le_device_db_tlv_flush(void){
+#ifdef ENABLE_LE_SIGNED_WRITE
+    if (le_device_db_tlv_flush_timer_active){
+        btstack_run_loop_remove_timer(&le_device_db_tlv_flush_timer);
+        le_device_db_tlv_flush_timer_active = 0;
+    }
+    if (num_dirty_entries == 0) return;
+    int i;
+    for (i=0;i<NVM_NUM_DEVICE_DB_ENTRIES;i++){
+        if (!entry_dirty[i]) continue;
+        log_info("flush le device entry %u", i);
+        le_device_db_tlv_store(i);
+    }
+#endif
+}
+
 void le_device_db_dump(void){
     log_info("LE Device DB dump, devices: %d", le_device_db_count());
     uint32_t i;
 
     for (i=0;i<NVM_NUM_DEVICE_DB_ENTRIES;i++){
         if (!entry_map[i]) continue;
-		// fetch entry
-		le_device_db_entry_t entry;
-		le_device_db_tlv_fetch(i, &entry);
-        log_info("%u: %u %s", i, entry.addr_type, bd_addr_to_str(entry.addr));
-        log_info_key("irk", entry.irk);
+		le_device_db_entry_t * entry = &entries[i];
+        log_info("%u: %u %s", i, entry->addr_type, bd_addr_to_str(entry->addr));
+        log_info_key("irk", entry->irk);
 #ifdef ENABLE_LE_SIGNED_WRITE
-        log_info_key("local csrk", entry.local_csrk);
-        log_info_key("remote csrk", entry.remote_csrk);
+        log_info_key("local csrk", entry->local_csrk);
+        log_info_key("remote csrk", entry->remote_csrk);
 #endif
     }
 }
 
 void le_device_db_tlv_configure(const btstack_tlv_t * btstack_tlv_impl, void * btstack_tlv_context){
+#ifdef ENABLE_LE_SIGNED_WRITE
+    // pending updates are dropped, call le_device_db_tlv_flush() before
+    if (le_device_db_tlv_flush_timer_active){
+        btstack_run_loop_remove_timer(&le_device_db_tlv_flush_timer);
+        le_device_db_tlv_flush_timer_active = 0;
+    }
+#endif
 	le_device_db_tlv_btstack_tlv_impl = btstack_tlv_impl;
 	le_device_db_tlv_btstack_tlv_context = btstack_tlv_context;
     le_device_db_tlv_scan();
+#ifdef ENABLE_LE_SIGNED_WRITE
+    // flush on disconnect
+    if (le_device_db_tlv_hci_event_callback_registration.callback == NULL){
+        le_device_db_tlv_hci_event_callback_registration.callback = &le_device_db_tlv_hci_event_handler;
+        hci_add_event_handler_for_events(&le_device_db_tlv_hci_event_callback_registration, le_device_db_tlv_hci_events, NULL);
+    }
+#endif
 }
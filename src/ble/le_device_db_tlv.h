@@ -55,6 +55,13 @@ extern "C" {
 
 void le_device_db_tlv_configure(const btstack_tlv_t * btstack_tlv_impl, void * btstack_tlv_context);
 
+/**
+ * @brief write signing counter and CSRK updates that are cached in RAM to btstack tlv
+ * @note updates are written on disconnect and LE_DEVICE_DB_TLV_FLUSH_INTERVAL_MS after they were made,
+ *       call before shutdown or before calling le_device_db_tlv_configure again
+ */
+void le_device_db_tlv_flush(void);
+
 /* API_END */
 
 #if defined __cplusplus
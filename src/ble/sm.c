@@ -108,6 +108,19 @@
 #define ENABLE_CMAC_ENGINE
 #endif
 
+// Software AES128 implementation
+#ifdef ENABLE_SOFTWARE_AES128
+#ifdef HAVE_AES128
+#error "Please use either HAVE_AES128 (platform AES128) or ENABLE_SOFTWARE_AES128 in btstack_config.h"
+#endif
+#include "rijndael.h"
+#endif
+
+// AES128 results are available immediately instead of via HCI LE Encrypt
+#if defined(HAVE_AES128) || defined(ENABLE_SOFTWARE_AES128)
+#define USE_SYNCHRONOUS_AES128
+#endif
+
 //
 // SM internal types and globals
 //
@@ -264,9 +277,12 @@ static void *             sm_aes128_context;
 
 // use aes128 provided by MCU - not needed usually
 #ifdef HAVE_AES128
+void btstack_aes128_calc(uint8_t * key, uint8_t * plaintext, uint8_t * result);
+#endif
+
+#ifdef USE_SYNCHRONOUS_AES128
 static uint8_t                aes128_result_flipped[16];
 static btstack_timer_source_t aes128_timer;
-void btstack_aes128_calc(uint8_t * key, uint8_t * plaintext, uint8_t * result);
 #endif
 
 // random engine. store context (ususally sm_connection_t)
@@ -275,6 +291,26 @@ static void * sm_random_context;
 // to receive hci events
 static btstack_packet_callback_registration_t hci_event_callback_registration;
 
+// HCI events handled by sm_event_packet_handler, which also calls sm_run for each of them
+static const uint8_t sm_hci_events[] = {
+    BTSTACK_EVENT_STATE,
+    HCI_EVENT_TRANSPORT_PACKET_SENT,
+    HCI_EVENT_COMMAND_STATUS,
+    HCI_EVENT_COMMAND_COMPLETE,
+    HCI_EVENT_DISCONNECTION_COMPLETE,
+    HCI_EVENT_ENCRYPTION_CHANGE,
+    HCI_EVENT_ENCRYPTION_KEY_REFRESH_COMPLETE,
+    HCI_EVENT_LE_META,
+    0
+};
+static const uint8_t sm_hci_le_subevents[] = {
+    HCI_SUBEVENT_LE_CONNECTION_COMPLETE,
+    HCI_SUBEVENT_LE_LONG_TERM_KEY_REQUEST,
+    HCI_SUBEVENT_LE_READ_LOCAL_P256_PUBLIC_KEY_COMPLETE,
+    HCI_SUBEVENT_LE_GENERATE_DHKEY_COMPLETE,
+    0
+};
+
 /* to dispatch sm event */
 static btstack_linked_list_t sm_event_handlers;
 
@@ -300,6 +336,9 @@ static mbedtls_ecp_group   mbedtls_ec_group;
 // data needed for security setup
 typedef struct sm_setup_context {
 
+    // connection that uses this setup context, HCI_CON_HANDLE_INVALID if free
+    hci_con_handle_t sm_handle;
+
     btstack_timer_source_t sm_timeout;
 
     // used in all phases
@@ -371,12 +410,27 @@ typedef struct sm_setup_context {
 
 } sm_setup_context_t;
 
-//
-static sm_setup_context_t the_setup;
-static sm_setup_context_t * setup = &the_setup;
+// number of pairings that can be active at the same time
+#ifndef MAX_NR_SM_SETUP_CONTEXTS
+#define MAX_NR_SM_SETUP_CONTEXTS 1
+#endif
 
-// active connection - the one for which the_setup is used for
-static uint16_t sm_active_connection_handle = HCI_CON_HANDLE_INVALID;
+// setup contexts are assigned to connections for the duration of a pairing/encryption setup
+static sm_setup_context_t sm_setup_contexts[MAX_NR_SM_SETUP_CONTEXTS];
+
+// setup context of the connection that is currently handled
+static sm_setup_context_t * setup = &sm_setup_contexts[0];
+
+// setup context to handle first in sm_run, to serve active connections round-robin
+static uint8_t sm_setup_context_next;
+
+#if defined(ENABLE_LE_SECURE_CONNECTIONS) && !defined(USE_SOFTWARE_ECDH_IMPLEMENTATION)
+// LE Generate DHKey Complete doesn't contain a connection handle, only one DHKey calculation is started at a time
+static hci_con_handle_t sm_dhkey_connection_handle;
+#endif
+
+// random engine busy, LE Rand results are matched to sm_random_context
+static uint8_t sm_random_active;
 
 // @returns 1 if oob data is available
 // stores oob data in provided 16 byte buffer if not null
@@ -562,12 +616,24 @@ static void gap_random_address_update_stop(void){
 }
 
 
+// pre: sm_random_active == 0, hci_can_send_command == 1
 static void sm_random_start(void * context){
+    sm_random_active = 1;
     sm_random_context = context;
     hci_send_cmd(&hci_le_rand);
 }
 
+#ifdef USE_SYNCHRONOUS_AES128
+static void sm_aes128_calc(sm_key_t key, sm_key_t plaintext, sm_key_t result){
 #ifdef HAVE_AES128
+    btstack_aes128_calc(key, plaintext, result);
+#else
+    uint32_t rk[RKLENGTH(KEYBITS)];
+    int nrounds = rijndaelSetupEncrypt(rk, key, KEYBITS);
+    rijndaelEncrypt(rk, nrounds, plaintext, result);
+#endif
+}
+
 static void aes128_completed(btstack_timer_source_t * ts){
     UNUSED(ts);
     sm_handle_encryption_result(&aes128_result_flipped[0]);
@@ -581,10 +647,10 @@ static void sm_aes128_start(sm_key_t key, sm_key_t plaintext, void * context){
     sm_aes128_state = SM_AES128_ACTIVE;
     sm_aes128_context = context;
 
-#ifdef HAVE_AES128
+#ifdef USE_SYNCHRONOUS_AES128
     // calc result directly
     sm_key_t result;
-    btstack_aes128_calc(key, plaintext, result);
+    sm_aes128_calc(key, plaintext, result);
 
     // log
     log_info_key("key", key);
@@ -615,6 +681,35 @@ static void sm_ah_r_prime(uint8_t r[3], uint8_t * r_prime){
     memcpy(&r_prime[13], r, 3);
 }
 
+#ifdef USE_SYNCHRONOUS_AES128
+// match address against LE Device DB entries starting at start_index in one pass
+// @returns index of matching entry or -1
+static int sm_address_resolution_match(int start_index, uint8_t address_type, bd_addr_t address){
+    sm_key_t r_prime;
+    sm_key_t hash;
+    sm_ah_r_prime(address, r_prime);
+    int count = le_device_db_count();
+    int i;
+    for (i = start_index; i < count; i++){
+        int addr_type;
+        bd_addr_t addr;
+        sm_key_t irk;
+        le_device_db_info(i, &addr_type, addr, irk);
+        if (address_type == addr_type && memcmp(addr, address, 6) == 0) return i;
+        // only random addresses can be resolved
+        if (address_type == 0) continue;
+        // hash = ah(irk, prand)
+        sm_aes128_calc(irk, r_prime, hash);
+        if (memcmp(&address[3], &hash[13], 3) == 0) return i;
+    }
+    return -1;
+}
+
+int sm_address_resolution_lookup_sync(uint8_t address_type, bd_addr_t address){
+    return sm_address_resolution_match(0, address_type, address);
+}
+#endif
+
 // d1 helper
 // d' = padding || r || d
 // d,r - 16 bit values
@@ -1209,12 +1304,41 @@ static int sm_key_distribution_all_received(sm_connection_t * sm_conn){
     return recv_flags == setup->sm_key_distribution_received_set;
 }
 
-static void sm_done_for_handle(hci_con_handle_t con_handle){
-    if (sm_active_connection_handle == con_handle){
-        sm_timeout_stop();
-        sm_active_connection_handle = HCI_CON_HANDLE_INVALID;
-        log_info("sm: connection 0x%x released setup context", con_handle);
+static sm_setup_context_t * sm_setup_for_handle(hci_con_handle_t con_handle){
+    int i;
+    for (i = 0; i < MAX_NR_SM_SETUP_CONTEXTS; i++){
+        if (sm_setup_contexts[i].sm_handle == con_handle) return &sm_setup_contexts[i];
+    }
+    return NULL;
+}
+
+// use setup context of connection for following setup accesses. @returns 1 if connection has a setup context
+static int sm_setup_select(sm_connection_t * sm_conn){
+    sm_setup_context_t * context = sm_setup_for_handle(sm_conn->sm_handle);
+    if (!context) return 0;
+    setup = context;
+    return 1;
+}
+
+static void sm_setup_contexts_init(void){
+    int i;
+    for (i = 0; i < MAX_NR_SM_SETUP_CONTEXTS; i++){
+        sm_setup_contexts[i].sm_handle = HCI_CON_HANDLE_INVALID;
     }
+    setup = &sm_setup_contexts[0];
+    sm_setup_context_next = 0;
+    sm_random_active = 0;
+#if defined(ENABLE_LE_SECURE_CONNECTIONS) && !defined(USE_SOFTWARE_ECDH_IMPLEMENTATION)
+    sm_dhkey_connection_handle = HCI_CON_HANDLE_INVALID;
+#endif
+}
+
+static void sm_done_for_handle(hci_con_handle_t con_handle){
+    sm_setup_context_t * context = sm_setup_for_handle(con_handle);
+    if (!context) return;
+    btstack_run_loop_remove_timer(&context->sm_timeout);
+    context->sm_handle = HCI_CON_HANDLE_INVALID;
+    log_info("sm: connection 0x%x released setup context", con_handle);
 }
 
 static int sm_key_distribution_flags_for_auth_req(void){
@@ -1469,7 +1593,13 @@ static void sm_key_distribution_handle_all_received(sm_connection_t * sm_conn){
 }
 
 static void sm_pairing_error(sm_connection_t * sm_conn, uint8_t reason){
-    setup->sm_pairing_failed_reason = reason;
+    // store reason in setup context if connection owns one, current one might belong to another connection
+    sm_setup_context_t * context = sm_setup_for_handle(sm_conn->sm_handle);
+    if (context){
+        context->sm_pairing_failed_reason = reason;
+    } else {
+        sm_conn->sm_pairing_failed_reason = reason;
+    }
     sm_conn->sm_engine_state = SM_GENERAL_SEND_PAIRING_FAILED;
 }
 
@@ -1542,6 +1672,8 @@ static void sm_sc_cmac_done(uint8_t * hash){
     link_key_type_t link_key_type;
 #endif
 
+    if (!sm_setup_select(sm_conn)) return;
+
     switch (sm_conn->sm_engine_state){
         case SM_SC_W4_CMAC_FOR_CONFIRMATION:
             memcpy(setup->sm_local_confirm, hash, 16);
@@ -1956,6 +2088,509 @@ static void sm_start_calculating_ltk_from_ediv_and_rand(sm_connection_t * sm_con
 }
 #endif
 
+// handle connection that owns the current setup context
+// @returns 1 if sm_run should stop, e.g. as an HCI command or SM PDU was sent
+static int sm_run_active_connection(sm_connection_t * connection){
+
+#if defined(ENABLE_LE_SECURE_CONNECTIONS) && !defined(USE_SOFTWARE_ECDH_IMPLEMENTATION)
+    if ((setup->sm_state_vars & SM_STATE_VAR_DHKEY_NEEDED) && (sm_dhkey_connection_handle == HCI_CON_HANDLE_INVALID)){
+        setup->sm_state_vars &= ~SM_STATE_VAR_DHKEY_NEEDED;
+        sm_dhkey_connection_handle = connection->sm_handle;
+        hci_send_cmd(&hci_le_generate_dhkey, &setup->sm_peer_q[0], &setup->sm_peer_q[32]);
+        return 1;
+    }
+#endif
+
+    // assert that we could send a SM PDU - not needed for all of the following
+    if (!l2cap_can_send_fixed_channel_packet_now(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL)) {
+        log_info("cannot send now, requesting can send now event");
+        l2cap_request_can_send_fix_channel_now_event(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL);
+        return 0;
+    }
+
+    // send keypress notifications
+    if (setup->sm_keypress_notification != 0xff){
+        uint8_t buffer[2];
+        buffer[0] = SM_CODE_KEYPRESS_NOTIFICATION;
+        buffer[1] = setup->sm_keypress_notification;
+        setup->sm_keypress_notification = 0xff;
+        l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+        return 1;
+    }
+
+    sm_key_t plaintext;
+    int key_distribution_flags;
+    UNUSED(key_distribution_flags);
+
+    log_info("sm_run: state %u", connection->sm_engine_state);
+
+    switch (connection->sm_engine_state){
+
+        // general
+        case SM_GENERAL_SEND_PAIRING_FAILED: {
+            uint8_t buffer[2];
+            buffer[0] = SM_CODE_PAIRING_FAILED;
+            buffer[1] = setup->sm_pairing_failed_reason;
+            connection->sm_engine_state = connection->sm_role ? SM_RESPONDER_IDLE : SM_INITIATOR_CONNECTED;
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_done_for_handle(connection->sm_handle);
+            break;
+        }
+
+        // responding state
+#ifdef ENABLE_LE_SECURE_CONNECTIONS
+        case SM_SC_W2_GET_RANDOM_A:
+            if (sm_random_active) break;
+            sm_random_start(connection);
+            connection->sm_engine_state = SM_SC_W4_GET_RANDOM_A;
+            break;
+        case SM_SC_W2_GET_RANDOM_B:
+            if (sm_random_active) break;
+            sm_random_start(connection);
+            connection->sm_engine_state = SM_SC_W4_GET_RANDOM_B;
+            break;
+        case SM_SC_W2_CMAC_FOR_CONFIRMATION:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CMAC_FOR_CONFIRMATION;
+            sm_sc_calculate_local_confirm(connection);
+            break;
+        case SM_SC_W2_CMAC_FOR_CHECK_CONFIRMATION:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CMAC_FOR_CHECK_CONFIRMATION;
+            sm_sc_calculate_remote_confirm(connection);
+            break;
+        case SM_SC_W2_CALCULATE_F6_FOR_DHKEY_CHECK:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_F6_FOR_DHKEY_CHECK;
+            sm_sc_calculate_f6_for_dhkey_check(connection);
+            break;
+        case SM_SC_W2_CALCULATE_F6_TO_VERIFY_DHKEY_CHECK:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_F6_TO_VERIFY_DHKEY_CHECK;
+            sm_sc_calculate_f6_to_verify_dhkey_check(connection);
+            break;
+        case SM_SC_W2_CALCULATE_F5_SALT:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_SALT;
+            f5_calculate_salt(connection);
+            break;
+        case SM_SC_W2_CALCULATE_F5_MACKEY:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_MACKEY;
+            f5_calculate_mackey(connection);
+            break;
+        case SM_SC_W2_CALCULATE_F5_LTK:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_LTK;
+            f5_calculate_ltk(connection);
+            break;
+        case SM_SC_W2_CALCULATE_G2:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_G2;
+            g2_calculate(connection);
+            break;
+        case SM_SC_W2_CALCULATE_H6_ILK:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_H6_ILK;
+            h6_calculate_ilk(connection);
+            break;
+        case SM_SC_W2_CALCULATE_H6_BR_EDR_LINK_KEY:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_H6_BR_EDR_LINK_KEY;
+            h6_calculate_br_edr_link_key(connection);
+            break;
+#endif
+
+#ifdef ENABLE_LE_CENTRAL
+        // initiator side
+        case SM_INITIATOR_PH0_SEND_START_ENCRYPTION: {
+            sm_key_t peer_ltk_flipped;
+            reverse_128(setup->sm_peer_ltk, peer_ltk_flipped);
+            connection->sm_engine_state = SM_INITIATOR_PH0_W4_CONNECTION_ENCRYPTED;
+            log_info("sm: hci_le_start_encryption ediv 0x%04x", setup->sm_peer_ediv);
+            uint32_t rand_high = big_endian_read_32(setup->sm_peer_rand, 0);
+            uint32_t rand_low  = big_endian_read_32(setup->sm_peer_rand, 4);
+            hci_send_cmd(&hci_le_start_encryption, connection->sm_handle,rand_low, rand_high, setup->sm_peer_ediv, peer_ltk_flipped);
+            return 1;
+        }
+
+        case SM_INITIATOR_PH1_SEND_PAIRING_REQUEST:
+            sm_pairing_packet_set_code(setup->sm_m_preq, SM_CODE_PAIRING_REQUEST);
+            connection->sm_engine_state = SM_INITIATOR_PH1_W4_PAIRING_RESPONSE;
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) &setup->sm_m_preq, sizeof(sm_pairing_packet_t));
+            sm_timeout_reset(connection);
+            break;
+#endif
+
+#ifdef ENABLE_LE_SECURE_CONNECTIONS
+
+        case SM_SC_SEND_PUBLIC_KEY_COMMAND: {
+            uint8_t buffer[65];
+            buffer[0] = SM_CODE_PAIRING_PUBLIC_KEY;
+            //
+            reverse_256(&ec_q[0],  &buffer[1]);
+            reverse_256(&ec_q[32], &buffer[33]);
+
+            // stk generation method
+            // passkey entry: notify app to show passkey or to request passkey
+            switch (setup->sm_stk_generation_method){
+                case JUST_WORKS:
+                case NK_BOTH_INPUT:
+                    if (IS_RESPONDER(connection->sm_role)){
+                        // responder
+                        sm_sc_start_calculating_local_confirm(connection);
+                    } else {
+                        // initiator
+                        connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
+                    }
+                    break;
+                case PK_INIT_INPUT:
+                case PK_RESP_INPUT:
+                case OK_BOTH_INPUT:
+                    // use random TK for display
+                    memcpy(setup->sm_ra, setup->sm_tk, 16);
+                    memcpy(setup->sm_rb, setup->sm_tk, 16);
+                    setup->sm_passkey_bit = 0;
+
+                    if (IS_RESPONDER(connection->sm_role)){
+                        // responder
+                        connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
+                    } else {
+                        // initiator
+                        connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
+                    }
+                    sm_trigger_user_response(connection);
+                    break;
+                case OOB:
+                    // TODO: implement SC OOB
+                    break;
+            }
+
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
+            break;
+        }
+        case SM_SC_SEND_CONFIRMATION: {
+            uint8_t buffer[17];
+            buffer[0] = SM_CODE_PAIRING_CONFIRM;
+            reverse_128(setup->sm_local_confirm, &buffer[1]);
+            if (IS_RESPONDER(connection->sm_role)){
+                connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
+            } else {
+                connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
+            }
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
+            break;
+        }
+        case SM_SC_SEND_PAIRING_RANDOM: {
+            uint8_t buffer[17];
+            buffer[0] = SM_CODE_PAIRING_RANDOM;
+            reverse_128(setup->sm_local_nonce, &buffer[1]);
+            if (setup->sm_stk_generation_method != JUST_WORKS && setup->sm_stk_generation_method != NK_BOTH_INPUT && setup->sm_passkey_bit < 20){
+                if (IS_RESPONDER(connection->sm_role)){
+                    // responder
+                    connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
+                } else {
+                    // initiator
+                    connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
+                }
+            } else {
+                if (IS_RESPONDER(connection->sm_role)){
+                    // responder
+                    if (setup->sm_stk_generation_method == NK_BOTH_INPUT){
+                        connection->sm_engine_state = SM_SC_W2_CALCULATE_G2;
+                    } else {
+                        sm_sc_prepare_dhkey_check(connection);
+                    }
+                } else {
+                    // initiator
+                    connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
+                }
+            }
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
+            break;
+        }
+        case SM_SC_SEND_DHKEY_CHECK_COMMAND: {
+            uint8_t buffer[17];
+            buffer[0] = SM_CODE_PAIRING_DHKEY_CHECK;
+            reverse_128(setup->sm_local_dhkey_check, &buffer[1]);
+
+            if (IS_RESPONDER(connection->sm_role)){
+                connection->sm_engine_state = SM_SC_W4_LTK_REQUEST_SC;
+            } else {
+                connection->sm_engine_state = SM_SC_W4_DHKEY_CHECK_COMMAND;
+            }
+
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
+            break;
+        }
+
+#endif
+
+#ifdef ENABLE_LE_PERIPHERAL
+        case SM_RESPONDER_PH1_SEND_PAIRING_RESPONSE:
+            // echo initiator for now
+            sm_pairing_packet_set_code(setup->sm_s_pres,SM_CODE_PAIRING_RESPONSE);
+            key_distribution_flags = sm_key_distribution_flags_for_auth_req();
+
+            if (setup->sm_use_secure_connections){
+                connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
+                // skip LTK/EDIV for SC
+                log_info("sm: dropping encryption information flag");
+                key_distribution_flags &= ~SM_KEYDIST_ENC_KEY;
+            } else {
+                connection->sm_engine_state = SM_RESPONDER_PH1_W4_PAIRING_CONFIRM;
+            }
+
+            sm_pairing_packet_set_initiator_key_distribution(setup->sm_s_pres, sm_pairing_packet_get_initiator_key_distribution(setup->sm_m_preq) & key_distribution_flags);
+            sm_pairing_packet_set_responder_key_distribution(setup->sm_s_pres, sm_pairing_packet_get_responder_key_distribution(setup->sm_m_preq) & key_distribution_flags);
+            // update key distribution after ENC was dropped
+            sm_setup_key_distribution(sm_pairing_packet_get_responder_key_distribution(setup->sm_s_pres));
+
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) &setup->sm_s_pres, sizeof(sm_pairing_packet_t));
+            sm_timeout_reset(connection);
+            // SC Numeric Comparison will trigger user response after public keys & nonces have been exchanged
+            if (!setup->sm_use_secure_connections || setup->sm_stk_generation_method == JUST_WORKS){
+                sm_trigger_user_response(connection);
+            }
+            return 1;
+#endif
+
+        case SM_PH2_SEND_PAIRING_RANDOM: {
+            uint8_t buffer[17];
+            buffer[0] = SM_CODE_PAIRING_RANDOM;
+            reverse_128(setup->sm_local_random, &buffer[1]);
+            if (IS_RESPONDER(connection->sm_role)){
+                connection->sm_engine_state = SM_RESPONDER_PH2_W4_LTK_REQUEST;
+            } else {
+                connection->sm_engine_state = SM_INITIATOR_PH2_W4_PAIRING_RANDOM;
+            }
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
+            break;
+        }
+
+        case SM_PH2_GET_RANDOM_TK:
+        case SM_PH2_C1_GET_RANDOM_A:
+        case SM_PH2_C1_GET_RANDOM_B:
+        case SM_PH3_GET_RANDOM:
+        case SM_PH3_GET_DIV:
+            if (sm_random_active) break;
+            sm_next_responding_state(connection);
+            sm_random_start(connection);
+            return 1;
+
+        case SM_PH2_C1_GET_ENC_B:
+        case SM_PH2_C1_GET_ENC_D:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            sm_next_responding_state(connection);
+            sm_aes128_start(setup->sm_tk, setup->sm_c1_t3_value, connection);
+            return 1;
+
+        case SM_PH3_LTK_GET_ENC:
+        case SM_RESPONDER_PH4_LTK_GET_ENC:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_IDLE) {
+                sm_key_t d_prime;
+                sm_d1_d_prime(setup->sm_local_div, 0, d_prime);
+                sm_next_responding_state(connection);
+                sm_aes128_start(sm_persistent_er, d_prime, connection);
+                return 1;
+            }
+            break;
+
+        case SM_PH3_CSRK_GET_ENC:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_IDLE) {
+                sm_key_t d_prime;
+                sm_d1_d_prime(setup->sm_local_div, 1, d_prime);
+                sm_next_responding_state(connection);
+                sm_aes128_start(sm_persistent_er, d_prime, connection);
+                return 1;
+            }
+            break;
+
+        case SM_PH2_C1_GET_ENC_C:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            // calculate m_confirm using aes128 engine - step 1
+            sm_c1_t1(setup->sm_peer_random, (uint8_t*) &setup->sm_m_preq, (uint8_t*) &setup->sm_s_pres, setup->sm_m_addr_type, setup->sm_s_addr_type, plaintext);
+            sm_next_responding_state(connection);
+            sm_aes128_start(setup->sm_tk, plaintext, connection);
+            break;
+        case SM_PH2_C1_GET_ENC_A:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            // calculate confirm using aes128 engine - step 1
+            sm_c1_t1(setup->sm_local_random, (uint8_t*) &setup->sm_m_preq, (uint8_t*) &setup->sm_s_pres, setup->sm_m_addr_type, setup->sm_s_addr_type, plaintext);
+            sm_next_responding_state(connection);
+            sm_aes128_start(setup->sm_tk, plaintext, connection);
+            break;
+        case SM_PH2_CALC_STK:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            // calculate STK
+            if (IS_RESPONDER(connection->sm_role)){
+                sm_s1_r_prime(setup->sm_local_random, setup->sm_peer_random, plaintext);
+            } else {
+                sm_s1_r_prime(setup->sm_peer_random, setup->sm_local_random, plaintext);
+            }
+            sm_next_responding_state(connection);
+            sm_aes128_start(setup->sm_tk, plaintext, connection);
+            break;
+        case SM_PH3_Y_GET_ENC:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            // PH3B2 - calculate Y from      - enc
+            // Y = dm(DHK, Rand)
+            sm_dm_r_prime(setup->sm_local_rand, plaintext);
+            sm_next_responding_state(connection);
+            sm_aes128_start(sm_persistent_dhk, plaintext, connection);
+            return 1;
+        case SM_PH2_C1_SEND_PAIRING_CONFIRM: {
+            uint8_t buffer[17];
+            buffer[0] = SM_CODE_PAIRING_CONFIRM;
+            reverse_128(setup->sm_local_confirm, &buffer[1]);
+            if (IS_RESPONDER(connection->sm_role)){
+                connection->sm_engine_state = SM_RESPONDER_PH2_W4_PAIRING_RANDOM;
+            } else {
+                connection->sm_engine_state = SM_INITIATOR_PH2_W4_PAIRING_CONFIRM;
+            }
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
+            return 1;
+        }
+#ifdef ENABLE_LE_PERIPHERAL
+        case SM_RESPONDER_PH2_SEND_LTK_REPLY: {
+            sm_key_t stk_flipped;
+            reverse_128(setup->sm_ltk, stk_flipped);
+            connection->sm_engine_state = SM_PH2_W4_CONNECTION_ENCRYPTED;
+            hci_send_cmd(&hci_le_long_term_key_request_reply, connection->sm_handle, stk_flipped);
+            return 1;
+        }
+        case SM_RESPONDER_PH4_SEND_LTK_REPLY: {
+            sm_key_t ltk_flipped;
+            reverse_128(setup->sm_ltk, ltk_flipped);
+            connection->sm_engine_state = SM_RESPONDER_IDLE;
+            hci_send_cmd(&hci_le_long_term_key_request_reply, connection->sm_handle, ltk_flipped);
+            sm_done_for_handle(connection->sm_handle);
+            return 1;
+        }
+        case SM_RESPONDER_PH4_Y_GET_ENC:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            log_info("LTK Request: recalculating with ediv 0x%04x", setup->sm_local_ediv);
+            // Y = dm(DHK, Rand)
+            sm_dm_r_prime(setup->sm_local_rand, plaintext);
+            sm_next_responding_state(connection);
+            sm_aes128_start(sm_persistent_dhk, plaintext, connection);
+            return 1;
+#endif
+#ifdef ENABLE_LE_CENTRAL
+        case SM_INITIATOR_PH3_SEND_START_ENCRYPTION: {
+            sm_key_t stk_flipped;
+            reverse_128(setup->sm_ltk, stk_flipped);
+            connection->sm_engine_state = SM_PH2_W4_CONNECTION_ENCRYPTED;
+            hci_send_cmd(&hci_le_start_encryption, connection->sm_handle, 0, 0, 0, stk_flipped);
+            return 1;
+        }
+#endif
+
+        case SM_PH3_DISTRIBUTE_KEYS:
+            if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_ENCRYPTION_INFORMATION){
+                setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_ENCRYPTION_INFORMATION;
+                uint8_t buffer[17];
+                buffer[0] = SM_CODE_ENCRYPTION_INFORMATION;
+                reverse_128(setup->sm_ltk, &buffer[1]);
+                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                sm_timeout_reset(connection);
+                return 1;
+            }
+            if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_MASTER_IDENTIFICATION){
+                setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_MASTER_IDENTIFICATION;
+                uint8_t buffer[11];
+                buffer[0] = SM_CODE_MASTER_IDENTIFICATION;
+                little_endian_store_16(buffer, 1, setup->sm_local_ediv);
+                reverse_64(setup->sm_local_rand, &buffer[3]);
+                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                sm_timeout_reset(connection);
+                return 1;
+            }
+            if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_IDENTITY_INFORMATION){
+                setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_IDENTITY_INFORMATION;
+                uint8_t buffer[17];
+                buffer[0] = SM_CODE_IDENTITY_INFORMATION;
+                reverse_128(sm_persistent_irk, &buffer[1]);
+                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                sm_timeout_reset(connection);
+                return 1;
+            }
+            if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_IDENTITY_ADDRESS_INFORMATION){
+                setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_IDENTITY_ADDRESS_INFORMATION;
+                bd_addr_t local_address;
+                uint8_t buffer[8];
+                buffer[0] = SM_CODE_IDENTITY_ADDRESS_INFORMATION;
+                switch (gap_random_address_get_mode()){
+                    case GAP_RANDOM_ADDRESS_TYPE_OFF:
+                    case GAP_RANDOM_ADDRESS_TYPE_STATIC:
+                        // public or static random
+                        gap_le_get_own_address(&buffer[1], local_address);
+                        break;
+                    case GAP_RANDOM_ADDRESS_NON_RESOLVABLE:
+                    case GAP_RANDOM_ADDRESS_RESOLVABLE:
+                        // fallback to public
+                        gap_local_bd_addr(local_address);
+                        buffer[1] = 0;
+                        break;
+                }
+                reverse_bd_addr(local_address, &buffer[2]);
+                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                sm_timeout_reset(connection);
+                return 1;
+            }
+            if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_SIGNING_IDENTIFICATION){
+                setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_SIGNING_IDENTIFICATION;
+
+                // hack to reproduce test runs
+                if (test_use_fixed_local_csrk){
+                    memset(setup->sm_local_csrk, 0xcc, 16);
+                }
+
+                uint8_t buffer[17];
+                buffer[0] = SM_CODE_SIGNING_INFORMATION;
+                reverse_128(setup->sm_local_csrk, &buffer[1]);
+                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                sm_timeout_reset(connection);
+                return 1;
+            }
+
+            // keys are sent
+            if (IS_RESPONDER(connection->sm_role)){
+                // slave -> receive master keys if any
+                if (sm_key_distribution_all_received(connection)){
+                    sm_key_distribution_handle_all_received(connection);
+                    connection->sm_engine_state = SM_RESPONDER_IDLE;
+                    sm_done_for_handle(connection->sm_handle);
+                } else {
+                    connection->sm_engine_state = SM_PH3_RECEIVE_KEYS;
+                }
+            } else {
+                // master -> all done
+                connection->sm_engine_state = SM_INITIATOR_CONNECTED;
+                sm_done_for_handle(connection->sm_handle);
+            }
+            break;
+
+        default:
+            break;
+    }
+    return 0;
+}
+
 static void sm_run(void){
 
     btstack_linked_list_iterator_t it;
@@ -2001,6 +2636,7 @@ static void sm_run(void){
 #ifdef ENABLE_LE_SECURE_CONNECTIONS
     if (ec_key_generation_state == EC_KEY_GENERATION_ACTIVE){
 #ifdef USE_SOFTWARE_ECDH_IMPLEMENTATION
+        if (sm_random_active) return;
         sm_random_start(NULL);
 #else
         ec_key_generation_state = EC_KEY_GENERATION_W4_KEY;
@@ -2013,6 +2649,7 @@ static void sm_run(void){
     // random address updates
     switch (rau_state){
         case RAU_GET_RANDOM:
+            if (sm_random_active) break;
             rau_next_state();
             sm_random_start(NULL);
             return;
@@ -2077,6 +2714,20 @@ static void sm_run(void){
     }
 
     // -- Continue with CSRK device lookup by public or resolvable private address
+#ifdef USE_SYNCHRONOUS_AES128
+    // check all devices in one pass, result is available immediately
+    if (!sm_address_resolution_idle()){
+        int matched_device_id = sm_address_resolution_match(sm_address_resolution_test, sm_address_resolution_addr_type, sm_address_resolution_address);
+        if (matched_device_id < 0){
+            log_info("LE Device Lookup: not found");
+            sm_address_resolution_handle_event(ADDRESS_RESOLUTION_FAILED);
+        } else {
+            log_info("LE Device Lookup: found device %u", matched_device_id);
+            sm_address_resolution_test = matched_device_id;
+            sm_address_resolution_handle_event(ADDRESS_RESOLUTION_SUCEEDED);
+        }
+    }
+#else
     if (!sm_address_resolution_idle()){
         log_info("LE Device Lookup: device %u/%u", sm_address_resolution_test, le_device_db_count());
         while (sm_address_resolution_test < le_device_db_count()){
@@ -2114,14 +2765,40 @@ static void sm_run(void){
             sm_address_resolution_handle_event(ADDRESS_RESOLUTION_FAILED);
         }
     }
+#endif
 
     // handle basic actions that don't requires the full context
     hci_connections_get_iterator(&it);
-    while((sm_active_connection_handle == HCI_CON_HANDLE_INVALID) && btstack_linked_list_iterator_has_next(&it)){
+    while(btstack_linked_list_iterator_has_next(&it)){
         hci_connection_t * hci_connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
         sm_connection_t  * sm_connection = &hci_connection->sm_connection;
         switch(sm_connection->sm_engine_state){
             // responder side
+#ifdef ENABLE_LE_PERIPHERAL
+            case SM_RESPONDER_SEND_SECURITY_REQUEST:
+                // send packet if possible,
+                if (l2cap_can_send_fixed_channel_packet_now(sm_connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL)){
+                    const uint8_t buffer[2] = { SM_CODE_SECURITY_REQUEST, SM_AUTHREQ_BONDING};
+                    sm_connection->sm_engine_state = SM_RESPONDER_PH1_W4_PAIRING_REQUEST;
+                    l2cap_send_connectionless(sm_connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                } else {
+                    l2cap_request_can_send_fix_channel_now_event(sm_connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL);
+                }
+                break;
+#endif
+            // connections that own a setup context send Pairing Failed in sm_run_active_connection
+            case SM_GENERAL_SEND_PAIRING_FAILED:
+                if (sm_setup_for_handle(sm_connection->sm_handle)) break;
+                if (l2cap_can_send_fixed_channel_packet_now(sm_connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL)){
+                    uint8_t buffer[2];
+                    buffer[0] = SM_CODE_PAIRING_FAILED;
+                    buffer[1] = sm_connection->sm_pairing_failed_reason;
+                    sm_connection->sm_engine_state = sm_connection->sm_role ? SM_RESPONDER_IDLE : SM_INITIATOR_CONNECTED;
+                    l2cap_send_connectionless(sm_connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                } else {
+                    l2cap_request_can_send_fix_channel_now_event(sm_connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL);
+                }
+                break;
             case SM_RESPONDER_PH0_SEND_LTK_REQUESTED_NEGATIVE_REPLY:
                 sm_connection->sm_engine_state = SM_RESPONDER_IDLE;
                 hci_send_cmd(&hci_le_long_term_key_negative_reply, sm_connection->sm_handle);
@@ -2147,33 +2824,26 @@ static void sm_run(void){
 
     //
     // active connection handling
-    // -- use loop to handle next connection if lock on setup context is released
+    // -- use loop to handle next connection if a setup context is released
 
     while (1) {
 
-        // Find connections that requires setup context and make active if no other is locked
+        // Find connections that requires setup context and assign a free one
         hci_connections_get_iterator(&it);
-        while((sm_active_connection_handle == HCI_CON_HANDLE_INVALID) && btstack_linked_list_iterator_has_next(&it)){
+        while(btstack_linked_list_iterator_has_next(&it)){
             hci_connection_t * hci_connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
             sm_connection_t  * sm_connection = &hci_connection->sm_connection;
-            // - if no connection locked and we're ready/waiting for setup context, fetch it and start
+            // - skip connections that already own a setup context
+            if (sm_setup_for_handle(sm_connection->sm_handle)) continue;
+            // - if we're ready/waiting for setup context, fetch a free one and start
+            sm_setup_context_t * free_context = sm_setup_for_handle(HCI_CON_HANDLE_INVALID);
+            if (!free_context) break;
+            setup = free_context;
             int done = 1;
             int err;
             UNUSED(err);
             switch (sm_connection->sm_engine_state) {
 #ifdef ENABLE_LE_PERIPHERAL
-                case SM_RESPONDER_SEND_SECURITY_REQUEST:
-                    // send packet if possible,
-                    if (l2cap_can_send_fixed_channel_packet_now(sm_connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL)){
-                        const uint8_t buffer[2] = { SM_CODE_SECURITY_REQUEST, SM_AUTHREQ_BONDING};
-                        sm_connection->sm_engine_state = SM_RESPONDER_PH1_W4_PAIRING_REQUEST;
-                        l2cap_send_connectionless(sm_connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                    } else {
-                        l2cap_request_can_send_fix_channel_now_event(sm_connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL);
-                    }
-                    // don't lock sxetup context yet
-                    done = 0;
-                    break;
                 case SM_RESPONDER_PH1_PAIRING_REQUEST_RECEIVED:
                     sm_reset_setup();
                     sm_init_setup(sm_connection);
@@ -2243,518 +2913,44 @@ static void sm_run(void){
                     break;
             }
             if (done){
-                sm_active_connection_handle = sm_connection->sm_handle;
-                log_info("sm: connection 0x%04x locked setup context as %s, state %u", sm_active_connection_handle, sm_connection->sm_role ? "responder" : "initiator", sm_connection->sm_engine_state);
+                setup->sm_handle = sm_connection->sm_handle;
+                log_info("sm: connection 0x%04x locked setup context as %s, state %u", setup->sm_handle, sm_connection->sm_role ? "responder" : "initiator", sm_connection->sm_engine_state);
             }
         }
 
         //
-        // active connection handling
+        // active connection handling, start with the context after the one served last
         //
 
-        if (sm_active_connection_handle == HCI_CON_HANDLE_INVALID) return;
-
-        sm_connection_t * connection = sm_get_connection_for_handle(sm_active_connection_handle);
-        if (!connection) {
-            log_info("no connection for handle 0x%04x", sm_active_connection_handle);
-            return;
-        }
-
-#if defined(ENABLE_LE_SECURE_CONNECTIONS) && !defined(USE_SOFTWARE_ECDH_IMPLEMENTATION)
-        if (setup->sm_state_vars & SM_STATE_VAR_DHKEY_NEEDED){
-            setup->sm_state_vars &= ~SM_STATE_VAR_DHKEY_NEEDED;
-            hci_send_cmd(&hci_le_generate_dhkey, &setup->sm_peer_q[0], &setup->sm_peer_q[32]);
-            return;
-        }
-#endif
-
-        // assert that we could send a SM PDU - not needed for all of the following
-        if (!l2cap_can_send_fixed_channel_packet_now(sm_active_connection_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL)) {
-            log_info("cannot send now, requesting can send now event");
-            l2cap_request_can_send_fix_channel_now_event(sm_active_connection_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL);
-            return;
-        }
-
-        // send keypress notifications
-        if (setup->sm_keypress_notification != 0xff){
-            uint8_t buffer[2];
-            buffer[0] = SM_CODE_KEYPRESS_NOTIFICATION;
-            buffer[1] = setup->sm_keypress_notification;
-            setup->sm_keypress_notification = 0xff;
-            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-            return;
-        }
-
-        sm_key_t plaintext;
-        int key_distribution_flags;
-        UNUSED(key_distribution_flags);
-
-        log_info("sm_run: state %u", connection->sm_engine_state);
-
-        switch (connection->sm_engine_state){
-
-            // general
-            case SM_GENERAL_SEND_PAIRING_FAILED: {
-                uint8_t buffer[2];
-                buffer[0] = SM_CODE_PAIRING_FAILED;
-                buffer[1] = setup->sm_pairing_failed_reason;
-                connection->sm_engine_state = connection->sm_role ? SM_RESPONDER_IDLE : SM_INITIATOR_CONNECTED;
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_done_for_handle(connection->sm_handle);
-                break;
-            }
-
-            // responding state
-#ifdef ENABLE_LE_SECURE_CONNECTIONS
-            case SM_SC_W2_GET_RANDOM_A:
-                sm_random_start(connection);
-                connection->sm_engine_state = SM_SC_W4_GET_RANDOM_A;
-                break;
-            case SM_SC_W2_GET_RANDOM_B:
-                sm_random_start(connection);
-                connection->sm_engine_state = SM_SC_W4_GET_RANDOM_B;
-                break;
-            case SM_SC_W2_CMAC_FOR_CONFIRMATION:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CMAC_FOR_CONFIRMATION;
-                sm_sc_calculate_local_confirm(connection);
-                break;
-            case SM_SC_W2_CMAC_FOR_CHECK_CONFIRMATION:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CMAC_FOR_CHECK_CONFIRMATION;
-                sm_sc_calculate_remote_confirm(connection);
-                break;
-            case SM_SC_W2_CALCULATE_F6_FOR_DHKEY_CHECK:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_F6_FOR_DHKEY_CHECK;
-                sm_sc_calculate_f6_for_dhkey_check(connection);
-                break;
-            case SM_SC_W2_CALCULATE_F6_TO_VERIFY_DHKEY_CHECK:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_F6_TO_VERIFY_DHKEY_CHECK;
-                sm_sc_calculate_f6_to_verify_dhkey_check(connection);
-                break;
-            case SM_SC_W2_CALCULATE_F5_SALT:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_SALT;
-                f5_calculate_salt(connection);
-                break;
-            case SM_SC_W2_CALCULATE_F5_MACKEY:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_MACKEY;
-                f5_calculate_mackey(connection);
-                break;
-            case SM_SC_W2_CALCULATE_F5_LTK:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_LTK;
-                f5_calculate_ltk(connection);
-                break;
-            case SM_SC_W2_CALCULATE_G2:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_G2;
-                g2_calculate(connection);
-                break;
-            case SM_SC_W2_CALCULATE_H6_ILK:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_H6_ILK;
-                h6_calculate_ilk(connection);
-                break;
-            case SM_SC_W2_CALCULATE_H6_BR_EDR_LINK_KEY:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_H6_BR_EDR_LINK_KEY;
-                h6_calculate_br_edr_link_key(connection);
-                break;
-#endif
-
-#ifdef ENABLE_LE_CENTRAL
-            // initiator side
-            case SM_INITIATOR_PH0_SEND_START_ENCRYPTION: {
-                sm_key_t peer_ltk_flipped;
-                reverse_128(setup->sm_peer_ltk, peer_ltk_flipped);
-                connection->sm_engine_state = SM_INITIATOR_PH0_W4_CONNECTION_ENCRYPTED;
-                log_info("sm: hci_le_start_encryption ediv 0x%04x", setup->sm_peer_ediv);
-                uint32_t rand_high = big_endian_read_32(setup->sm_peer_rand, 0);
-                uint32_t rand_low  = big_endian_read_32(setup->sm_peer_rand, 4);
-                hci_send_cmd(&hci_le_start_encryption, connection->sm_handle,rand_low, rand_high, setup->sm_peer_ediv, peer_ltk_flipped);
-                return;
-            }
-
-            case SM_INITIATOR_PH1_SEND_PAIRING_REQUEST:
-                sm_pairing_packet_set_code(setup->sm_m_preq, SM_CODE_PAIRING_REQUEST);
-                connection->sm_engine_state = SM_INITIATOR_PH1_W4_PAIRING_RESPONSE;
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) &setup->sm_m_preq, sizeof(sm_pairing_packet_t));
-                sm_timeout_reset(connection);
-                break;
-#endif
-
-#ifdef ENABLE_LE_SECURE_CONNECTIONS
-
-            case SM_SC_SEND_PUBLIC_KEY_COMMAND: {
-                uint8_t buffer[65];
-                buffer[0] = SM_CODE_PAIRING_PUBLIC_KEY;
-                //
-                reverse_256(&ec_q[0],  &buffer[1]);
-                reverse_256(&ec_q[32], &buffer[33]);
-
-                // stk generation method
-                // passkey entry: notify app to show passkey or to request passkey
-                switch (setup->sm_stk_generation_method){
-                    case JUST_WORKS:
-                    case NK_BOTH_INPUT:
-                        if (IS_RESPONDER(connection->sm_role)){
-                            // responder
-                            sm_sc_start_calculating_local_confirm(connection);
-                        } else {
-                            // initiator
-                            connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
-                        }
-                        break;
-                    case PK_INIT_INPUT:
-                    case PK_RESP_INPUT:
-                    case OK_BOTH_INPUT:
-                        // use random TK for display
-                        memcpy(setup->sm_ra, setup->sm_tk, 16);
-                        memcpy(setup->sm_rb, setup->sm_tk, 16);
-                        setup->sm_passkey_bit = 0;
-
-                        if (IS_RESPONDER(connection->sm_role)){
-                            // responder
-                            connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
-                        } else {
-                            // initiator
-                            connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
-                        }
-                        sm_trigger_user_response(connection);
-                        break;
-                    case OOB:
-                        // TODO: implement SC OOB
-                        break;
-                }
-
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                break;
-            }
-            case SM_SC_SEND_CONFIRMATION: {
-                uint8_t buffer[17];
-                buffer[0] = SM_CODE_PAIRING_CONFIRM;
-                reverse_128(setup->sm_local_confirm, &buffer[1]);
-                if (IS_RESPONDER(connection->sm_role)){
-                    connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
-                } else {
-                    connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
-                }
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                break;
-            }
-            case SM_SC_SEND_PAIRING_RANDOM: {
-                uint8_t buffer[17];
-                buffer[0] = SM_CODE_PAIRING_RANDOM;
-                reverse_128(setup->sm_local_nonce, &buffer[1]);
-                if (setup->sm_stk_generation_method != JUST_WORKS && setup->sm_stk_generation_method != NK_BOTH_INPUT && setup->sm_passkey_bit < 20){
-                    if (IS_RESPONDER(connection->sm_role)){
-                        // responder
-                        connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
-                    } else {
-                        // initiator
-                        connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
-                    }
-                } else {
-                    if (IS_RESPONDER(connection->sm_role)){
-                        // responder
-                        if (setup->sm_stk_generation_method == NK_BOTH_INPUT){
-                            connection->sm_engine_state = SM_SC_W2_CALCULATE_G2;
-                        } else {
-                            sm_sc_prepare_dhkey_check(connection);
-                        }
-                    } else {
-                        // initiator
-                        connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
-                    }
-                }
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                break;
-            }
-            case SM_SC_SEND_DHKEY_CHECK_COMMAND: {
-                uint8_t buffer[17];
-                buffer[0] = SM_CODE_PAIRING_DHKEY_CHECK;
-                reverse_128(setup->sm_local_dhkey_check, &buffer[1]);
-
-                if (IS_RESPONDER(connection->sm_role)){
-                    connection->sm_engine_state = SM_SC_W4_LTK_REQUEST_SC;
-                } else {
-                    connection->sm_engine_state = SM_SC_W4_DHKEY_CHECK_COMMAND;
-                }
-
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                break;
-            }
-
-#endif
-
-#ifdef ENABLE_LE_PERIPHERAL
-            case SM_RESPONDER_PH1_SEND_PAIRING_RESPONSE:
-                // echo initiator for now
-                sm_pairing_packet_set_code(setup->sm_s_pres,SM_CODE_PAIRING_RESPONSE);
-                key_distribution_flags = sm_key_distribution_flags_for_auth_req();
-
-                if (setup->sm_use_secure_connections){
-                    connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
-                    // skip LTK/EDIV for SC
-                    log_info("sm: dropping encryption information flag");
-                    key_distribution_flags &= ~SM_KEYDIST_ENC_KEY;
-                } else {
-                    connection->sm_engine_state = SM_RESPONDER_PH1_W4_PAIRING_CONFIRM;
-                }
-
-                sm_pairing_packet_set_initiator_key_distribution(setup->sm_s_pres, sm_pairing_packet_get_initiator_key_distribution(setup->sm_m_preq) & key_distribution_flags);
-                sm_pairing_packet_set_responder_key_distribution(setup->sm_s_pres, sm_pairing_packet_get_responder_key_distribution(setup->sm_m_preq) & key_distribution_flags);
-                // update key distribution after ENC was dropped
-                sm_setup_key_distribution(sm_pairing_packet_get_responder_key_distribution(setup->sm_s_pres));
-
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) &setup->sm_s_pres, sizeof(sm_pairing_packet_t));
-                sm_timeout_reset(connection);
-                // SC Numeric Comparison will trigger user response after public keys & nonces have been exchanged
-                if (!setup->sm_use_secure_connections || setup->sm_stk_generation_method == JUST_WORKS){
-                    sm_trigger_user_response(connection);
-                }
-                return;
-#endif
-
-            case SM_PH2_SEND_PAIRING_RANDOM: {
-                uint8_t buffer[17];
-                buffer[0] = SM_CODE_PAIRING_RANDOM;
-                reverse_128(setup->sm_local_random, &buffer[1]);
-                if (IS_RESPONDER(connection->sm_role)){
-                    connection->sm_engine_state = SM_RESPONDER_PH2_W4_LTK_REQUEST;
-                } else {
-                    connection->sm_engine_state = SM_INITIATOR_PH2_W4_PAIRING_RANDOM;
-                }
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                break;
+        int context_released = 0;
+        int i;
+        for (i = 0; i < MAX_NR_SM_SETUP_CONTEXTS; i++){
+            int index = (sm_setup_context_next + i) % MAX_NR_SM_SETUP_CONTEXTS;
+            sm_setup_context_t * context = &sm_setup_contexts[index];
+            if (context->sm_handle == HCI_CON_HANDLE_INVALID) continue;
+
+            sm_connection_t * connection = sm_get_connection_for_handle(context->sm_handle);
+            if (!connection) {
+                log_info("no connection for handle 0x%04x", context->sm_handle);
+                continue;
             }
 
-            case SM_PH2_GET_RANDOM_TK:
-            case SM_PH2_C1_GET_RANDOM_A:
-            case SM_PH2_C1_GET_RANDOM_B:
-            case SM_PH3_GET_RANDOM:
-            case SM_PH3_GET_DIV:
-                sm_next_responding_state(connection);
-                sm_random_start(connection);
-                return;
-
-            case SM_PH2_C1_GET_ENC_B:
-            case SM_PH2_C1_GET_ENC_D:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                sm_next_responding_state(connection);
-                sm_aes128_start(setup->sm_tk, setup->sm_c1_t3_value, connection);
-                return;
-
-            case SM_PH3_LTK_GET_ENC:
-            case SM_RESPONDER_PH4_LTK_GET_ENC:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_IDLE) {
-                    sm_key_t d_prime;
-                    sm_d1_d_prime(setup->sm_local_div, 0, d_prime);
-                    sm_next_responding_state(connection);
-                    sm_aes128_start(sm_persistent_er, d_prime, connection);
-                    return;
-                }
-                break;
-
-            case SM_PH3_CSRK_GET_ENC:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_IDLE) {
-                    sm_key_t d_prime;
-                    sm_d1_d_prime(setup->sm_local_div, 1, d_prime);
-                    sm_next_responding_state(connection);
-                    sm_aes128_start(sm_persistent_er, d_prime, connection);
-                    return;
-                }
-                break;
+            // previous connection might have used the command slot
+            if (!hci_can_send_command_packet_now()) return;
 
-            case SM_PH2_C1_GET_ENC_C:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                // calculate m_confirm using aes128 engine - step 1
-                sm_c1_t1(setup->sm_peer_random, (uint8_t*) &setup->sm_m_preq, (uint8_t*) &setup->sm_s_pres, setup->sm_m_addr_type, setup->sm_s_addr_type, plaintext);
-                sm_next_responding_state(connection);
-                sm_aes128_start(setup->sm_tk, plaintext, connection);
-                break;
-            case SM_PH2_C1_GET_ENC_A:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                // calculate confirm using aes128 engine - step 1
-                sm_c1_t1(setup->sm_local_random, (uint8_t*) &setup->sm_m_preq, (uint8_t*) &setup->sm_s_pres, setup->sm_m_addr_type, setup->sm_s_addr_type, plaintext);
-                sm_next_responding_state(connection);
-                sm_aes128_start(setup->sm_tk, plaintext, connection);
-                break;
-            case SM_PH2_CALC_STK:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                // calculate STK
-                if (IS_RESPONDER(connection->sm_role)){
-                    sm_s1_r_prime(setup->sm_local_random, setup->sm_peer_random, plaintext);
-                } else {
-                    sm_s1_r_prime(setup->sm_peer_random, setup->sm_local_random, plaintext);
-                }
-                sm_next_responding_state(connection);
-                sm_aes128_start(setup->sm_tk, plaintext, connection);
-                break;
-            case SM_PH3_Y_GET_ENC:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                // PH3B2 - calculate Y from      - enc
-                // Y = dm(DHK, Rand)
-                sm_dm_r_prime(setup->sm_local_rand, plaintext);
-                sm_next_responding_state(connection);
-                sm_aes128_start(sm_persistent_dhk, plaintext, connection);
-                return;
-            case SM_PH2_C1_SEND_PAIRING_CONFIRM: {
-                uint8_t buffer[17];
-                buffer[0] = SM_CODE_PAIRING_CONFIRM;
-                reverse_128(setup->sm_local_confirm, &buffer[1]);
-                if (IS_RESPONDER(connection->sm_role)){
-                    connection->sm_engine_state = SM_RESPONDER_PH2_W4_PAIRING_RANDOM;
-                } else {
-                    connection->sm_engine_state = SM_INITIATOR_PH2_W4_PAIRING_CONFIRM;
-                }
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                return;
-            }
-#ifdef ENABLE_LE_PERIPHERAL
-            case SM_RESPONDER_PH2_SEND_LTK_REPLY: {
-                sm_key_t stk_flipped;
-                reverse_128(setup->sm_ltk, stk_flipped);
-                connection->sm_engine_state = SM_PH2_W4_CONNECTION_ENCRYPTED;
-                hci_send_cmd(&hci_le_long_term_key_request_reply, connection->sm_handle, stk_flipped);
-                return;
+            setup = context;
+            int stop = sm_run_active_connection(connection);
+            if (context->sm_handle == HCI_CON_HANDLE_INVALID){
+                context_released = 1;
             }
-            case SM_RESPONDER_PH4_SEND_LTK_REPLY: {
-                sm_key_t ltk_flipped;
-                reverse_128(setup->sm_ltk, ltk_flipped);
-                connection->sm_engine_state = SM_RESPONDER_IDLE;
-                hci_send_cmd(&hci_le_long_term_key_request_reply, connection->sm_handle, ltk_flipped);
-                sm_done_for_handle(connection->sm_handle);
+            if (stop){
+                sm_setup_context_next = (index + 1) % MAX_NR_SM_SETUP_CONTEXTS;
                 return;
             }
-            case SM_RESPONDER_PH4_Y_GET_ENC:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                log_info("LTK Request: recalculating with ediv 0x%04x", setup->sm_local_ediv);
-                // Y = dm(DHK, Rand)
-                sm_dm_r_prime(setup->sm_local_rand, plaintext);
-                sm_next_responding_state(connection);
-                sm_aes128_start(sm_persistent_dhk, plaintext, connection);
-                return;
-#endif
-#ifdef ENABLE_LE_CENTRAL
-            case SM_INITIATOR_PH3_SEND_START_ENCRYPTION: {
-                sm_key_t stk_flipped;
-                reverse_128(setup->sm_ltk, stk_flipped);
-                connection->sm_engine_state = SM_PH2_W4_CONNECTION_ENCRYPTED;
-                hci_send_cmd(&hci_le_start_encryption, connection->sm_handle, 0, 0, 0, stk_flipped);
-                return;
-            }
-#endif
-
-            case SM_PH3_DISTRIBUTE_KEYS:
-                if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_ENCRYPTION_INFORMATION){
-                    setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_ENCRYPTION_INFORMATION;
-                    uint8_t buffer[17];
-                    buffer[0] = SM_CODE_ENCRYPTION_INFORMATION;
-                    reverse_128(setup->sm_ltk, &buffer[1]);
-                    l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                    sm_timeout_reset(connection);
-                    return;
-                }
-                if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_MASTER_IDENTIFICATION){
-                    setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_MASTER_IDENTIFICATION;
-                    uint8_t buffer[11];
-                    buffer[0] = SM_CODE_MASTER_IDENTIFICATION;
-                    little_endian_store_16(buffer, 1, setup->sm_local_ediv);
-                    reverse_64(setup->sm_local_rand, &buffer[3]);
-                    l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                    sm_timeout_reset(connection);
-                    return;
-                }
-                if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_IDENTITY_INFORMATION){
-                    setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_IDENTITY_INFORMATION;
-                    uint8_t buffer[17];
-                    buffer[0] = SM_CODE_IDENTITY_INFORMATION;
-                    reverse_128(sm_persistent_irk, &buffer[1]);
-                    l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                    sm_timeout_reset(connection);
-                    return;
-                }
-                if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_IDENTITY_ADDRESS_INFORMATION){
-                    setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_IDENTITY_ADDRESS_INFORMATION;
-                    bd_addr_t local_address;
-                    uint8_t buffer[8];
-                    buffer[0] = SM_CODE_IDENTITY_ADDRESS_INFORMATION;
-                    switch (gap_random_address_get_mode()){
-                        case GAP_RANDOM_ADDRESS_TYPE_OFF:
-                        case GAP_RANDOM_ADDRESS_TYPE_STATIC:
-                            // public or static random
-                            gap_le_get_own_address(&buffer[1], local_address);
-                            break;
-                        case GAP_RANDOM_ADDRESS_NON_RESOLVABLE:
-                        case GAP_RANDOM_ADDRESS_RESOLVABLE:
-                            // fallback to public
-                            gap_local_bd_addr(local_address);
-                            buffer[1] = 0;
-                            break;
-                    }
-                    reverse_bd_addr(local_address, &buffer[2]);
-                    l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                    sm_timeout_reset(connection);
-                    return;
-                }
-                if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_SIGNING_IDENTIFICATION){
-                    setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_SIGNING_IDENTIFICATION;
-
-                    // hack to reproduce test runs
-                    if (test_use_fixed_local_csrk){
-                        memset(setup->sm_local_csrk, 0xcc, 16);
-                    }
-
-                    uint8_t buffer[17];
-                    buffer[0] = SM_CODE_SIGNING_INFORMATION;
-                    reverse_128(setup->sm_local_csrk, &buffer[1]);
-                    l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                    sm_timeout_reset(connection);
-                    return;
-                }
-
-                // keys are sent
-                if (IS_RESPONDER(connection->sm_role)){
-                    // slave -> receive master keys if any
-                    if (sm_key_distribution_all_received(connection)){
-                        sm_key_distribution_handle_all_received(connection);
-                        connection->sm_engine_state = SM_RESPONDER_IDLE;
-                        sm_done_for_handle(connection->sm_handle);
-                    } else {
-                        connection->sm_engine_state = SM_PH3_RECEIVE_KEYS;
-                    }
-                } else {
-                    // master -> all done
-                    connection->sm_engine_state = SM_INITIATOR_CONNECTED;
-                    sm_done_for_handle(connection->sm_handle);
-                }
-                break;
-
-            default:
-                break;
         }
 
-        // check again if active connection was released
-        if (sm_active_connection_handle != HCI_CON_HANDLE_INVALID) break;
+        // check again if a setup context was released
+        if (!context_released) break;
     }
 }
 
@@ -2822,6 +3018,7 @@ static void sm_handle_encryption_result(uint8_t * data){
     // retrieve sm_connection provided to sm_aes128_start_encryption
     sm_connection_t * connection = (sm_connection_t*) sm_aes128_context;
     if (!connection) return;
+    if (!sm_setup_select(connection)) return;
     switch (connection->sm_engine_state){
         case SM_PH2_C1_W4_ENC_A:
         case SM_PH2_C1_W4_ENC_C:
@@ -2959,9 +3156,13 @@ static int sm_generate_f_rng_mbedtls(void * context, unsigned char * buffer, siz
 // note: random generator is ready. this doesn NOT imply that aes engine is unused!
 static void sm_handle_random_result(uint8_t * data){
 
+    sm_random_active = 0;
+
 #if defined(ENABLE_LE_SECURE_CONNECTIONS) && defined(USE_SOFTWARE_ECDH_IMPLEMENTATION)
 
     if (ec_key_generation_state == EC_KEY_GENERATION_ACTIVE){
+        // key generation runs before any pairing, first setup context is used as scratch
+        setup = &sm_setup_contexts[0];
         int num_bytes = setup->sm_passkey_bit;
         memcpy(&setup->sm_peer_q[num_bytes], data, 8);
         num_bytes += 8;
@@ -3044,6 +3245,7 @@ static void sm_handle_random_result(uint8_t * data){
     // retrieve sm_connection provided to sm_random_start
     sm_connection_t * connection = (sm_connection_t *) sm_random_context;
     if (!connection) return;
+    if (!sm_setup_select(connection)) return;
     switch (connection->sm_engine_state){
 #ifdef ENABLE_LE_SECURE_CONNECTIONS
         case SM_SC_W4_GET_RANDOM_A:
@@ -3143,6 +3345,7 @@ static void sm_event_packet_handler (uint8_t packet_type, uint16_t channel, uint
                         dkg_state = sm_persistent_irk_ready ? DKG_CALC_DHK : DKG_CALC_IRK;
 #ifdef ENABLE_LE_SECURE_CONNECTIONS
                         if (!sm_have_ec_keypair){
+                            setup = &sm_setup_contexts[0];
                             setup->sm_passkey_bit = 0;
                             ec_key_generation_state = EC_KEY_GENERATION_ACTIVE;
                         }
@@ -3276,7 +3479,9 @@ static void sm_event_packet_handler (uint8_t packet_type, uint16_t channel, uint
                             sm_log_ec_keypair();
                             break;
                         case HCI_SUBEVENT_LE_GENERATE_DHKEY_COMPLETE:
-                            sm_conn = sm_get_connection_for_handle(sm_active_connection_handle);
+                            sm_conn = sm_get_connection_for_handle(sm_dhkey_connection_handle);
+                            sm_dhkey_connection_handle = HCI_CON_HANDLE_INVALID;
+                            if (!sm_conn || !sm_setup_select(sm_conn)) break;
                             if (hci_subevent_le_generate_dhkey_complete_get_status(packet)){
                                 log_error("Generate DHKEY failed -> abort");
                                 // abort pairing with 'unspecified reason'
@@ -3310,6 +3515,7 @@ static void sm_event_packet_handler (uint8_t packet_type, uint16_t channel, uint
                         sm_conn->sm_actual_encryption_key_size);
                     log_info("event handler, state %u", sm_conn->sm_engine_state);
                     if (!sm_conn->sm_connection_encrypted) break;
+                    sm_setup_select(sm_conn);
                     // continue if part of initial pairing
                     switch (sm_conn->sm_engine_state){
                         case SM_INITIATOR_PH0_W4_CONNECTION_ENCRYPTED:
@@ -3510,9 +3716,13 @@ static void sm_pdu_handler(uint8_t packet_type, hci_con_handle_t con_handle, uin
 
     if (sm_pdu_code == SM_CODE_PAIRING_FAILED){
         sm_conn->sm_engine_state = sm_conn->sm_role ? SM_RESPONDER_IDLE : SM_INITIATOR_CONNECTED;
+        sm_done_for_handle(con_handle);
         return;
     }
 
+    // states that access the setup context are only reached with a setup context assigned
+    sm_setup_select(sm_conn);
+
     log_debug("sm_pdu_handler: state %u, pdu 0x%02x", sm_conn->sm_engine_state, sm_pdu_code);
 
     int err;
@@ -3991,13 +4201,13 @@ void sm_init(void){
     sm_address_resolution_general_queue = NULL;
 
     gap_random_adress_update_period = 15 * 60 * 1000L;
-    sm_active_connection_handle = HCI_CON_HANDLE_INVALID;
+    sm_setup_contexts_init();
 
     test_use_fixed_local_csrk = 0;
 
     // register for HCI Events from HCI
     hci_event_callback_registration.callback = &sm_event_packet_handler;
-    hci_add_event_handler(&hci_event_callback_registration);
+    hci_add_event_handler_for_events(&hci_event_callback_registration, sm_hci_events, sm_hci_le_subevents);
 
     // and L2CAP PDUs + L2CAP_EVENT_CAN_SEND_NOW
     l2cap_register_fixed_channel(sm_pdu_handler, L2CAP_CID_SECURITY_MANAGER_PROTOCOL);
@@ -4164,6 +4374,7 @@ void sm_authorization_grant(hci_con_handle_t con_handle){
 void sm_bonding_decline(hci_con_handle_t con_handle){
     sm_connection_t * sm_conn = sm_get_connection_for_handle(con_handle);
     if (!sm_conn) return;     // wrong connection
+    if (!sm_setup_select(sm_conn)) return;  // not pairing
     setup->sm_user_response = SM_USER_RESPONSE_DECLINE;
 
     if (sm_conn->sm_engine_state == SM_PH1_W4_USER_RESPONSE){
@@ -4188,6 +4399,7 @@ void sm_bonding_decline(hci_con_handle_t con_handle){
 void sm_just_works_confirm(hci_con_handle_t con_handle){
     sm_connection_t * sm_conn = sm_get_connection_for_handle(con_handle);
     if (!sm_conn) return;     // wrong connection
+    if (!sm_setup_select(sm_conn)) return;  // not pairing
     setup->sm_user_response = SM_USER_RESPONSE_CONFIRM;
     if (sm_conn->sm_engine_state == SM_PH1_W4_USER_RESPONSE){
         if (setup->sm_use_secure_connections){
@@ -4214,6 +4426,7 @@ void sm_numeric_comparison_confirm(hci_con_handle_t con_handle){
 void sm_passkey_input(hci_con_handle_t con_handle, uint32_t passkey){
     sm_connection_t * sm_conn = sm_get_connection_for_handle(con_handle);
     if (!sm_conn) return;     // wrong connection
+    if (!sm_setup_select(sm_conn)) return;  // not pairing
     sm_reset_tk();
     big_endian_store_32(setup->sm_tk, 12, passkey);
     setup->sm_user_response = SM_USER_RESPONSE_PASSKEY;
@@ -4234,6 +4447,7 @@ void sm_keypress_notification(hci_con_handle_t con_handle, uint8_t action){
     sm_connection_t * sm_conn = sm_get_connection_for_handle(con_handle);
     if (!sm_conn) return;     // wrong connection
     if (action > SM_KEYPRESS_PASSKEY_ENTRY_COMPLETED) return;
+    if (!sm_setup_select(sm_conn)) return;  // not pairing
     setup->sm_keypress_notification = action;
     sm_run();
 }
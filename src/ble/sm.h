@@ -230,6 +230,13 @@ void sm_cmac_signed_write_start(const sm_key_t key, uint8_t opcode, uint16_t att
  */
 int sm_address_resolution_lookup(uint8_t addr_type, bd_addr_t addr);
 
+/*
+ * @brief Match address against all bonded devices in one pass
+ * @note Only available with software AES128 (ENABLE_SOFTWARE_AES128) or platform AES128 (HAVE_AES128)
+ * @return index in LE Device DB or -1 if not found
+ */
+int sm_address_resolution_lookup_sync(uint8_t addr_type, bd_addr_t addr);
+
 /**
  * @brief Identify device in LE Device DB.
  * @param handle
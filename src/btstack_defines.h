@@ -221,6 +221,9 @@ typedef uint8_t sm_key_t[16];
 // set global Bluetooth state
 #define BTSTACK_SET_BLUETOOTH_ENABLED                      0x08
 
+// use shared memory for L2CAP and RFCOMM data: param ring_size (32), 0 for default
+#define BTSTACK_OPEN_SHARED_MEMORY                         0x09
+
 // create l2cap channel: param bd_addr(48), psm (16)
 #define L2CAP_CREATE_CHANNEL                               0x20
 
@@ -363,6 +366,16 @@ typedef uint8_t sm_key_t[16];
 // internal - data: event(8)
 #define DAEMON_EVENT_CONNECTION_CLOSED                     0x68
 
+/**
+ * @format 14
+ * @param status
+ * @param ring_size
+ */
+#define DAEMON_EVENT_SHARED_MEMORY_OPENED                  0x6A
+
+// internal - data: event(8), len(8) - L2CAP and RFCOMM data is sent over shared memory again
+#define DAEMON_EVENT_SHARED_MEMORY_RESUMED                 0x6B
+
 // data: event(8), len(8), local_cid(16), credits(8)
 #define DAEMON_EVENT_L2CAP_CREDITS                         0x74
 
@@ -182,3 +182,103 @@ void btstack_linked_list_iterator_remove(btstack_linked_list_iterator_t * it){
     it->prev->next = it->curr;
     it->advance_on_next = 0;
 }
+
+//
+// hash index
+//
+
+static uint16_t btstack_linked_list_index_home(btstack_linked_list_index_t * index, uint16_t key){
+    // keys are usually allocated in sequence, modulo spreads them without collisions
+    return key % index->size;
+}
+
+static uint16_t btstack_linked_list_index_find(btstack_linked_list_index_t * index, uint16_t key){
+    uint16_t pos = btstack_linked_list_index_home(index, key);
+    uint16_t i;
+    for (i = 0; i < index->size; i++){
+        btstack_linked_list_index_entry_t * entry = &index->entries[pos];
+        if (entry->item == NULL) break;
+        if (entry->key == key) return pos;
+        pos++;
+        if (pos == index->size) pos = 0;
+    }
+    return index->size;
+}
+
+void btstack_linked_list_index_init(btstack_linked_list_index_t * index, btstack_linked_list_index_entry_t * entries, uint16_t size){
+    uint16_t i;
+    index->entries  = entries;
+    index->size     = size;
+    index->count    = 0;
+    index->overflow = 0;
+    for (i = 0; i < size; i++){
+        entries[i].item = NULL;
+    }
+}
+
+int btstack_linked_list_index_add(btstack_linked_list_index_t * index, uint16_t key, btstack_linked_item_t * item){
+    if (index->size == 0) {
+        index->overflow = 1;
+        return 0;
+    }
+    uint16_t pos = btstack_linked_list_index_find(index, key);
+    if (pos < index->size){
+        index->entries[pos].item = item;
+        return 1;
+    }
+    // keep one slot free to terminate probing
+    if (index->count + 1 >= index->size){
+        log_info("index %p full, key 0x%04x not added", index, key);
+        index->overflow = 1;
+        return 0;
+    }
+    pos = btstack_linked_list_index_home(index, key);
+    while (index->entries[pos].item){
+        pos++;
+        if (pos == index->size) pos = 0;
+    }
+    index->entries[pos].key  = key;
+    index->entries[pos].item = item;
+    index->count++;
+    return 1;
+}
+
+void btstack_linked_list_index_remove(btstack_linked_list_index_t * index, uint16_t key, btstack_linked_item_t * item){
+    if (index->size == 0) return;
+    uint16_t free_pos = btstack_linked_list_index_find(index, key);
+    if (free_pos == index->size) return;
+    if (index->entries[free_pos].item != item) return;
+    index->entries[free_pos].item = NULL;
+    index->count--;
+    // move following entries of the probe sequence into the free slot if their home position allows it
+    uint16_t pos = free_pos;
+    while (1){
+        pos++;
+        if (pos == index->size) pos = 0;
+        btstack_linked_list_index_entry_t * entry = &index->entries[pos];
+        if (entry->item == NULL) break;
+        uint16_t home = btstack_linked_list_index_home(index, entry->key);
+        // entry can be moved if free_pos is cyclically in [home, pos)
+        int movable;
+        if (home <= pos){
+            movable = (home <= free_pos) && (free_pos < pos);
+        } else {
+            movable = (home <= free_pos) || (free_pos < pos);
+        }
+        if (!movable) continue;
+        index->entries[free_pos] = *entry;
+        entry->item = NULL;
+        free_pos = pos;
+    }
+}
+
+btstack_linked_item_t * btstack_linked_list_index_get(btstack_linked_list_index_t * index, uint16_t key){
+    if (index->size == 0) return NULL;
+    uint16_t pos = btstack_linked_list_index_find(index, key);
+    if (pos == index->size) return NULL;
+    return index->entries[pos].item;
+}
+
+int btstack_linked_list_index_complete(btstack_linked_list_index_t * index){
+    return index->overflow == 0;
+}
@@ -42,6 +42,8 @@
 #ifndef __BTSTACK_LINKED_LIST_H
 #define __BTSTACK_LINKED_LIST_H
 
+#include <stdint.h>
+
 #if defined __cplusplus
 extern "C" {
 #endif
@@ -91,6 +93,34 @@ int             btstack_linked_list_iterator_has_next(btstack_linked_list_iterat
 btstack_linked_item_t * btstack_linked_list_iterator_next(btstack_linked_list_iterator_t * it);
 void            btstack_linked_list_iterator_remove(btstack_linked_list_iterator_t * it);
 
+//
+// hash index for items of a linked list with a unique 16 bit key, e.g. connection handle or channel id.
+// uses linear probing in a table provided by the caller. if the table is full, the item is not added
+// and lookups that miss have to search the list (btstack_linked_list_index_complete returns 0)
+//
+typedef struct {
+    uint16_t                key;
+    btstack_linked_item_t * item;   // NULL if slot is free
+} btstack_linked_list_index_entry_t;
+
+typedef struct {
+    btstack_linked_list_index_entry_t * entries;
+    uint16_t size;
+    uint16_t count;
+    uint8_t  overflow;
+} btstack_linked_list_index_t;
+
+// init index with table of size entries, size can be 0
+void            btstack_linked_list_index_init(btstack_linked_list_index_t * index, btstack_linked_list_index_entry_t * entries, uint16_t size);
+// add/replace item for key, returns 0 if table is full
+int             btstack_linked_list_index_add(btstack_linked_list_index_t * index, uint16_t key, btstack_linked_item_t * item);
+// remove item for key, if key maps to item
+void            btstack_linked_list_index_remove(btstack_linked_list_index_t * index, uint16_t key, btstack_linked_item_t * item);
+// get item for key, or NULL
+btstack_linked_item_t * btstack_linked_list_index_get(btstack_linked_list_index_t * index, uint16_t key);
+// returns 1 if all added items are in the index, i.e. a miss means that there is no item with this key
+int             btstack_linked_list_index_complete(btstack_linked_list_index_t * index);
+
 /* API_END */
 
 void test_linked_list(void);
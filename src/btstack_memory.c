@@ -477,6 +477,45 @@ void btstack_memory_service_record_item_free(service_record_item_t *service_reco
 
 
 
+// MARK: sdp_client_t
+#if !defined(HAVE_MALLOC) && !defined(MAX_NR_SDP_CLIENTS)
+    #if defined(MAX_NO_SDP_CLIENTS)
+        #error "Deprecated MAX_NO_SDP_CLIENTS defined instead of MAX_NR_SDP_CLIENTS. Please update your btstack_config.h to use MAX_NR_SDP_CLIENTS."
+    #else
+        #define MAX_NR_SDP_CLIENTS 0
+    #endif
+#endif
+
+#ifdef MAX_NR_SDP_CLIENTS
+#if MAX_NR_SDP_CLIENTS > 0
+static sdp_client_t sdp_client_storage[MAX_NR_SDP_CLIENTS];
+static btstack_memory_pool_t sdp_client_pool;
+sdp_client_t * btstack_memory_sdp_client_get(void){
+    return (sdp_client_t *) btstack_memory_pool_get(&sdp_client_pool);
+}
+void btstack_memory_sdp_client_free(sdp_client_t *sdp_client){
+    btstack_memory_pool_free(&sdp_client_pool, sdp_client);
+}
+#else
+sdp_client_t * btstack_memory_sdp_client_get(void){
+    return NULL;
+}
+void btstack_memory_sdp_client_free(sdp_client_t *sdp_client){
+    // silence compiler warning about unused parameter in a portable way
+    (void) sdp_client;
+};
+#endif
+#elif defined(HAVE_MALLOC)
+sdp_client_t * btstack_memory_sdp_client_get(void){
+    return (sdp_client_t*) malloc(sizeof(sdp_client_t));
+}
+void btstack_memory_sdp_client_free(sdp_client_t *sdp_client){
+    free(sdp_client);
+}
+#endif
+
+
+
 // MARK: avdtp_stream_endpoint_t
 #if !defined(HAVE_MALLOC) && !defined(MAX_NR_AVDTP_STREAM_ENDPOINTS)
     #if defined(MAX_NO_AVDTP_STREAM_ENDPOINTS)
@@ -632,6 +671,83 @@ void btstack_memory_avrcp_browsing_connection_free(avrcp_browsing_connection_t *
 #endif
 
 
+
+// MARK: goep_client_t
+#if !defined(HAVE_MALLOC) && !defined(MAX_NR_GOEP_CLIENTS)
+    #if defined(MAX_NO_GOEP_CLIENTS)
+        #error "Deprecated MAX_NO_GOEP_CLIENTS defined instead of MAX_NR_GOEP_CLIENTS. Please update your btstack_config.h to use MAX_NR_GOEP_CLIENTS."
+    #else
+        #define MAX_NR_GOEP_CLIENTS 0
+    #endif
+#endif
+
+#ifdef MAX_NR_GOEP_CLIENTS
+#if MAX_NR_GOEP_CLIENTS > 0
+static goep_client_t goep_client_storage[MAX_NR_GOEP_CLIENTS];
+static btstack_memory_pool_t goep_client_pool;
+goep_client_t * btstack_memory_goep_client_get(void){
+    return (goep_client_t *) btstack_memory_pool_get(&goep_client_pool);
+}
+void btstack_memory_goep_client_free(goep_client_t *goep_client){
+    btstack_memory_pool_free(&goep_client_pool, goep_client);
+}
+#else
+goep_client_t * btstack_memory_goep_client_get(void){
+    return NULL;
+}
+void btstack_memory_goep_client_free(goep_client_t *goep_client){
+    // silence compiler warning about unused parameter in a portable way
+    (void) goep_client;
+};
+#endif
+#elif defined(HAVE_MALLOC)
+goep_client_t * btstack_memory_goep_client_get(void){
+    return (goep_client_t*) malloc(sizeof(goep_client_t));
+}
+void btstack_memory_goep_client_free(goep_client_t *goep_client){
+    free(goep_client);
+}
+#endif
+
+
+// MARK: pbap_client_t
+#if !defined(HAVE_MALLOC) && !defined(MAX_NR_PBAP_CLIENTS)
+    #if defined(MAX_NO_PBAP_CLIENTS)
+        #error "Deprecated MAX_NO_PBAP_CLIENTS defined instead of MAX_NR_PBAP_CLIENTS. Please update your btstack_config.h to use MAX_NR_PBAP_CLIENTS."
+    #else
+        #define MAX_NR_PBAP_CLIENTS 0
+    #endif
+#endif
+
+#ifdef MAX_NR_PBAP_CLIENTS
+#if MAX_NR_PBAP_CLIENTS > 0
+static pbap_client_t pbap_client_storage[MAX_NR_PBAP_CLIENTS];
+static btstack_memory_pool_t pbap_client_pool;
+pbap_client_t * btstack_memory_pbap_client_get(void){
+    return (pbap_client_t *) btstack_memory_pool_get(&pbap_client_pool);
+}
+void btstack_memory_pbap_client_free(pbap_client_t *pbap_client){
+    btstack_memory_pool_free(&pbap_client_pool, pbap_client);
+}
+#else
+pbap_client_t * btstack_memory_pbap_client_get(void){
+    return NULL;
+}
+void btstack_memory_pbap_client_free(pbap_client_t *pbap_client){
+    // silence compiler warning about unused parameter in a portable way
+    (void) pbap_client;
+};
+#endif
+#elif defined(HAVE_MALLOC)
+pbap_client_t * btstack_memory_pbap_client_get(void){
+    return (pbap_client_t*) malloc(sizeof(pbap_client_t));
+}
+void btstack_memory_pbap_client_free(pbap_client_t *pbap_client){
+    free(pbap_client);
+}
+#endif
+
+
 #ifdef ENABLE_BLE
 
 // MARK: gatt_client_t
@@ -784,6 +900,9 @@ void btstack_memory_init(void){
 #if MAX_NR_SERVICE_RECORD_ITEMS > 0
     btstack_memory_pool_create(&service_record_item_pool, service_record_item_storage, MAX_NR_SERVICE_RECORD_ITEMS, sizeof(service_record_item_t));
 #endif
+#if MAX_NR_SDP_CLIENTS > 0
+    btstack_memory_pool_create(&sdp_client_pool, sdp_client_storage, MAX_NR_SDP_CLIENTS, sizeof(sdp_client_t));
+#endif
 #if MAX_NR_AVDTP_STREAM_ENDPOINTS > 0
     btstack_memory_pool_create(&avdtp_stream_endpoint_pool, avdtp_stream_endpoint_storage, MAX_NR_AVDTP_STREAM_ENDPOINTS, sizeof(avdtp_stream_endpoint_t));
 #endif
@@ -796,6 +915,12 @@ void btstack_memory_init(void){
 #if MAX_NR_AVRCP_BROWSING_CONNECTIONS > 0
     btstack_memory_pool_create(&avrcp_browsing_connection_pool, avrcp_browsing_connection_storage, MAX_NR_AVRCP_BROWSING_CONNECTIONS, sizeof(avrcp_browsing_connection_t));
 #endif
+#if MAX_NR_GOEP_CLIENTS > 0
+    btstack_memory_pool_create(&goep_client_pool, goep_client_storage, MAX_NR_GOEP_CLIENTS, sizeof(goep_client_t));
+#endif
+#if MAX_NR_PBAP_CLIENTS > 0
+    btstack_memory_pool_create(&pbap_client_pool, pbap_client_storage, MAX_NR_PBAP_CLIENTS, sizeof(pbap_client_t));
+#endif
 #ifdef ENABLE_BLE
 #if MAX_NR_GATT_CLIENTS > 0
     btstack_memory_pool_create(&gatt_client_pool, gatt_client_storage, MAX_NR_GATT_CLIENTS, sizeof(gatt_client_t));
@@ -64,9 +64,12 @@ extern "C" {
 #include "classic/btstack_link_key_db_memory.h"
 #include "classic/rfcomm.h"
 #include "classic/sdp_server.h"
+#include "classic/sdp_client.h"
 #include "classic/avdtp_sink.h"
 #include "classic/avdtp_source.h"
 #include "classic/avrcp.h"
+#include "classic/goep_client.h"
+#include "classic/pbap_client.h"
 
 // BLE
 #ifdef ENABLE_BLE
@@ -119,6 +122,10 @@ void   btstack_memory_hfp_connection_free(hfp_connection_t *hfp_connection);
 service_record_item_t * btstack_memory_service_record_item_get(void);
 void   btstack_memory_service_record_item_free(service_record_item_t *service_record_item);
 
+// sdp_client
+sdp_client_t * btstack_memory_sdp_client_get(void);
+void   btstack_memory_sdp_client_free(sdp_client_t *sdp_client);
+
 // avdtp_stream_endpoint
 avdtp_stream_endpoint_t * btstack_memory_avdtp_stream_endpoint_get(void);
 void   btstack_memory_avdtp_stream_endpoint_free(avdtp_stream_endpoint_t *avdtp_stream_endpoint);
@@ -135,6 +142,12 @@ void   btstack_memory_avrcp_connection_free(avrcp_connection_t *avrcp_connection
 avrcp_browsing_connection_t * btstack_memory_avrcp_browsing_connection_get(void);
 void   btstack_memory_avrcp_browsing_connection_free(avrcp_browsing_connection_t *avrcp_browsing_connection);
 
+// goep_client, pbap_client
+goep_client_t * btstack_memory_goep_client_get(void);
+void   btstack_memory_goep_client_free(goep_client_t *goep_client);
+pbap_client_t * btstack_memory_pbap_client_get(void);
+void   btstack_memory_pbap_client_free(pbap_client_t *pbap_client);
+
 #ifdef ENABLE_BLE
 // gatt_client, whitelist_entry, sm_lookup_entry
 gatt_client_t * btstack_memory_gatt_client_get(void);
@@ -47,6 +47,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>  // exit()
+#include <string.h>  // memset
 
 
 #include "btstack_debug.h"
@@ -191,3 +192,234 @@ void btstack_run_loop_init(const btstack_run_loop_t * run_loop){
     the_run_loop->init();
 }
 
+
+// Timer wheel
+//
+// A timer is stored in the slot of the highest level in which its timeout differs from wheel->now,
+// in the lowest level, each slot only contains timers with identical timeouts. When now enters
+// the range of a slot in a higher level, its timers are moved down (cascaded).
+// Slot lists are kept newest first, so adding is O(1). Removing only scans the slot the timer is in.
+
+#define TIMER_WHEEL_SLOT_MASK      (BTSTACK_TIMER_WHEEL_SLOTS_PER_LEVEL - 1)
+#define TIMER_WHEEL_LIST_OVERFLOW  (BTSTACK_TIMER_WHEEL_NUM_LEVELS * BTSTACK_TIMER_WHEEL_SLOTS_PER_LEVEL)
+#define TIMER_WHEEL_LIST_EXPIRING  (TIMER_WHEEL_LIST_OVERFLOW + 1)
+#define TIMER_WHEEL_LIST_NONE      0xffff
+
+static int btstack_timer_wheel_slot_for_level(uint32_t time, int level){
+    return (time >> (level * BTSTACK_TIMER_WHEEL_LEVEL_BITS)) & TIMER_WHEEL_SLOT_MASK;
+}
+
+// start of slot range in level relative to now
+static uint32_t btstack_timer_wheel_slot_start(uint32_t now, int level, int slot){
+    uint32_t start = 0;
+    int level_shift = (level + 1) * BTSTACK_TIMER_WHEEL_LEVEL_BITS;
+    if (level_shift < 32){
+        start = (now >> level_shift) << level_shift;
+    }
+    return start | ((uint32_t) slot << (level * BTSTACK_TIMER_WHEEL_LEVEL_BITS));
+}
+
+static btstack_linked_item_t * btstack_timer_wheel_reverse(btstack_linked_item_t * it){
+    btstack_linked_item_t * reversed = NULL;
+    while (it){
+        btstack_linked_item_t * next = it->next;
+        it->next = reversed;
+        reversed = it;
+        it = next;
+    }
+    return reversed;
+}
+
+static void btstack_timer_wheel_insert(btstack_timer_wheel_t * wheel, btstack_timer_source_t * ts){
+    uint16_t list;
+    int32_t delta = (int32_t)(ts->timeout - wheel->now);
+    if (delta < 0){
+        // already expired, process with timers for now
+        int slot = btstack_timer_wheel_slot_for_level(wheel->now, 0);
+        wheel->occupied[0] |= 1u << slot;
+        list = slot;
+    } else if (ts->timeout < wheel->now){
+        // after 32-bit wrap-around
+        list = TIMER_WHEEL_LIST_OVERFLOW;
+    } else {
+        int level = 0;
+        uint32_t diff = (ts->timeout ^ wheel->now) >> BTSTACK_TIMER_WHEEL_LEVEL_BITS;
+        while (diff){
+            level++;
+            diff >>= BTSTACK_TIMER_WHEEL_LEVEL_BITS;
+        }
+        int slot = btstack_timer_wheel_slot_for_level(ts->timeout, level);
+        wheel->occupied[level] |= 1u << slot;
+        list = level * BTSTACK_TIMER_WHEEL_SLOTS_PER_LEVEL + slot;
+    }
+    ts->wheel_slot = list;
+    ts->item.next  = wheel->lists[list];
+    wheel->lists[list] = (btstack_linked_item_t *) ts;
+}
+
+// re-insert timers in order they have been added
+static void btstack_timer_wheel_reinsert(btstack_timer_wheel_t * wheel, btstack_linked_item_t * newest_first){
+    btstack_linked_item_t * it = btstack_timer_wheel_reverse(newest_first);
+    while (it){
+        btstack_linked_item_t * next = it->next;
+        btstack_timer_wheel_insert(wheel, (btstack_timer_source_t *) it);
+        it = next;
+    }
+}
+
+static btstack_linked_item_t * btstack_timer_wheel_take_slot(btstack_timer_wheel_t * wheel, int level, int slot){
+    int list = level * BTSTACK_TIMER_WHEEL_SLOTS_PER_LEVEL + slot;
+    btstack_linked_item_t * it = wheel->lists[list];
+    wheel->lists[list] = NULL;
+    wheel->occupied[level] &= ~(1u << slot);
+    return it;
+}
+
+// find first occupied slot. returns level or -1 if wheel is empty
+static int btstack_timer_wheel_first_slot(btstack_timer_wheel_t * wheel, int * slot){
+    int level;
+    for (level = 0; level < BTSTACK_TIMER_WHEEL_NUM_LEVELS; level++){
+        // slot for now in higher levels has been cascaded already
+        int first = btstack_timer_wheel_slot_for_level(wheel->now, level) + (level ? 1 : 0);
+        uint32_t occupied = wheel->occupied[level] >> first;
+        if (!occupied) continue;
+        while ((occupied & 1) == 0){
+            occupied >>= 1;
+            first++;
+        }
+        *slot = first;
+        return level;
+    }
+    return -1;
+}
+
+// move now forward, all timers before time must have been processed
+static void btstack_timer_wheel_advance(btstack_timer_wheel_t * wheel, uint32_t time){
+    uint32_t diff = wheel->now ^ time;
+    wheel->now = time;
+    int level;
+    for (level = BTSTACK_TIMER_WHEEL_NUM_LEVELS - 1; level > 0; level--){
+        if ((diff >> (level * BTSTACK_TIMER_WHEEL_LEVEL_BITS)) == 0) continue;
+        int slot = btstack_timer_wheel_slot_for_level(time, level);
+        btstack_timer_wheel_reinsert(wheel, btstack_timer_wheel_take_slot(wheel, level, slot));
+    }
+}
+
+// process timers until time, time >= now
+static void btstack_timer_wheel_expire_until(btstack_timer_wheel_t * wheel, uint32_t time){
+    while (1){
+        int slot;
+        int level = btstack_timer_wheel_first_slot(wheel, &slot);
+        if (level < 0){
+            btstack_timer_wheel_advance(wheel, time);
+            return;
+        }
+        uint32_t slot_start = btstack_timer_wheel_slot_start(wheel->now, level, slot);
+        if (slot_start > time){
+            btstack_timer_wheel_advance(wheel, time);
+            return;
+        }
+        if (slot_start > wheel->now){
+            btstack_timer_wheel_advance(wheel, slot_start);
+        }
+        if (level > 0) continue;
+
+        // process timers in slot in order they have been added
+        btstack_linked_item_t * it;
+        wheel->lists[TIMER_WHEEL_LIST_EXPIRING] = btstack_timer_wheel_reverse(btstack_timer_wheel_take_slot(wheel, 0, slot));
+        for (it = wheel->lists[TIMER_WHEEL_LIST_EXPIRING]; it ; it = it->next){
+            ((btstack_timer_source_t *) it)->wheel_slot = TIMER_WHEEL_LIST_EXPIRING;
+        }
+        while (wheel->lists[TIMER_WHEEL_LIST_EXPIRING]){
+            btstack_timer_source_t * ts = (btstack_timer_source_t *) wheel->lists[TIMER_WHEEL_LIST_EXPIRING];
+            wheel->lists[TIMER_WHEEL_LIST_EXPIRING] = ts->item.next;
+            ts->wheel_slot = TIMER_WHEEL_LIST_NONE;
+            ts->process(ts);
+        }
+    }
+}
+
+void btstack_timer_wheel_init(btstack_timer_wheel_t * wheel, uint32_t now){
+    memset(wheel, 0, sizeof(btstack_timer_wheel_t));
+    wheel->now = now;
+}
+
+void btstack_timer_wheel_add(btstack_timer_wheel_t * wheel, btstack_timer_source_t * ts){
+    // don't add timer that's already in there
+    if (ts->wheel_slot < BTSTACK_TIMER_WHEEL_NUM_LISTS){
+        btstack_linked_item_t * it;
+        for (it = wheel->lists[ts->wheel_slot]; it ; it = it->next){
+            if (it == (btstack_linked_item_t *) ts){
+                log_error( "btstack_run_loop_timer_add error: timer to add already in list!");
+                return;
+            }
+        }
+    }
+    btstack_timer_wheel_insert(wheel, ts);
+}
+
+int btstack_timer_wheel_remove(btstack_timer_wheel_t * wheel, btstack_timer_source_t * ts){
+    uint16_t list = ts->wheel_slot;
+    if (list >= BTSTACK_TIMER_WHEEL_NUM_LISTS) return -1;
+    if (btstack_linked_list_remove(&wheel->lists[list], (btstack_linked_item_t *) ts) < 0) return -1;
+    ts->wheel_slot = TIMER_WHEEL_LIST_NONE;
+    if (list < TIMER_WHEEL_LIST_OVERFLOW && wheel->lists[list] == NULL){
+        wheel->occupied[list / BTSTACK_TIMER_WHEEL_SLOTS_PER_LEVEL] &= ~(1u << (list & TIMER_WHEEL_SLOT_MASK));
+    }
+    return 0;
+}
+
+int btstack_timer_wheel_get_next_timeout(btstack_timer_wheel_t * wheel, uint32_t * timeout){
+    btstack_linked_item_t * it;
+    int slot;
+    int level = btstack_timer_wheel_first_slot(wheel, &slot);
+    if (level == 0){
+        *timeout = btstack_timer_wheel_slot_start(wheel->now, 0, slot);
+        return 1;
+    }
+    if (level > 0){
+        it = wheel->lists[level * BTSTACK_TIMER_WHEEL_SLOTS_PER_LEVEL + slot];
+    } else {
+        it = wheel->lists[TIMER_WHEEL_LIST_OVERFLOW];
+        if (!it) return 0;
+    }
+    // find earliest timer in slot
+    uint32_t next = ((btstack_timer_source_t *) it)->timeout;
+    for (it = it->next; it ; it = it->next){
+        uint32_t ts_timeout = ((btstack_timer_source_t *) it)->timeout;
+        if ((uint32_t)(ts_timeout - wheel->now) < (uint32_t)(next - wheel->now)){
+            next = ts_timeout;
+        }
+    }
+    *timeout = next;
+    return 1;
+}
+
+void btstack_timer_wheel_process_expired(btstack_timer_wheel_t * wheel, uint32_t now){
+    if ((int32_t)(now - wheel->now) < 0) return;
+    if (now < wheel->now){
+        // 32-bit wrap-around: process all remaining timers, then start over with overflow timers
+        btstack_timer_wheel_expire_until(wheel, 0xffffffff);
+        btstack_linked_item_t * overflow = wheel->lists[TIMER_WHEEL_LIST_OVERFLOW];
+        wheel->lists[TIMER_WHEEL_LIST_OVERFLOW] = NULL;
+        wheel->now = 0;
+        btstack_timer_wheel_reinsert(wheel, overflow);
+    }
+    btstack_timer_wheel_expire_until(wheel, now);
+}
+
+void btstack_timer_wheel_dump(btstack_timer_wheel_t * wheel){
+#ifdef ENABLE_LOG_INFO
+    int list;
+    int i = 0;
+    for (list = 0; list < BTSTACK_TIMER_WHEEL_NUM_LISTS; list++){
+        btstack_linked_item_t * it;
+        for (it = wheel->lists[list]; it ; it = it->next){
+            btstack_timer_source_t *ts = (btstack_timer_source_t*) it;
+            log_info("timer %u, timeout %u, slot %u\n", i++, (unsigned int) ts->timeout, list);
+        }
+    }
+#else
+    UNUSED(wheel);
+#endif
+}
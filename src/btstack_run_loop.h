@@ -91,6 +91,8 @@ typedef struct btstack_timer_source {
     // will be called when timer fired
     void  (*process)(struct btstack_timer_source *ts); 
     void * context;
+    // timer wheel slot the timer has been added to, managed by run loop
+    uint16_t wheel_slot;
 } btstack_timer_source_t;
 
 typedef struct btstack_run_loop {
@@ -109,6 +111,60 @@ typedef struct btstack_run_loop {
 
 void btstack_run_loop_timer_dump(void);
 
+// Hierarchical timer wheel used by run loop implementations to manage timers with O(1) add
+// Each level has 16 slots, 8 levels cover the 32-bit timeout range
+#define BTSTACK_TIMER_WHEEL_LEVEL_BITS      4
+#define BTSTACK_TIMER_WHEEL_SLOTS_PER_LEVEL (1 << BTSTACK_TIMER_WHEEL_LEVEL_BITS)
+#define BTSTACK_TIMER_WHEEL_NUM_LEVELS      (32 / BTSTACK_TIMER_WHEEL_LEVEL_BITS)
+// wheel slots + list for timeouts after 32-bit wrap-around + list of timers being expired
+#define BTSTACK_TIMER_WHEEL_NUM_LISTS       (BTSTACK_TIMER_WHEEL_NUM_LEVELS * BTSTACK_TIMER_WHEEL_SLOTS_PER_LEVEL + 2)
+
+typedef struct {
+    // all timers with timeout before now have been processed
+    uint32_t now;
+    // bitmap of non-empty slots per level
+    uint16_t occupied[BTSTACK_TIMER_WHEEL_NUM_LEVELS];
+    btstack_linked_list_t lists[BTSTACK_TIMER_WHEEL_NUM_LISTS];
+} btstack_timer_wheel_t;
+
+/**
+ * @brief Init timer wheel
+ * @param wheel
+ * @param now current time in the unit used for timer timeouts
+ */
+void btstack_timer_wheel_init(btstack_timer_wheel_t * wheel, uint32_t now);
+
+/**
+ * @brief Add timer to wheel. Timers with the same timeout expire in the order they have been added.
+ */
+void btstack_timer_wheel_add(btstack_timer_wheel_t * wheel, btstack_timer_source_t * ts);
+
+/**
+ * @brief Remove timer from wheel
+ * @returns 0 if timer was removed, -1 if it was not found
+ */
+int  btstack_timer_wheel_remove(btstack_timer_wheel_t * wheel, btstack_timer_source_t * ts);
+
+/**
+ * @brief Get timeout of next timer
+ * @param wheel
+ * @param timeout
+ * @returns 0 if no timer is active
+ */
+int  btstack_timer_wheel_get_next_timeout(btstack_timer_wheel_t * wheel, uint32_t * timeout);
+
+/**
+ * @brief Remove all timers with timeout before or at now from the wheel and call their process handler in order
+ * @param wheel
+ * @param now
+ */
+void btstack_timer_wheel_process_expired(btstack_timer_wheel_t * wheel, uint32_t now);
+
+/**
+ * @brief Log active timers
+ */
+void btstack_timer_wheel_dump(btstack_timer_wheel_t * wheel);
+
 /* API_START */
 
 /**
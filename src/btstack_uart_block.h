@@ -47,6 +47,9 @@
 
 #include <stdint.h>
 
+// max number of blocks passed to send_blocks
+#define BTSTACK_UART_MAX_BLOCKS 8
+
 typedef struct {
     uint32_t   baudrate;
     int        flowcontrol;
@@ -143,6 +146,16 @@ typedef struct {
      */
     void (*set_wakeup_handler)(void (*wakeup_handler)(void));
 
+    /**
+     * send blocks back to back, e.g. with a single writev(). Block sent callback is called once after all blocks
+     * have been sent. The blocks need to stay valid until then, the arrays can be reused after the call.
+     * NULL if not supported, use send_block instead
+     * @param buffers
+     * @param lengths
+     * @param num_blocks up to BTSTACK_UART_MAX_BLOCKS
+     */
+    void (*send_blocks)(const uint8_t * const * buffers, const uint16_t * lengths, uint8_t num_blocks);
+
 } btstack_uart_block_t;
 
 // common implementations
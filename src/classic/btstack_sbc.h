@@ -80,13 +80,24 @@ typedef struct {
 /* BTstack SBC decoder */
 /**
  * @brief Init SBC decoder
+ * @note With HAVE_MALLOC, each state gets its own decoder and different states can be initialized and used
+ *       concurrently from different threads. Call btstack_sbc_decoder_deinit before calling init on the same state again.
+ *       Without HAVE_MALLOC, up to MAX_NR_SBC_DECODERS decoders are taken from a pool and init and deinit
+ *       need to be called from a single thread.
  * @param state
  * @param mode
  * @param callback for decoded PCM data in host endianess
  * @param context provided in callback
+ * @return status ERROR_CODE_SUCCESS or BTSTACK_MEMORY_ALLOC_FAILED if no decoder is available
  */
 
-void btstack_sbc_decoder_init(btstack_sbc_decoder_state_t * state, btstack_sbc_mode_t mode, void (*callback)(int16_t * data, int num_samples, int num_channels, int sample_rate, void * context), void * context);
+uint8_t btstack_sbc_decoder_init(btstack_sbc_decoder_state_t * state, btstack_sbc_mode_t mode, void (*callback)(int16_t * data, int num_samples, int num_channels, int sample_rate, void * context), void * context);
+
+/**
+ * @brief Release SBC decoder
+ * @param state
+ */
+void btstack_sbc_decoder_deinit(btstack_sbc_decoder_state_t * state);
 
 /**
  * @brief Process received SCO data
@@ -116,6 +127,10 @@ int btstack_sbc_decoder_sample_rate(btstack_sbc_decoder_state_t * state);
 /* BTstack SBC Encoder */
 /**
  * @brief Init SBC encoder
+ * @note With HAVE_MALLOC, each state gets its own encoder and different states can be initialized and used
+ *       concurrently from different threads. Call btstack_sbc_encoder_deinit before calling init on the same state again.
+ *       Without HAVE_MALLOC, up to MAX_NR_SBC_ENCODERS encoders are taken from a pool and init and deinit
+ *       need to be called from a single thread.
  * @param state
  * @param mode 
  * @param blocks
@@ -124,31 +139,42 @@ int btstack_sbc_decoder_sample_rate(btstack_sbc_decoder_state_t * state);
  * @param sample_rate
  * @param bitpool
  * @param channel_mode
+ * @return status ERROR_CODE_SUCCESS or BTSTACK_MEMORY_ALLOC_FAILED if no encoder is available
  */
-void btstack_sbc_encoder_init(btstack_sbc_encoder_state_t * state, btstack_sbc_mode_t mode, 
+uint8_t btstack_sbc_encoder_init(btstack_sbc_encoder_state_t * state, btstack_sbc_mode_t mode, 
                         int blocks, int subbands, int allocation_method, int sample_rate, int bitpool, int channel_mode);
 
+/**
+ * @brief Release SBC encoder
+ * @param state
+ */
+void btstack_sbc_encoder_deinit(btstack_sbc_encoder_state_t * state);
+
 /**
  * @brief Encode PCM data
+ * @param state
  * @param buffer with samples in host endianess
  */
-void btstack_sbc_encoder_process_data(int16_t * input_buffer);
+void btstack_sbc_encoder_process_data(btstack_sbc_encoder_state_t * state, int16_t * input_buffer);
 
 /**
  * @brief Return SBC frame
+ * @param state
  */
-uint8_t * btstack_sbc_encoder_sbc_buffer(void);
+uint8_t * btstack_sbc_encoder_sbc_buffer(btstack_sbc_encoder_state_t * state);
 
 /**
  * @brief Return SBC frame length
+ * @param state
  */
-uint16_t  btstack_sbc_encoder_sbc_buffer_length(void);
+uint16_t  btstack_sbc_encoder_sbc_buffer_length(btstack_sbc_encoder_state_t * state);
 
 /**
  * @brief Return number of audio frames required for one SBC packet
  * @note  each audio frame contains 2 sample values in stereo modes
+ * @param state
  */
-int  btstack_sbc_encoder_num_audio_frames(void);
+int  btstack_sbc_encoder_num_audio_frames(btstack_sbc_encoder_state_t * state);
 
 /* API_END */
 
@@ -64,7 +64,12 @@
 
 #define DECODER_DATA_SIZE (SBC_MAX_CHANNELS*SBC_MAX_BLOCKS*SBC_MAX_BANDS * 4 + SBC_CODEC_MIN_FILTER_BUFFERS*SBC_MAX_BANDS*SBC_MAX_CHANNELS * 2)
 
+#ifndef MAX_NR_SBC_DECODERS
+#define MAX_NR_SBC_DECODERS 1
+#endif
+
 typedef struct {
+    btstack_sbc_decoder_state_t * owner;
     OI_UINT32 bytes_in_frame_buffer;
     OI_CODEC_SBC_DECODER_CONTEXT decoder_context;
     
@@ -77,10 +82,12 @@ typedef struct {
     int search_new_sync_word;
     int sync_word_found;
     int first_good_frame_found; 
+    int frame_count;
 } bludroid_decoder_state_t;
 
-static btstack_sbc_decoder_state_t * sbc_decoder_state_singleton = NULL;
-static bludroid_decoder_state_t bd_decoder_state;
+#ifndef HAVE_MALLOC
+static bludroid_decoder_state_t bd_decoder_states[MAX_NR_SBC_DECODERS];
+#endif
 
 // Testing only - START
 static int plc_enabled = 1;
@@ -137,16 +144,19 @@ static int find_h2_syncword(const OI_BYTE *frame_data, OI_UINT32 frame_bytes){
 
 int btstack_sbc_decoder_num_samples_per_frame(btstack_sbc_decoder_state_t * state){
     bludroid_decoder_state_t * decoder_state = (bludroid_decoder_state_t *) state->decoder_state;
+    if (!decoder_state) return 0;
     return decoder_state->decoder_context.common.frameInfo.nrof_blocks * decoder_state->decoder_context.common.frameInfo.nrof_subbands;
 }
 
 int btstack_sbc_decoder_num_channels(btstack_sbc_decoder_state_t * state){
     bludroid_decoder_state_t * decoder_state = (bludroid_decoder_state_t *) state->decoder_state;
+    if (!decoder_state) return 0;
     return decoder_state->decoder_context.common.frameInfo.nrof_channels;
 }
 
 int btstack_sbc_decoder_sample_rate(btstack_sbc_decoder_state_t * state){
     bludroid_decoder_state_t * decoder_state = (bludroid_decoder_state_t *) state->decoder_state;
+    if (!decoder_state) return 0;
     return decoder_state->decoder_context.common.frameInfo.frequency;
 }
 
@@ -156,18 +166,58 @@ void OI_AssertFail(const char* file, int line, const char* reason){
 }
 #endif
 
-void btstack_sbc_decoder_init(btstack_sbc_decoder_state_t * state, btstack_sbc_mode_t mode, void (*callback)(int16_t * data, int num_samples, int num_channels, int sample_rate, void * context), void * context){
-    if (sbc_decoder_state_singleton && sbc_decoder_state_singleton != state ){
-        log_error("SBC decoder: different sbc decoder state is allready registered");
-    } 
+#ifdef HAVE_MALLOC
+// each state gets its own decoder, malloc can be called from different threads
+static bludroid_decoder_state_t * btstack_sbc_decoder_bluedroid_get(btstack_sbc_decoder_state_t * state){
+    UNUSED(state);
+    return (bludroid_decoder_state_t *) malloc(sizeof(bludroid_decoder_state_t));
+}
+
+static void btstack_sbc_decoder_bluedroid_free(bludroid_decoder_state_t * bd_decoder_state){
+    free(bd_decoder_state);
+}
+#else
+// get decoder assigned to state or a free one, NULL if all are used by other states
+static bludroid_decoder_state_t * btstack_sbc_decoder_bluedroid_get(btstack_sbc_decoder_state_t * state){
+    bludroid_decoder_state_t * free_decoder = NULL;
+    int i;
+    for (i = 0; i < MAX_NR_SBC_DECODERS; i++){
+        if (bd_decoder_states[i].owner == state) return &bd_decoder_states[i];
+        if (bd_decoder_states[i].owner == NULL && free_decoder == NULL){
+            free_decoder = &bd_decoder_states[i];
+        }
+    }
+    return free_decoder;
+}
+
+static void btstack_sbc_decoder_bluedroid_free(bludroid_decoder_state_t * bd_decoder_state){
+    bd_decoder_state->owner = NULL;
+}
+#endif
+
+uint8_t btstack_sbc_decoder_init(btstack_sbc_decoder_state_t * state, btstack_sbc_mode_t mode, void (*callback)(int16_t * data, int num_samples, int num_channels, int sample_rate, void * context), void * context){
+    // start with fresh filter state
+    bludroid_decoder_state_t * bd_decoder_state = btstack_sbc_decoder_bluedroid_get(state);
+    if (!bd_decoder_state){
+#ifdef HAVE_MALLOC
+        log_error("SBC decoder: not enough memory");
+#else
+        log_error("SBC decoder: all %u decoders in use, increase MAX_NR_SBC_DECODERS", MAX_NR_SBC_DECODERS);
+#endif
+        memset(state, 0, sizeof(btstack_sbc_decoder_state_t));
+        return BTSTACK_MEMORY_ALLOC_FAILED;
+    }
+    memset(bd_decoder_state, 0, sizeof(bludroid_decoder_state_t));
+    bd_decoder_state->owner = state;
+
     OI_STATUS status = OI_STATUS_SUCCESS;
     switch (mode){
         case SBC_MODE_STANDARD:
             // note: we always request stereo output, even for mono input
-            status = OI_CODEC_SBC_DecoderReset(&(bd_decoder_state.decoder_context), bd_decoder_state.decoder_data, sizeof(bd_decoder_state.decoder_data), 2, 2, FALSE);
+            status = OI_CODEC_SBC_DecoderReset(&(bd_decoder_state->decoder_context), bd_decoder_state->decoder_data, sizeof(bd_decoder_state->decoder_data), 2, 2, FALSE);
             break;
         case SBC_MODE_mSBC:
-            status = OI_CODEC_mSBC_DecoderReset(&(bd_decoder_state.decoder_context), bd_decoder_state.decoder_data, sizeof(bd_decoder_state.decoder_data));
+            status = OI_CODEC_mSBC_DecoderReset(&(bd_decoder_state->decoder_context), bd_decoder_state->decoder_data, sizeof(bd_decoder_state->decoder_data));
             break;
         default:
             break;
@@ -177,24 +227,32 @@ void btstack_sbc_decoder_init(btstack_sbc_decoder_state_t * state, btstack_sbc_m
         log_error("SBC decoder: error during reset %d\n", status);
     }
     
-    sbc_decoder_state_singleton = state;
-    
-    bd_decoder_state.bytes_in_frame_buffer = 0;
-    bd_decoder_state.pcm_bytes = sizeof(bd_decoder_state.pcm_data);
-    bd_decoder_state.h2_sequence_nr = -1;
-    bd_decoder_state.sync_word_found = 0;
-    bd_decoder_state.search_new_sync_word = 0;
+    bd_decoder_state->bytes_in_frame_buffer = 0;
+    bd_decoder_state->pcm_bytes = sizeof(bd_decoder_state->pcm_data);
+    bd_decoder_state->h2_sequence_nr = -1;
+    bd_decoder_state->sync_word_found = 0;
+    bd_decoder_state->search_new_sync_word = 0;
     if (mode == SBC_MODE_mSBC){
-        bd_decoder_state.search_new_sync_word = 1;
+        bd_decoder_state->search_new_sync_word = 1;
     }
-    bd_decoder_state.first_good_frame_found = 0;
+    bd_decoder_state->first_good_frame_found = 0;
+    bd_decoder_state->frame_count = 0;
 
     memset(state, 0, sizeof(btstack_sbc_decoder_state_t));
     state->handle_pcm_data = callback;
     state->mode = mode;
     state->context = context;
-    state->decoder_state = &bd_decoder_state;
+    state->decoder_state = bd_decoder_state;
     btstack_sbc_plc_init(&state->plc_state);
+    return ERROR_CODE_SUCCESS;
+}
+
+void btstack_sbc_decoder_deinit(btstack_sbc_decoder_state_t * state){
+    bludroid_decoder_state_t * bd_decoder_state = (bludroid_decoder_state_t *) state->decoder_state;
+    if (bd_decoder_state && bd_decoder_state->owner == state){
+        btstack_sbc_decoder_bluedroid_free(bd_decoder_state);
+    }
+    state->decoder_state = NULL;
 }
 
 static void append_received_sbc_data(bludroid_decoder_state_t * state, uint8_t * buffer, int size){
@@ -225,14 +283,13 @@ static void btstack_sbc_decoder_process_sbc_data(btstack_sbc_decoder_state_t * s
         uint16_t bytes_processed = 0;
         const OI_BYTE *frame_data = decoder_state->frame_buffer;
 
-        static int frame_count = 0;
         while (1){
             if (corrupt_frame_period > 0){
-               frame_count++;
+                decoder_state->frame_count++;
 
-                if (frame_count % corrupt_frame_period == 0){
+                if (decoder_state->frame_count % corrupt_frame_period == 0){
                     *(uint8_t*)&frame_data[5] = 0;
-                    frame_count = 0;
+                    decoder_state->frame_count = 0;
                 }
             }
 
@@ -337,13 +394,12 @@ static void btstack_sbc_decoder_process_msbc_data(btstack_sbc_decoder_state_t *
         uint16_t bytes_processed = 0;
         const OI_BYTE *frame_data = decoder_state->frame_buffer;
 
-        static int frame_count = 0;
         if (corrupt_frame_period > 0){
-           frame_count++;
+            decoder_state->frame_count++;
 
-            if (frame_count % corrupt_frame_period == 0){
+            if (decoder_state->frame_count % corrupt_frame_period == 0){
                 *(uint8_t*)&frame_data[5] = 0;
-                frame_count = 0;
+                decoder_state->frame_count = 0;
             }
         }
 
@@ -460,6 +516,10 @@ static void btstack_sbc_decoder_process_msbc_data(btstack_sbc_decoder_state_t *
 }
 
 void btstack_sbc_decoder_process_data(btstack_sbc_decoder_state_t * state, int packet_status_flag, uint8_t * buffer, int size){
+    if (!state->decoder_state){
+        log_error("SBC decoder: call btstack_sbc_decoder_init to initialize it");
+        return;
+    }
     if (state->mode == SBC_MODE_mSBC){
         btstack_sbc_decoder_process_msbc_data(state, packet_status_flag, buffer, size);
     } else {
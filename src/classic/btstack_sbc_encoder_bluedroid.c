@@ -62,75 +62,123 @@
 // #define LOG_FRAME_STATUS
 
 
+#ifndef MAX_NR_SBC_ENCODERS
+#define MAX_NR_SBC_ENCODERS 1
+#endif
+
 typedef struct {
+    btstack_sbc_encoder_state_t * owner;
     SBC_ENC_PARAMS context;
     int num_data_bytes;
     uint8_t sbc_packet[1000];
 } bludroid_encoder_state_t;
 
-static btstack_sbc_encoder_state_t * sbc_encoder_state_singleton = NULL;
-static bludroid_encoder_state_t bd_encoder_state;
+#ifdef HAVE_MALLOC
+// each state gets its own encoder, malloc can be called from different threads
+static bludroid_encoder_state_t * btstack_sbc_encoder_bluedroid_get(btstack_sbc_encoder_state_t * state){
+    UNUSED(state);
+    return (bludroid_encoder_state_t *) malloc(sizeof(bludroid_encoder_state_t));
+}
 
+static void btstack_sbc_encoder_bluedroid_free(bludroid_encoder_state_t * bd_encoder_state){
+    free(bd_encoder_state);
+}
+#else
+static bludroid_encoder_state_t bd_encoder_states[MAX_NR_SBC_ENCODERS];
+
+// get encoder assigned to state or a free one, NULL if all are used by other states
+static bludroid_encoder_state_t * btstack_sbc_encoder_bluedroid_get(btstack_sbc_encoder_state_t * state){
+    bludroid_encoder_state_t * free_encoder = NULL;
+    int i;
+    for (i = 0; i < MAX_NR_SBC_ENCODERS; i++){
+        if (bd_encoder_states[i].owner == state) return &bd_encoder_states[i];
+        if (bd_encoder_states[i].owner == NULL && free_encoder == NULL){
+            free_encoder = &bd_encoder_states[i];
+        }
+    }
+    return free_encoder;
+}
 
-void btstack_sbc_encoder_init(btstack_sbc_encoder_state_t * state, btstack_sbc_mode_t mode, 
-                        int blocks, int subbands, int allmethod, int sample_rate, int bitpool, int channel_mode){
+static void btstack_sbc_encoder_bluedroid_free(bludroid_encoder_state_t * bd_encoder_state){
+    bd_encoder_state->owner = NULL;
+}
+#endif
 
-    if (sbc_encoder_state_singleton && sbc_encoder_state_singleton != state ){
-        log_error("SBC encoder: different sbc decoder state is allready registered");
-    } 
-    
-    sbc_encoder_state_singleton = state;
+uint8_t btstack_sbc_encoder_init(btstack_sbc_encoder_state_t * state, btstack_sbc_mode_t mode, 
+                        int blocks, int subbands, int allmethod, int sample_rate, int bitpool, int channel_mode){
 
-    if (!sbc_encoder_state_singleton){
+    if (!state){
         log_error("SBC encoder init: sbc state is NULL");
+        return ERROR_CODE_UNSPECIFIED_ERROR;
+    }
+
+    bludroid_encoder_state_t * bd_encoder_state = btstack_sbc_encoder_bluedroid_get(state);
+    if (!bd_encoder_state){
+#ifdef HAVE_MALLOC
+        log_error("SBC encoder: not enough memory");
+#else
+        log_error("SBC encoder: all %u encoders in use, increase MAX_NR_SBC_ENCODERS", MAX_NR_SBC_ENCODERS);
+#endif
+        state->encoder_state = NULL;
+        return BTSTACK_MEMORY_ALLOC_FAILED;
     }
+    memset(bd_encoder_state, 0, sizeof(bludroid_encoder_state_t));
+    bd_encoder_state->owner = state;
 
-    sbc_encoder_state_singleton->mode = mode;
+    state->mode = mode;
 
-    switch (sbc_encoder_state_singleton->mode){
+    switch (state->mode){
         case SBC_MODE_STANDARD:
-            bd_encoder_state.context.s16NumOfBlocks = blocks;                          
-            bd_encoder_state.context.s16NumOfSubBands = subbands;                       
-            bd_encoder_state.context.s16AllocationMethod = allmethod;                     
-            bd_encoder_state.context.s16BitPool = bitpool;  
-            bd_encoder_state.context.mSBCEnabled = 0;
-            bd_encoder_state.context.s16ChannelMode = channel_mode;
-            bd_encoder_state.context.s16NumOfChannels = 2;
-            if (bd_encoder_state.context.s16ChannelMode == SBC_MONO){
-                bd_encoder_state.context.s16NumOfChannels = 1;
+            bd_encoder_state->context.s16NumOfBlocks = blocks;                          
+            bd_encoder_state->context.s16NumOfSubBands = subbands;                       
+            bd_encoder_state->context.s16AllocationMethod = allmethod;                     
+            bd_encoder_state->context.s16BitPool = bitpool;  
+            bd_encoder_state->context.mSBCEnabled = 0;
+            bd_encoder_state->context.s16ChannelMode = channel_mode;
+            bd_encoder_state->context.s16NumOfChannels = 2;
+            if (bd_encoder_state->context.s16ChannelMode == SBC_MONO){
+                bd_encoder_state->context.s16NumOfChannels = 1;
             }
             switch(sample_rate){
-                case 16000: bd_encoder_state.context.s16SamplingFreq = SBC_sf16000; break;
-                case 32000: bd_encoder_state.context.s16SamplingFreq = SBC_sf32000; break;
-                case 44100: bd_encoder_state.context.s16SamplingFreq = SBC_sf44100; break;
-                case 48000: bd_encoder_state.context.s16SamplingFreq = SBC_sf48000; break;
-                default: bd_encoder_state.context.s16SamplingFreq = 0; break;
+                case 16000: bd_encoder_state->context.s16SamplingFreq = SBC_sf16000; break;
+                case 32000: bd_encoder_state->context.s16SamplingFreq = SBC_sf32000; break;
+                case 44100: bd_encoder_state->context.s16SamplingFreq = SBC_sf44100; break;
+                case 48000: bd_encoder_state->context.s16SamplingFreq = SBC_sf48000; break;
+                default: bd_encoder_state->context.s16SamplingFreq = 0; break;
             }
             break;
         case SBC_MODE_mSBC:
-            bd_encoder_state.context.s16NumOfBlocks    = 15;
-            bd_encoder_state.context.s16NumOfSubBands  = 8;
-            bd_encoder_state.context.s16AllocationMethod = SBC_LOUDNESS;
-            bd_encoder_state.context.s16BitPool   = 26;
-            bd_encoder_state.context.s16ChannelMode = SBC_MONO;
-            bd_encoder_state.context.s16NumOfChannels = 1;
-            bd_encoder_state.context.mSBCEnabled = 1;
-            bd_encoder_state.context.s16SamplingFreq = SBC_sf16000;
+            bd_encoder_state->context.s16NumOfBlocks    = 15;
+            bd_encoder_state->context.s16NumOfSubBands  = 8;
+            bd_encoder_state->context.s16AllocationMethod = SBC_LOUDNESS;
+            bd_encoder_state->context.s16BitPool   = 26;
+            bd_encoder_state->context.s16ChannelMode = SBC_MONO;
+            bd_encoder_state->context.s16NumOfChannels = 1;
+            bd_encoder_state->context.mSBCEnabled = 1;
+            bd_encoder_state->context.s16SamplingFreq = SBC_sf16000;
             break;
     }
-    bd_encoder_state.context.pu8Packet = bd_encoder_state.sbc_packet;
+    bd_encoder_state->context.pu8Packet = bd_encoder_state->sbc_packet;
     
-    sbc_encoder_state_singleton->encoder_state = &bd_encoder_state;
-    SBC_ENC_PARAMS * context = &((bludroid_encoder_state_t *)sbc_encoder_state_singleton->encoder_state)->context;
-    SBC_Encoder_Init(context);
+    state->encoder_state = bd_encoder_state;
+    SBC_Encoder_Init(&bd_encoder_state->context);
+    return ERROR_CODE_SUCCESS;
 }
 
+void btstack_sbc_encoder_deinit(btstack_sbc_encoder_state_t * state){
+    bludroid_encoder_state_t * bd_encoder_state = (bludroid_encoder_state_t *) state->encoder_state;
+    if (bd_encoder_state && bd_encoder_state->owner == state){
+        btstack_sbc_encoder_bluedroid_free(bd_encoder_state);
+    }
+    state->encoder_state = NULL;
+}
 
-void btstack_sbc_encoder_process_data(int16_t * input_buffer){
-    if (!sbc_encoder_state_singleton){
-        log_error("SBC encoder: sbc state is NULL, call btstack_sbc_encoder_init to initialize it");
+void btstack_sbc_encoder_process_data(btstack_sbc_encoder_state_t * state, int16_t * input_buffer){
+    if (!state->encoder_state){
+        log_error("SBC encoder: call btstack_sbc_encoder_init to initialize it");
+        return;
     }
-    SBC_ENC_PARAMS * context = &((bludroid_encoder_state_t *)sbc_encoder_state_singleton->encoder_state)->context;
+    SBC_ENC_PARAMS * context = &((bludroid_encoder_state_t *)state->encoder_state)->context;
     context->ps16PcmBuffer = input_buffer;
     if (context->mSBCEnabled){
         context->pu8Packet[0] = 0xad;
@@ -138,17 +186,20 @@ void btstack_sbc_encoder_process_data(int16_t * input_buffer){
     SBC_Encoder(context);
 }
 
-int btstack_sbc_encoder_num_audio_frames(void){
-    SBC_ENC_PARAMS * context = &((bludroid_encoder_state_t *)sbc_encoder_state_singleton->encoder_state)->context;
+int btstack_sbc_encoder_num_audio_frames(btstack_sbc_encoder_state_t * state){
+    if (!state->encoder_state) return 0;
+    SBC_ENC_PARAMS * context = &((bludroid_encoder_state_t *)state->encoder_state)->context;
     return context->s16NumOfSubBands * context->s16NumOfBlocks;
 }
 
-uint8_t * btstack_sbc_encoder_sbc_buffer(void){
-    SBC_ENC_PARAMS * context = &((bludroid_encoder_state_t *)sbc_encoder_state_singleton->encoder_state)->context;
+uint8_t * btstack_sbc_encoder_sbc_buffer(btstack_sbc_encoder_state_t * state){
+    if (!state->encoder_state) return NULL;
+    SBC_ENC_PARAMS * context = &((bludroid_encoder_state_t *)state->encoder_state)->context;
     return context->pu8Packet;
 }
 
-uint16_t  btstack_sbc_encoder_sbc_buffer_length(void){
-    SBC_ENC_PARAMS * context = &((bludroid_encoder_state_t *)sbc_encoder_state_singleton->encoder_state)->context;
+uint16_t  btstack_sbc_encoder_sbc_buffer_length(btstack_sbc_encoder_state_t * state){
+    if (!state->encoder_state) return 0;
+    SBC_ENC_PARAMS * context = &((bludroid_encoder_state_t *)state->encoder_state)->context;
     return context->u16PacketLength;
 }
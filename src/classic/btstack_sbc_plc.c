@@ -51,14 +51,14 @@
 
 #define SAMPLE_FORMAT int16_t
 
-static uint8_t indices0[] = { 0xad, 0x00, 0x00, 0xc5, 0x00, 0x00, 0x00, 0x00, 0x77, 0x6d,
+static const uint8_t indices0[] = { 0xad, 0x00, 0x00, 0xc5, 0x00, 0x00, 0x00, 0x00, 0x77, 0x6d,
 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6d, 0xdd, 0xb6, 0xdb, 0x77, 0x6d,
 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6d, 0xdd, 0xb6, 0xdb, 0x77, 0x6d,
 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6d, 0xdd, 0xb6, 0xdb, 0x77, 0x6d,
 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6c};
 
 /* Raised COSine table for OLA */
-static float rcos[SBC_OLAL] = {
+static const float rcos[SBC_OLAL] = {
     0.99148655f,0.96623611f,0.92510857f,0.86950446f,
     0.80131732f,0.72286918f,0.63683150f,0.54613418f, 
     0.45386582f,0.36316850f,0.27713082f,0.19868268f, 
@@ -142,8 +142,8 @@ static SAMPLE_FORMAT crop_sample(float val){
     return (SAMPLE_FORMAT) croped_val;
 }
 
-uint8_t * btstack_sbc_plc_zero_signal_frame(void){
-    return (uint8_t *)&indices0;
+const uint8_t * btstack_sbc_plc_zero_signal_frame(void){
+    return indices0;
 }
 
 void btstack_sbc_plc_init(btstack_sbc_plc_state_t *plc_state){
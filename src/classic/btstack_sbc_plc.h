@@ -67,7 +67,7 @@ typedef struct sbc_plc_state {
 void btstack_sbc_plc_init(btstack_sbc_plc_state_t *plc_state);
 void btstack_sbc_plc_bad_frame(btstack_sbc_plc_state_t *plc_state, int16_t *ZIRbuf, int16_t *out); 
 void btstack_sbc_plc_good_frame(btstack_sbc_plc_state_t *plc_state, int16_t *in, int16_t *out);
-uint8_t * btstack_sbc_plc_zero_signal_frame(void);
+const uint8_t * btstack_sbc_plc_zero_signal_frame(void);
 
 #if defined __cplusplus
 }
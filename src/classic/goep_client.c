@@ -48,43 +48,67 @@
 #include "hci_dump.h"
 #include "bluetooth_sdp.h"
 #include "btstack_event.h"
+#include "btstack_memory.h"
 #include "classic/goep_client.h"
 #include "classic/obex.h"
-#include "classic/obex_iterator.h"
 #include "classic/rfcomm.h"
-#include "classic/sdp_client_rfcomm.h"
+#include "classic/sdp_client.h"
+#include "classic/sdp_util.h"
 
 //------------------------------------------------------------------------------------------------------------
 // goep_client.c
 //
 
-typedef enum {
-    GOEP_INIT,
-    GOEP_W4_SDP,
-    GOEP_W4_CONNECTION,
-    GOEP_CONNECTED,
-} goep_state_t;
-
-typedef struct {
-    uint16_t         cid;
-    goep_state_t     state;
-    bd_addr_t        bd_addr;
-    hci_con_handle_t con_handle;
-    uint8_t          incoming;
-    uint8_t          bearer_l2cap;
-    uint16_t         bearer_port;   // l2cap: psm, rfcomm: channel nr
-    uint16_t         bearer_cid;
-    uint16_t         bearer_mtu;
-
-    uint8_t          obex_opcode;
-    uint32_t         obex_connection_id;
-    int              obex_connection_id_set;
-
-    btstack_packet_handler_t client_handler;
-} goep_client_t;
-
-static goep_client_t _goep_client;
-static goep_client_t * goep_client = &_goep_client;
+static btstack_linked_list_t goep_clients;
+static uint16_t goep_client_cid_counter;
+
+// attribute id list: protocol descriptor list
+static const uint8_t goep_client_sdp_attribute_id_list[] = { 0x35, 0x03, 0x09, 0x00, 0x04 };
+
+static uint16_t goep_client_get_next_cid(void){
+    goep_client_cid_counter++;
+    if (goep_client_cid_counter == 0){
+        goep_client_cid_counter = 1;
+    }
+    return goep_client_cid_counter;
+}
+
+static goep_client_t * goep_client_for_cid(uint16_t goep_cid){
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &goep_clients);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        goep_client_t * context = (goep_client_t *) btstack_linked_list_iterator_next(&it);
+        if (context->cid == goep_cid) return context;
+    }
+    return NULL;
+}
+
+static goep_client_t * goep_client_for_bearer_cid(uint16_t bearer_cid){
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &goep_clients);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        goep_client_t * context = (goep_client_t *) btstack_linked_list_iterator_next(&it);
+        if (context->state < GOEP_W4_CONNECTION) continue;
+        if (context->bearer_cid == bearer_cid) return context;
+    }
+    return NULL;
+}
+
+static goep_client_t * goep_client_for_sdp_query_id(uint16_t sdp_query_id){
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &goep_clients);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        goep_client_t * context = (goep_client_t *) btstack_linked_list_iterator_next(&it);
+        if (context->state != GOEP_W4_SDP) continue;
+        if (context->sdp_query_id == sdp_query_id) return context;
+    }
+    return NULL;
+}
+
+static void goep_client_finalize(goep_client_t * context){
+    btstack_linked_list_remove(&goep_clients, (btstack_linked_item_t *) context);
+    btstack_memory_goep_client_free(context);
+}
 
 static inline void goep_client_emit_connected_event(goep_client_t * context, uint8_t status){
     uint8_t event[22];
@@ -131,73 +155,149 @@ static inline void goep_client_emit_can_send_now_event(goep_client_t * context){
     context->client_handler(HCI_EVENT_PACKET, context->cid, &event[0], pos);
 }   
 
+// emit connection opened event with error and free instance
+static void goep_client_handle_connection_failed(goep_client_t * context, uint8_t status){
+    context->state = GOEP_INIT;
+    goep_client_emit_connected_event(context, status);
+    goep_client_finalize(context);
+}
+
 static void goep_client_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
-    UNUSED(channel);
-    UNUSED(size);
+    goep_client_t * context;
     uint8_t status;
     switch (packet_type){
         case HCI_EVENT_PACKET:
             switch (hci_event_packet_get_type(packet)) {
                 case RFCOMM_EVENT_CHANNEL_OPENED:
+                    context = goep_client_for_bearer_cid(rfcomm_event_channel_opened_get_rfcomm_cid(packet));
+                    if (!context) break;
                     status = rfcomm_event_channel_opened_get_status(packet);
                     if (status) {
-                        log_info("goep_client: RFCOMM channel open failed, status %u", rfcomm_event_channel_opened_get_status(packet));
-                        goep_client->state = GOEP_INIT;
-                    } else {
-                        goep_client->bearer_mtu = rfcomm_event_channel_opened_get_max_frame_size(packet);
-                        log_info("goep_client: RFCOMM channel open succeeded. cid %u, max frame size %u", goep_client->bearer_cid, goep_client->bearer_mtu);
-                        goep_client->state = GOEP_CONNECTED;
-                    }                    
-                    goep_client_emit_connected_event(goep_client, status);
-                    return;
+                        log_info("goep_client: RFCOMM channel open failed, status %u", status);
+                        goep_client_handle_connection_failed(context, status);
+                        break;
+                    }
+                    context->con_handle = rfcomm_event_channel_opened_get_con_handle(packet);
+                    context->bearer_mtu = rfcomm_event_channel_opened_get_max_frame_size(packet);
+                    log_info("goep_client: RFCOMM channel open succeeded. cid %u, max frame size %u", context->bearer_cid, context->bearer_mtu);
+                    context->state = GOEP_CONNECTED;
+                    goep_client_emit_connected_event(context, 0);
+                    break;
                 case RFCOMM_EVENT_CAN_SEND_NOW:
-                    goep_client_emit_can_send_now_event(goep_client);
+                    context = goep_client_for_bearer_cid(rfcomm_event_can_send_now_get_rfcomm_cid(packet));
+                    if (!context) break;
+                    goep_client_emit_can_send_now_event(context);
                     break;
-                case RFCOMM_CHANNEL_CLOSED:
-                    goep_client->state = GOEP_INIT;
-                    goep_client_emit_connection_closed_event(goep_client);
+                case RFCOMM_EVENT_CHANNEL_CLOSED:
+                    context = goep_client_for_bearer_cid(rfcomm_event_channel_closed_get_rfcomm_cid(packet));
+                    if (!context) break;
+                    context->state = GOEP_INIT;
+                    goep_client_emit_connection_closed_event(context);
+                    goep_client_finalize(context);
                     break;
                 default:
                     break;
             }
             break;
         case RFCOMM_DATA_PACKET:
-            goep_client->client_handler(GOEP_DATA_PACKET, goep_client->cid, packet, size);
+            context = goep_client_for_bearer_cid(channel);
+            if (!context) break;
+            context->client_handler(GOEP_DATA_PACKET, context->cid, packet, size);
             break;
         default:
             break;
     }
 }
 
-static void goep_client_handle_query_rfcomm_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+static void goep_client_handle_sdp_attribute_value(goep_client_t * context, const uint8_t * packet){
+    des_iterator_t des_list_it;
+    des_iterator_t prot_it;
+
+    if (sdp_event_query_attribute_byte_get_attribute_id(packet) != BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST) return;
+    // use first RFCOMM channel found
+    if (context->bearer_port) return;
+
+    uint16_t attribute_len = sdp_event_query_attribute_byte_get_attribute_length(packet);
+    uint16_t data_offset   = sdp_event_query_attribute_byte_get_data_offset(packet);
+    if (attribute_len > GOEP_CLIENT_SDP_ATTRIBUTE_VALUE_SIZE){
+        if (data_offset == 0){
+            log_error("goep_client: SDP attribute value buffer size exceeded: available %u, required %u", GOEP_CLIENT_SDP_ATTRIBUTE_VALUE_SIZE, attribute_len);
+        }
+        return;
+    }
+    context->sdp_attribute_value[data_offset] = sdp_event_query_attribute_byte_get_data(packet);
+    if ((data_offset + 1) < attribute_len) return;
+
+    // find RFCOMM channel in protocol descriptor list
+    if (de_get_element_type(context->sdp_attribute_value) != DE_DES) return;
+    for (des_iterator_init(&des_list_it, context->sdp_attribute_value); des_iterator_has_more(&des_list_it); des_iterator_next(&des_list_it)) {
+        uint8_t * element;
+        if (des_iterator_get_type(&des_list_it) != DE_DES) continue;
+        des_iterator_init(&prot_it, des_iterator_get_element(&des_list_it));
+        element = des_iterator_get_element(&prot_it);
+        if (de_get_element_type(element) != DE_UUID) continue;
+        if (de_get_uuid32(element) != BLUETOOTH_PROTOCOL_RFCOMM) continue;
+        if (!des_iterator_has_more(&prot_it)) continue;
+        des_iterator_next(&prot_it);
+        element = des_iterator_get_element(&prot_it);
+        if (de_get_element_type(element) != DE_UINT) continue;
+        if (de_get_size_type(element) != DE_SIZE_8) continue;
+        context->bearer_port = element[de_get_header_size(element)];
+        return;
+    }
+}
+
+static void goep_client_handle_sdp_query_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
     UNUSED(packet_type);
-    UNUSED(channel);
     UNUSED(size);
 
-    switch (packet[0]){
-        case SDP_EVENT_QUERY_RFCOMM_SERVICE:
-            goep_client->bearer_port = sdp_event_query_rfcomm_service_get_rfcomm_channel(packet);
+    goep_client_t * context = goep_client_for_sdp_query_id(channel);
+    if (!context) return;
+
+    uint8_t status;
+    switch (hci_event_packet_get_type(packet)){
+        case SDP_EVENT_QUERY_ATTRIBUTE_VALUE:
+            goep_client_handle_sdp_attribute_value(context, packet);
             break;
         case SDP_EVENT_QUERY_COMPLETE:
-            if (sdp_event_query_complete_get_status(packet)){
-                log_info("GOEP client, SDP query failed 0x%02x", sdp_event_query_complete_get_status(packet));
-                goep_client->state = GOEP_INIT;
-                goep_client_emit_connected_event(goep_client, sdp_event_query_complete_get_status(packet));
+            status = sdp_event_query_complete_get_status(packet);
+            if (status){
+                log_info("GOEP client, SDP query failed 0x%02x", status);
+                goep_client_handle_connection_failed(context, status);
                 break;
             } 
-            
-            if (goep_client->bearer_port == 0){
+            if (context->bearer_port == 0){
                 log_info("Remote GOEP RFCOMM Server Channel not found");
-                goep_client->state = GOEP_INIT;
-                goep_client_emit_connected_event(goep_client, ERROR_CODE_UNSUPPORTED_FEATURE_OR_PARAMETER_VALUE);
+                goep_client_handle_connection_failed(context, ERROR_CODE_UNSUPPORTED_FEATURE_OR_PARAMETER_VALUE);
                 break;
             }
-            log_info("Remote GOEP RFCOMM Server Channel: %u", goep_client->bearer_port);
-            rfcomm_create_channel(&goep_client_packet_handler, goep_client->bd_addr, goep_client->bearer_port, &goep_client->bearer_cid);
+            log_info("Remote GOEP RFCOMM Server Channel: %u", context->bearer_port);
+            context->state = GOEP_W4_CONNECTION;
+            status = rfcomm_create_channel(&goep_client_packet_handler, context->bd_addr, context->bearer_port, &context->bearer_cid);
+            if (status){
+                goep_client_handle_connection_failed(context, status);
+            }
+            break;
+        default:
             break;
     }
 }
 
+static uint8_t goep_client_start_sdp_query(goep_client_t * context, uint16_t uuid){
+    // service search pattern: { uuid16 }
+    context->sdp_service_search_pattern[0] = 0x35;
+    context->sdp_service_search_pattern[1] = 0x03;
+    context->sdp_service_search_pattern[2] = 0x19;
+    big_endian_store_16(context->sdp_service_search_pattern, 3, uuid);
+    uint8_t status = sdp_client_query_parallel(&goep_client_handle_sdp_query_event, context->bd_addr,
+        context->sdp_service_search_pattern, goep_client_sdp_attribute_id_list, &context->sdp_query_id);
+    if (status != BTSTACK_MEMORY_ALLOC_FAILED) return status;
+    // no SDP Client instance available, use built-in one. its events are delivered with channel 0
+    context->sdp_query_id = 0;
+    return sdp_client_query(&goep_client_handle_sdp_query_event, context->bd_addr,
+        context->sdp_service_search_pattern, goep_client_sdp_attribute_id_list);
+}
+
 static void goep_client_packet_append(const uint8_t * data, uint16_t len){
      uint8_t * buffer = rfcomm_get_outgoing_buffer();
      uint16_t pos = big_endian_read_16(buffer, 1);
@@ -206,91 +306,107 @@ static void goep_client_packet_append(const uint8_t * data, uint16_t len){
      big_endian_store_16(buffer, 1, pos);
 }
 
-static void goep_client_packet_init(uint16_t goep_cid, uint8_t opcode){
-    UNUSED(goep_cid);
+static void goep_client_packet_init(goep_client_t * context, uint8_t opcode){
     rfcomm_reserve_packet_buffer();
     uint8_t * buffer = rfcomm_get_outgoing_buffer();
     buffer[0] = opcode;
     big_endian_store_16(buffer, 1, 3);
     // store opcode for parsing of response
-    goep_client->obex_opcode = opcode;
+    context->obex_opcode = opcode;
 }
 
-static void goep_client_packet_add_connection_id(uint16_t goep_cid){
-    UNUSED(goep_cid);
+static void goep_client_packet_add_connection_id(goep_client_t * context){
     // add connection_id header if set, must be first header if used
-    if (goep_client->obex_connection_id != OBEX_CONNECTION_ID_INVALID){
+    if (context->obex_connection_id != OBEX_CONNECTION_ID_INVALID){
         uint8_t header[5];
         header[0] = OBEX_HEADER_CONNECTION_ID;
-        big_endian_store_32(header, 1, goep_client->obex_connection_id);
+        big_endian_store_32(header, 1, context->obex_connection_id);
         goep_client_packet_append(&header[0], sizeof(header));
     }
 }
 
 void goep_client_init(void){
-    memset(goep_client, 0, sizeof(goep_client_t));
-    goep_client->state = GOEP_INIT;
-    goep_client->cid = 1;
-    goep_client->obex_connection_id = OBEX_CONNECTION_ID_INVALID;
+    goep_clients = NULL;
+    goep_client_cid_counter = 0;
 }
 
 uint8_t goep_client_create_connection(btstack_packet_handler_t handler, bd_addr_t addr, uint16_t uuid, uint16_t * out_cid){
-    if (goep_client->state != GOEP_INIT) return BTSTACK_MEMORY_ALLOC_FAILED;
-    goep_client->client_handler = handler;
-    goep_client->state = GOEP_W4_SDP;
-    memcpy(goep_client->bd_addr, addr, 6);
-    sdp_client_query_rfcomm_channel_and_name_for_uuid(&goep_client_handle_query_rfcomm_event, goep_client->bd_addr, uuid);
-    *out_cid = goep_client->cid;
+    goep_client_t * context = btstack_memory_goep_client_get();
+    if (!context){
+        log_error("goep_client_create_connection: no memory for GOEP Client instance");
+        return BTSTACK_MEMORY_ALLOC_FAILED;
+    }
+    memset(context, 0, sizeof(goep_client_t));
+    context->cid = goep_client_get_next_cid();
+    context->state = GOEP_W4_SDP;
+    context->client_handler = handler;
+    context->obex_connection_id = OBEX_CONNECTION_ID_INVALID;
+    memcpy(context->bd_addr, addr, 6);
+    btstack_linked_list_add(&goep_clients, (btstack_linked_item_t *) context);
+
+    uint8_t status = goep_client_start_sdp_query(context, uuid);
+    if (status){
+        goep_client_finalize(context);
+        return status;
+    }
+    *out_cid = context->cid;
     return 0;
 }
 
 uint8_t goep_client_disconnect(uint16_t goep_cid){
-    UNUSED(goep_cid);
-    rfcomm_disconnect(goep_client->bearer_cid);
+    goep_client_t * context = goep_client_for_cid(goep_cid);
+    if (!context) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    if (context->state != GOEP_CONNECTED) return BTSTACK_BUSY;
+    rfcomm_disconnect(context->bearer_cid);
     return 0;
 }
 
 void goep_client_set_connection_id(uint16_t goep_cid, uint32_t connection_id){
-    UNUSED(goep_cid);
-    goep_client->obex_connection_id = connection_id;
+    goep_client_t * context = goep_client_for_cid(goep_cid);
+    if (!context) return;
+    context->obex_connection_id = connection_id;
 }
 
 uint8_t goep_client_get_request_opcode(uint16_t goep_cid){
-    UNUSED(goep_cid);
-    return goep_client->obex_opcode;
+    goep_client_t * context = goep_client_for_cid(goep_cid);
+    if (!context) return 0;
+    return context->obex_opcode;
 }
 
 void goep_client_request_can_send_now(uint16_t goep_cid){
-    UNUSED(goep_cid);
-    rfcomm_request_can_send_now_event(goep_client->bearer_cid);
+    goep_client_t * context = goep_client_for_cid(goep_cid);
+    if (!context) return;
+    rfcomm_request_can_send_now_event(context->bearer_cid);
 }
 
 void goep_client_create_connect_request(uint16_t goep_cid, uint8_t obex_version_number, uint8_t flags, uint16_t maximum_obex_packet_length){
-    UNUSED(goep_cid);
-    goep_client_packet_init(goep_cid, OBEX_OPCODE_CONNECT);
+    goep_client_t * context = goep_client_for_cid(goep_cid);
+    if (!context) return;
+    goep_client_packet_init(context, OBEX_OPCODE_CONNECT);
     uint8_t fields[4];
     fields[0] = obex_version_number;
     fields[1] = flags;
-    // workaround: limit OBEX packet len to RFCOMM MTU to avoid handling of fragemented packets
-    maximum_obex_packet_length = btstack_min(maximum_obex_packet_length, goep_client->bearer_mtu);
+    // response packets larger than the RFCOMM MTU are forwarded in fragments
     big_endian_store_16(fields, 2, maximum_obex_packet_length);
     goep_client_packet_append(&fields[0], sizeof(fields));
 }
 
 void goep_client_create_get_request(uint16_t goep_cid){
-    UNUSED(goep_cid);
-    goep_client_packet_init(goep_cid, OBEX_OPCODE_GET | OBEX_OPCODE_FINAL_BIT_MASK);
-    goep_client_packet_add_connection_id(goep_cid);
+    goep_client_t * context = goep_client_for_cid(goep_cid);
+    if (!context) return;
+    goep_client_packet_init(context, OBEX_OPCODE_GET | OBEX_OPCODE_FINAL_BIT_MASK);
+    goep_client_packet_add_connection_id(context);
 }
 
 void goep_client_create_set_path_request(uint16_t goep_cid, uint8_t flags){
-    UNUSED(goep_cid);
-    goep_client_packet_init(goep_cid, OBEX_OPCODE_SETPATH);
+    goep_client_t * context = goep_client_for_cid(goep_cid);
+    if (!context) return;
+    goep_client_packet_init(context, OBEX_OPCODE_SETPATH);
     uint8_t fields[2];
     fields[0] = flags;
     fields[1] = 0;  // reserved
     goep_client_packet_append(&fields[0], sizeof(fields));
-    goep_client_packet_add_connection_id(goep_cid);
+    goep_client_packet_add_connection_id(context);
 }
 
 void goep_client_add_header_target(uint16_t goep_cid, uint16_t length, const uint8_t * target){
@@ -330,8 +446,9 @@ void goep_client_add_header_type(uint16_t goep_cid, const char * type){
 }
 
 int goep_client_execute(uint16_t goep_cid){
-    UNUSED(goep_cid);
+    goep_client_t * context = goep_client_for_cid(goep_cid);
+    if (!context) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
     uint8_t * buffer = rfcomm_get_outgoing_buffer();
     uint16_t pos = big_endian_read_16(buffer, 1);
-    return rfcomm_send_prepared(goep_client->bearer_cid, pos);
+    return rfcomm_send_prepared(context->bearer_cid, pos);
 }
@@ -36,6 +36,7 @@
  */
 
 #ifndef __GOEP_CLIENT_H
+#define __GOEP_CLIENT_H
 
 #if defined __cplusplus
 extern "C" {
@@ -46,7 +47,9 @@ extern "C" {
 #include <stdlib.h>
 #include <string.h>
 
+#include "bluetooth.h"
 #include "btstack_defines.h"
+#include "btstack_linked_list.h"
 
 //------------------------------------------------------------------------------------------------------------
 // goep_client.h
@@ -54,15 +57,54 @@ extern "C" {
 // Communicate with remote OBEX server - General Object Exchange
 //
 
+// size of buffer for SDP Protocol Descriptor List of remote GOEP server
+#ifndef GOEP_CLIENT_SDP_ATTRIBUTE_VALUE_SIZE
+#define GOEP_CLIENT_SDP_ATTRIBUTE_VALUE_SIZE 32
+#endif
+
+typedef enum {
+    GOEP_INIT,
+    GOEP_W4_SDP,
+    GOEP_W4_CONNECTION,
+    GOEP_CONNECTED,
+} goep_state_t;
+
+// GOEP Client instance, one per connection, allocated via btstack_memory
+typedef struct {
+    btstack_linked_item_t item;
+
+    uint16_t         cid;
+    goep_state_t     state;
+    bd_addr_t        bd_addr;
+    hci_con_handle_t con_handle;
+    uint8_t          incoming;
+    uint8_t          bearer_l2cap;
+    uint16_t         bearer_port;   // l2cap: psm, rfcomm: channel nr
+    uint16_t         bearer_cid;
+    uint16_t         bearer_mtu;
+
+    // SDP query for RFCOMM channel
+    uint16_t         sdp_query_id;
+    uint8_t          sdp_service_search_pattern[5];
+    uint8_t          sdp_attribute_value[GOEP_CLIENT_SDP_ATTRIBUTE_VALUE_SIZE];
+
+    uint8_t          obex_opcode;
+    uint32_t         obex_connection_id;
+
+    btstack_packet_handler_t client_handler;
+} goep_client_t;
+
 /* API_START */
 
 /**
  * Setup GOEP Client
+ * @note Each connection uses its own goep_client_t instance allocated via btstack_memory (MAX_NR_GOEP_CLIENTS)
  */
 void    goep_client_init(void);
 
 /*
  * @brief Create GOEP connection to a GEOP server with specified UUID on a remote deivce.
+ * @note OBEX response packets are forwarded as GOEP_DATA_PACKET in fragments as received from the bearer
  * @param handler 
  * @param addr
  * @param uuid
@@ -48,43 +48,68 @@
 
 #include <stdint.h>
 
+#include "btstack_sbc.h"
+
 #if defined __cplusplus
 extern "C" {
 #endif
 
+#define HFP_MSBC_FRAME_SIZE 57
+#define HFP_MSBC_HEADER_H2_SIZE 2
+#define HFP_MSBC_PADDING_SIZE 1
+#define HFP_MSBC_EXTRA_SIZE (HFP_MSBC_HEADER_H2_SIZE + HFP_MSBC_PADDING_SIZE)
+
+typedef struct {
+    // private
+    btstack_sbc_encoder_state_t sbc_encoder_state;
+    int sequence_number;
+    uint8_t buffer[2*(HFP_MSBC_FRAME_SIZE + HFP_MSBC_EXTRA_SIZE)];
+    int buffer_offset;
+} hfp_msbc_state_t;
+
 /* API_START */
 
 /**
- *
+ * @brief Init mSBC encoder, see btstack_sbc_encoder_init
+ * @param state
+ * @return status ERROR_CODE_SUCCESS or BTSTACK_MEMORY_ALLOC_FAILED if no encoder is available
  */
-void hfp_msbc_init(void);
+uint8_t hfp_msbc_init(hfp_msbc_state_t * state);
 
 /**
- *
+ * @brief Release mSBC encoder
+ * @param state
  */
-int  hfp_msbc_num_audio_samples_per_frame(void);
+void hfp_msbc_deinit(hfp_msbc_state_t * state);
 
 /**
- *
+ * @param state
  */
-int  hfp_msbc_can_encode_audio_frame_now(void);
+int  hfp_msbc_num_audio_samples_per_frame(hfp_msbc_state_t * state);
 
 /**
+ * @param state
+ */
+int  hfp_msbc_can_encode_audio_frame_now(hfp_msbc_state_t * state);
+
+/**
+ * @param state
  * @param pcm_samples - complete audio frame of hfp_msbc_num_audio_samples_per_frame int16 samples
  */
-void hfp_msbc_encode_audio_frame(int16_t * pcm_samples);
+void hfp_msbc_encode_audio_frame(hfp_msbc_state_t * state, int16_t * pcm_samples);
 
 /**
- *
+ * @param state
  */
-int  hfp_msbc_num_bytes_in_stream(void);
+int  hfp_msbc_num_bytes_in_stream(hfp_msbc_state_t * state);
 
 /**
  *
+ * @param state
  * @param buffer to store stream
  * @param size num bytes to read from stream
  */
-void hfp_msbc_read_from_stream(uint8_t * buffer, int size);
+void hfp_msbc_read_from_stream(hfp_msbc_state_t * state, uint8_t * buffer, int size);
 
 /* API_END */
 
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define __BTSTACK_FILE__ "obex_parser.c"
+
+#include "btstack_config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "btstack_debug.h"
+#include "btstack_util.h"
+#include "classic/obex.h"
+#include "classic/obex_parser.h"
+
+typedef enum {
+    OBEX_PARSER_STATE_W4_PARAMS = 0,
+    OBEX_PARSER_STATE_W4_HEADER_ID,
+    OBEX_PARSER_STATE_W4_HEADER_LEN,
+    OBEX_PARSER_STATE_W4_HEADER_DATA,
+    OBEX_PARSER_STATE_COMPLETE,
+    OBEX_PARSER_STATE_INVALID,
+} obex_parser_state_t;
+
+void obex_parser_init_for_response(obex_parser_t * obex_parser, uint8_t request_opcode, obex_parser_callback_t callback, void * user_data){
+    memset(obex_parser, 0, sizeof(obex_parser_t));
+    obex_parser->callback = callback;
+    obex_parser->user_data = user_data;
+    obex_parser->request_opcode = request_opcode;
+    obex_parser->state = OBEX_PARSER_STATE_W4_PARAMS;
+    // connect response contains version, flags and max packet length
+    obex_parser->params_size = (request_opcode == OBEX_OPCODE_CONNECT) ? 7 : 3;
+}
+
+// @returns 1 if 'len' more bytes after the current one fit into the packet
+static int obex_parser_fits_into_packet(const obex_parser_t * obex_parser, uint16_t len){
+    return (uint32_t) obex_parser->packet_pos + 1 + len <= obex_parser->packet_size;
+}
+
+static void obex_parser_handle_header_id(obex_parser_t * obex_parser, uint8_t header_id){
+    obex_parser->header_id = header_id;
+    obex_parser->header_pos = 0;
+    obex_parser->header_len_pos = 0;
+    obex_parser->header_total_len = 0;
+    switch (header_id >> 6){
+        case 0:
+        case 1:
+            // 16-bit length info prefixed
+            obex_parser->state = OBEX_PARSER_STATE_W4_HEADER_LEN;
+            break;
+        case 2:
+            // 8-bit value
+            obex_parser->header_total_len = 1;
+            obex_parser->state = OBEX_PARSER_STATE_W4_HEADER_DATA;
+            break;
+        default:
+            // 32-bit value
+            obex_parser->header_total_len = 4;
+            obex_parser->state = OBEX_PARSER_STATE_W4_HEADER_DATA;
+            break;
+    }
+    uint16_t header_bytes = (obex_parser->state == OBEX_PARSER_STATE_W4_HEADER_LEN) ? 2 : obex_parser->header_total_len;
+    if (!obex_parser_fits_into_packet(obex_parser, header_bytes)){
+        obex_parser->state = OBEX_PARSER_STATE_INVALID;
+    }
+}
+
+static void obex_parser_handle_header_len(obex_parser_t * obex_parser, uint8_t data){
+    obex_parser->header_total_len = (obex_parser->header_total_len << 8) | data;
+    obex_parser->header_len_pos++;
+    if (obex_parser->header_len_pos < 2) return;
+    // length includes header id and length field
+    if (obex_parser->header_total_len < 3){
+        obex_parser->state = OBEX_PARSER_STATE_INVALID;
+        return;
+    }
+    obex_parser->header_total_len -= 3;
+    if (!obex_parser_fits_into_packet(obex_parser, obex_parser->header_total_len)){
+        obex_parser->state = OBEX_PARSER_STATE_INVALID;
+        return;
+    }
+    if (obex_parser->header_total_len == 0){
+        (*obex_parser->callback)(obex_parser->user_data, obex_parser->header_id, 0, 0, NULL, 0);
+        obex_parser->state = OBEX_PARSER_STATE_W4_HEADER_ID;
+        return;
+    }
+    obex_parser->state = OBEX_PARSER_STATE_W4_HEADER_DATA;
+}
+
+obex_parser_object_state_t obex_parser_process_data(obex_parser_t * obex_parser, const uint8_t * data_buffer, uint16_t data_len){
+    while ((data_len > 0) && (obex_parser->state < OBEX_PARSER_STATE_COMPLETE)){
+        uint16_t bytes_consumed = 1;
+        switch (obex_parser->state){
+            case OBEX_PARSER_STATE_W4_PARAMS:
+                obex_parser->params[obex_parser->packet_pos] = *data_buffer;
+                if ((obex_parser->packet_pos + 1) < obex_parser->params_size) break;
+                obex_parser->packet_size = big_endian_read_16(obex_parser->params, 1);
+                if (obex_parser->packet_size < obex_parser->params_size){
+                    obex_parser->state = OBEX_PARSER_STATE_INVALID;
+                    break;
+                }
+                obex_parser->state = OBEX_PARSER_STATE_W4_HEADER_ID;
+                break;
+            case OBEX_PARSER_STATE_W4_HEADER_ID:
+                obex_parser_handle_header_id(obex_parser, *data_buffer);
+                break;
+            case OBEX_PARSER_STATE_W4_HEADER_LEN:
+                obex_parser_handle_header_len(obex_parser, *data_buffer);
+                break;
+            case OBEX_PARSER_STATE_W4_HEADER_DATA:
+                bytes_consumed = btstack_min(data_len, obex_parser->header_total_len - obex_parser->header_pos);
+                (*obex_parser->callback)(obex_parser->user_data, obex_parser->header_id, obex_parser->header_total_len,
+                    obex_parser->header_pos, data_buffer, bytes_consumed);
+                obex_parser->header_pos += bytes_consumed;
+                if (obex_parser->header_pos == obex_parser->header_total_len){
+                    obex_parser->state = OBEX_PARSER_STATE_W4_HEADER_ID;
+                }
+                break;
+            default:
+                break;
+        }
+        obex_parser->packet_pos += bytes_consumed;
+        data_buffer += bytes_consumed;
+        data_len    -= bytes_consumed;
+
+        // packet complete after last header
+        if ((obex_parser->state == OBEX_PARSER_STATE_W4_HEADER_ID) && (obex_parser->packet_pos == obex_parser->packet_size)){
+            obex_parser->state = OBEX_PARSER_STATE_COMPLETE;
+        }
+    }
+
+    // more data than announced in packet length
+    if ((data_len > 0) && (obex_parser->state == OBEX_PARSER_STATE_COMPLETE)){
+        log_error("obex_parser: %u bytes after end of packet", data_len);
+        obex_parser->state = OBEX_PARSER_STATE_INVALID;
+    }
+
+    switch (obex_parser->state){
+        case OBEX_PARSER_STATE_COMPLETE:
+            return OBEX_PARSER_OBJECT_STATE_COMPLETE;
+        case OBEX_PARSER_STATE_INVALID:
+            return OBEX_PARSER_OBJECT_STATE_INVALID;
+        default:
+            return OBEX_PARSER_OBJECT_STATE_INCOMPLETE;
+    }
+}
+
+uint8_t obex_parser_get_response_code(const obex_parser_t * obex_parser){
+    return obex_parser->params[0];
+}
+
+int obex_parser_header_store(uint8_t * header_buffer, uint16_t buffer_size, uint16_t total_len, uint16_t data_offset, const uint8_t * data_buffer, uint16_t data_len){
+    if (total_len > buffer_size) return 0;
+    if (data_len == 0) return data_offset == total_len;
+    memcpy(&header_buffer[data_offset], data_buffer, data_len);
+    return (data_offset + data_len) == total_len;
+}
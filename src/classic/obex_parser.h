@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  obex_parser.h
+ *
+ *  Incremental parser for OBEX response packets that may be received in several fragments
+ */
+
+#ifndef __OBEX_PARSER_H
+#define __OBEX_PARSER_H
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* API_START */
+
+/**
+ * Callback for header data
+ * @param user_data provided in obex_parser_init_for_response
+ * @param header_id
+ * @param total_len of header data
+ * @param data_offset of data_buffer in header data
+ * @param data_buffer
+ * @param data_len
+ */
+typedef void (*obex_parser_callback_t)(void * user_data, uint8_t header_id, uint16_t total_len, uint16_t data_offset, const uint8_t * data_buffer, uint16_t data_len);
+
+typedef enum {
+    OBEX_PARSER_OBJECT_STATE_INCOMPLETE,
+    OBEX_PARSER_OBJECT_STATE_COMPLETE,
+    OBEX_PARSER_OBJECT_STATE_INVALID,
+} obex_parser_object_state_t;
+
+typedef struct obex_parser {
+    obex_parser_callback_t callback;
+    void *   user_data;
+    uint8_t  state;
+    uint8_t  request_opcode;
+    uint16_t packet_size;
+    uint16_t packet_pos;
+    // response code, packet length and fields of connect response
+    uint8_t  params[7];
+    uint8_t  params_size;
+    uint8_t  header_id;
+    uint8_t  header_len_pos;
+    uint16_t header_total_len;
+    uint16_t header_pos;
+} obex_parser_t;
+
+/**
+ * Init parser for response packet to a request with given opcode
+ * @param obex_parser
+ * @param request_opcode
+ * @param callback for header data
+ * @param user_data
+ */
+void obex_parser_init_for_response(obex_parser_t * obex_parser, uint8_t request_opcode, obex_parser_callback_t callback, void * user_data);
+
+/**
+ * Process next fragment of the OBEX packet. Data of BODY/END-OF-BODY and other headers is delivered to the
+ * callback as soon as it has been received, the data buffer is not copied.
+ * @param obex_parser
+ * @param data_buffer
+ * @param data_len
+ * @return OBEX_PARSER_OBJECT_STATE_COMPLETE after the last byte of the packet
+ */
+obex_parser_object_state_t obex_parser_process_data(obex_parser_t * obex_parser, const uint8_t * data_buffer, uint16_t data_len);
+
+/**
+ * Get response code of received packet, available after the first byte
+ * @param obex_parser
+ * @return response code
+ */
+uint8_t obex_parser_get_response_code(const obex_parser_t * obex_parser);
+
+/**
+ * Helper to collect header data spread over several callbacks in a buffer
+ * @param header_buffer
+ * @param buffer_size
+ * @param total_len from callback
+ * @param data_offset from callback
+ * @param data_buffer from callback
+ * @param data_len from callback
+ * @return 1 if header is complete and fits into the buffer
+ */
+int obex_parser_header_store(uint8_t * header_buffer, uint16_t buffer_size, uint16_t total_len, uint16_t data_offset, const uint8_t * data_buffer, uint16_t data_len);
+
+/* API_END */
+
+#if defined __cplusplus
+}
+#endif
+#endif
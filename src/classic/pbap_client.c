@@ -72,11 +72,10 @@
 #include "hci_dump.h"
 #include "l2cap.h"
 #include "bluetooth_sdp.h"
-#include "classic/sdp_client_rfcomm.h"
 #include "btstack_event.h"
 
 #include "classic/obex.h"
-#include "classic/obex_iterator.h"
+#include "classic/obex_parser.h"
 #include "classic/goep_client.h"
 #include "classic/pbap_client.h"
 
@@ -85,36 +84,41 @@ uint8_t pbap_uuid[] = { 0x79, 0x61, 0x35, 0xf0, 0xf0, 0xc5, 0x11, 0xd8, 0x09, 0x
 const char * pbap_type = "x-bt/phonebook";
 const char * pbap_name = "pb.vcf";
 
-typedef enum {
-    PBAP_INIT = 0,
-    PBAP_W4_GOEP_CONNECTION,
-    PBAP_W2_SEND_CONNECT_REQUEST,
-    PBAP_W4_CONNECT_RESPONSE,
-    PBAP_CONNECT_RESPONSE_RECEIVED,
-    PBAP_CONNECTED,
-    //
-    PBAP_W2_PULL_PHONE_BOOK,
-    PBAP_W4_PHONE_BOOK,
-    PBAP_W2_SET_PATH_ROOT,
-    PBAP_W4_SET_PATH_ROOT_COMPLETE,
-    PBAP_W2_SET_PATH_ELEMENT,
-    PBAP_W4_SET_PATH_ELEMENT_COMPLETE,
-} pbap_state_t;
+static btstack_linked_list_t pbap_clients;
+static uint16_t pbap_client_cid_counter;
 
-typedef struct pbap_client {
-    pbap_state_t state;
-    uint16_t  cid;
-    bd_addr_t bd_addr;
-    hci_con_handle_t con_handle;
-    uint8_t   incoming;
-    uint16_t  goep_cid;
-    btstack_packet_handler_t client_handler;
-    const char * current_folder;
-    uint16_t set_path_offset;
-} pbap_client_t;
+static uint16_t pbap_client_get_next_cid(void){
+    pbap_client_cid_counter++;
+    if (pbap_client_cid_counter == 0){
+        pbap_client_cid_counter = 1;
+    }
+    return pbap_client_cid_counter;
+}
+
+static pbap_client_t * pbap_client_for_cid(uint16_t pbap_cid){
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &pbap_clients);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        pbap_client_t * context = (pbap_client_t *) btstack_linked_list_iterator_next(&it);
+        if (context->cid == pbap_cid) return context;
+    }
+    return NULL;
+}
 
-static pbap_client_t _pbap_client;
-static pbap_client_t * pbap_client = &_pbap_client;
+static pbap_client_t * pbap_client_for_goep_cid(uint16_t goep_cid){
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &pbap_clients);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        pbap_client_t * context = (pbap_client_t *) btstack_linked_list_iterator_next(&it);
+        if (context->goep_cid == goep_cid) return context;
+    }
+    return NULL;
+}
+
+static void pbap_client_finalize(pbap_client_t * context){
+    btstack_linked_list_remove(&pbap_clients, (btstack_linked_item_t *) context);
+    btstack_memory_pbap_client_free(context);
+}
 
 static inline void pbap_client_emit_connected_event(pbap_client_t * context, uint8_t status){
     uint8_t event[15];
@@ -162,7 +166,33 @@ static inline void pbap_client_emit_operation_complete_event(pbap_client_t * con
     context->client_handler(HCI_EVENT_PACKET, context->cid, &event[0], pos);
 }
 
-static void pbap_handle_can_send_now(void){
+static void pbap_client_parser_callback(void * user_data, uint8_t header_id, uint16_t total_len, uint16_t data_offset, const uint8_t * data_buffer, uint16_t data_len){
+    pbap_client_t * context = (pbap_client_t *) user_data;
+    switch (context->state){
+        case PBAP_W4_CONNECT_RESPONSE:
+            if (header_id != OBEX_HEADER_CONNECTION_ID) break;
+            if (obex_parser_header_store(context->obex_header_buffer, sizeof(context->obex_header_buffer), total_len, data_offset, data_buffer, data_len)){
+                goep_client_set_connection_id(context->goep_cid, big_endian_read_32(context->obex_header_buffer, 0));
+            }
+            break;
+        case PBAP_W4_PHONE_BOOK:
+            if (header_id != OBEX_HEADER_BODY && header_id != OBEX_HEADER_END_OF_BODY) break;
+            if (data_len == 0) break;
+            // forward vCard data as soon as it has been received
+            context->client_handler(PBAP_DATA_PACKET, context->cid, (uint8_t *) data_buffer, data_len);
+            break;
+        default:
+            break;
+    }
+}
+
+static void pbap_client_send_request(pbap_client_t * context){
+    // prepare parser for response before the request is sent
+    obex_parser_init_for_response(&context->obex_parser, goep_client_get_request_opcode(context->goep_cid), &pbap_client_parser_callback, context);
+    goep_client_execute(context->goep_cid);
+}
+
+static void pbap_handle_can_send_now(pbap_client_t * pbap_client){
     uint8_t  path_element[20];
     uint16_t path_element_start;
     uint16_t path_element_len;
@@ -174,7 +204,7 @@ static void pbap_handle_can_send_now(void){
             // state
             pbap_client->state = PBAP_W4_CONNECT_RESPONSE;
             // send packet
-            goep_client_execute(pbap_client->goep_cid);
+            pbap_client_send_request(pbap_client);
             return;
         case PBAP_W2_PULL_PHONE_BOOK:
             goep_client_create_get_request(pbap_client->goep_cid);
@@ -183,7 +213,7 @@ static void pbap_handle_can_send_now(void){
             // state
             pbap_client->state = PBAP_W4_PHONE_BOOK;
             // send packet
-            goep_client_execute(pbap_client->goep_cid);
+            pbap_client_send_request(pbap_client);
             break;
         case PBAP_W2_SET_PATH_ROOT:
             goep_client_create_set_path_request(pbap_client->goep_cid, 1 << 1); // Don’t create directory
@@ -192,7 +222,7 @@ static void pbap_handle_can_send_now(void){
             // state
             pbap_client->state = PBAP_W4_SET_PATH_ROOT_COMPLETE;
             // send packet
-            goep_client_execute(pbap_client->goep_cid);
+            pbap_client_send_request(pbap_client);
             break;
         case PBAP_W2_SET_PATH_ELEMENT:
             // find '/' or '\0'
@@ -201,11 +231,12 @@ static void pbap_handle_can_send_now(void){
                 pbap_client->current_folder[pbap_client->set_path_offset] != '/'){
                 pbap_client->set_path_offset++;              
             }
+            path_element_len = pbap_client->set_path_offset-path_element_start;
             // skip /
             if (pbap_client->current_folder[pbap_client->set_path_offset] == '/'){
                 pbap_client->set_path_offset++;  
             }
-            path_element_len = pbap_client->set_path_offset-path_element_start;
+            path_element_len = btstack_min(path_element_len, sizeof(path_element) - 1);
             memcpy(path_element, &pbap_client->current_folder[path_element_start], path_element_len);
             path_element[path_element_len] = 0;
 
@@ -214,150 +245,179 @@ static void pbap_handle_can_send_now(void){
             // state
             pbap_client->state = PBAP_W4_SET_PATH_ELEMENT_COMPLETE;
             // send packet
-            goep_client_execute(pbap_client->goep_cid);
+            pbap_client_send_request(pbap_client);
             break;
         default:
             break;
     }
 }
 
-static void pbap_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+static void pbap_handle_response(pbap_client_t * pbap_client, uint8_t response_code){
+    switch (pbap_client->state){
+        case PBAP_W4_CONNECT_RESPONSE:
+            if (response_code == OBEX_RESP_SUCCESS){
+                pbap_client->state = PBAP_CONNECTED;
+                pbap_client_emit_connected_event(pbap_client, 0);
+            } else {
+                log_info("pbap: obex connect failed, result 0x%02x", response_code);
+                pbap_client->state = PBAP_INIT;
+                pbap_client_emit_connected_event(pbap_client, OBEX_CONNECT_FAILED);
+                goep_client_disconnect(pbap_client->goep_cid);
+            }
+            break;
+        case PBAP_W4_SET_PATH_ROOT_COMPLETE:
+        case PBAP_W4_SET_PATH_ELEMENT_COMPLETE:
+            if (response_code == OBEX_RESP_SUCCESS){
+                if (pbap_client->current_folder && pbap_client->current_folder[pbap_client->set_path_offset] != '\0'){
+                    pbap_client->state = PBAP_W2_SET_PATH_ELEMENT;
+                    goep_client_request_can_send_now(pbap_client->goep_cid);
+                } else {
+                    pbap_client->state = PBAP_CONNECTED;
+                    pbap_client_emit_operation_complete_event(pbap_client, 0);
+                }
+            } else if (response_code == OBEX_RESP_NOT_FOUND){
+                pbap_client->state = PBAP_CONNECTED;
+                pbap_client_emit_operation_complete_event(pbap_client, OBEX_NOT_FOUND);
+            } else {
+                pbap_client->state = PBAP_CONNECTED;
+                pbap_client_emit_operation_complete_event(pbap_client, OBEX_UNKNOWN_ERROR);
+            }
+            break;
+        case PBAP_W4_PHONE_BOOK:
+            if (response_code == OBEX_RESP_CONTINUE){
+                pbap_client->state = PBAP_W2_PULL_PHONE_BOOK;
+                goep_client_request_can_send_now(pbap_client->goep_cid);                
+            } else if (response_code == OBEX_RESP_SUCCESS){
+                pbap_client->state = PBAP_CONNECTED;
+                pbap_client_emit_operation_complete_event(pbap_client, 0);
+            } else {
+                pbap_client->state = PBAP_CONNECTED;
+                pbap_client_emit_operation_complete_event(pbap_client, OBEX_UNKNOWN_ERROR);
+            }
+            break;
+        default:
+            break;
+    }
+}
 
-    UNUSED(channel); // ok: there is no channel
-    UNUSED(size);    // ok: handling own geop events
+static void pbap_handle_data(pbap_client_t * pbap_client, uint8_t *packet, uint16_t size){
+    switch (pbap_client->state){
+        case PBAP_W4_CONNECT_RESPONSE:
+        case PBAP_W4_SET_PATH_ROOT_COMPLETE:
+        case PBAP_W4_SET_PATH_ELEMENT_COMPLETE:
+        case PBAP_W4_PHONE_BOOK:
+            break;
+        default:
+            return;
+    }
+    // OBEX response might be split over several GOEP data packets
+    switch (obex_parser_process_data(&pbap_client->obex_parser, packet, size)){
+        case OBEX_PARSER_OBJECT_STATE_INCOMPLETE:
+            break;
+        case OBEX_PARSER_OBJECT_STATE_COMPLETE:
+            pbap_handle_response(pbap_client, obex_parser_get_response_code(&pbap_client->obex_parser));
+            break;
+        default:
+            log_error("pbap: invalid OBEX response");
+            pbap_handle_response(pbap_client, OBEX_RESP_BAD_REQUEST);
+            break;
+    }
+}
 
-    obex_iterator_t it;
+static void pbap_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    pbap_client_t * pbap_client;
     uint8_t status;
+
     switch (packet_type){
         case HCI_EVENT_PACKET:
-            switch (hci_event_packet_get_type(packet)) {
-                case HCI_EVENT_GOEP_META:
-                    switch (hci_event_goep_meta_get_subevent_code(packet)){
-                        case GOEP_SUBEVENT_CONNECTION_OPENED:
-                            status = goep_subevent_connection_opened_get_status(packet);
-                            pbap_client->con_handle = goep_subevent_connection_opened_get_con_handle(packet);
-                            pbap_client->incoming = goep_subevent_connection_opened_get_incoming(packet);
-                            goep_subevent_connection_opened_get_bd_addr(packet, pbap_client->bd_addr); 
-                            if (status){
-                                log_info("pbap: connection failed %u", status);
-                                pbap_client->state = PBAP_INIT;
-                                pbap_client_emit_connected_event(pbap_client, status);
-                            } else {
-                                log_info("pbap: connection established");
-                                pbap_client->goep_cid = goep_subevent_connection_opened_get_goep_cid(packet);
-                                pbap_client->state = PBAP_W2_SEND_CONNECT_REQUEST;
-                                goep_client_request_can_send_now(pbap_client->goep_cid);
-                            }
-                            break;
-                        case GOEP_SUBEVENT_CONNECTION_CLOSED:
-                            if (pbap_client->state != PBAP_CONNECTED){
-                                pbap_client_emit_operation_complete_event(pbap_client, OBEX_DISCONNECTED);
-                            }
-                            pbap_client->state = PBAP_INIT;
-                            pbap_client_emit_connection_closed_event(pbap_client);
-                            break;
-                        case GOEP_SUBEVENT_CAN_SEND_NOW:
-                            pbap_handle_can_send_now();
-                            break;
-                    }
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case GOEP_DATA_PACKET:
-            // TODO: handle chunked data
-#if 0
-            obex_dump_packet(goep_client_get_request_opcode(pbap_client->goep_cid), packet, size);
-#endif
-            switch (pbap_client->state){
-                case PBAP_W4_CONNECT_RESPONSE:
-                    for (obex_iterator_init_with_response_packet(&it, goep_client_get_request_opcode(pbap_client->goep_cid), packet, size); obex_iterator_has_more(&it) ; obex_iterator_next(&it)){
-                        uint8_t hi = obex_iterator_get_hi(&it);
-                        if (hi == OBEX_HEADER_CONNECTION_ID){
-                            goep_client_set_connection_id(pbap_client->goep_cid, obex_iterator_get_data_32(&it));
-                        }
-                    }
-                    if (packet[0] == OBEX_RESP_SUCCESS){
-                        pbap_client->state = PBAP_CONNECTED;
-                        pbap_client_emit_connected_event(pbap_client, 0);
-                    } else {
-                        log_info("pbap: obex connect failed, result 0x%02x", packet[0]);
+            if (hci_event_packet_get_type(packet) != HCI_EVENT_GOEP_META) break;
+            // GOEP events are delivered with goep_cid as channel
+            pbap_client = pbap_client_for_goep_cid(channel);
+            if (!pbap_client) break;
+            switch (hci_event_goep_meta_get_subevent_code(packet)){
+                case GOEP_SUBEVENT_CONNECTION_OPENED:
+                    status = goep_subevent_connection_opened_get_status(packet);
+                    pbap_client->con_handle = goep_subevent_connection_opened_get_con_handle(packet);
+                    pbap_client->incoming = goep_subevent_connection_opened_get_incoming(packet);
+                    if (status){
+                        log_info("pbap: connection failed %u", status);
                         pbap_client->state = PBAP_INIT;
-                        pbap_client_emit_connected_event(pbap_client, OBEX_CONNECT_FAILED);
-                    }
-                    break;
-                case PBAP_W4_SET_PATH_ROOT_COMPLETE:
-                case PBAP_W4_SET_PATH_ELEMENT_COMPLETE:
-                    if (packet[0] == OBEX_RESP_SUCCESS){
-                        if (pbap_client->current_folder){
-                            pbap_client->state = PBAP_W2_SET_PATH_ELEMENT;
-                            goep_client_request_can_send_now(pbap_client->goep_cid);
-                        } else {
-                            pbap_client_emit_operation_complete_event(pbap_client, 0);
-                        }
-                    } else if (packet[0] == OBEX_RESP_NOT_FOUND){
-                        pbap_client->state = PBAP_CONNECTED;
-                        pbap_client_emit_operation_complete_event(pbap_client, OBEX_NOT_FOUND);
+                        pbap_client_emit_connected_event(pbap_client, status);
+                        pbap_client_finalize(pbap_client);
                     } else {
-                        pbap_client->state = PBAP_CONNECTED;
-                        pbap_client_emit_operation_complete_event(pbap_client, OBEX_UNKNOWN_ERROR);
+                        log_info("pbap: connection established");
+                        pbap_client->state = PBAP_W2_SEND_CONNECT_REQUEST;
+                        goep_client_request_can_send_now(pbap_client->goep_cid);
                     }
                     break;
-                case PBAP_W4_PHONE_BOOK:
-                    for (obex_iterator_init_with_response_packet(&it, goep_client_get_request_opcode(pbap_client->goep_cid), packet, size); obex_iterator_has_more(&it) ; obex_iterator_next(&it)){
-                        uint8_t hi = obex_iterator_get_hi(&it);
-                        if (hi == OBEX_HEADER_BODY || hi == OBEX_HEADER_END_OF_BODY){
-                            uint16_t     data_len = obex_iterator_get_data_len(&it);
-                            const uint8_t  * data =  obex_iterator_get_data(&it);
-                            pbap_client->client_handler(PBAP_DATA_PACKET, pbap_client->cid, (uint8_t *) data, data_len);
-                        }
-                    }
-                    if (packet[0] == OBEX_RESP_CONTINUE){
-                        pbap_client->state = PBAP_W2_PULL_PHONE_BOOK;
-                        goep_client_request_can_send_now(pbap_client->goep_cid);                
-                    } else if (packet[0] == OBEX_RESP_SUCCESS){
-                        pbap_client->state = PBAP_CONNECTED;
-                        pbap_client_emit_operation_complete_event(pbap_client, 0);
+                case GOEP_SUBEVENT_CONNECTION_CLOSED:
+                    if (pbap_client->state == PBAP_INIT){
+                        // connection failed already reported
+                    } else if (pbap_client->state < PBAP_CONNECTED){
+                        pbap_client_emit_connected_event(pbap_client, OBEX_DISCONNECTED);
                     } else {
-                        pbap_client->state = PBAP_CONNECTED;
-                        pbap_client_emit_operation_complete_event(pbap_client, OBEX_UNKNOWN_ERROR);
+                        if (pbap_client->state != PBAP_CONNECTED){
+                            pbap_client_emit_operation_complete_event(pbap_client, OBEX_DISCONNECTED);
+                        }
+                        pbap_client_emit_connection_closed_event(pbap_client);
                     }
+                    pbap_client->state = PBAP_INIT;
+                    pbap_client_finalize(pbap_client);
+                    break;
+                case GOEP_SUBEVENT_CAN_SEND_NOW:
+                    pbap_handle_can_send_now(pbap_client);
                     break;
                 default:
                     break;
             }
             break;
+        case GOEP_DATA_PACKET:
+            pbap_client = pbap_client_for_goep_cid(channel);
+            if (!pbap_client) break;
+            pbap_handle_data(pbap_client, packet, size);
+            break;
         default:
             break;
     }
 }
 
 void pbap_client_init(void){
-    memset(pbap_client, 0, sizeof(pbap_client_t));
-    pbap_client->state = PBAP_INIT;
-    pbap_client->cid = 1;
+    pbap_clients = NULL;
+    pbap_client_cid_counter = 0;
 }
 
 uint8_t pbap_connect(btstack_packet_handler_t handler, bd_addr_t addr, uint16_t * out_cid){
-    if (pbap_client->state != PBAP_INIT) return BTSTACK_MEMORY_ALLOC_FAILED;
+    pbap_client_t * pbap_client = btstack_memory_pbap_client_get();
+    if (!pbap_client){
+        log_error("pbap_connect: no memory for PBAP Client instance");
+        return BTSTACK_MEMORY_ALLOC_FAILED;
+    }
+    memset(pbap_client, 0, sizeof(pbap_client_t));
+    pbap_client->cid = pbap_client_get_next_cid();
     pbap_client->state = PBAP_W4_GOEP_CONNECTION;
     pbap_client->client_handler = handler;
+    memcpy(pbap_client->bd_addr, addr, 6);
     uint8_t err = goep_client_create_connection(&pbap_packet_handler, addr, BLUETOOTH_SERVICE_CLASS_PHONEBOOK_ACCESS_PSE, &pbap_client->goep_cid);
+    if (err){
+        btstack_memory_pbap_client_free(pbap_client);
+        return err;
+    }
+    btstack_linked_list_add(&pbap_clients, (btstack_linked_item_t *) pbap_client);
     *out_cid = pbap_client->cid;
-    if (err) return err;
     return 0;
 }
 
 uint8_t pbap_disconnect(uint16_t pbap_cid){
-    UNUSED(pbap_cid);
+    pbap_client_t * pbap_client = pbap_client_for_cid(pbap_cid);
+    if (!pbap_client) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
     if (pbap_client->state != PBAP_CONNECTED) return BTSTACK_BUSY;
     goep_client_disconnect(pbap_client->goep_cid);
     return 0;
 }
 
 uint8_t pbap_pull_phonebook(uint16_t pbap_cid){
-    UNUSED(pbap_cid);
+    pbap_client_t * pbap_client = pbap_client_for_cid(pbap_cid);
+    if (!pbap_client) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
     if (pbap_client->state != PBAP_CONNECTED) return BTSTACK_BUSY;
     pbap_client->state = PBAP_W2_PULL_PHONE_BOOK;
     goep_client_request_can_send_now(pbap_client->goep_cid);                
@@ -365,7 +425,8 @@ uint8_t pbap_pull_phonebook(uint16_t pbap_cid){
 }
 
 uint8_t pbap_set_phonebook(uint16_t pbap_cid, const char * path){
-    UNUSED(pbap_cid);
+    pbap_client_t * pbap_client = pbap_client_for_cid(pbap_cid);
+    if (!pbap_client) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
     if (pbap_client->state != PBAP_CONNECTED) return BTSTACK_BUSY;
     pbap_client->state = PBAP_W2_SET_PATH_ROOT;
     pbap_client->current_folder = path;
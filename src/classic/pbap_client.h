@@ -35,7 +35,8 @@
  *
  */
 
-#ifndef __GOEP_CLIENT_H
+#ifndef __PBAP_CLIENT_H
+#define __PBAP_CLIENT_H
 
 #if defined __cplusplus
 extern "C" {
@@ -44,10 +45,49 @@ extern "C" {
 #include "btstack_config.h"
 #include <stdint.h>
 
+#include "bluetooth.h"
+#include "btstack_defines.h"
+#include "btstack_linked_list.h"
+#include "classic/obex_parser.h"
+
+typedef enum {
+    PBAP_INIT = 0,
+    PBAP_W4_GOEP_CONNECTION,
+    PBAP_W2_SEND_CONNECT_REQUEST,
+    PBAP_W4_CONNECT_RESPONSE,
+    PBAP_CONNECT_RESPONSE_RECEIVED,
+    PBAP_CONNECTED,
+    //
+    PBAP_W2_PULL_PHONE_BOOK,
+    PBAP_W4_PHONE_BOOK,
+    PBAP_W2_SET_PATH_ROOT,
+    PBAP_W4_SET_PATH_ROOT_COMPLETE,
+    PBAP_W2_SET_PATH_ELEMENT,
+    PBAP_W4_SET_PATH_ELEMENT_COMPLETE,
+} pbap_state_t;
+
+// PBAP Client instance, one per connection, allocated via btstack_memory
+typedef struct pbap_client {
+    btstack_linked_item_t item;
+    pbap_state_t state;
+    uint16_t  cid;
+    bd_addr_t bd_addr;
+    hci_con_handle_t con_handle;
+    uint8_t   incoming;
+    uint16_t  goep_cid;
+    btstack_packet_handler_t client_handler;
+    const char * current_folder;
+    uint16_t set_path_offset;
+    // parser for current response
+    obex_parser_t obex_parser;
+    uint8_t   obex_header_buffer[4];
+} pbap_client_t;
+
 /* API_START */
 
 /**
  * Setup PhoneBook Access Client
+ * @note Each connection uses its own pbap_client_t instance allocated via btstack_memory (MAX_NR_PBAP_CLIENTS)
  */
 void pbap_client_init(void);
 
@@ -77,6 +117,7 @@ uint8_t pbap_set_phonebook(uint16_t pbap_cid, const char * path);
 
 /**
  * @brief Pull phone book from PSE
+ * @note vCard data is delivered as PBAP_DATA_PACKET in chunks as soon as they have been received
  * @param pbap_cid
  * @return status
  */
@@ -71,6 +71,23 @@
 
 #define RFCOMM_CREDITS 10
 
+// size of hash indices over multiplexers by l2cap cid and channels by rfcomm cid, load factor 1/2 for
+// MAX_NR_RFCOMM_MULTIPLEXERS/MAX_NR_RFCOMM_CHANNELS or 64/128 with HAVE_MALLOC. Others are found by a linear search
+#ifndef RFCOMM_MULTIPLEXER_INDEX_SIZE
+#if defined(MAX_NR_RFCOMM_MULTIPLEXERS) && !defined(HAVE_MALLOC)
+#define RFCOMM_MULTIPLEXER_INDEX_SIZE (2 * MAX_NR_RFCOMM_MULTIPLEXERS + 1)
+#else
+#define RFCOMM_MULTIPLEXER_INDEX_SIZE 129
+#endif
+#endif
+#ifndef RFCOMM_CHANNEL_INDEX_SIZE
+#if defined(MAX_NR_RFCOMM_CHANNELS) && !defined(HAVE_MALLOC)
+#define RFCOMM_CHANNEL_INDEX_SIZE (2 * MAX_NR_RFCOMM_CHANNELS + 1)
+#else
+#define RFCOMM_CHANNEL_INDEX_SIZE 257
+#endif
+#endif
+
 // FCS calc 
 #define BT_RFCOMM_CODE_WORD         0xE0 // pol = x8+x2+x1+1
 #define BT_RFCOMM_CRC_CHECK_LEN     3
@@ -132,6 +149,12 @@ static btstack_linked_list_t rfcomm_multiplexers = NULL;
 static btstack_linked_list_t rfcomm_channels = NULL;
 static btstack_linked_list_t rfcomm_services = NULL;
 
+// indices for lookup by cid
+static btstack_linked_list_index_t       rfcomm_multiplexer_index;
+static btstack_linked_list_index_entry_t rfcomm_multiplexer_index_entries[RFCOMM_MULTIPLEXER_INDEX_SIZE];
+static btstack_linked_list_index_t       rfcomm_channel_index;
+static btstack_linked_list_index_entry_t rfcomm_channel_index_entries[RFCOMM_CHANNEL_INDEX_SIZE];
+
 static gap_security_level_t rfcomm_security_level;
 
 static int  rfcomm_channel_can_send(rfcomm_channel_t * channel);
@@ -324,7 +347,17 @@ static rfcomm_multiplexer_t * rfcomm_multiplexer_for_addr(bd_addr_t addr){
     return NULL;
 }
 
+static void rfcomm_multiplexer_set_l2cap_cid(rfcomm_multiplexer_t * multiplexer, uint16_t l2cap_cid){
+    btstack_linked_list_index_remove(&rfcomm_multiplexer_index, multiplexer->l2cap_cid, (btstack_linked_item_t *) multiplexer);
+    multiplexer->l2cap_cid = l2cap_cid;
+    if (l2cap_cid == 0) return;
+    btstack_linked_list_index_add(&rfcomm_multiplexer_index, l2cap_cid, (btstack_linked_item_t *) multiplexer);
+}
+
 static rfcomm_multiplexer_t * rfcomm_multiplexer_for_l2cap_cid(uint16_t l2cap_cid) {
+    rfcomm_multiplexer_t * indexed_multiplexer = (rfcomm_multiplexer_t *) btstack_linked_list_index_get(&rfcomm_multiplexer_index, l2cap_cid);
+    if (indexed_multiplexer) return indexed_multiplexer;
+    if (btstack_linked_list_index_complete(&rfcomm_multiplexer_index)) return NULL;
     btstack_linked_item_t *it;
     for (it = (btstack_linked_item_t *) rfcomm_multiplexers; it ; it = it->next){
         rfcomm_multiplexer_t * multiplexer = ((rfcomm_multiplexer_t *) it);
@@ -418,10 +451,17 @@ static rfcomm_channel_t * rfcomm_channel_create(rfcomm_multiplexer_t * multiplex
     
     // add to services list
     btstack_linked_list_add(&rfcomm_channels, (btstack_linked_item_t *) channel);
+    btstack_linked_list_index_add(&rfcomm_channel_index, channel->rfcomm_cid, (btstack_linked_item_t *) channel);
     
     return channel;
 }
 
+static void rfcomm_channel_free(rfcomm_channel_t * channel){
+    btstack_linked_list_index_remove(&rfcomm_channel_index, channel->rfcomm_cid, (btstack_linked_item_t *) channel);
+    btstack_linked_list_remove(&rfcomm_channels, (btstack_linked_item_t *) channel);
+    btstack_memory_rfcomm_channel_free(channel);
+}
+
 static void rfcomm_notify_channel_can_send(void){
     btstack_linked_list_iterator_t it;
     btstack_linked_list_iterator_init(&it, &rfcomm_channels);
@@ -436,6 +476,9 @@ static void rfcomm_notify_channel_can_send(void){
 }
 
 static rfcomm_channel_t * rfcomm_channel_for_rfcomm_cid(uint16_t rfcomm_cid){
+    rfcomm_channel_t * indexed_channel = (rfcomm_channel_t *) btstack_linked_list_index_get(&rfcomm_channel_index, rfcomm_cid);
+    if (indexed_channel) return indexed_channel;
+    if (btstack_linked_list_index_complete(&rfcomm_channel_index)) return NULL;
     btstack_linked_item_t *it;
     for (it = (btstack_linked_item_t *) rfcomm_channels; it ; it = it->next){
         rfcomm_channel_t * channel = ((rfcomm_channel_t *) it);
@@ -761,6 +804,7 @@ static void rfcomm_multiplexer_stop_timer(rfcomm_multiplexer_t * multiplexer){
     }
 }
 static void rfcomm_multiplexer_free(rfcomm_multiplexer_t * multiplexer){
+    btstack_linked_list_index_remove(&rfcomm_multiplexer_index, multiplexer->l2cap_cid, (btstack_linked_item_t *) multiplexer);
     btstack_linked_list_remove( &rfcomm_multiplexers, (btstack_linked_item_t *) multiplexer);
     btstack_memory_rfcomm_multiplexer_free(multiplexer);
 }
@@ -788,6 +832,7 @@ static void rfcomm_multiplexer_finalize(rfcomm_multiplexer_t * multiplexer){
             }
             // remove from list
             it->next = it->next->next;
+            btstack_linked_list_index_remove(&rfcomm_channel_index, channel->rfcomm_cid, (btstack_linked_item_t *) channel);
             // free channel struct
             btstack_memory_rfcomm_channel_free(channel);
         } else {
@@ -953,7 +998,7 @@ static int rfcomm_hci_event_handler(uint8_t *packet, uint16_t size){
             }
             
             multiplexer->con_handle = con_handle;
-            multiplexer->l2cap_cid = l2cap_cid;
+            rfcomm_multiplexer_set_l2cap_cid(multiplexer, l2cap_cid);
             // 
             multiplexer->state = RFCOMM_MULTIPLEXER_W4_SABM_0;
             log_info("L2CAP_EVENT_INCOMING_CONNECTION (l2cap_cid 0x%02x) for BLUETOOTH_PROTOCOL_RFCOMM => accept", l2cap_cid);
@@ -995,8 +1040,7 @@ static int rfcomm_hci_event_handler(uint8_t *packet, uint16_t size){
                         rfcomm_channel_t * channel = (rfcomm_channel_t *) it->next;
                         if (channel->multiplexer == multiplexer){
                             rfcomm_emit_channel_opened(channel, status);
-                            btstack_linked_list_remove(&rfcomm_channels, (btstack_linked_item_t *) channel);
-                            btstack_memory_rfcomm_channel_free(channel);
+                            rfcomm_channel_free(channel);
                             break;
                         } else {
                             it = it->next;
@@ -1015,7 +1059,7 @@ static int rfcomm_hci_event_handler(uint8_t *packet, uint16_t size){
                 log_info("L2CAP_EVENT_CHANNEL_OPENED: outgoing connection");
                 // wrong remote addr
                 if (bd_addr_cmp(event_addr, multiplexer->remote_addr)) break;
-                multiplexer->l2cap_cid = l2cap_cid;
+                rfcomm_multiplexer_set_l2cap_cid(multiplexer, l2cap_cid);
                 multiplexer->con_handle = con_handle;
                 // send SABM #0
                 rfcomm_multiplexer_set_state_and_request_can_send_now_event(multiplexer, RFCOMM_MULTIPLEXER_SEND_SABM_0);
@@ -1348,11 +1392,8 @@ static void rfcomm_channel_finalize(rfcomm_channel_t *channel){
 
     rfcomm_multiplexer_t *multiplexer = channel->multiplexer;
 
-    // remove from list
-    btstack_linked_list_remove( &rfcomm_channels, (btstack_linked_item_t *) channel);
-
-    // free channel
-    btstack_memory_rfcomm_channel_free(channel);
+    // remove from list and free channel
+    rfcomm_channel_free(channel);
     
     // update multiplexer timeout after channel was removed from list
     rfcomm_multiplexer_prepare_idle_timer(multiplexer);
@@ -2031,6 +2072,8 @@ void rfcomm_init(void){
     rfcomm_multiplexers = NULL;
     rfcomm_services     = NULL;
     rfcomm_channels     = NULL;
+    btstack_linked_list_index_init(&rfcomm_multiplexer_index, rfcomm_multiplexer_index_entries, RFCOMM_MULTIPLEXER_INDEX_SIZE);
+    btstack_linked_list_index_init(&rfcomm_channel_index, rfcomm_channel_index_entries, RFCOMM_CHANNEL_INDEX_SIZE);
     rfcomm_security_level = LEVEL_2;
 }
 
@@ -2257,7 +2300,7 @@ static uint8_t rfcomm_channel_create_internal(btstack_packet_handler_t packet_ha
         uint16_t l2cap_cid = 0;
         status = l2cap_create_channel(rfcomm_packet_handler, addr, BLUETOOTH_PROTOCOL_RFCOMM, l2cap_max_mtu(), &l2cap_cid);
         if (status) goto fail;
-        multiplexer->l2cap_cid = l2cap_cid;
+        rfcomm_multiplexer_set_l2cap_cid(multiplexer, l2cap_cid);
         return 0;
     }
     
@@ -2268,8 +2311,8 @@ static uint8_t rfcomm_channel_create_internal(btstack_packet_handler_t packet_ha
     return 0;
 
 fail:
-    if (new_multiplexer) btstack_memory_rfcomm_multiplexer_free(multiplexer);
-    if (channel)         btstack_memory_rfcomm_channel_free(channel);
+    if (channel)         rfcomm_channel_free(channel);
+    if (new_multiplexer) rfcomm_multiplexer_free(multiplexer);
     return status;
 }
 
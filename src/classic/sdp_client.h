@@ -44,6 +44,8 @@
 
 #include "btstack_config.h"
 
+#include "btstack_defines.h"
+#include "btstack_linked_list.h"
 #include "btstack_util.h"
 
 #if defined __cplusplus
@@ -62,9 +64,43 @@ typedef struct de_state {
 void de_state_init(de_state_t * state);
 int  de_state_size(uint8_t eventByte, de_state_t *de_state);
 
+// SDP Client instance, one per active query
+typedef struct sdp_client {
+    btstack_linked_item_t item;
+
+    // SDP Parser
+    btstack_packet_handler_t callback;
+    de_state_t de_header_state;
+    uint8_t  parser_state;
+    uint16_t attribute_id;
+    uint16_t attribute_bytes_received;
+    uint16_t attribute_bytes_delivered;
+    uint16_t list_offset;
+    uint16_t list_size;
+    uint16_t record_offset;
+    uint16_t record_size;
+    uint16_t attribute_value_size;
+    int      record_counter;
+
+    // SDP Client
+    uint8_t  state;
+    uint8_t  pdu_id;
+    uint16_t cid;
+    uint16_t mtu;
+    uint16_t transaction_id;
+    const uint8_t * service_search_pattern;
+    const uint8_t * attribute_id_list;
+    uint8_t  continuation_state[16];
+    uint8_t  continuation_state_len;
+#ifdef ENABLE_SDP_EXTRA_QUERIES
+    uint32_t service_record_handle;
+    uint32_t record_handle;
+#endif
+} sdp_client_t;
+
 /** 
  * @brief Checks if the SDP Client is ready
- * @return 1 when no query is active
+ * @return 1 when no query started via sdp_client_query* or sdp_client_service_* is active
  */
 int sdp_client_ready(void);
 
@@ -90,6 +126,20 @@ uint8_t sdp_client_query_uuid16(btstack_packet_handler_t callback, bd_addr_t rem
  */
 uint8_t sdp_client_query_uuid128(btstack_packet_handler_t callback, bd_addr_t remote, const uint8_t* uuid128);
 
+/** 
+ * @brief Queries the SDP service of the remote device like sdp_client_query, but with its own SDP Client instance
+ * allocated via btstack_memory (MAX_NR_SDP_CLIENTS). Queries started this way run in parallel to each other and
+ * to the one started via sdp_client_query. Their events are delivered with the query id as channel.
+ * @note service search pattern and attribute ID list need to stay valid until SDP_EVENT_QUERY_COMPLETE
+ * @param callback for attributes values and done event
+ * @param remote address
+ * @param des_service_search_pattern 
+ * @param des_attribute_id_list
+ * @param out_query_id set to the id of the query, can be NULL
+ * @return status
+ */
+uint8_t sdp_client_query_parallel(btstack_packet_handler_t callback, bd_addr_t remote, const uint8_t * des_service_search_pattern, const uint8_t * des_attribute_id_list, uint16_t * out_query_id);
+
 
 /** 
  * @brief Retrieves all attribute IDs of a SDP record specified by its service record handle and a list of attribute IDs. 
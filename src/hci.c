@@ -143,6 +143,7 @@ static void gap_inquiry_explode(uint8_t * packet);
 static int  hci_power_control_on(void);
 static void hci_power_control_off(void);
 static void hci_state_reset(void);
+static void hci_initializing_command_completed(void);
 static void hci_emit_disconnection_complete(hci_con_handle_t con_handle, uint8_t reason);
 static void hci_emit_nr_connections_changed(void);
 static void hci_emit_hci_open_failed(void);
@@ -205,6 +206,19 @@ static hci_connection_t * create_connection_for_bd_addr_and_type(bd_addr_t addr,
     return conn;
 }
 
+static void hci_connection_set_con_handle(hci_connection_t * conn, hci_con_handle_t con_handle){
+    btstack_linked_list_index_remove(&hci_stack->connection_index, conn->con_handle, (btstack_linked_item_t *) conn);
+    conn->con_handle = con_handle;
+    if (con_handle == HCI_CON_HANDLE_INVALID) return;
+    btstack_linked_list_index_add(&hci_stack->connection_index, con_handle, (btstack_linked_item_t *) conn);
+}
+
+static void hci_connection_free(hci_connection_t * conn){
+    btstack_linked_list_index_remove(&hci_stack->connection_index, conn->con_handle, (btstack_linked_item_t *) conn);
+    btstack_linked_list_remove(&hci_stack->connections, (btstack_linked_item_t *) conn);
+    btstack_memory_hci_connection_free( conn );
+}
+
 
 /**
  * get le connection parameter range
@@ -240,6 +254,11 @@ void hci_connections_get_iterator(btstack_linked_list_iterator_t *it){
  * @return connection OR NULL, if not found
  */
 hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle){
+    if (con_handle != HCI_CON_HANDLE_INVALID){
+        hci_connection_t * conn = (hci_connection_t *) btstack_linked_list_index_get(&hci_stack->connection_index, con_handle);
+        if (conn) return conn;
+        if (btstack_linked_list_index_complete(&hci_stack->connection_index)) return NULL;
+    }
     btstack_linked_list_iterator_t it;
     btstack_linked_list_iterator_init(&it, &hci_stack->connections);
     while (btstack_linked_list_iterator_has_next(&it)){
@@ -463,6 +482,31 @@ static int hci_can_send_comand_packet_transport(void){
     return 1;
 }
 
+// host command queue: commands sent to the Controller that didn't receive Command Complete/Command Status yet
+static void hci_command_queue_add(uint16_t opcode){
+    if (hci_stack->cmds_in_flight_count >= HCI_MAX_COMMANDS_IN_FLIGHT){
+        log_error("hci_command_queue_add: no space for opcode %04x", opcode);
+        return;
+    }
+    hci_stack->cmds_in_flight[hci_stack->cmds_in_flight_count++] = opcode;
+}
+
+static void hci_command_queue_remove(uint16_t opcode){
+    int i;
+    for (i = 0; i < hci_stack->cmds_in_flight_count; i++){
+        if (hci_stack->cmds_in_flight[i] != opcode) continue;
+        hci_stack->cmds_in_flight_count--;
+        memmove(&hci_stack->cmds_in_flight[i], &hci_stack->cmds_in_flight[i+1], (hci_stack->cmds_in_flight_count - i) * sizeof(uint16_t));
+        return;
+    }
+}
+
+// Num_HCI_Command_Packets is the number of commands the Controller can accept now, limited by the host command queue
+static void hci_command_queue_completed(uint16_t opcode, uint8_t num_hci_command_packets){
+    hci_command_queue_remove(opcode);
+    hci_stack->num_cmd_packets = btstack_min(num_hci_command_packets, HCI_MAX_COMMANDS_IN_FLIGHT - hci_stack->cmds_in_flight_count);
+}
+
 // new functions replacing hci_can_send_packet_now[_using_packet_buffer]
 int hci_can_send_command_packet_now(void){
     if (hci_can_send_comand_packet_transport() == 0) return 0;
@@ -480,8 +524,26 @@ static int hci_can_send_prepared_acl_packet_for_address_type(bd_addr_type_t addr
     return hci_number_free_acl_slots_for_connection_type(address_type) > 0;
 }
 
+// fragments are prepared in place, next ACL packet can be sent after the last fragment was passed to the HCI Transport
+static int hci_acl_fragmentation_active_for_address_type(bd_addr_type_t address_type){
+    btstack_linked_item_t *it;
+    for (it = (btstack_linked_item_t *) hci_stack->connections; it ; it = it->next){
+        hci_connection_t * connection = (hci_connection_t *) it;
+        if (connection->acl_fragmentation_total_size == 0) continue;
+        if ((address_type == BD_ADDR_TYPE_CLASSIC) == (connection->address_type == BD_ADDR_TYPE_CLASSIC)) return 1;
+    }
+    return 0;
+}
+
+static int hci_acl_fragmentation_active_for_handle(hci_con_handle_t con_handle){
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    if (!connection) return 0;
+    return connection->acl_fragmentation_total_size != 0;
+}
+
 int hci_can_send_acl_le_packet_now(void){
     if (hci_stack->hci_packet_buffer_reserved) return 0;
+    if (hci_acl_fragmentation_active_for_address_type(BD_ADDR_TYPE_LE_PUBLIC)) return 0;
     return hci_can_send_prepared_acl_packet_for_address_type(BD_ADDR_TYPE_LE_PUBLIC);
 }
 
@@ -492,12 +554,14 @@ int hci_can_send_prepared_acl_packet_now(hci_con_handle_t con_handle) {
 
 int hci_can_send_acl_packet_now(hci_con_handle_t con_handle){
     if (hci_stack->hci_packet_buffer_reserved) return 0;
+    if (hci_acl_fragmentation_active_for_handle(con_handle)) return 0;
     return hci_can_send_prepared_acl_packet_now(con_handle);
 }
 
 #ifdef ENABLE_CLASSIC
 int hci_can_send_acl_classic_packet_now(void){
     if (hci_stack->hci_packet_buffer_reserved) return 0;
+    if (hci_acl_fragmentation_active_for_address_type(BD_ADDR_TYPE_CLASSIC)) return 0;
     return hci_can_send_prepared_acl_packet_for_address_type(BD_ADDR_TYPE_CLASSIC);
 }
 
@@ -518,6 +582,116 @@ void hci_request_sco_can_send_now_event(void){
 }
 #endif
 
+// outgoing packet buffer state
+#define HCI_PACKET_BUFFER_STATE_RESERVED    1   // reserved for packet assembly
+#define HCI_PACKET_BUFFER_STATE_FRAGMENTING 2   // ACL packet is sent in fragments
+#define HCI_PACKET_BUFFER_STATE_IN_FLIGHT   4   // owned by HCI Transport until HCI_EVENT_TRANSPORT_PACKET_SENT
+#define HCI_PACKET_BUFFER_NONE 0xff
+
+static uint8_t * hci_packet_buffer_for_index(uint8_t index){
+    return &hci_stack->hci_packet_buffer_data[index][HCI_OUTGOING_PRE_BUFFER_SIZE];
+}
+
+// @returns index of outgoing packet buffer that contains packet or HCI_PACKET_BUFFER_NONE
+static uint8_t hci_packet_buffer_index_for_packet(const uint8_t * packet){
+    uint8_t index;
+    for (index = 0; index < HCI_OUTGOING_PACKET_BUFFER_COUNT; index++){
+        const uint8_t * buffer = hci_packet_buffer_for_index(index);
+        if (packet >= buffer && packet < &buffer[HCI_PACKET_BUFFER_SIZE]) return index;
+    }
+    return HCI_PACKET_BUFFER_NONE;
+}
+
+// select buffer for next packet, keep current one if reserved or free
+static void hci_packet_buffer_select(void){
+    uint8_t index = hci_stack->hci_packet_buffer_index;
+    if (hci_stack->hci_packet_buffer_state[index] & HCI_PACKET_BUFFER_STATE_RESERVED){
+        hci_stack->hci_packet_buffer_reserved = 1;
+        return;
+    }
+    int i;
+    for (i = 0; i < HCI_OUTGOING_PACKET_BUFFER_COUNT; i++){
+        if (hci_stack->hci_packet_buffer_state[index] == 0){
+            hci_stack->hci_packet_buffer_index = index;
+            hci_stack->hci_packet_buffer = hci_packet_buffer_for_index(index);
+            hci_stack->hci_packet_buffer_reserved = 0;
+            return;
+        }
+        index++;
+        if (index == HCI_OUTGOING_PACKET_BUFFER_COUNT){
+            index = 0;
+        }
+    }
+    // all buffers in use
+    hci_stack->hci_packet_buffer_reserved = 1;
+}
+
+static void hci_packet_buffers_reset(void){
+    memset(hci_stack->hci_packet_buffer_state, 0, sizeof(hci_stack->hci_packet_buffer_state));
+    hci_stack->hci_packets_in_flight_head  = 0;
+    hci_stack->hci_packets_in_flight_count = 0;
+    hci_stack->hci_packet_buffer_index = 0;
+    hci_packet_buffer_select();
+}
+
+// handle HCI_EVENT_TRANSPORT_PACKET_SENT: release buffer of oldest packet in flight
+static void hci_packet_buffer_packet_sent(void){
+    if (hci_stack->hci_packets_in_flight_count == 0) return;
+    uint8_t index = hci_stack->hci_packets_in_flight[hci_stack->hci_packets_in_flight_head];
+    hci_stack->hci_packets_in_flight_head++;
+    if (hci_stack->hci_packets_in_flight_head == sizeof(hci_stack->hci_packets_in_flight)){
+        hci_stack->hci_packets_in_flight_head = 0;
+    }
+    hci_stack->hci_packets_in_flight_count--;
+    if (index == HCI_PACKET_BUFFER_NONE) return;
+    hci_stack->hci_packet_buffer_state[index] &= ~HCI_PACKET_BUFFER_STATE_IN_FLIGHT;
+    hci_packet_buffer_select();
+}
+
+// assumption: synchronous implementations don't provide can_send_packet_now as they don't keep the buffer after the call
+static int hci_transport_synchronous(void){
+    return hci_stack->hci_transport->can_send_packet_now == NULL;
+}
+
+// pass packet to HCI Transport. for async transports, its buffer stays in use until HCI_EVENT_TRANSPORT_PACKET_SENT
+static int hci_transport_send_packet(uint8_t packet_type, uint8_t * packet, int size){
+    uint8_t index = hci_packet_buffer_index_for_packet(packet);
+    int synchronous = hci_transport_synchronous();
+    if (!synchronous && hci_stack->hci_packets_in_flight_count == sizeof(hci_stack->hci_packets_in_flight)){
+        log_error("hci_transport_send_packet: too many packets in flight");
+        if (index != HCI_PACKET_BUFFER_NONE){
+            hci_stack->hci_packet_buffer_state[index] &= ~HCI_PACKET_BUFFER_STATE_RESERVED;
+            hci_packet_buffer_select();
+        }
+        return -1;
+    }
+    if (index != HCI_PACKET_BUFFER_NONE){
+        hci_stack->hci_packet_buffer_state[index] &= ~HCI_PACKET_BUFFER_STATE_RESERVED;
+        if (!synchronous){
+            hci_stack->hci_packet_buffer_state[index] |= HCI_PACKET_BUFFER_STATE_IN_FLIGHT;
+        }
+    }
+    // track packet before sending as "transport done" might be sent during send_packet already
+    if (!synchronous){
+        int pos = hci_stack->hci_packets_in_flight_head + hci_stack->hci_packets_in_flight_count;
+        if (pos >= (int) sizeof(hci_stack->hci_packets_in_flight)){
+            pos -= sizeof(hci_stack->hci_packets_in_flight);
+        }
+        hci_stack->hci_packets_in_flight[pos] = index;
+        hci_stack->hci_packets_in_flight_count++;
+    }
+    int err = hci_stack->hci_transport->send_packet(packet_type, packet, size);
+    if (err && !synchronous){
+        // packet rejected, no HCI_EVENT_TRANSPORT_PACKET_SENT will follow: drop newest entry and release buffer
+        hci_stack->hci_packets_in_flight_count--;
+        if (index != HCI_PACKET_BUFFER_NONE){
+            hci_stack->hci_packet_buffer_state[index] &= ~HCI_PACKET_BUFFER_STATE_IN_FLIGHT;
+        }
+    }
+    hci_packet_buffer_select();
+    return err;
+}
+
 // used for internal checks in l2cap.c
 int hci_is_packet_buffer_reserved(void){
     return hci_stack->hci_packet_buffer_reserved;
@@ -529,22 +703,102 @@ int hci_reserve_packet_buffer(void){
         log_error("hci_reserve_packet_buffer called but buffer already reserved");
         return 0;
     }
+    hci_stack->hci_packet_buffer_state[hci_stack->hci_packet_buffer_index] |= HCI_PACKET_BUFFER_STATE_RESERVED;
     hci_stack->hci_packet_buffer_reserved = 1;
     return 1;    
 }
 
 void hci_release_packet_buffer(void){
-    hci_stack->hci_packet_buffer_reserved = 0;
+    hci_stack->hci_packet_buffer_state[hci_stack->hci_packet_buffer_index] &= ~HCI_PACKET_BUFFER_STATE_RESERVED;
+    hci_packet_buffer_select();
 }
 
-// assumption: synchronous implementations don't provide can_send_packet_now as they don't keep the buffer after the call
-static int hci_transport_synchronous(void){
-    return hci_stack->hci_transport->can_send_packet_now == NULL;
+// incoming buffers: the HCI Transport holds one reference while it receives into a buffer. If the buffer got retained
+// while the packet handler was active, the HCI Transport continues with a free one. A buffer held by the HCI Transport
+// alone can only be retained if a free buffer is left.
+#if HCI_INCOMING_BUFFER_COUNT > 0
+// @returns index of incoming buffer that contains packet or -1
+static int hci_incoming_buffer_index_for_packet(const uint8_t * packet){
+    const uint8_t * pool = &hci_stack->hci_incoming_buffer_data[0][0];
+    if (packet < pool || packet >= &pool[sizeof(hci_stack->hci_incoming_buffer_data)]) return -1;
+    return (packet - pool) / HCI_INCOMING_BUFFER_SIZE;
+}
+
+static int hci_incoming_buffer_free(void){
+    int index;
+    for (index = 0; index < HCI_INCOMING_BUFFER_COUNT; index++){
+        if (hci_stack->hci_incoming_buffer_ref_count[index] == 0) return 1;
+    }
+    return 0;
+}
+#endif
+
+uint8_t * hci_incoming_buffer_get(void){
+#if HCI_INCOMING_BUFFER_COUNT > 0
+    int index;
+    for (index = 0; index < HCI_INCOMING_BUFFER_COUNT; index++){
+        if (hci_stack->hci_incoming_buffer_ref_count[index] == 0){
+            hci_stack->hci_incoming_buffer_ref_count[index] = 1;
+            return hci_stack->hci_incoming_buffer_data[index];
+        }
+    }
+#endif
+    return NULL;
+}
+
+uint8_t * hci_incoming_buffer_recycle(uint8_t * buffer){
+#if HCI_INCOMING_BUFFER_COUNT > 0
+    int index = hci_incoming_buffer_index_for_packet(buffer);
+    // HCI Transport fell back to its own buffer, switch back to the pool
+    if (index < 0) return hci_incoming_buffer_get();
+    if (hci_stack->hci_incoming_buffer_ref_count[index] == 1) return buffer;
+    hci_stack->hci_incoming_buffer_ref_count[index]--;
+    return hci_incoming_buffer_get();
+#else
+    return buffer;
+#endif
+}
+
+int hci_incoming_buffer_retain(const uint8_t * packet){
+#if HCI_INCOMING_BUFFER_COUNT > 0
+    int index = hci_incoming_buffer_index_for_packet(packet);
+    if (index < 0) return 0;
+    uint8_t ref_count = hci_stack->hci_incoming_buffer_ref_count[index];
+    if (ref_count == 0 || ref_count == 0xff) return 0;
+    if (ref_count == 1 && !hci_incoming_buffer_free()) return 0;
+    hci_stack->hci_incoming_buffer_ref_count[index]++;
+    return 1;
+#else
+    UNUSED(packet);
+    return 0;
+#endif
+}
+
+void hci_incoming_buffer_release(const uint8_t * packet){
+#if HCI_INCOMING_BUFFER_COUNT > 0
+    int index = hci_incoming_buffer_index_for_packet(packet);
+    if (index < 0) return;
+    if (hci_stack->hci_incoming_buffer_ref_count[index] == 0){
+        log_error("hci_incoming_buffer_release: buffer %u not in use", index);
+        return;
+    }
+    hci_stack->hci_incoming_buffer_ref_count[index]--;
+#else
+    UNUSED(packet);
+#endif
+}
+
+static void hci_drop_acl_fragments(hci_connection_t * connection){
+    if (connection->acl_fragmentation_total_size == 0) return;
+    connection->acl_fragmentation_total_size = 0;
+    connection->acl_fragmentation_pos = 0;
+    hci_stack->hci_packet_buffer_state[connection->acl_fragmentation_buffer] &= ~HCI_PACKET_BUFFER_STATE_FRAGMENTING;
+    hci_packet_buffer_select();
 }
 
 static int hci_send_acl_packet_fragments(hci_connection_t *connection){
 
-    // log_info("hci_send_acl_packet_fragments  %u/%u (con 0x%04x)", hci_stack->acl_fragmentation_pos, hci_stack->acl_fragmentation_total_size, connection->con_handle);
+    // log_info("hci_send_acl_packet_fragments  %u/%u (con 0x%04x)", connection->acl_fragmentation_pos, connection->acl_fragmentation_total_size, connection->con_handle);
 
     // max ACL data packet length depends on connection type (LE vs. Classic) and available buffers
     uint16_t max_acl_data_packet_length = hci_stack->acl_data_packet_length;
@@ -557,6 +811,9 @@ static int hci_send_acl_packet_fragments(hci_connection_t *connection){
 
     log_debug("hci_send_acl_packet_fragments entered");
 
+    const uint8_t buffer_index = connection->acl_fragmentation_buffer;
+    uint8_t * buffer = hci_packet_buffer_for_index(buffer_index);
+
     int err;
     // multiple packets could be send on a synchronous HCI transport
     while (1){
@@ -564,8 +821,8 @@ static int hci_send_acl_packet_fragments(hci_connection_t *connection){
         log_debug("hci_send_acl_packet_fragments loop entered");
 
         // get current data
-        const uint16_t acl_header_pos = hci_stack->acl_fragmentation_pos - 4;
-        int current_acl_data_packet_length = hci_stack->acl_fragmentation_total_size - hci_stack->acl_fragmentation_pos;
+        const uint16_t acl_header_pos = connection->acl_fragmentation_pos - 4;
+        int current_acl_data_packet_length = connection->acl_fragmentation_total_size - connection->acl_fragmentation_pos;
         int more_fragments = 0;
 
         // if ACL packet is larger than Bluetooth packet buffer, only send max_acl_data_packet_length
@@ -576,49 +833,70 @@ static int hci_send_acl_packet_fragments(hci_connection_t *connection){
 
         // copy handle_and_flags if not first fragment and update packet boundary flags to be 01 (continuing fragmnent)
         if (acl_header_pos > 0){
-            uint16_t handle_and_flags = little_endian_read_16(hci_stack->hci_packet_buffer, 0);
+            uint16_t handle_and_flags = little_endian_read_16(buffer, 0);
             handle_and_flags = (handle_and_flags & 0xcfff) | (1 << 12);
-            little_endian_store_16(hci_stack->hci_packet_buffer, acl_header_pos, handle_and_flags);
+            little_endian_store_16(buffer, acl_header_pos, handle_and_flags);
         }
 
         // update header len
-        little_endian_store_16(hci_stack->hci_packet_buffer, acl_header_pos + 2, current_acl_data_packet_length);
+        little_endian_store_16(buffer, acl_header_pos + 2, current_acl_data_packet_length);
 
         // count packet
         connection->num_acl_packets_sent++;
         log_debug("hci_send_acl_packet_fragments loop before send (more fragments %d)", more_fragments);
 
         // update state for next fragment (if any) as "transport done" might be sent during send_packet already
+        const uint16_t acl_fragmentation_pos = connection->acl_fragmentation_pos;
+        const uint16_t acl_fragmentation_total_size = connection->acl_fragmentation_total_size;
         if (more_fragments){
             // update start of next fragment to send
-            hci_stack->acl_fragmentation_pos += current_acl_data_packet_length;
+            connection->acl_fragmentation_pos += current_acl_data_packet_length;
         } else {
             // done
-            hci_stack->acl_fragmentation_pos = 0;
-            hci_stack->acl_fragmentation_total_size = 0;
+            connection->acl_fragmentation_pos = 0;
+            connection->acl_fragmentation_total_size = 0;
+            hci_stack->hci_packet_buffer_state[buffer_index] &= ~HCI_PACKET_BUFFER_STATE_FRAGMENTING;
         }
 
         // send packet
-        uint8_t * packet = &hci_stack->hci_packet_buffer[acl_header_pos];
+        uint8_t * packet = &buffer[acl_header_pos];
         const int size = current_acl_data_packet_length + 4;
         hci_dump_packet(HCI_ACL_DATA_PACKET, 0, packet, size);
-        err = hci_stack->hci_transport->send_packet(HCI_ACL_DATA_PACKET, packet, size);
+        err = hci_transport_send_packet(HCI_ACL_DATA_PACKET, packet, size);
 
         log_debug("hci_send_acl_packet_fragments loop after send (more fragments %d)", more_fragments);
 
+        // fragment rejected by HCI Transport: drop packet if caller gets error, retry continuation fragment from hci_run
+        if (err){
+            connection->num_acl_packets_sent--;
+            if (acl_header_pos > 0){
+                connection->acl_fragmentation_pos = acl_fragmentation_pos;
+                connection->acl_fragmentation_total_size = acl_fragmentation_total_size;
+                hci_stack->hci_packet_buffer_state[buffer_index] |= HCI_PACKET_BUFFER_STATE_FRAGMENTING;
+                err = 0;
+            } else {
+                connection->acl_fragmentation_pos = 0;
+                connection->acl_fragmentation_total_size = 0;
+                hci_stack->hci_packet_buffer_state[buffer_index] &= ~HCI_PACKET_BUFFER_STATE_FRAGMENTING;
+            }
+            hci_packet_buffer_select();
+            return err;
+        }
+
         // done yet?
         if (!more_fragments) break;
 
+        // next fragment header overwrites current fragment, wait until it has been sent
+        if (hci_stack->hci_packet_buffer_state[buffer_index] & HCI_PACKET_BUFFER_STATE_IN_FLIGHT) return err;
+
         // can send more?
         if (!hci_can_send_prepared_acl_packet_now(connection->con_handle)) return err;
     }
 
     log_debug("hci_send_acl_packet_fragments loop over");
 
-    // release buffer now for synchronous transport
+    // notify upper stack that it might be possible to send again
     if (hci_transport_synchronous()){
-        hci_release_packet_buffer();
-        // notify upper stack that it might be possible to send again
         uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
         hci_emit_event(&event[0], sizeof(event), 0);  // don't dump
     }
@@ -653,15 +931,25 @@ int hci_send_acl_packet_buffer(int size){
         return 0;
     }
 
+    if (connection->acl_fragmentation_total_size) {
+        log_error("hci_send_acl_packet_buffer called but previous packet for handle 0x%04x not sent yet", con_handle);
+        hci_release_packet_buffer();
+        return BTSTACK_ACL_BUFFERS_FULL;
+    }
+
 #ifdef ENABLE_CLASSIC
     hci_connection_timestamp(connection);
 #endif
 
     // hci_dump_packet( HCI_ACL_DATA_PACKET, 0, packet, size);
 
-    // setup data
-    hci_stack->acl_fragmentation_total_size = size;
-    hci_stack->acl_fragmentation_pos = 4;   // start of L2CAP packet
+    // setup data, packet buffer is owned by connection until last fragment was passed to HCI Transport
+    const uint8_t buffer_index = hci_stack->hci_packet_buffer_index;
+    hci_stack->hci_packet_buffer_state[buffer_index] &= ~HCI_PACKET_BUFFER_STATE_RESERVED;
+    hci_stack->hci_packet_buffer_state[buffer_index] |=  HCI_PACKET_BUFFER_STATE_FRAGMENTING;
+    connection->acl_fragmentation_buffer = buffer_index;
+    connection->acl_fragmentation_total_size = size;
+    connection->acl_fragmentation_pos = 4;   // start of L2CAP packet
 
     return hci_send_acl_packet_fragments(connection);
 }
@@ -701,10 +989,9 @@ int hci_send_sco_packet_buffer(int size){
     }
 
     hci_dump_packet( HCI_SCO_DATA_PACKET, 0, packet, size);
-    int err = hci_stack->hci_transport->send_packet(HCI_SCO_DATA_PACKET, packet, size);
+    int err = hci_transport_send_packet(HCI_SCO_DATA_PACKET, packet, size);
 
     if (hci_transport_synchronous()){
-        hci_release_packet_buffer();
         // notify upper stack that it might be possible to send again
         uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
         hci_emit_event(&event[0], sizeof(event), 0);    // don't dump
@@ -714,6 +1001,16 @@ int hci_send_sco_packet_buffer(int size){
 }
 #endif
 
+// drop fragments of incomplete L2CAP PDU
+static void hci_acl_recombination_reset(hci_connection_t * conn){
+    if (conn->acl_recombination_packet){
+        hci_incoming_buffer_release(conn->acl_recombination_packet);
+        conn->acl_recombination_packet = NULL;
+    }
+    conn->acl_recombination_length = 0;
+    conn->acl_recombination_pos = 0;
+}
+
 static void acl_handler(uint8_t *packet, int size){
 
     // log_info("acl_handler: size %u", size);
@@ -759,12 +1056,12 @@ static void acl_handler(uint8_t *packet, int size){
             if (conn->acl_recombination_pos + acl_length > 4 + HCI_ACL_BUFFER_SIZE){
                 log_error( "ACL Cont Fragment to large: combined packet %u > buffer size %u for handle 0x%02x",
                     conn->acl_recombination_pos + acl_length, 4 + HCI_ACL_BUFFER_SIZE, con_handle);
-                conn->acl_recombination_pos = 0;
+                hci_acl_recombination_reset(conn);
                 return;
             }
 
             // append fragment payload (header already stored)
-            memcpy(&conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + conn->acl_recombination_pos], &packet[4], acl_length );
+            memcpy(&conn->acl_recombination_packet[conn->acl_recombination_pos], &packet[4], acl_length );
             conn->acl_recombination_pos += acl_length;
             
             // log_error( "ACL Cont Fragment: acl_len %u, combined_len %u, l2cap_len %u", acl_length,
@@ -772,10 +1069,9 @@ static void acl_handler(uint8_t *packet, int size){
             
             // forward complete L2CAP packet if complete. 
             if (conn->acl_recombination_pos >= conn->acl_recombination_length + 4 + 4){ // pos already incl. ACL header
-                hci_emit_acl_packet(&conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE], conn->acl_recombination_pos);
+                hci_emit_acl_packet(conn->acl_recombination_packet, conn->acl_recombination_pos);
                 // reset recombination buffer
-                conn->acl_recombination_length = 0;
-                conn->acl_recombination_pos = 0;
+                hci_acl_recombination_reset(conn);
             }
             break;
             
@@ -784,7 +1080,7 @@ static void acl_handler(uint8_t *packet, int size){
             // sanity check
             if (conn->acl_recombination_pos) {
                 log_error( "ACL First Fragment but data in buffer for handle 0x%02x, dropping stale fragments", con_handle);
-                conn->acl_recombination_pos = 0;
+                hci_acl_recombination_reset(conn);
             }
 
             // peek into L2CAP packet!
@@ -804,11 +1100,17 @@ static void acl_handler(uint8_t *packet, int size){
                     return;
                 }
 
-                // store first fragment and tweak acl length for complete package
-                memcpy(&conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE], packet, acl_length + 4);
+                // store first fragment and tweak acl length for complete package. if the fragment is in an incoming
+                // buffer, keep it there and append the following fragments in place
+                if (hci_incoming_buffer_retain(packet)){
+                    conn->acl_recombination_packet = packet;
+                } else {
+                    memcpy(&conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE], packet, acl_length + 4);
+                    conn->acl_recombination_packet = &conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+                }
                 conn->acl_recombination_pos    = acl_length + 4;
                 conn->acl_recombination_length = l2cap_length;
-                little_endian_store_16(conn->acl_recombination_buffer, HCI_INCOMING_PRE_BUFFER_SIZE + 2, l2cap_length +4);
+                little_endian_store_16(conn->acl_recombination_packet, 2, l2cap_length +4);
             }
             break;
             
@@ -832,9 +1134,14 @@ static void hci_shutdown_connection(hci_connection_t *conn){
 #endif
 
     btstack_run_loop_remove_timer(&conn->timeout);
+
+    // release outgoing packet buffer used for ACL fragmentation
+    hci_drop_acl_fragments(conn);
+
+    // release incoming buffer used for ACL recombination
+    hci_acl_recombination_reset(conn);
     
-    btstack_linked_list_remove(&hci_stack->connections, (btstack_linked_item_t *) conn);
-    btstack_memory_hci_connection_free( conn );
+    hci_connection_free(conn);
     
     // now it's gone
     hci_emit_nr_connections_changed();
@@ -1071,6 +1378,40 @@ static void hci_replace_bd_addr_placeholder(uint8_t * data, uint16_t size){
 }
 #endif
 
+static int hci_initializing_command_pipelined(void){
+    switch (hci_stack->substate){
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+        case HCI_INIT_W4_HOST_BUFFER_SIZE:
+        case HCI_INIT_W4_SET_CONTROLLER_TO_HOST_FLOW_CONTROL:
+#endif
+        case HCI_INIT_W4_SET_EVENT_MASK:
+#ifdef ENABLE_CLASSIC
+        case HCI_INIT_W4_WRITE_SIMPLE_PAIRING_MODE:
+        case HCI_INIT_W4_WRITE_PAGE_TIMEOUT:
+        case HCI_INIT_W4_WRITE_CLASS_OF_DEVICE:
+        case HCI_INIT_W4_WRITE_LOCAL_NAME:
+        case HCI_INIT_W4_WRITE_EIR_DATA:
+        case HCI_INIT_W4_WRITE_INQUIRY_MODE:
+        case HCI_INIT_W4_WRITE_SCAN_ENABLE:
+        case HCI_INIT_W4_WRITE_SYNCHRONOUS_FLOW_CONTROL_ENABLE:
+        case HCI_INIT_W4_WRITE_DEFAULT_ERRONEOUS_DATA_REPORTING:
+#endif
+#ifdef ENABLE_BLE
+        case HCI_INIT_W4_WRITE_LE_HOST_SUPPORTED:
+        case HCI_INIT_W4_LE_SET_EVENT_MASK:
+#endif
+#ifdef ENABLE_LE_DATA_LENGTH_EXTENSION
+        case HCI_INIT_W4_LE_WRITE_SUGGESTED_DATA_LENGTH:
+#endif
+#ifdef ENABLE_LE_CENTRAL
+        case HCI_INIT_W4_LE_SET_SCAN_PARAMETERS:
+#endif
+            return 1;
+        default:
+            return 0;
+    }
+}
+
 // assumption: hci_can_send_command_packet_now() == true
 static void hci_initializing_run(void){
     log_debug("hci_initializing_run: substate %u, can send %u", hci_stack->substate, hci_can_send_command_packet_now());
@@ -1165,7 +1506,7 @@ static void hci_initializing_run(void){
                             }
                             break;
                     }
-                    hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, hci_stack->hci_packet_buffer, size);
+                    hci_transport_send_packet(HCI_COMMAND_DATA_PACKET, hci_stack->hci_packet_buffer, size);
                     break;
                 }
                 log_info("Init script done");
@@ -1369,9 +1710,19 @@ static void hci_initializing_run(void){
         default:
             return;
     }
+
+    // configuration commands don't return data needed for the next steps, continue without waiting for them
+    if (!hci_initializing_command_pipelined()) return;
+    hci_stack->last_cmd_opcode = 0;
+    hci_initializing_command_completed();
 }
 
 static void hci_init_done(void){
+    // wait for Command Complete of pipelined commands
+    if (hci_stack->cmds_in_flight_count){
+        hci_stack->substate = HCI_INIT_DONE;
+        return;
+    }
     // done. tell the app
     log_info("hci_init_done -> HCI_STATE_WORKING");
     hci_stack->state = HCI_STATE_WORKING;
@@ -1379,105 +1730,8 @@ static void hci_init_done(void){
     hci_run();
 }
 
-static void hci_initializing_event_handler(uint8_t * packet, uint16_t size){
-
-    UNUSED(size);   // ok: less than 6 bytes are read from our buffer
-    
-    uint8_t command_completed = 0;
-
-    if (hci_event_packet_get_type(packet) == HCI_EVENT_COMMAND_COMPLETE){
-        uint16_t opcode = little_endian_read_16(packet,3);
-        if (opcode == hci_stack->last_cmd_opcode){
-            command_completed = 1;
-            log_debug("Command complete for expected opcode %04x at substate %u", opcode, hci_stack->substate);
-        } else {
-            log_info("Command complete for different opcode %04x, expected %04x, at substate %u", opcode, hci_stack->last_cmd_opcode, hci_stack->substate);
-        }
-    }
-
-    if (hci_event_packet_get_type(packet) == HCI_EVENT_COMMAND_STATUS){
-        uint8_t  status = packet[2];
-        uint16_t opcode = little_endian_read_16(packet,4);
-        if (opcode == hci_stack->last_cmd_opcode){
-            if (status){
-                command_completed = 1;
-                log_debug("Command status error 0x%02x for expected opcode %04x at substate %u", status, opcode, hci_stack->substate);
-            } else {
-                log_info("Command status OK for expected opcode %04x, waiting for command complete", opcode);
-            }
-        } else {
-            log_debug("Command status for opcode %04x, expected %04x", opcode, hci_stack->last_cmd_opcode);
-        }
-    }
-
-#if !defined(HAVE_PLATFORM_IPHONE_OS) && !defined (HAVE_HOST_CONTROLLER_API)
-
-    // Vendor == CSR
-    if (hci_stack->substate == HCI_INIT_W4_CUSTOM_INIT && hci_event_packet_get_type(packet) == HCI_EVENT_VENDOR_SPECIFIC){
-        // TODO: track actual command
-        command_completed = 1;
-    }
-
-    // Vendor == Toshiba
-    if (hci_stack->substate == HCI_INIT_W4_SEND_BAUD_CHANGE && hci_event_packet_get_type(packet) == HCI_EVENT_VENDOR_SPECIFIC){
-        // TODO: track actual command
-        command_completed = 1;
-    }
-
-    // Late response (> 100 ms) for HCI Reset e.g. on Toshiba TC35661:
-    // Command complete for HCI Reset arrives after we've resent the HCI Reset command
-    //
-    // HCI Reset
-    // Timeout 100 ms
-    // HCI Reset
-    // Command Complete Reset
-    // HCI Read Local Version Information
-    // Command Complete Reset - but we expected Command Complete Read Local Version Information
-    // hang...
-    //
-    // Fix: Command Complete for HCI Reset in HCI_INIT_W4_SEND_READ_LOCAL_VERSION_INFORMATION trigger resend
-    if (!command_completed
-            && hci_event_packet_get_type(packet) == HCI_EVENT_COMMAND_COMPLETE
-            && hci_stack->substate == HCI_INIT_W4_SEND_READ_LOCAL_VERSION_INFORMATION){
-
-        uint16_t opcode = little_endian_read_16(packet,3);
-        if (opcode == hci_reset.opcode){
-            hci_stack->substate = HCI_INIT_SEND_READ_LOCAL_VERSION_INFORMATION;
-            return;
-        }
-    }
-
-    // CSR & H5
-    // Fix: Command Complete for HCI Reset in HCI_INIT_W4_SEND_READ_LOCAL_VERSION_INFORMATION trigger resend
-    if (!command_completed
-            && hci_event_packet_get_type(packet) == HCI_EVENT_COMMAND_COMPLETE
-            && hci_stack->substate == HCI_INIT_W4_READ_LOCAL_SUPPORTED_COMMANDS){
-
-        uint16_t opcode = little_endian_read_16(packet,3);
-        if (opcode == hci_reset.opcode){
-            hci_stack->substate = HCI_INIT_READ_LOCAL_SUPPORTED_COMMANDS;
-            return;
-        }
-    }
-
-    // on CSR with BCSP/H5, the reset resend timeout leads to substate == HCI_INIT_SEND_RESET or HCI_INIT_SEND_RESET_CSR_WARM_BOOT
-    // fix: Correct substate and behave as command below
-    if (command_completed){
-        switch (hci_stack->substate){
-            case HCI_INIT_SEND_RESET:
-                hci_stack->substate = HCI_INIT_W4_SEND_RESET;
-                break;
-            case HCI_INIT_SEND_RESET_CSR_WARM_BOOT:
-                hci_stack->substate = HCI_INIT_W4_CUSTOM_INIT_CSR_WARM_BOOT;
-                break;
-            default:
-                break;
-        }
-    }
-
-#endif
-
-    if (!command_completed) return;
+// select next init step after completion of the current command
+static void hci_initializing_command_completed(void){
 
     int need_baud_change = 0;
     int need_addr_change = 0;
@@ -1681,6 +1935,120 @@ static void hci_initializing_event_handler(uint8_t * packet, uint16_t size){
     hci_initializing_next_state();
 }
 
+static void hci_initializing_event_handler(uint8_t * packet, uint16_t size){
+
+    UNUSED(size);   // ok: less than 6 bytes are read from our buffer
+    
+    uint8_t command_completed = 0;
+
+    // init done after all pipelined commands are complete
+    if (hci_stack->substate == HCI_INIT_DONE){
+        if (hci_stack->cmds_in_flight_count == 0){
+            hci_init_done();
+        }
+        return;
+    }
+
+    // last_cmd_opcode is 0 if no command is expected to complete, e.g. after a pipelined command
+    if (hci_event_packet_get_type(packet) == HCI_EVENT_COMMAND_COMPLETE){
+        uint16_t opcode = little_endian_read_16(packet,3);
+        if (opcode && opcode == hci_stack->last_cmd_opcode){
+            command_completed = 1;
+            log_debug("Command complete for expected opcode %04x at substate %u", opcode, hci_stack->substate);
+        } else {
+            log_info("Command complete for different opcode %04x, expected %04x, at substate %u", opcode, hci_stack->last_cmd_opcode, hci_stack->substate);
+        }
+    }
+
+    if (hci_event_packet_get_type(packet) == HCI_EVENT_COMMAND_STATUS){
+        uint8_t  status = packet[2];
+        uint16_t opcode = little_endian_read_16(packet,4);
+        if (opcode && opcode == hci_stack->last_cmd_opcode){
+            if (status){
+                command_completed = 1;
+                log_debug("Command status error 0x%02x for expected opcode %04x at substate %u", status, opcode, hci_stack->substate);
+            } else {
+                log_info("Command status OK for expected opcode %04x, waiting for command complete", opcode);
+            }
+        } else {
+            log_debug("Command status for opcode %04x, expected %04x", opcode, hci_stack->last_cmd_opcode);
+        }
+    }
+
+#if !defined(HAVE_PLATFORM_IPHONE_OS) && !defined (HAVE_HOST_CONTROLLER_API)
+
+    // Vendor == CSR
+    if (hci_stack->substate == HCI_INIT_W4_CUSTOM_INIT && hci_event_packet_get_type(packet) == HCI_EVENT_VENDOR_SPECIFIC){
+        // TODO: track actual command
+        command_completed = 1;
+    }
+
+    // Vendor == Toshiba
+    if (hci_stack->substate == HCI_INIT_W4_SEND_BAUD_CHANGE && hci_event_packet_get_type(packet) == HCI_EVENT_VENDOR_SPECIFIC){
+        // TODO: track actual command
+        command_completed = 1;
+        // no Command Complete will follow
+        hci_command_queue_remove(hci_stack->last_cmd_opcode);
+    }
+
+    // Late response (> 100 ms) for HCI Reset e.g. on Toshiba TC35661:
+    // Command complete for HCI Reset arrives after we've resent the HCI Reset command
+    //
+    // HCI Reset
+    // Timeout 100 ms
+    // HCI Reset
+    // Command Complete Reset
+    // HCI Read Local Version Information
+    // Command Complete Reset - but we expected Command Complete Read Local Version Information
+    // hang...
+    //
+    // Fix: Command Complete for HCI Reset in HCI_INIT_W4_SEND_READ_LOCAL_VERSION_INFORMATION trigger resend
+    if (!command_completed
+            && hci_event_packet_get_type(packet) == HCI_EVENT_COMMAND_COMPLETE
+            && hci_stack->substate == HCI_INIT_W4_SEND_READ_LOCAL_VERSION_INFORMATION){
+
+        uint16_t opcode = little_endian_read_16(packet,3);
+        if (opcode == hci_reset.opcode){
+            hci_stack->substate = HCI_INIT_SEND_READ_LOCAL_VERSION_INFORMATION;
+            return;
+        }
+    }
+
+    // CSR & H5
+    // Fix: Command Complete for HCI Reset in HCI_INIT_W4_SEND_READ_LOCAL_VERSION_INFORMATION trigger resend
+    if (!command_completed
+            && hci_event_packet_get_type(packet) == HCI_EVENT_COMMAND_COMPLETE
+            && hci_stack->substate == HCI_INIT_W4_READ_LOCAL_SUPPORTED_COMMANDS){
+
+        uint16_t opcode = little_endian_read_16(packet,3);
+        if (opcode == hci_reset.opcode){
+            hci_stack->substate = HCI_INIT_READ_LOCAL_SUPPORTED_COMMANDS;
+            return;
+        }
+    }
+
+    // on CSR with BCSP/H5, the reset resend timeout leads to substate == HCI_INIT_SEND_RESET or HCI_INIT_SEND_RESET_CSR_WARM_BOOT
+    // fix: Correct substate and behave as command below
+    if (command_completed){
+        switch (hci_stack->substate){
+            case HCI_INIT_SEND_RESET:
+                hci_stack->substate = HCI_INIT_W4_SEND_RESET;
+                break;
+            case HCI_INIT_SEND_RESET_CSR_WARM_BOOT:
+                hci_stack->substate = HCI_INIT_W4_CUSTOM_INIT_CSR_WARM_BOOT;
+                break;
+            default:
+                break;
+        }
+    }
+
+#endif
+
+    if (!command_completed) return;
+
+    hci_initializing_command_completed();
+}
+
 static void event_handler(uint8_t *packet, int size){
 
     uint16_t event_length = packet[1];
@@ -1705,8 +2073,7 @@ static void event_handler(uint8_t *packet, int size){
     switch (hci_event_packet_get_type(packet)) {
                         
         case HCI_EVENT_COMMAND_COMPLETE:
-            // get num cmd packets - limit to 1 to reduce complexity
-            hci_stack->num_cmd_packets = packet[2] ? 1 : 0;
+            hci_command_queue_completed(little_endian_read_16(packet, 3), packet[2]);
 
             if (HCI_EVENT_IS_COMMAND_COMPLETE(packet, hci_read_local_name)){
                 if (packet[5]) break;
@@ -1820,8 +2187,7 @@ static void event_handler(uint8_t *packet, int size){
             break;
             
         case HCI_EVENT_COMMAND_STATUS:
-            // get num cmd packets - limit to 1 to reduce complexity
-            hci_stack->num_cmd_packets = packet[3] ? 1 : 0;
+            hci_command_queue_completed(little_endian_read_16(packet, 4), packet[3]);
             break;
             
         case HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS:{
@@ -1908,7 +2274,7 @@ static void event_handler(uint8_t *packet, int size){
             if (conn) {
                 if (!packet[2]){
                     conn->state = OPEN;
-                    conn->con_handle = little_endian_read_16(packet, 3);
+                    hci_connection_set_con_handle(conn, little_endian_read_16(packet, 3));
                     conn->bonding_flags |= BONDING_REQUEST_REMOTE_FEATURES;
 
                     // restart timer
@@ -1925,8 +2291,7 @@ static void event_handler(uint8_t *packet, int size){
                     memcpy(&bd_address, conn->address, 6);
 
                     // connection failed, remove entry
-                    btstack_linked_list_remove(&hci_stack->connections, (btstack_linked_item_t *) conn);
-                    btstack_memory_hci_connection_free( conn );
+                    hci_connection_free(conn);
                     
                     // notify client if dedicated bonding
                     if (notify_dedicated_bonding_failed){
@@ -1957,7 +2322,7 @@ static void event_handler(uint8_t *packet, int size){
                 break;
             }
             conn->state = OPEN;
-            conn->con_handle = little_endian_read_16(packet, 3);            
+            hci_connection_set_con_handle(conn, little_endian_read_16(packet, 3));
 
 #ifdef ENABLE_SCO_OVER_HCI
             // update SCO
@@ -2090,18 +2455,15 @@ static void event_handler(uint8_t *packet, int size){
         case HCI_EVENT_DISCONNECTION_COMPLETE:
             if (packet[2]) break;   // status != 0
             handle = little_endian_read_16(packet, 3);
-            // drop outgoing ACL fragments if it is for closed connection
-            if (hci_stack->acl_fragmentation_total_size > 0) {
-                if (handle == READ_ACL_CONNECTION_HANDLE(hci_stack->hci_packet_buffer)){
-                    log_info("hci: drop fragmented ACL data for closed connection");
-                     hci_stack->acl_fragmentation_total_size = 0;
-                     hci_stack->acl_fragmentation_pos = 0;
-                }
-            }
-
             // re-enable advertisements for le connections if active
             conn = hci_connection_for_handle(handle);
             if (!conn) break; 
+
+            // drop outgoing ACL fragments for closed connection
+            if (conn->acl_fragmentation_total_size > 0) {
+                log_info("hci: drop fragmented ACL data for closed connection");
+                hci_drop_acl_fragments(conn);
+            }
 #ifdef ENABLE_BLE
 #ifdef ENABLE_LE_PERIPHERAL
             if (hci_is_le_connection(conn) && hci_stack->le_advertisements_enabled){
@@ -2139,8 +2501,7 @@ static void event_handler(uint8_t *packet, int size){
                 log_error("Synchronous HCI Transport shouldn't send HCI_EVENT_TRANSPORT_PACKET_SENT");
                 return; // instead of break: to avoid re-entering hci_run()
             }
-            if (hci_stack->acl_fragmentation_total_size) break;
-            hci_release_packet_buffer();
+            hci_packet_buffer_packet_sent();
             
             // L2CAP receives this event via the hci_emit_event below
 
@@ -2191,8 +2552,7 @@ static void event_handler(uint8_t *packet, int size){
                         hci_stack->le_connecting_state = LE_CONNECTING_IDLE;
                         // remove entry
                         if (conn){
-                            btstack_linked_list_remove(&hci_stack->connections, (btstack_linked_item_t *) conn);
-                            btstack_memory_hci_connection_free( conn );
+                            hci_connection_free(conn);
                         }
                         break;
                     }
@@ -2222,7 +2582,7 @@ static void event_handler(uint8_t *packet, int size){
                     
                     conn->state = OPEN;
                     conn->role  = packet[6];
-                    conn->con_handle = little_endian_read_16(packet, 4);
+                    hci_connection_set_con_handle(conn, little_endian_read_16(packet, 4));
                     
                     // TODO: store - role, peer address type, conn_interval, conn_latency, supervision timeout, master clock
 
@@ -2326,6 +2686,43 @@ void hci_add_event_handler(btstack_packet_callback_registration_t * callback_han
     btstack_linked_list_add_tail(&hci_stack->event_handlers, (btstack_linked_item_t*) callback_handler);
 }
 
+/**
+ * @brief Add event packet handler for selected events.
+ */
+void hci_add_event_handler_for_events(btstack_packet_callback_registration_t * callback_handler, const uint8_t * event_codes, const uint8_t * le_subevent_codes){
+    int index;
+    for (index = 0; index < hci_stack->filtered_event_handlers_count; index++){
+        if (hci_stack->filtered_event_handlers[index] == callback_handler) return;
+    }
+    if (index == HCI_MAX_FILTERED_EVENT_HANDLERS){
+        log_info("event dispatch table full, handler receives all events");
+        hci_add_event_handler(callback_handler);
+        return;
+    }
+    hci_stack->filtered_event_handlers[index] = callback_handler;
+    hci_stack->filtered_event_handlers_count++;
+
+    hci_event_handler_mask_t handler_bit = (hci_event_handler_mask_t) (1u << index);
+    if (event_codes){
+        for ( ; *event_codes ; event_codes++){
+            hci_stack->event_dispatch_table[*event_codes] |= handler_bit;
+        }
+    }
+    int i;
+    if (le_subevent_codes == NULL){
+        hci_stack->le_meta_all_subevents |= handler_bit;
+        for (i = 0; i < HCI_LE_META_DISPATCH_TABLE_SIZE; i++){
+            hci_stack->le_meta_dispatch_table[i] |= handler_bit;
+        }
+        return;
+    }
+    hci_stack->event_dispatch_table[HCI_EVENT_LE_META] |= handler_bit;
+    for ( ; *le_subevent_codes ; le_subevent_codes++){
+        if (*le_subevent_codes >= HCI_LE_META_DISPATCH_TABLE_SIZE) continue;
+        hci_stack->le_meta_dispatch_table[*le_subevent_codes] |= handler_bit;
+    }
+}
+
 
 /** Register HCI packet handlers */
 void hci_register_acl_packet_handler(btstack_packet_handler_t handler){
@@ -2344,6 +2741,7 @@ void hci_register_sco_packet_handler(btstack_packet_handler_t handler){
 static void hci_state_reset(void){
     // no connections yet
     hci_stack->connections = NULL;
+    btstack_linked_list_index_init(&hci_stack->connection_index, hci_stack->connection_index_entries, HCI_CONNECTION_INDEX_SIZE);
 
     // keep discoverable/connectable as this has been requested by the client(s)
     // hci_stack->discoverable = 0;
@@ -2351,8 +2749,11 @@ static void hci_state_reset(void){
     // hci_stack->bondable = 1;
     // hci_stack->own_addr_type = 0;
 
-    // buffer is free
-    hci_stack->hci_packet_buffer_reserved = 0;
+    // buffers are free
+    hci_packet_buffers_reset();
+
+    // HCI Reset discards commands in Controller
+    hci_stack->cmds_in_flight_count = 0;
 
     // no pending cmds
     hci_stack->decline_reason = 0;
@@ -2403,7 +2804,7 @@ void hci_init(const hci_transport_t *transport, const void *config){
     hci_stack->config = config;
     
     // setup pointer for outgoing packet buffer
-    hci_stack->hci_packet_buffer = &hci_stack->hci_packet_buffer_data[HCI_OUTGOING_PRE_BUFFER_SIZE];
+    hci_packet_buffers_reset();
 
     // max acl payload size defined in config.h
     hci_stack->acl_data_packet_length = HCI_ACL_PAYLOAD_SIZE;
@@ -2628,7 +3029,8 @@ static int hci_power_control_wake(void){
 static void hci_power_transition_to_initializing(void){
     // set up state machine
     hci_stack->num_cmd_packets = 1; // assume that one cmd can be sent
-    hci_stack->hci_packet_buffer_reserved = 0;
+    hci_stack->cmds_in_flight_count = 0;
+    hci_packet_buffers_reset();
     hci_stack->state = HCI_STATE_INITIALIZING;
     hci_stack->substate = HCI_INIT_SEND_RESET;
 }
@@ -2839,35 +3241,24 @@ static void hci_host_num_completed_packets(void){
     hci_stack->host_completed_packets = 0;
 
     hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, packet, size);
-    hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, packet, size);
-
-    // release packet buffer for synchronous transport implementations    
-    if (hci_transport_synchronous()){
-        hci_stack->hci_packet_buffer_reserved = 0;
-    }
+    hci_transport_send_packet(HCI_COMMAND_DATA_PACKET, packet, size);
 }
 #endif
 
-static void hci_run(void){
+static void hci_run_once(void){
     
     // log_info("hci_run: entered");
     btstack_linked_item_t * it;
 
-    // send continuation fragments first, as they block the prepared packet buffer
-    if (hci_stack->acl_fragmentation_total_size > 0) {
-        hci_con_handle_t con_handle = READ_ACL_CONNECTION_HANDLE(hci_stack->hci_packet_buffer);
-        hci_connection_t *connection = hci_connection_for_handle(con_handle);
-        if (connection) {
-            if (hci_can_send_prepared_acl_packet_now(con_handle)){
-                hci_send_acl_packet_fragments(connection);
-                return;
-            }
-        } else {
-            // connection gone -> discard further fragments
-            log_info("hci_run: fragmented ACL packet no connection -> discard fragment");
-            hci_stack->acl_fragmentation_total_size = 0;
-            hci_stack->acl_fragmentation_pos = 0;
-        }
+    // send continuation fragments first, as they block outgoing packet buffers
+    for (it = (btstack_linked_item_t *) hci_stack->connections; it ; it = it->next){
+        hci_connection_t * connection = (hci_connection_t *) it;
+        if (connection->acl_fragmentation_total_size == 0) continue;
+        // previous fragment still in flight
+        if (hci_stack->hci_packet_buffer_state[connection->acl_fragmentation_buffer] & HCI_PACKET_BUFFER_STATE_IN_FLIGHT) continue;
+        if (!hci_can_send_prepared_acl_packet_now(connection->con_handle)) continue;
+        hci_send_acl_packet_fragments(connection);
+        return;
     }
 
 #ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
@@ -3380,6 +3771,16 @@ static void hci_run(void){
     }
 }
 
+static void hci_run(void){
+    // continue while commands get sent and the Controller can accept more
+    while (1){
+        uint8_t num_cmd_packets = hci_stack->num_cmd_packets;
+        hci_run_once();
+        if (hci_stack->num_cmd_packets >= num_cmd_packets) return;
+        if (!hci_can_send_command_packet_now()) return;
+    }
+}
+
 int hci_send_cmd_packet(uint8_t *packet, int size){
     // house-keeping
     
@@ -3505,16 +3906,10 @@ int hci_send_cmd_packet(uint8_t *packet, int size){
 #endif
 
     hci_stack->num_cmd_packets--;
+    hci_command_queue_add(little_endian_read_16(packet, 0));
 
     hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, packet, size);
-    int err = hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, packet, size);
-
-    // release packet buffer for synchronous transport implementations    
-    if (hci_transport_synchronous() && (packet == hci_stack->hci_packet_buffer)){
-        hci_stack->hci_packet_buffer_reserved = 0;
-    }
-
-    return err;
+    return hci_transport_send_packet(HCI_COMMAND_DATA_PACKET, packet, size);
 }
 
 // disconnect because of security block
@@ -3589,7 +3984,24 @@ static void hci_emit_event(uint8_t * event, uint16_t size, int dump){
         hci_dump_packet( HCI_EVENT_PACKET, 0, event, size);
     } 
 
-    // dispatch to all event handlers
+    // dispatch to handlers registered for this event code and LE Meta subevent
+    uint8_t event_code = hci_event_packet_get_type(event);
+    hci_event_handler_mask_t handlers = hci_stack->event_dispatch_table[event_code];
+    if (event_code == HCI_EVENT_LE_META){
+        uint8_t subevent_code = hci_event_le_meta_get_subevent_code(event);
+        if (subevent_code < HCI_LE_META_DISPATCH_TABLE_SIZE){
+            handlers &= hci_stack->le_meta_dispatch_table[subevent_code];
+        } else {
+            handlers &= hci_stack->le_meta_all_subevents;
+        }
+    }
+    int i;
+    for (i = 0; handlers ; i++, handlers >>= 1){
+        if ((handlers & 1) == 0) continue;
+        hci_stack->filtered_event_handlers[i]->callback(HCI_EVENT_PACKET, 0, event, size);
+    }
+
+    // dispatch to all other event handlers
     btstack_linked_list_iterator_t it;
     btstack_linked_list_iterator_init(&it, &hci_stack->event_handlers);
     while (btstack_linked_list_iterator_has_next(&it)){
@@ -4034,8 +4446,7 @@ uint8_t gap_connect_cancel(void){
         case SEND_CREATE_CONNECTION:
             // skip sending create connection and emit event instead
             hci_emit_le_connection_complete(conn->address_type, conn->address, 0, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
-            btstack_linked_list_remove(&hci_stack->connections, (btstack_linked_item_t *) conn);
-            btstack_memory_hci_connection_free( conn );
+            hci_connection_free(conn);
             break;            
         case SENT_CREATE_CONNECTION:
             // request to send cancel connection
@@ -115,6 +115,47 @@ extern "C" {
 #define HCI_OUTGOING_PRE_BUFFER_SIZE 1
 #endif
 
+// number of outgoing packet buffers. with more than one buffer, the next packet can be prepared while previous ones
+// are still owned by the HCI Transport. requires a transport that emits HCI_EVENT_TRANSPORT_PACKET_SENT in send order
+#ifndef HCI_OUTGOING_PACKET_BUFFER_COUNT
+#define HCI_OUTGOING_PACKET_BUFFER_COUNT 1
+#endif
+
+// max number of HCI Commands sent to the Controller without Command Complete or Command Status. The Controller reports
+// how many commands it can accept in Num_HCI_Command_Packets, 1 = wait for completion of each command
+#ifndef HCI_MAX_COMMANDS_IN_FLIGHT
+#define HCI_MAX_COMMANDS_IN_FLIGHT 4
+#endif
+
+// max number of event handlers registered with hci_add_event_handler_for_events. These are called via a dispatch table
+// indexed by event code and LE Meta subevent code. Additional handlers are called for all events
+#ifndef HCI_MAX_FILTERED_EVENT_HANDLERS
+#define HCI_MAX_FILTERED_EVENT_HANDLERS 8
+#endif
+
+#if HCI_MAX_FILTERED_EVENT_HANDLERS <= 8
+typedef uint8_t  hci_event_handler_mask_t;
+#elif HCI_MAX_FILTERED_EVENT_HANDLERS <= 16
+typedef uint16_t hci_event_handler_mask_t;
+#elif HCI_MAX_FILTERED_EVENT_HANDLERS <= 32
+typedef uint32_t hci_event_handler_mask_t;
+#else
+#error "HCI_MAX_FILTERED_EVENT_HANDLERS > 32 not supported"
+#endif
+
+// size of the hash index over connections by connection handle. one slot is always free, so the default keeps the
+// load factor at 1/2 for MAX_NR_HCI_CONNECTIONS or 64 connections with HAVE_MALLOC. Further connections are found by a linear search
+#ifndef HCI_CONNECTION_INDEX_SIZE
+#if defined(MAX_NR_HCI_CONNECTIONS) && !defined(HAVE_MALLOC)
+#define HCI_CONNECTION_INDEX_SIZE (2 * MAX_NR_HCI_CONNECTIONS + 1)
+#else
+#define HCI_CONNECTION_INDEX_SIZE 129
+#endif
+#endif
+
+// LE Meta subevents with a higher subevent code are only delivered to handlers that did not provide a subevent list
+#define HCI_LE_META_DISPATCH_TABLE_SIZE 0x20
+
 // BNEP may uncompress the IP Header by 16 bytes
 #ifndef HCI_INCOMING_PRE_BUFFER_SIZE
 #ifdef ENABLE_CLASSIC
@@ -124,6 +165,20 @@ extern "C" {
 #endif
 #endif
 
+// number of reference counted buffers for incoming packets. HCI Transports that support it receive into these buffers.
+// HCI keeps the first fragment of a fragmented L2CAP PDU in its buffer, and layers above can retain a received packet
+// instead of copying it. 0 = off, HCI Transports use their own buffers. Packets can only be kept if another buffer is
+// free for the HCI Transport, so at least 2 buffers are needed
+#ifndef HCI_INCOMING_BUFFER_COUNT
+#define HCI_INCOMING_BUFFER_COUNT 0
+#endif
+#if HCI_INCOMING_BUFFER_COUNT == 1
+#error "HCI_INCOMING_BUFFER_COUNT must be 0 or at least 2"
+#endif
+
+// incoming buffer: pre-buffer + H4 packet type + complete L2CAP PDU as used for ACL recombination
+#define HCI_INCOMING_BUFFER_SIZE (HCI_INCOMING_PRE_BUFFER_SIZE + 1 + 4 + HCI_PACKET_BUFFER_SIZE)
+
 // 
 #define IS_COMMAND(packet, command) (little_endian_read_16(packet,0) == command.opcode)
 
@@ -409,6 +464,7 @@ typedef struct sm_connection {
     uint16_t                 sm_local_ediv;
     uint8_t                  sm_local_rand[8];
     int                      sm_le_db_index;
+    uint8_t                  sm_pairing_failed_reason;  // if connection does not own a setup context
 } sm_connection_t;
 
 //
@@ -445,6 +501,10 @@ typedef struct {
     uint16_t                request_size;
     uint8_t                 request_buffer[ATT_REQUEST_BUFFER_SIZE];
 
+    // queued values from att_server_notify_connections/att_server_indicate_connections, one bit per value slot
+    uint32_t                fanout_pending;
+    uint8_t                 fanout_next_slot;
+
 } att_server_t;
 
 #endif
@@ -504,7 +564,9 @@ typedef struct {
     uint32_t timestamp;
 
     // ACL packet recombination - PRE_BUFFER + ACL Header + ACL payload
+    // acl_recombination_packet points into acl_recombination_buffer or to the first fragment in a retained incoming buffer
     uint8_t  acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 4 + HCI_ACL_BUFFER_SIZE];
+    uint8_t * acl_recombination_packet;
     uint16_t acl_recombination_pos;
     uint16_t acl_recombination_length;
     
@@ -512,6 +574,11 @@ typedef struct {
     uint8_t num_acl_packets_sent;
     uint8_t num_sco_packets_sent;
 
+    // ACL packet fragmentation - outgoing packet buffer index + fragmentation state
+    uint8_t  acl_fragmentation_buffer;
+    uint16_t acl_fragmentation_pos;
+    uint16_t acl_fragmentation_total_size;
+
 #ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
     uint8_t num_packets_completed;
 #endif
@@ -688,6 +755,9 @@ typedef struct {
 
     // list of existing baseband connections
     btstack_linked_list_t     connections;
+    // index of connections with valid connection handle
+    btstack_linked_list_index_t       connection_index;
+    btstack_linked_list_index_entry_t connection_index_entries[HCI_CONNECTION_INDEX_SIZE];
 
     /* callback to L2CAP layer */
     btstack_packet_handler_t acl_packet_handler;
@@ -698,6 +768,13 @@ typedef struct {
     /* callbacks for events */
     btstack_linked_list_t event_handlers;
 
+    // callbacks for selected events in order of registration, with a bit per handler for each event code and LE Meta subevent
+    btstack_packet_callback_registration_t * filtered_event_handlers[HCI_MAX_FILTERED_EVENT_HANDLERS];
+    uint8_t                  filtered_event_handlers_count;
+    hci_event_handler_mask_t event_dispatch_table[256];
+    hci_event_handler_mask_t le_meta_dispatch_table[HCI_LE_META_DISPATCH_TABLE_SIZE];
+    hci_event_handler_mask_t le_meta_all_subevents;
+
     // hardware error callback
     void (*hardware_error_callback)(uint8_t error);
 
@@ -712,15 +789,31 @@ typedef struct {
     uint8_t            ssp_auto_accept;
     inquiry_mode_t     inquiry_mode;
 
-    // single buffer for HCI packet assembly + additional prebuffer for H4 drivers
+    // pool of buffers for HCI packet assembly + additional prebuffer for H4 drivers
+    // hci_packet_buffer points to the buffer used for the next packet, hci_packet_buffer_reserved is set if it is
+    // reserved or no buffer is free
     uint8_t   * hci_packet_buffer;
-    uint8_t   hci_packet_buffer_data[HCI_OUTGOING_PRE_BUFFER_SIZE + HCI_PACKET_BUFFER_SIZE];
+    uint8_t   hci_packet_buffer_data[HCI_OUTGOING_PACKET_BUFFER_COUNT][HCI_OUTGOING_PRE_BUFFER_SIZE + HCI_PACKET_BUFFER_SIZE];
     uint8_t   hci_packet_buffer_reserved;
-    uint16_t  acl_fragmentation_pos;
-    uint16_t  acl_fragmentation_total_size;
+    uint8_t   hci_packet_buffer_index;
+    uint8_t   hci_packet_buffer_state[HCI_OUTGOING_PACKET_BUFFER_COUNT];
+
+#if HCI_INCOMING_BUFFER_COUNT > 0
+    // pool of incoming buffers, a buffer is free if its reference count is 0
+    uint8_t   hci_incoming_buffer_data[HCI_INCOMING_BUFFER_COUNT][HCI_INCOMING_BUFFER_SIZE];
+    uint8_t   hci_incoming_buffer_ref_count[HCI_INCOMING_BUFFER_COUNT];
+#endif
+
+    // buffer index for packets passed to async HCI Transport, in send order
+    uint8_t   hci_packets_in_flight[HCI_OUTGOING_PACKET_BUFFER_COUNT + 2];
+    uint8_t   hci_packets_in_flight_head;
+    uint8_t   hci_packets_in_flight_count;
      
     /* host to controller flow control */
     uint8_t  num_cmd_packets;
+    // opcodes of commands waiting for Command Complete/Command Status, in send order
+    uint16_t cmds_in_flight[HCI_MAX_COMMANDS_IN_FLIGHT];
+    uint8_t  cmds_in_flight_count;
     uint8_t  acl_packets_total_num;
     uint16_t acl_data_packet_length;
     uint8_t  sco_packets_total_num;
@@ -931,6 +1024,15 @@ void hci_close(void);
  */
 void hci_add_event_handler(btstack_packet_callback_registration_t * callback_handler);
 
+/**
+ * @brief Add event packet handler that only receives the listed events. Handlers registered this way
+ * are called before handlers registered with hci_add_event_handler.
+ * @param callback_handler
+ * @param event_codes list of event codes terminated by 0
+ * @param le_subevent_codes list of LE Meta subevent codes terminated by 0, or NULL for all LE Meta events if HCI_EVENT_LE_META is in event_codes
+ */
+void hci_add_event_handler_for_events(btstack_packet_callback_registration_t * callback_handler, const uint8_t * event_codes, const uint8_t * le_subevent_codes);
+
 /**
  * @brief Registers a packet handler for ACL data. Used by L2CAP
  */
@@ -1006,9 +1108,35 @@ uint8_t* hci_get_outgoing_packet_buffer(void);
  */
 void hci_release_packet_buffer(void);
 
+// Incoming buffers, see HCI_INCOMING_BUFFER_COUNT
+
+/**
+ * @brief Keep buffer of a received packet after the packet handler returns, e.g. to process its payload later
+ * @param packet or pointer into it as passed to a packet handler
+ * @return 1 if retained, 0 if the packet is not in an incoming buffer or no buffer is left for the HCI Transport. Copy the data then
+ */
+int hci_incoming_buffer_retain(const uint8_t * packet);
+
+/**
+ * @brief Release buffer retained with hci_incoming_buffer_retain
+ * @param packet or pointer into it
+ */
+void hci_incoming_buffer_release(const uint8_t * packet);
 
 /* API_END */
 
+/**
+ * Get free incoming buffer of HCI_INCOMING_BUFFER_SIZE bytes. Called by HCI Transport
+ * @return buffer or NULL if none is free or HCI_INCOMING_BUFFER_COUNT is 0
+ */
+uint8_t * hci_incoming_buffer_get(void);
+
+/**
+ * Called by HCI Transport after the packet handler returned for a packet received into buffer
+ * @return buffer for next packet, the same one if it was not retained, or NULL if it was retained or not from the pool and none is free
+ */
+uint8_t * hci_incoming_buffer_recycle(uint8_t * buffer);
+
 
 /**
  * va_list version of hci_send_cmd
@@ -64,6 +64,27 @@
 #include <time.h>
 #include <sys/time.h>     // for timestamps
 #include <sys/stat.h>     // for mode flags
+#include <string.h>
+#endif
+
+#ifdef ENABLE_HCI_DUMP_ASYNC
+#ifndef HAVE_POSIX_FILE_IO
+#error "ENABLE_HCI_DUMP_ASYNC requires HAVE_POSIX_FILE_IO"
+#endif
+#include <pthread.h>
+#include <sys/uio.h>      // writev
+#endif
+
+#ifndef HCI_DUMP_MAX_FILENAME_LEN
+#define HCI_DUMP_MAX_FILENAME_LEN 128
+#endif
+
+#ifndef HCI_DUMP_ASYNC_BUFFER_SIZE
+#define HCI_DUMP_ASYNC_BUFFER_SIZE 65536
+#endif
+
+#ifndef HCI_DUMP_ASYNC_FLUSH_INTERVAL_MS
+#define HCI_DUMP_ASYNC_FLUSH_INTERVAL_MS 100
 #endif
 
 // BLUEZ hcidump - struct not used directly, but left here as documentation
@@ -91,33 +112,326 @@ pktlog_hdr;
 static int dump_file = -1;
 #ifdef HAVE_POSIX_FILE_IO
 static int dump_format;
-static uint8_t header_bluez[HCIDUMP_HDR_SIZE];
-static uint8_t header_packetlogger[PKTLOG_HDR_SIZE];
 static char time_string[40];
 static int  max_nr_packets = -1;
 static int  nr_packets = 0;
 static char log_message_buffer[256];
+
+// rotation
+static char     dump_filename[HCI_DUMP_MAX_FILENAME_LEN];
+static uint32_t dump_file_size;
+static time_t   dump_file_created;
+static uint32_t rotation_max_file_size;
+static uint32_t rotation_max_age_s;
+static int      rotation_num_files;
+#endif
+
+#ifdef ENABLE_HCI_DUMP_ASYNC
+// single producer (BTstack thread), single consumer (writer thread) ring of records
+// record: length (2), flags (1), reserved (1), header + packet
+#define ASYNC_RECORD_HEADER_SIZE 4
+#define ASYNC_RECORD_FLAG_WRAP   1
+#define ASYNC_RECORD_FLAG_ROTATE 2
+#define ASYNC_MAX_IOVECS         64
+
+static uint8_t          async_buffer[HCI_DUMP_ASYNC_BUFFER_SIZE];
+static uint32_t         async_head;
+static uint32_t         async_tail;
+static uint32_t         async_wakeup_pending;
+static uint32_t         async_dropped;
+static uint32_t         async_dropped_reported;
+static int              async_stop;
+static int              async_running;
+static pthread_t        async_thread;
+static pthread_mutex_t  async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   async_cond  = PTHREAD_COND_INITIALIZER;
 #endif
 
 // levels: debug, info, error
 static int log_level_enabled[3] = { 1, 1, 1};
 
+#ifdef HAVE_POSIX_FILE_IO
+static int hci_dump_open_file(void){
+    int oflags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef _WIN32
+    oflags |= O_BINARY;
+#endif
+    dump_file = open(dump_filename, oflags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+    dump_file_size = 0;
+    dump_file_created = time(NULL);
+    if (dump_file < 0){
+        printf("hci_dump_open: failed to open file %s\n", dump_filename);
+    }
+    return dump_file;
+}
+
+// keep previous files as filename.1 (newest) .. filename.num_files, or restart file if rotation not configured
+static void hci_dump_rotate_file(void){
+    char from[HCI_DUMP_MAX_FILENAME_LEN + 12];
+    char to[HCI_DUMP_MAX_FILENAME_LEN + 12];
+    int i;
+    close(dump_file);
+    if (rotation_num_files > 0){
+        for (i = rotation_num_files - 1; i > 0; i--){
+            snprintf(from, sizeof(from), "%s.%u", dump_filename, i);
+            snprintf(to,   sizeof(to),   "%s.%u", dump_filename, i + 1);
+            remove(to);
+            rename(from, to);
+        }
+        snprintf(to, sizeof(to), "%s.1", dump_filename);
+        remove(to);
+        rename(dump_filename, to);
+    }
+    hci_dump_open_file();
+}
+
+static int hci_dump_rotation_needed(uint32_t file_size, uint16_t record_len, time_t now){
+    if (file_size == 0) return 0;
+    if (rotation_max_file_size && (file_size + record_len) > rotation_max_file_size) return 1;
+    if (rotation_max_age_s && (uint32_t) (now - dump_file_created) >= rotation_max_age_s) return 1;
+    return 0;
+}
+
+// @returns size of header or 0 if packet type cannot be stored
+static int hci_dump_setup_header(uint8_t * header, uint8_t packet_type, uint8_t in, uint16_t len, struct timeval * curr_time){
+    switch (dump_format){
+        case HCI_DUMP_BLUEZ:
+            little_endian_store_16( header, 0, 1 + len);
+            header[2] = in;
+            header[3] = 0;
+            little_endian_store_32( header, 4, (uint32_t) curr_time->tv_sec);
+            little_endian_store_32( header, 8,            curr_time->tv_usec);
+            header[12] = packet_type;
+            return HCIDUMP_HDR_SIZE;
+            
+        case HCI_DUMP_PACKETLOGGER:
+            big_endian_store_32( header, 0, PKTLOG_HDR_SIZE - 4 + len);
+            big_endian_store_32( header, 4,  (uint32_t) curr_time->tv_sec);
+            big_endian_store_32( header, 8, curr_time->tv_usec);
+            switch (packet_type){
+                case HCI_COMMAND_DATA_PACKET:
+                    header[12] = 0x00;
+                    break;
+                case HCI_ACL_DATA_PACKET:
+                    if (in) {
+                        header[12] = 0x03;
+                    } else {
+                        header[12] = 0x02;
+                    }
+                    break;
+                case HCI_SCO_DATA_PACKET:
+                    if (in) {
+                        header[12] = 0x09;
+                    } else {
+                        header[12] = 0x08;
+                    }
+                    break;
+                case HCI_EVENT_PACKET:
+                    header[12] = 0x01;
+                    break;
+                case LOG_MESSAGE_PACKET:
+                    header[12] = 0xfc;
+                    break;
+                default:
+                    return 0;
+            }
+            return PKTLOG_HDR_SIZE;
+
+        default:
+            return 0;
+    }
+}
+#endif
+
+#ifdef ENABLE_HCI_DUMP_ASYNC
+
+static void hci_dump_async_write(struct iovec * iov, int num_iov){
+    if (num_iov == 0) return;
+    ssize_t res = writev(dump_file, iov, num_iov);
+    if (res > 0){
+        dump_file_size += (uint32_t) res;
+    }
+}
+
+// writer thread: write all stored records, batched into writev calls
+static void hci_dump_async_drain(void){
+    struct iovec iov[ASYNC_MAX_IOVECS];
+    int num_iov = 0;
+    uint32_t batch_len = 0;
+    uint32_t tail = async_tail;
+    uint32_t head = __atomic_load_n(&async_head, __ATOMIC_ACQUIRE);
+    time_t now = time(NULL);
+    while (tail != head){
+        if (HCI_DUMP_ASYNC_BUFFER_SIZE - tail < ASYNC_RECORD_HEADER_SIZE){
+            tail = 0;
+            continue;
+        }
+        uint16_t len  = little_endian_read_16(async_buffer, tail);
+        uint8_t flags = async_buffer[tail + 2];
+        if (flags & ASYNC_RECORD_FLAG_WRAP){
+            tail = 0;
+            continue;
+        }
+        if ((flags & ASYNC_RECORD_FLAG_ROTATE) || hci_dump_rotation_needed(dump_file_size + batch_len, len, now)){
+            hci_dump_async_write(iov, num_iov);
+            __atomic_store_n(&async_tail, tail, __ATOMIC_RELEASE);
+            num_iov = 0;
+            batch_len = 0;
+            hci_dump_rotate_file();
+            if (dump_file < 0) return;
+        }
+        iov[num_iov].iov_base = &async_buffer[tail + ASYNC_RECORD_HEADER_SIZE];
+        iov[num_iov].iov_len  = len;
+        num_iov++;
+        batch_len += len;
+        tail += ASYNC_RECORD_HEADER_SIZE + len;
+        if (num_iov == ASYNC_MAX_IOVECS){
+            hci_dump_async_write(iov, num_iov);
+            __atomic_store_n(&async_tail, tail, __ATOMIC_RELEASE);
+            num_iov = 0;
+            batch_len = 0;
+        }
+    }
+    hci_dump_async_write(iov, num_iov);
+    __atomic_store_n(&async_tail, tail, __ATOMIC_RELEASE);
+}
+
+static void * hci_dump_async_writer(void * context){
+    UNUSED(context);
+    while (1){
+        pthread_mutex_lock(&async_mutex);
+        if (!async_stop && !async_wakeup_pending){
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += HCI_DUMP_ASYNC_FLUSH_INTERVAL_MS * 1000000L;
+            deadline.tv_sec  += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&async_cond, &async_mutex, &deadline);
+        }
+        int stop = async_stop;
+        __atomic_store_n(&async_wakeup_pending, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&async_mutex);
+        hci_dump_async_drain();
+        if (stop) return NULL;
+    }
+}
+
+static void hci_dump_async_start(void){
+    async_head = 0;
+    async_tail = 0;
+    async_stop = 0;
+    async_wakeup_pending = 0;
+    async_running = pthread_create(&async_thread, NULL, &hci_dump_async_writer, NULL) == 0;
+    if (!async_running){
+        printf("hci_dump_open: failed to start writer thread\n");
+    }
+}
+
+static void hci_dump_async_stop(void){
+    if (!async_running) return;
+    pthread_mutex_lock(&async_mutex);
+    async_stop = 1;
+    pthread_cond_signal(&async_cond);
+    pthread_mutex_unlock(&async_mutex);
+    pthread_join(async_thread, NULL);
+    async_running = 0;
+}
+
+// BTstack thread: copy header and packet into ring, never blocks
+static int hci_dump_async_store(const uint8_t * header, uint16_t header_len, const uint8_t * packet, uint16_t len, uint8_t flags){
+    uint32_t size = ASYNC_RECORD_HEADER_SIZE + header_len + len;
+    uint32_t head = async_head;
+    uint32_t tail = __atomic_load_n(&async_tail, __ATOMIC_ACQUIRE);
+    uint32_t pos;
+    // one byte stays unused to tell full from empty
+    if (head >= tail){
+        uint32_t space_to_end = HCI_DUMP_ASYNC_BUFFER_SIZE - head;
+        if (size < space_to_end || (size == space_to_end && tail > 0)){
+            pos = head;
+        } else if (size < tail){
+            // record doesn't fit at the end, continue at start of buffer
+            if (space_to_end >= ASYNC_RECORD_HEADER_SIZE){
+                async_buffer[head + 2] = ASYNC_RECORD_FLAG_WRAP;
+            }
+            pos = 0;
+        } else {
+            return 0;
+        }
+    } else {
+        if (size >= tail - head) return 0;
+        pos = head;
+    }
+    little_endian_store_16(async_buffer, pos, header_len + len);
+    async_buffer[pos + 2] = flags;
+    async_buffer[pos + 3] = 0;
+    memcpy(&async_buffer[pos + ASYNC_RECORD_HEADER_SIZE], header, header_len);
+    memcpy(&async_buffer[pos + ASYNC_RECORD_HEADER_SIZE + header_len], packet, len);
+    head = pos + size;
+    if (head == HCI_DUMP_ASYNC_BUFFER_SIZE){
+        head = 0;
+    }
+    __atomic_store_n(&async_head, head, __ATOMIC_RELEASE);
+
+    // wake up writer early if buffer gets filled
+    uint32_t fill = head >= tail ? head - tail : HCI_DUMP_ASYNC_BUFFER_SIZE - tail + head;
+    // mutex is only taken once per writer cycle
+    if (fill >= HCI_DUMP_ASYNC_BUFFER_SIZE / 4 && __atomic_load_n(&async_wakeup_pending, __ATOMIC_ACQUIRE) == 0){
+        pthread_mutex_lock(&async_mutex);
+        __atomic_store_n(&async_wakeup_pending, 1, __ATOMIC_RELEASE);
+        pthread_cond_signal(&async_cond);
+        pthread_mutex_unlock(&async_mutex);
+    }
+    return 1;
+}
+
+static uint32_t hci_dump_async_free(void){
+    uint32_t head = async_head;
+    uint32_t tail = __atomic_load_n(&async_tail, __ATOMIC_ACQUIRE);
+    if (head >= tail) return HCI_DUMP_ASYNC_BUFFER_SIZE - head + tail - 1;
+    return tail - head - 1;
+}
+
+static void hci_dump_async_packet(uint8_t packet_type, uint8_t in, uint8_t *packet, uint16_t len, struct timeval * curr_time, uint8_t flags){
+    uint8_t header[PKTLOG_HDR_SIZE];
+    // note about dropped packets as soon as there's space again
+    if (async_dropped != async_dropped_reported){
+        char note[40];
+        if (hci_dump_async_free() < 2 * (ASYNC_RECORD_HEADER_SIZE + PKTLOG_HDR_SIZE) + sizeof(note) + len){
+            async_dropped++;
+            return;
+        }
+        uint32_t dropped = async_dropped;
+        int note_len = snprintf(note, sizeof(note), "hci_dump: %u packets dropped", (unsigned int) (dropped - async_dropped_reported));
+        int note_header_len = hci_dump_setup_header(header, LOG_MESSAGE_PACKET, 0, note_len, curr_time);
+        if (!hci_dump_async_store(header, note_header_len, (uint8_t *) note, note_len, 0)){
+            async_dropped++;
+            return;
+        }
+        async_dropped_reported = dropped;
+    }
+    int header_len = hci_dump_setup_header(header, packet_type, in, len, curr_time);
+    if (header_len == 0) return;
+    if (!hci_dump_async_store(header, header_len, packet, len, flags)){
+        async_dropped++;
+    }
+}
+#endif
+
 void hci_dump_open(const char *filename, hci_dump_format_t format){
 #ifdef HAVE_POSIX_FILE_IO
     dump_format = format;
+    nr_packets = 0;
     if (dump_format == HCI_DUMP_STDOUT) {
         dump_file = fileno(stdout);
     } else {
-
-        int oflags = O_WRONLY | O_CREAT | O_TRUNC;
-#ifdef _WIN32
-        oflags |= O_BINARY;
+        strncpy(dump_filename, filename, sizeof(dump_filename) - 1);
+        dump_filename[sizeof(dump_filename) - 1] = 0;
+        if (hci_dump_open_file() < 0) return;
+#ifdef ENABLE_HCI_DUMP_ASYNC
+        async_dropped = 0;
+        async_dropped_reported = 0;
+        hci_dump_async_start();
 #endif
-
-        dump_file = open(filename, oflags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
-        if (dump_file < 0){
-            printf("hci_dump_open: failed to open file %s\n", filename);
-        }
     }
 #else
     UNUSED(filename);
@@ -131,8 +445,22 @@ void hci_dump_open(const char *filename, hci_dump_format_t format){
 void hci_dump_set_max_packets(int packets){
     max_nr_packets = packets;
 }
+
+void hci_dump_set_rotation(uint32_t max_file_size, uint32_t max_age_s, int num_files){
+    rotation_max_file_size = max_file_size;
+    rotation_max_age_s = max_age_s;
+    rotation_num_files = num_files;
+}
 #endif
 
+uint32_t hci_dump_get_dropped_packets(void){
+#ifdef ENABLE_HCI_DUMP_ASYNC
+    return async_dropped;
+#else
+    return 0;
+#endif
+}
+
 static void printf_packet(uint8_t packet_type, uint8_t in, uint8_t * packet, uint16_t len){
     switch (packet_type){
         case HCI_COMMAND_DATA_PACKET:
@@ -199,11 +527,17 @@ void hci_dump_packet(uint8_t packet_type, uint8_t in, uint8_t *packet, uint16_t
 
 #ifdef HAVE_POSIX_FILE_IO
 
+    if (dump_format == HCI_DUMP_STDOUT){
+        printf_timestamp();
+        printf_packet(packet_type, in, packet, len);
+        return;
+    }
+
     // don't grow bigger than max_nr_packets
-    if (dump_format != HCI_DUMP_STDOUT && max_nr_packets > 0){
+    int rotate = 0;
+    if (max_nr_packets > 0){
         if (nr_packets >= max_nr_packets){
-            lseek(dump_file, 0, SEEK_SET);
-            ftruncate(dump_file, 0);
+            rotate = 1;
             nr_packets = 0;
         }
         nr_packets++;
@@ -213,62 +547,23 @@ void hci_dump_packet(uint8_t packet_type, uint8_t in, uint8_t *packet, uint16_t
     struct timeval curr_time;
     gettimeofday(&curr_time, NULL);
 
-    switch (dump_format){
-        case HCI_DUMP_STDOUT: {
-            printf_timestamp();
-            printf_packet(packet_type, in, packet, len);
-            break;
-        }
-            
-        case HCI_DUMP_BLUEZ:
-            little_endian_store_16( header_bluez, 0, 1 + len);
-            header_bluez[2] = in;
-            header_bluez[3] = 0;
-            little_endian_store_32( header_bluez, 4, (uint32_t) curr_time.tv_sec);
-            little_endian_store_32( header_bluez, 8,            curr_time.tv_usec);
-            header_bluez[12] = packet_type;
-            write (dump_file, header_bluez, HCIDUMP_HDR_SIZE);
-            write (dump_file, packet, len );
-            break;
-            
-        case HCI_DUMP_PACKETLOGGER:
-            big_endian_store_32( header_packetlogger, 0, PKTLOG_HDR_SIZE - 4 + len);
-            big_endian_store_32( header_packetlogger, 4,  (uint32_t) curr_time.tv_sec);
-            big_endian_store_32( header_packetlogger, 8, curr_time.tv_usec);
-            switch (packet_type){
-                case HCI_COMMAND_DATA_PACKET:
-                    header_packetlogger[12] = 0x00;
-                    break;
-                case HCI_ACL_DATA_PACKET:
-                    if (in) {
-                        header_packetlogger[12] = 0x03;
-                    } else {
-                        header_packetlogger[12] = 0x02;
-                    }
-                    break;
-                case HCI_SCO_DATA_PACKET:
-                    if (in) {
-                        header_packetlogger[12] = 0x09;
-                    } else {
-                        header_packetlogger[12] = 0x08;
-                    }
-                    break;
-                case HCI_EVENT_PACKET:
-                    header_packetlogger[12] = 0x01;
-                    break;
-                case LOG_MESSAGE_PACKET:
-                    header_packetlogger[12] = 0xfc;
-                    break;
-                default:
-                    return;
-            }
-            write (dump_file, &header_packetlogger, PKTLOG_HDR_SIZE);
-            write (dump_file, packet, len );
-            break;
-            
-        default:
-            break;
+#ifdef ENABLE_HCI_DUMP_ASYNC
+    if (async_running){
+        hci_dump_async_packet(packet_type, in, packet, len, &curr_time, rotate ? ASYNC_RECORD_FLAG_ROTATE : 0);
+        return;
     }
+#endif
+
+    uint8_t header[PKTLOG_HDR_SIZE];
+    int header_len = hci_dump_setup_header(header, packet_type, in, len, &curr_time);
+    if (header_len == 0) return;
+    if (rotate || hci_dump_rotation_needed(dump_file_size, header_len + len, curr_time.tv_sec)){
+        hci_dump_rotate_file();
+        if (dump_file < 0) return;
+    }
+    write (dump_file, header, header_len);
+    write (dump_file, packet, len );
+    dump_file_size += header_len + len;
 #else
 
     printf_timestamp();
@@ -320,8 +615,13 @@ void hci_dump_log_P(int log_level, PGM_P format, ...){
 #endif
 
 void hci_dump_close(void){
+#ifdef ENABLE_HCI_DUMP_ASYNC
+    hci_dump_async_stop();
+#endif
 #ifdef HAVE_POSIX_FILE_IO
-    close(dump_file);
+    if (dump_file >= 0 && dump_format != HCI_DUMP_STDOUT){
+        close(dump_file);
+    }
 #endif
     dump_file = -1;
 }
@@ -79,6 +79,18 @@ void hci_dump_open(const char *filename, hci_dump_format_t format);
  */
 void hci_dump_set_max_packets(int packets); // -1 for unlimited
 
+/*
+ * @brief Start new dump file if it would grow beyond max_file_size bytes or is older than max_age_s seconds (0 for no limit).
+ *        Also used when max packets are reached. Previous files are kept as filename.1 (newest) to filename.num_files,
+ *        with num_files = 0 the dump file is restarted.
+ */
+void hci_dump_set_rotation(uint32_t max_file_size, uint32_t max_age_s, int num_files);
+
+/*
+ * @brief Number of packets dropped since hci_dump_open, as ENABLE_HCI_DUMP_ASYNC buffer was full
+ */
+uint32_t hci_dump_get_dropped_packets(void);
+
 /*
  * @brief 
  */
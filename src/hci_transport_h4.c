@@ -123,6 +123,13 @@ typedef enum {
 #endif
 } TX_STATE;
 
+// outgoing packets are queued and sent back to back, eHCILL handles a single outgoing packet
+#ifdef ENABLE_EHCILL
+#define H4_TX_QUEUE_SIZE 1
+#else
+#define H4_TX_QUEUE_SIZE HCI_OUTGOING_PACKET_BUFFER_COUNT
+#endif
+
 // UART Driver + Config
 static const btstack_uart_block_t * btstack_uart;
 static btstack_uart_config_t uart_config;
@@ -136,6 +143,13 @@ static uint16_t  ehcill_tx_len;   // 0 == no outgoing packet
 
 static uint8_t packet_sent_event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
 
+// tx queue
+static uint8_t * tx_queue_data[H4_TX_QUEUE_SIZE];
+static uint16_t  tx_queue_len[H4_TX_QUEUE_SIZE];
+static uint8_t   tx_queue_head;
+static uint8_t   tx_queue_count;
+static uint8_t   tx_queue_in_flight;   // packets passed to UART driver
+
 static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size) = dummy_handler;
 
 // packet reader state machine
@@ -147,6 +161,14 @@ static int read_pos;
 static uint8_t hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 1 + HCI_PACKET_BUFFER_SIZE]; // packet type + max(acl header + acl payload, event header + event data)
 static uint8_t * hci_packet = &hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
 
+// select incoming buffer from HCI if available, hci_packet_with_pre_buffer otherwise
+static void hci_transport_h4_select_packet_buffer(uint8_t * buffer){
+    if (!buffer){
+        buffer = hci_packet_with_pre_buffer;
+    }
+    hci_packet = &buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+}
+
 #ifdef ENABLE_CC256X_BAUDRATE_CHANGE_FLOWCONTROL_BUG_WORKAROUND
 static const uint8_t local_version_event_prefix[] = { 0x04, 0x0e, 0x0c, 0x01, 0x01, 0x10};
 static const uint8_t baud_rate_command_prefix[]   = { 0x01, 0x36, 0xff, 0x04};
@@ -246,6 +268,8 @@ static void hci_transport_h4_block_read(void){
             }
 #endif
             packet_handler(hci_packet[0], &hci_packet[1], read_pos-1);
+            // continue with another buffer if packet was retained
+            hci_transport_h4_select_packet_buffer(hci_incoming_buffer_recycle(&hci_packet[-HCI_INCOMING_PRE_BUFFER_SIZE]));
             hci_transport_h4_reset_statemachine();
             break;
         default:
@@ -264,10 +288,42 @@ static void hci_transport_h4_block_read(void){
     hci_transport_h4_trigger_next_read();
 }
 
+static void hci_transport_h4_send_next_packet(void){
+    tx_state = TX_W4_PACKET_SENT;
+    if (tx_queue_count == 1 || btstack_uart->send_blocks == NULL){
+        tx_queue_in_flight = 1;
+        btstack_uart->send_block(tx_queue_data[tx_queue_head], tx_queue_len[tx_queue_head]);
+        return;
+    }
+    // send all queued packets at once
+    const uint8_t * buffers[BTSTACK_UART_MAX_BLOCKS];
+    uint16_t lengths[BTSTACK_UART_MAX_BLOCKS];
+    int pos = tx_queue_head;
+    tx_queue_in_flight = 0;
+    while (tx_queue_in_flight < tx_queue_count && tx_queue_in_flight < BTSTACK_UART_MAX_BLOCKS){
+        buffers[tx_queue_in_flight] = tx_queue_data[pos];
+        lengths[tx_queue_in_flight] = tx_queue_len[pos];
+        tx_queue_in_flight++;
+        pos++;
+        if (pos == H4_TX_QUEUE_SIZE){
+            pos = 0;
+        }
+    }
+    btstack_uart->send_blocks(buffers, lengths, tx_queue_in_flight);
+}
+
 static void hci_transport_h4_block_sent(void){
+    int packets_sent;
     switch (tx_state){
         case TX_W4_PACKET_SENT:
-            // packet fully sent, reset state
+            // packets fully sent, remove from queue and reset state
+            packets_sent = tx_queue_in_flight;
+            tx_queue_head += packets_sent;
+            if (tx_queue_head >= H4_TX_QUEUE_SIZE){
+                tx_queue_head -= H4_TX_QUEUE_SIZE;
+            }
+            tx_queue_count -= packets_sent;
+            tx_queue_in_flight = 0;
 #ifdef ENABLE_EHCILL
             ehcill_tx_len = 0;
 #endif
@@ -277,8 +333,14 @@ static void hci_transport_h4_block_sent(void){
             // notify eHCILL engine
             hci_transport_h4_ehcill_handle_packet_sent();
 #endif
-            // notify upper stack that it can send again
-            packet_handler(HCI_EVENT_PACKET, &packet_sent_event[0], sizeof(packet_sent_event));
+            // start sending next queued packet
+            if (tx_queue_count && tx_state == TX_IDLE){
+                hci_transport_h4_send_next_packet();
+            }
+            // notify upper stack that it can send again, once per packet
+            while (packets_sent--){
+                packet_handler(HCI_EVENT_PACKET, &packet_sent_event[0], sizeof(packet_sent_event));
+            }
             break;
 
 #ifdef ENABLE_EHCILL        
@@ -294,7 +356,11 @@ static void hci_transport_h4_block_sent(void){
 }
 
 static int hci_transport_h4_can_send_now(uint8_t packet_type){
+#ifdef ENABLE_EHCILL
     return tx_state == TX_IDLE;
+#else
+    return tx_queue_count < H4_TX_QUEUE_SIZE;
+#endif
 }
 
 static int hci_transport_h4_send_packet(uint8_t packet_type, uint8_t * packet, int size){
@@ -312,6 +378,20 @@ static int hci_transport_h4_send_packet(uint8_t packet_type, uint8_t * packet, i
     }
 #endif
 
+    if (tx_queue_count == H4_TX_QUEUE_SIZE){
+        log_error("hci_transport_h4: tx queue full");
+        return -1;
+    }
+
+    // queue packet
+    int pos = tx_queue_head + tx_queue_count;
+    if (pos >= H4_TX_QUEUE_SIZE){
+        pos -= H4_TX_QUEUE_SIZE;
+    }
+    tx_queue_data[pos] = packet;
+    tx_queue_len[pos]  = size;
+    tx_queue_count++;
+
 #ifdef ENABLE_EHCILL
     // store request for later
     ehcill_tx_len   = size;
@@ -328,9 +408,10 @@ static int hci_transport_h4_send_packet(uint8_t packet_type, uint8_t * packet, i
     }
 #endif
 
-    // start sending
-    tx_state = TX_W4_PACKET_SENT;
-    btstack_uart->send_block(packet, size);
+    // start sending if idle, otherwise packet is sent after the previous one
+    if (tx_state == TX_IDLE){
+        hci_transport_h4_send_next_packet();
+    }
     return 0;
 }
 
@@ -362,10 +443,14 @@ static int hci_transport_h4_open(void){
     if (res){
         return res;
     }
+    hci_transport_h4_select_packet_buffer(hci_incoming_buffer_get());
     hci_transport_h4_reset_statemachine();
     hci_transport_h4_trigger_next_read();
 
     tx_state = TX_IDLE;
+    tx_queue_head  = 0;
+    tx_queue_count = 0;
+    tx_queue_in_flight = 0;
 
 #ifdef ENABLE_EHCILL
     hci_transport_h4_ehcill_open();
@@ -374,7 +459,10 @@ static int hci_transport_h4_open(void){
 }
 
 static int hci_transport_h4_close(void){
-    return btstack_uart->close();
+    int res = btstack_uart->close();
+    hci_incoming_buffer_release(hci_packet);
+    hci_transport_h4_select_packet_buffer(NULL);
+    return res;
 }
 
 static void hci_transport_h4_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
@@ -590,6 +678,7 @@ static void hci_transport_h4_ehcill_handle_command(uint8_t action){
                     log_info("eHCILL: Received WAKE_UP (%02x)", action);
 #endif
                     tx_state = TX_W4_PACKET_SENT;
+                    tx_queue_in_flight = 1;
                     ehcill_state = EHCILL_STATE_AWAKE;
                     btstack_uart->send_block(ehcill_tx_data, ehcill_tx_len);
                     break;
@@ -131,10 +131,13 @@ static uint8_t  link_peer_supports_data_integrity_check;
 static btstack_timer_source_t inactivity_timer;
 static uint16_t link_inactivity_timeout_ms; // auto-sleep if set
 
-// Outgoing packet
-static uint8_t   hci_packet_type;
-static uint16_t  hci_packet_size;
-static uint8_t * hci_packet;
+// Outgoing packets - sliding window = 1, further packets are queued and sent after the current one was acknowledged
+#define H5_TX_QUEUE_SIZE HCI_OUTGOING_PACKET_BUFFER_COUNT
+static uint8_t   hci_packet_type[H5_TX_QUEUE_SIZE];
+static uint16_t  hci_packet_size[H5_TX_QUEUE_SIZE];
+static uint8_t * hci_packet[H5_TX_QUEUE_SIZE];
+static uint8_t   hci_packet_queue_head;
+static uint8_t   hci_packet_queue_count;
 
 // hci packet handler
 static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
@@ -349,17 +352,20 @@ static void hci_transport_link_send_sleep(void){
 
 static void hci_transport_link_send_queued_packet(void){
 
+    uint8_t * packet     = hci_packet[hci_packet_queue_head];
+    uint16_t packet_size = hci_packet_size[hci_packet_queue_head];
+
     uint8_t header[4];
-    hci_transport_link_calc_header(header, link_seq_nr, link_ack_nr, link_peer_supports_data_integrity_check, 1, hci_packet_type, hci_packet_size);
+    hci_transport_link_calc_header(header, link_seq_nr, link_ack_nr, link_peer_supports_data_integrity_check, 1, hci_packet_type[hci_packet_queue_head], packet_size);
 
     uint16_t data_integrity_check = 0;
     if (link_peer_supports_data_integrity_check){
-        data_integrity_check = crc16_calc_for_slip_frame(header, hci_packet, hci_packet_size);
+        data_integrity_check = crc16_calc_for_slip_frame(header, packet, packet_size);
     }
-    log_debug("hci_transport_link_send_queued_packet: seq %u, ack %u, size %u. Append dic %u, dic = 0x%04x", link_seq_nr, link_ack_nr, hci_packet_size, link_peer_supports_data_integrity_check, data_integrity_check);
-    log_debug_hexdump(hci_packet, hci_packet_size);
+    log_debug("hci_transport_link_send_queued_packet: seq %u, ack %u, size %u. Append dic %u, dic = 0x%04x", link_seq_nr, link_ack_nr, packet_size, link_peer_supports_data_integrity_check, data_integrity_check);
+    log_debug_hexdump(packet, packet_size);
 
-    hci_transport_slip_send_frame(header, hci_packet, hci_packet_size, data_integrity_check);
+    hci_transport_slip_send_frame(header, packet, packet_size, data_integrity_check);
 
     // reset inactvitiy timer
     hci_transport_inactivity_timer_set();
@@ -487,18 +493,35 @@ static int hci_transport_link_inc_seq_nr(int seq_nr){
 }
 
 static int hci_transport_link_have_outgoing_packet(void){
-    return hci_packet != 0;
+    return hci_packet_queue_count != 0;
 }
 
 static void hci_transport_link_clear_queue(void){
     btstack_run_loop_remove_timer(&link_timer);
-    hci_packet = NULL;
+    hci_packet_queue_head  = 0;
+    hci_packet_queue_count = 0;
+}
+
+// remove acknowledged packet, @returns 1 if more packets are queued
+static int hci_transport_link_dequeue_packet(void){
+    btstack_run_loop_remove_timer(&link_timer);
+    hci_packet_queue_head++;
+    if (hci_packet_queue_head == H5_TX_QUEUE_SIZE){
+        hci_packet_queue_head = 0;
+    }
+    hci_packet_queue_count--;
+    return hci_packet_queue_count != 0;
 }
 
 static void hci_transport_h5_queue_packet(uint8_t packet_type, uint8_t *packet, int size){
-    hci_packet = packet;
-    hci_packet_type = packet_type;
-    hci_packet_size = size;
+    int pos = hci_packet_queue_head + hci_packet_queue_count;
+    if (pos >= H5_TX_QUEUE_SIZE){
+        pos -= H5_TX_QUEUE_SIZE;
+    }
+    hci_packet[pos] = packet;
+    hci_packet_type[pos] = packet_type;
+    hci_packet_size[pos] = size;
+    hci_packet_queue_count++;
 }
 
 static void hci_transport_h5_emit_sleep_state(int sleep_active){
@@ -640,7 +663,11 @@ static void hci_transport_h5_process_frame(uint16_t frame_size){
                 if (hci_transport_link_have_outgoing_packet() && next_seq_nr == ack_nr){
                     log_debug("outoing packet with seq %u ack'ed", link_seq_nr);
                     link_seq_nr = next_seq_nr;
-                    hci_transport_link_clear_queue();
+                    if (hci_transport_link_dequeue_packet()){
+                        // send next queued packet
+                        hci_transport_link_actions |= HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET;
+                        hci_transport_link_set_timer(link_resend_timeout_ms);
+                    }
 
                     // notify upper stack that it can send again
                     uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
@@ -854,7 +881,7 @@ static void hci_transport_h5_register_packet_handler(void (*handler)(uint8_t pac
 }
 
 static int hci_transport_h5_can_send_packet_now(uint8_t packet_type){
-    int res = !hci_transport_link_have_outgoing_packet() && link_state == LINK_ACTIVE;
+    int res = hci_packet_queue_count < H5_TX_QUEUE_SIZE && link_state == LINK_ACTIVE;
     // log_info("can_send_packet_now: %u", res);
     return res;
 }
@@ -868,6 +895,9 @@ static int hci_transport_h5_send_packet(uint8_t packet_type, uint8_t *packet, in
     // store request
     hci_transport_h5_queue_packet(packet_type, packet, size);
 
+    // previous packet not acknowledged yet, queued packet is sent later
+    if (hci_packet_queue_count > 1) return 0;
+
     // send wakeup first
     if (link_peer_asleep){
         hci_transport_h5_emit_sleep_state(0);
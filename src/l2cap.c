@@ -68,6 +68,24 @@
 // used to cache l2cap rejects, echo, and informational requests
 #define NR_PENDING_SIGNALING_RESPONSES 3
 
+// size of hash index over classic and LE data channels by local cid, load factor 1/2 for MAX_NR_L2CAP_CHANNELS
+// or 128 channels with HAVE_MALLOC. Channels that don't fit are found by a linear search
+#ifndef L2CAP_CHANNEL_INDEX_SIZE
+#if defined(MAX_NR_L2CAP_CHANNELS) && !defined(HAVE_MALLOC)
+#define L2CAP_CHANNEL_INDEX_SIZE (2 * MAX_NR_L2CAP_CHANNELS + 1)
+#else
+#define L2CAP_CHANNEL_INDEX_SIZE 257
+#endif
+#endif
+
+// max nr of transmit opportunities granted in one call to l2cap_notify_channel_can_send
+#define L2CAP_SCHEDULER_MAX_GRANTS_PER_RUN 32
+
+// bytes added to the deficit of a waiting entry per round and weight by the default scheduler
+#ifndef L2CAP_SCHEDULER_QUANTUM
+#define L2CAP_SCHEDULER_QUANTUM 64
+#endif
+
 // nr of credits provided to remote if credits fall below watermark
 #define L2CAP_LE_DATA_CHANNELS_AUTOMATIC_CREDITS_WATERMARK 5
 #define L2CAP_LE_DATA_CHANNELS_AUTOMATIC_CREDITS_INCREMENT 5
@@ -103,6 +121,8 @@ static void l2cap_emit_channel_opened(l2cap_channel_t *channel, uint8_t status);
 static void l2cap_emit_channel_closed(l2cap_channel_t *channel);
 static void l2cap_emit_incoming_connection(l2cap_channel_t *channel);
 static int  l2cap_channel_ready_for_open(l2cap_channel_t *channel);
+static void l2cap_add_channel(l2cap_channel_t * channel);
+static void l2cap_remove_channel(l2cap_channel_t * channel);
 #endif
 #ifdef ENABLE_LE_DATA_CHANNELS
 static void l2cap_emit_le_channel_opened(l2cap_channel_t *channel, uint8_t status);
@@ -111,9 +131,13 @@ static l2cap_channel_t * l2cap_le_get_channel_for_local_cid(uint16_t local_cid);
 static void l2cap_le_notify_channel_can_send(l2cap_channel_t *channel);
 static void l2cap_le_finialize_channel_close(l2cap_channel_t *channel);
 static inline l2cap_service_t * l2cap_le_get_service(uint16_t psm);
+static void l2cap_le_add_channel(l2cap_channel_t * channel);
+static void l2cap_le_remove_channel(l2cap_channel_t * channel);
+static void l2cap_le_send_pdu(l2cap_channel_t *channel);
 #endif
 #ifdef L2CAP_USES_CHANNELS
 static void l2cap_dispatch_to_channel(l2cap_channel_t *channel, uint8_t type, uint8_t * data, uint16_t size);
+static void l2cap_free_channel_entry(l2cap_channel_t * channel);
 static l2cap_channel_t * l2cap_get_channel_for_local_cid(uint16_t local_cid);
 static l2cap_channel_t * l2cap_create_channel_entry(btstack_packet_handler_t packet_handler, bd_addr_t address, bd_addr_type_t address_type, 
         uint16_t psm, uint16_t local_mtu, gap_security_level_t security_level);
@@ -126,18 +150,21 @@ static void l2cap_ertm_retransmission_timeout_callback(btstack_timer_source_t *
 
 typedef struct l2cap_fixed_channel {
     btstack_packet_handler_t callback;
-    uint8_t waiting_for_can_send_now;
-    uint8_t next_request;
+    l2cap_scheduler_entry_t  scheduler_entry;
 } l2cap_fixed_channel_t;
 
 #ifdef ENABLE_CLASSIC
 static btstack_linked_list_t l2cap_channels;
+static btstack_linked_list_index_t       l2cap_channel_index;
+static btstack_linked_list_index_entry_t l2cap_channel_index_entries[L2CAP_CHANNEL_INDEX_SIZE];
 static btstack_linked_list_t l2cap_services;
 static uint8_t require_security_level2_for_outgoing_sdp;
 #endif
 
 #ifdef ENABLE_LE_DATA_CHANNELS
 static btstack_linked_list_t l2cap_le_channels;
+static btstack_linked_list_index_t       l2cap_le_channel_index;
+static btstack_linked_list_index_entry_t l2cap_le_channel_index_entries[L2CAP_CHANNEL_INDEX_SIZE];
 static btstack_linked_list_t l2cap_le_services;
 #endif
 
@@ -146,10 +173,31 @@ static l2cap_signaling_response_t signaling_responses[NR_PENDING_SIGNALING_RESPO
 static int signaling_responses_pending;
 
 static btstack_packet_callback_registration_t hci_event_callback_registration;
-#define FIXED_CHANNEL_FIFO_INVALID_INDEX 0xff
+
+// HCI events handled by l2cap_hci_event_handler, which also calls l2cap_run for each of them
+static const uint8_t l2cap_hci_events[] = {
+    BTSTACK_EVENT_STATE,
+    HCI_EVENT_TRANSPORT_PACKET_SENT,
+    HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS,
+    HCI_EVENT_COMMAND_STATUS,
+    HCI_EVENT_COMMAND_COMPLETE,
+    HCI_EVENT_CONNECTION_COMPLETE,
+    HCI_EVENT_DISCONNECTION_COMPLETE,
+    HCI_EVENT_READ_REMOTE_SUPPORTED_FEATURES_COMPLETE,
+    HCI_EVENT_LE_META,
+    GAP_EVENT_SECURITY_LEVEL,
+    L2CAP_EVENT_TIMEOUT_CHECK,
+    0
+};
+static const uint8_t l2cap_hci_le_subevents[] = {
+    HCI_SUBEVENT_LE_CONNECTION_COMPLETE,
+    0
+};
 static l2cap_fixed_channel_t fixed_channels[L2CAP_FIXED_CHANNEL_TABLE_SIZE];
-static uint8_t fixed_channel_head_index = FIXED_CHANNEL_FIFO_INVALID_INDEX;
-static uint8_t fixed_channel_tail_index = FIXED_CHANNEL_FIFO_INVALID_INDEX;
+
+// transmit scheduling
+static const l2cap_scheduler_t * l2cap_scheduler;
+static int l2cap_scheduler_active;
 
 #ifdef ENABLE_BLE
 // only used for connection parameter update events
@@ -533,7 +581,7 @@ uint8_t l2cap_create_ertm_channel(btstack_packet_handler_t packet_handler, bd_ad
     l2cap_ertm_configure_channel(channel, ertm_config, buffer, size);
 
     // add to connections list
-    btstack_linked_list_add(&l2cap_channels, (btstack_linked_item_t *) channel);
+    l2cap_add_channel(channel);
 
     // store local_cid
     if (out_local_cid){
@@ -760,11 +808,299 @@ static int l2cap_fixed_channel_table_index_is_le(int index){
     return 1;
 }
 
+// Transmit scheduling
+//
+// Classic channels and fixed channels waiting for can send now and LE Data Channels with an SDU to send are
+// represented by a l2cap_scheduler_entry_t. If the Controller has buffers available, the scheduler selects
+// the next entry and L2CAP emits a can send now event or sends the next PDU of the SDU.
+
+// default scheduler: strict priority between priority classes and deficit round robin within a class.
+// A new turn adds L2CAP_SCHEDULER_QUANTUM * weight bytes to the deficit of an entry, L2CAP subtracts the
+// size of each packet sent. As the packet size is not known before the transmit opportunity, an entry
+// keeps its turn while its deficit is positive and may end it with a negative deficit that is carried
+// into its next turn. An entry that requests again during its turn stays at the head of the queue.
+static btstack_linked_list_t     l2cap_scheduler_wrr_queues[L2CAP_NUM_PRIORITY_CLASSES];
+static l2cap_scheduler_entry_t * l2cap_scheduler_wrr_last_granted[L2CAP_NUM_PRIORITY_CLASSES];
+
+static void l2cap_scheduler_wrr_init(void){
+    memset(l2cap_scheduler_wrr_queues, 0, sizeof(l2cap_scheduler_wrr_queues));
+    memset(l2cap_scheduler_wrr_last_granted, 0, sizeof(l2cap_scheduler_wrr_last_granted));
+}
+
+static void l2cap_scheduler_wrr_add(l2cap_scheduler_entry_t * entry){
+    uint8_t priority_class = entry->priority_class;
+    if (entry == l2cap_scheduler_wrr_last_granted[priority_class] && entry->deficit > 0){
+        btstack_linked_list_add(&l2cap_scheduler_wrr_queues[priority_class], (btstack_linked_item_t *) entry);
+    } else {
+        // unused deficit is not kept by an entry that was idle, a negative one is
+        if (entry->deficit > 0){
+            entry->deficit = 0;
+        }
+        btstack_linked_list_add_tail(&l2cap_scheduler_wrr_queues[priority_class], (btstack_linked_item_t *) entry);
+    }
+}
+
+static void l2cap_scheduler_wrr_remove(l2cap_scheduler_entry_t * entry){
+    uint8_t priority_class = entry->priority_class;
+    btstack_linked_list_remove(&l2cap_scheduler_wrr_queues[priority_class], (btstack_linked_item_t *) entry);
+    if (l2cap_scheduler_wrr_last_granted[priority_class] == entry){
+        l2cap_scheduler_wrr_last_granted[priority_class] = NULL;
+    }
+}
+
+static l2cap_scheduler_entry_t * l2cap_scheduler_wrr_first_can_send(btstack_linked_list_t * queue, int (*can_send)(l2cap_scheduler_entry_t * entry)){
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, queue);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        l2cap_scheduler_entry_t * entry = (l2cap_scheduler_entry_t *) btstack_linked_list_iterator_next(&it);
+        if ((*can_send)(entry)) return entry;
+    }
+    return NULL;
+}
+
+static l2cap_scheduler_entry_t * l2cap_scheduler_wrr_next(int (*can_send)(l2cap_scheduler_entry_t * entry)){
+    int priority_class;
+    for (priority_class = 0; priority_class < L2CAP_NUM_PRIORITY_CLASSES; priority_class++){
+        btstack_linked_list_t * queue = &l2cap_scheduler_wrr_queues[priority_class];
+        while (1){
+            l2cap_scheduler_entry_t * entry = l2cap_scheduler_wrr_first_can_send(queue, can_send);
+            if (!entry) break;
+            btstack_linked_list_remove(queue, (btstack_linked_item_t *) entry);
+            // start new turn
+            if (entry != l2cap_scheduler_wrr_last_granted[priority_class] || entry->deficit <= 0){
+                entry->deficit += L2CAP_SCHEDULER_QUANTUM * entry->weight;
+                l2cap_scheduler_wrr_last_granted[priority_class] = entry;
+                // deficit still not paid off, skip turn. terminates as the deficit grows with each turn
+                if (entry->deficit <= 0){
+                    btstack_linked_list_add_tail(queue, (btstack_linked_item_t *) entry);
+                    continue;
+                }
+            }
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static const l2cap_scheduler_t l2cap_scheduler_weighted_round_robin = {
+    &l2cap_scheduler_wrr_init,
+    &l2cap_scheduler_wrr_add,
+    &l2cap_scheduler_wrr_remove,
+    &l2cap_scheduler_wrr_next,
+};
+
+const l2cap_scheduler_t * l2cap_scheduler_weighted_round_robin_get_instance(void){
+    return &l2cap_scheduler_weighted_round_robin;
+}
+
+void l2cap_set_scheduler(const l2cap_scheduler_t * scheduler){
+    l2cap_scheduler = scheduler;
+}
+
+static void l2cap_scheduler_entry_init(l2cap_scheduler_entry_t * entry, l2cap_scheduler_entry_type_t type, uint16_t cid, l2cap_priority_class_t priority_class){
+    memset(entry, 0, sizeof(l2cap_scheduler_entry_t));
+    entry->type = type;
+    entry->cid  = cid;
+    entry->priority_class = priority_class;
+    entry->weight = 1;
+}
+
+static void l2cap_scheduler_request(l2cap_scheduler_entry_t * entry){
+    if (entry->waiting) return;
+    entry->waiting = 1;
+    entry->request_time_ms = btstack_run_loop_get_time_ms();
+    (*l2cap_scheduler->add)(entry);
+}
+
+static void l2cap_scheduler_cancel(l2cap_scheduler_entry_t * entry){
+    if (!entry->waiting) return;
+    entry->waiting = 0;
+    (*l2cap_scheduler->remove)(entry);
+}
+
+static void l2cap_scheduler_set_priority(l2cap_scheduler_entry_t * entry, l2cap_priority_class_t priority_class, uint8_t weight){
+    int waiting = entry->waiting;
+    l2cap_scheduler_cancel(entry);
+    entry->priority_class = btstack_min(priority_class, L2CAP_NUM_PRIORITY_CLASSES - 1);
+    entry->weight  = btstack_max(weight, 1);
+    entry->deficit = 0;
+    // keep request time
+    if (waiting){
+        entry->waiting = 1;
+        (*l2cap_scheduler->add)(entry);
+    }
+}
+
+static void l2cap_scheduler_count_packet(l2cap_scheduler_entry_t * entry, uint16_t len){
+    entry->statistics.packets_sent++;
+    entry->statistics.bytes_sent += len;
+    entry->deficit -= len;
+    // packets sent without transmit opportunity don't build up more than one packet of debt
+    if (entry->deficit < - (int32_t) len){
+        entry->deficit = - (int32_t) len;
+    }
+}
+
+// entries without channel or callback can always 'send' to get dropped
+static int l2cap_scheduler_can_send(l2cap_scheduler_entry_t * entry){
+    int index;
+#ifdef L2CAP_USES_CHANNELS
+    l2cap_channel_t * channel;
+#endif
+    switch (entry->type){
+#ifdef ENABLE_CLASSIC
+        case L2CAP_SCHEDULER_ENTRY_TYPE_CHANNEL:
+            channel = l2cap_get_channel_for_local_cid(entry->cid);
+            if (!channel) return 1;
+            return hci_can_send_acl_packet_now(channel->con_handle);
+#endif
+#ifdef ENABLE_LE_DATA_CHANNELS
+        case L2CAP_SCHEDULER_ENTRY_TYPE_LE_CHANNEL:
+            channel = l2cap_le_get_channel_for_local_cid(entry->cid);
+            if (!channel) return 1;
+            if (channel->state != L2CAP_STATE_OPEN) return 0;
+            if (!channel->credits_outgoing) return 0;
+            return hci_can_send_acl_packet_now(channel->con_handle);
+#endif
+        case L2CAP_SCHEDULER_ENTRY_TYPE_FIXED_CHANNEL:
+            index = l2cap_fixed_channel_table_index_for_channel_id(entry->cid);
+            if (index < 0 || !fixed_channels[index].callback) return 1;
+            if (l2cap_fixed_channel_table_index_is_le(index)){
+#ifdef ENABLE_BLE
+                return hci_can_send_acl_le_packet_now();
+#endif
+            } else {
+#ifdef ENABLE_CLASSIC
+                return hci_can_send_acl_classic_packet_now();
+#endif
+            }
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static void l2cap_scheduler_grant(l2cap_scheduler_entry_t * entry){
+    int index;
+#ifdef L2CAP_USES_CHANNELS
+    l2cap_channel_t * channel;
+#endif
+    uint32_t wait_time_ms = btstack_run_loop_get_time_ms() - entry->request_time_ms;
+    entry->waiting = 0;
+    entry->statistics.transmit_opportunities++;
+    entry->statistics.wait_time_total_ms += wait_time_ms;
+    entry->statistics.wait_time_max_ms = btstack_max(entry->statistics.wait_time_max_ms, wait_time_ms);
+
+    switch (entry->type){
+#ifdef ENABLE_CLASSIC
+        case L2CAP_SCHEDULER_ENTRY_TYPE_CHANNEL:
+            channel = l2cap_get_channel_for_local_cid(entry->cid);
+            if (!channel) break;
+            channel->waiting_for_can_send_now = 0;
+            l2cap_emit_can_send_now(channel->packet_handler, channel->local_cid);
+            break;
+#endif
+#ifdef ENABLE_LE_DATA_CHANNELS
+        case L2CAP_SCHEDULER_ENTRY_TYPE_LE_CHANNEL:
+            channel = l2cap_le_get_channel_for_local_cid(entry->cid);
+            if (!channel) break;
+            l2cap_le_send_pdu(channel);
+            break;
+#endif
+        case L2CAP_SCHEDULER_ENTRY_TYPE_FIXED_CHANNEL:
+            index = l2cap_fixed_channel_table_index_for_channel_id(entry->cid);
+            if (index < 0 || !fixed_channels[index].callback) break;
+            l2cap_emit_can_send_now(fixed_channels[index].callback, entry->cid);
+            break;
+        default:
+            break;
+    }
+}
+
+static void l2cap_notify_channel_can_send(void){
+    // requests from can send now callbacks are handled by the outer call
+    if (l2cap_scheduler_active) return;
+    l2cap_scheduler_active = 1;
+    int i;
+    for (i = 0; i < L2CAP_SCHEDULER_MAX_GRANTS_PER_RUN; i++){
+        l2cap_scheduler_entry_t * entry = (*l2cap_scheduler->next)(&l2cap_scheduler_can_send);
+        if (!entry) break;
+        l2cap_scheduler_grant(entry);
+    }
+    l2cap_scheduler_active = 0;
+}
+
+void l2cap_set_fixed_channel_priority(uint16_t channel_id, l2cap_priority_class_t priority_class, uint8_t weight){
+    int index = l2cap_fixed_channel_table_index_for_channel_id(channel_id);
+    if (index < 0) return;
+    l2cap_scheduler_set_priority(&fixed_channels[index].scheduler_entry, priority_class, weight);
+}
+
+void l2cap_get_fixed_channel_statistics(uint16_t channel_id, l2cap_channel_statistics_t * statistics){
+    int index = l2cap_fixed_channel_table_index_for_channel_id(channel_id);
+    if (index < 0) {
+        memset(statistics, 0, sizeof(l2cap_channel_statistics_t));
+        return;
+    }
+    *statistics = fixed_channels[index].scheduler_entry.statistics;
+}
+
+#ifdef L2CAP_USES_CHANNELS
+// Classic channel or LE Data Channel
+static l2cap_channel_t * l2cap_get_scheduled_channel_for_local_cid(uint16_t local_cid){
+    l2cap_channel_t * channel = NULL;
+#ifdef ENABLE_CLASSIC
+    channel = l2cap_get_channel_for_local_cid(local_cid);
+#endif
+#ifdef ENABLE_LE_DATA_CHANNELS
+    if (!channel){
+        channel = l2cap_le_get_channel_for_local_cid(local_cid);
+    }
+#endif
+    return channel;
+}
+#endif
+
+uint8_t l2cap_set_channel_priority(uint16_t local_cid, l2cap_priority_class_t priority_class, uint8_t weight){
+#ifdef L2CAP_USES_CHANNELS
+    l2cap_channel_t * channel = l2cap_get_scheduled_channel_for_local_cid(local_cid);
+    if (!channel) return L2CAP_LOCAL_CID_DOES_NOT_EXIST;
+    l2cap_scheduler_set_priority(&channel->scheduler_entry, priority_class, weight);
+    return 0;
+#else
+    UNUSED(local_cid);      // ok: no channels
+    UNUSED(priority_class); // ok: no channels
+    UNUSED(weight);         // ok: no channels
+    return L2CAP_LOCAL_CID_DOES_NOT_EXIST;
+#endif
+}
+
+uint8_t l2cap_get_channel_statistics(uint16_t local_cid, l2cap_channel_statistics_t * statistics){
+#ifdef L2CAP_USES_CHANNELS
+    l2cap_channel_t * channel = l2cap_get_scheduled_channel_for_local_cid(local_cid);
+    if (!channel) return L2CAP_LOCAL_CID_DOES_NOT_EXIST;
+    *statistics = channel->scheduler_entry.statistics;
+    return 0;
+#else
+    UNUSED(local_cid);      // ok: no channels
+    UNUSED(statistics);     // ok: no channels
+    return L2CAP_LOCAL_CID_DOES_NOT_EXIST;
+#endif
+}
+
+#ifdef L2CAP_USES_CHANNELS
+static void l2cap_free_channel_entry(l2cap_channel_t * channel){
+    l2cap_scheduler_cancel(&channel->scheduler_entry);
+    btstack_memory_l2cap_channel_free(channel);
+}
+#endif
+
 void l2cap_init(void){
     signaling_responses_pending = 0;
     
 #ifdef ENABLE_CLASSIC
     l2cap_channels = NULL;
+    btstack_linked_list_index_init(&l2cap_channel_index, l2cap_channel_index_entries, L2CAP_CHANNEL_INDEX_SIZE);
     l2cap_services = NULL;
     require_security_level2_for_outgoing_sdp = 0;
 #endif
@@ -772,6 +1108,7 @@ void l2cap_init(void){
 #ifdef ENABLE_LE_DATA_CHANNELS
     l2cap_le_services = NULL;
     l2cap_le_channels = NULL;
+    btstack_linked_list_index_init(&l2cap_le_channel_index, l2cap_le_channel_index_entries, L2CAP_CHANNEL_INDEX_SIZE);
 #endif
 
 #ifdef ENABLE_BLE
@@ -780,14 +1117,21 @@ void l2cap_init(void){
     memset(fixed_channels, 0, sizeof(fixed_channels));
     int i;
     for (i=0;i<L2CAP_FIXED_CHANNEL_TABLE_SIZE;i++){
-        fixed_channels[i].next_request = FIXED_CHANNEL_FIFO_INVALID_INDEX;        
+        l2cap_scheduler_entry_init(&fixed_channels[i].scheduler_entry, L2CAP_SCHEDULER_ENTRY_TYPE_FIXED_CHANNEL,
+            l2cap_fixed_channel_table_channel_id_for_index(i), L2CAP_PRIORITY_CLASS_NORMAL);
+    }
+
+    if (!l2cap_scheduler){
+        l2cap_scheduler = l2cap_scheduler_weighted_round_robin_get_instance();
     }
+    l2cap_scheduler_active = 0;
+    (*l2cap_scheduler->init)();
 
     // 
     // register callback with HCI
     //
     hci_event_callback_registration.callback = &l2cap_hci_event_handler;
-    hci_add_event_handler(&hci_event_callback_registration);
+    hci_add_event_handler_for_events(&hci_event_callback_registration, l2cap_hci_events, l2cap_hci_le_subevents);
 
     hci_register_acl_packet_handler(&l2cap_acl_handler);
 
@@ -810,18 +1154,7 @@ void l2cap_request_can_send_fix_channel_now_event(hci_con_handle_t con_handle, u
     int index = l2cap_fixed_channel_table_index_for_channel_id(channel_id);
     if (index < 0) return;
 
-    // check if already registered
-    if (fixed_channels[index].waiting_for_can_send_now) return;
-
-    // insert into queue
-    if (fixed_channel_tail_index == FIXED_CHANNEL_FIFO_INVALID_INDEX){
-        fixed_channel_head_index = index;
-    } else {
-        fixed_channels[fixed_channel_tail_index].next_request = index;
-    }
-    fixed_channel_tail_index = index;
-    fixed_channels[index].next_request = FIXED_CHANNEL_FIFO_INVALID_INDEX;
-    fixed_channels[index].waiting_for_can_send_now = 1;
+    l2cap_scheduler_request(&fixed_channels[index].scheduler_entry);
     l2cap_notify_channel_can_send();
 }
 
@@ -869,6 +1202,11 @@ int l2cap_send_prepared_connectionless(hci_con_handle_t con_handle, uint16_t cid
     
     log_debug("l2cap_send_prepared_connectionless handle %u, cid 0x%02x", con_handle, cid);
     
+    int index = l2cap_fixed_channel_table_index_for_channel_id(cid);
+    if (index >= 0){
+        l2cap_scheduler_count_packet(&fixed_channels[index].scheduler_entry, len);
+    }
+
     uint8_t *acl_buffer = hci_get_outgoing_packet_buffer();
     l2cap_setup_header(acl_buffer, con_handle, 0, cid, len);
     // send
@@ -961,7 +1299,20 @@ static void l2cap_emit_incoming_connection(l2cap_channel_t *channel) {
     l2cap_dispatch_to_channel(channel, HCI_EVENT_PACKET, event, sizeof(event));
 }
 
+static void l2cap_add_channel(l2cap_channel_t * channel){
+    btstack_linked_list_add(&l2cap_channels, (btstack_linked_item_t *) channel);
+    btstack_linked_list_index_add(&l2cap_channel_index, channel->local_cid, (btstack_linked_item_t *) channel);
+}
+
+static void l2cap_remove_channel(l2cap_channel_t * channel){
+    btstack_linked_list_index_remove(&l2cap_channel_index, channel->local_cid, (btstack_linked_item_t *) channel);
+    btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
+}
+
 static l2cap_channel_t * l2cap_get_channel_for_local_cid(uint16_t local_cid){
+    l2cap_channel_t * indexed_channel = (l2cap_channel_t *) btstack_linked_list_index_get(&l2cap_channel_index, local_cid);
+    if (indexed_channel) return indexed_channel;
+    if (btstack_linked_list_index_complete(&l2cap_channel_index)) return NULL;
     btstack_linked_list_iterator_t it;    
     btstack_linked_list_iterator_init(&it, &l2cap_channels);
     while (btstack_linked_list_iterator_has_next(&it)){
@@ -985,6 +1336,7 @@ void l2cap_request_can_send_now_event(uint16_t local_cid){
         return;
     }
 #endif        
+    l2cap_scheduler_request(&channel->scheduler_entry);
     l2cap_notify_channel_can_send();
 }
 
@@ -1043,8 +1395,8 @@ static void l2cap_rtx_timeout(btstack_timer_source_t * ts){
 
     // discard channel
     // no need to stop timer here, it is removed from list during timer callback
-    btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
-    btstack_memory_l2cap_channel_free(channel);
+    l2cap_remove_channel(channel);
+    l2cap_free_channel_entry(channel);
 }
 
 static void l2cap_stop_rtx(l2cap_channel_t * channel){
@@ -1113,6 +1465,8 @@ int l2cap_send_prepared(uint16_t local_cid, uint16_t len){
     }
     
     log_debug("l2cap_send_prepared cid 0x%02x, handle %u, 1 credit used", local_cid, channel->con_handle);
+
+    l2cap_scheduler_count_packet(&channel->scheduler_entry, len);
     
     int fcs_size = 0;
 
@@ -1366,7 +1720,8 @@ static void l2cap_run(void){
 #endif
 
 #ifdef ENABLE_CLASSIC
-    uint8_t  config_options[10];
+    // MTU (4) + Retransmission and Flow Control (11) + FCS (3) options for ERTM
+    uint8_t  config_options[18];
     btstack_linked_list_iterator_init(&it, &l2cap_channels);
     while (btstack_linked_list_iterator_has_next(&it)){
 
@@ -1398,7 +1753,8 @@ static void l2cap_run(void){
                 // discard channel - l2cap_finialize_channel_close without sending l2cap close event
                 l2cap_stop_rtx(channel);
                 btstack_linked_list_iterator_remove(&it);
-                btstack_memory_l2cap_channel_free(channel); 
+                btstack_linked_list_index_remove(&l2cap_channel_index, channel->local_cid, (btstack_linked_item_t *) channel);
+                l2cap_free_channel_entry(channel); 
                 break;
                 
             case L2CAP_STATE_WILL_SEND_CONNECTION_RESPONSE_ACCEPT:
@@ -1563,10 +1919,6 @@ static void l2cap_run(void){
 #ifdef ENABLE_LE_DATA_CHANNELS
     btstack_linked_list_iterator_init(&it, &l2cap_le_channels);
     while (btstack_linked_list_iterator_has_next(&it)){
-        uint8_t  * acl_buffer;
-        uint8_t  * l2cap_payload;
-        uint16_t pos;
-        uint16_t payload_size;
         l2cap_channel_t * channel = (l2cap_channel_t *) btstack_linked_list_iterator_next(&it);
         // log_info("l2cap_run: channel %p, state %u, var 0x%02x", channel, channel->state, channel->state_var);
         switch (channel->state){
@@ -1596,7 +1948,8 @@ static void l2cap_run(void){
                 // discard channel - l2cap_finialize_channel_close without sending l2cap close event
                 l2cap_stop_rtx(channel);
                 btstack_linked_list_iterator_remove(&it);
-                btstack_memory_l2cap_channel_free(channel);
+                btstack_linked_list_index_remove(&l2cap_le_channel_index, channel->local_cid, (btstack_linked_item_t *) channel);
+                l2cap_free_channel_entry(channel);
                 break;
             case L2CAP_STATE_OPEN:
                 if (!hci_can_send_acl_packet_now(channel->con_handle)) break;
@@ -1612,39 +1965,7 @@ static void l2cap_run(void){
                     break;
                 }
 
-                // send data
-                if (!channel->send_sdu_buffer) break;
-                if (!channel->credits_outgoing) break;
-
-                // send part of SDU
-                hci_reserve_packet_buffer();
-                acl_buffer = hci_get_outgoing_packet_buffer();
-                l2cap_payload = acl_buffer + 8;
-                pos = 0;
-                if (!channel->send_sdu_pos){
-                    // store SDU len
-                    channel->send_sdu_pos += 2;
-                    little_endian_store_16(l2cap_payload, pos, channel->send_sdu_len);
-                    pos += 2;
-                }
-                payload_size = btstack_min(channel->send_sdu_len + 2 - channel->send_sdu_pos, channel->remote_mps - pos);
-                log_info("len %u, pos %u => payload %u, credits %u", channel->send_sdu_len, channel->send_sdu_pos, payload_size, channel->credits_outgoing);
-                memcpy(&l2cap_payload[pos], &channel->send_sdu_buffer[channel->send_sdu_pos-2], payload_size); // -2 for virtual SDU len
-                pos += payload_size;
-                channel->send_sdu_pos += payload_size;
-                l2cap_setup_header(acl_buffer, channel->con_handle, 0, channel->remote_cid, pos);
-                // done
-
-                channel->credits_outgoing--;
-
-                if (channel->send_sdu_pos >= channel->send_sdu_len + 2){
-                    channel->send_sdu_buffer = NULL;
-                    // send done event
-                    l2cap_emit_simple_event_with_cid(channel, L2CAP_EVENT_LE_PACKET_SENT);
-                    // inform about can send now
-                    l2cap_le_notify_channel_can_send(channel);
-                }
-                hci_send_acl_packet_buffer(8 + pos);
+                // data is sent by l2cap_notify_channel_can_send
                 break;
             case L2CAP_STATE_WILL_SEND_DISCONNECT_REQUEST:
                 if (!hci_can_send_acl_packet_now(channel->con_handle)) break;
@@ -1739,6 +2060,20 @@ static void l2cap_handle_remote_supported_features_received(l2cap_channel_t * ch
 #endif
 
 #ifdef L2CAP_USES_CHANNELS
+// latency sensitive HID and AVDTP before bulk data from BNEP
+static l2cap_priority_class_t l2cap_priority_class_for_psm(uint16_t psm){
+    switch (psm){
+        case PSM_HID_CONTROL:
+        case PSM_HID_INTERRUPT:
+        case BLUETOOTH_PROTOCOL_AVDTP:
+            return L2CAP_PRIORITY_CLASS_HIGH;
+        case PSM_BNEP:
+            return L2CAP_PRIORITY_CLASS_BULK;
+        default:
+            return L2CAP_PRIORITY_CLASS_NORMAL;
+    }
+}
+
 static l2cap_channel_t * l2cap_create_channel_entry(btstack_packet_handler_t packet_handler, bd_addr_t address, bd_addr_type_t address_type, 
     uint16_t psm, uint16_t local_mtu, gap_security_level_t security_level){
 
@@ -1763,6 +2098,12 @@ static l2cap_channel_t * l2cap_create_channel_entry(btstack_packet_handler_t pac
     channel->local_cid = l2cap_next_local_cid();
     channel->con_handle = 0;
 
+    if (address_type == BD_ADDR_TYPE_CLASSIC){
+        l2cap_scheduler_entry_init(&channel->scheduler_entry, L2CAP_SCHEDULER_ENTRY_TYPE_CHANNEL, channel->local_cid, l2cap_priority_class_for_psm(psm));
+    } else {
+        l2cap_scheduler_entry_init(&channel->scheduler_entry, L2CAP_SCHEDULER_ENTRY_TYPE_LE_CHANNEL, channel->local_cid, L2CAP_PRIORITY_CLASS_NORMAL);
+    }
+
     // set initial state
     channel->state = L2CAP_STATE_WILL_SEND_CREATE_CONNECTION;
     channel->state_var = L2CAP_CHANNEL_STATE_VAR_NONE;
@@ -1800,7 +2141,7 @@ uint8_t l2cap_create_channel(btstack_packet_handler_t channel_packet_handler, bd
 #endif    
 
     // add to connections list
-    btstack_linked_list_add(&l2cap_channels, (btstack_linked_item_t *) channel);
+    l2cap_add_channel(channel);
 
     // store local_cid
     if (out_local_cid){
@@ -1865,8 +2206,8 @@ static void l2cap_handle_connection_failed_for_addr(bd_addr_t address, uint8_t s
                 l2cap_emit_channel_opened(channel, status);
                 // discard channel
                 l2cap_stop_rtx(channel);
-                btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
-                btstack_memory_l2cap_channel_free(channel);
+                l2cap_remove_channel(channel);
+                l2cap_free_channel_entry(channel);
                 break;
             }
         }
@@ -1888,76 +2229,6 @@ static void l2cap_handle_connection_success_for_addr(bd_addr_t address, hci_con_
 }
 #endif
 
-static void l2cap_notify_channel_can_send(void){
-
-#ifdef ENABLE_CLASSIC
-    btstack_linked_list_iterator_t it;
-    btstack_linked_list_iterator_init(&it, &l2cap_channels);
-    while (btstack_linked_list_iterator_has_next(&it)){
-        l2cap_channel_t * channel = (l2cap_channel_t *) btstack_linked_list_iterator_next(&it);
-        if (!channel->waiting_for_can_send_now) continue;
-        if (!hci_can_send_acl_packet_now(channel->con_handle)) continue;
-        channel->waiting_for_can_send_now = 0;
-        l2cap_emit_can_send_now(channel->packet_handler, channel->local_cid);
-    }
-#endif
-
-#if 1
-    if (fixed_channel_head_index != FIXED_CHANNEL_FIFO_INVALID_INDEX){
-        int can_send = 0;
-        int remove_entry = 1;
-        uint8_t i = fixed_channel_head_index;
-        if (fixed_channels[i].callback && fixed_channels[i].waiting_for_can_send_now){
-            if (l2cap_fixed_channel_table_index_is_le(i)){
-#ifdef ENABLE_BLE
-                can_send = hci_can_send_acl_le_packet_now();
-                remove_entry = can_send;
-#endif
-            } else {
-#ifdef ENABLE_CLASSIC
-                can_send = hci_can_send_acl_classic_packet_now();
-                remove_entry = can_send;
-#endif
-            }
-        }
-        // remove entry
-        if (remove_entry){
-            fixed_channels[i].waiting_for_can_send_now = 0;
-            fixed_channel_head_index = fixed_channels[i].next_request;
-            fixed_channels[i].next_request = FIXED_CHANNEL_FIFO_INVALID_INDEX;
-            if (fixed_channel_head_index == FIXED_CHANNEL_FIFO_INVALID_INDEX){
-                fixed_channel_tail_index = FIXED_CHANNEL_FIFO_INVALID_INDEX;
-            }
-        }
-        // notify
-        if (can_send) {
-            l2cap_emit_can_send_now(fixed_channels[i].callback, l2cap_fixed_channel_table_channel_id_for_index(i));
-        }
-    }
-#else
-    int i;
-    for (i=0;i<L2CAP_FIXED_CHANNEL_TABLE_SIZE;i++){
-        if (!fixed_channels[i].callback) continue;
-        if (!fixed_channels[i].waiting_for_can_send_now) continue;
-        int can_send = 0;
-        if (l2cap_fixed_channel_table_index_is_le(i)){
-#ifdef ENABLE_BLE
-            can_send = hci_can_send_acl_le_packet_now();
-#endif
-        } else {
-#ifdef ENABLE_CLASSIC
-            can_send = hci_can_send_acl_classic_packet_now();
-#endif
-        } 
-        if (!can_send) continue;
-        fixed_channels[i].waiting_for_can_send_now = 0;
-        l2cap_emit_can_send_now(fixed_channels[i].callback, l2cap_fixed_channel_table_channel_id_for_index(i));
-    }
-
-#endif
-
-}
-
 #ifdef L2CAP_USES_CHANNELS
 
 static int l2cap_send_open_failed_on_hci_disconnect(l2cap_channel_t * channel){
@@ -2006,7 +2277,7 @@ static void l2cap_handle_hci_disconnect_event(l2cap_channel_t * channel){
     } else {
         l2cap_emit_channel_closed(channel);
     }
-    btstack_memory_l2cap_channel_free(channel);
+    l2cap_free_channel_entry(channel);
 }
 
 #endif
@@ -2076,6 +2347,7 @@ static void l2cap_hci_event_handler(uint8_t packet_type, uint16_t cid, uint8_t *
                 l2cap_channel_t * channel = (l2cap_channel_t *) btstack_linked_list_iterator_next(&it);
                 if (channel->con_handle != handle) continue;
                 btstack_linked_list_iterator_remove(&it);
+                btstack_linked_list_index_remove(&l2cap_channel_index, channel->local_cid, (btstack_linked_item_t *) channel);
                 l2cap_stop_rtx(channel);
                 l2cap_handle_hci_disconnect_event(channel);
             }
@@ -2086,6 +2358,7 @@ static void l2cap_hci_event_handler(uint8_t packet_type, uint16_t cid, uint8_t *
                 l2cap_channel_t * channel = (l2cap_channel_t *) btstack_linked_list_iterator_next(&it);
                 if (channel->con_handle != handle) continue;
                 btstack_linked_list_iterator_remove(&it);
+                btstack_linked_list_index_remove(&l2cap_le_channel_index, channel->local_cid, (btstack_linked_item_t *) channel);
                 l2cap_handle_hci_disconnect_event(channel);
             }
 #endif
@@ -2237,7 +2510,7 @@ static void l2cap_handle_connection_request(hci_con_handle_t handle, uint8_t sig
     channel->state_var  = (L2CAP_CHANNEL_STATE_VAR) (L2CAP_CHANNEL_STATE_VAR_SEND_CONN_RESP_PEND | L2CAP_CHANNEL_STATE_VAR_INCOMING);
     
     // add to connections list
-    btstack_linked_list_add(&l2cap_channels, (btstack_linked_item_t *) channel);
+    l2cap_add_channel(channel);
 
     // assert security requirements
     gap_request_security_level(handle, channel->required_security_level);
@@ -2503,8 +2776,8 @@ static void l2cap_signaling_handler_channel(l2cap_channel_t *channel, uint8_t *c
                             }
                             
                             // discard channel
-                            btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
-                            btstack_memory_l2cap_channel_free(channel);
+                            l2cap_remove_channel(channel);
+                            l2cap_free_channel_entry(channel);
                             break;
                     }
                     break;
@@ -2662,8 +2935,8 @@ static void l2cap_signaling_handler_dispatch(hci_con_handle_t handle, uint8_t *
                                 // map l2cap connection response result to BTstack status enumeration
                                 l2cap_emit_channel_opened(channel, L2CAP_CONNECTION_RESPONSE_RESULT_ERTM_NOT_SUPPORTED);
                                 // discard channel
-                                btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
-                                btstack_memory_l2cap_channel_free(channel);
+                                l2cap_remove_channel(channel);
+                                l2cap_free_channel_entry(channel);
                                 continue;
                             } else {
                                 // fallback to Basic mode
@@ -2829,8 +3102,8 @@ static int l2cap_le_signaling_handler_dispatch(hci_con_handle_t handle, uint8_t
                 l2cap_emit_le_channel_opened(channel, 0x0002);
                                 
                 // discard channel
-                btstack_linked_list_remove(&l2cap_le_channels, (btstack_linked_item_t *) channel);
-                btstack_memory_l2cap_channel_free(channel);
+                l2cap_le_remove_channel(channel);
+                l2cap_free_channel_entry(channel);
                 break;
             }
             break;
@@ -2917,10 +3190,10 @@ static int l2cap_le_signaling_handler_dispatch(hci_con_handle_t handle, uint8_t
 
                 // set initial state
                 channel->state      = L2CAP_STATE_WAIT_CLIENT_ACCEPT_OR_REJECT;
-                channel->state_var |= L2CAP_CHANNEL_STATE_VAR_INCOMING;
+                channel->state_var = (L2CAP_CHANNEL_STATE_VAR) (channel->state_var | L2CAP_CHANNEL_STATE_VAR_INCOMING);
 
                 // add to connections list
-                btstack_linked_list_add(&l2cap_le_channels, (btstack_linked_item_t *) channel);
+                l2cap_le_add_channel(channel);
 
                 // post connection request event
                 l2cap_emit_le_incoming_connection(channel);
@@ -2955,8 +3228,8 @@ static int l2cap_le_signaling_handler_dispatch(hci_con_handle_t handle, uint8_t
                 l2cap_emit_le_channel_opened(channel, result);
                                 
                 // discard channel
-                btstack_linked_list_remove(&l2cap_le_channels, (btstack_linked_item_t *) channel);
-                btstack_memory_l2cap_channel_free(channel);
+                l2cap_le_remove_channel(channel);
+                l2cap_free_channel_entry(channel);
                 break;
             }
 
@@ -2967,6 +3240,8 @@ static int l2cap_le_signaling_handler_dispatch(hci_con_handle_t handle, uint8_t
             channel->credits_outgoing = little_endian_read_16(command, L2CAP_SIGNALING_COMMAND_DATA_OFFSET + 6);
             channel->state = L2CAP_STATE_OPEN;
             l2cap_emit_le_channel_opened(channel, result);
+            // send SDU queued before channel was opened
+            l2cap_notify_channel_can_send();
             break;
 
         case LE_FLOW_CONTROL_CREDIT:
@@ -2990,6 +3265,7 @@ static int l2cap_le_signaling_handler_dispatch(hci_con_handle_t handle, uint8_t
                 break;
             }            
             log_info("l2cap: %u credits for 0x%02x, now %u", new_credits, local_cid, channel->credits_outgoing);
+            l2cap_notify_channel_can_send();
             break;
 
         case DISCONNECTION_REQUEST:
@@ -3354,8 +3630,8 @@ void l2cap_finialize_channel_close(l2cap_channel_t * channel){
     l2cap_emit_channel_closed(channel);
     // discard channel
     l2cap_stop_rtx(channel);
-    btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
-    btstack_memory_l2cap_channel_free(channel);
+    l2cap_remove_channel(channel);
+    l2cap_free_channel_entry(channel);
 }
 
 static l2cap_service_t * l2cap_get_service_internal(btstack_linked_list_t * services, uint16_t psm){
@@ -3428,6 +3704,46 @@ uint8_t l2cap_unregister_service(uint16_t psm){
 
 #ifdef ENABLE_LE_DATA_CHANNELS
 
+// send next PDU of SDU, called by scheduler
+static void l2cap_le_send_pdu(l2cap_channel_t *channel){
+    uint8_t  * acl_buffer;
+    uint8_t  * l2cap_payload;
+    uint16_t pos;
+    uint16_t payload_size;
+
+    hci_reserve_packet_buffer();
+    acl_buffer = hci_get_outgoing_packet_buffer();
+    l2cap_payload = acl_buffer + 8;
+    pos = 0;
+    if (!channel->send_sdu_pos){
+        // store SDU len
+        channel->send_sdu_pos += 2;
+        little_endian_store_16(l2cap_payload, pos, channel->send_sdu_len);
+        pos += 2;
+    }
+    payload_size = btstack_min(channel->send_sdu_len + 2 - channel->send_sdu_pos, channel->remote_mps - pos);
+    log_info("len %u, pos %u => payload %u, credits %u", channel->send_sdu_len, channel->send_sdu_pos, payload_size, channel->credits_outgoing);
+    memcpy(&l2cap_payload[pos], &channel->send_sdu_buffer[channel->send_sdu_pos-2], payload_size); // -2 for virtual SDU len
+    pos += payload_size;
+    channel->send_sdu_pos += payload_size;
+    l2cap_setup_header(acl_buffer, channel->con_handle, 0, channel->remote_cid, pos);
+    // done
+
+    channel->credits_outgoing--;
+    l2cap_scheduler_count_packet(&channel->scheduler_entry, pos);
+
+    if (channel->send_sdu_pos >= channel->send_sdu_len + 2){
+        channel->send_sdu_buffer = NULL;
+        // send done event
+        l2cap_emit_simple_event_with_cid(channel, L2CAP_EVENT_LE_PACKET_SENT);
+        // inform about can send now
+        l2cap_le_notify_channel_can_send(channel);
+    } else {
+        l2cap_scheduler_request(&channel->scheduler_entry);
+    }
+    hci_send_acl_packet_buffer(8 + pos);
+}
+
 static void l2cap_le_notify_channel_can_send(l2cap_channel_t *channel){
     if (!channel->waiting_for_can_send_now) return;
     if (channel->send_sdu_buffer) return;
@@ -3475,7 +3791,20 @@ static void l2cap_emit_le_channel_opened(l2cap_channel_t *channel, uint8_t statu
     l2cap_dispatch_to_channel(channel, HCI_EVENT_PACKET, event, sizeof(event));
 }
 
+static void l2cap_le_add_channel(l2cap_channel_t * channel){
+    btstack_linked_list_add(&l2cap_le_channels, (btstack_linked_item_t *) channel);
+    btstack_linked_list_index_add(&l2cap_le_channel_index, channel->local_cid, (btstack_linked_item_t *) channel);
+}
+
+static void l2cap_le_remove_channel(l2cap_channel_t * channel){
+    btstack_linked_list_index_remove(&l2cap_le_channel_index, channel->local_cid, (btstack_linked_item_t *) channel);
+    btstack_linked_list_remove(&l2cap_le_channels, (btstack_linked_item_t *) channel);
+}
+
 static l2cap_channel_t * l2cap_le_get_channel_for_local_cid(uint16_t local_cid){
+    l2cap_channel_t * indexed_channel = (l2cap_channel_t *) btstack_linked_list_index_get(&l2cap_le_channel_index, local_cid);
+    if (indexed_channel) return indexed_channel;
+    if (btstack_linked_list_index_complete(&l2cap_le_channel_index)) return NULL;
     btstack_linked_list_iterator_t it;    
     btstack_linked_list_iterator_init(&it, &l2cap_le_channels);
     while (btstack_linked_list_iterator_has_next(&it)){
@@ -3492,8 +3821,8 @@ void l2cap_le_finialize_channel_close(l2cap_channel_t * channel){
     channel->state = L2CAP_STATE_CLOSED;
     l2cap_emit_simple_event_with_cid(channel, L2CAP_EVENT_CHANNEL_CLOSED);
     // discard channel
-    btstack_linked_list_remove(&l2cap_le_channels, (btstack_linked_item_t *) channel);
-    btstack_memory_l2cap_channel_free(channel);
+    l2cap_le_remove_channel(channel);
+    l2cap_free_channel_entry(channel);
 }
 
 static inline l2cap_service_t * l2cap_le_get_service(uint16_t le_psm){
@@ -3619,7 +3948,7 @@ uint8_t l2cap_le_create_channel(btstack_packet_handler_t packet_handler, hci_con
     channel->automatic_credits    = initial_credits == L2CAP_LE_AUTOMATIC_CREDITS;
 
     // add to connections list
-    btstack_linked_list_add(&l2cap_le_channels, (btstack_linked_item_t *) channel);
+    l2cap_le_add_channel(channel);
 
     // go
     l2cap_run();
@@ -3728,7 +4057,8 @@ uint8_t l2cap_le_send_data(uint16_t local_cid, uint8_t * data, uint16_t len){
     channel->send_sdu_len    = len;
     channel->send_sdu_pos    = 0;
 
-    l2cap_run();
+    l2cap_scheduler_request(&channel->scheduler_entry);
+    l2cap_notify_channel_can_send();
     return 0;
 }
 
@@ -154,6 +154,57 @@ typedef struct {
 
 } l2cap_ertm_config_t;
 
+// priority classes for transmit opportunities, lower classes are served first
+typedef enum {
+    L2CAP_PRIORITY_CLASS_HIGH = 0,  // latency sensitive, e.g. HID, AVDTP
+    L2CAP_PRIORITY_CLASS_NORMAL,
+    L2CAP_PRIORITY_CLASS_BULK,      // e.g. BNEP, OBEX
+} l2cap_priority_class_t;
+
+#define L2CAP_NUM_PRIORITY_CLASSES 3
+
+typedef enum {
+    L2CAP_SCHEDULER_ENTRY_TYPE_CHANNEL = 0,     // Classic channel waiting for can send now
+    L2CAP_SCHEDULER_ENTRY_TYPE_LE_CHANNEL,      // LE Data Channel with SDU to send
+    L2CAP_SCHEDULER_ENTRY_TYPE_FIXED_CHANNEL,   // fixed channel waiting for can send now
+} l2cap_scheduler_entry_type_t;
+
+typedef struct {
+    uint32_t packets_sent;
+    uint32_t bytes_sent;                // L2CAP payload
+    uint32_t transmit_opportunities;    // can send now events or LE PDUs
+    uint32_t wait_time_total_ms;        // from request to transmit opportunity
+    uint32_t wait_time_max_ms;
+} l2cap_channel_statistics_t;
+
+// sender that waits for a transmit opportunity
+typedef struct {
+    // linked list - assert: first field
+    btstack_linked_item_t item;
+
+    uint16_t cid;               // local cid or fixed channel id
+    uint8_t  type;              // l2cap_scheduler_entry_type_t
+    uint8_t  priority_class;    // l2cap_priority_class_t
+    uint8_t  weight;            // share of bytes per round
+    int32_t  deficit;           // bytes, decreased by packets sent, used by scheduler
+    uint8_t  waiting;
+    uint32_t request_time_ms;
+
+    l2cap_channel_statistics_t statistics;
+} l2cap_scheduler_entry_t;
+
+// scheduler that selects the next sender if the Controller has buffers available
+typedef struct {
+    // called from l2cap_init
+    void (*init)(void);
+    // entry waits for transmit opportunity
+    void (*add)(l2cap_scheduler_entry_t * entry);
+    // entry does not wait anymore, e.g. channel closed
+    void (*remove)(l2cap_scheduler_entry_t * entry);
+    // remove and return next entry for which can_send returns true, NULL if none
+    l2cap_scheduler_entry_t * (*next)(int (*can_send)(l2cap_scheduler_entry_t * entry));
+} l2cap_scheduler_t;
+
 // info regarding an actual connection
 typedef struct {
     // linked list - assert: first field
@@ -192,6 +243,9 @@ typedef struct {
     uint8_t   reason; // used in decline internal
     uint8_t   waiting_for_can_send_now;
 
+    // transmit scheduling and statistics
+    l2cap_scheduler_entry_t scheduler_entry;
+
     // LE Data Channels
 
     // incoming SDU
@@ -498,6 +552,51 @@ int l2cap_send_prepared(uint16_t local_cid, uint16_t len);
  */
 void l2cap_release_packet_buffer(void);
 
+/**
+ * @brief Set scheduler for transmit opportunities of Classic channels, LE Data Channels and fixed channels
+ * @note call before l2cap_init
+ * @param scheduler
+ */
+void l2cap_set_scheduler(const l2cap_scheduler_t * scheduler);
+
+/**
+ * @brief Get default scheduler: strict priority between priority classes, deficit round robin over bytes sent within a class
+ */
+const l2cap_scheduler_t * l2cap_scheduler_weighted_round_robin_get_instance(void);
+
+/**
+ * @brief Set priority class and weight for Classic channel or LE Data Channel
+ * @note HID and AVDTP channels default to L2CAP_PRIORITY_CLASS_HIGH, BNEP to L2CAP_PRIORITY_CLASS_BULK, others to L2CAP_PRIORITY_CLASS_NORMAL with weight 1
+ * @param local_cid
+ * @param priority_class
+ * @param weight share of bytes sent per round relative to other channels in the same priority class, at least 1
+ * @return status
+ */
+uint8_t l2cap_set_channel_priority(uint16_t local_cid, l2cap_priority_class_t priority_class, uint8_t weight);
+
+/**
+ * @brief Set priority class and weight for fixed channel
+ * @param channel_id
+ * @param priority_class
+ * @param weight share of bytes sent per round relative to other channels in the same priority class, at least 1
+ */
+void l2cap_set_fixed_channel_priority(uint16_t channel_id, l2cap_priority_class_t priority_class, uint8_t weight);
+
+/**
+ * @brief Get statistics for Classic channel or LE Data Channel since it was created
+ * @param local_cid
+ * @param statistics
+ * @return status
+ */
+uint8_t l2cap_get_channel_statistics(uint16_t local_cid, l2cap_channel_statistics_t * statistics);
+
+/**
+ * @brief Get statistics for fixed channel since l2cap_init
+ * @param channel_id
+ * @param statistics
+ */
+void l2cap_get_fixed_channel_statistics(uint16_t channel_id, l2cap_channel_statistics_t * statistics);
+
 
 //
 // LE Connection Oriented Channels feature with the LE Credit Based Flow Control Mode == LE Data Channel
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2018 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ * att_db_benchmark.c
+ *
+ * Measures GATT discovery and read latency of att_db.c against a large ATT DB
+ * with and without the handle and service index.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ble/att_db.h"
+#include "ble/att_db_util.h"
+#include "bluetooth.h"
+#include "bluetooth_gatt.h"
+#include "btstack_util.h"
+#include "hci_dump.h"
+
+#define NUM_SERVICES          100
+#define NUM_CHARACTERISTICS    10
+#define NUM_READS          100000
+#define MAX_INDEX_SIZE      10000
+
+static uint16_t att_db_index[MAX_INDEX_SIZE];
+static uint16_t service_start_handles[NUM_SERVICES];
+static uint16_t service_end_handles[NUM_SERVICES];
+static uint16_t value_handles[NUM_SERVICES * NUM_CHARACTERISTICS];
+static att_connection_t att_connection;
+static uint8_t request[23];
+static uint8_t response[ATT_DEFAULT_MTU];
+
+static void setup_db(void){
+    att_db_util_init();
+    int i;
+    for (i = 0; i < NUM_SERVICES; i++){
+        uint8_t uuid128[16];
+        uuid_add_bluetooth_prefix(uuid128, 0x1234);
+        big_endian_store_16(uuid128, 0, i);
+        att_db_util_add_service_uuid128(uuid128);
+        int j;
+        for (j = 0; j < NUM_CHARACTERISTICS; j++){
+            uint8_t value[4];
+            little_endian_store_32(value, 0, i * NUM_CHARACTERISTICS + j);
+            value_handles[i * NUM_CHARACTERISTICS + j] =
+                att_db_util_add_characteristic_uuid16(0x2a00 + j, ATT_PROPERTY_READ | ATT_PROPERTY_NOTIFY, value, sizeof(value));
+        }
+    }
+}
+
+// @returns number of requests
+static int discover_primary_services(void){
+    int num_requests = 0;
+    int num_services = 0;
+    uint16_t start_handle = 1;
+    while (1){
+        request[0] = ATT_READ_BY_GROUP_TYPE_REQUEST;
+        little_endian_store_16(request, 1, start_handle);
+        little_endian_store_16(request, 3, 0xffff);
+        little_endian_store_16(request, 5, GATT_PRIMARY_SERVICE_UUID);
+        uint16_t response_len = att_handle_request(&att_connection, request, 7, response);
+        num_requests++;
+        if (response[0] != ATT_READ_BY_GROUP_TYPE_RESPONSE) break;
+        uint16_t pair_len = response[1];
+        uint16_t offset;
+        uint16_t end_handle = 0;
+        for (offset = 2; offset + pair_len <= response_len; offset += pair_len){
+            if (num_services == NUM_SERVICES) break;
+            service_start_handles[num_services] = little_endian_read_16(response, offset);
+            end_handle = little_endian_read_16(response, offset + 2);
+            service_end_handles[num_services] = end_handle;
+            num_services++;
+        }
+        if (end_handle == 0xffff) break;
+        start_handle = end_handle + 1;
+    }
+    if (num_services != NUM_SERVICES){
+        printf("service discovery failed, %u services\n", num_services);
+        exit(1);
+    }
+    return num_requests;
+}
+
+// @returns number of requests
+static int discover_characteristics(void){
+    int num_requests = 0;
+    int i;
+    for (i = 0; i < NUM_SERVICES; i++){
+        uint16_t start_handle = service_start_handles[i];
+        while (start_handle <= service_end_handles[i]){
+            request[0] = ATT_READ_BY_TYPE_REQUEST;
+            little_endian_store_16(request, 1, start_handle);
+            little_endian_store_16(request, 3, service_end_handles[i]);
+            little_endian_store_16(request, 5, GATT_CHARACTERISTICS_UUID);
+            uint16_t response_len = att_handle_request(&att_connection, request, 7, response);
+            num_requests++;
+            if (response[0] != ATT_READ_BY_TYPE_RESPONSE) break;
+            uint16_t pair_len = response[1];
+            uint16_t offset = 2;
+            while (offset + pair_len <= response_len){
+                start_handle = little_endian_read_16(response, offset) + 1;
+                offset += pair_len;
+            }
+        }
+    }
+    return num_requests;
+}
+
+// @returns number of requests
+static int read_values(void){
+    int i;
+    request[0] = ATT_READ_REQUEST;
+    for (i = 0; i < NUM_READS; i++){
+        uint16_t value_handle = value_handles[rand() % (NUM_SERVICES * NUM_CHARACTERISTICS)];
+        little_endian_store_16(request, 1, value_handle);
+        att_handle_request(&att_connection, request, 3, response);
+        if (response[0] != ATT_READ_RESPONSE){
+            printf("read 0x%04x failed\n", value_handle);
+            exit(1);
+        }
+    }
+    return NUM_READS;
+}
+
+static double now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static void run_benchmark(const char * name, int (*operation)(void), int repetitions){
+    double times[2];
+    int use_index;
+    int num_requests = 0;
+    for (use_index = 0; use_index < 2; use_index++){
+        att_set_db(att_db_util_get_address());
+        if (use_index){
+            att_set_db_index(att_db_index);
+        }
+        srand(0);
+        num_requests = 0;
+        double start = now_us();
+        int i;
+        for (i = 0; i < repetitions; i++){
+            num_requests += (*operation)();
+        }
+        times[use_index] = (now_us() - start) / num_requests;
+    }
+    printf("%-28s %6u requests, %8.3f us/request linear, %8.3f us/request indexed, speedup %6.1f\n",
+        name, num_requests / repetitions, times[0], times[1], times[0] / times[1]);
+}
+
+int main(void){
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+    setup_db();
+    uint16_t index_len = att_db_index_create(att_db_util_get_address(), att_db_index, MAX_INDEX_SIZE);
+    if (index_len == 0){
+        printf("index creation failed\n");
+        return 1;
+    }
+    printf("ATT DB: %u services, %u handles, %u bytes, index %u bytes\n",
+        NUM_SERVICES, att_db_index[0], att_db_util_get_size(), index_len * 2);
+
+    memset(&att_connection, 0, sizeof(att_connection));
+    att_connection.mtu = ATT_DEFAULT_MTU;
+    att_connection.max_mtu = ATT_DEFAULT_MTU;
+
+    run_benchmark("primary service discovery", &discover_primary_services, 100);
+    run_benchmark("characteristic discovery", &discover_characteristics, 10);
+    run_benchmark("read", &read_values, 1);
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2018 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+// *****************************************************************************
+//
+// ATT DB index tests: responses have to be identical with and without index
+//
+// *****************************************************************************
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "ble/att_db.h"
+#include "ble/att_db_util.h"
+#include "btstack_util.h"
+#include "bluetooth.h"
+#include "bluetooth_gatt.h"
+#include "hci_dump.h"
+
+#define NUM_SERVICES                20
+#define NUM_CHARACTERISTICS          6
+#define MAX_INDEX_SIZE             1000
+#define MAX_MTU                     185
+
+static uint16_t att_db_index[MAX_INDEX_SIZE];
+static uint16_t num_handles;
+
+static uint8_t  response_plain[MAX_MTU];
+static uint8_t  response_indexed[MAX_MTU];
+
+static att_connection_t att_connection;
+
+// CCCs are dynamic
+static uint16_t att_read_callback(hci_con_handle_t con_handle, uint16_t attribute_handle, uint16_t offset, uint8_t * buffer, uint16_t buffer_size){
+    UNUSED(con_handle);
+    uint8_t value[2];
+    little_endian_store_16(value, 0, attribute_handle);
+    return att_read_callback_handle_blob(value, sizeof(value), offset, buffer, buffer_size);
+}
+
+static void uuid128_for_index(uint8_t * uuid128, uint16_t index){
+    uuid_add_bluetooth_prefix(uuid128, 0x1234);
+    big_endian_store_16(uuid128, 0, index);
+}
+
+static void check_request(uint8_t * request, uint16_t request_len){
+    uint8_t const * db = att_db_util_get_address();
+    att_set_db(db);
+    uint16_t plain_len = att_handle_request(&att_connection, request, request_len, response_plain);
+    att_set_db(db);
+    att_set_db_index(att_db_index);
+    uint16_t indexed_len = att_handle_request(&att_connection, request, request_len, response_indexed);
+    CHECK_EQUAL(plain_len, indexed_len);
+    MEMCMP_EQUAL(response_plain, response_indexed, plain_len);
+}
+
+static void check_handle_range_request(uint8_t opcode, uint16_t start_handle, uint16_t end_handle, uint8_t * data, uint16_t data_len){
+    uint8_t request[40];
+    request[0] = opcode;
+    little_endian_store_16(request, 1, start_handle);
+    little_endian_store_16(request, 3, end_handle);
+    if (data_len){
+        memcpy(&request[5], data, data_len);
+    }
+    check_request(request, 5 + data_len);
+}
+
+TEST_GROUP(AttDbIndex){
+    void setup(void){
+        att_db_util_init();
+        att_db_util_add_service_uuid16(GAP_SERVICE_UUID);
+        att_db_util_add_characteristic_uuid16(GAP_DEVICE_NAME_UUID, ATT_PROPERTY_READ, (uint8_t*)"Index", 5);
+        int i;
+        for (i = 0; i < NUM_SERVICES; i++){
+            uint8_t uuid128[16];
+            if (i & 1){
+                uuid128_for_index(uuid128, i);
+                att_db_util_add_service_uuid128(uuid128);
+            } else {
+                att_db_util_add_service_uuid16(0x1800 + i);
+            }
+            int j;
+            for (j = 0; j < NUM_CHARACTERISTICS; j++){
+                uint8_t value[4];
+                little_endian_store_16(value, 0, i);
+                little_endian_store_16(value, 2, j);
+                if (j & 1){
+                    uuid128_for_index(uuid128, 0x100 + j);
+                    att_db_util_add_characteristic_uuid128(uuid128, ATT_PROPERTY_READ | ATT_PROPERTY_NOTIFY, value, sizeof(value));
+                } else {
+                    att_db_util_add_characteristic_uuid16(0x2a00 + j, ATT_PROPERTY_READ, value, j);
+                }
+            }
+        }
+        uint16_t index_len = att_db_index_create(att_db_util_get_address(), att_db_index, MAX_INDEX_SIZE);
+        CHECK(index_len > 0);
+        num_handles = att_db_index[0];
+        memset(&att_connection, 0, sizeof(att_connection));
+        att_connection.mtu = ATT_DEFAULT_MTU;
+        att_connection.max_mtu = MAX_MTU;
+        att_set_read_callback(&att_read_callback);
+    }
+    void teardown(void){
+        att_set_db_index(NULL);
+    }
+};
+
+TEST(AttDbIndex, Layout){
+    // GAP service with 3 handles, services with declaration, 3 uuid16 and 3 uuid128 characteristics with CCC
+    CHECK_EQUAL(3 + NUM_SERVICES * (1 + 3 * 2 + 3 * 3), num_handles);
+    uint16_t num_services = att_db_index[num_handles + 2];
+    CHECK_EQUAL(1 + NUM_SERVICES, num_services);
+    uint16_t * services = &att_db_index[num_handles + 3];
+    CHECK_EQUAL(1, services[0]);
+    CHECK_EQUAL(3, services[1]);
+    CHECK_EQUAL(num_handles, services[num_services * 2 - 1]);
+    // END tag
+    CHECK_EQUAL(att_db_util_get_size() - 2, att_db_index[num_handles + 1]);
+}
+
+TEST(AttDbIndex, IndexTooSmall){
+    uint16_t small_index[20];
+    CHECK_EQUAL(0, att_db_index_create(att_db_util_get_address(), small_index, sizeof(small_index) / sizeof(uint16_t)));
+}
+
+TEST(AttDbIndex, IndexMismatch){
+    uint8_t const db[] = {
+        0x0a, 0x00, 0x02, 0x00, 0x01, 0x00, 0x00, 0x28, 0x00, 0x18,
+        0x00, 0x00,
+    };
+    uint16_t other_index[10];
+    CHECK(att_db_index_create(db, other_index, 10) > 0);
+    att_set_db(att_db_util_get_address());
+    att_set_db_index(other_index);
+    // index got rejected, handle lookup still works
+    CHECK_EQUAL(GATT_CHARACTERISTICS_UUID, att_uuid_for_handle(2));
+}
+
+TEST(AttDbIndex, ReadByGroupType){
+    uint8_t primary_service[2];
+    little_endian_store_16(primary_service, 0, GATT_PRIMARY_SERVICE_UUID);
+    uint16_t mtus[] = { ATT_DEFAULT_MTU, MAX_MTU };
+    unsigned int i;
+    for (i = 0; i < sizeof(mtus) / sizeof(uint16_t); i++){
+        att_connection.mtu = mtus[i];
+        uint16_t start_handle;
+        for (start_handle = 1; start_handle <= num_handles + 1; start_handle++){
+            check_handle_range_request(ATT_READ_BY_GROUP_TYPE_REQUEST, start_handle, 0xffff, primary_service, 2);
+            check_handle_range_request(ATT_READ_BY_GROUP_TYPE_REQUEST, start_handle, start_handle + 20, primary_service, 2);
+        }
+    }
+}
+
+TEST(AttDbIndex, FindByTypeValue){
+    uint8_t request[23];
+    uint16_t start_handle;
+    for (start_handle = 1; start_handle <= num_handles + 1; start_handle += 3){
+        request[0] = ATT_FIND_BY_TYPE_VALUE_REQUEST;
+        little_endian_store_16(request, 1, start_handle);
+        little_endian_store_16(request, 3, 0xffff);
+        little_endian_store_16(request, 5, GATT_PRIMARY_SERVICE_UUID);
+        little_endian_store_16(request, 7, 0x1804);
+        check_request(request, 9);
+        uint8_t uuid128[16];
+        uuid128_for_index(uuid128, 5);
+        reverse_128(uuid128, &request[7]);
+        check_request(request, 23);
+        // generic attribute type
+        little_endian_store_16(request, 5, 0x2a02);
+        check_request(request, 7);
+    }
+}
+
+TEST(AttDbIndex, FindInformation){
+    uint16_t start_handle;
+    for (start_handle = 1; start_handle <= num_handles + 1; start_handle++){
+        check_handle_range_request(ATT_FIND_INFORMATION_REQUEST, start_handle, 0xffff, NULL, 0);
+        check_handle_range_request(ATT_FIND_INFORMATION_REQUEST, start_handle, start_handle, NULL, 0);
+    }
+}
+
+TEST(AttDbIndex, ReadByType){
+    uint8_t characteristic[2];
+    little_endian_store_16(characteristic, 0, GATT_CHARACTERISTICS_UUID);
+    uint8_t ccc[2];
+    little_endian_store_16(ccc, 0, GATT_CLIENT_CHARACTERISTICS_CONFIGURATION);
+    uint16_t start_handle;
+    for (start_handle = 1; start_handle <= num_handles + 1; start_handle++){
+        check_handle_range_request(ATT_READ_BY_TYPE_REQUEST, start_handle, 0xffff, characteristic, 2);
+        check_handle_range_request(ATT_READ_BY_TYPE_REQUEST, start_handle, start_handle + 10, ccc, 2);
+    }
+}
+
+TEST(AttDbIndex, Read){
+    uint8_t request[3];
+    request[0] = ATT_READ_REQUEST;
+    uint16_t handle;
+    for (handle = 0; handle <= num_handles + 2; handle++){
+        little_endian_store_16(request, 1, handle);
+        check_request(request, 3);
+    }
+    little_endian_store_16(request, 1, 0xffff);
+    check_request(request, 3);
+}
+
+TEST(AttDbIndex, GattServerHelpers){
+    uint16_t start_handle;
+    uint16_t end_handle;
+    att_set_db(att_db_util_get_address());
+    att_set_db_index(att_db_index);
+    CHECK_EQUAL(1, gatt_server_get_get_handle_range_for_service_with_uuid16(0x1806, &start_handle, &end_handle));
+    uint16_t value_handle = gatt_server_get_value_handle_for_characteristic_with_uuid16(start_handle, end_handle, 0x2a02);
+    att_set_db(att_db_util_get_address());
+    CHECK_EQUAL(value_handle, gatt_server_get_value_handle_for_characteristic_with_uuid16(start_handle, end_handle, 0x2a02));
+    CHECK(value_handle > start_handle);
+}
+
+int main (int argc, const char * argv[]){
+    // skip ATT request logs
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,284 @@
+
+// *****************************************************************************
+//
+// test att_server notification/indication fan-out to several connections
+//
+// *****************************************************************************
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ble/att_db.h"
+#include "ble/att_server.h"
+#include "bluetooth.h"
+#include "btstack_util.h"
+#include "mock.h"
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#define NUM_CONNECTIONS 4
+
+// empty ATT DB
+static const uint8_t profile_data[] = { 1, 0, 0 };
+
+static const hci_con_handle_t con_handles[NUM_CONNECTIONS] = { 0x0040, 0x0041, 0x0042, 0x0043 };
+
+static int              num_can_send_now_events;
+static int              num_indication_complete_events;
+static hci_con_handle_t indication_complete_con_handle;
+
+static void att_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    UNUSED(channel);
+    UNUSED(size);
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (packet[0]){
+        case ATT_EVENT_CAN_SEND_NOW:
+            num_can_send_now_events++;
+            break;
+        case ATT_EVENT_HANDLE_VALUE_INDICATION_COMPLETE:
+            num_indication_complete_events++;
+            indication_complete_con_handle = little_endian_read_16(packet, 3);
+            break;
+        default:
+            break;
+    }
+}
+
+static void check_sent_pdu(int index, hci_con_handle_t con_handle, uint8_t opcode, uint16_t attribute_handle, uint8_t value){
+    uint16_t len;
+    const uint8_t * pdu = mock_sent_pdu(index, &len);
+    CHECK_EQUAL(con_handle, mock_sent_pdu_con_handle(index));
+    CHECK_EQUAL(4, len);
+    CHECK_EQUAL(opcode, pdu[0]);
+    CHECK_EQUAL(attribute_handle, little_endian_read_16(pdu, 1));
+    CHECK_EQUAL(value, pdu[3]);
+}
+
+static int num_sent_to(hci_con_handle_t con_handle){
+    int i;
+    int count = 0;
+    for (i=0;i<mock_num_sent_pdus();i++){
+        if (mock_sent_pdu_con_handle(i) == con_handle) count++;
+    }
+    return count;
+}
+
+TEST_GROUP(ATTServerFanout){
+    att_server_fanout_statistics_t statistics;
+    void setup(void){
+        int i;
+        mock_reset();
+        att_server_init(profile_data, NULL, NULL);
+        att_server_register_packet_handler(&att_event_handler);
+        att_server_reset_fanout_statistics();
+        for (i=0;i<NUM_CONNECTIONS;i++){
+            mock_le_connect(con_handles[i]);
+        }
+        num_can_send_now_events = 0;
+        num_indication_complete_events = 0;
+    }
+    void teardown(void){
+        int i;
+        for (i=0;i<NUM_CONNECTIONS;i++){
+            mock_le_disconnect(con_handles[i]);
+        }
+    }
+};
+
+TEST(ATTServerFanout, NotifyAllRoundRobin){
+    uint8_t value = 0x11;
+    mock_set_acl_buffers(1);
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, NULL, 0));
+    CHECK_EQUAL(1, mock_num_sent_pdus());
+
+    value = 0x22;
+    CHECK_EQUAL(0, att_server_notify_connections(0x0020, &value, 1, NULL, 0));
+    CHECK_EQUAL(1, mock_num_sent_pdus());
+
+    // one buffer at a time: every connection gets one value before any gets a second one
+    int i;
+    for (i=1;i<2*NUM_CONNECTIONS;i++){
+        mock_free_acl_buffers(1);
+        CHECK_EQUAL(i+1, mock_num_sent_pdus());
+    }
+    for (i=0;i<NUM_CONNECTIONS;i++){
+        check_sent_pdu(i, con_handles[i], ATT_HANDLE_VALUE_NOTIFICATION, 0x0010, 0x11);
+        check_sent_pdu(NUM_CONNECTIONS + i, con_handles[i], ATT_HANDLE_VALUE_NOTIFICATION, 0x0020, 0x22);
+    }
+    mock_free_acl_buffers(1);
+    CHECK_EQUAL(2*NUM_CONNECTIONS, mock_num_sent_pdus());
+
+    att_server_get_fanout_statistics(&statistics);
+    CHECK_EQUAL(2*NUM_CONNECTIONS, statistics.queued);
+    CHECK_EQUAL(2*NUM_CONNECTIONS, statistics.sent);
+    CHECK_EQUAL(0, statistics.superseded);
+    CHECK_EQUAL(0, statistics.dropped);
+}
+
+TEST(ATTServerFanout, RoundRobinContinuesAfterLastConnection){
+    uint8_t value = 0x11;
+    mock_set_acl_buffers(0);
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, NULL, 0));
+    mock_free_acl_buffers(2);
+    CHECK_EQUAL(2, mock_num_sent_pdus());
+    // new value for first connection only must not be sent before the others got the first one
+    value = 0x22;
+    CHECK_EQUAL(0, att_server_notify_connections(0x0020, &value, 1, &con_handles[0], 1));
+    mock_free_acl_buffers(2);
+    CHECK_EQUAL(4, mock_num_sent_pdus());
+    check_sent_pdu(2, con_handles[2], ATT_HANDLE_VALUE_NOTIFICATION, 0x0010, 0x11);
+    check_sent_pdu(3, con_handles[3], ATT_HANDLE_VALUE_NOTIFICATION, 0x0010, 0x11);
+    mock_free_acl_buffers(1);
+    check_sent_pdu(4, con_handles[0], ATT_HANDLE_VALUE_NOTIFICATION, 0x0020, 0x22);
+}
+
+TEST(ATTServerFanout, CoalesceSupersededValue){
+    uint8_t value = 0x11;
+    mock_set_acl_buffers(0);
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, NULL, 0));
+    value = 0x22;
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, NULL, 0));
+    mock_free_acl_buffers(10);
+    CHECK_EQUAL(NUM_CONNECTIONS, mock_num_sent_pdus());
+    int i;
+    for (i=0;i<NUM_CONNECTIONS;i++){
+        check_sent_pdu(i, con_handles[i], ATT_HANDLE_VALUE_NOTIFICATION, 0x0010, 0x22);
+    }
+    att_server_get_fanout_statistics(&statistics);
+    CHECK_EQUAL(2*NUM_CONNECTIONS, statistics.queued);
+    CHECK_EQUAL(NUM_CONNECTIONS, statistics.sent);
+    CHECK_EQUAL(NUM_CONNECTIONS, statistics.superseded);
+}
+
+TEST(ATTServerFanout, CoalesceOnlyForCoveredConnections){
+    uint8_t value = 0x11;
+    mock_set_acl_buffers(0);
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, &con_handles[0], 1));
+    // value still queued for first connection must not be replaced by value for second one
+    value = 0x22;
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, &con_handles[1], 1));
+    mock_free_acl_buffers(10);
+    CHECK_EQUAL(2, mock_num_sent_pdus());
+    check_sent_pdu(0, con_handles[0], ATT_HANDLE_VALUE_NOTIFICATION, 0x0010, 0x11);
+    check_sent_pdu(1, con_handles[1], ATT_HANDLE_VALUE_NOTIFICATION, 0x0010, 0x22);
+    att_server_get_fanout_statistics(&statistics);
+    CHECK_EQUAL(0, statistics.superseded);
+}
+
+TEST(ATTServerFanout, SupersedeForSubsetOfConnections){
+    uint8_t value = 0x11;
+    mock_set_acl_buffers(0);
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, NULL, 0));
+    value = 0x22;
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, &con_handles[0], 1));
+    mock_free_acl_buffers(10);
+    CHECK_EQUAL(NUM_CONNECTIONS, mock_num_sent_pdus());
+    CHECK_EQUAL(1, num_sent_to(con_handles[0]));
+    int i;
+    for (i=0;i<NUM_CONNECTIONS;i++){
+        uint16_t len;
+        const uint8_t * pdu = mock_sent_pdu(i, &len);
+        CHECK_EQUAL(mock_sent_pdu_con_handle(i) == con_handles[0] ? 0x22 : 0x11, pdu[3]);
+    }
+    att_server_get_fanout_statistics(&statistics);
+    CHECK_EQUAL(1, statistics.superseded);
+}
+
+TEST(ATTServerFanout, NotificationDoesNotReplaceIndication){
+    uint8_t value = 0x55;
+    mock_set_acl_buffers(0);
+    CHECK_EQUAL(0, att_server_indicate_connections(0x0010, &value, 1, &con_handles[0], 1));
+    value = 0x66;
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, &con_handles[0], 1));
+    mock_free_acl_buffers(10);
+    CHECK_EQUAL(2, mock_num_sent_pdus());
+    check_sent_pdu(0, con_handles[0], ATT_HANDLE_VALUE_INDICATION, 0x0010, 0x55);
+    check_sent_pdu(1, con_handles[0], ATT_HANDLE_VALUE_NOTIFICATION, 0x0010, 0x66);
+}
+
+TEST(ATTServerFanout, SubsetOfConnections){
+    uint8_t value = 0x33;
+    const hci_con_handle_t subset[] = { con_handles[1], con_handles[3], 0x0100 };
+    mock_set_acl_buffers(10);
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, subset, 3));
+    CHECK_EQUAL(2, mock_num_sent_pdus());
+    CHECK_EQUAL(0, num_sent_to(con_handles[0]));
+    CHECK_EQUAL(1, num_sent_to(con_handles[1]));
+    CHECK_EQUAL(0, num_sent_to(con_handles[2]));
+    CHECK_EQUAL(1, num_sent_to(con_handles[3]));
+}
+
+TEST(ATTServerFanout, DisconnectDropsQueuedValues){
+    uint8_t value = 0x44;
+    mock_set_acl_buffers(0);
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, NULL, 0));
+    CHECK_EQUAL(0, att_server_notify_connections(0x0011, &value, 1, NULL, 0));
+    mock_le_disconnect(con_handles[2]);
+    mock_free_acl_buffers(10);
+    CHECK_EQUAL(2 * (NUM_CONNECTIONS - 1), mock_num_sent_pdus());
+    CHECK_EQUAL(0, num_sent_to(con_handles[2]));
+    att_server_get_fanout_statistics(&statistics);
+    CHECK_EQUAL(2, statistics.dropped);
+    CHECK_EQUAL(2 * (NUM_CONNECTIONS - 1), statistics.sent);
+    mock_le_connect(con_handles[2]);
+}
+
+TEST(ATTServerFanout, IndicationsWaitForConfirmation){
+    const uint8_t confirmation[] = { ATT_HANDLE_VALUE_CONFIRMATION };
+    uint8_t value = 0x55;
+    mock_set_acl_buffers(10);
+    CHECK_EQUAL(0, att_server_indicate_connections(0x0010, &value, 1, NULL, 0));
+    value = 0x66;
+    CHECK_EQUAL(0, att_server_indicate_connections(0x0020, &value, 1, NULL, 0));
+    CHECK_EQUAL(NUM_CONNECTIONS, mock_num_sent_pdus());
+    int i;
+    for (i=0;i<NUM_CONNECTIONS;i++){
+        check_sent_pdu(i, con_handles[i], ATT_HANDLE_VALUE_INDICATION, 0x0010, 0x55);
+    }
+    // notifications are not blocked by indication in flight
+    CHECK_EQUAL(0, att_server_notify_connections(0x0030, &value, 1, &con_handles[0], 1));
+    CHECK_EQUAL(NUM_CONNECTIONS + 1, mock_num_sent_pdus());
+
+    mock_receive_att_pdu(con_handles[1], confirmation, sizeof(confirmation));
+    CHECK_EQUAL(1, num_indication_complete_events);
+    CHECK_EQUAL(con_handles[1], indication_complete_con_handle);
+    mock_free_acl_buffers(0);
+    CHECK_EQUAL(NUM_CONNECTIONS + 2, mock_num_sent_pdus());
+    check_sent_pdu(NUM_CONNECTIONS + 1, con_handles[1], ATT_HANDLE_VALUE_INDICATION, 0x0020, 0x66);
+}
+
+TEST(ATTServerFanout, ValueSlots){
+    uint8_t value[64];
+    memset(value, 0, sizeof(value));
+    mock_set_acl_buffers(0);
+    int i;
+    for (i=0;i<4;i++){
+        CHECK_EQUAL(0, att_server_notify_connections(0x0010 + i, value, 1, NULL, 0));
+    }
+    CHECK_EQUAL(BTSTACK_MEMORY_ALLOC_FAILED, att_server_notify_connections(0x0020, value, 1, NULL, 0));
+    // update of queued value is fine
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, value, 1, NULL, 0));
+    CHECK(att_server_notify_connections(0x0010, value, sizeof(value), NULL, 0) != 0);
+    // slots are free after values have been sent
+    mock_free_acl_buffers(100);
+    CHECK_EQUAL(4 * NUM_CONNECTIONS, mock_num_sent_pdus());
+    CHECK_EQUAL(0, att_server_notify_connections(0x0020, value, 1, NULL, 0));
+}
+
+TEST(ATTServerFanout, CanSendNowEventAfterQueuedValues){
+    uint8_t value = 0x77;
+    mock_set_acl_buffers(0);
+    CHECK_EQUAL(0, att_server_notify_connections(0x0010, &value, 1, NULL, 0));
+    att_server_request_can_send_now_event(con_handles[0]);
+    mock_free_acl_buffers(NUM_CONNECTIONS);
+    CHECK_EQUAL(NUM_CONNECTIONS, mock_num_sent_pdus());
+    CHECK_EQUAL(0, num_can_send_now_events);
+    mock_free_acl_buffers(1);
+    CHECK_EQUAL(1, num_can_send_now_events);
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
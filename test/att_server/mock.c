@@ -0,0 +1,282 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "btstack_debug.h"
+#include "btstack_linked_list.h"
+#include "btstack_run_loop.h"
+#include "btstack_tlv.h"
+#include "ble/le_device_db.h"
+#include "ble/sm.h"
+#include "hci.h"
+#include "l2cap.h"
+#include "mock.h"
+
+#define MOCK_MAX_CONNECTIONS 8
+#define MOCK_MAX_PDUS        64
+
+static hci_connection_t      mock_connections[MOCK_MAX_CONNECTIONS];
+static btstack_linked_list_t connections;
+static btstack_linked_list_t event_handlers;
+static btstack_packet_handler_t att_fixed_channel_handler;
+
+static int     acl_buffers;
+static int     can_send_now_requested;
+static uint8_t outgoing_buffer[HCI_ACL_PAYLOAD_SIZE];
+
+static hci_con_handle_t sent_con_handles[MOCK_MAX_PDUS];
+static uint8_t          sent_pdus[MOCK_MAX_PDUS][32];
+static uint16_t         sent_lens[MOCK_MAX_PDUS];
+static int              num_sent_pdus;
+
+void mock_reset(void){
+    memset(mock_connections, 0, sizeof(mock_connections));
+    connections = NULL;
+    event_handlers = NULL;
+    acl_buffers = 0;
+    can_send_now_requested = 0;
+    num_sent_pdus = 0;
+}
+
+static void mock_emit_hci_event(uint8_t * event, uint16_t size){
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &event_handlers);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        btstack_packet_callback_registration_t * entry = (btstack_packet_callback_registration_t*) btstack_linked_list_iterator_next(&it);
+        (*entry->callback)(HCI_EVENT_PACKET, 0, event, size);
+    }
+}
+
+void mock_le_connect(hci_con_handle_t con_handle){
+    int i;
+    for (i=0;i<MOCK_MAX_CONNECTIONS;i++){
+        if (mock_connections[i].con_handle == 0) break;
+    }
+    hci_connection_t * connection = &mock_connections[i];
+    memset(connection, 0, sizeof(hci_connection_t));
+    connection->con_handle = con_handle;
+    btstack_linked_list_add_tail(&connections, (btstack_linked_item_t *) connection);
+
+    uint8_t event[21];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = sizeof(event) - 2;
+    event[2] = HCI_SUBEVENT_LE_CONNECTION_COMPLETE;
+    little_endian_store_16(event, 4, con_handle);
+    event[8] = con_handle & 0xff;
+    mock_emit_hci_event(event, sizeof(event));
+}
+
+void mock_le_disconnect(hci_con_handle_t con_handle){
+    uint8_t event[6];
+    event[0] = HCI_EVENT_DISCONNECTION_COMPLETE;
+    event[1] = sizeof(event) - 2;
+    event[2] = 0;
+    little_endian_store_16(event, 3, con_handle);
+    event[5] = 0x13;
+    mock_emit_hci_event(event, sizeof(event));
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    btstack_linked_list_remove(&connections, (btstack_linked_item_t *) connection);
+    connection->con_handle = 0;
+}
+
+void mock_set_acl_buffers(int num_buffers){
+    acl_buffers = num_buffers;
+}
+
+void mock_free_acl_buffers(int num_buffers){
+    acl_buffers += num_buffers;
+    while (acl_buffers && can_send_now_requested){
+        can_send_now_requested = 0;
+        uint8_t event[] = { L2CAP_EVENT_CAN_SEND_NOW, 2, 0, 0};
+        (*att_fixed_channel_handler)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+    }
+}
+
+void mock_receive_att_pdu(hci_con_handle_t con_handle, const uint8_t * pdu, uint16_t len){
+    uint8_t buffer[32];
+    memcpy(buffer, pdu, len);
+    (*att_fixed_channel_handler)(ATT_DATA_PACKET, con_handle, buffer, len);
+}
+
+int mock_num_sent_pdus(void){
+    return num_sent_pdus;
+}
+
+hci_con_handle_t mock_sent_pdu_con_handle(int index){
+    return sent_con_handles[index];
+}
+
+const uint8_t * mock_sent_pdu(int index, uint16_t * len){
+    *len = sent_lens[index];
+    return sent_pdus[index];
+}
+
+// HCI
+
+void hci_add_event_handler(btstack_packet_callback_registration_t * callback_handler){
+    btstack_linked_list_add_tail(&event_handlers, (btstack_linked_item_t*) callback_handler);
+}
+
+void hci_add_event_handler_for_events(btstack_packet_callback_registration_t * callback_handler, const uint8_t * event_codes, const uint8_t * le_subevent_codes){
+    UNUSED(event_codes);
+    UNUSED(le_subevent_codes);
+    hci_add_event_handler(callback_handler);
+}
+
+int hci_can_send_acl_le_packet_now(void){
+    return acl_buffers > 0;
+}
+
+hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle){
+    btstack_linked_list_iterator_t it;
+    btstack_linked_list_iterator_init(&it, &connections);
+    while (btstack_linked_list_iterator_has_next(&it)){
+        hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
+        if (connection->con_handle == con_handle) return connection;
+    }
+    return NULL;
+}
+
+void hci_connections_get_iterator(btstack_linked_list_iterator_t *it){
+    btstack_linked_list_iterator_init(it, &connections);
+}
+
+// L2CAP
+
+void l2cap_register_fixed_channel(btstack_packet_handler_t packet_handler, uint16_t channel_id){
+    UNUSED(channel_id);
+    att_fixed_channel_handler = packet_handler;
+}
+
+int l2cap_can_send_fixed_channel_packet_now(hci_con_handle_t con_handle, uint16_t channel_id){
+    UNUSED(con_handle);
+    UNUSED(channel_id);
+    return acl_buffers > 0;
+}
+
+void l2cap_request_can_send_fix_channel_now_event(hci_con_handle_t con_handle, uint16_t channel_id){
+    UNUSED(con_handle);
+    UNUSED(channel_id);
+    can_send_now_requested = 1;
+}
+
+uint16_t l2cap_max_le_mtu(void){
+    return HCI_ACL_PAYLOAD_SIZE - 4;
+}
+
+int l2cap_reserve_packet_buffer(void){
+    return 1;
+}
+
+void l2cap_release_packet_buffer(void){
+}
+
+uint8_t * l2cap_get_outgoing_buffer(void){
+    return outgoing_buffer;
+}
+
+int l2cap_send_prepared_connectionless(hci_con_handle_t con_handle, uint16_t cid, uint16_t len){
+    UNUSED(cid);
+    if (acl_buffers == 0) return BTSTACK_ACL_BUFFERS_FULL;
+    acl_buffers--;
+    if (num_sent_pdus < MOCK_MAX_PDUS){
+        sent_con_handles[num_sent_pdus] = con_handle;
+        memcpy(sent_pdus[num_sent_pdus], outgoing_buffer, btstack_min(len, sizeof(sent_pdus[0])));
+        sent_lens[num_sent_pdus] = len;
+        num_sent_pdus++;
+    }
+    return 0;
+}
+
+// Security Manager
+
+void sm_add_event_handler(btstack_packet_callback_registration_t * callback_handler){
+    UNUSED(callback_handler);
+}
+
+int sm_encryption_key_size(hci_con_handle_t con_handle){
+    UNUSED(con_handle);
+    return 0;
+}
+
+int sm_authenticated(hci_con_handle_t con_handle){
+    UNUSED(con_handle);
+    return 0;
+}
+
+authorization_state_t sm_authorization_state(hci_con_handle_t con_handle){
+    UNUSED(con_handle);
+    return AUTHORIZATION_UNKNOWN;
+}
+
+void sm_request_pairing(hci_con_handle_t con_handle){
+    UNUSED(con_handle);
+}
+
+int sm_cmac_ready(void){
+    return 1;
+}
+
+void sm_cmac_signed_write_start(const sm_key_t key, uint8_t opcode, uint16_t attribute_handle, uint16_t message_len, const uint8_t * message, uint32_t sign_counter, void (*done_callback)(uint8_t * hash)){
+    UNUSED(opcode);
+    UNUSED(attribute_handle);
+    UNUSED(message_len);
+    UNUSED(message);
+    UNUSED(sign_counter);
+    UNUSED(done_callback);
+}
+
+int sm_le_device_index(hci_con_handle_t con_handle){
+    UNUSED(con_handle);
+    return -1;
+}
+
+// LE Device DB and TLV
+
+void le_device_db_remote_csrk_get(int index, sm_key_t csrk){
+    UNUSED(index);
+    memset(csrk, 0, 16);
+}
+
+uint32_t le_device_db_remote_counter_get(int index){
+    UNUSED(index);
+    return 0;
+}
+
+void le_device_db_remote_counter_set(int index, uint32_t counter){
+    UNUSED(index);
+    UNUSED(counter);
+}
+
+void btstack_tlv_get_instance(const btstack_tlv_t ** tlv_impl, void ** tlv_context){
+    *tlv_impl = NULL;
+    *tlv_context = NULL;
+}
+
+// Run Loop
+
+void btstack_run_loop_set_timer(btstack_timer_source_t * ts, uint32_t timeout_in_ms){
+    ts->timeout = timeout_in_ms;
+}
+
+void btstack_run_loop_set_timer_handler(btstack_timer_source_t * ts, void (*process)(btstack_timer_source_t *_ts)){
+    ts->process = process;
+}
+
+void btstack_run_loop_set_timer_context(btstack_timer_source_t * ts, void * context){
+    ts->context = context;
+}
+
+void * btstack_run_loop_get_timer_context(btstack_timer_source_t * ts){
+    return ts->context;
+}
+
+void btstack_run_loop_add_timer(btstack_timer_source_t * ts){
+    UNUSED(ts);
+}
+
+int btstack_run_loop_remove_timer(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    return 1;
+}
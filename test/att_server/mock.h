@@ -0,0 +1,21 @@
+#include <stdint.h>
+#include "btstack_defines.h"
+#include "bluetooth.h"
+
+void mock_reset(void);
+
+// LE connections with ATT Server context
+void mock_le_connect(hci_con_handle_t con_handle);
+void mock_le_disconnect(hci_con_handle_t con_handle);
+
+// Controller ACL buffers, freeing buffers emits L2CAP_EVENT_CAN_SEND_NOW if requested
+void mock_set_acl_buffers(int num_buffers);
+void mock_free_acl_buffers(int num_buffers);
+
+// ATT PDU received from client
+void mock_receive_att_pdu(hci_con_handle_t con_handle, const uint8_t * pdu, uint16_t len);
+
+// ATT PDUs sent to clients
+int                    mock_num_sent_pdus(void);
+hci_con_handle_t       mock_sent_pdu_con_handle(int index);
+const uint8_t *        mock_sent_pdu(int index, uint16_t * len);
@@ -35,21 +35,29 @@
  *
  */
 
-#include <stdio.h>
+/*
+ * sine_encode_decode_performance_test.c
+ *
+ * Encodes and decodes sine waves with SBC (A2DP) and mSBC (HFP). First, each configuration is run
+ * on its own. Then, 1 to MAX_NR_SBC_DECODERS streams are run in parallel, each on its own thread
+ * with its own encoder and decoder instance. The encoded and decoded data of all streams is
+ * compared against the single stream run and the total throughput is reported.
+ */
+
 #include <math.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <portaudio.h>
+#include <time.h>
 
+#include "bluetooth.h"
 #include "btstack_sbc.h"
-#include "avdtp.h"
-#include "avdtp_source.h"
-#include "btstack_stdin.h"
+#include "btstack_util.h"
+#include "hfp_msbc.h"
 
-#define NUM_CHANNELS        2
-#define SAMPLE_RATE         44100
-#define BYTES_PER_AUDIO_SAMPLE   (2*NUM_CHANNELS)
-#define LATENCY             300 // ms
+#define NUM_FRAMES          2000
+#define MAX_NUM_STREAMS     8
 
 #ifndef M_PI
 #define M_PI  3.14159265
@@ -62,33 +70,47 @@ typedef struct {
     int right_phase;
 } paTestData;
 
-static uint8_t pcm_frame[2*8*16*2];
+typedef struct {
+    btstack_sbc_mode_t mode;
+    btstack_sbc_encoder_state_t sbc_encoder_state;
+    hfp_msbc_state_t msbc_encoder_state;
+    btstack_sbc_decoder_state_t sbc_decoder_state;
+    paTestData sin_data;
+    int16_t pcm_frame[2*8*16];
+    // FNV-1a hashes over SBC and PCM data
+    uint32_t sbc_hash;
+    uint32_t pcm_hash;
+    pthread_t thread;
+} stream_t;
 
 static paTestData sin_data;
+static stream_t streams[MAX_NUM_STREAMS];
+static uint32_t reference_sbc_hash[2];
+static uint32_t reference_pcm_hash[2];
 
-static btstack_sbc_mode_t mode = SBC_MODE_STANDARD;
-static btstack_sbc_encoder_state_t sbc_encoder_state;
-static btstack_sbc_decoder_state_t sbc_decoder_state;
+static uint32_t hash_update(uint32_t hash, const uint8_t * data, int len){
+    int i;
+    for (i = 0; i < len; i++){
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
 static void handle_pcm_data(int16_t * data, int num_samples, int num_channels, int sample_rate, void * context){
     UNUSED(sample_rate);
-    UNUSED(context);
-    UNUSED(data);
-    UNUSED(num_samples);
-    UNUSED(num_channels);
+    stream_t * stream = (stream_t *) context;
+    stream->pcm_hash = hash_update(stream->pcm_hash, (const uint8_t *) data, num_samples * num_channels * 2);
 }
 
-static void fill_sine_frame(void *userData, int num_samples_to_write){
-    paTestData *data = (paTestData*)userData;
+static void fill_sine_frame(paTestData * data, int16_t * pcm_frame, int num_samples_to_write, int num_channels){
     int count = 0;
     int offset = 0;
     while (count < num_samples_to_write){
-        uint8_t write_data[BYTES_PER_AUDIO_SAMPLE];
-        *(int16_t*)&write_data[0] = data->source[data->left_phase];
-        *(int16_t*)&write_data[2] = data->source[data->right_phase];
-        
-        memcpy(pcm_frame+offset, write_data, BYTES_PER_AUDIO_SAMPLE);
-        offset += BYTES_PER_AUDIO_SAMPLE;
+        pcm_frame[offset++] = data->source[data->left_phase];
+        if (num_channels == 2){
+            pcm_frame[offset++] = data->source[data->right_phase];
+        }
         count++;
 
         data->left_phase += 1;
@@ -102,42 +124,129 @@ static void fill_sine_frame(void *userData, int num_samples_to_write){
     }
 }
 
-int btstack_main(int argc, const char * argv[]);
-int btstack_main(int argc, const char * argv[]){
+// called from stream thread, encoder and decoder are initialized concurrently
+static void stream_init(stream_t * stream){
+    stream->sin_data = sin_data;
+    stream->sbc_hash = 2166136261u;
+    stream->pcm_hash = 2166136261u;
+    uint8_t status;
+    if (stream->mode == SBC_MODE_STANDARD){
+        status = btstack_sbc_encoder_init(&stream->sbc_encoder_state, SBC_MODE_STANDARD, 16, 8, 0, 44100, 53, 3);
+    } else {
+        status = hfp_msbc_init(&stream->msbc_encoder_state);
+    }
+    if (status == ERROR_CODE_SUCCESS){
+        status = btstack_sbc_decoder_init(&stream->sbc_decoder_state, stream->mode, &handle_pcm_data, stream);
+    }
+    if (status != ERROR_CODE_SUCCESS){
+        printf("stream init failed, status 0x%02x\n", status);
+        exit(1);
+    }
+}
+
+static void stream_deinit(stream_t * stream){
+    if (stream->mode == SBC_MODE_STANDARD){
+        btstack_sbc_encoder_deinit(&stream->sbc_encoder_state);
+    } else {
+        hfp_msbc_deinit(&stream->msbc_encoder_state);
+    }
+    btstack_sbc_decoder_deinit(&stream->sbc_decoder_state);
+}
+
+static void * stream_process(void * context){
+    stream_t * stream = (stream_t *) context;
+    uint8_t msbc_packet[HFP_MSBC_FRAME_SIZE + HFP_MSBC_EXTRA_SIZE];
+    stream_init(stream);
+    int i;
+    for (i = 0; i < NUM_FRAMES; i++){
+        if (stream->mode == SBC_MODE_STANDARD){
+            fill_sine_frame(&stream->sin_data, stream->pcm_frame, btstack_sbc_encoder_num_audio_frames(&stream->sbc_encoder_state), 2);
+            btstack_sbc_encoder_process_data(&stream->sbc_encoder_state, stream->pcm_frame);
+            uint8_t * sbc_frame = btstack_sbc_encoder_sbc_buffer(&stream->sbc_encoder_state);
+            uint16_t  sbc_frame_len = btstack_sbc_encoder_sbc_buffer_length(&stream->sbc_encoder_state);
+            stream->sbc_hash = hash_update(stream->sbc_hash, sbc_frame, sbc_frame_len);
+            btstack_sbc_decoder_process_data(&stream->sbc_decoder_state, 0, sbc_frame, sbc_frame_len);
+        } else {
+            fill_sine_frame(&stream->sin_data, stream->pcm_frame, hfp_msbc_num_audio_samples_per_frame(&stream->msbc_encoder_state), 1);
+            hfp_msbc_encode_audio_frame(&stream->msbc_encoder_state, stream->pcm_frame);
+            hfp_msbc_read_from_stream(&stream->msbc_encoder_state, msbc_packet, sizeof(msbc_packet));
+            stream->sbc_hash = hash_update(stream->sbc_hash, msbc_packet, sizeof(msbc_packet));
+            // skip H2 header and padding
+            btstack_sbc_decoder_process_data(&stream->sbc_decoder_state, 0, &msbc_packet[HFP_MSBC_HEADER_H2_SIZE], HFP_MSBC_FRAME_SIZE);
+        }
+    }
+    stream_deinit(stream);
+    return NULL;
+}
+
+static double time_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// realtime: SBC 128 samples @ 44100 Hz, mSBC 120 samples @ 16000 Hz
+static double frames_per_second_realtime(btstack_sbc_mode_t mode){
+    return mode == SBC_MODE_STANDARD ? 44100.0 / 128 : 16000.0 / 120;
+}
+
+static void single_stream(btstack_sbc_mode_t mode){
+    stream_t * stream = &streams[0];
+    stream->mode = mode;
+    double start = time_ms();
+    stream_process(stream);
+    double duration = time_ms() - start;
+    reference_sbc_hash[mode] = stream->sbc_hash;
+    reference_pcm_hash[mode] = stream->pcm_hash;
+    printf("%-5s 1 stream : %u frames encoded and decoded in %6.1f ms, %6.1fx realtime\n",
+        mode == SBC_MODE_STANDARD ? "SBC" : "mSBC", NUM_FRAMES, duration,
+        NUM_FRAMES / (duration / 1000.0) / frames_per_second_realtime(mode));
+}
+
+// every other stream uses mSBC
+static void parallel_streams(int num_streams){
+    int i;
+    for (i = 0; i < num_streams; i++){
+        streams[i].mode = (i & 1) ? SBC_MODE_mSBC : SBC_MODE_STANDARD;
+    }
+    double start = time_ms();
+    for (i = 0; i < num_streams; i++){
+        pthread_create(&streams[i].thread, NULL, &stream_process, &streams[i]);
+    }
+    for (i = 0; i < num_streams; i++){
+        pthread_join(streams[i].thread, NULL);
+    }
+    double duration = time_ms() - start;
+    double realtime_streams = 0;
+    for (i = 0; i < num_streams; i++){
+        stream_t * stream = &streams[i];
+        if (stream->sbc_hash != reference_sbc_hash[stream->mode] || stream->pcm_hash != reference_pcm_hash[stream->mode]){
+            printf("stream %u: encoded or decoded data differs from single stream\n", i);
+            exit(1);
+        }
+        realtime_streams += NUM_FRAMES / (duration / 1000.0) / frames_per_second_realtime(stream->mode);
+    }
+    printf("%u parallel streams: %u frames encoded and decoded in %6.1f ms, %6.1fx realtime in total, output matches\n",
+        num_streams, num_streams * NUM_FRAMES, duration, realtime_streams);
+}
+
+int main(int argc, const char * argv[]){
     (void) argc;
     (void) argv;
-    btstack_sbc_encoder_init(&sbc_encoder_state, SBC_MODE_STANDARD, 16, 8, 2, 44100, 53);
-                    
+
     /* initialise sinusoidal wavetable */
     int i;
     for (i=0; i<TABLE_SIZE_441HZ; i++){ 
         sin_data.source[i] = sin(((double)i/(double)TABLE_SIZE_441HZ) * M_PI * 2.)*32767;
     }
     sin_data.left_phase = sin_data.right_phase = 0;
-    
-    btstack_sbc_decoder_init(&sbc_decoder_state, mode, handle_pcm_data, NULL);
-    int num_frames = 10000;
-    uint32_t timestamp_start;
-    uint32_t encoding_time = 0;
-    uint32_t decoding_time = 0;
-    
-    timestamp_start = btstack_run_loop_get_time_ms();
-    for (i=0; i<num_frames; i++){
-        fill_sine_frame(&sin_data, 128);
-        btstack_sbc_encoder_process_data((int16_t *) pcm_frame);
-    }
-    encoding_time = btstack_run_loop_get_time_ms() - timestamp_start;
 
-    timestamp_start = btstack_run_loop_get_time_ms();
-    for (i=0; i<num_frames; i++){
-        fill_sine_frame(&sin_data, 128);
-        btstack_sbc_encoder_process_data((int16_t *) pcm_frame);
-        btstack_sbc_decoder_process_data(&sbc_decoder_state, 0, btstack_sbc_encoder_sbc_buffer(), btstack_sbc_encoder_sbc_buffer_length());
-    }
-    decoding_time =  btstack_run_loop_get_time_ms() - timestamp_start - encoding_time;
+    single_stream(SBC_MODE_STANDARD);
+    single_stream(SBC_MODE_mSBC);
 
-    printf("%d frames encoded in %dms\n", num_frames, encoding_time);
-    printf("%d frames decoded in %dms\n", num_frames, decoding_time);
-    
-    exit(0);
+    int num_streams;
+    for (num_streams = 1; num_streams <= MAX_NUM_STREAMS; num_streams <<= 1){
+        parallel_streams(num_streams);
+    }
+    return 0;
 }
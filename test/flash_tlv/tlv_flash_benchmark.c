@@ -0,0 +1,92 @@
+/*
+ * tlv_flash_benchmark.c
+ *
+ * Compares btstack_tlv_flash_bank (two banks) with btstack_tlv_flash_log (eight banks) on 32 kB of
+ * hal_flash_bank_memory. With bonds for NUM_BONDS devices stored, it reports the average get_tag time and
+ * the average and longest store_tag time for signing counter updates. The longest store contains the
+ * migration of the full bank for btstack_tlv_flash_bank and a single garbage collection step for
+ * btstack_tlv_flash_log. Flash is simulated in RAM, on real flash, erase and write times add to it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "hal_flash_bank.h"
+#include "hal_flash_bank_memory.h"
+#include "btstack_tlv.h"
+#include "btstack_tlv_flash_bank.h"
+#include "btstack_tlv_flash_log.h"
+#include "btstack_debug.h"
+#include "hci_dump.h"
+
+#define STORAGE_SIZE  (32 * 1024)
+#define NUM_BONDS     64
+#define BOND_SIZE     100
+#define NUM_LOOKUPS   100000
+#define NUM_UPDATES   20000
+
+static uint8_t storage[STORAGE_SIZE];
+static hal_flash_bank_memory_t hal_flash_bank_context;
+static btstack_tlv_flash_bank_t tlv_flash_bank_context;
+static btstack_tlv_flash_log_t  tlv_flash_log_context;
+static btstack_tlv_flash_log_index_entry_t tlv_flash_log_index[2 * (2 * NUM_BONDS)];
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void run_benchmark(const char * name, const btstack_tlv_t * tlv_impl, void * tlv_context){
+    uint8_t  bond[BOND_SIZE];
+    uint32_t i;
+    double   start;
+
+    // bonds and signing counters
+    for (i = 0; i < NUM_BONDS; i++){
+        memset(bond, i, sizeof(bond));
+        tlv_impl->store_tag(tlv_context, 0x42540000 | i, bond, sizeof(bond));
+        tlv_impl->store_tag(tlv_context, 0x43540000 | i, (const uint8_t *) &i, sizeof(i));
+    }
+
+    // lookups
+    start = now();
+    for (i = 0; i < NUM_LOOKUPS; i++){
+        uint32_t counter;
+        tlv_impl->get_tag(tlv_context, 0x43540000 | (i % NUM_BONDS), (uint8_t *) &counter, sizeof(counter));
+    }
+    double lookup_s = now() - start;
+
+    // counter updates
+    double max_store_s = 0;
+    start = now();
+    for (i = 0; i < NUM_UPDATES; i++){
+        double store_start = now();
+        tlv_impl->store_tag(tlv_context, 0x43540000 | (i % NUM_BONDS), (const uint8_t *) &i, sizeof(i));
+        double store_s = now() - store_start;
+        if (store_s > max_store_s){
+            max_store_s = store_s;
+        }
+    }
+    double update_s = now() - start;
+
+    printf("%-22s get_tag %8.2f us, store_tag %8.2f us, longest store_tag %9.2f us\n", name,
+        lookup_s * 1000000.0 / NUM_LOOKUPS, update_s * 1000000.0 / NUM_UPDATES, max_store_s * 1000000.0);
+}
+
+int main(void){
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+
+    const hal_flash_bank_t * hal_flash_bank_impl = hal_flash_bank_memory_init_instance(&hal_flash_bank_context, storage, STORAGE_SIZE);
+    const btstack_tlv_t * tlv_impl = btstack_tlv_flash_bank_init_instance(&tlv_flash_bank_context, hal_flash_bank_impl, &hal_flash_bank_context);
+    run_benchmark("btstack_tlv_flash_bank", tlv_impl, &tlv_flash_bank_context);
+
+    hal_flash_bank_impl = hal_flash_bank_memory_init_instance_with_banks(&hal_flash_bank_context, storage, STORAGE_SIZE, 8);
+    tlv_impl = btstack_tlv_flash_log_init_instance(&tlv_flash_log_context, hal_flash_bank_impl, &hal_flash_bank_context,
+        8, tlv_flash_log_index, sizeof(tlv_flash_log_index) / sizeof(btstack_tlv_flash_log_index_entry_t));
+    run_benchmark("btstack_tlv_flash_log", tlv_impl, &tlv_flash_log_context);
+    printf("btstack_tlv_flash_log: %u garbage collection steps, %u bank erases\n", tlv_flash_log_context.num_gc_steps, tlv_flash_log_context.num_erases);
+    return 0;
+}
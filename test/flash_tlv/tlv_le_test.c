@@ -12,6 +12,9 @@
 #include "btstack_util.h"
 #include "btstack_config.h"
 #include "btstack_debug.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "hci.h"
 
 #define HAL_FLASH_BANK_MEMORY_STORAGE_SIZE 512
 static uint8_t hal_flash_bank_memory_storage[HAL_FLASH_BANK_MEMORY_STORAGE_SIZE];
@@ -28,6 +31,19 @@ static void CHECK_EQUAL_ARRAY(uint8_t * expected, uint8_t * actual, int size){
     }
 }
 
+// HCI event handler registered by le_device_db_tlv
+static btstack_packet_handler_t hci_event_handler;
+
+void hci_add_event_handler(btstack_packet_callback_registration_t * callback_handler){
+    hci_event_handler = callback_handler->callback;
+}
+
+void hci_add_event_handler_for_events(btstack_packet_callback_registration_t * callback_handler, const uint8_t * event_codes, const uint8_t * le_subevent_codes){
+    UNUSED(event_codes);
+    UNUSED(le_subevent_codes);
+    hci_add_event_handler(callback_handler);
+}
+
 //
 
 TEST_GROUP(LE_DEVICE_DB){
@@ -61,6 +77,15 @@ TEST_GROUP(LE_DEVICE_DB){
         memset(sm_key_bb, 0xbb, 16);
         memset(sm_key_cc, 0xcc, 16);
     }
+    // drop RAM cache and read entries from flash again
+    void reopen_db(void){
+        btstack_tlv_impl = btstack_tlv_flash_bank_init_instance(&btstack_tlv_context, hal_flash_bank_impl, &hal_flash_bank_context);
+        le_device_db_tlv_configure(btstack_tlv_impl, &btstack_tlv_context);
+    }
+    void send_disconnect(void){
+        uint8_t event[] = { HCI_EVENT_DISCONNECTION_COMPLETE, 4, 0, 0x40, 0x00, 0x13 };
+        hci_event_handler(HCI_EVENT_PACKET, 0, event, sizeof(event));
+    }
 };
 
 TEST(LE_DEVICE_DB, Empty){
@@ -117,7 +142,97 @@ TEST(LE_DEVICE_DB, AddOTwoRemoveOneAddOne){
 }
 
 
+TEST(LE_DEVICE_DB, RemoteCounterWriteBack){
+    int index = le_device_db_add(BD_ADDR_TYPE_LE_PUBLIC, addr_aa, sm_key_aa);
+    uint32_t counter;
+    for (counter = 1; counter <= 100; counter++){
+        le_device_db_remote_counter_set(index, counter);
+    }
+    CHECK_EQUAL(100, le_device_db_remote_counter_get(index));
+
+    // not written yet
+    reopen_db();
+    CHECK_EQUAL(1, le_device_db_count());
+    CHECK_EQUAL(0, le_device_db_remote_counter_get(index));
+
+    le_device_db_remote_counter_set(index, 200);
+    le_device_db_tlv_flush();
+    reopen_db();
+    CHECK_EQUAL(200, le_device_db_remote_counter_get(index));
+}
+
+TEST(LE_DEVICE_DB, FlushOnDisconnect){
+    int index = le_device_db_add(BD_ADDR_TYPE_LE_PUBLIC, addr_aa, sm_key_aa);
+    le_device_db_remote_csrk_set(index, sm_key_bb);
+    le_device_db_local_csrk_set(index, sm_key_cc);
+    le_device_db_remote_counter_set(index, 5);
+    send_disconnect();
+
+    reopen_db();
+    sm_key_t csrk;
+    le_device_db_remote_csrk_get(index, csrk);
+    CHECK_EQUAL_ARRAY(sm_key_bb, csrk, 16);
+    le_device_db_local_csrk_get(index, csrk);
+    CHECK_EQUAL_ARRAY(sm_key_cc, csrk, 16);
+    CHECK_EQUAL(5, le_device_db_remote_counter_get(index));
+}
+
+TEST(LE_DEVICE_DB, PairingWritesPendingUpdates){
+    int index = le_device_db_add(BD_ADDR_TYPE_LE_PUBLIC, addr_aa, sm_key_aa);
+    uint8_t rand[8];
+    memset(rand, 0x11, sizeof(rand));
+    le_device_db_remote_csrk_set(index, sm_key_bb);
+    le_device_db_encryption_set(index, 0x1234, rand, sm_key_cc, 16, 1, 0);
+
+    reopen_db();
+    sm_key_t csrk;
+    le_device_db_remote_csrk_get(index, csrk);
+    CHECK_EQUAL_ARRAY(sm_key_bb, csrk, 16);
+    uint16_t ediv = 0;
+    le_device_db_encryption_get(index, &ediv, NULL, NULL, NULL, NULL, NULL);
+    CHECK_EQUAL(0x1234, ediv);
+}
+
+TEST(LE_DEVICE_DB, LocalCounterNotReusedAfterReset){
+    int index = le_device_db_add(BD_ADDR_TYPE_LE_PUBLIC, addr_aa, sm_key_aa);
+    le_device_db_local_counter_set(index, 0);
+    uint32_t counter;
+    // sign 10 writes
+    for (counter = 0; counter < 10; counter++){
+        CHECK_EQUAL(counter, le_device_db_local_counter_get(index));
+        le_device_db_local_counter_set(index, counter + 1);
+    }
+
+    // reset without flush, continue after all counters possibly used
+    reopen_db();
+    CHECK(le_device_db_local_counter_get(index) >= 10);
+}
+
+TEST(LE_DEVICE_DB, LocalCounterReset){
+    int index = le_device_db_add(BD_ADDR_TYPE_LE_PUBLIC, addr_aa, sm_key_aa);
+    le_device_db_local_counter_set(index, 1000);
+    // new pairing starts again at 0
+    le_device_db_local_counter_set(index, 0);
+    le_device_db_local_counter_set(index, 1);
+
+    reopen_db();
+    uint32_t counter = le_device_db_local_counter_get(index);
+    CHECK(counter >= 1);
+    CHECK(counter < 1000);
+}
+
+TEST(LE_DEVICE_DB, RemoveDropsPendingUpdates){
+    int index = le_device_db_add(BD_ADDR_TYPE_LE_PUBLIC, addr_aa, sm_key_aa);
+    le_device_db_remote_counter_set(index, 5);
+    le_device_db_remove(index);
+    le_device_db_tlv_flush();
+
+    reopen_db();
+    CHECK_EQUAL(0, le_device_db_count());
+}
+
 int main (int argc, const char * argv[]){
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
     hci_dump_open("tlv_le_test.pklg", HCI_DUMP_PACKETLOGGER);
     return CommandLineTestRunner::RunAllTests(argc, argv);
 }
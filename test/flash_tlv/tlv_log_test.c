@@ -0,0 +1,305 @@
+/*
+ * tlv_log_test.c
+ *
+ * Tests btstack_tlv_flash_log with a four bank hal_flash_bank_memory: lookups through the RAM index,
+ * replay after re-init, recovery from interrupted writes, and incremental garbage collection.
+ */
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "hal_flash_bank.h"
+#include "hal_flash_bank_memory.h"
+#include "btstack_tlv.h"
+#include "btstack_tlv_flash_log.h"
+#include "hci_dump.h"
+#include "btstack_util.h"
+#include "btstack_config.h"
+#include "btstack_debug.h"
+
+#define NUM_BANKS 4
+#define BANK_SIZE 256
+#define INDEX_SIZE 32
+
+static uint8_t hal_flash_bank_memory_storage[NUM_BANKS * BANK_SIZE];
+static btstack_tlv_flash_log_index_entry_t tlv_index[INDEX_SIZE];
+
+// count erases and bytes written per operation
+static const hal_flash_bank_t * hal_flash_bank_memory_impl;
+static int      num_erases;
+static uint32_t num_bytes_written;
+
+static uint32_t counting_get_size(void * context){
+	return hal_flash_bank_memory_impl->get_size(context);
+}
+static uint32_t counting_get_alignment(void * context){
+	return hal_flash_bank_memory_impl->get_alignment(context);
+}
+static void counting_erase(void * context, int bank){
+	num_erases++;
+	hal_flash_bank_memory_impl->erase(context, bank);
+}
+static void counting_read(void * context, int bank, uint32_t offset, uint8_t * buffer, uint32_t size){
+	hal_flash_bank_memory_impl->read(context, bank, offset, buffer, size);
+}
+static void counting_write(void * context, int bank, uint32_t offset, const uint8_t * data, uint32_t size){
+	num_bytes_written += size;
+	hal_flash_bank_memory_impl->write(context, bank, offset, data, size);
+}
+
+static const hal_flash_bank_t hal_flash_bank_counting = {
+	&counting_get_size,
+	&counting_get_alignment,
+	&counting_erase,
+	&counting_read,
+	&counting_write,
+};
+
+TEST_GROUP(TLV_FLASH_LOG){
+	hal_flash_bank_memory_t  hal_flash_bank_context;
+	const btstack_tlv_t *    btstack_tlv_impl;
+	btstack_tlv_flash_log_t  btstack_tlv_context;
+
+	void setup(void){
+		hal_flash_bank_memory_impl = hal_flash_bank_memory_init_instance_with_banks(&hal_flash_bank_context, hal_flash_bank_memory_storage, sizeof(hal_flash_bank_memory_storage), NUM_BANKS);
+		init_tlv();
+	}
+	void init_tlv(void){
+		btstack_tlv_impl = btstack_tlv_flash_log_init_instance(&btstack_tlv_context, &hal_flash_bank_counting, &hal_flash_bank_context, NUM_BANKS, tlv_index, INDEX_SIZE);
+	}
+	void store_u32(uint32_t tag, uint32_t value){
+		int status = btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, (const uint8_t *) &value, sizeof(value));
+		CHECK_EQUAL(0, status);
+	}
+	uint32_t get_u32(uint32_t tag){
+		uint32_t value = 0;
+		int size = btstack_tlv_impl->get_tag(&btstack_tlv_context, tag, (uint8_t *) &value, sizeof(value));
+		CHECK_EQUAL(sizeof(value), size);
+		return value;
+	}
+	int get_size(uint32_t tag){
+		return btstack_tlv_impl->get_tag(&btstack_tlv_context, tag, NULL, 0);
+	}
+};
+
+TEST(TLV_FLASH_LOG, MissingTag){
+	CHECK_EQUAL(0, get_size(0x1234));
+}
+
+TEST(TLV_FLASH_LOG, InvalidConfiguration){
+	btstack_tlv_flash_log_t context;
+	POINTERS_EQUAL(NULL, btstack_tlv_flash_log_init_instance(&context, &hal_flash_bank_counting, &hal_flash_bank_context, 2, tlv_index, INDEX_SIZE));
+	POINTERS_EQUAL(NULL, btstack_tlv_flash_log_init_instance(&context, &hal_flash_bank_counting, &hal_flash_bank_context, NUM_BANKS, tlv_index, 0));
+}
+
+TEST(TLV_FLASH_LOG, WriteRead){
+	uint8_t data[20];
+	uint8_t buffer[20];
+	memset(data, 0x55, sizeof(data));
+	CHECK_EQUAL(0, btstack_tlv_impl->store_tag(&btstack_tlv_context, 0x1234, data, sizeof(data)));
+	CHECK_EQUAL(sizeof(data), get_size(0x1234));
+	CHECK_EQUAL(10, btstack_tlv_impl->get_tag(&btstack_tlv_context, 0x1234, buffer, 10));
+	MEMCMP_EQUAL(data, buffer, 10);
+}
+
+TEST(TLV_FLASH_LOG, InvalidTag){
+	uint8_t data = 0;
+	CHECK(btstack_tlv_impl->store_tag(&btstack_tlv_context, 0, &data, 1) != 0);
+	CHECK(btstack_tlv_impl->store_tag(&btstack_tlv_context, 0xffffffff, &data, 1) != 0);
+}
+
+TEST(TLV_FLASH_LOG, WriteWriteRead){
+	store_u32(0x1234, 1);
+	store_u32(0x1234, 2);
+	CHECK_EQUAL(2, get_u32(0x1234));
+	CHECK_EQUAL(1, btstack_tlv_context.num_tags);
+}
+
+TEST(TLV_FLASH_LOG, WriteDeleteRead){
+	store_u32(0x1234, 1);
+	store_u32(0x5678, 2);
+	btstack_tlv_impl->delete_tag(&btstack_tlv_context, 0x1234);
+	CHECK_EQUAL(0, get_size(0x1234));
+	CHECK_EQUAL(2, get_u32(0x5678));
+
+	init_tlv();
+	CHECK_EQUAL(0, get_size(0x1234));
+	CHECK_EQUAL(2, get_u32(0x5678));
+}
+
+TEST(TLV_FLASH_LOG, IndexCollisions){
+	uint32_t tag;
+	// more tags than index slots / 2
+	for (tag = 1; tag <= 20; tag++){
+		store_u32(tag, tag * 3);
+	}
+	// delete every other tag, remaining ones must still be found
+	for (tag = 1; tag <= 20; tag += 2){
+		btstack_tlv_impl->delete_tag(&btstack_tlv_context, tag);
+	}
+	for (tag = 1; tag <= 20; tag++){
+		if (tag & 1){
+			CHECK_EQUAL(0, get_size(tag));
+		} else {
+			CHECK_EQUAL(tag * 3, get_u32(tag));
+		}
+	}
+	CHECK_EQUAL(10, btstack_tlv_context.num_tags);
+}
+
+TEST(TLV_FLASH_LOG, IndexFull){
+	uint32_t tag;
+	uint32_t value = 0;
+	for (tag = 1; tag < INDEX_SIZE; tag++){
+		store_u32(tag, tag);
+	}
+	CHECK_EQUAL(2, btstack_tlv_impl->store_tag(&btstack_tlv_context, INDEX_SIZE, (const uint8_t *) &value, sizeof(value)));
+	// updates still work
+	store_u32(1, 100);
+	CHECK_EQUAL(100, get_u32(1));
+}
+
+TEST(TLV_FLASH_LOG, Replay){
+	uint32_t i;
+	for (i = 0; i < 100; i++){
+		store_u32(0x1000 + (i % 5), i);
+	}
+	init_tlv();
+	CHECK_EQUAL(5, btstack_tlv_context.num_tags);
+	for (i = 0; i < 5; i++){
+		CHECK_EQUAL(95 + i, get_u32(0x1000 + i));
+	}
+}
+
+TEST(TLV_FLASH_LOG, GarbageCollection){
+	uint32_t i;
+	uint8_t bond[60];
+	// two bonds that stay live
+	memset(bond, 0xaa, sizeof(bond));
+	CHECK_EQUAL(0, btstack_tlv_impl->store_tag(&btstack_tlv_context, 'BOND', bond, sizeof(bond)));
+	memset(bond, 0xbb, sizeof(bond));
+	CHECK_EQUAL(0, btstack_tlv_impl->store_tag(&btstack_tlv_context, 'BONE', bond, sizeof(bond)));
+
+	// frequent counter updates
+	for (i = 0; i < 1000; i++){
+		num_erases = 0;
+		num_bytes_written = 0;
+		store_u32(0x2000 + (i % 4), i);
+		// at most one erase or one gc step per store
+		CHECK(num_erases <= 1);
+		CHECK(num_bytes_written <= 2 * (8 + 60) + 8 + 4 + 4 + BTSTACK_TLV_FLASH_LOG_GC_STEP_SIZE + 8);
+	}
+	CHECK(btstack_tlv_context.num_erases > 0);
+
+	for (i = 0; i < 4; i++){
+		CHECK_EQUAL(996 + i, get_u32(0x2000 + i));
+	}
+	uint8_t buffer[60];
+	btstack_tlv_impl->get_tag(&btstack_tlv_context, 'BOND', buffer, sizeof(buffer));
+	memset(bond, 0xaa, sizeof(bond));
+	MEMCMP_EQUAL(bond, buffer, sizeof(bond));
+
+	init_tlv();
+	CHECK_EQUAL(6, btstack_tlv_context.num_tags);
+	for (i = 0; i < 4; i++){
+		CHECK_EQUAL(996 + i, get_u32(0x2000 + i));
+	}
+	btstack_tlv_impl->get_tag(&btstack_tlv_context, 'BONE', buffer, sizeof(buffer));
+	memset(bond, 0xbb, sizeof(bond));
+	MEMCMP_EQUAL(bond, buffer, sizeof(bond));
+}
+
+TEST(TLV_FLASH_LOG, GarbageCollectionSteps){
+	uint32_t i;
+	// write until garbage collection starts
+	for (i = 0; btstack_tlv_context.num_erased_banks >= BTSTACK_TLV_FLASH_LOG_GC_ERASED_BANKS; i++){
+		store_u32(0x3000 + (i % 2), i);
+		CHECK(i < 100);
+	}
+	// finish garbage collection in steps without store
+	uint32_t num_gc_steps = btstack_tlv_context.num_gc_steps;
+	int steps = 0;
+	while (btstack_tlv_flash_log_gc_step(&btstack_tlv_context)){
+		steps++;
+		CHECK(steps < 100);
+	}
+	CHECK(btstack_tlv_context.num_erased_banks >= BTSTACK_TLV_FLASH_LOG_GC_ERASED_BANKS);
+	CHECK(btstack_tlv_context.num_gc_steps > num_gc_steps);
+	CHECK_EQUAL(i - 1, get_u32(0x3000 + ((i - 1) % 2)));
+	CHECK_EQUAL(i - 2, get_u32(0x3000 + (i % 2)));
+}
+
+TEST(TLV_FLASH_LOG, NoSpaceLeft){
+	uint8_t data[200];
+	memset(data, 0x11, sizeof(data));
+	// live data is limited to num_banks - 2 banks
+	CHECK_EQUAL(0, btstack_tlv_impl->store_tag(&btstack_tlv_context, 1, data, sizeof(data)));
+	CHECK_EQUAL(0, btstack_tlv_impl->store_tag(&btstack_tlv_context, 2, data, sizeof(data)));
+	CHECK_EQUAL(2, btstack_tlv_impl->store_tag(&btstack_tlv_context, 3, data, sizeof(data)));
+	// too large for bank
+	uint8_t large[BANK_SIZE];
+	CHECK_EQUAL(2, btstack_tlv_impl->store_tag(&btstack_tlv_context, 4, large, sizeof(large)));
+	// updates still possible with garbage collection
+	int i;
+	for (i = 0; i < 10; i++){
+		data[0] = i;
+		CHECK_EQUAL(0, btstack_tlv_impl->store_tag(&btstack_tlv_context, 1 + (i & 1), data, sizeof(data)));
+	}
+	init_tlv();
+	uint8_t buffer;
+	btstack_tlv_impl->get_tag(&btstack_tlv_context, 1, &buffer, 1);
+	CHECK_EQUAL(8, buffer);
+	btstack_tlv_impl->get_tag(&btstack_tlv_context, 2, &buffer, 1);
+	CHECK_EQUAL(9, buffer);
+}
+
+TEST(TLV_FLASH_LOG, ResetBeforeInvalidate){
+	store_u32(0x1234, 1);
+	// new entry written, but old one not invalidated yet
+	uint8_t entry[12];
+	big_endian_store_32(entry, 0, 0x1234);
+	big_endian_store_32(entry, 4, 4);
+	little_endian_store_32(entry, 8, 2);
+	hal_flash_bank_memory_impl->write(&hal_flash_bank_context, btstack_tlv_context.head_bank, btstack_tlv_context.write_offset, entry, sizeof(entry));
+
+	init_tlv();
+	CHECK_EQUAL(1, btstack_tlv_context.num_tags);
+	CHECK_EQUAL(2, get_u32(0x1234));
+	store_u32(0x1234, 3);
+	init_tlv();
+	CHECK_EQUAL(3, get_u32(0x1234));
+}
+
+TEST(TLV_FLASH_LOG, ResetBeforeTag){
+	store_u32(0x1234, 1);
+	// value written, but not tag and len
+	uint8_t value[4] = { 1, 2, 3, 4};
+	int bank = btstack_tlv_context.head_bank;
+	hal_flash_bank_memory_impl->write(&hal_flash_bank_context, bank, btstack_tlv_context.write_offset + 8, value, sizeof(value));
+
+	init_tlv();
+	CHECK_EQUAL(1, get_u32(0x1234));
+	// continues in next bank
+	store_u32(0x1234, 2);
+	CHECK(btstack_tlv_context.head_bank != bank);
+	init_tlv();
+	CHECK_EQUAL(2, get_u32(0x1234));
+}
+
+TEST(TLV_FLASH_LOG, InvalidBankErased){
+	store_u32(0x1234, 1);
+	// garbage in bank without header
+	uint8_t garbage[4] = { 1, 2, 3, 4};
+	int bank = (btstack_tlv_context.head_bank + 2) % NUM_BANKS;
+	hal_flash_bank_memory_impl->write(&hal_flash_bank_context, bank, 100, garbage, sizeof(garbage));
+	num_erases = 0;
+	init_tlv();
+	CHECK_EQUAL(1, num_erases);
+	CHECK_EQUAL(NUM_BANKS - 1, btstack_tlv_context.num_erased_banks);
+	CHECK_EQUAL(1, get_u32(0x1234));
+}
+
+int main (int argc, const char * argv[]){
+	hci_dump_open("tlv_log_test.pklg", HCI_DUMP_PACKETLOGGER);
+	return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,300 @@
+
+// *****************************************************************************
+//
+// test gatt client request queue and Read Multiple batching
+//
+// *****************************************************************************
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "btstack_config.h"
+#include "btstack_event.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "ble/att_db.h"
+#include "ble/gatt_client.h"
+#include "profile.h"
+
+void mock_set_can_send_now(int enabled);
+void mock_simulate_disconnected(uint16_t con_handle);
+void mock_reset_att_requests_sent(void);
+uint16_t mock_att_requests_sent(uint8_t opcode);
+
+#define MAX_REQUESTS 12
+#define MAX_EVENTS   32
+
+static const hci_con_handle_t con_handle = 0x40;
+
+// event log of client
+typedef struct {
+    uint8_t  type;
+    uint16_t value_handle;
+    uint16_t value_length;
+    uint8_t  status;
+} test_event_t;
+
+static test_event_t events[MAX_EVENTS];
+static int num_events;
+
+// access log of server
+static uint16_t server_accesses[MAX_EVENTS];
+static int num_server_accesses;
+
+// size of values returned by server
+static uint16_t server_value_length;
+
+static gatt_client_service_t service;
+static gatt_client_characteristic_t characteristics[50];
+static int num_characteristics;
+
+static void handle_discovery_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (hci_event_packet_get_type(packet)){
+        case GATT_EVENT_SERVICE_QUERY_RESULT:
+            gatt_event_service_query_result_get_service(packet, &service);
+            break;
+        case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT:
+            gatt_event_characteristic_query_result_get_characteristic(packet, &characteristics[num_characteristics++]);
+            break;
+        default:
+            break;
+    }
+}
+
+static void handle_request_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    if (packet_type != HCI_EVENT_PACKET) return;
+    test_event_t * event = &events[num_events];
+    memset(event, 0, sizeof(test_event_t));
+    event->type = hci_event_packet_get_type(packet);
+    switch (event->type){
+        case GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT:
+            event->value_handle = gatt_event_characteristic_value_query_result_get_value_handle(packet);
+            event->value_length = gatt_event_characteristic_value_query_result_get_value_length(packet);
+            CHECK_EQUAL(event->value_handle & 0xff, gatt_event_characteristic_value_query_result_get_value(packet)[0]);
+            break;
+        case GATT_EVENT_QUERY_COMPLETE:
+            event->status = gatt_event_query_complete_get_status(packet);
+            break;
+        default:
+            return;
+    }
+    num_events++;
+}
+
+extern "C" uint16_t att_read_callback(uint16_t handle, uint16_t attribute_handle, uint16_t offset, uint8_t * buffer, uint16_t buffer_size){
+    if (buffer){
+        server_accesses[num_server_accesses++] = attribute_handle;
+        // value: low byte of handle, followed by zeros
+        memset(buffer, 0, buffer_size);
+        buffer[0] = attribute_handle & 0xff;
+    }
+    return server_value_length;
+}
+
+extern "C" int att_write_callback(hci_con_handle_t handle, uint16_t attribute_handle, uint16_t transaction_mode, uint16_t offset, uint8_t *buffer, uint16_t buffer_size){
+    server_accesses[num_server_accesses++] = attribute_handle;
+    return 0;
+}
+
+static uint16_t value_handle_for_uuid16(uint16_t uuid16){
+    int i;
+    for (i=0;i<num_characteristics;i++){
+        if (characteristics[i].uuid16 == uuid16) return characteristics[i].value_handle;
+    }
+    return 0;
+}
+
+static void check_value_event(int index, uint16_t value_handle, uint16_t value_length){
+    CHECK_EQUAL(GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT, events[index].type);
+    CHECK_EQUAL(value_handle, events[index].value_handle);
+    CHECK_EQUAL(value_length, events[index].value_length);
+}
+
+static void check_complete_event(int index, uint8_t status){
+    CHECK_EQUAL(GATT_EVENT_QUERY_COMPLETE, events[index].type);
+    CHECK_EQUAL(status, events[index].status);
+}
+
+TEST_GROUP(GATTClientQueue){
+    gatt_client_request_t requests[MAX_REQUESTS];
+    uint16_t readable[6];
+
+    void setup(void){
+        mock_set_can_send_now(1);
+        if (num_characteristics == 0){
+            CHECK_EQUAL(0, gatt_client_discover_primary_services_by_uuid16(&handle_discovery_event, con_handle, 0xF000));
+            CHECK_EQUAL(0, gatt_client_discover_characteristics_for_service(&handle_discovery_event, con_handle, &service));
+        }
+        readable[0] = value_handle_for_uuid16(0xF100);
+        readable[1] = value_handle_for_uuid16(0xF10B);
+        readable[2] = value_handle_for_uuid16(0xF10C);
+        readable[3] = value_handle_for_uuid16(0xF10D);
+        readable[4] = value_handle_for_uuid16(0xF10E);
+        readable[5] = readable[0];
+        int i;
+        for (i=0;i<5;i++){
+            CHECK(readable[i] != 0);
+        }
+        num_events = 0;
+        num_server_accesses = 0;
+        server_value_length = 2;
+        mock_reset_att_requests_sent();
+    }
+};
+
+TEST(GATTClientQueue, ReadsAreCombinedIntoReadMultiple){
+    int i;
+    mock_set_can_send_now(0);
+    for (i=0;i<6;i++){
+        CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[i], &handle_request_event, con_handle, readable[i], 2, 0));
+    }
+    CHECK_EQUAL(0, num_events);
+    mock_set_can_send_now(1);
+    CHECK_EQUAL(1, mock_att_requests_sent(ATT_READ_MULTIPLE_REQUEST));
+    CHECK_EQUAL(0, mock_att_requests_sent(ATT_READ_REQUEST));
+    CHECK_EQUAL(12, num_events);
+    for (i=0;i<6;i++){
+        check_value_event(2*i, readable[i], 2);
+        check_complete_event(2*i+1, 0);
+    }
+}
+
+TEST(GATTClientQueue, ReadMultipleLimitedByMaxHandles){
+    int i;
+    mock_set_can_send_now(0);
+    for (i=0;i<10;i++){
+        CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[i], &handle_request_event, con_handle, readable[i % 6], 2, 0));
+    }
+    mock_set_can_send_now(1);
+    // ceil(10 / MAX_GATT_CLIENT_READ_MULTIPLE_HANDLES)
+    CHECK_EQUAL(2, mock_att_requests_sent(ATT_READ_MULTIPLE_REQUEST));
+    CHECK_EQUAL(20, num_events);
+}
+
+TEST(GATTClientQueue, ReadMultipleLimitedByMTU){
+    int i;
+    server_value_length = 8;
+    mock_set_can_send_now(0);
+    for (i=0;i<6;i++){
+        CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[i], &handle_request_event, con_handle, readable[i], 8, 0));
+    }
+    mock_set_can_send_now(1);
+    // only two 8 byte values fit into Read Multiple Response with MTU 23
+    CHECK_EQUAL(3, mock_att_requests_sent(ATT_READ_MULTIPLE_REQUEST));
+    CHECK_EQUAL(12, num_events);
+    for (i=0;i<6;i++){
+        check_value_event(2*i, readable[i], 8);
+    }
+}
+
+TEST(GATTClientQueue, ReadsWithUnknownLengthAreNotCombined){
+    int i;
+    mock_set_can_send_now(0);
+    for (i=0;i<3;i++){
+        CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[i], &handle_request_event, con_handle, readable[i], 0, 0));
+    }
+    mock_set_can_send_now(1);
+    CHECK_EQUAL(0, mock_att_requests_sent(ATT_READ_MULTIPLE_REQUEST));
+    CHECK_EQUAL(3, mock_att_requests_sent(ATT_READ_REQUEST));
+    CHECK_EQUAL(6, num_events);
+    for (i=0;i<3;i++){
+        check_value_event(2*i, readable[i], 2);
+        check_complete_event(2*i+1, 0);
+    }
+}
+
+TEST(GATTClientQueue, Priority){
+    uint8_t value[] = { 1, 2 };
+    mock_set_can_send_now(0);
+    CHECK_EQUAL(0, gatt_client_queue_write_value_of_characteristic(&requests[0], &handle_request_event, con_handle, readable[0], sizeof(value), value, 0));
+    CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[1], &handle_request_event, con_handle, readable[1], 2, 1));
+    CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[2], &handle_request_event, con_handle, readable[2], 2, 2));
+    mock_set_can_send_now(1);
+    CHECK_EQUAL(1, mock_att_requests_sent(ATT_READ_MULTIPLE_REQUEST));
+    CHECK_EQUAL(1, mock_att_requests_sent(ATT_WRITE_REQUEST));
+    CHECK_EQUAL(3, num_server_accesses);
+    CHECK_EQUAL(readable[2], server_accesses[0]);
+    CHECK_EQUAL(readable[1], server_accesses[1]);
+    CHECK_EQUAL(readable[0], server_accesses[2]);
+    CHECK_EQUAL(5, num_events);
+    check_complete_event(4, 0);
+}
+
+TEST(GATTClientQueue, ErrorResponseFallsBackToSingleReads){
+    uint16_t not_readable = value_handle_for_uuid16(0xF102);
+    mock_set_can_send_now(0);
+    CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[0], &handle_request_event, con_handle, readable[0], 2, 0));
+    CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[1], &handle_request_event, con_handle, not_readable, 2, 0));
+    CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[2], &handle_request_event, con_handle, readable[1], 2, 0));
+    mock_set_can_send_now(1);
+    CHECK_EQUAL(1, mock_att_requests_sent(ATT_READ_MULTIPLE_REQUEST));
+    CHECK_EQUAL(3, mock_att_requests_sent(ATT_READ_REQUEST));
+    CHECK_EQUAL(5, num_events);
+    check_value_event(0, readable[0], 2);
+    check_complete_event(1, 0);
+    check_complete_event(2, ATT_ERROR_READ_NOT_PERMITTED);
+    check_value_event(3, readable[1], 2);
+    check_complete_event(4, 0);
+}
+
+TEST(GATTClientQueue, LengthMismatchFallsBackToSingleReads){
+    int i;
+    mock_set_can_send_now(0);
+    for (i=0;i<3;i++){
+        CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[i], &handle_request_event, con_handle, readable[i], 3, 0));
+    }
+    mock_set_can_send_now(1);
+    CHECK_EQUAL(1, mock_att_requests_sent(ATT_READ_MULTIPLE_REQUEST));
+    CHECK_EQUAL(3, mock_att_requests_sent(ATT_READ_REQUEST));
+    CHECK_EQUAL(6, num_events);
+    for (i=0;i<3;i++){
+        check_value_event(2*i, readable[i], 2);
+    }
+}
+
+TEST(GATTClientQueue, CancelRequest){
+    int i;
+    mock_set_can_send_now(0);
+    for (i=0;i<3;i++){
+        CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[i], &handle_request_event, con_handle, readable[i], 2, 0));
+    }
+    CHECK_EQUAL(GATT_CLIENT_IN_WRONG_STATE, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[1], &handle_request_event, con_handle, readable[1], 2, 0));
+    CHECK_EQUAL(0, gatt_client_cancel_request(&requests[1]));
+    CHECK_EQUAL(GATT_CLIENT_IN_WRONG_STATE, gatt_client_cancel_request(&requests[1]));
+    mock_set_can_send_now(1);
+    CHECK_EQUAL(4, num_events);
+    check_value_event(0, readable[0], 2);
+    check_value_event(2, readable[2], 2);
+}
+
+TEST(GATTClientQueue, DisconnectFailsQueuedRequests){
+    int i;
+    mock_set_can_send_now(0);
+    for (i=0;i<3;i++){
+        CHECK_EQUAL(0, gatt_client_queue_read_value_of_characteristic_using_value_handle(&requests[i], &handle_request_event, con_handle, readable[i], 2, 0));
+    }
+    mock_simulate_disconnected(con_handle);
+    CHECK_EQUAL(3, num_events);
+    for (i=0;i<3;i++){
+        check_complete_event(i, ATT_ERROR_HCI_DISCONNECT_RECEIVED);
+    }
+    mock_set_can_send_now(1);
+    CHECK_EQUAL(0, mock_att_requests_sent(ATT_READ_MULTIPLE_REQUEST));
+}
+
+int main (int argc, const char * argv[]){
+    att_set_db(profile_data);
+    att_set_write_callback(&att_write_callback);
+    att_set_read_callback(&att_read_callback);
+
+    gatt_client_init();
+
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
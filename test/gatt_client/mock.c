@@ -19,6 +19,10 @@ static const uint16_t max_mtu = 23;
 static uint8_t  l2cap_stack_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 8 + max_mtu];	// pre buffer + HCI Header + L2CAP header
 uint16_t gatt_client_handle = 0x40;
 
+static int      can_send_now = 1;
+static int      can_send_now_requested = 0;
+static uint16_t att_requests_sent[256];
+
 uint16_t get_gatt_client_handle(void){
 	return gatt_client_handle;
 }
@@ -43,6 +47,27 @@ void mock_simulate_scan_response(void){
 	registered_hci_event_handler(HCI_EVENT_PACKET, 0, (uint8_t *)&packet, sizeof(packet));
 }
 
+void mock_set_can_send_now(int enabled){
+	can_send_now = enabled;
+	if (!can_send_now || !can_send_now_requested) return;
+	can_send_now_requested = 0;
+	uint8_t event[] = { L2CAP_EVENT_CAN_SEND_NOW, 2, 1, 0};
+	att_packet_handler(HCI_EVENT_PACKET, 0, (uint8_t*)event, sizeof(event));
+}
+
+void mock_simulate_disconnected(uint16_t con_handle){
+	uint8_t packet[] = {HCI_EVENT_DISCONNECTION_COMPLETE, 4, 0, (uint8_t) (con_handle & 0xff), (uint8_t) (con_handle >> 8), 0x13};
+	registered_hci_event_handler(HCI_EVENT_PACKET, 0, (uint8_t *)&packet, sizeof(packet));
+}
+
+void mock_reset_att_requests_sent(void){
+	memset(att_requests_sent, 0, sizeof(att_requests_sent));
+}
+
+uint16_t mock_att_requests_sent(uint8_t opcode){
+	return att_requests_sent[opcode];
+}
+
 void gap_start_scan(void){
 }
 void gap_stop_scan(void){
@@ -94,15 +119,25 @@ void hci_add_event_handler(btstack_packet_callback_registration_t * callback_han
 	registered_hci_event_handler = callback_handler->callback;
 }
 
+void hci_add_event_handler_for_events(btstack_packet_callback_registration_t * callback_handler, const uint8_t * event_codes, const uint8_t * le_subevent_codes){
+	UNUSED(event_codes);
+	UNUSED(le_subevent_codes);
+	hci_add_event_handler(callback_handler);
+}
+
 int l2cap_reserve_packet_buffer(void){
 	return 1;
 }
 
 int l2cap_can_send_fixed_channel_packet_now(uint16_t handle, uint16_t channel_id){
-	return 1;
+	return can_send_now;
 }
 
 void l2cap_request_can_send_fix_channel_now_event(uint16_t handle, uint16_t channel_id){
+	if (!can_send_now){
+		can_send_now_requested = 1;
+		return;
+	}
 	uint8_t event[] = { L2CAP_EVENT_CAN_SEND_NOW, 2, 1, 0};
 	att_packet_handler(HCI_EVENT_PACKET, 0, (uint8_t*)event, sizeof(event));
 }
@@ -110,10 +145,13 @@ void l2cap_request_can_send_fix_channel_now_event(uint16_t handle, uint16_t chan
 int l2cap_send_prepared_connectionless(uint16_t handle, uint16_t cid, uint16_t len){
 	att_connection_t att_connection;
 	att_init_connection(&att_connection);
-	uint8_t response[max_mtu];
+	// reserve space for HCI/L2CAP headers in front of ATT PDU, used by gatt client to create events in place
+	uint8_t response_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 8 + max_mtu];
+	uint8_t * response = &response_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 8];
+	att_requests_sent[l2cap_get_outgoing_buffer()[0]]++;
 	uint16_t response_len = att_handle_request(&att_connection, l2cap_get_outgoing_buffer(), len, &response[0]);
 	if (response_len){
-		att_packet_handler(ATT_DATA_PACKET, gatt_client_handle, &response[0], response_len);
+		att_packet_handler(ATT_DATA_PACKET, gatt_client_handle, response, response_len);
 	}
 	return 0;
 }
@@ -0,0 +1,168 @@
+/*
+ * hci_acl_receive_benchmark.c
+ *
+ * Receives L2CAP PDUs in ACL fragments of different sizes through a mock HCI Transport and reports
+ * the bytes copied by memcpy in HCI per received payload byte and the receive throughput.
+ *
+ * The transport receives into incoming buffers from hci_incoming_buffer_get() and continues with
+ * the buffer returned by hci_incoming_buffer_recycle(), like the H4 and libusb transports. Built
+ * without HCI_INCOMING_BUFFER_COUNT, it receives into a single static buffer instead and HCI copies
+ * every fragment into the recombination buffer of the connection.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_dump.h"
+#include "hci_transport.h"
+
+#define CON_HANDLE 0x0040
+#define L2CAP_CID  0x0040
+#define NUM_BYTES  (100 * 1024 * 1024)
+
+typedef struct {
+    const char * name;
+    uint16_t     pdu_len;
+    uint16_t     fragment_len;
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    { "LE, 27 byte fragments",       672,   27 },
+    { "LE DLE, 251 byte fragments", 1000,  251 },
+    { "BR/EDR, 3-DH5 fragments",    1000, 1021 },
+};
+
+// memcpy calls from hci.c are counted while the packet handler is active
+extern "C" void * __real_memcpy(void * dest, const void * src, size_t n);
+static int      count_memcpy;
+static uint64_t memcpy_bytes;
+
+extern "C" void * __wrap_memcpy(void * dest, const void * src, size_t n){
+    if (count_memcpy){
+        memcpy_bytes += n;
+    }
+    return __real_memcpy(dest, src, n);
+}
+
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+static uint8_t   static_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + HCI_ACL_BUFFER_SIZE];
+static uint8_t * receive_buffer;
+static uint64_t  received_bytes;
+
+static void mock_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static int mock_can_send_packet_now(uint8_t packet_type){
+    UNUSED(packet_type);
+    return 0;
+}
+
+static int mock_open(void){
+    return 0;
+}
+
+static int mock_close(void){
+    return 0;
+}
+
+static const hci_transport_t mock_transport = {
+  /*  .transport.name                          = */  "MOCK",
+  /*  .transport.init                          = */  NULL,
+  /*  .transport.open                          = */  &mock_open,
+  /*  .transport.close                         = */  &mock_close,
+  /*  .transport.register_packet_handler       = */  &mock_register_packet_handler,
+  /*  .transport.can_send_packet_now           = */  &mock_can_send_packet_now,
+  /*  .transport.send_packet                   = */  NULL,
+  /*  .transport.set_baudrate                  = */  NULL,
+};
+
+static void acl_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    UNUSED(channel);
+    UNUSED(packet);
+    if (packet_type != HCI_ACL_DATA_PACKET) return;
+    received_bytes += size - 8;
+}
+
+static void send_le_connection_complete(void){
+    uint8_t buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 21];
+    const uint8_t event[] = {
+        HCI_EVENT_LE_META, 19, HCI_SUBEVENT_LE_CONNECTION_COMPLETE, 0x00, CON_HANDLE & 0xff, CON_HANDLE >> 8,
+        HCI_ROLE_SLAVE, 0x00, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x28, 0x00, 0x00, 0x00, 0x48, 0x00, 0x01 };
+    memcpy(&buffer[HCI_INCOMING_PRE_BUFFER_SIZE], event, sizeof(event));
+    transport_packet_handler(HCI_EVENT_PACKET, &buffer[HCI_INCOMING_PRE_BUFFER_SIZE], sizeof(event));
+}
+
+static void receive_fragment(const uint8_t * pdu, uint16_t pos, uint16_t len){
+    uint8_t * packet = &receive_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+    little_endian_store_16(packet, 0, CON_HANDLE | (pos ? 0x1000 : 0x2000));
+    little_endian_store_16(packet, 2, len);
+    memcpy(&packet[4], &pdu[pos], len);
+    count_memcpy = 1;
+    transport_packet_handler(HCI_ACL_DATA_PACKET, packet, len + 4);
+    count_memcpy = 0;
+    receive_buffer = hci_incoming_buffer_recycle(receive_buffer);
+    if (!receive_buffer){
+        receive_buffer = static_buffer;
+    }
+}
+
+static void run_benchmark(const scenario_t * scenario){
+    uint8_t pdu[4 + HCI_ACL_PAYLOAD_SIZE];
+    struct timespec start_ts, end_ts;
+    int i;
+
+    little_endian_store_16(pdu, 0, scenario->pdu_len);
+    little_endian_store_16(pdu, 2, L2CAP_CID);
+    for (i = 0; i < scenario->pdu_len; i++){
+        pdu[4 + i] = (uint8_t) i;
+    }
+
+    received_bytes = 0;
+    memcpy_bytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    while (received_bytes < NUM_BYTES){
+        uint16_t pos = 0;
+        while (pos < 4 + scenario->pdu_len){
+            uint16_t len = btstack_min(scenario->fragment_len, 4 + scenario->pdu_len - pos);
+            receive_fragment(pdu, pos, len);
+            pos += len;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_ts);
+    double elapsed_s = (end_ts.tv_sec - start_ts.tv_sec) + (end_ts.tv_nsec - start_ts.tv_nsec) / 1000000000.0;
+
+    printf("%-28s %5.3f memcpy bytes/payload byte, %8.1f MB/s\n", scenario->name,
+        (double) memcpy_bytes / received_bytes, received_bytes / elapsed_s / 1000000.0);
+}
+
+int main(void){
+    btstack_memory_init();
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+    hci_init(&mock_transport, NULL);
+    hci_register_acl_packet_handler(&acl_packet_handler);
+    send_le_connection_complete();
+
+    receive_buffer = hci_incoming_buffer_get();
+    if (receive_buffer){
+        printf("Receive into %u incoming buffers\n", HCI_INCOMING_BUFFER_COUNT);
+    } else {
+        printf("Receive into static buffer\n");
+        receive_buffer = static_buffer;
+    }
+
+    unsigned int i;
+    for (i = 0; i < sizeof(scenarios) / sizeof(scenario_t); i++){
+        run_benchmark(&scenarios[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * hci_command_queue_test.c
+ *
+ * Powers on HCI with a mock Controller that reports different values for Num_HCI_Command_Packets.
+ * Checks that HCI never has more commands in flight than the Controller accepts, that init sends
+ * the same commands in the same order independent of the number of credits, and that configuration
+ * commands during init and white list updates are pipelined.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_util.h"
+#include "gap.h"
+#include "hci.h"
+#include "hci_cmd.h"
+#include "hci_dump.h"
+#include "mock_controller.h"
+
+static uint16_t serialized_opcodes[100];
+static int      serialized_num_commands;
+static int      serialized_rounds;
+
+static void power_on_serialized(void){
+    mock_controller_init(1);
+    serialized_rounds = mock_controller_power_on();
+    serialized_num_commands = mock_controller_num_commands();
+    int i;
+    for (i = 0; i < serialized_num_commands; i++){
+        serialized_opcodes[i] = mock_controller_command_opcode(i);
+    }
+    mock_controller_close();
+}
+
+static int num_commands_with_opcode(uint16_t opcode){
+    int i;
+    int count = 0;
+    for (i = 0; i < mock_controller_num_commands(); i++){
+        if (mock_controller_command_opcode(i) == opcode) count++;
+    }
+    return count;
+}
+
+TEST_GROUP(CommandQueue){
+    void setup(void){
+        power_on_serialized();
+    }
+    void teardown(void){
+        mock_controller_close();
+    }
+};
+
+TEST(CommandQueue, OneCreditOneCommandPerRound){
+    mock_controller_init(1);
+    int rounds = mock_controller_power_on();
+    CHECK_EQUAL(HCI_STATE_WORKING, hci_get_state());
+    CHECK_EQUAL(1, mock_controller_max_commands_in_flight());
+    CHECK_EQUAL(mock_controller_num_commands(), rounds);
+}
+
+TEST(CommandQueue, PipelinedInitSendsSameCommands){
+    mock_controller_init(HCI_MAX_COMMANDS_IN_FLIGHT);
+    int rounds = mock_controller_power_on();
+    CHECK_EQUAL(HCI_STATE_WORKING, hci_get_state());
+    CHECK_EQUAL(serialized_num_commands, mock_controller_num_commands());
+    int i;
+    for (i = 0; i < serialized_num_commands; i++){
+        CHECK_EQUAL(serialized_opcodes[i], mock_controller_command_opcode(i));
+    }
+    CHECK(rounds < serialized_rounds);
+    printf("Power on: %u commands, %u rounds with 1 credit, %u rounds with %u credits\n",
+        serialized_num_commands, serialized_rounds, rounds, HCI_MAX_COMMANDS_IN_FLIGHT);
+}
+
+TEST(CommandQueue, CreditsOfControllerAreHonored){
+    mock_controller_init(2);
+    mock_controller_power_on();
+    CHECK_EQUAL(HCI_STATE_WORKING, hci_get_state());
+    CHECK_EQUAL(2, mock_controller_max_commands_in_flight());
+}
+
+TEST(CommandQueue, CreditsLimitedByHostQueue){
+    mock_controller_init(HCI_MAX_COMMANDS_IN_FLIGHT + 4);
+    mock_controller_power_on();
+    CHECK_EQUAL(HCI_STATE_WORKING, hci_get_state());
+    CHECK(mock_controller_max_commands_in_flight() <= HCI_MAX_COMMANDS_IN_FLIGHT);
+}
+
+TEST(CommandQueue, WorkingAfterAllInitCommandsCompleted){
+    mock_controller_init(HCI_MAX_COMMANDS_IN_FLIGHT);
+    hci_power_control(HCI_POWER_ON);
+    while (hci_get_state() != HCI_STATE_WORKING){
+        int num_commands = mock_controller_num_commands();
+        CHECK(mock_controller_round() > 0);
+        // last round only completes commands
+        if (hci_get_state() == HCI_STATE_WORKING){
+            CHECK_EQUAL(num_commands, mock_controller_num_commands());
+        }
+    }
+}
+
+// rounds until all devices are on the white list of the Controller and it is connecting
+TEST(CommandQueue, WhitelistAndConnectPipelined){
+    bd_addr_t addr = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x00 };
+    int rounds[2];
+    uint8_t credits[2] = { 1, HCI_MAX_COMMANDS_IN_FLIGHT };
+    int i;
+    for (i = 0; i < 2; i++){
+        if (i) mock_controller_close();
+        mock_controller_init(credits[i]);
+        mock_controller_power_on();
+        uint8_t j;
+        for (j = 0; j < 3; j++){
+            addr[5] = j;
+            gap_auto_connection_start(BD_ADDR_TYPE_LE_PUBLIC, addr);
+        }
+        rounds[i] = 0;
+        while (1){
+            int last = mock_controller_num_commands() - 1;
+            if (num_commands_with_opcode(hci_le_add_device_to_white_list.opcode) == 3
+            &&  mock_controller_command_opcode(last) == hci_le_create_connection.opcode) break;
+            CHECK(mock_controller_round() > 0);
+            rounds[i]++;
+        }
+    }
+    CHECK_EQUAL(3, rounds[0]);
+    CHECK(rounds[1] < rounds[0]);
+    printf("White list with 3 devices and connect: %u rounds with 1 credit, %u rounds with %u credits\n",
+        rounds[0], rounds[1], HCI_MAX_COMMANDS_IN_FLIGHT);
+}
+
+int main (int argc, const char * argv[]){
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
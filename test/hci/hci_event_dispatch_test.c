@@ -0,0 +1,186 @@
+/*
+ * hci_event_dispatch_test.c
+ *
+ * Registers event handlers with and without event filter and sends events from a mock Controller.
+ * Checks that handlers registered with hci_add_event_handler_for_events only receive the listed
+ * event codes and LE Meta subevents, the order of delivery and the fallback if the dispatch table
+ * is full. Also counts the callbacks for a stream of Advertising Reports and Number Of Completed
+ * Packets events with a set of handlers similar to the one of the BLE stack.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "btstack_event.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_util.h"
+#include "gap.h"
+#include "hci.h"
+#include "hci_dump.h"
+#include "mock_controller.h"
+
+#define NUM_HANDLERS (HCI_MAX_FILTERED_EVENT_HANDLERS + 2)
+#define MAX_CALLS    100
+
+static btstack_packet_callback_registration_t registrations[NUM_HANDLERS];
+static int     num_events[NUM_HANDLERS];
+static int     num_calls;
+static int     call_handler[MAX_CALLS];
+static uint8_t call_event[MAX_CALLS];
+
+static void handle_event(int handler, uint8_t * packet){
+    num_events[handler]++;
+    if (num_calls == MAX_CALLS) return;
+    call_handler[num_calls] = handler;
+    call_event[num_calls]   = hci_event_packet_get_type(packet);
+    num_calls++;
+}
+
+#define HANDLER(n) static void handler_##n(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){ handle_event(n, packet); }
+HANDLER(0) HANDLER(1) HANDLER(2) HANDLER(3) HANDLER(4) HANDLER(5) HANDLER(6) HANDLER(7) HANDLER(8) HANDLER(9)
+static const btstack_packet_handler_t handlers[] = {
+    &handler_0, &handler_1, &handler_2, &handler_3, &handler_4, &handler_5, &handler_6, &handler_7, &handler_8, &handler_9
+};
+
+static const uint8_t disconnection_complete[] = { HCI_EVENT_DISCONNECTION_COMPLETE, 4, 0, 0x40, 0x00, 0x13 };
+static const uint8_t number_of_completed_packets[] = { HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS, 1, 0 };
+static const uint8_t le_connection_update_complete[] = { HCI_EVENT_LE_META, 10, HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE, 0, 0x40, 0x00, 6, 0, 0, 0, 10, 0};
+static const uint8_t le_advertising_report[] = { HCI_EVENT_LE_META, 12, HCI_SUBEVENT_LE_ADVERTISING_REPORT, 1, 0, 0, 1, 2, 3, 4, 5, 6, 0, 0xc0 };
+static const uint8_t le_unknown_subevent[] = { HCI_EVENT_LE_META, 1, 0x3f };
+
+static const uint8_t disconnection_events[] = { HCI_EVENT_DISCONNECTION_COMPLETE, 0 };
+static const uint8_t acl_events[] = { HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS, HCI_EVENT_DISCONNECTION_COMPLETE, 0 };
+static const uint8_t le_meta_events[] = { HCI_EVENT_LE_META, 0 };
+static const uint8_t le_connection_update_subevents[] = { HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE, 0 };
+
+static void send_event(const uint8_t * packet, uint16_t size){
+    mock_controller_send_event(packet, size);
+}
+
+static void reset_counters(void){
+    memset(num_events, 0, sizeof(num_events));
+    num_calls = 0;
+}
+
+TEST_GROUP(EventDispatch){
+    void setup(void){
+        int i;
+        for (i = 0; i < NUM_HANDLERS; i++){
+            memset(&registrations[i], 0, sizeof(btstack_packet_callback_registration_t));
+            registrations[i].callback = handlers[i];
+        }
+        mock_controller_init(1);
+        mock_controller_power_on();
+        reset_counters();
+    }
+    void teardown(void){
+        mock_controller_close();
+    }
+};
+
+TEST(EventDispatch, FilteredHandlerOnlyGetsListedEvents){
+    hci_add_event_handler(&registrations[0]);
+    hci_add_event_handler_for_events(&registrations[1], disconnection_events, NULL);
+    send_event(number_of_completed_packets, sizeof(number_of_completed_packets));
+    send_event(disconnection_complete, sizeof(disconnection_complete));
+    CHECK_EQUAL(2, num_events[0]);
+    CHECK_EQUAL(1, num_events[1]);
+    CHECK_EQUAL(1, call_handler[1]);
+    CHECK_EQUAL(HCI_EVENT_DISCONNECTION_COMPLETE, call_event[1]);
+}
+
+TEST(EventDispatch, LeMetaSubeventFilter){
+    hci_add_event_handler_for_events(&registrations[0], le_meta_events, NULL);
+    hci_add_event_handler_for_events(&registrations[1], NULL, le_connection_update_subevents);
+    hci_add_event_handler_for_events(&registrations[2], disconnection_events, le_connection_update_subevents);
+    send_event(le_advertising_report, sizeof(le_advertising_report));
+    send_event(le_connection_update_complete, sizeof(le_connection_update_complete));
+    send_event(le_unknown_subevent, sizeof(le_unknown_subevent));
+    CHECK_EQUAL(3, num_events[0]);
+    CHECK_EQUAL(1, num_events[1]);
+    CHECK_EQUAL(1, num_events[2]);
+    send_event(disconnection_complete, sizeof(disconnection_complete));
+    CHECK_EQUAL(1, num_events[1]);
+    CHECK_EQUAL(2, num_events[2]);
+}
+
+TEST(EventDispatch, FilteredHandlersFirstInRegistrationOrder){
+    hci_add_event_handler(&registrations[0]);
+    hci_add_event_handler_for_events(&registrations[2], acl_events, NULL);
+    hci_add_event_handler_for_events(&registrations[1], acl_events, NULL);
+    send_event(number_of_completed_packets, sizeof(number_of_completed_packets));
+    CHECK_EQUAL(3, num_calls);
+    CHECK_EQUAL(2, call_handler[0]);
+    CHECK_EQUAL(1, call_handler[1]);
+    CHECK_EQUAL(0, call_handler[2]);
+}
+
+TEST(EventDispatch, RegisteringTwiceIsIgnored){
+    hci_add_event_handler_for_events(&registrations[0], acl_events, NULL);
+    hci_add_event_handler_for_events(&registrations[0], acl_events, NULL);
+    send_event(number_of_completed_packets, sizeof(number_of_completed_packets));
+    CHECK_EQUAL(1, num_events[0]);
+}
+
+TEST(EventDispatch, HandlerGetsAllEventsIfTableIsFull){
+    int i;
+    for (i = 0; i < NUM_HANDLERS; i++){
+        hci_add_event_handler_for_events(&registrations[i], disconnection_events, NULL);
+    }
+    send_event(number_of_completed_packets, sizeof(number_of_completed_packets));
+    for (i = 0; i < HCI_MAX_FILTERED_EVENT_HANDLERS; i++){
+        CHECK_EQUAL(0, num_events[i]);
+    }
+    for ( ; i < NUM_HANDLERS; i++){
+        CHECK_EQUAL(1, num_events[i]);
+    }
+}
+
+// l2cap is interested in Number Of Completed Packets, the others only in connection events as sm, att_server,
+// gatt_client and the GATT services. Each Advertising Report also results in a GAP Advertising Report event
+TEST(EventDispatch, CallbacksForAdvertisingReportsAndCompletedPackets){
+    const int num_stack_handlers = 6;
+    int calls[2];
+    int filtered;
+    for (filtered = 0; filtered < 2; filtered++){
+        int i;
+        if (filtered){
+            mock_controller_close();
+            setup();
+        }
+        for (i = 0; i < num_stack_handlers; i++){
+            if (!filtered){
+                hci_add_event_handler(&registrations[i]);
+            } else {
+                hci_add_event_handler_for_events(&registrations[i], i ? disconnection_events : acl_events, NULL);
+            }
+        }
+        gap_start_scan();
+        while (mock_controller_round() > 0);
+        reset_counters();
+        for (i = 0; i < 100; i++){
+            send_event(le_advertising_report, sizeof(le_advertising_report));
+            send_event(number_of_completed_packets, sizeof(number_of_completed_packets));
+        }
+        calls[filtered] = 0;
+        for (i = 0; i < num_stack_handlers; i++){
+            calls[filtered] += num_events[i];
+        }
+    }
+    CHECK_EQUAL(num_stack_handlers * 300, calls[0]);
+    CHECK_EQUAL(100, calls[1]);
+    printf("100 Advertising Reports and 100 Number Of Completed Packets events with %u handlers: %u callbacks, %u with event filter\n",
+        num_stack_handlers, calls[0], calls[1]);
+}
+
+int main (int argc, const char * argv[]){
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
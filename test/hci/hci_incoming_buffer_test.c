@@ -0,0 +1,293 @@
+/*
+ * hci_incoming_buffer_test.c
+ *
+ * Receives ACL packets through a mock HCI Transport that works like the H4 and libusb transports:
+ * it receives into an incoming buffer and calls hci_incoming_buffer_recycle() after the packet
+ * handler returned. Checks that fragmented L2CAP PDUs are reassembled in the buffer of the first
+ * fragment, that retained buffers are not reused before they are released, and that HCI falls back
+ * to the recombination buffer of the connection when no incoming buffer is available and returns to the
+ * incoming buffers once one is free again.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_dump.h"
+#include "hci_transport.h"
+
+#define CON_HANDLE 0x0040
+#define L2CAP_CID  0x0004
+
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+
+static uint8_t  static_buffer[HCI_INCOMING_BUFFER_SIZE];
+static uint8_t * received_packet;
+static uint16_t received_size;
+static uint8_t  received_data[HCI_ACL_PAYLOAD_SIZE];
+static int      received_count;
+static int      retain_received_packet;
+
+static void mock_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static int mock_can_send_packet_now(uint8_t packet_type){
+    UNUSED(packet_type);
+    return 0;
+}
+
+static int mock_open(void){
+    return 0;
+}
+
+static int mock_close(void){
+    return 0;
+}
+
+static const hci_transport_t mock_transport = {
+  /*  .transport.name                          = */  "MOCK",
+  /*  .transport.init                          = */  NULL,
+  /*  .transport.open                          = */  &mock_open,
+  /*  .transport.close                         = */  &mock_close,
+  /*  .transport.register_packet_handler       = */  &mock_register_packet_handler,
+  /*  .transport.can_send_packet_now           = */  &mock_can_send_packet_now,
+  /*  .transport.send_packet                   = */  NULL,
+  /*  .transport.set_baudrate                  = */  NULL,
+};
+
+static void acl_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    UNUSED(channel);
+    if (packet_type != HCI_ACL_DATA_PACKET) return;
+    received_count++;
+    received_packet = packet;
+    received_size = size;
+    memcpy(received_data, &packet[8], size - 8);
+    if (retain_received_packet){
+        CHECK_EQUAL(1, hci_incoming_buffer_retain(packet));
+    }
+}
+
+static void send_event(const uint8_t * event, uint16_t size){
+    uint8_t buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 260];
+    memcpy(&buffer[HCI_INCOMING_PRE_BUFFER_SIZE], event, size);
+    transport_packet_handler(HCI_EVENT_PACKET, &buffer[HCI_INCOMING_PRE_BUFFER_SIZE], size);
+}
+
+static void send_le_connection_complete(void){
+    const uint8_t event[] = {
+        HCI_EVENT_LE_META, 19, HCI_SUBEVENT_LE_CONNECTION_COMPLETE, 0x00, CON_HANDLE & 0xff, CON_HANDLE >> 8,
+        HCI_ROLE_SLAVE, 0x00, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x28, 0x00, 0x00, 0x00, 0x48, 0x00, 0x01 };
+    send_event(event, sizeof(event));
+}
+
+static void send_disconnection_complete(void){
+    const uint8_t event[] = { HCI_EVENT_DISCONNECTION_COMPLETE, 4, 0x00, CON_HANDLE & 0xff, CON_HANDLE >> 8, 0x13 };
+    send_event(event, sizeof(event));
+}
+
+// receive ACL packet into buffer and continue with the buffer returned by hci_incoming_buffer_recycle
+static uint8_t * receive_acl(uint8_t * buffer, uint16_t flags, const uint8_t * data, uint16_t len){
+    uint8_t * packet = &buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+    little_endian_store_16(packet, 0, CON_HANDLE | (flags << 12));
+    little_endian_store_16(packet, 2, len);
+    memcpy(&packet[4], data, len);
+    transport_packet_handler(HCI_ACL_DATA_PACKET, packet, len + 4);
+    return hci_incoming_buffer_recycle(buffer);
+}
+
+// L2CAP PDU with len bytes payload
+static void create_pdu(uint8_t * pdu, uint16_t len){
+    int i;
+    little_endian_store_16(pdu, 0, len);
+    little_endian_store_16(pdu, 2, L2CAP_CID);
+    for (i = 0; i < len; i++){
+        pdu[4 + i] = (uint8_t) (i * 7 + 3);
+    }
+}
+
+// receive PDU in fragments of fragment_len bytes
+static uint8_t * receive_pdu(uint8_t * buffer, const uint8_t * pdu, uint16_t pdu_len, uint16_t fragment_len){
+    uint16_t pos = 0;
+    while (pos < pdu_len){
+        uint16_t len = btstack_min(fragment_len, pdu_len - pos);
+        buffer = receive_acl(buffer, pos ? 0x01 : 0x02, &pdu[pos], len);
+        CHECK(buffer != NULL);
+        pos += len;
+    }
+    return buffer;
+}
+
+static int num_free_buffers(void){
+    uint8_t * buffers[HCI_INCOMING_BUFFER_COUNT];
+    int count = 0;
+    while (count < HCI_INCOMING_BUFFER_COUNT){
+        buffers[count] = hci_incoming_buffer_get();
+        if (!buffers[count]) break;
+        count++;
+    }
+    int i;
+    for (i = 0; i < count; i++){
+        hci_incoming_buffer_release(buffers[i]);
+    }
+    return count;
+}
+
+TEST_GROUP(IncomingBuffer){
+    void setup(void){
+        btstack_memory_init();
+        hci_init(&mock_transport, NULL);
+        hci_register_acl_packet_handler(&acl_packet_handler);
+        send_le_connection_complete();
+        received_packet = NULL;
+        received_size = 0;
+        received_count = 0;
+        retain_received_packet = 0;
+    }
+    void teardown(void){
+        hci_close();
+    }
+};
+
+TEST(IncomingBuffer, GetAndRecycle){
+    uint8_t * buffers[HCI_INCOMING_BUFFER_COUNT];
+    int i;
+    for (i = 0; i < HCI_INCOMING_BUFFER_COUNT; i++){
+        buffers[i] = hci_incoming_buffer_get();
+        CHECK(buffers[i] != NULL);
+    }
+    POINTERS_EQUAL(NULL, hci_incoming_buffer_get());
+    for (i = 0; i < HCI_INCOMING_BUFFER_COUNT; i++){
+        POINTERS_EQUAL(buffers[i], hci_incoming_buffer_recycle(buffers[i]));
+        hci_incoming_buffer_release(buffers[i]);
+    }
+    CHECK_EQUAL(HCI_INCOMING_BUFFER_COUNT, num_free_buffers());
+    // other buffers are not managed
+    CHECK_EQUAL(0, hci_incoming_buffer_retain(static_buffer));
+}
+
+TEST(IncomingBuffer, BackToPoolAfterFallback){
+    uint8_t * buffers[HCI_INCOMING_BUFFER_COUNT];
+    int i;
+    for (i = 0; i < HCI_INCOMING_BUFFER_COUNT; i++){
+        buffers[i] = hci_incoming_buffer_get();
+    }
+    // transport stays with its own buffer while none is free
+    POINTERS_EQUAL(NULL, hci_incoming_buffer_recycle(static_buffer));
+    hci_incoming_buffer_release(buffers[0]);
+    // and continues with a free one
+    POINTERS_EQUAL(buffers[0], hci_incoming_buffer_recycle(static_buffer));
+    for (i = 0; i < HCI_INCOMING_BUFFER_COUNT; i++){
+        hci_incoming_buffer_release(buffers[i]);
+    }
+    CHECK_EQUAL(HCI_INCOMING_BUFFER_COUNT, num_free_buffers());
+}
+
+TEST(IncomingBuffer, CompletePduWithoutCopy){
+    uint8_t pdu[4 + 100];
+    create_pdu(pdu, 100);
+    uint8_t * buffer = hci_incoming_buffer_get();
+    uint8_t * next = receive_pdu(buffer, pdu, sizeof(pdu), sizeof(pdu));
+    CHECK_EQUAL(1, received_count);
+    POINTERS_EQUAL(&buffer[HCI_INCOMING_PRE_BUFFER_SIZE], received_packet);
+    POINTERS_EQUAL(buffer, next);
+    hci_incoming_buffer_release(next);
+    CHECK_EQUAL(HCI_INCOMING_BUFFER_COUNT, num_free_buffers());
+}
+
+TEST(IncomingBuffer, FragmentedPduInFirstBuffer){
+    uint8_t pdu[4 + 1000];
+    create_pdu(pdu, 1000);
+    uint8_t * buffer = hci_incoming_buffer_get();
+    uint8_t * next = receive_pdu(buffer, pdu, sizeof(pdu), 251);
+    CHECK_EQUAL(1, received_count);
+    // reassembled in buffer of first fragment, transport continued with another one
+    POINTERS_EQUAL(&buffer[HCI_INCOMING_PRE_BUFFER_SIZE], received_packet);
+    CHECK(next != buffer);
+    CHECK_EQUAL(sizeof(pdu) + 4, received_size);
+    MEMCMP_EQUAL(&pdu[4], received_data, 1000);
+    // first buffer released after PDU was delivered
+    hci_incoming_buffer_release(next);
+    CHECK_EQUAL(HCI_INCOMING_BUFFER_COUNT, num_free_buffers());
+}
+
+TEST(IncomingBuffer, FragmentedPduFromStaticBuffer){
+    uint8_t pdu[4 + 1000];
+    create_pdu(pdu, 1000);
+    uint8_t * next = receive_pdu(static_buffer, pdu, sizeof(pdu), 251);
+    CHECK_EQUAL(1, received_count);
+    CHECK(received_packet != &static_buffer[HCI_INCOMING_PRE_BUFFER_SIZE]);
+    MEMCMP_EQUAL(&pdu[4], received_data, 1000);
+    // transport continued with a buffer from the pool after the first fragment
+    CHECK(next != static_buffer);
+    hci_incoming_buffer_release(next);
+    CHECK_EQUAL(HCI_INCOMING_BUFFER_COUNT, num_free_buffers());
+}
+
+TEST(IncomingBuffer, FragmentedPduWithoutFreeBuffer){
+    uint8_t * buffers[HCI_INCOMING_BUFFER_COUNT];
+    int i;
+    for (i = 0; i < HCI_INCOMING_BUFFER_COUNT; i++){
+        buffers[i] = hci_incoming_buffer_get();
+    }
+    uint8_t pdu[4 + 600];
+    create_pdu(pdu, 600);
+    uint8_t * next = receive_pdu(buffers[0], pdu, sizeof(pdu), 251);
+    // no buffer left for the transport, first fragment is copied
+    CHECK_EQUAL(1, received_count);
+    CHECK(received_packet != &buffers[0][HCI_INCOMING_PRE_BUFFER_SIZE]);
+    POINTERS_EQUAL(buffers[0], next);
+    MEMCMP_EQUAL(&pdu[4], received_data, 600);
+    for (i = 0; i < HCI_INCOMING_BUFFER_COUNT; i++){
+        hci_incoming_buffer_release(buffers[i]);
+    }
+    CHECK_EQUAL(HCI_INCOMING_BUFFER_COUNT, num_free_buffers());
+}
+
+TEST(IncomingBuffer, RetainedByApplication){
+    uint8_t pdu[4 + 100];
+    create_pdu(pdu, 100);
+    uint8_t * buffer = hci_incoming_buffer_get();
+    retain_received_packet = 1;
+    uint8_t * next = receive_pdu(buffer, pdu, sizeof(pdu), sizeof(pdu));
+    retain_received_packet = 0;
+    CHECK(next != buffer);
+    CHECK_EQUAL(HCI_INCOMING_BUFFER_COUNT - 2, num_free_buffers());
+    // packet stays valid while the transport keeps receiving
+    uint8_t * retained = received_packet;
+    uint8_t other[4 + 50];
+    create_pdu(other, 50);
+    next = receive_pdu(next, other, sizeof(other), sizeof(other));
+    MEMCMP_EQUAL(&pdu[4], &retained[8], 100);
+    hci_incoming_buffer_release(retained);
+    hci_incoming_buffer_release(next);
+    CHECK_EQUAL(HCI_INCOMING_BUFFER_COUNT, num_free_buffers());
+}
+
+TEST(IncomingBuffer, ReleasedOnDisconnect){
+    uint8_t pdu[4 + 1000];
+    create_pdu(pdu, 1000);
+    uint8_t * buffer = hci_incoming_buffer_get();
+    uint8_t * next = receive_acl(buffer, 0x02, pdu, 251);
+    CHECK(next != buffer);
+    CHECK_EQUAL(HCI_INCOMING_BUFFER_COUNT - 2, num_free_buffers());
+    send_disconnection_complete();
+    hci_incoming_buffer_release(next);
+    CHECK_EQUAL(0, received_count);
+    CHECK_EQUAL(HCI_INCOMING_BUFFER_COUNT, num_free_buffers());
+}
+
+int main (int argc, const char * argv[]){
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,125 @@
+/*
+ * hci_lookup_benchmark.c
+ *
+ * Measures the time to look up a HCI connection by connection handle, an L2CAP channel by local cid
+ * and an RFCOMM channel by rfcomm cid with 1, 16 and 64 connections. Each connection has an L2CAP
+ * channel and an RFCOMM channel with its own L2CAP channel for the multiplexer.
+ *
+ * Built once with the hash indices (hci_lookup_benchmark) and once with index size 1, where all lookups
+ * fall back to a linear search of the linked lists (hci_lookup_benchmark_linear).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bluetooth_sdp.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_util.h"
+#include "classic/rfcomm.h"
+#include "hci.h"
+#include "hci_dump.h"
+#include "l2cap.h"
+#include "mock_controller.h"
+
+#define MAX_CONNECTIONS 64
+#define NUM_LOOKUPS     1000000
+
+static const int num_connections[] = { 1, 16, 64 };
+
+static hci_con_handle_t con_handles[MAX_CONNECTIONS];
+static uint16_t         l2cap_cids[MAX_CONNECTIONS];
+static uint16_t         rfcomm_cids[MAX_CONNECTIONS];
+static int              num_misses;
+
+static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+}
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void send_le_connection_complete(hci_con_handle_t con_handle, bd_addr_t addr){
+    uint8_t event[21];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = sizeof(event) - 2;
+    event[2] = HCI_SUBEVENT_LE_CONNECTION_COMPLETE;
+    little_endian_store_16(event, 4, con_handle);
+    event[6] = HCI_ROLE_MASTER;
+    reverse_bd_addr(addr, &event[8]);
+    mock_controller_send_event(event, sizeof(event));
+}
+
+static void setup_connections(int num){
+    int i;
+    mock_controller_init(1);
+    l2cap_init();
+    rfcomm_init();
+    mock_controller_power_on();
+    for (i = 0; i < num; i++){
+        bd_addr_t addr = { 0x11, 0x22, 0x33, 0x44, 0x00, 0x00 };
+        big_endian_store_16(addr, 4, i);
+        con_handles[i] = 0x0040 + i;
+        send_le_connection_complete(con_handles[i], addr);
+        addr[0] = 0x22;
+        l2cap_create_channel(&packet_handler, addr, PSM_SDP, 100, &l2cap_cids[i]);
+        addr[0] = 0x33;
+        rfcomm_create_channel(&packet_handler, addr, 1, &rfcomm_cids[i]);
+    }
+}
+
+// lookups in pseudo random order
+static double benchmark_lookups(int num, int type){
+    int i;
+    uint32_t lfsr = 0x1234;
+    double start = now();
+    for (i = 0; i < NUM_LOOKUPS; i++){
+        lfsr = lfsr * 1103515245 + 12345;
+        int index = (lfsr >> 16) % num;
+        int found;
+        switch (type){
+            case 0:
+                found = hci_connection_for_handle(con_handles[index]) != NULL;
+                break;
+            case 1:
+                found = l2cap_get_remote_mtu_for_local_cid(l2cap_cids[index]) != 0;
+                break;
+            default:
+                found = rfcomm_get_max_frame_size(rfcomm_cids[index]) != 0;
+                break;
+        }
+        if (!found) num_misses++;
+    }
+    return (now() - start) * 1000000000.0 / NUM_LOOKUPS;
+}
+
+int main(void){
+    unsigned int i;
+#if HCI_CONNECTION_INDEX_SIZE > 1
+    const char * mode = "index";
+#else
+    const char * mode = "linear";
+#endif
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    for (i = 0; i < sizeof(num_connections) / sizeof(int); i++){
+        int num = num_connections[i];
+        setup_connections(num);
+        double hci_ns    = benchmark_lookups(num, 0);
+        double l2cap_ns  = benchmark_lookups(num, 1);
+        double rfcomm_ns = benchmark_lookups(num, 2);
+        printf("%-6s %2u connections: HCI connection %5.1f ns, L2CAP channel %5.1f ns, RFCOMM channel %5.1f ns per lookup\n",
+            mode, num, hci_ns, l2cap_ns, rfcomm_ns);
+        mock_controller_close();
+    }
+    if (num_misses){
+        printf("%u lookups failed\n", num_misses);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * hci_packet_buffer_test.c
+ *
+ * Sends ACL packets over two LE connections to a mock Controller with an asynchronous HCI Transport that
+ * only reads a packet from its buffer when it gets transmitted. HCI is built with HCI_OUTGOING_PACKET_BUFFER_COUNT
+ * buffers. Checks that buffers are reused in the order HCI_EVENT_TRANSPORT_PACKET_SENT releases them, that large
+ * packets are fragmented independently per connection, that packets in flight are not overwritten, that packets
+ * rejected by the HCI Transport don't leave a buffer in flight, and counts ACL packets sent per transport round.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_cmd.h"
+#include "hci_dump.h"
+#include "mock_controller.h"
+
+#define TX_QUEUE_SIZE   8
+#define LE_ACL_SIZE     251     // LE ACL Data Packet Length reported by mock Controller
+#define LARGE_PDU_SIZE  600
+#define NUM_ROUNDS      10
+
+static hci_con_handle_t handle_a = 0x0040;
+static hci_con_handle_t handle_b = 0x0041;
+
+static void send_le_connection_complete(hci_con_handle_t con_handle){
+    bd_addr_t addr = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x00 };
+    addr[5] = con_handle & 0xff;
+    uint8_t event[21];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = sizeof(event) - 2;
+    event[2] = HCI_SUBEVENT_LE_CONNECTION_COMPLETE;
+    little_endian_store_16(event, 4, con_handle);
+    event[6] = HCI_ROLE_MASTER;
+    reverse_bd_addr(addr, &event[8]);
+    mock_controller_send_event(event, sizeof(event));
+}
+
+// send L2CAP PDU on ATT channel filled with value. @returns outgoing packet buffer used
+static uint8_t * send_acl_packet(hci_con_handle_t con_handle, uint16_t pdu_len, uint8_t value){
+    CHECK(hci_can_send_acl_packet_now(con_handle));
+    CHECK_EQUAL(1, hci_reserve_packet_buffer());
+    uint8_t * buffer = hci_get_outgoing_packet_buffer();
+    little_endian_store_16(buffer, 0, con_handle);
+    little_endian_store_16(buffer, 2, pdu_len + 4);
+    little_endian_store_16(buffer, 4, pdu_len);
+    little_endian_store_16(buffer, 6, L2CAP_CID_ATTRIBUTE_PROTOCOL);
+    memset(&buffer[8], value, pdu_len);
+    CHECK_EQUAL(0, hci_send_acl_packet_buffer(pdu_len + 8));
+    return buffer;
+}
+
+static void check_acl_packet(int index, hci_con_handle_t con_handle, uint8_t pb_flag, uint16_t len, uint8_t value){
+    const uint8_t * packet = mock_controller_acl_packet(index);
+    uint16_t handle_and_flags = little_endian_read_16(packet, 0);
+    CHECK_EQUAL(con_handle, handle_and_flags & 0x0fff);
+    CHECK_EQUAL(pb_flag, (handle_and_flags >> 12) & 0x03);
+    CHECK_EQUAL(len, little_endian_read_16(packet, 2));
+    // skip L2CAP header in first fragment
+    int pos = (pb_flag == 0) ? 8 : 4;
+    for (; pos < len + 4; pos++){
+        CHECK_EQUAL(value, packet[pos]);
+    }
+}
+
+// check that ACL packets starting at index form a large PDU sent in three fragments
+static int check_large_pdu(int index, hci_con_handle_t con_handle, uint8_t value){
+    uint16_t total = LARGE_PDU_SIZE + 4;
+    int num_fragments = 0;
+    int i;
+    for (i = index; total > 0 && i < mock_controller_num_acl_packets(); i++){
+        const uint8_t * packet = mock_controller_acl_packet(i);
+        if ((little_endian_read_16(packet, 0) & 0x0fff) != con_handle) continue;
+        uint16_t len = btstack_min(total, LE_ACL_SIZE);
+        check_acl_packet(i, con_handle, num_fragments ? 1 : 0, len, value);
+        total -= len;
+        num_fragments++;
+    }
+    CHECK_EQUAL(0, total);
+    return num_fragments;
+}
+
+TEST_GROUP(PacketBuffer){
+    void setup(void){
+        mock_controller_init_async(HCI_MAX_COMMANDS_IN_FLIGHT, TX_QUEUE_SIZE);
+        mock_controller_power_on();
+        CHECK_EQUAL(HCI_STATE_WORKING, hci_get_state());
+        send_le_connection_complete(handle_a);
+        send_le_connection_complete(handle_b);
+        mock_controller_round();
+    }
+    void teardown(void){
+        mock_controller_close();
+    }
+};
+
+TEST(PacketBuffer, BuffersReusedInReleaseOrder){
+    int base = mock_controller_num_acl_packets();
+    uint8_t * buffers[HCI_OUTGOING_PACKET_BUFFER_COUNT];
+    int i;
+    for (i = 0; i < HCI_OUTGOING_PACKET_BUFFER_COUNT; i++){
+        buffers[i] = send_acl_packet(handle_a, 20, i);
+        CHECK(i == 0 || buffers[i] != buffers[i-1]);
+    }
+    // all buffers in flight
+    CHECK_FALSE(hci_can_send_acl_packet_now(handle_a));
+    CHECK_FALSE(hci_can_send_command_packet_now());
+
+    // each transmitted packet frees its buffer for the next one
+    for (i = 0; i < HCI_OUTGOING_PACKET_BUFFER_COUNT; i++){
+        CHECK_EQUAL(1, mock_controller_transmit(1));
+        uint8_t * buffer = send_acl_packet(handle_a, 20, 0x80 + i);
+        POINTERS_EQUAL(buffers[i], buffer);
+        CHECK_FALSE(hci_can_send_acl_packet_now(handle_a));
+    }
+    mock_controller_transmit(TX_QUEUE_SIZE);
+    for (i = 0; i < HCI_OUTGOING_PACKET_BUFFER_COUNT; i++){
+        check_acl_packet(base + i, handle_a, 0, 24, i);
+        check_acl_packet(base + HCI_OUTGOING_PACKET_BUFFER_COUNT + i, handle_a, 0, 24, 0x80 + i);
+    }
+}
+
+TEST(PacketBuffer, FragmentationPerConnection){
+    int base = mock_controller_num_acl_packets();
+    send_acl_packet(handle_a, LARGE_PDU_SIZE, 'A');
+    // connection a is still fragmenting, connection b uses its own buffer
+    CHECK_FALSE(hci_can_send_acl_packet_now(handle_a));
+    send_acl_packet(handle_b, LARGE_PDU_SIZE, 'B');
+    CHECK_FALSE(hci_can_send_acl_packet_now(handle_b));
+    // next fragment waits until previous fragment has been transmitted
+    CHECK_EQUAL(2, mock_controller_num_queued_packets());
+
+    int rounds = 0;
+    while (mock_controller_num_queued_packets() && rounds < 10){
+        mock_controller_transmit(1);
+        rounds++;
+    }
+    CHECK_EQUAL(6, rounds);
+    CHECK_EQUAL(3, check_large_pdu(base, handle_a, 'A'));
+    CHECK_EQUAL(3, check_large_pdu(base, handle_b, 'B'));
+    // fragments of both connections are interleaved
+    check_acl_packet(base + 1, handle_b, 0, LE_ACL_SIZE, 'B');
+    CHECK(hci_can_send_acl_packet_now(handle_a));
+    CHECK(hci_can_send_acl_packet_now(handle_b));
+}
+
+TEST(PacketBuffer, PacketSentReleasesBuffersInSendOrder){
+    int base = mock_controller_num_acl_packets();
+    int num_commands = mock_controller_num_commands();
+    uint8_t * buffer_a = send_acl_packet(handle_a, 20, 1);
+    CHECK(hci_can_send_command_packet_now());
+    hci_send_cmd(&hci_read_bd_addr);
+    // ACL packet and command in flight
+    send_acl_packet(handle_b, 20, 2);
+    CHECK_FALSE(hci_can_send_acl_packet_now(handle_a));
+
+    // first PACKET_SENT releases buffer of first packet, new data does not modify packets in flight
+    mock_controller_transmit(1);
+    POINTERS_EQUAL(buffer_a, send_acl_packet(handle_a, 20, 3));
+    mock_controller_transmit(1);
+    CHECK_EQUAL(num_commands + 1, mock_controller_num_commands());
+    CHECK_EQUAL(hci_read_bd_addr.opcode, mock_controller_command_opcode(num_commands));
+    mock_controller_transmit(TX_QUEUE_SIZE);
+    CHECK_EQUAL(base + 3, mock_controller_num_acl_packets());
+    check_acl_packet(base + 0, handle_a, 0, 24, 1);
+    check_acl_packet(base + 1, handle_b, 0, 24, 2);
+    check_acl_packet(base + 2, handle_a, 0, 24, 3);
+}
+
+TEST(PacketBuffer, RejectedPacketReleasesBuffer){
+    int base = mock_controller_num_acl_packets();
+    send_acl_packet(handle_a, 20, 1);
+
+    // packet rejected by HCI Transport
+    CHECK_EQUAL(1, hci_reserve_packet_buffer());
+    uint8_t * buffer = hci_get_outgoing_packet_buffer();
+    little_endian_store_16(buffer, 0, handle_b);
+    little_endian_store_16(buffer, 2, 24);
+    little_endian_store_16(buffer, 4, 20);
+    little_endian_store_16(buffer, 6, L2CAP_CID_ATTRIBUTE_PROTOCOL);
+    mock_controller_reject_next_packet();
+    CHECK(hci_send_acl_packet_buffer(28) != 0);
+
+    // its buffer is available again
+    POINTERS_EQUAL(buffer, send_acl_packet(handle_b, 20, 2));
+    mock_controller_transmit(TX_QUEUE_SIZE);
+    mock_controller_complete_acl_packets();
+    CHECK_EQUAL(base + 2, mock_controller_num_acl_packets());
+
+    // all buffers released after transmitting all packets
+    int i;
+    for (i = 0; i < HCI_OUTGOING_PACKET_BUFFER_COUNT; i++){
+        send_acl_packet(handle_a, 20, 3);
+    }
+    mock_controller_transmit(TX_QUEUE_SIZE);
+    mock_controller_complete_acl_packets();
+    CHECK(hci_can_send_acl_packet_now(handle_a));
+}
+
+TEST(PacketBuffer, RejectedFragmentIsRetried){
+    int base = mock_controller_num_acl_packets();
+    send_acl_packet(handle_a, LARGE_PDU_SIZE, 'A');
+    // second fragment is sent after first one was transmitted and gets rejected
+    mock_controller_reject_next_packet();
+    mock_controller_transmit(1);
+    CHECK_EQUAL(0, mock_controller_num_queued_packets());
+    CHECK_FALSE(hci_can_send_acl_packet_now(handle_a));
+
+    // next event triggers retry
+    mock_controller_complete_acl_packets();
+    while (mock_controller_transmit(1));
+    CHECK_EQUAL(3, check_large_pdu(base, handle_a, 'A'));
+    CHECK(hci_can_send_acl_packet_now(handle_a));
+}
+
+// application sends as many packets as possible, transport transmits all queued packets per round
+TEST(PacketBuffer, AclPacketsPerTransportRound){
+    int base = mock_controller_num_acl_packets();
+    int round;
+    for (round = 0; round < NUM_ROUNDS; round++){
+        while (hci_can_send_acl_packet_now(handle_a)){
+            send_acl_packet(handle_a, 20, round);
+        }
+        mock_controller_transmit(TX_QUEUE_SIZE);
+        mock_controller_complete_acl_packets();
+    }
+    int num_packets = mock_controller_num_acl_packets() - base;
+    CHECK_EQUAL(NUM_ROUNDS * HCI_OUTGOING_PACKET_BUFFER_COUNT, num_packets);
+    printf("%u ACL packets in %u transport rounds with %u outgoing packet buffers\n",
+        num_packets, NUM_ROUNDS, HCI_OUTGOING_PACKET_BUFFER_COUNT);
+}
+
+int main (int argc, const char * argv[]){
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,428 @@
+/*
+ * l2cap_scheduler_test.c
+ *
+ * Opens Classic channels, LE Data Channels and a fixed channel on connections to a mock Controller that
+ * completes all outgoing ACL packets in each round. Checks that channels that always want to send get
+ * a share of the bytes sent according to their weight, also with different packet sizes, that higher
+ * priority classes are served first, that LE Data Channels interleave their PDUs and that a custom
+ * scheduler can be used. Per channel statistics are used to verify the share of each channel.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "bluetooth_sdp.h"
+#include "btstack_event.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_dump.h"
+#include "l2cap.h"
+#include "ble/sm.h"
+#include "mock_controller.h"
+
+#define NUM_CHANNELS 4
+#define NUM_ROUNDS   100
+#define MAX_GRANTS   100
+#define LE_SDU_SIZE  200
+#define LE_MPS       23
+
+static bd_addr_t        remote_addr = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+static hci_con_handle_t classic_handle = 0x0001;
+static hci_con_handle_t le_handle = 0x0040;
+
+static uint16_t cids[NUM_CHANNELS];
+static int      num_cids;
+static int      sending[NUM_CHANNELS];
+static int      grants[MAX_GRANTS];
+static int      num_grants;
+static uint16_t packet_size[NUM_CHANNELS];
+static uint8_t  data[400];
+static uint8_t  le_sdu[NUM_CHANNELS][LE_SDU_SIZE];
+static uint8_t  le_receive_buffer[NUM_CHANNELS][LE_SDU_SIZE];
+static int      le_sdus_sent[NUM_CHANNELS];
+static int      fixed_channel_packets;
+
+// LE Data Channels query security of incoming connections
+int sm_encryption_key_size(hci_con_handle_t con_handle){
+    return 0;
+}
+int sm_authenticated(hci_con_handle_t con_handle){
+    return 0;
+}
+authorization_state_t sm_authorization_state(hci_con_handle_t con_handle){
+    return AUTHORIZATION_UNKNOWN;
+}
+
+static int channel_index(uint16_t cid){
+    int i;
+    for (i = 0; i < num_cids; i++){
+        if (cids[i] == cid) return i;
+    }
+    return -1;
+}
+
+static void log_grant(int index){
+    if (num_grants == MAX_GRANTS) return;
+    grants[num_grants++] = index;
+}
+
+static void channel_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    if (packet_type != HCI_EVENT_PACKET) return;
+    uint16_t cid;
+    int index;
+    switch (hci_event_packet_get_type(packet)){
+        case L2CAP_EVENT_CAN_SEND_NOW:
+            cid = l2cap_event_can_send_now_get_local_cid(packet);
+            index = channel_index(cid);
+            if (index < 0) break;
+            log_grant(index);
+            l2cap_send(cid, data, packet_size[index]);
+            if (sending[index]){
+                l2cap_request_can_send_now_event(cid);
+            }
+            break;
+        case L2CAP_EVENT_LE_PACKET_SENT:
+            cid = l2cap_event_le_packet_sent_get_local_cid(packet);
+            index = channel_index(cid);
+            if (index < 0) break;
+            le_sdus_sent[index]++;
+            break;
+        default:
+            break;
+    }
+}
+
+static void fixed_channel_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (hci_event_packet_get_type(packet) != L2CAP_EVENT_CAN_SEND_NOW) return;
+    fixed_channel_packets++;
+    l2cap_send_connectionless(le_handle, L2CAP_CID_ATTRIBUTE_PROTOCOL, data, 20);
+}
+
+static void send_classic_connection_complete(void){
+    uint8_t event[13];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_CONNECTION_COMPLETE;
+    event[1] = sizeof(event) - 2;
+    little_endian_store_16(event, 3, classic_handle);
+    reverse_bd_addr(remote_addr, &event[5]);
+    event[11] = 1;  // ACL
+    mock_controller_send_event(event, sizeof(event));
+}
+
+static void send_le_connection_complete(void){
+    uint8_t event[21];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = sizeof(event) - 2;
+    event[2] = HCI_SUBEVENT_LE_CONNECTION_COMPLETE;
+    little_endian_store_16(event, 4, le_handle);
+    event[6] = HCI_ROLE_MASTER;
+    reverse_bd_addr(remote_addr, &event[8]);
+    mock_controller_send_event(event, sizeof(event));
+}
+
+static uint16_t create_channel(uint16_t psm){
+    uint16_t cid;
+    l2cap_create_channel(&channel_packet_handler, remote_addr, psm, 1000, &cid);
+    cids[num_cids++] = cid;
+    return cid;
+}
+
+// first channel creates the ACL connection, the others are created on the established connection
+static void create_channels(const uint16_t * psms, int num){
+    int i;
+    create_channel(psms[0]);
+    while (mock_controller_round() > 0);
+    send_classic_connection_complete();
+    while (mock_controller_round() > 0);
+    for (i = 1; i < num; i++){
+        create_channel(psms[i]);
+    }
+    while (mock_controller_round() > 0);
+}
+
+// open LE Data Channel with the LE Credit Based Connection Request sent by L2CAP
+static uint16_t create_le_channel(void){
+    uint16_t cid;
+    int index = num_cids;
+    l2cap_le_create_channel(&channel_packet_handler, le_handle, 0x0080, le_receive_buffer[index], LE_SDU_SIZE, 1, LEVEL_0, &cid);
+    cids[num_cids++] = cid;
+    const uint8_t * request = mock_controller_last_acl_packet();
+    CHECK_EQUAL(LE_CREDIT_BASED_CONNECTION_REQUEST, request[8]);
+    uint8_t response[22];
+    little_endian_store_16(response, 0, le_handle | 0x2000);  // first automatically flushable packet
+    little_endian_store_16(response, 2, 18);
+    little_endian_store_16(response, 4, 14);
+    little_endian_store_16(response, 6, L2CAP_CID_SIGNALING_LE);
+    response[8] = LE_CREDIT_BASED_CONNECTION_RESPONSE;
+    response[9] = request[9];
+    little_endian_store_16(response, 10, 10);
+    little_endian_store_16(response, 12, 0x0040 + index);   // remote cid
+    little_endian_store_16(response, 14, LE_SDU_SIZE);      // mtu
+    little_endian_store_16(response, 16, LE_MPS);
+    little_endian_store_16(response, 18, 1000);             // credits
+    little_endian_store_16(response, 20, 0);                // result
+    mock_controller_send_acl_packet(response, sizeof(response));
+    return cid;
+}
+
+static void run_rounds(int rounds){
+    int i;
+    for (i = 0; i < rounds; i++){
+        mock_controller_complete_acl_packets();
+    }
+}
+
+static l2cap_channel_statistics_t statistics_for_channel(int index){
+    l2cap_channel_statistics_t statistics;
+    CHECK_EQUAL(0, l2cap_get_channel_statistics(cids[index], &statistics));
+    return statistics;
+}
+
+TEST_GROUP(L2CAPScheduler){
+    void setup(void){
+        num_cids = 0;
+        num_grants = 0;
+        fixed_channel_packets = 0;
+        memset(sending, 0, sizeof(sending));
+        memset(le_sdus_sent, 0, sizeof(le_sdus_sent));
+        int i;
+        for (i = 0; i < NUM_CHANNELS; i++){
+            packet_size[i] = 100;
+        }
+        mock_controller_init(1);
+        l2cap_init();
+        mock_controller_power_on();
+    }
+    void teardown(void){
+        mock_controller_close();
+        l2cap_set_scheduler(l2cap_scheduler_weighted_round_robin_get_instance());
+    }
+};
+
+TEST(L2CAPScheduler, DefaultPriorityClassByPsm){
+    const uint16_t psms[] = { PSM_HID_INTERRUPT, PSM_BNEP, PSM_SDP };
+    create_channels(psms, 3);
+    // SDP uses all ACL buffers, then all channels wait until the Controller has buffers again
+    sending[0] = sending[1] = sending[2] = 1;
+    l2cap_request_can_send_now_event(cids[2]);
+    CHECK_EQUAL(8, num_grants);
+    l2cap_request_can_send_now_event(cids[1]);
+    l2cap_request_can_send_now_event(cids[0]);
+    // HID goes first and keeps its turn
+    num_grants = 0;
+    run_rounds(1);
+    CHECK_EQUAL(8, num_grants);
+    int i;
+    for (i = 0; i < 8; i++){
+        CHECK_EQUAL(0, grants[i]);
+    }
+    // HID sends its last packet, SDP (normal) gets all remaining buffers before BNEP (bulk)
+    sending[0] = 0;
+    num_grants = 0;
+    run_rounds(1);
+    CHECK_EQUAL(8, num_grants);
+    CHECK_EQUAL(0, grants[0]);
+    for (i = 1; i < 8; i++){
+        CHECK_EQUAL(2, grants[i]);
+    }
+    CHECK_EQUAL(0, statistics_for_channel(1).transmit_opportunities);
+}
+
+TEST(L2CAPScheduler, WeightedRoundRobin){
+    const uint16_t psms[] = { PSM_SDP, PSM_SDP, PSM_SDP };
+    int i;
+    create_channels(psms, 3);
+    for (i = 0; i < 3; i++){
+        sending[i] = 1;
+    }
+    CHECK_EQUAL(0, l2cap_set_channel_priority(cids[1], L2CAP_PRIORITY_CLASS_NORMAL, 2));
+    CHECK_EQUAL(L2CAP_LOCAL_CID_DOES_NOT_EXIST, l2cap_set_channel_priority(0x7777, L2CAP_PRIORITY_CLASS_NORMAL, 2));
+    for (i = 0; i < 3; i++){
+        l2cap_request_can_send_now_event(cids[i]);
+    }
+    run_rounds(NUM_ROUNDS);
+    l2cap_channel_statistics_t statistics[3];
+    uint32_t total = 0;
+    for (i = 0; i < 3; i++){
+        statistics[i] = statistics_for_channel(i);
+        CHECK_EQUAL(statistics[i].transmit_opportunities, statistics[i].packets_sent);
+        CHECK_EQUAL(statistics[i].packets_sent * packet_size[i], statistics[i].bytes_sent);
+        total += statistics[i].packets_sent;
+    }
+    CHECK_EQUAL((NUM_ROUNDS + 1) * 8, total);
+    // first channel fills all buffers before the others requested, then 1 : 2 : 1 per round
+    CHECK(abs((int) statistics[1].packets_sent - 2 * (int) statistics[2].packets_sent) <= 2);
+    CHECK(abs((int) statistics[0].packets_sent - (int) statistics[2].packets_sent) <= 8);
+    printf("Weights 1:2:1 over %u rounds with 8 ACL buffers: %u, %u, %u packets\n", NUM_ROUNDS,
+        statistics[0].packets_sent, statistics[1].packets_sent, statistics[2].packets_sent);
+}
+
+TEST(L2CAPScheduler, ByteSharesWithMixedPacketSizes){
+    const uint16_t psms[] = { PSM_SDP, PSM_SDP, PSM_SDP };
+    int i;
+    create_channels(psms, 3);
+    packet_size[0] = 400;
+    packet_size[1] = 40;
+    packet_size[2] = 40;
+    CHECK_EQUAL(0, l2cap_set_channel_priority(cids[2], L2CAP_PRIORITY_CLASS_NORMAL, 2));
+    for (i = 0; i < 3; i++){
+        sending[i] = 1;
+        l2cap_request_can_send_now_event(cids[i]);
+    }
+    l2cap_channel_statistics_t start[3];
+    for (i = 0; i < 3; i++){
+        start[i] = statistics_for_channel(i);
+    }
+    run_rounds(NUM_ROUNDS);
+    // weights 1 : 1 : 2 apply to bytes, not to packets
+    uint32_t bytes[3];
+    for (i = 0; i < 3; i++){
+        bytes[i] = statistics_for_channel(i).bytes_sent - start[i].bytes_sent;
+    }
+    CHECK(abs((int) bytes[0] - (int) bytes[1]) <= 400);
+    CHECK(abs(2 * (int) bytes[0] - (int) bytes[2]) <= 800);
+    printf("Weights 1:1:2 with 400, 40, 40 byte packets over %u rounds: %u, %u, %u bytes\n", NUM_ROUNDS,
+        bytes[0], bytes[1], bytes[2]);
+}
+
+TEST(L2CAPScheduler, ChannelEarlyInListDoesNotStarveOthers){
+    const uint16_t psms[] = { PSM_SDP, PSM_SDP };
+    int i;
+    create_channels(psms, 2);
+    sending[0] = sending[1] = 1;
+    l2cap_request_can_send_now_event(cids[0]);
+    l2cap_request_can_send_now_event(cids[1]);
+    num_grants = 0;
+    run_rounds(2);
+    // channels alternate
+    CHECK_EQUAL(16, num_grants);
+    for (i = 1; i < 16; i++){
+        CHECK(grants[i] != grants[i-1]);
+    }
+}
+
+TEST(L2CAPScheduler, HighPriorityServedFirst){
+    const uint16_t psms[] = { PSM_SDP, PSM_SDP };
+    create_channels(psms, 2);
+    l2cap_set_channel_priority(cids[0], L2CAP_PRIORITY_CLASS_BULK, 1);
+    l2cap_set_channel_priority(cids[1], L2CAP_PRIORITY_CLASS_HIGH, 1);
+    sending[0] = 1;
+    l2cap_request_can_send_now_event(cids[0]);
+    int round;
+    for (round = 0; round < 10; round++){
+        // latency sensitive channel sends a single packet from time to time
+        l2cap_request_can_send_now_event(cids[1]);
+        num_grants = 0;
+        run_rounds(1);
+        CHECK_EQUAL(8, num_grants);
+        CHECK_EQUAL(1, grants[0]);
+    }
+    l2cap_channel_statistics_t statistics = statistics_for_channel(1);
+    CHECK_EQUAL(10, statistics.packets_sent);
+    CHECK(statistics.wait_time_max_ms < 1000);
+}
+
+TEST(L2CAPScheduler, FixedChannel){
+    l2cap_register_fixed_channel(&fixed_channel_packet_handler, L2CAP_CID_ATTRIBUTE_PROTOCOL);
+    send_le_connection_complete();
+    l2cap_request_can_send_fix_channel_now_event(le_handle, L2CAP_CID_ATTRIBUTE_PROTOCOL);
+    l2cap_request_can_send_fix_channel_now_event(le_handle, L2CAP_CID_ATTRIBUTE_PROTOCOL);
+    CHECK_EQUAL(2, fixed_channel_packets);
+    l2cap_channel_statistics_t statistics;
+    l2cap_get_fixed_channel_statistics(L2CAP_CID_ATTRIBUTE_PROTOCOL, &statistics);
+    CHECK_EQUAL(2, statistics.transmit_opportunities);
+    CHECK_EQUAL(2, statistics.packets_sent);
+    CHECK_EQUAL(40, statistics.bytes_sent);
+}
+
+TEST(L2CAPScheduler, LeDataChannelsInterleavePdus){
+    send_le_connection_complete();
+    create_le_channel();
+    create_le_channel();
+    CHECK_EQUAL(0, l2cap_set_channel_priority(cids[1], L2CAP_PRIORITY_CLASS_NORMAL, 3));
+    mock_controller_complete_acl_packets();
+    l2cap_le_send_data(cids[0], le_sdu[0], LE_SDU_SIZE);
+    l2cap_le_send_data(cids[1], le_sdu[1], LE_SDU_SIZE);
+    int rounds = 0;
+    while (le_sdus_sent[0] + le_sdus_sent[1] < 2 && rounds < 100){
+        run_rounds(1);
+        rounds++;
+    }
+    CHECK_EQUAL(1, le_sdus_sent[0]);
+    CHECK_EQUAL(1, le_sdus_sent[1]);
+    // 202 bytes with MPS 23 are 9 PDUs per SDU
+    l2cap_channel_statistics_t statistics[2];
+    statistics[0] = statistics_for_channel(0);
+    statistics[1] = statistics_for_channel(1);
+    CHECK_EQUAL(9, statistics[0].packets_sent);
+    CHECK_EQUAL(9, statistics[1].packets_sent);
+    CHECK_EQUAL(LE_SDU_SIZE + 2, statistics[0].bytes_sent);
+}
+
+// custom scheduler: FIFO of waiting entries, counts calls
+static btstack_linked_list_t fifo;
+static int fifo_next_calls;
+
+static void fifo_init(void){
+    fifo = NULL;
+}
+static void fifo_add(l2cap_scheduler_entry_t * entry){
+    btstack_linked_list_add_tail(&fifo, (btstack_linked_item_t *) entry);
+}
+static void fifo_remove(l2cap_scheduler_entry_t * entry){
+    btstack_linked_list_remove(&fifo, (btstack_linked_item_t *) entry);
+}
+static l2cap_scheduler_entry_t * fifo_next(int (*can_send)(l2cap_scheduler_entry_t * entry)){
+    fifo_next_calls++;
+    l2cap_scheduler_entry_t * entry = (l2cap_scheduler_entry_t *) btstack_linked_list_get_first_item(&fifo);
+    if (!entry || !(*can_send)(entry)) return NULL;
+    btstack_linked_list_remove(&fifo, (btstack_linked_item_t *) entry);
+    return entry;
+}
+static const l2cap_scheduler_t fifo_scheduler = { &fifo_init, &fifo_add, &fifo_remove, &fifo_next };
+
+TEST(L2CAPScheduler, CustomScheduler){
+    mock_controller_close();
+    l2cap_set_scheduler(&fifo_scheduler);
+    setup();
+    fifo_next_calls = 0;
+    const uint16_t psms[] = { PSM_SDP, PSM_SDP };
+    create_channels(psms, 2);
+    l2cap_request_can_send_now_event(cids[0]);
+    l2cap_request_can_send_now_event(cids[1]);
+    CHECK(fifo_next_calls > 0);
+    CHECK_EQUAL(2, num_grants);
+    CHECK_EQUAL(0, grants[0]);
+    CHECK_EQUAL(1, grants[1]);
+}
+
+TEST(L2CAPScheduler, ClosedChannelIsRemovedFromScheduler){
+    const uint16_t psms[] = { PSM_SDP, PSM_SDP };
+    create_channels(psms, 2);
+    sending[0] = 1;
+    l2cap_request_can_send_now_event(cids[0]);
+    l2cap_request_can_send_now_event(cids[1]);
+    // baseband disconnect frees both channels while the second one is waiting
+    uint8_t event[] = { HCI_EVENT_DISCONNECTION_COMPLETE, 4, 0, 0, 0, 0x13 };
+    little_endian_store_16(event, 3, classic_handle);
+    mock_controller_send_event(event, sizeof(event));
+    CHECK_EQUAL(L2CAP_LOCAL_CID_DOES_NOT_EXIST, l2cap_set_channel_priority(cids[1], L2CAP_PRIORITY_CLASS_HIGH, 1));
+    num_grants = 0;
+    run_rounds(1);
+    CHECK_EQUAL(0, num_grants);
+}
+
+int main (int argc, const char * argv[]){
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,290 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "btstack_memory.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_cmd.h"
+#include "hci_transport.h"
+#include "mock_controller.h"
+
+#define MOCK_MAX_COMMANDS 100
+#define MOCK_MAX_ROUNDS   100
+#define MOCK_MAX_HANDLES  8
+#define MOCK_MAX_TX_QUEUE 16
+#define MOCK_MAX_ACL_LOG  32
+
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+
+static uint16_t command_opcodes[MOCK_MAX_COMMANDS];
+static int      num_commands;
+static int      num_answered;
+static int      max_commands_in_flight;
+static uint8_t  controller_num_cmd_packets;
+
+// ACL packets sent by host and not completed yet, per connection handle
+static hci_con_handle_t acl_handles[MOCK_MAX_HANDLES];
+static uint16_t         acl_packets_in_flight[MOCK_MAX_HANDLES];
+static int              num_acl_packets;
+static uint8_t          last_acl_packet[HCI_ACL_PAYLOAD_SIZE + 4];
+static uint8_t          acl_log[MOCK_MAX_ACL_LOG][HCI_ACL_PAYLOAD_SIZE + 4];
+
+// asynchronous mode: packets stay queued and their buffers owned by the transport until transmitted
+static int              async_mode;
+static int              tx_queue_size;
+static uint8_t          tx_queue_type[MOCK_MAX_TX_QUEUE];
+static uint8_t *        tx_queue_packet[MOCK_MAX_TX_QUEUE];
+static int              tx_queue_len[MOCK_MAX_TX_QUEUE];
+static int              tx_queue_count;
+static int              reject_next_packet;
+
+static void mock_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static void mock_receive_acl_packet(uint8_t *packet, int size){
+    hci_con_handle_t con_handle = little_endian_read_16(packet, 0) & 0x0fff;
+    int i;
+    num_acl_packets++;
+    memcpy(last_acl_packet, packet, btstack_min(size, sizeof(last_acl_packet)));
+    if (num_acl_packets <= MOCK_MAX_ACL_LOG){
+        memcpy(acl_log[num_acl_packets - 1], packet, btstack_min(size, sizeof(acl_log[0])));
+    }
+    for (i = 0; i < MOCK_MAX_HANDLES; i++){
+        if (acl_packets_in_flight[i] == 0 || acl_handles[i] == con_handle) break;
+    }
+    if (i == MOCK_MAX_HANDLES) return;
+    acl_handles[i] = con_handle;
+    acl_packets_in_flight[i]++;
+}
+
+static int mock_receive_packet(uint8_t packet_type, uint8_t *packet, int size){
+    if (packet_type == HCI_ACL_DATA_PACKET){
+        mock_receive_acl_packet(packet, size);
+        return 0;
+    }
+    if (packet_type != HCI_COMMAND_DATA_PACKET) return 0;
+    if (num_commands == MOCK_MAX_COMMANDS) return 0;
+    command_opcodes[num_commands++] = little_endian_read_16(packet, 0);
+    max_commands_in_flight = btstack_max(max_commands_in_flight, num_commands - num_answered);
+    return 0;
+}
+
+static int mock_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    if (!async_mode) return mock_receive_packet(packet_type, packet, size);
+    if (reject_next_packet || tx_queue_count == tx_queue_size){
+        reject_next_packet = 0;
+        return -1;
+    }
+    tx_queue_type[tx_queue_count]   = packet_type;
+    tx_queue_packet[tx_queue_count] = packet;
+    tx_queue_len[tx_queue_count]    = size;
+    tx_queue_count++;
+    return 0;
+}
+
+static int mock_can_send_packet_now(uint8_t packet_type){
+    UNUSED(packet_type);
+    return tx_queue_count < tx_queue_size;
+}
+
+static int mock_open(void){
+    return 0;
+}
+
+static int mock_close(void){
+    return 0;
+}
+
+static const hci_transport_t mock_transport = {
+  /*  .transport.name                          = */  "MOCK",
+  /*  .transport.init                          = */  NULL,
+  /*  .transport.open                          = */  &mock_open,
+  /*  .transport.close                         = */  &mock_close,
+  /*  .transport.register_packet_handler       = */  &mock_register_packet_handler,
+  /*  .transport.can_send_packet_now           = */  NULL,
+  /*  .transport.send_packet                   = */  &mock_send_packet,
+  /*  .transport.set_baudrate                  = */  NULL,
+};
+
+static const hci_transport_t mock_transport_async = {
+  /*  .transport.name                          = */  "MOCK-ASYNC",
+  /*  .transport.init                          = */  NULL,
+  /*  .transport.open                          = */  &mock_open,
+  /*  .transport.close                         = */  &mock_close,
+  /*  .transport.register_packet_handler       = */  &mock_register_packet_handler,
+  /*  .transport.can_send_packet_now           = */  &mock_can_send_packet_now,
+  /*  .transport.send_packet                   = */  &mock_send_packet,
+  /*  .transport.set_baudrate                  = */  NULL,
+};
+
+// Command Complete with status 0 and return parameters for the commands used during init
+static void mock_send_command_complete(uint16_t opcode){
+    uint8_t event[HCI_INCOMING_PRE_BUFFER_SIZE + 260];
+    uint8_t * packet = &event[HCI_INCOMING_PRE_BUFFER_SIZE];
+    uint8_t * params = &packet[6];
+    memset(event, 0, sizeof(event));
+    packet[0] = HCI_EVENT_COMMAND_COMPLETE;
+    packet[1] = 252;
+    // the Controller can accept as many commands as it has free slots
+    packet[2] = controller_num_cmd_packets - (num_commands - num_answered);
+    little_endian_store_16(packet, 3, opcode);
+    packet[5] = ERROR_CODE_SUCCESS;
+    if (opcode == hci_read_local_supported_commands.opcode){
+        memset(params, 0xff, 64);
+    }
+    if (opcode == hci_read_local_supported_features.opcode){
+        params[4] = 1 << 6; // LE and BR/EDR
+        params[6] = 1 << 3; // SSP
+    }
+    if (opcode == hci_read_buffer_size.opcode){
+        little_endian_store_16(params, 0, 1021);
+        params[2] = 64;
+        little_endian_store_16(params, 3, 8);
+        little_endian_store_16(params, 5, 8);
+    }
+    if (opcode == hci_le_read_buffer_size.opcode){
+        little_endian_store_16(params, 0, 251);
+        params[2] = 8;
+    }
+    if (opcode == hci_le_read_white_list_size.opcode){
+        params[0] = 8;
+    }
+    transport_packet_handler(HCI_EVENT_PACKET, packet, 2 + packet[1]);
+}
+
+static void mock_controller_setup(uint8_t num_cmd_packets){
+    controller_num_cmd_packets = num_cmd_packets;
+    num_commands = 0;
+    num_answered = 0;
+    max_commands_in_flight = 0;
+    num_acl_packets = 0;
+    memset(acl_packets_in_flight, 0, sizeof(acl_packets_in_flight));
+    tx_queue_count = 0;
+    reject_next_packet = 0;
+    btstack_memory_init();
+}
+
+void mock_controller_init(uint8_t num_cmd_packets){
+    mock_controller_setup(num_cmd_packets);
+    async_mode = 0;
+    hci_init(&mock_transport, NULL);
+}
+
+void mock_controller_init_async(uint8_t num_cmd_packets, int queue_size){
+    mock_controller_setup(num_cmd_packets);
+    async_mode = 1;
+    tx_queue_size = btstack_min(queue_size, MOCK_MAX_TX_QUEUE);
+    hci_init(&mock_transport_async, NULL);
+}
+
+int mock_controller_transmit(int num_packets){
+    int count = 0;
+    while (tx_queue_count > 0 && count < num_packets){
+        // take packet from queue before emitting the event, as HCI might send the next one right away
+        uint8_t   packet_type = tx_queue_type[0];
+        uint8_t * packet      = tx_queue_packet[0];
+        int       size        = tx_queue_len[0];
+        tx_queue_count--;
+        memmove(&tx_queue_type[0],   &tx_queue_type[1],   tx_queue_count * sizeof(tx_queue_type[0]));
+        memmove(&tx_queue_packet[0], &tx_queue_packet[1], tx_queue_count * sizeof(tx_queue_packet[0]));
+        memmove(&tx_queue_len[0],    &tx_queue_len[1],    tx_queue_count * sizeof(tx_queue_len[0]));
+        mock_receive_packet(packet_type, packet, size);
+        count++;
+        uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0 };
+        mock_controller_send_event(event, sizeof(event));
+    }
+    return count;
+}
+
+int mock_controller_num_queued_packets(void){
+    return tx_queue_count;
+}
+
+void mock_controller_reject_next_packet(void){
+    reject_next_packet = 1;
+}
+
+void mock_controller_close(void){
+    hci_close();
+}
+
+int mock_controller_round(void){
+    if (async_mode){
+        mock_controller_transmit(tx_queue_count);
+    }
+    int num_received = num_commands;
+    int count = 0;
+    while (num_answered < num_received){
+        uint16_t opcode = command_opcodes[num_answered++];
+        mock_send_command_complete(opcode);
+        count++;
+    }
+    return count;
+}
+
+int mock_controller_power_on(void){
+    int rounds = 0;
+    hci_power_control(HCI_POWER_ON);
+    while (hci_get_state() != HCI_STATE_WORKING && rounds < MOCK_MAX_ROUNDS){
+        if (mock_controller_round() == 0) break;
+        rounds++;
+    }
+    return rounds;
+}
+
+void mock_controller_send_event(const uint8_t * packet, uint16_t size){
+    uint8_t event[HCI_INCOMING_PRE_BUFFER_SIZE + 260];
+    memcpy(&event[HCI_INCOMING_PRE_BUFFER_SIZE], packet, size);
+    transport_packet_handler(HCI_EVENT_PACKET, &event[HCI_INCOMING_PRE_BUFFER_SIZE], size);
+}
+
+void mock_controller_send_acl_packet(const uint8_t * packet, uint16_t size){
+    uint8_t acl[HCI_INCOMING_PRE_BUFFER_SIZE + HCI_ACL_PAYLOAD_SIZE + 4];
+    memcpy(&acl[HCI_INCOMING_PRE_BUFFER_SIZE], packet, size);
+    transport_packet_handler(HCI_ACL_DATA_PACKET, &acl[HCI_INCOMING_PRE_BUFFER_SIZE], size);
+}
+
+int mock_controller_complete_acl_packets(void){
+    int count = 0;
+    int i;
+    for (i = 0; i < MOCK_MAX_HANDLES; i++){
+        if (acl_packets_in_flight[i] == 0) continue;
+        uint8_t event[7];
+        event[0] = HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS;
+        event[1] = sizeof(event) - 2;
+        event[2] = 1;
+        little_endian_store_16(event, 3, acl_handles[i]);
+        little_endian_store_16(event, 5, acl_packets_in_flight[i]);
+        count += acl_packets_in_flight[i];
+        acl_packets_in_flight[i] = 0;
+        mock_controller_send_event(event, sizeof(event));
+    }
+    return count;
+}
+
+int mock_controller_num_acl_packets(void){
+    return num_acl_packets;
+}
+
+const uint8_t * mock_controller_last_acl_packet(void){
+    return last_acl_packet;
+}
+
+const uint8_t * mock_controller_acl_packet(int index){
+    if (index >= MOCK_MAX_ACL_LOG) return NULL;
+    return acl_log[index];
+}
+
+int mock_controller_num_commands(void){
+    return num_commands;
+}
+
+uint16_t mock_controller_command_opcode(int index){
+    return command_opcodes[index];
+}
+
+int mock_controller_max_commands_in_flight(void){
+    return max_commands_in_flight;
+}
@@ -0,0 +1,45 @@
+#include <stdint.h>
+#include "btstack_defines.h"
+#include "bluetooth.h"
+
+// HCI with a synchronous mock HCI Transport. The mock Controller accepts up to
+// num_cmd_packets commands and answers each with a Command Complete
+void mock_controller_init(uint8_t num_cmd_packets);
+void mock_controller_close(void);
+
+// HCI with an asynchronous mock HCI Transport that queues up to queue_size packets. Packets are
+// only read from their buffer and confirmed with HCI_EVENT_TRANSPORT_PACKET_SENT when transmitted
+void mock_controller_init_async(uint8_t num_cmd_packets, int queue_size);
+
+// transmit oldest queued packets in send order. @returns number of transmitted packets
+int  mock_controller_transmit(int num_packets);
+int  mock_controller_num_queued_packets(void);
+
+// next send_packet call fails without queueing the packet
+void mock_controller_reject_next_packet(void);
+
+// answer all commands received so far. commands sent by the host in response
+// are answered in the next round. @returns number of answered commands
+int  mock_controller_round(void);
+
+// power on and answer commands until HCI_STATE_WORKING. @returns number of rounds
+int  mock_controller_power_on(void);
+
+// send HCI event to the host
+void mock_controller_send_event(const uint8_t * packet, uint16_t size);
+
+// send ACL packet to the host
+void mock_controller_send_acl_packet(const uint8_t * packet, uint16_t size);
+
+// send Number Of Completed Packets for all ACL packets received so far. @returns number of completed packets
+int  mock_controller_complete_acl_packets(void);
+
+// received ACL packets
+int             mock_controller_num_acl_packets(void);
+const uint8_t * mock_controller_last_acl_packet(void);
+const uint8_t * mock_controller_acl_packet(int index);
+
+// received commands
+int      mock_controller_num_commands(void);
+uint16_t mock_controller_command_opcode(int index);
+int      mock_controller_max_commands_in_flight(void);
@@ -0,0 +1,183 @@
+
+// *****************************************************************************
+//
+// test hci_dump async writer: ring wrap-around, dropped packets and file rotation
+//
+// *****************************************************************************
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_dump.h"
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#define TEST_DUMP     "/tmp/hci_dump_test.dump"
+// large enough for all packets of DroppedPacketsAreCounted if the writer keeps up
+#define MAX_FILE_SIZE 500000
+
+typedef struct {
+    int      num_packets;
+    int      num_notes;
+    int      first_seq;
+    int      last_seq;
+    int      corrupt;
+} dump_content_t;
+
+static uint8_t file_data[MAX_FILE_SIZE];
+
+static void send_packet(int seq, uint16_t len){
+    uint8_t packet[300];
+    uint16_t i;
+    little_endian_store_16(packet, 0, seq);
+    for (i=2;i<len;i++){
+        packet[i] = (uint8_t) (seq + i);
+    }
+    hci_dump_packet(HCI_ACL_DATA_PACKET, 1, packet, len);
+}
+
+// parse BlueZ hcidump format, check that packets are intact and in order
+static void parse_dump(const char * filename, dump_content_t * content){
+    memset(content, 0, sizeof(dump_content_t));
+    content->first_seq = -1;
+    content->last_seq  = -1;
+    FILE * file = fopen(filename, "rb");
+    if (!file) return;
+    size_t size = fread(file_data, 1, sizeof(file_data), file);
+    fclose(file);
+    size_t pos = 0;
+    while (pos + 13 <= size){
+        uint16_t len = little_endian_read_16(file_data, pos) - 1;
+        uint8_t  type = file_data[pos + 12];
+        const uint8_t * packet = &file_data[pos + 13];
+        pos += 13 + len;
+        if (pos > size) {
+            content->corrupt = 1;
+            return;
+        }
+        if (type == LOG_MESSAGE_PACKET){
+            content->num_notes++;
+            continue;
+        }
+        int seq = little_endian_read_16(packet, 0);
+        uint16_t i;
+        for (i=2;i<len;i++){
+            if (packet[i] != (uint8_t) (seq + i)) content->corrupt = 1;
+        }
+        if (content->last_seq >= seq) content->corrupt = 1;
+        if (content->first_seq < 0) content->first_seq = seq;
+        content->last_seq = seq;
+        content->num_packets++;
+    }
+    if (pos != size) content->corrupt = 1;
+}
+
+static void remove_dumps(void){
+    char name[64];
+    int i;
+    remove(TEST_DUMP);
+    for (i=1;i<=3;i++){
+        snprintf(name, sizeof(name), "%s.%u", TEST_DUMP, i);
+        remove(name);
+    }
+}
+
+TEST_GROUP(HCIDumpAsync){
+    dump_content_t content;
+    void setup(void){
+        remove_dumps();
+        hci_dump_set_max_packets(-1);
+        hci_dump_set_rotation(0, 0, 0);
+    }
+    void teardown(void){
+        remove_dumps();
+    }
+};
+
+TEST(HCIDumpAsync, WrapAroundWithoutDrops){
+    int i;
+    hci_dump_open(TEST_DUMP, HCI_DUMP_BLUEZ);
+    for (i=0;i<100;i++){
+        send_packet(i, 10 + (i * 37) % 200);
+        usleep(1000);
+    }
+    hci_dump_close();
+    CHECK_EQUAL(0, hci_dump_get_dropped_packets());
+    parse_dump(TEST_DUMP, &content);
+    CHECK_EQUAL(0, content.corrupt);
+    CHECK_EQUAL(100, content.num_packets);
+    CHECK_EQUAL(0, content.num_notes);
+    CHECK_EQUAL(99, content.last_seq);
+}
+
+TEST(HCIDumpAsync, DroppedPacketsAreCounted){
+    int i;
+    hci_dump_open(TEST_DUMP, HCI_DUMP_BLUEZ);
+    for (i=0;i<2000;i++){
+        send_packet(i, 200);
+    }
+    // note about dropped packets gets logged with next packet
+    usleep(20000);
+    send_packet(i, 200);
+    hci_dump_close();
+    uint32_t dropped = hci_dump_get_dropped_packets();
+    parse_dump(TEST_DUMP, &content);
+    CHECK_EQUAL(0, content.corrupt);
+    CHECK(dropped > 0);
+    CHECK(content.num_notes > 0);
+    CHECK_EQUAL(2001, content.num_packets + (int) dropped);
+    CHECK_EQUAL(2000, content.last_seq);
+}
+
+TEST(HCIDumpAsync, RotationBySize){
+    int i;
+    dump_content_t older;
+    dump_content_t oldest;
+    hci_dump_set_rotation(2000, 0, 2);
+    hci_dump_open(TEST_DUMP, HCI_DUMP_BLUEZ);
+    for (i=0;i<100;i++){
+        send_packet(i, 50);
+        usleep(200);
+    }
+    hci_dump_close();
+    CHECK_EQUAL(0, hci_dump_get_dropped_packets());
+    parse_dump(TEST_DUMP, &content);
+    parse_dump(TEST_DUMP ".1", &older);
+    parse_dump(TEST_DUMP ".2", &oldest);
+    CHECK_EQUAL(0, content.corrupt + older.corrupt + oldest.corrupt);
+    // 31 packets of 63 bytes per file
+    CHECK_EQUAL(31, older.num_packets);
+    CHECK_EQUAL(31, oldest.num_packets);
+    CHECK_EQUAL(oldest.last_seq + 1, older.first_seq);
+    CHECK_EQUAL(older.last_seq + 1, content.first_seq);
+    CHECK_EQUAL(99, content.last_seq);
+    CHECK_EQUAL(-1, access(TEST_DUMP ".3", F_OK));
+}
+
+TEST(HCIDumpAsync, MaxPacketsRotates){
+    int i;
+    dump_content_t older;
+    hci_dump_set_max_packets(10);
+    hci_dump_set_rotation(0, 0, 1);
+    hci_dump_open(TEST_DUMP, HCI_DUMP_BLUEZ);
+    for (i=0;i<25;i++){
+        send_packet(i, 20);
+    }
+    hci_dump_close();
+    parse_dump(TEST_DUMP, &content);
+    parse_dump(TEST_DUMP ".1", &older);
+    CHECK_EQUAL(5, content.num_packets);
+    CHECK_EQUAL(20, content.first_seq);
+    CHECK_EQUAL(10, older.num_packets);
+    CHECK_EQUAL(10, older.first_seq);
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,71 @@
+/*
+ * hci_dump_benchmark.c
+ *
+ * Measures the time spent in hci_dump_packet() per packet on the BTstack thread, with packet
+ * logging off and with a PacketLogger file. Built once with synchronous writes (hci_dump_benchmark_sync)
+ * and once with ENABLE_HCI_DUMP_ASYNC (hci_dump_benchmark), which also reports dropped packets.
+ *
+ * Packets are sent in bursts with a pause of 1 ms in between, only the bursts are timed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_dump.h"
+
+#define BENCHMARK_DUMP  "/tmp/hci_dump_benchmark.pklg"
+#define NUM_PACKETS     64000
+#define BURST_SIZE      32
+
+static const uint16_t packet_sizes[] = { 27, 251, 1021 };
+
+static uint8_t packet[1024];
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static double benchmark_packets(uint16_t size){
+    int i;
+    double elapsed_s = 0;
+    double start = now();
+    for (i = 0; i < NUM_PACKETS; i++){
+        little_endian_store_16(packet, 0, i);
+        hci_dump_packet(HCI_ACL_DATA_PACKET, i & 1, packet, size);
+        if ((i % BURST_SIZE) == (BURST_SIZE - 1)){
+            elapsed_s += now() - start;
+            usleep(1000);
+            start = now();
+        }
+    }
+    elapsed_s += now() - start;
+    return elapsed_s * 1000000000.0 / NUM_PACKETS;
+}
+
+int main(void){
+    unsigned int i;
+    memset(packet, 0x55, sizeof(packet));
+#ifdef ENABLE_HCI_DUMP_ASYNC
+    const char * mode = "async";
+#else
+    const char * mode = "sync";
+#endif
+    for (i = 0; i < sizeof(packet_sizes) / sizeof(uint16_t); i++){
+        uint16_t size = packet_sizes[i];
+        double off_ns = benchmark_packets(size);
+        hci_dump_open(BENCHMARK_DUMP, HCI_DUMP_PACKETLOGGER);
+        double on_ns = benchmark_packets(size);
+        hci_dump_close();
+        printf("%-5s %4u byte packets: logging off %6.1f ns, on %8.1f ns per packet, %6u dropped\n",
+            mode, size, off_ns, on_ns, hci_dump_get_dropped_packets());
+    }
+    remove(BENCHMARK_DUMP);
+    return 0;
+}
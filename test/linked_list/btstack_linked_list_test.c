@@ -2,6 +2,8 @@
 #include "CppUTest/CommandLineTestRunner.h"
 #include "btstack_linked_list.h"
 
+#include <string.h>
+
 btstack_linked_list_t testList;
 btstack_linked_item_t itemA;
 btstack_linked_item_t itemB;
@@ -235,6 +237,99 @@ TEST(LinkedList, RemoveSecondAndThirdUsingListRemove){
     CHECK(!btstack_linked_list_iterator_has_next(&it));
 }
 
+#define INDEX_SIZE 8
+
+static btstack_linked_list_index_t index_under_test;
+static btstack_linked_list_index_entry_t index_entries[INDEX_SIZE];
+static btstack_linked_item_t index_items[32];
+
+TEST_GROUP(LinkedListIndex){
+    void setup(void){
+        btstack_linked_list_index_init(&index_under_test, index_entries, INDEX_SIZE);
+    }
+};
+
+TEST(LinkedListIndex, AddGetRemove){
+    CHECK(btstack_linked_list_index_add(&index_under_test, 0x40, &itemA));
+    CHECK(btstack_linked_list_index_add(&index_under_test, 0x41, &itemB));
+    CHECK_EQUAL(&itemA, btstack_linked_list_index_get(&index_under_test, 0x40));
+    CHECK_EQUAL(&itemB, btstack_linked_list_index_get(&index_under_test, 0x41));
+    CHECK(btstack_linked_list_index_get(&index_under_test, 0x42) == NULL);
+    // only removed if key maps to item
+    btstack_linked_list_index_remove(&index_under_test, 0x40, &itemB);
+    CHECK_EQUAL(&itemA, btstack_linked_list_index_get(&index_under_test, 0x40));
+    btstack_linked_list_index_remove(&index_under_test, 0x40, &itemA);
+    CHECK(btstack_linked_list_index_get(&index_under_test, 0x40) == NULL);
+    CHECK_EQUAL(1, index_under_test.count);
+    CHECK(btstack_linked_list_index_complete(&index_under_test));
+}
+
+TEST(LinkedListIndex, CollisionsAndWrapAround){
+    // all keys have home position 7
+    uint16_t keys[] = { 7, 15, 23, 31 };
+    int i;
+    for (i = 0; i < 4; i++){
+        CHECK(btstack_linked_list_index_add(&index_under_test, keys[i], &index_items[i]));
+    }
+    // remove head of probe sequence, others have to stay reachable
+    btstack_linked_list_index_remove(&index_under_test, 7, &index_items[0]);
+    CHECK(btstack_linked_list_index_get(&index_under_test, 7) == NULL);
+    for (i = 1; i < 4; i++){
+        CHECK_EQUAL(&index_items[i], btstack_linked_list_index_get(&index_under_test, keys[i]));
+    }
+    btstack_linked_list_index_remove(&index_under_test, 23, &index_items[2]);
+    CHECK_EQUAL(&index_items[1], btstack_linked_list_index_get(&index_under_test, 15));
+    CHECK_EQUAL(&index_items[3], btstack_linked_list_index_get(&index_under_test, 31));
+}
+
+TEST(LinkedListIndex, FullIndexIsIncomplete){
+    int i;
+    for (i = 0; i < INDEX_SIZE - 1; i++){
+        CHECK(btstack_linked_list_index_add(&index_under_test, 0x40 + i, &index_items[i]));
+    }
+    CHECK(btstack_linked_list_index_complete(&index_under_test));
+    CHECK_EQUAL(0, btstack_linked_list_index_add(&index_under_test, 0x80, &index_items[i]));
+    CHECK_EQUAL(0, btstack_linked_list_index_complete(&index_under_test));
+    // replacing an existing key still works
+    CHECK(btstack_linked_list_index_add(&index_under_test, 0x40, &itemA));
+    CHECK_EQUAL(&itemA, btstack_linked_list_index_get(&index_under_test, 0x40));
+}
+
+TEST(LinkedListIndex, EmptyTable){
+    btstack_linked_list_index_init(&index_under_test, NULL, 0);
+    CHECK(btstack_linked_list_index_get(&index_under_test, 0x40) == NULL);
+    CHECK_EQUAL(0, btstack_linked_list_index_add(&index_under_test, 0x40, &itemA));
+    CHECK_EQUAL(0, btstack_linked_list_index_complete(&index_under_test));
+    btstack_linked_list_index_remove(&index_under_test, 0x40, &itemA);
+}
+
+// compare with a reference table for a pseudo random sequence of adds and removes
+TEST(LinkedListIndex, RandomAddRemove){
+    btstack_linked_item_t * reference[32];
+    memset(reference, 0, sizeof(reference));
+    uint32_t lfsr = 0x1234;
+    int count = 0;
+    int i;
+    for (i = 0; i < 10000; i++){
+        lfsr = lfsr * 1103515245 + 12345;
+        uint16_t key = (lfsr >> 16) % 32;
+        if (reference[key]){
+            btstack_linked_list_index_remove(&index_under_test, key, reference[key]);
+            reference[key] = NULL;
+            count--;
+        } else if (count < INDEX_SIZE - 1){
+            CHECK(btstack_linked_list_index_add(&index_under_test, key, &index_items[key]));
+            reference[key] = &index_items[key];
+            count++;
+        }
+        uint16_t k;
+        for (k = 0; k < 32; k++){
+            CHECK_EQUAL(reference[k], btstack_linked_list_index_get(&index_under_test, k));
+        }
+    }
+    CHECK(btstack_linked_list_index_complete(&index_under_test));
+}
+
 int main (int argc, const char * argv[]){
     return CommandLineTestRunner::RunAllTests(argc, argv);
 }
\ No newline at end of file
@@ -0,0 +1,236 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "btstack_defines.h"
+#include "btstack_debug.h"
+#include "btstack_util.h"
+#include "bluetooth.h"
+#include "mock.h"
+
+#define MOCK_MAX_CHANNELS 8
+
+typedef struct {
+    btstack_packet_handler_t callback;
+    bd_addr_t addr;
+    uint16_t  query_id;
+    uint16_t  uuid;
+} mock_sdp_query_t;
+
+typedef struct {
+    btstack_packet_handler_t handler;
+    bd_addr_t addr;
+    uint8_t   server_channel;
+    uint16_t  cid;
+    int       can_send_now_requested;
+    int       disconnect_requested;
+    uint8_t   sent_packet[1024];
+    uint16_t  sent_len;
+} mock_rfcomm_channel_t;
+
+static mock_sdp_query_t      sdp_queries[MOCK_MAX_CHANNELS];
+static int                   num_sdp_queries;
+static mock_rfcomm_channel_t rfcomm_channels[MOCK_MAX_CHANNELS];
+static int                   num_rfcomm_channels;
+static uint8_t               outgoing_buffer[1024];
+static int                   outgoing_buffer_reserved;
+static void (*rfcomm_send_callback)(int channel);
+
+void mock_reset(void){
+    memset(sdp_queries, 0, sizeof(sdp_queries));
+    num_sdp_queries = 0;
+    memset(rfcomm_channels, 0, sizeof(rfcomm_channels));
+    num_rfcomm_channels = 0;
+    outgoing_buffer_reserved = 0;
+    rfcomm_send_callback = NULL;
+}
+
+// SDP Client
+
+extern "C" uint8_t sdp_client_query_parallel(btstack_packet_handler_t callback, bd_addr_t remote, const uint8_t * des_service_search_pattern, const uint8_t * des_attribute_id_list, uint16_t * out_query_id){
+    if (num_sdp_queries >= MOCK_MAX_CHANNELS) return BTSTACK_MEMORY_ALLOC_FAILED;
+    mock_sdp_query_t * query = &sdp_queries[num_sdp_queries];
+    query->callback = callback;
+    memcpy(query->addr, remote, 6);
+    query->query_id = 0x41 + num_sdp_queries;
+    // pattern: DES { UUID16 }
+    query->uuid = big_endian_read_16(des_service_search_pattern, 3);
+    num_sdp_queries++;
+    if (out_query_id){
+        *out_query_id = query->query_id;
+    }
+    return 0;
+}
+
+extern "C" uint8_t sdp_client_query(btstack_packet_handler_t callback, bd_addr_t remote, const uint8_t * des_service_search_pattern, const uint8_t * des_attribute_id_list){
+    return SDP_QUERY_BUSY;
+}
+
+int mock_sdp_num_queries(void){
+    return num_sdp_queries;
+}
+
+uint16_t mock_sdp_query_uuid(int query){
+    return sdp_queries[query].uuid;
+}
+
+void mock_sdp_query_addr(int query, bd_addr_t addr){
+    memcpy(addr, sdp_queries[query].addr, 6);
+}
+
+void mock_sdp_query_attribute_byte(int query, uint16_t attribute_id, uint16_t attribute_len, uint16_t data_offset, uint8_t data){
+    uint8_t event[11];
+    event[0] = SDP_EVENT_QUERY_ATTRIBUTE_VALUE;
+    event[1] = sizeof(event) - 2;
+    little_endian_store_16(event, 2, 0);
+    little_endian_store_16(event, 4, attribute_id);
+    little_endian_store_16(event, 6, attribute_len);
+    little_endian_store_16(event, 8, data_offset);
+    event[10] = data;
+    (*sdp_queries[query].callback)(HCI_EVENT_PACKET, sdp_queries[query].query_id, event, sizeof(event));
+}
+
+void mock_sdp_query_complete(int query, uint8_t status){
+    uint8_t event[3];
+    event[0] = SDP_EVENT_QUERY_COMPLETE;
+    event[1] = 1;
+    event[2] = status;
+    (*sdp_queries[query].callback)(HCI_EVENT_PACKET, sdp_queries[query].query_id, event, sizeof(event));
+}
+
+// RFCOMM
+
+static mock_rfcomm_channel_t * mock_rfcomm_channel_for_cid(uint16_t cid){
+    int i;
+    for (i=0;i<num_rfcomm_channels;i++){
+        if (rfcomm_channels[i].cid == cid) return &rfcomm_channels[i];
+    }
+    return NULL;
+}
+
+extern "C" uint8_t rfcomm_create_channel(btstack_packet_handler_t packet_handler, bd_addr_t addr, uint8_t server_channel, uint16_t * out_cid){
+    if (num_rfcomm_channels >= MOCK_MAX_CHANNELS) return BTSTACK_MEMORY_ALLOC_FAILED;
+    mock_rfcomm_channel_t * channel = &rfcomm_channels[num_rfcomm_channels];
+    channel->handler = packet_handler;
+    memcpy(channel->addr, addr, 6);
+    channel->server_channel = server_channel;
+    channel->cid = 0x81 + num_rfcomm_channels;
+    num_rfcomm_channels++;
+    if (out_cid){
+        *out_cid = channel->cid;
+    }
+    return 0;
+}
+
+extern "C" void rfcomm_disconnect(uint16_t rfcomm_cid){
+    mock_rfcomm_channel_t * channel = mock_rfcomm_channel_for_cid(rfcomm_cid);
+    if (!channel) return;
+    channel->disconnect_requested = 1;
+}
+
+extern "C" void rfcomm_request_can_send_now_event(uint16_t rfcomm_cid){
+    mock_rfcomm_channel_t * channel = mock_rfcomm_channel_for_cid(rfcomm_cid);
+    if (!channel) return;
+    channel->can_send_now_requested = 1;
+}
+
+extern "C" int rfcomm_reserve_packet_buffer(void){
+    if (outgoing_buffer_reserved) log_error("rfcomm_reserve_packet_buffer: buffer already reserved");
+    outgoing_buffer_reserved = 1;
+    return 0;
+}
+
+extern "C" uint8_t * rfcomm_get_outgoing_buffer(void){
+    return outgoing_buffer;
+}
+
+extern "C" int rfcomm_send_prepared(uint16_t rfcomm_cid, uint16_t len){
+    outgoing_buffer_reserved = 0;
+    mock_rfcomm_channel_t * channel = mock_rfcomm_channel_for_cid(rfcomm_cid);
+    if (!channel) return RFCOMM_CHANNEL_ALREADY_REGISTERED;
+    memcpy(channel->sent_packet, outgoing_buffer, len);
+    channel->sent_len = len;
+    if (rfcomm_send_callback){
+        (*rfcomm_send_callback)(channel - rfcomm_channels);
+    }
+    return 0;
+}
+
+int mock_rfcomm_num_channels(void){
+    return num_rfcomm_channels;
+}
+
+uint16_t mock_rfcomm_cid(int channel){
+    return rfcomm_channels[channel].cid;
+}
+
+uint8_t mock_rfcomm_server_channel(int channel){
+    return rfcomm_channels[channel].server_channel;
+}
+
+void mock_rfcomm_addr(int channel, bd_addr_t addr){
+    memcpy(addr, rfcomm_channels[channel].addr, 6);
+}
+
+void mock_rfcomm_channel_opened(int channel, uint8_t status, uint16_t max_frame_size){
+    mock_rfcomm_channel_t * context = &rfcomm_channels[channel];
+    uint8_t event[17];
+    memset(event, 0, sizeof(event));
+    event[0] = RFCOMM_EVENT_CHANNEL_OPENED;
+    event[1] = sizeof(event) - 2;
+    event[2] = status;
+    reverse_bd_addr(context->addr, &event[3]);
+    little_endian_store_16(event, 9, 0x0040 + channel);
+    event[11] = context->server_channel;
+    little_endian_store_16(event, 12, context->cid);
+    little_endian_store_16(event, 14, max_frame_size);
+    event[16] = 0;
+    (*context->handler)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+}
+
+void mock_rfcomm_channel_closed(int channel){
+    mock_rfcomm_channel_t * context = &rfcomm_channels[channel];
+    uint8_t event[4];
+    event[0] = RFCOMM_EVENT_CHANNEL_CLOSED;
+    event[1] = sizeof(event) - 2;
+    little_endian_store_16(event, 2, context->cid);
+    (*context->handler)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+}
+
+void mock_rfcomm_receive(int channel, const uint8_t * data, uint16_t len){
+    mock_rfcomm_channel_t * context = &rfcomm_channels[channel];
+    uint8_t packet[1024];
+    memcpy(packet, data, len);
+    (*context->handler)(RFCOMM_DATA_PACKET, context->cid, packet, len);
+}
+
+int mock_rfcomm_process_can_send_now(void){
+    int num_events = 0;
+    int i;
+    for (i=0;i<num_rfcomm_channels;i++){
+        mock_rfcomm_channel_t * context = &rfcomm_channels[i];
+        if (!context->can_send_now_requested) continue;
+        context->can_send_now_requested = 0;
+        uint8_t event[4];
+        event[0] = RFCOMM_EVENT_CAN_SEND_NOW;
+        event[1] = sizeof(event) - 2;
+        little_endian_store_16(event, 2, context->cid);
+        (*context->handler)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+        num_events++;
+    }
+    return num_events;
+}
+
+const uint8_t * mock_rfcomm_sent_packet(int channel, uint16_t * len){
+    mock_rfcomm_channel_t * context = &rfcomm_channels[channel];
+    *len = context->sent_len;
+    context->sent_len = 0;
+    return context->sent_packet;
+}
+
+void mock_rfcomm_set_send_callback(void (*callback)(int channel)){
+    rfcomm_send_callback = callback;
+}
+
+int mock_rfcomm_disconnect_requested(int channel){
+    return rfcomm_channels[channel].disconnect_requested;
+}
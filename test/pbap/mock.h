@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include "btstack_defines.h"
+#include "bluetooth.h"
+
+void mock_reset(void);
+
+// SDP Client mock with one query per sdp_client_query_parallel call
+int      mock_sdp_num_queries(void);
+uint16_t mock_sdp_query_uuid(int query);
+void     mock_sdp_query_addr(int query, bd_addr_t addr);
+void     mock_sdp_query_attribute_byte(int query, uint16_t attribute_id, uint16_t attribute_len, uint16_t data_offset, uint8_t data);
+void     mock_sdp_query_complete(int query, uint8_t status);
+
+// RFCOMM mock with one channel per rfcomm_create_channel call
+int      mock_rfcomm_num_channels(void);
+uint16_t mock_rfcomm_cid(int channel);
+uint8_t  mock_rfcomm_server_channel(int channel);
+void     mock_rfcomm_addr(int channel, bd_addr_t addr);
+void     mock_rfcomm_channel_opened(int channel, uint8_t status, uint16_t max_frame_size);
+void     mock_rfcomm_channel_closed(int channel);
+void     mock_rfcomm_receive(int channel, const uint8_t * data, uint16_t len);
+// emits RFCOMM_EVENT_CAN_SEND_NOW for all channels with pending request, returns number of events
+int      mock_rfcomm_process_can_send_now(void);
+const uint8_t * mock_rfcomm_sent_packet(int channel, uint16_t * len);
+// called from rfcomm_send_prepared, e.g. to respond before it returns. NULL to disable
+void     mock_rfcomm_set_send_callback(void (*callback)(int channel));
+int      mock_rfcomm_disconnect_requested(int channel);
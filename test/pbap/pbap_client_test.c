@@ -0,0 +1,497 @@
+
+// *****************************************************************************
+//
+// test pbap client: phonebook pulls from several phones in parallel with
+// interleaved OBEX responses split over several RFCOMM frames
+//
+// *****************************************************************************
+
+#include "btstack_config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bluetooth_sdp.h"
+#include "btstack_event.h"
+#include "btstack_memory.h"
+#include "btstack_util.h"
+#include "mock.h"
+#include "classic/goep_client.h"
+#include "classic/obex.h"
+#include "classic/obex_parser.h"
+#include "classic/pbap_client.h"
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#define NUM_PHONES        3
+#define NUM_CONTACTS      16
+#define RFCOMM_MTU        64
+#define OBEX_PACKET_LEN   300
+#define PHONEBOOK_SIZE    2000
+
+typedef struct {
+    bd_addr_t addr;
+    uint8_t   server_channel;
+    uint32_t  connection_id;
+    char      phonebook[PHONEBOOK_SIZE];
+    uint16_t  phonebook_len;
+    uint16_t  phonebook_pos;
+
+    uint16_t  pbap_cid;
+    int       rfcomm_channel;
+    int       num_connected;
+    uint8_t   connect_status;
+    int       num_operations_completed;
+    uint8_t   operation_status;
+    int       num_closed;
+    int       num_get_responses;
+    int       num_set_path_requests;
+
+    uint8_t   received[PHONEBOOK_SIZE];
+    uint16_t  received_len;
+    int       num_data_packets;
+    // bytes received before the last fragment of an OBEX response
+    int       num_bytes_streamed;
+
+    uint8_t   response[OBEX_PACKET_LEN];
+    uint16_t  response_len;
+    uint16_t  response_pos;
+} phone_t;
+
+static phone_t phones[NUM_PHONES];
+static int     num_unknown_cid_events;
+
+// PDL: { { L2CAP }, { RFCOMM, channel }, { OBEX } }
+static const uint8_t protocol_descriptor_list[] = {
+    0x35, 0x11, 0x35, 0x03, 0x19, 0x01, 0x00, 0x35, 0x05, 0x19, 0x00, 0x03, 0x08, 0x00, 0x35, 0x03, 0x19, 0x00, 0x08
+};
+#define PDL_SERVER_CHANNEL_OFFSET 13
+
+static phone_t * phone_for_pbap_cid(uint16_t pbap_cid){
+    int i;
+    for (i=0;i<NUM_PHONES;i++){
+        if (phones[i].pbap_cid == pbap_cid) return &phones[i];
+    }
+    return NULL;
+}
+
+static void pbap_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    phone_t * phone = phone_for_pbap_cid(channel);
+    if (!phone){
+        num_unknown_cid_events++;
+        return;
+    }
+    switch (packet_type){
+        case HCI_EVENT_PACKET:
+            if (hci_event_packet_get_type(packet) != HCI_EVENT_PBAP_META) break;
+            switch (hci_event_pbap_meta_get_subevent_code(packet)){
+                case PBAP_SUBEVENT_CONNECTION_OPENED:
+                    phone->num_connected++;
+                    phone->connect_status = pbap_subevent_connection_opened_get_status(packet);
+                    break;
+                case PBAP_SUBEVENT_OPERATION_COMPLETED:
+                    phone->num_operations_completed++;
+                    phone->operation_status = pbap_subevent_operation_completed_get_status(packet);
+                    break;
+                case PBAP_SUBEVENT_CONNECTION_CLOSED:
+                    phone->num_closed++;
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case PBAP_DATA_PACKET:
+            CHECK(phone->received_len + size <= PHONEBOOK_SIZE);
+            memcpy(&phone->received[phone->received_len], packet, size);
+            phone->received_len += size;
+            phone->num_data_packets++;
+            break;
+        default:
+            break;
+    }
+}
+
+static void phone_init(phone_t * phone, int index){
+    int i;
+    memset(phone, 0, sizeof(phone_t));
+    phone->addr[0] = 0x11;
+    phone->addr[5] = index + 1;
+    phone->server_channel = 10 + index;
+    phone->connection_id = 0x1000 + index;
+    phone->rfcomm_channel = -1;
+    for (i=0;i<NUM_CONTACTS;i++){
+        phone->phonebook_len += snprintf(&phone->phonebook[phone->phonebook_len], PHONEBOOK_SIZE - phone->phonebook_len,
+            "BEGIN:VCARD\r\nVERSION:2.1\r\nFN:Phone %u Contact %u\r\nTEL;CELL:+49 %u %04u\r\nEND:VCARD\r\n", index, i, index, i);
+    }
+}
+
+static void phone_prepare_response(phone_t * phone, uint8_t response_code, const uint8_t * fields, uint16_t fields_len){
+    phone->response[0] = response_code;
+    memcpy(&phone->response[3], fields, fields_len);
+    phone->response_len = 3 + fields_len;
+    big_endian_store_16(phone->response, 1, phone->response_len);
+    phone->response_pos = 0;
+}
+
+static void phone_handle_request(phone_t * phone, const uint8_t * request, uint16_t request_len){
+    uint8_t  fields[OBEX_PACKET_LEN];
+    uint16_t pos = 0;
+    uint16_t chunk_len;
+    int      final;
+
+    CHECK_EQUAL(request_len, big_endian_read_16(request, 1));
+    switch (request[0]){
+        case OBEX_OPCODE_CONNECT:
+            // target header with PBAP UUID
+            CHECK_EQUAL(OBEX_HEADER_TARGET, request[7]);
+            fields[pos++] = OBEX_VERSION;
+            fields[pos++] = 0;
+            big_endian_store_16(fields, pos, OBEX_PACKET_LEN);
+            pos += 2;
+            fields[pos++] = OBEX_HEADER_CONNECTION_ID;
+            big_endian_store_32(fields, pos, phone->connection_id);
+            pos += 4;
+            phone_prepare_response(phone, OBEX_RESP_SUCCESS, fields, pos);
+            break;
+        case OBEX_OPCODE_GET | OBEX_OPCODE_FINAL_BIT_MASK:
+            // connection id of this phone must be first header
+            CHECK_EQUAL(OBEX_HEADER_CONNECTION_ID, request[3]);
+            CHECK_EQUAL(phone->connection_id, big_endian_read_32(request, 4));
+            chunk_len = btstack_min(phone->phonebook_len - phone->phonebook_pos, OBEX_PACKET_LEN - 6);
+            final = (phone->phonebook_pos + chunk_len) == phone->phonebook_len;
+            fields[pos++] = final ? OBEX_HEADER_END_OF_BODY : OBEX_HEADER_BODY;
+            big_endian_store_16(fields, pos, 3 + chunk_len);
+            pos += 2;
+            memcpy(&fields[pos], &phone->phonebook[phone->phonebook_pos], chunk_len);
+            pos += chunk_len;
+            phone->phonebook_pos += chunk_len;
+            phone_prepare_response(phone, final ? OBEX_RESP_SUCCESS : OBEX_RESP_CONTINUE, fields, pos);
+            phone->num_get_responses++;
+            break;
+        case OBEX_OPCODE_SETPATH:
+            CHECK_EQUAL(OBEX_HEADER_CONNECTION_ID, request[5]);
+            CHECK_EQUAL(phone->connection_id, big_endian_read_32(request, 6));
+            phone->num_set_path_requests++;
+            phone_prepare_response(phone, OBEX_RESP_SUCCESS, NULL, 0);
+            break;
+        default:
+            FAIL("unexpected OBEX request");
+            break;
+    }
+}
+
+// send one RFCOMM frame of pending response
+static int phone_send_fragment(phone_t * phone){
+    if (phone->response_pos >= phone->response_len) return 0;
+    uint16_t fragment_len = btstack_min(RFCOMM_MTU, phone->response_len - phone->response_pos);
+    uint16_t received_len = phone->received_len;
+    mock_rfcomm_receive(phone->rfcomm_channel, &phone->response[phone->response_pos], fragment_len);
+    phone->response_pos += fragment_len;
+    if (phone->response_pos < phone->response_len){
+        phone->num_bytes_streamed += phone->received_len - received_len;
+    }
+    return 1;
+}
+
+// handle requests and deliver responses of all phones interleaved, frame by frame
+static void run_phones(void){
+    int active = 1;
+    while (active){
+        int i;
+        active = mock_rfcomm_process_can_send_now();
+        for (i=0;i<NUM_PHONES;i++){
+            phone_t * phone = &phones[i];
+            if (phone->rfcomm_channel < 0) continue;
+            uint16_t request_len;
+            const uint8_t * request = mock_rfcomm_sent_packet(phone->rfcomm_channel, &request_len);
+            if (request_len){
+                phone_handle_request(phone, request, request_len);
+                active = 1;
+            }
+        }
+        for (i=0;i<NUM_PHONES;i++){
+            if (phones[i].rfcomm_channel < 0) continue;
+            active |= phone_send_fragment(&phones[i]);
+        }
+    }
+}
+
+static int sdp_query_for_phone(phone_t * phone){
+    int i;
+    for (i=0;i<mock_sdp_num_queries();i++){
+        bd_addr_t addr;
+        mock_sdp_query_addr(i, addr);
+        if (bd_addr_cmp(addr, phone->addr) == 0) return i;
+    }
+    return -1;
+}
+
+static int rfcomm_channel_for_phone(phone_t * phone){
+    int i;
+    for (i=0;i<mock_rfcomm_num_channels();i++){
+        bd_addr_t addr;
+        mock_rfcomm_addr(i, addr);
+        if (bd_addr_cmp(addr, phone->addr) == 0) return i;
+    }
+    return -1;
+}
+
+// deliver protocol descriptor list of all phones interleaved byte by byte
+static void run_sdp_queries(void){
+    unsigned int offset;
+    int i;
+    for (offset=0;offset<sizeof(protocol_descriptor_list);offset++){
+        for (i=0;i<NUM_PHONES;i++){
+            int query = sdp_query_for_phone(&phones[i]);
+            CHECK(query >= 0);
+            uint8_t data = protocol_descriptor_list[offset];
+            if (offset == PDL_SERVER_CHANNEL_OFFSET){
+                data = phones[i].server_channel;
+            }
+            mock_sdp_query_attribute_byte(query, BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST, sizeof(protocol_descriptor_list), offset, data);
+        }
+    }
+    for (i=0;i<NUM_PHONES;i++){
+        mock_sdp_query_complete(sdp_query_for_phone(&phones[i]), 0);
+    }
+}
+
+static void connect_phones(void){
+    int i;
+    for (i=0;i<NUM_PHONES;i++){
+        CHECK_EQUAL(0, pbap_connect(&pbap_packet_handler, phones[i].addr, &phones[i].pbap_cid));
+    }
+    CHECK_EQUAL(NUM_PHONES, mock_sdp_num_queries());
+    for (i=0;i<NUM_PHONES;i++){
+        CHECK_EQUAL(BLUETOOTH_SERVICE_CLASS_PHONEBOOK_ACCESS_PSE, mock_sdp_query_uuid(i));
+    }
+    run_sdp_queries();
+
+    // RFCOMM channels open in reverse order
+    CHECK_EQUAL(NUM_PHONES, mock_rfcomm_num_channels());
+    for (i=NUM_PHONES-1;i>=0;i--){
+        phones[i].rfcomm_channel = rfcomm_channel_for_phone(&phones[i]);
+        CHECK(phones[i].rfcomm_channel >= 0);
+        CHECK_EQUAL(phones[i].server_channel, mock_rfcomm_server_channel(phones[i].rfcomm_channel));
+        mock_rfcomm_channel_opened(phones[i].rfcomm_channel, 0, RFCOMM_MTU);
+    }
+    run_phones();
+
+    for (i=0;i<NUM_PHONES;i++){
+        CHECK_EQUAL(1, phones[i].num_connected);
+        CHECK_EQUAL(0, phones[i].connect_status);
+    }
+}
+
+TEST_GROUP(PBAPClient){
+    void setup(void){
+        int i;
+        btstack_memory_init();
+        mock_reset();
+        goep_client_init();
+        pbap_client_init();
+        for (i=0;i<NUM_PHONES;i++){
+            phone_init(&phones[i], i);
+        }
+        num_unknown_cid_events = 0;
+    }
+    void teardown(void){
+        CHECK_EQUAL(0, num_unknown_cid_events);
+    }
+};
+
+TEST(PBAPClient, ParallelPullPhonebook){
+    int i;
+    connect_phones();
+    for (i=0;i<NUM_PHONES;i++){
+        CHECK_EQUAL(0, pbap_pull_phonebook(phones[i].pbap_cid));
+        CHECK_EQUAL(BTSTACK_BUSY, pbap_pull_phonebook(phones[i].pbap_cid));
+    }
+    run_phones();
+    for (i=0;i<NUM_PHONES;i++){
+        phone_t * phone = &phones[i];
+        CHECK_EQUAL(1, phone->num_operations_completed);
+        CHECK_EQUAL(0, phone->operation_status);
+        CHECK_EQUAL(phone->phonebook_len, phone->received_len);
+        CHECK_EQUAL(0, memcmp(phone->phonebook, phone->received, phone->phonebook_len));
+        // several GET responses, each delivered in several chunks
+        CHECK(phone->num_get_responses > 1);
+        CHECK(phone->num_data_packets > phone->num_get_responses);
+        CHECK(phone->num_bytes_streamed > 0);
+    }
+}
+
+TEST(PBAPClient, SetPhonebookPath){
+    int i;
+    connect_phones();
+    for (i=0;i<NUM_PHONES;i++){
+        CHECK_EQUAL(0, pbap_set_phonebook(phones[i].pbap_cid, i ? "telecom/pb" : "telecom"));
+    }
+    run_phones();
+    for (i=0;i<NUM_PHONES;i++){
+        CHECK_EQUAL(1, phones[i].num_operations_completed);
+        CHECK_EQUAL(0, phones[i].operation_status);
+        // root + one request per path element
+        CHECK_EQUAL(i ? 3 : 2, phones[i].num_set_path_requests);
+    }
+}
+
+TEST(PBAPClient, Disconnect){
+    int i;
+    connect_phones();
+    CHECK_EQUAL(0, pbap_disconnect(phones[1].pbap_cid));
+    CHECK_EQUAL(0, mock_rfcomm_disconnect_requested(phones[0].rfcomm_channel));
+    CHECK_EQUAL(1, mock_rfcomm_disconnect_requested(phones[1].rfcomm_channel));
+    mock_rfcomm_channel_closed(phones[1].rfcomm_channel);
+    CHECK_EQUAL(1, phones[1].num_closed);
+    CHECK_EQUAL(ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER, pbap_pull_phonebook(phones[1].pbap_cid));
+    phones[1].rfcomm_channel = -1;
+
+    // others continue
+    for (i=0;i<NUM_PHONES;i+=2){
+        CHECK_EQUAL(0, pbap_pull_phonebook(phones[i].pbap_cid));
+    }
+    run_phones();
+    for (i=0;i<NUM_PHONES;i+=2){
+        CHECK_EQUAL(0, phones[i].num_closed);
+        CHECK_EQUAL(1, phones[i].num_operations_completed);
+        CHECK_EQUAL(phones[i].phonebook_len, phones[i].received_len);
+    }
+}
+
+// phone handles request and delivers complete response before rfcomm_send_prepared returns
+static void phone_respond_synchronously(int channel){
+    int i;
+    for (i=0;i<NUM_PHONES;i++){
+        phone_t * phone = &phones[i];
+        if (phone->rfcomm_channel != channel) continue;
+        uint16_t request_len;
+        const uint8_t * request = mock_rfcomm_sent_packet(channel, &request_len);
+        phone_handle_request(phone, request, request_len);
+        while (phone_send_fragment(phone));
+    }
+}
+
+TEST(PBAPClient, SynchronousResponse){
+    connect_phones();
+    mock_rfcomm_set_send_callback(&phone_respond_synchronously);
+    CHECK_EQUAL(0, pbap_pull_phonebook(phones[0].pbap_cid));
+    while (mock_rfcomm_process_can_send_now());
+    CHECK_EQUAL(1, phones[0].num_operations_completed);
+    CHECK_EQUAL(0, phones[0].operation_status);
+    CHECK_EQUAL(phones[0].phonebook_len, phones[0].received_len);
+    CHECK_EQUAL(0, memcmp(phones[0].phonebook, phones[0].received, phones[0].phonebook_len));
+}
+
+TEST(PBAPClient, ConnectionFailed){
+    int i;
+    for (i=0;i<NUM_PHONES;i++){
+        CHECK_EQUAL(0, pbap_connect(&pbap_packet_handler, phones[i].addr, &phones[i].pbap_cid));
+    }
+    // phone 0: SDP query failed, phone 1: no RFCOMM channel, phone 2: RFCOMM connection failed
+    mock_sdp_query_complete(sdp_query_for_phone(&phones[0]), SDP_QUERY_INCOMPLETE);
+    mock_sdp_query_complete(sdp_query_for_phone(&phones[1]), 0);
+    for (i=0;i<(int)sizeof(protocol_descriptor_list);i++){
+        mock_sdp_query_attribute_byte(sdp_query_for_phone(&phones[2]), BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST,
+            sizeof(protocol_descriptor_list), i, i == PDL_SERVER_CHANNEL_OFFSET ? phones[2].server_channel : protocol_descriptor_list[i]);
+    }
+    mock_sdp_query_complete(sdp_query_for_phone(&phones[2]), 0);
+    CHECK_EQUAL(1, mock_rfcomm_num_channels());
+    mock_rfcomm_channel_opened(0, ERROR_CODE_PAGE_TIMEOUT, 0);
+
+    CHECK_EQUAL(SDP_QUERY_INCOMPLETE, phones[0].connect_status);
+    CHECK_EQUAL(ERROR_CODE_UNSUPPORTED_FEATURE_OR_PARAMETER_VALUE, phones[1].connect_status);
+    CHECK_EQUAL(ERROR_CODE_PAGE_TIMEOUT, phones[2].connect_status);
+    for (i=0;i<NUM_PHONES;i++){
+        CHECK_EQUAL(1, phones[i].num_connected);
+        CHECK_EQUAL(ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER, pbap_disconnect(phones[i].pbap_cid));
+    }
+}
+
+typedef struct {
+    uint8_t  header_id;
+    uint8_t  data[400];
+    uint16_t data_len;
+    int      num_callbacks;
+} parser_result_t;
+
+static void parser_callback(void * user_data, uint8_t header_id, uint16_t total_len, uint16_t data_offset, const uint8_t * data_buffer, uint16_t data_len){
+    parser_result_t * result = (parser_result_t *) user_data;
+    CHECK_EQUAL(result->data_len, data_offset);
+    CHECK(data_offset + data_len <= total_len);
+    result->header_id = header_id;
+    memcpy(&result->data[result->data_len], data_buffer, data_len);
+    result->data_len += data_len;
+    result->num_callbacks++;
+}
+
+TEST_GROUP(OBEXParser){
+    obex_parser_t   parser;
+    parser_result_t result;
+    void setup(void){
+        memset(&result, 0, sizeof(result));
+    }
+};
+
+TEST(OBEXParser, ConnectResponseByteByByte){
+    const uint8_t response[] = { 0xA0, 0x00, 0x0C, 0x10, 0x00, 0x01, 0x00, 0xCB, 0x12, 0x34, 0x56, 0x78 };
+    uint8_t connection_id[4];
+    unsigned int i;
+    obex_parser_init_for_response(&parser, OBEX_OPCODE_CONNECT, &parser_callback, &result);
+    for (i=0;i<sizeof(response)-1;i++){
+        CHECK_EQUAL(OBEX_PARSER_OBJECT_STATE_INCOMPLETE, obex_parser_process_data(&parser, &response[i], 1));
+    }
+    CHECK_EQUAL(OBEX_PARSER_OBJECT_STATE_COMPLETE, obex_parser_process_data(&parser, &response[i], 1));
+    CHECK_EQUAL(OBEX_RESP_SUCCESS, obex_parser_get_response_code(&parser));
+    CHECK_EQUAL(OBEX_HEADER_CONNECTION_ID, result.header_id);
+    CHECK_EQUAL(4, result.num_callbacks);
+    CHECK_EQUAL(1, obex_parser_header_store(connection_id, sizeof(connection_id), 4, 0, result.data, 4));
+    CHECK_EQUAL(0x12345678, big_endian_read_32(connection_id, 0));
+}
+
+TEST(OBEXParser, BodyInFragments){
+    uint8_t response[3 + 3 + 300];
+    uint16_t pos;
+    int i;
+    response[0] = OBEX_RESP_CONTINUE;
+    big_endian_store_16(response, 1, sizeof(response));
+    response[3] = OBEX_HEADER_BODY;
+    big_endian_store_16(response, 4, 3 + 300);
+    for (i=0;i<300;i++){
+        response[6+i] = (uint8_t) i;
+    }
+    obex_parser_init_for_response(&parser, OBEX_OPCODE_GET | OBEX_OPCODE_FINAL_BIT_MASK, &parser_callback, &result);
+    for (pos = 0; (unsigned int) (pos + 50) < sizeof(response); pos += 50){
+        CHECK_EQUAL(OBEX_PARSER_OBJECT_STATE_INCOMPLETE, obex_parser_process_data(&parser, &response[pos], 50));
+    }
+    CHECK_EQUAL(OBEX_PARSER_OBJECT_STATE_COMPLETE, obex_parser_process_data(&parser, &response[pos], sizeof(response) - pos));
+    CHECK_EQUAL(OBEX_RESP_CONTINUE, obex_parser_get_response_code(&parser));
+    CHECK_EQUAL(OBEX_HEADER_BODY, result.header_id);
+    CHECK_EQUAL(300, result.data_len);
+    CHECK_EQUAL(0, memcmp(&response[6], result.data, 300));
+}
+
+TEST(OBEXParser, Invalid){
+    // header longer than packet
+    const uint8_t header_too_long[] = { 0xA0, 0x00, 0x08, 0x48, 0x00, 0x10, 0x00, 0x00 };
+    obex_parser_init_for_response(&parser, OBEX_OPCODE_GET, &parser_callback, &result);
+    CHECK_EQUAL(OBEX_PARSER_OBJECT_STATE_INVALID, obex_parser_process_data(&parser, header_too_long, sizeof(header_too_long)));
+    CHECK_EQUAL(0, result.num_callbacks);
+
+    // data after end of packet
+    const uint8_t trailing_data[] = { 0xA0, 0x00, 0x03, 0x00 };
+    obex_parser_init_for_response(&parser, OBEX_OPCODE_GET, &parser_callback, &result);
+    CHECK_EQUAL(OBEX_PARSER_OBJECT_STATE_INVALID, obex_parser_process_data(&parser, trailing_data, sizeof(trailing_data)));
+
+    // packet length shorter than response fields
+    const uint8_t packet_too_short[] = { 0xA0, 0x00, 0x02 };
+    obex_parser_init_for_response(&parser, OBEX_OPCODE_GET, &parser_callback, &result);
+    CHECK_EQUAL(OBEX_PARSER_OBJECT_STATE_INVALID, obex_parser_process_data(&parser, packet_too_short, sizeof(packet_too_short)));
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
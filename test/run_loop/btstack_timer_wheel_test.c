@@ -0,0 +1,233 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "btstack_run_loop.h"
+
+#define NUM_TIMERS 50
+
+static btstack_timer_wheel_t wheel;
+static btstack_timer_source_t timers[NUM_TIMERS];
+static btstack_timer_source_t * expired[NUM_TIMERS * 2];
+static int expired_count;
+
+static void timer_handler(btstack_timer_source_t * ts){
+    expired[expired_count++] = ts;
+}
+
+static void readd_handler(btstack_timer_source_t * ts){
+    expired[expired_count++] = ts;
+    if (expired_count > 1) return;
+    btstack_timer_wheel_add(&wheel, ts);
+}
+
+static void remove_next_handler(btstack_timer_source_t * ts){
+    expired[expired_count++] = ts;
+    btstack_timer_wheel_remove(&wheel, ts + 1);
+}
+
+static void add_timer(int index, uint32_t timeout){
+    timers[index].timeout = timeout;
+    timers[index].process = &timer_handler;
+    btstack_timer_wheel_add(&wheel, &timers[index]);
+}
+
+TEST_GROUP(TimerWheel){
+    void setup(void){
+        // timers are not initialized by users, simulate garbage
+        memset(timers, 0x55, sizeof(timers));
+        expired_count = 0;
+    }
+};
+
+TEST(TimerWheel, Empty){
+    uint32_t timeout;
+    btstack_timer_wheel_init(&wheel, 0);
+    CHECK_EQUAL(0, btstack_timer_wheel_get_next_timeout(&wheel, &timeout));
+    CHECK_EQUAL(-1, btstack_timer_wheel_remove(&wheel, &timers[0]));
+    btstack_timer_wheel_process_expired(&wheel, 100000);
+    CHECK_EQUAL(0, expired_count);
+}
+
+TEST(TimerWheel, SortedExpiry){
+    int i;
+    uint32_t timeout;
+    btstack_timer_wheel_init(&wheel, 1000);
+    // pseudo random timeouts in all levels
+    uint32_t value = 12345;
+    for (i = 0; i < NUM_TIMERS; i++){
+        value = value * 1103515245 + 12345;
+        add_timer(i, 1000 + (value % (1 << ((i % 7) * 4 + 4))));
+    }
+    CHECK_EQUAL(1, btstack_timer_wheel_get_next_timeout(&wheel, &timeout));
+    uint32_t min_timeout = 0xffffffff;
+    for (i = 0; i < NUM_TIMERS; i++){
+        if (timers[i].timeout < min_timeout) min_timeout = timers[i].timeout;
+    }
+    CHECK_EQUAL(min_timeout, timeout);
+    btstack_timer_wheel_process_expired(&wheel, 0x20000000);
+    CHECK_EQUAL(NUM_TIMERS, expired_count);
+    for (i = 1; i < NUM_TIMERS; i++){
+        CHECK(expired[i-1]->timeout <= expired[i]->timeout);
+    }
+}
+
+TEST(TimerWheel, SameTimeoutInAddOrder){
+    int i;
+    btstack_timer_wheel_init(&wheel, 0);
+    // first half added far ahead, second half after wheel moved closer
+    for (i = 0; i < 10; i++){
+        add_timer(i, 70000);
+    }
+    btstack_timer_wheel_process_expired(&wheel, 69000);
+    for (i = 10; i < 20; i++){
+        add_timer(i, 70000);
+    }
+    btstack_timer_wheel_process_expired(&wheel, 70000);
+    CHECK_EQUAL(20, expired_count);
+    for (i = 0; i < 20; i++){
+        POINTERS_EQUAL(&timers[i], expired[i]);
+    }
+}
+
+TEST(TimerWheel, ProcessOnlyExpired){
+    uint32_t timeout;
+    btstack_timer_wheel_init(&wheel, 0);
+    add_timer(0, 100);
+    add_timer(1, 5000);
+    add_timer(2, 100000);
+    btstack_timer_wheel_process_expired(&wheel, 4999);
+    CHECK_EQUAL(1, expired_count);
+    CHECK_EQUAL(1, btstack_timer_wheel_get_next_timeout(&wheel, &timeout));
+    CHECK_EQUAL(5000, timeout);
+    btstack_timer_wheel_process_expired(&wheel, 5000);
+    CHECK_EQUAL(2, expired_count);
+    CHECK_EQUAL(1, btstack_timer_wheel_get_next_timeout(&wheel, &timeout));
+    CHECK_EQUAL(100000, timeout);
+}
+
+TEST(TimerWheel, Remove){
+    btstack_timer_wheel_init(&wheel, 0);
+    add_timer(0, 100);
+    add_timer(1, 100);
+    add_timer(2, 3000);
+    CHECK_EQUAL(0, btstack_timer_wheel_remove(&wheel, &timers[1]));
+    CHECK_EQUAL(-1, btstack_timer_wheel_remove(&wheel, &timers[1]));
+    // remove after timeout was changed
+    timers[2].timeout = 50;
+    CHECK_EQUAL(0, btstack_timer_wheel_remove(&wheel, &timers[2]));
+    btstack_timer_wheel_process_expired(&wheel, 10000);
+    CHECK_EQUAL(1, expired_count);
+    POINTERS_EQUAL(&timers[0], expired[0]);
+    CHECK_EQUAL(-1, btstack_timer_wheel_remove(&wheel, &timers[0]));
+}
+
+TEST(TimerWheel, AddTwice){
+    btstack_timer_wheel_init(&wheel, 0);
+    add_timer(0, 100);
+    btstack_timer_wheel_add(&wheel, &timers[0]);
+    btstack_timer_wheel_process_expired(&wheel, 100);
+    CHECK_EQUAL(1, expired_count);
+}
+
+TEST(TimerWheel, ReaddFromHandler){
+    btstack_timer_wheel_init(&wheel, 0);
+    add_timer(0, 100);
+    timers[0].process = &readd_handler;
+    btstack_timer_wheel_process_expired(&wheel, 100);
+    // re-added expired timer gets processed in same call
+    CHECK_EQUAL(2, expired_count);
+}
+
+TEST(TimerWheel, RemoveFromHandler){
+    btstack_timer_wheel_init(&wheel, 0);
+    add_timer(0, 100);
+    add_timer(1, 100);
+    timers[0].process = &remove_next_handler;
+    btstack_timer_wheel_process_expired(&wheel, 200);
+    CHECK_EQUAL(1, expired_count);
+}
+
+TEST(TimerWheel, WrapAround){
+    int i;
+    uint32_t timeout;
+    btstack_timer_wheel_init(&wheel, 0xfffff000);
+    add_timer(0, 0xfffff800);
+    add_timer(1, 0x00000100);
+    add_timer(2, 0xffffffff);
+    add_timer(3, 0x00000000);
+    CHECK_EQUAL(1, btstack_timer_wheel_get_next_timeout(&wheel, &timeout));
+    CHECK_EQUAL(0xfffff800, timeout);
+    btstack_timer_wheel_process_expired(&wheel, 0xfffffff0);
+    CHECK_EQUAL(1, expired_count);
+    CHECK_EQUAL(1, btstack_timer_wheel_get_next_timeout(&wheel, &timeout));
+    CHECK_EQUAL(0xffffffff, timeout);
+    btstack_timer_wheel_process_expired(&wheel, 0x00000200);
+    CHECK_EQUAL(4, expired_count);
+    const int expected_order[] = { 0, 2, 3, 1};
+    for (i = 0; i < 4; i++){
+        POINTERS_EQUAL(&timers[expected_order[i]], expired[i]);
+    }
+}
+
+TEST(TimerWheel, PastTimeout){
+    btstack_timer_wheel_init(&wheel, 5000);
+    add_timer(0, 4000);
+    btstack_timer_wheel_process_expired(&wheel, 5000);
+    CHECK_EQUAL(1, expired_count);
+}
+
+TEST(TimerWheel, RandomOperationsMatchSortedList){
+    // reference: sorted by timeout, then by order of adding
+    static uint32_t added_seq[NUM_TIMERS];
+    static int active[NUM_TIMERS];
+    uint32_t seq = 0;
+    uint32_t now = 0;
+    uint32_t value = 1;
+    int round;
+    int i;
+    memset(active, 0, sizeof(active));
+    btstack_timer_wheel_init(&wheel, now);
+    for (round = 0; round < 20000; round++){
+        value = value * 1103515245 + 12345;
+        int index = (value >> 8) % NUM_TIMERS;
+        switch ((value >> 20) % 4){
+            case 0:
+            case 1:
+                if (active[index]) break;
+                add_timer(index, now + ((value >> 4) % (((value >> 24) & 1) ? 20 : 5000)));
+                added_seq[index] = seq++;
+                active[index] = 1;
+                break;
+            case 2:
+                CHECK_EQUAL(active[index] ? 0 : -1, btstack_timer_wheel_remove(&wheel, &timers[index]));
+                active[index] = 0;
+                break;
+            default: {
+                now += (value >> 6) % 300;
+                expired_count = 0;
+                btstack_timer_wheel_process_expired(&wheel, now);
+                int expected = 0;
+                while (1){
+                    int next = -1;
+                    for (i = 0; i < NUM_TIMERS; i++){
+                        if (!active[i] || timers[i].timeout > now) continue;
+                        if (next < 0 || timers[i].timeout < timers[next].timeout
+                        || (timers[i].timeout == timers[next].timeout && added_seq[i] < added_seq[next])){
+                            next = i;
+                        }
+                    }
+                    if (next < 0) break;
+                    POINTERS_EQUAL(&timers[next], expired[expected]);
+                    active[next] = 0;
+                    expected++;
+                }
+                CHECK_EQUAL(expected, expired_count);
+                break;
+            }
+        }
+    }
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,116 @@
+/*
+ * run_loop_benchmark.c
+ *
+ * Measures run loop overhead per dispatched data source callback while the number
+ * of registered (but idle) data sources grows from 10 to 1000.
+ *
+ * A single active pipe is kept readable, all other data sources are dups of an idle pipe.
+ * Each configuration runs in a forked child, as the run loops cannot be stopped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_run_loop_epoll.h"
+
+#define NUM_ITERATIONS 100000
+#define MAX_DATA_SOURCES 1000
+
+static const int num_data_sources_list[] = { 10, 100, 500, 1000 };
+
+static btstack_data_source_t data_sources[MAX_DATA_SOURCES];
+static int active_pipe[2];
+static int iterations;
+static struct timespec start_ts;
+
+static double elapsed_us(void){
+    struct timespec now_ts;
+    clock_gettime(CLOCK_MONOTONIC, &now_ts);
+    return (now_ts.tv_sec - start_ts.tv_sec) * 1000000.0 + (now_ts.tv_nsec - start_ts.tv_nsec) / 1000.0;
+}
+
+static void active_process(btstack_data_source_t * ds, btstack_data_source_callback_type_t callback_type){
+    (void) callback_type;
+    uint8_t byte;
+    if (read(ds->fd, &byte, 1) != 1) exit(1);
+    iterations++;
+    if (iterations == NUM_ITERATIONS){
+        printf("%8.3f us\n", elapsed_us() / NUM_ITERATIONS);
+        exit(0);
+    }
+    if (write(active_pipe[1], &byte, 1) != 1) exit(1);
+}
+
+static void idle_process(btstack_data_source_t * ds, btstack_data_source_callback_type_t callback_type){
+    (void) ds;
+    (void) callback_type;
+    // idle pipe never becomes readable
+    exit(1);
+}
+
+static void run_benchmark(const btstack_run_loop_t * run_loop, int num_data_sources){
+    int idle_pipe[2];
+    int i;
+    if (pipe(idle_pipe) || pipe(active_pipe)) exit(1);
+
+    btstack_run_loop_init(run_loop);
+
+    // idle data sources
+    for (i = 1; i < num_data_sources; i++){
+        int fd = dup(idle_pipe[0]);
+        if (fd < 0) exit(1);
+        if (run_loop == btstack_run_loop_posix_get_instance() && fd >= FD_SETSIZE){
+            printf(" n/a (fd >= FD_SETSIZE)\n");
+            exit(0);
+        }
+        btstack_run_loop_set_data_source_fd(&data_sources[i], fd);
+        btstack_run_loop_set_data_source_handler(&data_sources[i], &idle_process);
+        btstack_run_loop_enable_data_source_callbacks(&data_sources[i], DATA_SOURCE_CALLBACK_READ);
+        btstack_run_loop_add_data_source(&data_sources[i]);
+    }
+
+    // single active data source added last, so the select() based run loop has to visit all others first
+    btstack_run_loop_set_data_source_fd(&data_sources[0], active_pipe[0]);
+    btstack_run_loop_set_data_source_handler(&data_sources[0], &active_process);
+    btstack_run_loop_enable_data_source_callbacks(&data_sources[0], DATA_SOURCE_CALLBACK_READ);
+    btstack_run_loop_add_data_source(&data_sources[0]);
+
+    uint8_t byte = 0;
+    if (write(active_pipe[1], &byte, 1) != 1) exit(1);
+
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    btstack_run_loop_execute();
+}
+
+static void run_in_child(const char * name, const btstack_run_loop_t * run_loop, int num_data_sources){
+    printf("%-6s %5u data sources: ", name, num_data_sources);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0){
+        run_benchmark(run_loop, num_data_sources);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)){
+        printf(" failed\n");
+    }
+}
+
+int main(int argc, const char * argv[]){
+    (void) argc;
+    (void) argv;
+    unsigned int i;
+    printf("Run loop overhead per data source callback, %u iterations\n", NUM_ITERATIONS);
+    for (i = 0; i < sizeof(num_data_sources_list) / sizeof(int); i++){
+        run_in_child("posix", btstack_run_loop_posix_get_instance(), num_data_sources_list[i]);
+        run_in_child("epoll", btstack_run_loop_epoll_get_instance(), num_data_sources_list[i]);
+    }
+    return 0;
+}
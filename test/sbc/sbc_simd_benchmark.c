@@ -0,0 +1,140 @@
+/*
+ * sbc_simd_benchmark.c
+ *
+ * Reports encoded and decoded frames per second for SBC (8 subbands, 16 blocks, joint stereo)
+ * and mSBC for each SIMD level supported by the CPU, from the one selected at init down to
+ * SBC_SIMD_NONE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "sbc_encoder.h"
+#include "oi_codec_sbc.h"
+
+#define NUM_FRAMES      20000
+#define MAX_FRAME_SIZE  512
+#define MAX_PCM_SAMPLES (SBC_MAX_NUM_OF_SUBBANDS * SBC_MAX_NUM_OF_BLOCKS * SBC_MAX_NUM_OF_CHANNELS)
+#define DECODER_DATA_SIZE (SBC_MAX_CHANNELS*SBC_MAX_BLOCKS*SBC_MAX_BANDS * 4 + SBC_CODEC_MIN_FILTER_BUFFERS*SBC_MAX_BANDS*SBC_MAX_CHANNELS * 2)
+
+#ifndef M_PI
+#define M_PI  3.14159265
+#endif
+
+static SBC_ENC_PARAMS encoder;
+static OI_CODEC_SBC_DECODER_CONTEXT decoder;
+static OI_UINT32 decoder_data[(DECODER_DATA_SIZE+3)/4];
+static int16_t pcm_in[MAX_PCM_SAMPLES];
+static int16_t pcm_out[MAX_PCM_SAMPLES];
+static uint8_t sbc_frame[MAX_FRAME_SIZE];
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void encoder_setup(int msbc, SINT16 simd_level){
+    memset(&encoder, 0, sizeof(encoder));
+    if (msbc){
+        encoder.s16NumOfBlocks = 15;
+        encoder.s16NumOfSubBands = 8;
+        encoder.s16AllocationMethod = SBC_LOUDNESS;
+        encoder.s16BitPool = 26;
+        encoder.s16ChannelMode = SBC_MONO;
+        encoder.s16NumOfChannels = 1;
+        encoder.mSBCEnabled = 1;
+        encoder.s16SamplingFreq = SBC_sf16000;
+    } else {
+        encoder.s16NumOfBlocks = 16;
+        encoder.s16NumOfSubBands = 8;
+        encoder.s16AllocationMethod = SBC_LOUDNESS;
+        encoder.s16BitPool = 53;
+        encoder.s16ChannelMode = SBC_JOINT_STEREO;
+        encoder.s16NumOfChannels = 2;
+        encoder.s16SamplingFreq = SBC_sf44100;
+    }
+    encoder.pu8Packet = sbc_frame;
+    SBC_Encoder_Init(&encoder);
+    encoder.s16SimdLevel = simd_level;
+}
+
+static void run_benchmark(int msbc, SINT16 encoder_level, OI_UINT8 decoder_level){
+    int num_samples;
+    int frame;
+    int i;
+    double start;
+    double encode_s;
+    double decode_s = 0;
+
+    encoder_setup(msbc, encoder_level);
+    num_samples = encoder.s16NumOfSubBands * encoder.s16NumOfBlocks * encoder.s16NumOfChannels;
+    for (i = 0; i < num_samples; i++){
+        pcm_in[i] = (int16_t) (20000 * sin(i * 2 * M_PI * 441 / 44100));
+    }
+
+    start = now();
+    for (frame = 0; frame < NUM_FRAMES; frame++){
+        if (encoder.mSBCEnabled){
+            sbc_frame[0] = 0xad;
+        }
+        encoder.ps16PcmBuffer = pcm_in;
+        SBC_Encoder(&encoder);
+    }
+    encode_s = now() - start;
+
+    memset(decoder_data, 0, sizeof(decoder_data));
+    if (msbc){
+        OI_CODEC_mSBC_DecoderReset(&decoder, decoder_data, sizeof(decoder_data));
+    } else {
+        OI_CODEC_SBC_DecoderReset(&decoder, decoder_data, sizeof(decoder_data), 2, 2, FALSE);
+    }
+    decoder.common.simdLevel = decoder_level;
+    start = now();
+    for (frame = 0; frame < NUM_FRAMES; frame++){
+        const OI_BYTE * frame_data = sbc_frame;
+        OI_UINT32 frame_bytes = encoder.u16PacketLength;
+        OI_UINT32 pcm_bytes = sizeof(pcm_out);
+        if (OI_CODEC_SBC_DecodeFrame(&decoder, &frame_data, &frame_bytes, pcm_out, &pcm_bytes) != OI_STATUS_SUCCESS){
+            printf("decoding failed\n");
+            return;
+        }
+    }
+    decode_s = now() - start;
+
+    printf("%-5s encoder level %u: %8.0f frames/s, decoder level %u: %8.0f frames/s\n", msbc ? "mSBC" : "SBC",
+        encoder_level, NUM_FRAMES / encode_s, decoder_level, NUM_FRAMES / decode_s);
+}
+
+int main(void){
+    SINT16 encoder_default_level;
+    OI_UINT8 decoder_default_level;
+    SINT16 encoder_level;
+    OI_UINT8 decoder_level;
+    int msbc;
+
+    // levels selected by init
+    memset(&encoder, 0, sizeof(encoder));
+    encoder.s16NumOfBlocks = 16;
+    encoder.s16NumOfSubBands = 8;
+    encoder.s16NumOfChannels = 1;
+    SBC_Encoder_Init(&encoder);
+    encoder_default_level = encoder.s16SimdLevel;
+    OI_CODEC_SBC_DecoderReset(&decoder, decoder_data, sizeof(decoder_data), 2, 2, FALSE);
+    decoder_default_level = decoder.common.simdLevel;
+
+    for (msbc = 0; msbc < 2; msbc++){
+        encoder_level = encoder_default_level;
+        decoder_level = decoder_default_level;
+        while (1){
+            run_benchmark(msbc, encoder_level, decoder_level);
+            if (encoder_level == SBC_SIMD_NONE) break;
+            encoder_level = encoder_level == SBC_SIMD_AVX2 ? SBC_SIMD_SSE2 : SBC_SIMD_NONE;
+            decoder_level = encoder_level == SBC_SIMD_NONE ? OI_SBC_SIMD_NONE : decoder_level;
+        }
+    }
+    return 0;
+}
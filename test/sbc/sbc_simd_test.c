@@ -0,0 +1,242 @@
+/*
+ * sbc_simd_test.c
+ *
+ * Checks that the SIMD kernels of the SBC analysis filter (encoder) and the 8 subband synthesis
+ * filter (decoder) are bit-exact with the scalar code. Each configuration is encoded and decoded
+ * once with the SIMD level selected at init and once per lower level, down to SBC_SIMD_NONE.
+ * Encoded frames and decoded PCM must be identical.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sbc_encoder.h"
+#include "oi_codec_sbc.h"
+
+#define NUM_FRAMES      50
+#define MAX_FRAME_SIZE  512
+#define MAX_PCM_SAMPLES (SBC_MAX_NUM_OF_SUBBANDS * SBC_MAX_NUM_OF_BLOCKS * SBC_MAX_NUM_OF_CHANNELS)
+#define DECODER_DATA_SIZE (SBC_MAX_CHANNELS*SBC_MAX_BLOCKS*SBC_MAX_BANDS * 4 + SBC_CODEC_MIN_FILTER_BUFFERS*SBC_MAX_BANDS*SBC_MAX_CHANNELS * 2)
+
+#ifndef M_PI
+#define M_PI  3.14159265
+#endif
+
+typedef enum {
+    SIGNAL_RANDOM = 0,
+    SIGNAL_SINE,
+    SIGNAL_FULL_SCALE,
+    NUM_SIGNALS
+} signal_t;
+
+typedef struct {
+    int msbc;
+    int subbands;
+    int blocks;
+    int channel_mode;
+    signal_t signal;
+} test_config_t;
+
+typedef struct {
+    uint8_t  sbc[NUM_FRAMES][MAX_FRAME_SIZE];
+    uint16_t sbc_len[NUM_FRAMES];
+    int16_t  pcm[NUM_FRAMES][MAX_PCM_SAMPLES];
+} test_output_t;
+
+static SBC_ENC_PARAMS encoder;
+static OI_CODEC_SBC_DECODER_CONTEXT decoder;
+static OI_UINT32 decoder_data[(DECODER_DATA_SIZE+3)/4];
+static test_output_t reference;
+static test_output_t result;
+static int16_t pcm_in[NUM_FRAMES][MAX_PCM_SAMPLES];
+static int num_failures;
+static int num_tests;
+
+static int num_channels(const test_config_t * config){
+    return config->channel_mode == SBC_MONO ? 1 : 2;
+}
+
+static void create_signal(const test_config_t * config){
+    int num_samples = config->subbands * config->blocks * num_channels(config);
+    int frame;
+    int i;
+    srand(config->subbands * 1000 + config->blocks * 10 + config->channel_mode);
+    for (frame = 0; frame < NUM_FRAMES; frame++){
+        for (i = 0; i < num_samples; i++){
+            int pos = frame * num_samples + i;
+            switch (config->signal){
+                case SIGNAL_RANDOM:
+                    pcm_in[frame][i] = (int16_t) rand();
+                    break;
+                case SIGNAL_SINE:
+                    pcm_in[frame][i] = (int16_t) (20000 * sin(pos * 2 * M_PI * (i & 1 ? 1000 : 441) / 44100));
+                    break;
+                default:
+                    // alternating full scale square wave, worst case for saturation
+                    pcm_in[frame][i] = (pos / 7) & 1 ? 32767 : -32768;
+                    break;
+            }
+        }
+    }
+}
+
+static void encode(const test_config_t * config, SINT16 simd_level, test_output_t * output){
+    int frame;
+    memset(&encoder, 0, sizeof(encoder));
+    if (config->msbc){
+        encoder.s16NumOfBlocks = 15;
+        encoder.s16NumOfSubBands = 8;
+        encoder.s16AllocationMethod = SBC_LOUDNESS;
+        encoder.s16BitPool = 26;
+        encoder.s16ChannelMode = SBC_MONO;
+        encoder.s16NumOfChannels = 1;
+        encoder.mSBCEnabled = 1;
+        encoder.s16SamplingFreq = SBC_sf16000;
+    } else {
+        encoder.s16NumOfBlocks = config->blocks;
+        encoder.s16NumOfSubBands = config->subbands;
+        encoder.s16AllocationMethod = SBC_LOUDNESS;
+        encoder.s16BitPool = config->channel_mode == SBC_MONO || config->channel_mode == SBC_DUAL ? 32 : 53;
+        encoder.s16ChannelMode = config->channel_mode;
+        encoder.s16NumOfChannels = num_channels(config);
+        encoder.s16SamplingFreq = SBC_sf44100;
+    }
+    for (frame = 0; frame < NUM_FRAMES; frame++){
+        encoder.pu8Packet = output->sbc[frame];
+        if (frame == 0){
+            SBC_Encoder_Init(&encoder);
+            encoder.s16SimdLevel = simd_level;
+        }
+        if (encoder.mSBCEnabled){
+            encoder.pu8Packet[0] = 0xad;
+        }
+        encoder.ps16PcmBuffer = pcm_in[frame];
+        SBC_Encoder(&encoder);
+        output->sbc_len[frame] = encoder.u16PacketLength;
+    }
+}
+
+static int decode(const test_config_t * config, OI_UINT8 simd_level, const test_output_t * input, test_output_t * output){
+    int frame;
+    OI_STATUS status;
+    int pcm_stride = num_channels(config);
+    // decoder reset does not clear the filter history
+    memset(decoder_data, 0, sizeof(decoder_data));
+    if (config->msbc){
+        status = OI_CODEC_mSBC_DecoderReset(&decoder, decoder_data, sizeof(decoder_data));
+    } else {
+        status = OI_CODEC_SBC_DecoderReset(&decoder, decoder_data, sizeof(decoder_data), 2, pcm_stride, FALSE);
+    }
+    if (status != OI_STATUS_SUCCESS) return -1;
+    decoder.common.simdLevel = simd_level;
+    for (frame = 0; frame < NUM_FRAMES; frame++){
+        const OI_BYTE * frame_data = input->sbc[frame];
+        OI_UINT32 frame_bytes = input->sbc_len[frame];
+        OI_UINT32 pcm_bytes = sizeof(output->pcm[frame]);
+        memset(output->pcm[frame], 0x55, sizeof(output->pcm[frame]));
+        status = OI_CODEC_SBC_DecodeFrame(&decoder, &frame_data, &frame_bytes, output->pcm[frame], &pcm_bytes);
+        if (status != OI_STATUS_SUCCESS) return -1;
+    }
+    return 0;
+}
+
+static void describe(const test_config_t * config, char * buffer, int size){
+    static const char * mode_names[] = { "mono", "dual", "stereo", "joint" };
+    static const char * signal_names[] = { "random", "sine", "full scale" };
+    if (config->msbc){
+        snprintf(buffer, size, "mSBC, %s", signal_names[config->signal]);
+    } else {
+        snprintf(buffer, size, "%u subbands, %2u blocks, %-6s, %s", config->subbands, config->blocks,
+            mode_names[config->channel_mode], signal_names[config->signal]);
+    }
+}
+
+static void check(const test_config_t * config, const char * what, int simd_level, int ok){
+    char name[80];
+    num_tests++;
+    if (ok) return;
+    num_failures++;
+    describe(config, name, sizeof(name));
+    printf("FAIL: %s, %s, SIMD level %u differs from scalar code\n", name, what, simd_level);
+}
+
+static void test_config(const test_config_t * config, SINT16 encoder_level, OI_UINT8 decoder_level){
+    int frame;
+    int ok;
+
+    create_signal(config);
+
+    // scalar reference
+    encode(config, SBC_SIMD_NONE, &reference);
+    if (decode(config, OI_SBC_SIMD_NONE, &reference, &reference)){
+        check(config, "decoder reference", 0, 0);
+        return;
+    }
+
+    // encoder, every level from selected one down to SSE2 on x86
+    for (; encoder_level != SBC_SIMD_NONE; encoder_level = encoder_level == SBC_SIMD_AVX2 ? SBC_SIMD_SSE2 : SBC_SIMD_NONE){
+        encode(config, encoder_level, &result);
+        ok = 1;
+        for (frame = 0; frame < NUM_FRAMES; frame++){
+            if (result.sbc_len[frame] != reference.sbc_len[frame]) ok = 0;
+            if (memcmp(result.sbc[frame], reference.sbc[frame], reference.sbc_len[frame])) ok = 0;
+        }
+        check(config, "encoder", encoder_level, ok);
+    }
+
+    // decoder
+    if (decoder_level != OI_SBC_SIMD_NONE){
+        ok = decode(config, decoder_level, &reference, &result) == 0;
+        if (ok){
+            ok = memcmp(result.pcm, reference.pcm, sizeof(result.pcm)) == 0;
+        }
+        check(config, "decoder", decoder_level, ok);
+    }
+}
+
+int main(void){
+    static const int subbands[] = { 4, 8 };
+    static const int blocks[] = { 4, 8, 12, 16 };
+    static const int channel_modes[] = { SBC_MONO, SBC_DUAL, SBC_STEREO, SBC_JOINT_STEREO };
+    test_config_t config;
+    SINT16 encoder_level;
+    OI_UINT8 decoder_level;
+    unsigned int s, b, c;
+
+    // levels selected by init
+    memset(&encoder, 0, sizeof(encoder));
+    encoder.s16NumOfBlocks = 16;
+    encoder.s16NumOfSubBands = 8;
+    encoder.s16NumOfChannels = 1;
+    SBC_Encoder_Init(&encoder);
+    encoder_level = encoder.s16SimdLevel;
+    OI_CODEC_SBC_DecoderReset(&decoder, decoder_data, sizeof(decoder_data), 2, 2, FALSE);
+    decoder_level = decoder.common.simdLevel;
+    printf("SIMD level: encoder %u, decoder %u\n", encoder_level, decoder_level);
+
+    memset(&config, 0, sizeof(config));
+    for (config.signal = 0; config.signal < NUM_SIGNALS; config.signal++){
+        config.msbc = 0;
+        for (s = 0; s < sizeof(subbands) / sizeof(int); s++){
+            for (b = 0; b < sizeof(blocks) / sizeof(int); b++){
+                for (c = 0; c < sizeof(channel_modes) / sizeof(int); c++){
+                    config.subbands = subbands[s];
+                    config.blocks = blocks[b];
+                    config.channel_mode = channel_modes[c];
+                    test_config(&config, encoder_level, decoder_level);
+                }
+            }
+        }
+        config.msbc = 1;
+        config.subbands = 8;
+        config.blocks = 15;
+        config.channel_mode = SBC_MONO;
+        test_config(&config, encoder_level, decoder_level);
+    }
+
+    printf("%u checks, %u failures\n", num_tests, num_failures);
+    return num_failures ? 1 : 0;
+}
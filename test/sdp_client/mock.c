@@ -1,12 +1,19 @@
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "btstack_defines.h"
 #include "btstack_debug.h"
 #include "btstack_util.h"
 #include "bluetooth.h"
+#include "mock.h"
 
 static btstack_packet_handler_t packet_handler;
+static uint16_t next_local_cid = 0x41;
+static uint8_t  outgoing_buffer[1024];
+static uint16_t sent_cid;
+static uint16_t sent_len;
+static uint16_t disconnected_cid;
 
 extern "C" int l2cap_can_send_packet_now(uint16_t cid){
     return 1;
@@ -19,12 +26,17 @@ extern "C" void l2cap_request_can_send_now_event(uint16_t cid){
 
 extern "C" uint8_t l2cap_create_channel(btstack_packet_handler_t handler, bd_addr_t address, uint16_t psm, uint16_t mtu, uint16_t * out_local_cid){
 	packet_handler = handler;
-    return 0x41;
+    if (out_local_cid){
+        *out_local_cid = next_local_cid;
+    }
+    next_local_cid++;
+    return 0;
 }
 extern "C" void l2cap_disconnect(uint16_t local_cid, uint8_t reason){
+    disconnected_cid = local_cid;
 }
 extern "C" uint8_t *l2cap_get_outgoing_buffer(void){
-    return NULL;
+    return outgoing_buffer;
 }
 extern "C" uint16_t l2cap_max_mtu(void){
     return 0;
@@ -33,5 +45,45 @@ extern "C" int l2cap_reserve_packet_buffer(void){
     return 0;
 }
 extern "C" int l2cap_send_prepared(uint16_t local_cid, uint16_t len){
+    sent_cid = local_cid;
+    sent_len = len;
     return 0;
-}
\ No newline at end of file
+}
+
+void mock_l2cap_channel_opened(uint16_t local_cid, uint16_t mtu){
+    uint8_t event[21];
+    memset(event, 0, sizeof(event));
+    event[0] = L2CAP_EVENT_CHANNEL_OPENED;
+    event[1] = sizeof(event) - 2;
+    little_endian_store_16(event, 13, local_cid);
+    little_endian_store_16(event, 17, mtu);
+    little_endian_store_16(event, 19, mtu);
+    packet_handler(HCI_EVENT_PACKET, local_cid, event, sizeof(event));
+}
+
+void mock_l2cap_channel_closed(uint16_t local_cid){
+    uint8_t event[] = { L2CAP_EVENT_CHANNEL_CLOSED, 2, 0, 0};
+    little_endian_store_16(event, 2, local_cid);
+    packet_handler(HCI_EVENT_PACKET, local_cid, event, sizeof(event));
+}
+
+void mock_l2cap_receive(uint16_t local_cid, uint8_t * data, uint16_t len){
+    packet_handler(L2CAP_DATA_PACKET, local_cid, data, len);
+}
+
+uint8_t * mock_l2cap_sent_packet(uint16_t * local_cid, uint16_t * len){
+    *local_cid = sent_cid;
+    *len = sent_len;
+    sent_cid = 0;
+    return outgoing_buffer;
+}
+
+uint16_t mock_l2cap_disconnected_cid(void){
+    uint16_t cid = disconnected_cid;
+    disconnected_cid = 0;
+    return cid;
+}
+
+uint16_t mock_l2cap_last_local_cid(void){
+    return next_local_cid - 1;
+}
@@ -10,4 +10,13 @@ void sdp_parser_handle_service_search(uint8_t * data, uint16_t total_count, uint
 void sdp_client_query_rfcomm_init(void);
 
 void sdp_client_reset(void);
+void sdp_client_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
 
+
+// L2CAP mock with one channel per l2cap_create_channel call
+void mock_l2cap_channel_opened(uint16_t local_cid, uint16_t mtu);
+void mock_l2cap_channel_closed(uint16_t local_cid);
+void mock_l2cap_receive(uint16_t local_cid, uint8_t * data, uint16_t len);
+uint8_t * mock_l2cap_sent_packet(uint16_t * local_cid, uint16_t * len);
+uint16_t mock_l2cap_disconnected_cid(void);
+uint16_t mock_l2cap_last_local_cid(void);
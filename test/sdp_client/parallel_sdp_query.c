@@ -0,0 +1,254 @@
+
+// *****************************************************************************
+//
+// test parallel sdp queries: N queries to N remotes with interleaved,
+// fragmented responses
+//
+// *****************************************************************************
+
+#include "btstack_config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btstack_event.h"
+#include "btstack_memory.h"
+#include "l2cap.h"
+#include "mock.h"
+#include "classic/sdp_client.h"
+#include "classic/sdp_util.h"
+#include "classic/spp_server.h"
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#define NUM_REMOTES   4
+#define NUM_QUERIES   (NUM_REMOTES + 1)
+#define L2CAP_MTU     48
+#define MAX_FRAGMENT  20
+
+// query NUM_REMOTES uses sdp_client_query
+#define LEGACY_QUERY  NUM_REMOTES
+
+typedef struct {
+    uint16_t cid;
+    uint16_t channel;
+    uint8_t  record_list[200];
+    uint16_t record_list_len;
+    uint16_t record_list_pos;
+    uint16_t transaction_id;
+    uint8_t  name[40];
+    uint16_t name_len;
+    int      complete;
+    uint8_t  status;
+} query_t;
+
+static const uint8_t service_search_pattern[] = { 0x35, 0x03, 0x19, 0x11, 0x01 };
+static const uint8_t attribute_id_list[]      = { 0x35, 0x05, 0x0A, 0x00, 0x01, 0x01, 0x00 };
+
+static query_t queries[NUM_QUERIES];
+static int     num_unknown_channel_events;
+
+static query_t * query_for_channel(uint16_t channel){
+    int i;
+    for (i=0;i<NUM_QUERIES;i++){
+        if (queries[i].channel == channel) return &queries[i];
+    }
+    return NULL;
+}
+
+static void handle_query_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    query_t * query = query_for_channel(channel);
+    if (!query){
+        num_unknown_channel_events++;
+        return;
+    }
+    switch (hci_event_packet_get_type(packet)){
+        case SDP_EVENT_QUERY_ATTRIBUTE_VALUE:
+            if (sdp_event_query_attribute_byte_get_attribute_id(packet) != 0x0100) break;
+            // skip data element header of service name
+            if (sdp_event_query_attribute_byte_get_data_offset(packet) < 2) break;
+            query->name[query->name_len++] = sdp_event_query_attribute_byte_get_data(packet);
+            break;
+        case SDP_EVENT_QUERY_COMPLETE:
+            query->complete++;
+            query->status = sdp_event_query_complete_get_status(packet);
+            break;
+        default:
+            break;
+    }
+}
+
+static void create_record_list(query_t * query, int index){
+    char name[20];
+    sprintf(name, "Remote %u", index);
+    de_create_sequence(query->record_list);
+    uint8_t * record = de_push_sequence(query->record_list);
+    spp_create_sdp_record(record, 0x10001, index + 1, name);
+    de_pop_sequence(query->record_list, record);
+    query->record_list_len = de_get_len(query->record_list);
+}
+
+// check request sent for query and store its transaction id
+static void check_request(query_t * query){
+    uint16_t cid;
+    uint16_t len;
+    uint8_t * request = mock_l2cap_sent_packet(&cid, &len);
+    CHECK_EQUAL(query->cid, cid);
+    CHECK(len > 5);
+    CHECK_EQUAL(SDP_ServiceSearchAttributeRequest, request[0]);
+    query->transaction_id = big_endian_read_16(request, 1);
+}
+
+// send next fragment of the attribute lists, continuation state is the current position
+static void send_response(query_t * query){
+    uint8_t response[L2CAP_MTU];
+    uint16_t len = btstack_min(MAX_FRAGMENT, query->record_list_len - query->record_list_pos);
+    int more = query->record_list_pos + len < query->record_list_len;
+    uint16_t pos = 0;
+    response[pos++] = SDP_ServiceSearchAttributeResponse;
+    big_endian_store_16(response, pos, query->transaction_id);
+    pos += 2;
+    big_endian_store_16(response, pos, 2 + len + 1 + (more ? 1 : 0));
+    pos += 2;
+    big_endian_store_16(response, pos, len);
+    pos += 2;
+    memcpy(&response[pos], &query->record_list[query->record_list_pos], len);
+    pos += len;
+    query->record_list_pos += len;
+    if (more){
+        response[pos++] = 1;
+        response[pos++] = (uint8_t) query->record_list_pos;
+    } else {
+        response[pos++] = 0;
+    }
+    mock_l2cap_receive(query->cid, response, pos);
+}
+
+TEST_GROUP(SDPClientParallel){
+    void setup(void){
+        int i;
+        memset(queries, 0, sizeof(queries));
+        num_unknown_channel_events = 0;
+        for (i=0;i<NUM_QUERIES;i++){
+            create_record_list(&queries[i], i);
+        }
+    }
+    void teardown(void){
+        sdp_client_reset();
+    }
+};
+
+TEST(SDPClientParallel, InterleavedResponses){
+    bd_addr_t address;
+    int i;
+
+    // start queries
+    for (i=0;i<NUM_QUERIES;i++){
+        memset(address, 0, sizeof(address));
+        address[5] = i;
+        if (i == LEGACY_QUERY){
+            CHECK_EQUAL(1, sdp_client_ready());
+            CHECK_EQUAL(0, sdp_client_query(&handle_query_event, address, service_search_pattern, attribute_id_list));
+            CHECK_EQUAL(0, sdp_client_ready());
+            CHECK_EQUAL(SDP_QUERY_BUSY, sdp_client_query(&handle_query_event, address, service_search_pattern, attribute_id_list));
+            queries[i].cid = mock_l2cap_last_local_cid();
+            queries[i].channel = 0;
+        } else {
+            CHECK_EQUAL(0, sdp_client_query_parallel(&handle_query_event, address, service_search_pattern, attribute_id_list, &queries[i].channel));
+            queries[i].cid = queries[i].channel;
+            CHECK(queries[i].cid != 0);
+        }
+    }
+    for (i=0;i<NUM_REMOTES;i++){
+        CHECK(query_for_channel(queries[i].channel) == &queries[i]);
+    }
+
+    // open channels in reverse order, each query sends its first request
+    for (i=NUM_QUERIES-1;i>=0;i--){
+        mock_l2cap_channel_opened(queries[i].cid, L2CAP_MTU);
+        check_request(&queries[i]);
+    }
+
+    // deliver one fragment per query and round until all are done
+    int active = NUM_QUERIES;
+    while (active){
+        active = 0;
+        for (i=0;i<NUM_QUERIES;i++){
+            query_t * query = &queries[i];
+            if (query->record_list_pos == query->record_list_len) continue;
+            send_response(query);
+            if (query->record_list_pos < query->record_list_len){
+                check_request(query);
+                active++;
+            } else {
+                CHECK_EQUAL(query->cid, mock_l2cap_disconnected_cid());
+            }
+        }
+    }
+
+    // close channels
+    for (i=0;i<NUM_QUERIES;i++){
+        CHECK_EQUAL(0, queries[i].complete);
+        mock_l2cap_channel_closed(queries[i].cid);
+        CHECK_EQUAL(1, queries[i].complete);
+    }
+    CHECK_EQUAL(1, sdp_client_ready());
+
+    for (i=0;i<NUM_QUERIES;i++){
+        char name[20];
+        sprintf(name, "Remote %u", i);
+        CHECK_EQUAL(0, queries[i].status);
+        CHECK_EQUAL(strlen(name), queries[i].name_len);
+        MEMCMP_EQUAL(name, queries[i].name, queries[i].name_len);
+    }
+    CHECK_EQUAL(0, num_unknown_channel_events);
+}
+
+TEST(SDPClientParallel, ConnectionFailed){
+    bd_addr_t address;
+    memset(address, 0, sizeof(address));
+    query_t * query = &queries[0];
+    CHECK_EQUAL(0, sdp_client_query_parallel(&handle_query_event, address, service_search_pattern, attribute_id_list, &query->channel));
+    query->cid = query->channel;
+
+    // other query keeps running
+    query_t * other = &queries[1];
+    address[5] = 1;
+    CHECK_EQUAL(0, sdp_client_query_parallel(&handle_query_event, address, service_search_pattern, attribute_id_list, &other->channel));
+    other->cid = other->channel;
+    mock_l2cap_channel_opened(other->cid, L2CAP_MTU);
+    check_request(other);
+
+    // L2CAP_EVENT_CHANNEL_OPENED with status page timeout
+    uint8_t event[21];
+    memset(event, 0, sizeof(event));
+    event[0] = L2CAP_EVENT_CHANNEL_OPENED;
+    event[1] = sizeof(event) - 2;
+    event[2] = ERROR_CODE_PAGE_TIMEOUT;
+    little_endian_store_16(event, 13, query->cid);
+    sdp_client_packet_handler(HCI_EVENT_PACKET, query->cid, event, sizeof(event));
+    CHECK_EQUAL(1, query->complete);
+    CHECK_EQUAL(ERROR_CODE_PAGE_TIMEOUT, query->status);
+
+    // events for finished query are ignored
+    mock_l2cap_channel_closed(query->cid);
+    CHECK_EQUAL(1, query->complete);
+
+    while (other->record_list_pos < other->record_list_len){
+        send_response(other);
+        if (other->record_list_pos < other->record_list_len){
+            check_request(other);
+        }
+    }
+    mock_l2cap_channel_closed(other->cid);
+    CHECK_EQUAL(1, other->complete);
+    CHECK_EQUAL(0, other->status);
+}
+
+int main (int argc, const char * argv[]){
+    btstack_memory_init();
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
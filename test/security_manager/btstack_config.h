@@ -30,7 +30,9 @@
 #define HCI_ACL_PAYLOAD_SIZE 52
 #define HCI_INCOMING_PRE_BUFFER_SIZE 4
 
+#ifndef MAX_NR_LE_DEVICE_DB_ENTRIES
 #define MAX_NR_LE_DEVICE_DB_ENTRIES 4
+#endif
 
 #define NVM_NUM_LINK_KEYS 2
 
@@ -0,0 +1,176 @@
+/*
+ * irk_resolution_benchmark.c
+ *
+ * Resolves random private addresses against 16 to 256 bonded devices in the LE Device DB
+ * using sm_address_resolution_lookup(). The SM is connected to the HCI mock.
+ *
+ * Built with ENABLE_SOFTWARE_AES128, all IRKs are checked in a single pass and the number
+ * of resolutions per second is reported.
+ *
+ * Built without, each IRK is checked by an HCI LE Encrypt command. The number of round trips
+ * per resolution and the resulting rate for a controller round trip of 1 ms are reported.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "btstack_event.h"
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_dump.h"
+#include "ble/le_device_db.h"
+#include "ble/sm.h"
+#include "rijndael.h"
+
+void mock_init(void);
+void mock_clear_packet_buffer(void);
+void aes128_report_result(void);
+
+#define NUM_RESOLUTIONS_SOFTWARE 10000
+#define NUM_RESOLUTIONS_HCI      100
+
+// assumed duration of a HCI LE Encrypt round trip over UART
+#define HCI_ROUND_TRIP_MS 1
+
+static const int num_devices_list[] = { 16, 64, 256 };
+
+static sm_key_t irks[MAX_NR_LE_DEVICE_DB_ENTRIES];
+static btstack_packet_callback_registration_t sm_event_callback_registration;
+static int resolution_done;
+static int resolution_matched;
+
+static void sm_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    (void) channel;
+    (void) size;
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (hci_event_packet_get_type(packet)){
+        case SM_EVENT_IDENTITY_RESOLVING_SUCCEEDED:
+            resolution_done = 1;
+            resolution_matched = 1;
+            break;
+        case SM_EVENT_IDENTITY_RESOLVING_FAILED:
+            resolution_done = 1;
+            resolution_matched = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+// resolvable private address: hash = ah(irk, prand)
+static void create_resolvable_private_address(sm_key_t irk, bd_addr_t address){
+    sm_key_t r_prime;
+    sm_key_t hash;
+    uint32_t rk[RKLENGTH(KEYBITS)];
+    memset(r_prime, 0, 16);
+    r_prime[13] = 0x40 | (rand() & 0x3f);
+    r_prime[14] = rand();
+    r_prime[15] = rand();
+    int nrounds = rijndaelSetupEncrypt(rk, irk, KEYBITS);
+    rijndaelEncrypt(rk, nrounds, r_prime, hash);
+    memcpy(&address[0], &r_prime[13], 3);
+    memcpy(&address[3], &hash[13], 3);
+}
+
+static void setup_devices(int num_devices){
+    int i;
+    le_device_db_init();
+    for (i = 0; i < num_devices; i++){
+        bd_addr_t address = { 0x00, 0x1b, 0xdc, 0x00, (uint8_t) (i >> 8), (uint8_t) i };
+        int j;
+        for (j = 0; j < 16; j++){
+            irks[i][j] = rand();
+        }
+        le_device_db_add(BD_ADDR_TYPE_LE_PUBLIC, address, irks[i]);
+    }
+}
+
+// @returns number of HCI LE Encrypt round trips
+static int resolve(bd_addr_t address){
+    int round_trips = 0;
+    resolution_done = 0;
+    sm_address_resolution_lookup(BD_ADDR_TYPE_LE_RANDOM, address);
+    while (!resolution_done){
+        // deliver result of HCI LE Encrypt command
+        mock_clear_packet_buffer();
+        aes128_report_result();
+        round_trips++;
+    }
+    return round_trips;
+}
+
+static void run_benchmark(int num_devices, int matching){
+    int num_resolutions;
+#ifdef ENABLE_SOFTWARE_AES128
+    num_resolutions = NUM_RESOLUTIONS_SOFTWARE;
+#else
+    num_resolutions = NUM_RESOLUTIONS_HCI;
+#endif
+    setup_devices(num_devices);
+
+    int round_trips = 0;
+    int matches = 0;
+    struct timespec start_ts, end_ts;
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    int i;
+    for (i = 0; i < num_resolutions; i++){
+        bd_addr_t address;
+        sm_key_t unknown_irk;
+        if (matching){
+            create_resolvable_private_address(irks[rand() % num_devices], address);
+        } else {
+            memset(unknown_irk, 0x55, 16);
+            create_resolvable_private_address(unknown_irk, address);
+        }
+        round_trips += resolve(address);
+        matches += resolution_matched;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_ts);
+    double elapsed_s = (end_ts.tv_sec - start_ts.tv_sec) + (end_ts.tv_nsec - start_ts.tv_nsec) / 1000000000.0;
+
+    if (matches != (matching ? num_resolutions : 0)){
+        printf("unexpected result: %u of %u addresses resolved\n", matches, num_resolutions);
+        exit(1);
+    }
+
+#ifdef ENABLE_SOFTWARE_AES128
+    UNUSED(round_trips);
+    printf("%4u devices, %-8s %10.0f resolutions/s\n", num_devices, matching ? "bonded" : "unknown", num_resolutions / elapsed_s);
+#else
+    UNUSED(elapsed_s);
+    double round_trips_per_resolution = (double) round_trips / num_resolutions;
+    printf("%4u devices, %-8s %6.1f LE Encrypt round trips/resolution, %8.1f resolutions/s at %u ms/round trip\n",
+        num_devices, matching ? "bonded" : "unknown", round_trips_per_resolution,
+        1000.0 / (round_trips_per_resolution * HCI_ROUND_TRIP_MS), HCI_ROUND_TRIP_MS);
+#endif
+}
+
+int main(void){
+    btstack_memory_init();
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+    mock_init();
+
+    sm_init();
+    sm_event_callback_registration.callback = &sm_packet_handler;
+    sm_add_event_handler(&sm_event_callback_registration);
+
+#ifdef ENABLE_SOFTWARE_AES128
+    printf("Software AES128, batched IRK resolution\n");
+#else
+    printf("HCI LE Encrypt, one IRK per command\n");
+#endif
+
+    unsigned int i;
+    for (i = 0; i < sizeof(num_devices_list) / sizeof(int); i++){
+        run_benchmark(num_devices_list[i], 1);
+        run_benchmark(num_devices_list[i], 0);
+    }
+    return 0;
+}
@@ -13,26 +13,81 @@
 static btstack_packet_handler_t le_data_handler;
 static btstack_packet_handler_t event_packet_handler;
 
-static uint8_t packet_buffer[256];
-static uint16_t packet_buffer_len = 0;
+#define MOCK_MAX_CONNECTIONS 4
+#define MOCK_MAX_PACKETS     8
+
+// outgoing packets are queued, packet_buffer points to the next free slot
+static uint8_t packet_queue[MOCK_MAX_PACKETS][256];
+static uint8_t packet_queue_type[MOCK_MAX_PACKETS];
+static uint16_t packet_queue_len[MOCK_MAX_PACKETS];
+static int packet_queue_count;
+static uint8_t * packet_buffer = packet_queue[0];
 
 static uint8_t aes128_cyphertext[16];
 
-static hci_connection_t  the_connection;
+// can send now requested while packets are queued
+static uint16_t can_send_now_pending_cid;
+
+// connection handle 0x40 + index
+static hci_connection_t  mock_connections[MOCK_MAX_CONNECTIONS];
 static btstack_linked_list_t     connections;
 
 void mock_init(void){
-	the_connection.item.next = NULL;
-	connections = (btstack_linked_item*) &the_connection;
+	mock_connections[0].item.next = NULL;
+	mock_connections[0].con_handle = 0x40;
+	connections = (btstack_linked_item*) &mock_connections[0];
+}
+
+// add connection with handle 0x40 + index
+void mock_add_connection(int index){
+	mock_connections[index].con_handle = 0x40 + index;
+	btstack_linked_list_add_tail(&connections, (btstack_linked_item_t *) &mock_connections[index]);
+}
+
+// commit packet in packet_buffer
+static void mock_queue_packet(uint8_t packet_type, uint16_t len){
+	packet_queue_type[packet_queue_count] = packet_type;
+	packet_queue_len[packet_queue_count] = len;
+	if (packet_queue_count < MOCK_MAX_PACKETS - 1){
+		packet_queue_count++;
+	}
+	packet_buffer = packet_queue[packet_queue_count];
 }
 
+// oldest queued packet
 uint8_t * mock_packet_buffer(void){
-	return packet_buffer;
+	return packet_queue[0];
 }
 
+uint16_t mock_packet_buffer_len(void){
+	return packet_queue_count ? packet_queue_len[0] : 0;
+}
+
+uint8_t mock_packet_buffer_type(void){
+	return packet_queue_type[0];
+}
+
+static void mock_emit_can_send_now(uint16_t cid){
+    uint8_t event[] = { L2CAP_EVENT_CAN_SEND_NOW, 2, 0, 0};
+    little_endian_store_16(event, 2, cid);
+    le_data_handler(HCI_EVENT_PACKET, 0, event, sizeof(event));
+}
+
+// drop oldest queued packet
 void mock_clear_packet_buffer(void){
-	packet_buffer_len = 0;
-	memset(packet_buffer, 0, sizeof(packet_buffer));
+	if (packet_queue_count){
+		packet_queue_count--;
+		memmove(&packet_queue[0], &packet_queue[1], packet_queue_count * sizeof(packet_queue[0]));
+		memmove(&packet_queue_type[0], &packet_queue_type[1], packet_queue_count * sizeof(packet_queue_type[0]));
+		memmove(&packet_queue_len[0], &packet_queue_len[1], packet_queue_count * sizeof(packet_queue_len[0]));
+	}
+	memset(packet_queue[packet_queue_count], 0, sizeof(packet_queue[0]));
+	packet_buffer = packet_queue[packet_queue_count];
+	if (packet_queue_count == 0 && can_send_now_pending_cid){
+		uint16_t cid = can_send_now_pending_cid;
+		can_send_now_pending_cid = 0;
+		mock_emit_can_send_now(cid);
+	}
 }
 
 static void dump_packet(int packet_type, uint8_t * buffer, uint16_t size){
@@ -74,9 +129,8 @@ void aes128_report_result(void){
 	mock_simulate_hci_event(&le_enc_result[0], sizeof(le_enc_result));
 }
 
-void mock_simulate_sm_data_packet(uint8_t * packet, uint16_t len){
+void mock_simulate_sm_data_packet_for_handle(hci_con_handle_t handle, uint8_t * packet, uint16_t len){
 
-	uint16_t handle = 0x40;
 	uint16_t cid = 0x06;
 
 	uint8_t acl_buffer[len + 8];
@@ -96,6 +150,10 @@ void mock_simulate_sm_data_packet(uint8_t * packet, uint16_t len){
 	le_data_handler(SM_DATA_PACKET, handle, packet, len);
 }
 
+void mock_simulate_sm_data_packet(uint8_t * packet, uint16_t len){
+	mock_simulate_sm_data_packet_for_handle(0x40, packet, len);
+}
+
 void mock_simulate_command_complete(const hci_cmd_t *cmd){
 	uint8_t packet[] = {HCI_EVENT_COMMAND_COMPLETE, 4, 1, (uint8_t) cmd->opcode & 0xff, (uint8_t) cmd->opcode >> 8, 0};
 	mock_simulate_hci_event((uint8_t *)&packet, sizeof(packet));
@@ -111,6 +169,25 @@ void mock_simulate_connected(void){
 	mock_simulate_hci_event((uint8_t *)&packet, sizeof(packet));
 }
 
+void mock_simulate_disconnected(void){
+    uint8_t packet[] = { HCI_EVENT_DISCONNECTION_COMPLETE, 0x04, 0x00, 0x40, 0x00, 0x13};
+	mock_simulate_hci_event((uint8_t *)&packet, sizeof(packet));
+}
+
+// LE Connection Complete as slave for handle from peer with public address
+void mock_simulate_connected_with_handle(hci_con_handle_t handle, bd_addr_t addr){
+    uint8_t packet[] = { 0x3e, 0x13, 0x01, 0x00, 0x40, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x00, 0x00, 0x00, 0x48, 0x00, 0x05};
+    little_endian_store_16(packet, 4, handle);
+    reverse_bd_addr(addr, &packet[8]);
+	mock_simulate_hci_event((uint8_t *)&packet, sizeof(packet));
+}
+
+void mock_simulate_disconnected_with_handle(hci_con_handle_t handle){
+    uint8_t packet[] = { HCI_EVENT_DISCONNECTION_COMPLETE, 0x04, 0x00, 0x40, 0x00, 0x13};
+    little_endian_store_16(packet, 3, handle);
+	mock_simulate_hci_event((uint8_t *)&packet, sizeof(packet));
+}
+
 void att_init_connection(att_connection_t * att_connection){
     att_connection->mtu = 23;
     att_connection->encryption_key_size = 0;
@@ -132,10 +209,12 @@ int hci_can_send_packet_now_using_packet_buffer(uint8_t packet_type){
 }
 
 hci_connection_t * hci_connection_for_bd_addr_and_type(bd_addr_t addr, bd_addr_type_t addr_type){
-	return &the_connection;
+	return &mock_connections[0];
 }
 hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle){
-	return &the_connection;
+	int index = con_handle - 0x40;
+	if (index > 0 && index < MOCK_MAX_CONNECTIONS) return &mock_connections[index];
+	return &mock_connections[0];
 }
 void hci_connections_get_iterator(btstack_linked_list_iterator_t *it){
     btstack_linked_list_iterator_init(it, &connections);
@@ -160,18 +239,19 @@ void hci_le_set_own_address_type(uint8_t own_address){
 }
 
 extern "C" void l2cap_request_can_send_fix_channel_now_event(hci_con_handle_t con_handle, uint16_t cid){
-	if (packet_buffer_len) return;
-    uint8_t event[] = { L2CAP_EVENT_CAN_SEND_NOW, 2, 0, 0};
-    little_endian_store_16(event, 2, cid);
-    le_data_handler(HCI_EVENT_PACKET, 0, event, sizeof(event));
+	if (packet_queue_count) {
+		can_send_now_pending_cid = cid;
+		return;
+	}
+	mock_emit_can_send_now(cid);
 }
 
 int  l2cap_can_send_connectionless_packet_now(void){
-	return packet_buffer_len == 0;
+	return packet_queue_count == 0;
 }
 
 int  l2cap_can_send_fixed_channel_packet_now(uint16_t handle, uint16_t channel_id){
-	return packet_buffer_len == 0;
+	return packet_queue_count == 0;
 }
 
 int hci_send_cmd(const hci_cmd_t *cmd, ...){
@@ -181,7 +261,6 @@ int hci_send_cmd(const hci_cmd_t *cmd, ...){
     va_end(argptr);
 	hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, packet_buffer, len);
 	dump_packet(HCI_COMMAND_DATA_PACKET, packet_buffer, len);
-	packet_buffer_len = len;
 
 	// track le encrypt and le rand
 	if (cmd->opcode ==  hci_le_encrypt.opcode){
@@ -199,6 +278,7 @@ int hci_send_cmd(const hci_cmd_t *cmd, ...){
 	    // printf("le_encrypt res ");
 	    // hexdump(aes128_cyphertext, 16);
 	}
+	mock_queue_packet(HCI_COMMAND_DATA_PACKET, len);
 	return 0;
 }
 
@@ -210,6 +290,12 @@ void hci_add_event_handler(btstack_packet_callback_registration_t * callback_han
 	event_packet_handler = callback_handler->callback;
 }
 
+void hci_add_event_handler_for_events(btstack_packet_callback_registration_t * callback_handler, const uint8_t * event_codes, const uint8_t * le_subevent_codes){
+	UNUSED(event_codes);
+	UNUSED(le_subevent_codes);
+	hci_add_event_handler(callback_handler);
+}
+
 int l2cap_reserve_packet_buffer(void){
 	printf("l2cap_reserve_packet_buffer\n");
 	return 1;
@@ -238,7 +324,7 @@ int l2cap_send_connectionless(uint16_t handle, uint16_t cid, uint8_t * buffer, u
 	hci_dump_packet(HCI_ACL_DATA_PACKET, 0, &packet_buffer[0], len + 8);
 
 	dump_packet(HCI_ACL_DATA_PACKET, packet_buffer, len + 8);
-	packet_buffer_len = len + 8;
+	mock_queue_packet(HCI_ACL_DATA_PACKET, len + 8);
 
 	return 0;
 }
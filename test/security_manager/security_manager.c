@@ -117,6 +117,7 @@ void aes128_report_result(void);
 void mock_simulate_sm_data_packet(uint8_t * packet, uint16_t size);
 void mock_simulate_command_complete(const hci_cmd_t *cmd);
 void mock_simulate_connected(void);
+void mock_simulate_disconnected(void);
 uint8_t * mock_packet_buffer(void);
 uint16_t mock_packet_buffer_len(void);
 void mock_clear_packet_buffer(void);
@@ -289,6 +290,49 @@ TEST(SecurityManager, CMACTest){
     VALIDATE_MESSAGE(m64);
 }
 
+TEST(SecurityManager, UnexpectedPduWithoutSetupContext){
+
+    mock_init();
+    mock_simulate_hci_state_working();
+
+    // expect le encrypt commmand
+    CHECK_HCI_COMMAND(test_command_packet_01);
+
+    aes128_report_result();
+
+    // expect le encrypt commmand
+    CHECK_HCI_COMMAND(test_command_packet_02);
+
+    aes128_report_result();
+    mock_clear_packet_buffer();
+
+    // reset shared mock connection, other tests may leave it in a pairing state
+    mock_simulate_disconnected();
+    mock_clear_packet_buffer();
+
+    mock_simulate_connected();
+
+    CHECK_HCI_COMMAND(test_command_packet_02a);
+    aes128_report_result();
+
+    CHECK_HCI_COMMAND(test_command_packet_02a);
+    aes128_report_result();
+
+    CHECK_HCI_COMMAND(test_command_packet_02a);
+    aes128_report_result();
+
+    CHECK_HCI_COMMAND(test_command_packet_02a);
+    aes128_report_result();
+
+    // pairing confirm without pairing request, connection does not own a setup context
+    uint8_t test_pairing_confirm_command[] = { 0x03, 0x84, 0x5a, 0x87, 0x9a, 0x0f, 0xa9, 0x42, 0xba, 0x48, 0xc5, 0x79, 0xa0, 0x70, 0x70, 0xa9, 0xc8 };
+    mock_simulate_sm_data_packet(&test_pairing_confirm_command[0], sizeof(test_pairing_confirm_command));
+
+    // expect send pairing failed command, reason unspecified
+    uint8_t test_acl_packet_pairing_failed[] = { 0x40, 0x00, 0x06, 0x00, 0x02, 0x00, 0x06, 0x00, 0x05, 0x08 };
+    CHECK_ACL_PACKET(test_acl_packet_pairing_failed);
+}
+
 TEST(SecurityManager, MainTest){
 
     mock_init();
@@ -0,0 +1,263 @@
+// *****************************************************************************
+//
+// concurrent pairing test
+//
+// SM with MAX_NR_SM_SETUP_CONTEXTS=2 as responder on three connections. Two LE Legacy Just Works
+// pairings run interleaved on the shared LE Rand and LE Encrypt engines. The confirm values are
+// verified against c1 calculated here, which fails if a result is delivered to the wrong connection.
+// The third pairing waits until a setup context is released.
+//
+// *****************************************************************************
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "btstack_run_loop_posix.h"
+
+#include "hci_cmd.h"
+#include "btstack_util.h"
+
+#include "btstack_memory.h"
+#include "hci.h"
+#include "hci_dump.h"
+#include "l2cap.h"
+#include "ble/sm.h"
+
+#define NUM_CONNECTIONS 3
+
+// mock.c
+void mock_init(void);
+void mock_add_connection(int index);
+void mock_simulate_hci_state_working(void);
+void mock_simulate_hci_event(uint8_t * packet, uint16_t size);
+void mock_simulate_connected_with_handle(hci_con_handle_t handle, bd_addr_t addr);
+void mock_simulate_disconnected_with_handle(hci_con_handle_t handle);
+void mock_simulate_sm_data_packet_for_handle(hci_con_handle_t handle, uint8_t * packet, uint16_t size);
+void aes128_report_result(void);
+void aes128_calc_cyphertext(uint8_t key[16], uint8_t plaintext[16], uint8_t cyphertext[16]);
+uint8_t * mock_packet_buffer(void);
+uint16_t mock_packet_buffer_len(void);
+uint8_t mock_packet_buffer_type(void);
+void mock_clear_packet_buffer(void);
+void gap_le_get_own_address(uint8_t * addr_type, bd_addr_t addr);
+
+static btstack_packet_callback_registration_t sm_event_callback_registration;
+
+static bd_addr_t peer_addr[NUM_CONNECTIONS] = {
+    { 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6 },
+    { 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6 },
+    { 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6 },
+};
+
+// different IO Capabilities, all result in Just Works
+static uint8_t pairing_request[NUM_CONNECTIONS][7] = {
+    { 0x01, 0x04, 0x00, 0x01, 0x10, 0x07, 0x07 },
+    { 0x01, 0x03, 0x00, 0x01, 0x10, 0x07, 0x07 },
+    { 0x01, 0x00, 0x00, 0x01, 0x10, 0x07, 0x07 },
+};
+
+// Pairing Response sent by SM
+static uint8_t pairing_response[NUM_CONNECTIONS][7];
+
+// last SM PDU sent per connection and number of crypto operations before it was sent
+static uint8_t sm_pdu[NUM_CONNECTIONS][32];
+static int     sm_pdu_count[NUM_CONNECTIONS];
+static int     sm_pdu_crypto_ops[NUM_CONNECTIONS];
+static int     crypto_ops;
+static uint8_t random_counter;
+
+static void app_packet_handler (uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (packet[0] != SM_EVENT_JUST_WORKS_REQUEST) return;
+    sm_just_works_confirm(little_endian_read_16(packet, 2));
+}
+
+static hci_con_handle_t handle_for_index(int index){
+    return 0x40 + index;
+}
+
+// answer LE Rand and LE Encrypt in order and collect SM PDUs until no packets are left
+static void process_packets(void){
+    while (mock_packet_buffer_len()){
+        uint8_t packet[256];
+        uint16_t len = mock_packet_buffer_len();
+        uint8_t packet_type = mock_packet_buffer_type();
+        memcpy(packet, mock_packet_buffer(), len);
+        mock_clear_packet_buffer();
+
+        if (packet_type == HCI_ACL_DATA_PACKET){
+            int index = (little_endian_read_16(packet, 0) & 0x0fff) - 0x40;
+            CHECK(index >= 0 && index < NUM_CONNECTIONS);
+            memcpy(sm_pdu[index], &packet[8], len - 8);
+            sm_pdu_count[index]++;
+            sm_pdu_crypto_ops[index] = crypto_ops;
+            continue;
+        }
+
+        uint16_t opcode = little_endian_read_16(packet, 0);
+        if (opcode == hci_le_encrypt.opcode){
+            crypto_ops++;
+            aes128_report_result();
+        } else if (opcode == hci_le_rand.opcode){
+            crypto_ops++;
+            uint8_t rand_event[] = { 0x0e, 0x0c, 0x01, 0x18, 0x20, 0x00, 0, 0, 0, 0, 0, 0, 0, 0 };
+            int i;
+            for (i = 0; i < 8; i++){
+                rand_event[6 + i] = random_counter++;
+            }
+            mock_simulate_hci_event(rand_event, sizeof(rand_event));
+        }
+    }
+}
+
+// c1 for LE Legacy Pairing with TK = 0, responder with public address. Keys in big endian as used by sm.c
+static void calc_c1(int index, const sm_key_t r, sm_key_t c1){
+    const uint8_t * preq = pairing_request[index];
+    const uint8_t * pres = pairing_response[index];
+    sm_key_t tk;
+    memset(tk, 0, 16);
+    uint8_t  local_addr_type;
+    bd_addr_t local_addr;
+    gap_le_get_own_address(&local_addr_type, local_addr);
+
+    // p1 = pres || preq || rat || iat
+    sm_key_t p1;
+    reverse_56(pres, &p1[0]);
+    reverse_56(preq, &p1[7]);
+    p1[14] = local_addr_type;
+    p1[15] = 0;
+
+    // p2 = padding || ia || ra
+    sm_key_t p2;
+    memset(p2, 0, 16);
+    memcpy(&p2[4],  peer_addr[index], 6);
+    memcpy(&p2[10], local_addr, 6);
+
+    sm_key_t t1, t2, t3;
+    int i;
+    for (i = 0; i < 16; i++){
+        t1[i] = r[i] ^ p1[i];
+    }
+    aes128_calc_cyphertext(tk, t1, t2);
+    for (i = 0; i < 16; i++){
+        t3[i] = t2[i] ^ p2[i];
+    }
+    aes128_calc_cyphertext(tk, t3, c1);
+}
+
+static void send_pairing_request(int index){
+    mock_simulate_sm_data_packet_for_handle(handle_for_index(index), pairing_request[index], sizeof(pairing_request[index]));
+}
+
+// send Pairing Confirm (opcode 0x03) or Pairing Random (opcode 0x04) with value in big endian
+static void send_key_pdu(int index, uint8_t opcode, const sm_key_t key){
+    uint8_t pdu[17];
+    pdu[0] = opcode;
+    reverse_128(key, &pdu[1]);
+    mock_simulate_sm_data_packet_for_handle(handle_for_index(index), pdu, sizeof(pdu));
+}
+
+static void peer_random(int index, sm_key_t mrand){
+    int i;
+    for (i = 0; i < 16; i++){
+        mrand[i] = (uint8_t) (0x10 * (index + 1) + i);
+    }
+}
+
+TEST_GROUP(ConcurrentPairing){
+    void setup(void){
+        btstack_memory_init();
+        btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+        sm_init();
+        sm_set_io_capabilities(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+        sm_set_authentication_requirements(SM_AUTHREQ_BONDING);
+        sm_event_callback_registration.callback = &app_packet_handler;
+        sm_add_event_handler(&sm_event_callback_registration);
+
+        memset(sm_pdu_count, 0, sizeof(sm_pdu_count));
+        crypto_ops = 0;
+        random_counter = 0;
+        mock_init();
+        int i;
+        for (i = 1; i < NUM_CONNECTIONS; i++){
+            mock_add_connection(i);
+        }
+        mock_simulate_hci_state_working();
+        process_packets();
+        for (i = 0; i < NUM_CONNECTIONS; i++){
+            mock_simulate_connected_with_handle(handle_for_index(i), peer_addr[i]);
+            process_packets();
+        }
+    }
+};
+
+TEST(ConcurrentPairing, TwoPairingsAndThirdWaits){
+    int i;
+
+    // two connections get a setup context, third one waits
+    for (i = 0; i < NUM_CONNECTIONS; i++){
+        send_pairing_request(i);
+        process_packets();
+    }
+    for (i = 0; i < 2; i++){
+        CHECK_EQUAL(1, sm_pdu_count[i]);
+        CHECK_EQUAL(SM_CODE_PAIRING_RESPONSE, sm_pdu[i][0]);
+        memcpy(pairing_response[i], sm_pdu[i], 7);
+    }
+    CHECK_EQUAL(0, sm_pdu_count[2]);
+
+    // Pairing Confirm from both initiators before any crypto result is available
+    sm_key_t mrand[2];
+    for (i = 0; i < 2; i++){
+        sm_key_t mconfirm;
+        peer_random(i, mrand[i]);
+        calc_c1(i, mrand[i], mconfirm);
+        send_key_pdu(i, SM_CODE_PAIRING_CONFIRM, mconfirm);
+    }
+    crypto_ops = 0;
+    process_packets();
+
+    // each confirm needs 2 x LE Rand and 2 x LE Encrypt, calculations have been interleaved
+    sm_key_t sconfirm[2];
+    for (i = 0; i < 2; i++){
+        CHECK_EQUAL(2, sm_pdu_count[i]);
+        CHECK_EQUAL(SM_CODE_PAIRING_CONFIRM, sm_pdu[i][0]);
+        CHECK(sm_pdu_crypto_ops[i] > 4);
+        reverse_128(&sm_pdu[i][1], sconfirm[i]);
+    }
+    CHECK_EQUAL(8, crypto_ops);
+
+    // Pairing Random from both initiators, SM verifies their confirm values and sends its random
+    for (i = 0; i < 2; i++){
+        send_key_pdu(i, SM_CODE_PAIRING_RANDOM, mrand[i]);
+    }
+    process_packets();
+    for (i = 0; i < 2; i++){
+        CHECK_EQUAL(3, sm_pdu_count[i]);
+        CHECK_EQUAL(SM_CODE_PAIRING_RANDOM, sm_pdu[i][0]);
+        // confirm value sent before matches random of this connection
+        sm_key_t srand;
+        sm_key_t c1;
+        reverse_128(&sm_pdu[i][1], srand);
+        calc_c1(i, srand, c1);
+        MEMCMP_EQUAL(sconfirm[i], c1, 16);
+    }
+    CHECK_EQUAL(0, sm_pdu_count[2]);
+
+    // third connection continues after first one disconnected
+    mock_simulate_disconnected_with_handle(handle_for_index(0));
+    process_packets();
+    CHECK_EQUAL(1, sm_pdu_count[2]);
+    CHECK_EQUAL(SM_CODE_PAIRING_RESPONSE, sm_pdu[2][0]);
+    CHECK_EQUAL(3, sm_pdu_count[1]);
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
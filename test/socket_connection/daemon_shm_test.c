@@ -0,0 +1,349 @@
+/*
+ * daemon_shm_test.c
+ *
+ * Checks the shared memory data path between daemon and client: packets pass both rings in order
+ * across the end of the ring, doorbells are only signaled when the consumer might sleep or the
+ * producer waits for space, a corrupted ring is not read beyond its bounds, and the memory and
+ * doorbells created by the daemon reach the client as file descriptors passed along with an event
+ * over the unix domain socket of socket_connection. A minimal run loop records data sources.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "btstack_client.h"
+#include "btstack_defines.h"
+#include "btstack_linked_list.h"
+#include "btstack_run_loop.h"
+#include "btstack_util.h"
+#include "daemon_shm.h"
+#include "socket_connection.h"
+
+// run loop that only records data sources
+static btstack_linked_list_t data_sources;
+
+static void mock_run_loop_init(void){
+    data_sources = NULL;
+}
+
+static void mock_run_loop_add_data_source(btstack_data_source_t * ds){
+    btstack_linked_list_add_tail(&data_sources, (btstack_linked_item_t *) ds);
+}
+
+static int mock_run_loop_remove_data_source(btstack_data_source_t * ds){
+    return btstack_linked_list_remove(&data_sources, (btstack_linked_item_t *) ds);
+}
+
+static void mock_run_loop_enable_data_source_callbacks(btstack_data_source_t * ds, uint16_t callbacks){
+    ds->flags |= callbacks;
+}
+
+static void mock_run_loop_disable_data_source_callbacks(btstack_data_source_t * ds, uint16_t callbacks){
+    ds->flags &= ~callbacks;
+}
+
+static const btstack_run_loop_t mock_run_loop = {
+    &mock_run_loop_init,
+    &mock_run_loop_add_data_source,
+    &mock_run_loop_remove_data_source,
+    &mock_run_loop_enable_data_source_callbacks,
+    &mock_run_loop_disable_data_source_callbacks,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+
+static btstack_data_source_t * last_data_source(void){
+    btstack_linked_item_t * it = (btstack_linked_item_t *) data_sources;
+    while (it && it->next) it = it->next;
+    return (btstack_data_source_t *) it;
+}
+
+static int doorbell_signaled(daemon_shm_t * shm){
+    struct pollfd pfd;
+    pfd.fd = shm->ds.fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 1;
+}
+
+static uint64_t doorbell_read(daemon_shm_t * shm){
+    uint64_t value = 0;
+    if (read(shm->ds.fd, &value, sizeof(value)) != sizeof(value)) return 0;
+    return value;
+}
+
+static int num_daemon_doorbells;
+static int num_client_doorbells;
+
+static void daemon_handler(daemon_shm_t * shm){
+    num_daemon_doorbells++;
+}
+
+static void client_handler(daemon_shm_t * shm){
+    num_client_doorbells++;
+}
+
+static void fill_packet(uint8_t * packet, uint16_t size, uint32_t counter){
+    int i;
+    for (i = 0; i < size; i++){
+        packet[i] = (uint8_t) (counter + i);
+    }
+}
+
+static void check_packet(daemon_shm_t * shm, uint16_t expected_size, uint32_t counter){
+    uint16_t type;
+    uint16_t channel;
+    uint16_t size;
+    uint8_t expected[1100];
+    uint8_t * data = daemon_shm_peek_packet(shm, &type, &channel, &size);
+    CHECK(data != NULL);
+    CHECK_EQUAL(L2CAP_DATA_PACKET, type);
+    CHECK_EQUAL(0x0040, channel);
+    CHECK_EQUAL(expected_size, size);
+    fill_packet(expected, size, counter);
+    MEMCMP_EQUAL(expected, data, size);
+    daemon_shm_consume_packet(shm);
+}
+
+static daemon_shm_t daemon_shm;
+static daemon_shm_t client_shm;
+
+TEST_GROUP(DaemonShm){
+    void setup(void){
+        data_sources = NULL;
+        num_daemon_doorbells = 0;
+        num_client_doorbells = 0;
+        CHECK_EQUAL(0, daemon_shm_create(&daemon_shm, 0, &daemon_handler));
+        int fds[DAEMON_SHM_NUM_FDS];
+        daemon_shm_get_fds(&daemon_shm, fds);
+        int i;
+        for (i = 0; i < DAEMON_SHM_NUM_FDS; i++){
+            fds[i] = dup(fds[i]);
+        }
+        CHECK_EQUAL(0, daemon_shm_attach(&client_shm, fds, &client_handler));
+    }
+    void teardown(void){
+        daemon_shm_close(&client_shm);
+        daemon_shm_close(&daemon_shm);
+        CHECK(data_sources == NULL);
+    }
+};
+
+TEST(DaemonShm, DefaultRingSize){
+    CHECK_EQUAL(DAEMON_SHM_RING_SIZE, daemon_shm_get_ring_size(&daemon_shm));
+    CHECK_EQUAL(DAEMON_SHM_RING_SIZE, daemon_shm_get_ring_size(&client_shm));
+    CHECK_EQUAL(2, btstack_linked_list_count(&data_sources));
+}
+
+TEST(DaemonShm, PacketsInOrderAcrossRingEnd){
+    uint8_t packet[1100];
+    uint32_t send_counter = 0;
+    uint32_t receive_counter = 0;
+    uint32_t bytes = 0;
+    // sizes that are not multiples of the record alignment, two packets in flight
+    while (bytes < 3 * DAEMON_SHM_RING_SIZE){
+        uint16_t size = 1 + (send_counter * 37) % 1021;
+        fill_packet(packet, size, send_counter);
+        CHECK_EQUAL(0, daemon_shm_send_packet(&client_shm, L2CAP_DATA_PACKET, 0x0040, packet, size));
+        send_counter++;
+        bytes += size;
+        if (send_counter - receive_counter == 2){
+            check_packet(&daemon_shm, 1 + (receive_counter * 37) % 1021, receive_counter);
+            receive_counter++;
+        }
+    }
+    while (receive_counter < send_counter){
+        check_packet(&daemon_shm, 1 + (receive_counter * 37) % 1021, receive_counter);
+        receive_counter++;
+    }
+    uint16_t type, channel, size;
+    CHECK(daemon_shm_peek_packet(&daemon_shm, &type, &channel, &size) == NULL);
+}
+
+TEST(DaemonShm, BothDirections){
+    uint8_t packet[100];
+    fill_packet(packet, sizeof(packet), 1);
+    CHECK_EQUAL(0, daemon_shm_send_packet(&daemon_shm, L2CAP_DATA_PACKET, 0x0040, packet, sizeof(packet)));
+    fill_packet(packet, sizeof(packet), 2);
+    CHECK_EQUAL(0, daemon_shm_send_packet(&client_shm, L2CAP_DATA_PACKET, 0x0040, packet, sizeof(packet)));
+    check_packet(&client_shm, sizeof(packet), 1);
+    check_packet(&daemon_shm, sizeof(packet), 2);
+}
+
+TEST(DaemonShm, DoorbellOnlyForEmptyRing){
+    uint8_t packet[100];
+    memset(packet, 0, sizeof(packet));
+    int i;
+    for (i = 0; i < 10; i++){
+        CHECK_EQUAL(0, daemon_shm_send_packet(&client_shm, L2CAP_DATA_PACKET, 0x0040, packet, sizeof(packet)));
+    }
+    CHECK_EQUAL(1, doorbell_read(&daemon_shm));
+    CHECK_EQUAL(0, doorbell_signaled(&client_shm));
+
+    // consumer did not catch up yet, no doorbell
+    uint16_t type, channel, size;
+    CHECK(daemon_shm_peek_packet(&daemon_shm, &type, &channel, &size) != NULL);
+    daemon_shm_consume_packet(&daemon_shm);
+    CHECK_EQUAL(0, daemon_shm_send_packet(&client_shm, L2CAP_DATA_PACKET, 0x0040, packet, sizeof(packet)));
+    CHECK_EQUAL(0, doorbell_signaled(&daemon_shm));
+
+    // consumer drained ring, next packet signals doorbell again
+    while (daemon_shm_peek_packet(&daemon_shm, &type, &channel, &size)){
+        daemon_shm_consume_packet(&daemon_shm);
+    }
+    CHECK_EQUAL(0, daemon_shm_send_packet(&client_shm, L2CAP_DATA_PACKET, 0x0040, packet, sizeof(packet)));
+    CHECK_EQUAL(1, doorbell_read(&daemon_shm));
+}
+
+TEST(DaemonShm, DoorbellCallsHandler){
+    uint8_t packet[10];
+    memset(packet, 0, sizeof(packet));
+    CHECK_EQUAL(0, daemon_shm_send_packet(&daemon_shm, RFCOMM_DATA_PACKET, 0x0001, packet, sizeof(packet)));
+    CHECK(client_shm.ds.flags & DATA_SOURCE_CALLBACK_READ);
+    client_shm.ds.process(&client_shm.ds, DATA_SOURCE_CALLBACK_READ);
+    CHECK_EQUAL(1, num_client_doorbells);
+    CHECK_EQUAL(0, num_daemon_doorbells);
+    CHECK_EQUAL(0, doorbell_signaled(&client_shm));
+}
+
+TEST(DaemonShm, FullRingWakesProducer){
+    uint8_t packet[1000];
+    memset(packet, 0, sizeof(packet));
+    int num_packets = 0;
+    while (daemon_shm_send_packet(&client_shm, L2CAP_DATA_PACKET, 0x0040, packet, sizeof(packet)) == 0){
+        num_packets++;
+    }
+    CHECK_EQUAL(DAEMON_SHM_RING_SIZE / 1008, num_packets);
+    CHECK_EQUAL(0, doorbell_signaled(&client_shm));
+
+    // blocking send gives up
+    CHECK_EQUAL(-1, daemon_shm_send_packet_blocking(&client_shm, L2CAP_DATA_PACKET, 0x0040, packet, sizeof(packet), 10));
+
+    // space freed
+    uint16_t type, channel, size;
+    CHECK(daemon_shm_peek_packet(&daemon_shm, &type, &channel, &size) != NULL);
+    daemon_shm_consume_packet(&daemon_shm);
+    CHECK_EQUAL(1, doorbell_signaled(&client_shm));
+    CHECK_EQUAL(0, daemon_shm_send_packet_blocking(&client_shm, L2CAP_DATA_PACKET, 0x0040, packet, sizeof(packet), 10));
+    // doorbell stays set for run loop
+    CHECK_EQUAL(1, doorbell_signaled(&client_shm));
+}
+
+TEST(DaemonShm, CorruptedRingNotRead){
+    uint8_t packet[100];
+    memset(packet, 0, sizeof(packet));
+    CHECK_EQUAL(0, daemon_shm_send_packet(&client_shm, L2CAP_DATA_PACKET, 0x0040, packet, sizeof(packet)));
+    uint16_t type, channel, size;
+
+    // record longer than data in ring
+    little_endian_store_16(client_shm.tx.data, 4, 0xffff);
+    CHECK(daemon_shm_peek_packet(&daemon_shm, &type, &channel, &size) == NULL);
+    little_endian_store_16(client_shm.tx.data, 4, sizeof(packet));
+
+    // head beyond ring size
+    client_shm.tx.header->head = DAEMON_SHM_RING_SIZE + 8;
+    CHECK(daemon_shm_peek_packet(&daemon_shm, &type, &channel, &size) == NULL);
+
+    // unaligned head
+    client_shm.tx.header->head = 13;
+    CHECK(daemon_shm_peek_packet(&daemon_shm, &type, &channel, &size) == NULL);
+
+    // producer keeps own head
+    client_shm.tx.header->head = 0;
+    CHECK_EQUAL(0, daemon_shm_send_packet(&client_shm, L2CAP_DATA_PACKET, 0x0040, packet, sizeof(packet)));
+    CHECK(daemon_shm_peek_packet(&daemon_shm, &type, &channel, &size) != NULL);
+    CHECK_EQUAL(sizeof(packet), size);
+}
+
+// shared memory set up over socket connection
+static connection_t * daemon_connection;
+static connection_t * client_connection;
+static int received_status;
+static int attach_err;
+
+static int packet_handler(connection_t *connection, uint16_t packet_type, uint16_t channel, uint8_t *data, uint16_t length){
+    if (packet_type == DAEMON_EVENT_PACKET){
+        if (data[0] == DAEMON_EVENT_CONNECTION_OPENED){
+            daemon_connection = connection;
+        }
+        return 0;
+    }
+    if (packet_type == HCI_EVENT_PACKET && data[0] == DAEMON_EVENT_SHARED_MEMORY_OPENED){
+        received_status = data[2];
+        int fds[DAEMON_SHM_NUM_FDS];
+        if (socket_connection_take_received_fds(connection, fds, DAEMON_SHM_NUM_FDS) != DAEMON_SHM_NUM_FDS) return 0;
+        attach_err = daemon_shm_attach(&client_shm, fds, &client_handler);
+    }
+    return 0;
+}
+
+TEST_GROUP(DaemonShmSocket){
+    btstack_data_source_t * server_ds;
+    btstack_data_source_t * client_ds;
+
+    void setup(void){
+        data_sources = NULL;
+        daemon_connection = NULL;
+        received_status = -1;
+        attach_err = -1;
+        CHECK_EQUAL(0, socket_connection_create_unix((char *) BTSTACK_UNIX));
+        server_ds = last_data_source();
+        client_connection = socket_connection_open_unix();
+        CHECK(client_connection != NULL);
+        client_ds = last_data_source();
+        server_ds->process(server_ds, DATA_SOURCE_CALLBACK_READ);
+        CHECK(daemon_connection != NULL);
+    }
+    void teardown(void){
+        socket_connection_close_unix(client_connection);
+        close(btstack_run_loop_get_data_source_fd(server_ds));
+        unlink(BTSTACK_UNIX);
+    }
+};
+
+TEST(DaemonShmSocket, PassFileDescriptors){
+    CHECK_EQUAL(0, daemon_shm_create(&daemon_shm, 0, &daemon_handler));
+    uint8_t event[7];
+    event[0] = DAEMON_EVENT_SHARED_MEMORY_OPENED;
+    event[1] = sizeof(event) - 2;
+    event[2] = 0;
+    little_endian_store_32(event, 3, daemon_shm_get_ring_size(&daemon_shm));
+    int fds[DAEMON_SHM_NUM_FDS];
+    daemon_shm_get_fds(&daemon_shm, fds);
+    CHECK_EQUAL(0, socket_connection_send_packet_with_fds(daemon_connection, HCI_EVENT_PACKET, 0, event, sizeof(event), fds, DAEMON_SHM_NUM_FDS));
+
+    // header, then event
+    client_ds->process(client_ds, DATA_SOURCE_CALLBACK_READ);
+    client_ds->process(client_ds, DATA_SOURCE_CALLBACK_READ);
+    CHECK_EQUAL(0, received_status);
+    CHECK_EQUAL(0, attach_err);
+
+    // data goes through shared memory
+    uint8_t packet[100];
+    fill_packet(packet, sizeof(packet), 3);
+    CHECK_EQUAL(0, daemon_shm_send_packet(&client_shm, L2CAP_DATA_PACKET, 0x0040, packet, sizeof(packet)));
+    CHECK(doorbell_signaled(&daemon_shm));
+    check_packet(&daemon_shm, sizeof(packet), 3);
+
+    daemon_shm_close(&client_shm);
+    daemon_shm_close(&daemon_shm);
+}
+
+int main (int argc, const char * argv[]){
+    btstack_run_loop_init(&mock_run_loop);
+    socket_connection_init();
+    socket_connection_register_packet_callback(&packet_handler);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,322 @@
+/*
+ * socket_connection_test.c
+ *
+ * Connects raw clients to the unix domain socket of socket_connection and checks the output path
+ * of the daemon: packets go out with a single writev() while the socket accepts them, are queued
+ * and flushed by the write callback when it does not, a client whose queue grows above the high
+ * watermark is parked until it caught up, and a client that does not read at all is closed
+ * instead of blocking the run loop. A minimal run loop records data sources and their callbacks.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "btstack_defines.h"
+#include "btstack_linked_list.h"
+#include "btstack_run_loop.h"
+#include "btstack_util.h"
+#include "socket_connection.h"
+
+#define SOCKET_PATH   "/tmp/btstack_socket_connection_test"
+#define PACKET_SIZE   1000
+#define PACKET_TYPE   HCI_ACL_DATA_PACKET
+
+// count write calls
+extern "C" ssize_t __real_write(int fd, const void * buf, size_t count);
+extern "C" ssize_t __real_writev(int fd, const struct iovec * iov, int iovcnt);
+static int num_write;
+static int num_writev;
+
+extern "C" ssize_t __wrap_write(int fd, const void * buf, size_t count){
+    num_write++;
+    return __real_write(fd, buf, count);
+}
+
+extern "C" ssize_t __wrap_writev(int fd, const struct iovec * iov, int iovcnt){
+    num_writev++;
+    return __real_writev(fd, iov, iovcnt);
+}
+
+// run loop that only records data sources
+static btstack_linked_list_t data_sources;
+
+static void mock_run_loop_init(void){
+    data_sources = NULL;
+}
+
+static void mock_run_loop_add_data_source(btstack_data_source_t * ds){
+    btstack_linked_list_add_tail(&data_sources, (btstack_linked_item_t *) ds);
+}
+
+static int mock_run_loop_remove_data_source(btstack_data_source_t * ds){
+    return btstack_linked_list_remove(&data_sources, (btstack_linked_item_t *) ds);
+}
+
+static void mock_run_loop_enable_data_source_callbacks(btstack_data_source_t * ds, uint16_t callbacks){
+    ds->flags |= callbacks;
+}
+
+static void mock_run_loop_disable_data_source_callbacks(btstack_data_source_t * ds, uint16_t callbacks){
+    ds->flags &= ~callbacks;
+}
+
+static const btstack_run_loop_t mock_run_loop = {
+    &mock_run_loop_init,
+    &mock_run_loop_add_data_source,
+    &mock_run_loop_remove_data_source,
+    &mock_run_loop_enable_data_source_callbacks,
+    &mock_run_loop_disable_data_source_callbacks,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+
+// packet handler
+static connection_t * opened_connection;
+static int num_closed;
+static int num_dispatched;
+static int dispatch_err;
+
+static int packet_handler(connection_t *connection, uint16_t packet_type, uint16_t channel, uint8_t *data, uint16_t length){
+    if (packet_type == DAEMON_EVENT_PACKET){
+        switch (data[0]){
+            case DAEMON_EVENT_CONNECTION_OPENED:
+                opened_connection = connection;
+                break;
+            case DAEMON_EVENT_CONNECTION_CLOSED:
+                num_closed++;
+                break;
+            default:
+                break;
+        }
+        return 0;
+    }
+    num_dispatched++;
+    return dispatch_err;
+}
+
+static btstack_data_source_t * server_ds;
+static btstack_data_source_t * connection_ds;
+static int client_fd;
+static uint32_t next_send_counter;
+static uint32_t next_receive_counter;
+
+static int data_source_count(void){
+    return btstack_linked_list_count(&data_sources);
+}
+
+static btstack_data_source_t * last_data_source(void){
+    btstack_linked_item_t * it = (btstack_linked_item_t *) data_sources;
+    while (it && it->next) it = it->next;
+    return (btstack_data_source_t *) it;
+}
+
+static void send_counter_packet(void){
+    uint8_t packet[PACKET_SIZE];
+    memset(packet, 0x55, sizeof(packet));
+    little_endian_store_32(packet, 0, next_send_counter++);
+    socket_connection_send_packet(opened_connection, PACKET_TYPE, 0x0040, packet, sizeof(packet));
+}
+
+static void client_read_exactly(uint8_t * buffer, int len){
+    int pos = 0;
+    while (pos < len){
+        int res = read(client_fd, &buffer[pos], len - pos);
+        if (res < 0 && errno == EAGAIN){
+            CHECK(connection_ds->flags & DATA_SOURCE_CALLBACK_WRITE);
+            connection_ds->process(connection_ds, DATA_SOURCE_CALLBACK_WRITE);
+            continue;
+        }
+        CHECK(res > 0);
+        pos += res;
+    }
+}
+
+// read all packets sent so far and check they arrive complete and in order
+static void client_read_packets(void){
+    uint8_t buffer[6 + PACKET_SIZE];
+    while (next_receive_counter < next_send_counter){
+        client_read_exactly(buffer, sizeof(buffer));
+        CHECK_EQUAL(PACKET_TYPE, little_endian_read_16(buffer, 0));
+        CHECK_EQUAL(0x0040, little_endian_read_16(buffer, 2));
+        CHECK_EQUAL(PACKET_SIZE, little_endian_read_16(buffer, 4));
+        CHECK_EQUAL(next_receive_counter, little_endian_read_32(buffer, 6));
+        next_receive_counter++;
+    }
+}
+
+// send packets until they get queued
+static void fill_socket(void){
+    num_writev = 0;
+    while ((connection_ds->flags & DATA_SOURCE_CALLBACK_WRITE) == 0){
+        send_counter_packet();
+    }
+    CHECK_EQUAL(next_send_counter, (uint32_t) num_writev);
+}
+
+TEST_GROUP(SocketConnection){
+    void setup(void){
+        data_sources = NULL;
+        opened_connection = NULL;
+        num_closed = 0;
+        num_dispatched = 0;
+        dispatch_err = 0;
+        next_send_counter = 0;
+        next_receive_counter = 0;
+
+        // listen
+        CHECK_EQUAL(0, socket_connection_create_unix((char *) SOCKET_PATH));
+        server_ds = last_data_source();
+
+        // connect and accept
+        client_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, SOCKET_PATH);
+        CHECK_EQUAL(0, connect(client_fd, (struct sockaddr *) &addr, sizeof(addr)));
+        fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL, 0) | O_NONBLOCK);
+        server_ds->process(server_ds, DATA_SOURCE_CALLBACK_READ);
+        CHECK(opened_connection != NULL);
+        connection_ds = last_data_source();
+
+        // small socket buffer to get backpressure quickly
+        int size = 4096;
+        setsockopt(btstack_run_loop_get_data_source_fd(connection_ds), SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+    void teardown(void){
+        close(client_fd);
+        // let socket_connection close the connection
+        if (data_source_count() > 1){
+            connection_ds->process(connection_ds, DATA_SOURCE_CALLBACK_READ);
+        }
+        close(btstack_run_loop_get_data_source_fd(server_ds));
+        unlink(SOCKET_PATH);
+    }
+};
+
+TEST(SocketConnection, SingleWritevPerPacket){
+    num_write = 0;
+    num_writev = 0;
+    send_counter_packet();
+    send_counter_packet();
+    CHECK_EQUAL(0, num_write);
+    CHECK_EQUAL(2, num_writev);
+    CHECK_EQUAL(0, connection_ds->flags & DATA_SOURCE_CALLBACK_WRITE);
+    client_read_packets();
+}
+
+TEST(SocketConnection, QueueAndFlushWithoutBlocking){
+    fill_socket();
+    // queued packets don't trigger writes
+    num_writev = 0;
+    send_counter_packet();
+    send_counter_packet();
+    send_counter_packet();
+    CHECK_EQUAL(0, num_writev);
+    // flushed by write callback while client reads
+    client_read_packets();
+    CHECK_EQUAL(0, connection_ds->flags & DATA_SOURCE_CALLBACK_WRITE);
+    CHECK(connection_ds->flags & DATA_SOURCE_CALLBACK_READ);
+    // single writev per packet again
+    num_writev = 0;
+    send_counter_packet();
+    CHECK_EQUAL(1, num_writev);
+    client_read_packets();
+}
+
+TEST(SocketConnection, WriteCallbackCoalescesPackets){
+    fill_socket();
+    int num_queued = 8;
+    int i;
+    for (i = 0; i < num_queued; i++){
+        send_counter_packet();
+    }
+    // drain client socket buffer completely, then flush all queued packets at once
+    num_writev = 0;
+    uint8_t buffer[1024];
+    while (read(client_fd, buffer, sizeof(buffer)) > 0);
+    int size = 65536;
+    setsockopt(btstack_run_loop_get_data_source_fd(connection_ds), SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    connection_ds->process(connection_ds, DATA_SOURCE_CALLBACK_WRITE);
+    CHECK_EQUAL(1, num_writev);
+    CHECK_EQUAL(0, connection_ds->flags & DATA_SOURCE_CALLBACK_WRITE);
+}
+
+TEST(SocketConnection, SlowClientParked){
+    fill_socket();
+    // queue up to high watermark, client requests are still read
+    while (connection_ds->flags & DATA_SOURCE_CALLBACK_READ){
+        send_counter_packet();
+        CHECK_EQUAL(0, num_closed);
+    }
+    CHECK(next_send_counter * (6 + PACKET_SIZE) > 16384 / 2);
+    // un-parked after client caught up
+    client_read_packets();
+    CHECK(connection_ds->flags & DATA_SOURCE_CALLBACK_READ);
+    CHECK_EQUAL(0, num_closed);
+}
+
+TEST(SocketConnection, StalledClientClosed){
+    fill_socket();
+    int i;
+    for (i = 0; i < 32; i++){
+        send_counter_packet();
+    }
+    // connection is shut down instead of queuing more, read callback closes it
+    CHECK_EQUAL(0, connection_ds->flags & DATA_SOURCE_CALLBACK_WRITE);
+    CHECK(connection_ds->flags & DATA_SOURCE_CALLBACK_READ);
+    CHECK_EQUAL(0, num_closed);
+    connection_ds->process(connection_ds, DATA_SOURCE_CALLBACK_READ);
+    CHECK_EQUAL(1, num_closed);
+    CHECK_EQUAL(1, data_source_count());
+}
+
+TEST(SocketConnection, ParkedConnectionKeepsWriting){
+    // client sends packet that cannot be dispatched
+    uint8_t request[6 + 4];
+    little_endian_store_16(request, 0, HCI_COMMAND_DATA_PACKET);
+    little_endian_store_16(request, 2, 0);
+    little_endian_store_16(request, 4, 4);
+    memset(&request[6], 0, 4);
+    CHECK_EQUAL((int) sizeof(request), __real_write(client_fd, request, sizeof(request)));
+    dispatch_err = 1;
+    connection_ds->process(connection_ds, DATA_SOURCE_CALLBACK_READ);
+    connection_ds->process(connection_ds, DATA_SOURCE_CALLBACK_READ);
+    CHECK_EQUAL(1, num_dispatched);
+    CHECK(socket_connection_has_parked_connections());
+    CHECK_EQUAL(0, connection_ds->flags & DATA_SOURCE_CALLBACK_READ);
+
+    // output still works
+    fill_socket();
+    client_read_packets();
+
+    // retry succeeds
+    dispatch_err = 0;
+    socket_connection_retry_parked();
+    CHECK_EQUAL(2, num_dispatched);
+    CHECK_EQUAL(0, socket_connection_has_parked_connections());
+    CHECK(connection_ds->flags & DATA_SOURCE_CALLBACK_READ);
+}
+
+int main (int argc, const char * argv[]){
+    btstack_run_loop_init(&mock_run_loop);
+    socket_connection_init();
+    socket_connection_register_packet_callback(&packet_handler);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,106 @@
+/*
+ * tlv_posix_benchmark.c
+ *
+ * Reports the startup time of the POSIX TLV store for a database that holds a few hundred bonds
+ * and a log of frequent counter updates, once for the uncompacted log (replay and compaction on
+ * startup) and once for the compacted file. It also reports store throughput per sync policy.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_tlv.h"
+#include "btstack_tlv_posix.h"
+#include "btstack_util.h"
+#include "hci_dump.h"
+
+#define BENCHMARK_DB    "/tmp/tlv_posix_benchmark.tlv"
+#define NUM_BONDS       200
+#define BOND_SIZE       80
+#define NUM_UPDATES     200000
+#define NUM_STORES      2000
+
+static btstack_tlv_posix_t tlv_context;
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static uint32_t db_size(void){
+    struct stat st;
+    if (stat(BENCHMARK_DB, &st)) return 0;
+    return (uint32_t) st.st_size;
+}
+
+static void write_record(FILE * file, uint32_t tag, const uint8_t * data, uint32_t len){
+    uint8_t header[8];
+    big_endian_store_32(header, 0, tag);
+    big_endian_store_32(header, 4, len);
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(data, 1, len, file);
+}
+
+// log as written by previous versions, without compaction
+static void create_log(void){
+    uint8_t header[8] = "BTstack";
+    uint8_t bond[BOND_SIZE];
+    uint32_t i;
+    FILE * file = fopen(BENCHMARK_DB, "w");
+    fwrite(header, 1, sizeof(header), file);
+    for (i = 0; i < NUM_BONDS; i++){
+        memset(bond, i, sizeof(bond));
+        write_record(file, 0x42540000 | i, bond, sizeof(bond));
+    }
+    for (i = 0; i < NUM_UPDATES; i++){
+        write_record(file, 0x43540000 | (i % NUM_BONDS), (const uint8_t *) &i, sizeof(i));
+    }
+    fclose(file);
+}
+
+static void benchmark_startup(const char * name){
+    uint32_t size = db_size();
+    double start = now();
+    btstack_tlv_posix_init_instance(&tlv_context, BENCHMARK_DB);
+    double elapsed_s = now() - start;
+    printf("Startup %-12s %9u bytes -> %7u bytes, %5u entries, %8.3f ms\n", name, size, db_size(),
+        tlv_context.num_entries, elapsed_s * 1000.0);
+    btstack_tlv_posix_deinit(&tlv_context);
+}
+
+static void benchmark_store(const char * name, btstack_tlv_posix_sync_policy_t policy, uint16_t batch_size){
+    uint32_t i;
+    const btstack_tlv_t * tlv_impl = btstack_tlv_posix_init_instance(&tlv_context, BENCHMARK_DB);
+    btstack_tlv_posix_set_sync_policy(&tlv_context, policy, batch_size, 0);
+    double start = now();
+    for (i = 0; i < NUM_STORES; i++){
+        tlv_impl->store_tag(&tlv_context, 0x43540000 | (i % NUM_BONDS), (const uint8_t *) &i, sizeof(i));
+    }
+    btstack_tlv_posix_sync(&tlv_context);
+    double elapsed_s = now() - start;
+    printf("Store %-14s %9.0f stores/s, %u compactions\n", name, NUM_STORES / elapsed_s, tlv_context.num_compactions);
+    btstack_tlv_posix_deinit(&tlv_context);
+}
+
+int main(void){
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+
+    create_log();
+    benchmark_startup("log");
+    benchmark_startup("compacted");
+
+    benchmark_store("no sync", BTSTACK_TLV_POSIX_SYNC_NONE, 0);
+    benchmark_store("batched 32", BTSTACK_TLV_POSIX_SYNC_BATCHED, 32);
+    benchmark_store("always", BTSTACK_TLV_POSIX_SYNC_ALWAYS, 0);
+
+    unlink(BENCHMARK_DB);
+    return 0;
+}
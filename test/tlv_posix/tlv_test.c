@@ -2,12 +2,16 @@
 #include "CppUTest/TestHarness.h"
 #include "CppUTest/CommandLineTestRunner.h"
 
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
 #include "btstack_tlv.h"
 #include "btstack_tlv_posix.h"
 #include "hci_dump.h"
 #include "btstack_util.h"
 #include "btstack_config.h"
 #include "btstack_debug.h"
+#include <stdio.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #define TEST_DB "/tmp/test.tlv"
@@ -26,14 +30,19 @@ TEST_GROUP(BSTACK_TLV){
     void reopen_db(void){
     	log_info("reopen");
     	// close file 
-    	fclose(btstack_tlv_context.file);
+    	btstack_tlv_posix_deinit(&btstack_tlv_context);
     	// reopen
 		btstack_tlv_impl = btstack_tlv_posix_init_instance(&btstack_tlv_context, TEST_DB);
     }
+    uint32_t file_size(void){
+    	struct stat st;
+    	if (stat(TEST_DB, &st)) return 0;
+    	return (uint32_t) st.st_size;
+    }
     void teardown(void){
     	log_info("teardown");
     	// close file
-    	fclose(btstack_tlv_context.file);
+    	btstack_tlv_posix_deinit(&btstack_tlv_context);
     }
 };
 
@@ -158,7 +167,158 @@ TEST(BSTACK_TLV, TestWriteResetRead){
     CHECK_EQUAL(buffer, data);
 }
 
+TEST(BSTACK_TLV, TestWriteDeleteResetRead){
+    uint32_t tag = 'abcd';
+    uint8_t  data = 7;
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, &data, 1);
+    btstack_tlv_impl->delete_tag(&btstack_tlv_context, tag);
+
+    reopen_db();
+
+    int size = btstack_tlv_impl->get_tag(&btstack_tlv_context, tag, NULL, 0);
+    CHECK_EQUAL(size, 0);
+}
+
+TEST(BSTACK_TLV, TestGrowUpdateRead){
+    uint32_t tag = 'abcd';
+    uint8_t  data[100];
+    memset(data, 0x55, sizeof(data));
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, data, 1);
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, data, sizeof(data));
+    uint8_t buffer[100];
+    int size = btstack_tlv_impl->get_tag(&btstack_tlv_context, tag, buffer, sizeof(buffer));
+    CHECK_EQUAL(size, sizeof(data));
+    MEMCMP_EQUAL(data, buffer, sizeof(data));
+}
+
+TEST(BSTACK_TLV, TestManyTags){
+    uint32_t tag;
+    for (tag = 0; tag < 1000; tag++){
+        btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, (const uint8_t *) &tag, sizeof(tag));
+    }
+    btstack_tlv_impl->delete_tag(&btstack_tlv_context, 500);
+
+    reopen_db();
+
+    CHECK_EQUAL(999, btstack_tlv_context.num_entries);
+    CHECK(btstack_tlv_context.num_buckets * 2 >= btstack_tlv_context.num_entries);
+    for (tag = 0; tag < 1000; tag++){
+        uint32_t value = 0;
+        int size = btstack_tlv_impl->get_tag(&btstack_tlv_context, tag, (uint8_t *) &value, sizeof(value));
+        if (tag == 500){
+            CHECK_EQUAL(0, size);
+        } else {
+            CHECK_EQUAL(sizeof(value), size);
+            CHECK_EQUAL(tag, value);
+        }
+    }
+}
+
+TEST(BSTACK_TLV, TestCompaction){
+    uint32_t tag_counter = 'cntr';
+    uint32_t tag_key     = 'lkey';
+    uint8_t  key[16];
+    memset(key, 0xaa, sizeof(key));
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag_key, key, sizeof(key));
+
+    uint32_t counter;
+    for (counter = 0; counter < 10000; counter++){
+        btstack_tlv_impl->store_tag(&btstack_tlv_context, tag_counter, (const uint8_t *) &counter, sizeof(counter));
+    }
+    CHECK(btstack_tlv_context.num_compactions > 0);
+    // garbage is bounded by threshold
+    fflush(btstack_tlv_context.file);
+    CHECK(file_size() < 2 * BTSTACK_TLV_POSIX_COMPACTION_MIN_GARBAGE);
+    CHECK_EQUAL(btstack_tlv_context.file_size, file_size());
+
+    reopen_db();
+
+    uint32_t value = 0;
+    btstack_tlv_impl->get_tag(&btstack_tlv_context, tag_counter, (uint8_t *) &value, sizeof(value));
+    CHECK_EQUAL(counter - 1, value);
+    uint8_t buffer[16];
+    int size = btstack_tlv_impl->get_tag(&btstack_tlv_context, tag_key, buffer, sizeof(buffer));
+    CHECK_EQUAL(sizeof(key), size);
+    MEMCMP_EQUAL(key, buffer, sizeof(key));
+}
+
+TEST(BSTACK_TLV, TestCompactOnStartup){
+    uint32_t tag = 'abcd';
+    uint32_t counter;
+    // write log without compaction
+    for (counter = 0; counter < 1000; counter++){
+        uint8_t record[12];
+        big_endian_store_32(record, 0, tag);
+        big_endian_store_32(record, 4, sizeof(counter));
+        memcpy(&record[8], &counter, sizeof(counter));
+        fwrite(record, 1, sizeof(record), btstack_tlv_context.file);
+    }
+    fflush(btstack_tlv_context.file);
+    CHECK_EQUAL(8 + 1000 * 12, file_size());
+
+    reopen_db();
+
+    CHECK_EQUAL(1, btstack_tlv_context.num_compactions);
+    CHECK_EQUAL(8 + 12, file_size());
+    uint32_t value = 0;
+    btstack_tlv_impl->get_tag(&btstack_tlv_context, tag, (uint8_t *) &value, sizeof(value));
+    CHECK_EQUAL(999, value);
+}
+
+TEST(BSTACK_TLV, TestManualCompact){
+    uint32_t tag = 'abcd';
+    uint8_t  data = 7;
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, &data, 1);
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, &data, 1);
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, 'efgh', &data, 1);
+    btstack_tlv_impl->delete_tag(&btstack_tlv_context, 'efgh');
+    CHECK_EQUAL(0, btstack_tlv_posix_compact(&btstack_tlv_context));
+    CHECK_EQUAL(8 + 9, file_size());
+    data++;
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, &data, 1);
+
+    reopen_db();
+
+    uint8_t buffer = 0;
+    btstack_tlv_impl->get_tag(&btstack_tlv_context, tag, &buffer, 1);
+    CHECK_EQUAL(data, buffer);
+}
+
+TEST(BSTACK_TLV, TestSyncBatched){
+    uint32_t tag = 'abcd';
+    uint8_t  data = 7;
+    btstack_tlv_posix_set_sync_policy(&btstack_tlv_context, BTSTACK_TLV_POSIX_SYNC_BATCHED, 3, 0);
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, &data, 1);
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, &data, 1);
+    CHECK_EQUAL(2, btstack_tlv_context.unsynced_writes);
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, &data, 1);
+    CHECK_EQUAL(0, btstack_tlv_context.unsynced_writes);
+    CHECK_EQUAL(0, btstack_tlv_context.sync_timer_active);
+}
+
+TEST(BSTACK_TLV, TestSyncBatchedTimeout){
+    uint32_t tag = 'abcd';
+    uint8_t  data = 7;
+    btstack_tlv_posix_set_sync_policy(&btstack_tlv_context, BTSTACK_TLV_POSIX_SYNC_BATCHED, 10, 100);
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, &data, 1);
+    CHECK_EQUAL(1, btstack_tlv_context.unsynced_writes);
+    CHECK_EQUAL(1, btstack_tlv_context.sync_timer_active);
+    btstack_tlv_posix_sync(&btstack_tlv_context);
+    CHECK_EQUAL(0, btstack_tlv_context.unsynced_writes);
+    CHECK_EQUAL(0, btstack_tlv_context.sync_timer_active);
+}
+
+TEST(BSTACK_TLV, TestSyncAlways){
+    uint32_t tag = 'abcd';
+    uint8_t  data = 7;
+    btstack_tlv_posix_set_sync_policy(&btstack_tlv_context, BTSTACK_TLV_POSIX_SYNC_ALWAYS, 0, 0);
+    btstack_tlv_impl->store_tag(&btstack_tlv_context, tag, &data, 1);
+    CHECK_EQUAL(0, btstack_tlv_context.unsynced_writes);
+    CHECK_EQUAL(8 + 9, file_size());
+}
+
 int main (int argc, const char * argv[]){
+	btstack_run_loop_init(btstack_run_loop_posix_get_instance());
 	hci_dump_open("tlv_test.pklg", HCI_DUMP_PACKETLOGGER);
     return CommandLineTestRunner::RunAllTests(argc, argv);
 }
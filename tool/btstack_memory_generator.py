@@ -67,9 +67,12 @@ extern "C" {
 #include "classic/btstack_link_key_db_memory.h"
 #include "classic/rfcomm.h"
 #include "classic/sdp_server.h"
+#include "classic/sdp_client.h"
 #include "classic/avdtp_sink.h"
 #include "classic/avdtp_source.h"
 #include "classic/avrcp.h"
+#include "classic/goep_client.h"
+#include "classic/pbap_client.h"
 
 // BLE
 #ifdef ENABLE_BLE
@@ -179,10 +182,12 @@ list_of_structs = [
     ["bnep_service", "bnep_channel"],
     ["hfp_connection"],
     ["service_record_item"],
+    ["sdp_client"],
     ["avdtp_stream_endpoint"],
     ["avdtp_connection"],
     ["avrcp_connection"],
-    ["avrcp_browsing_connection"]    
+    ["avrcp_browsing_connection"],
+    ["goep_client", "pbap_client"]
 ]
 list_of_le_structs = [["gatt_client", "whitelist_entry", "sm_lookup_entry"]]
 
@@ -27,7 +27,9 @@ const uint8_t profile_data[] =
 '''
 
 usage = '''
-Usage: ./compile_gatt.py profile.gatt profile.h
+Usage: ./compile_gatt.py [--index] profile.gatt profile.h
+
+    --index  also generate profile_data_index for att_set_db_index
 '''
 
 
@@ -97,6 +99,7 @@ defines_for_services = []
 
 handle = 1
 total_size = 0
+db_bytes = []
 
 def read_defines(infile):
     defines = dict()
@@ -156,13 +159,16 @@ def parseProperties(properties):
 
 def write_8(fout, value):
     fout.write( "0x%02x, " % (value & 0xff))
+    db_bytes.append(value & 0xff)
 
 def write_16(fout, value):
     fout.write('0x%02x, 0x%02x, ' % (value & 0xff, (value >> 8) & 0xff))
+    db_bytes.extend([value & 0xff, (value >> 8) & 0xff])
 
 def write_uuid(uuid):
     for byte in uuid:
         fout.write( "0x%02x, " % byte)
+        db_bytes.append(byte)
 
 def write_string(fout, text):
     for l in text.lstrip('"').rstrip('"'):
@@ -172,6 +178,7 @@ def write_sequence(fout, text):
     parts = text.split()
     for part in parts:
         fout.write("0x%s, " % (part.strip()))
+        db_bytes.append(int(part.strip(), 16))
 
 def write_indent(fout):
     fout.write("    ")
@@ -706,7 +713,50 @@ def listHandles(fout):
         fout.write(define)
         fout.write('\n')
 
-if (len(sys.argv) < 3):
+def listIndex(fout):
+    # see att_db_index_create in att_db.c for layout
+    offsets = dict()
+    services = []
+    offset = 0
+    while True:
+        size = db_bytes[offset] | (db_bytes[offset+1] << 8)
+        if size == 0:
+            end_offset = offset
+            break
+        flags  = db_bytes[offset+2] | (db_bytes[offset+3] << 8)
+        handle = db_bytes[offset+4] | (db_bytes[offset+5] << 8)
+        offsets[handle] = offset
+        if flags & property_flags['LONG_UUID'] == 0:
+            uuid16 = db_bytes[offset+6] | (db_bytes[offset+7] << 8)
+            if uuid16 in [0x2800, 0x2801]:
+                services.append([handle, handle])
+        if len(services) > 0:
+            services[-1][1] = handle
+        offset = offset + size
+    num_handles = max(offsets.keys()) if len(offsets) > 0 else 0
+    fout.write('\n')
+    fout.write('//\n')
+    fout.write('// index for handle and service lookup, see att_set_db_index\n')
+    fout.write('//\n')
+    fout.write('const uint16_t profile_data_index[] =\n')
+    fout.write('{\n')
+    fout.write('    // number of handles\n')
+    fout.write('    0x%04x,\n' % num_handles)
+    fout.write('    // attribute offsets\n')
+    for attribute_handle in range(1, num_handles + 1):
+        fout.write('    0x%04x, // 0x%04x\n' % (offsets.get(attribute_handle, 0xffff), attribute_handle))
+    fout.write('    // END\n')
+    fout.write('    0x%04x,\n' % end_offset)
+    fout.write('    // number of services\n')
+    fout.write('    0x%04x,\n' % len(services))
+    fout.write('    // service handle ranges\n')
+    for service in services:
+        fout.write('    0x%04x, 0x%04x,\n' % (service[0], service[1]))
+    fout.write('};\n')
+
+generate_index = '--index' in sys.argv[1:]
+args = [arg for arg in sys.argv[1:] if arg != '--index']
+if (len(args) < 2):
     print(usage)
     sys.exit(1)
 try:
@@ -715,10 +765,12 @@ try:
     gen_path = btstack_root + '/src/bluetooth_gatt.h'
     bluetooth_gatt = read_defines(gen_path)
 
-    filename = sys.argv[2]
-    fin  = codecs.open (sys.argv[1], encoding='utf-8')
+    filename = args[1]
+    fin  = codecs.open (args[0], encoding='utf-8')
     fout = open (filename, 'w')
-    parse(sys.argv[1], fin, filename, fout)
+    parse(args[0], fin, filename, fout)
+    if generate_index:
+        listIndex(fout)
     listHandles(fout)    
     fout.close()
     print('Created %s' % filename)